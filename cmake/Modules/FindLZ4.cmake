@@ -0,0 +1,24 @@
+# Try to find lz4 (frame API)
+# Once done, this will define
+#
+# LZ4_FOUND       - system has lz4
+# LZ4_INCLUDE_DIR - the lz4 include directory
+# LZ4_LIBRARIES   - the lz4 library name(s)
+
+find_path(LZ4_INCLUDE_DIR lz4frame.h
+  HINTS
+  $ENV{LZ4_DIR}
+  PATH_SUFFIXES include/
+  )
+
+find_library(LZ4_LIBRARY lz4
+  HINTS
+  $ENV{LZ4_DIR}
+  PATH_SUFFIXES lib
+  )
+
+set(LZ4_LIBRARIES ${LZ4_LIBRARY})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4 DEFAULT_MSG LZ4_LIBRARY LZ4_INCLUDE_DIR)
+mark_as_advanced(LZ4_INCLUDE_DIR LZ4_LIBRARY)
@@ -0,0 +1,24 @@
+# Try to find zstd
+# Once done, this will define
+#
+# ZSTD_FOUND       - system has zstd
+# ZSTD_INCLUDE_DIR - the zstd include directory
+# ZSTD_LIBRARIES   - the zstd library name(s)
+
+find_path(ZSTD_INCLUDE_DIR zstd.h
+  HINTS
+  $ENV{ZSTD_DIR}
+  PATH_SUFFIXES include/
+  )
+
+find_library(ZSTD_LIBRARY zstd
+  HINTS
+  $ENV{ZSTD_DIR}
+  PATH_SUFFIXES lib
+  )
+
+set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(ZSTD DEFAULT_MSG ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
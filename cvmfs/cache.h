@@ -81,6 +81,18 @@ class CacheManager : SingleCopy {
     kTypeVolatile,
   };
 
+  /**
+   * Optional features of a cache manager.
+   */
+  enum Capabilities {
+    /**
+     * File descriptors returned by Open() are descriptors of regular files
+     * that can be read by the kernel directly, e.g. spliced into the fuse
+     * device.
+     */
+    kCapFileDescriptor = 0,
+  };
+
   /**
    * Meta-data of an object that the cache may or may not maintain.  Good cache
    * implementations should at least distinguish between volatile and regular
@@ -156,6 +168,7 @@ class CacheManager : SingleCopy {
   virtual std::string Describe() = 0;
 
   virtual bool AcquireQuotaManager(QuotaManager *quota_mgr) = 0;
+  virtual bool HasCapability(Capabilities /*capability*/) { return false; }
 
   virtual ~CacheManager();
   /**
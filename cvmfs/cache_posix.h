@@ -74,6 +74,9 @@ class PosixCacheManager : public CacheManager {
     const RenameWorkarounds rename_workaround = kRenameNormal);
   virtual ~PosixCacheManager() { }
   virtual bool AcquireQuotaManager(QuotaManager *quota_mgr);
+  virtual bool HasCapability(Capabilities capability) {
+    return capability == kCapFileDescriptor;
+  }
 
   virtual int Open(const BlessedObject &object);
   virtual int64_t GetSize(int fd);
@@ -41,6 +41,9 @@ class TieredCacheManager : public CacheManager {
     quota_mgr_ = upper_->quota_mgr();
     return result;
   }
+  virtual bool HasCapability(Capabilities capability) {
+    return upper_->HasCapability(capability);
+  }
 
   virtual int Open(const BlessedObject &object);
   virtual int64_t GetSize(int fd) {return upper_->GetSize(fd);}
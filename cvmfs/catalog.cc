@@ -9,11 +9,15 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
+#include "catalog_index.h"
 #include "catalog_mgr.h"
+#include "globals.h"
 #include "logging.h"
 #include "platform.h"
 #include "smalloc.h"
+#include "statistics.h"
 #include "util_concurrency.h"
 
 using namespace std;  // NOLINT
@@ -22,6 +26,20 @@ namespace catalog {
 
 const shash::Md5 Catalog::kMd5PathEmpty("", 0);
 
+namespace {
+
+/**
+ * Variant symlinks are rare; they are expanded by the SQL code path.
+ */
+bool NeedsSymlinkExpansion(const DirectoryEntry &dirent) {
+  if (g_raw_symlinks)
+    return false;
+  const LinkString &symlink = dirent.symlink();
+  return memchr(symlink.GetChars(), '$', symlink.GetLength()) != NULL;
+}
+
+}  // anonymous namespace
+
 
 /**
  * Open a catalog outside the framework of a catalog manager.
@@ -78,13 +96,37 @@ Catalog::Catalog(const PathString &mountpoint,
   sql_all_chunks_ = NULL;
   sql_chunks_listing_ = NULL;
   sql_lookup_xattrs_ = NULL;
+
+  is_index_enabled_ = false;
+  index_max_entries_ = 0;
+  sz_index_bytes_ = NULL;
+  index_ = NULL;
+  atomic_init32(&index_state_);
+
+  atomic_init32(&next_read_connection_);
+  hardlink_lock_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(hardlink_lock_, NULL);
+  assert(retval == 0);
 }
 
 
 Catalog::~Catalog() {
+  for (unsigned i = 0; i < read_connections_.size(); ++i) {
+    delete read_connections_[i].sql_listing;
+    delete read_connections_[i].sql_lookup_md5path;
+    delete read_connections_[i].database;
+    pthread_mutex_destroy(read_connections_[i].lock);
+    free(read_connections_[i].lock);
+  }
+  pthread_mutex_destroy(hardlink_lock_);
+  free(hardlink_lock_);
   pthread_mutex_destroy(lock_);
   free(lock_);
   FinalizePreparedStatements();
+  if ((index_ != NULL) && (sz_index_bytes_ != NULL))
+    perf::Xadd(sz_index_bytes_, -static_cast<int64_t>(index_->GetMemory()));
+  delete index_;
   delete database_;
 }
 
@@ -234,6 +276,77 @@ bool Catalog::OpenDatabase(const string &db_path) {
 }
 
 
+/**
+ * Opens another read-only connection to the already opened catalog database.
+ * Must be called before the catalog is used by multiple threads.  The
+ * database file name can differ from the one of the main connection, e.g.
+ * for a duplicated cache manager file descriptor.
+ */
+bool Catalog::AddReadConnection(const string &db_path) {
+  assert(database_ != NULL);
+  CatalogDatabase *database =
+    CatalogDatabase::Open(db_path, CatalogDatabase::kOpenReadOnly);
+  if (database == NULL) {
+    LogCvmfs(kLogCatalog, kLogDebug,
+             "failed to open additional connection to %s", db_path.c_str());
+    return false;
+  }
+  // Apply the fix-ups of the main connection, see OpenDatabase()
+  database->EnforceSchema(database_->schema_version(),
+                          database_->schema_revision());
+
+  ReadConnection connection;
+  connection.database = database;
+  connection.sql_lookup_md5path = new SqlLookupPathHash(*database);
+  connection.sql_listing = new SqlListing(*database);
+  connection.lock =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  int retval = pthread_mutex_init(connection.lock, NULL);
+  assert(retval == 0);
+  read_connections_.push_back(connection);
+  return true;
+}
+
+
+Catalog::ReadConnection Catalog::GetReadConnection(unsigned idx) const {
+  if (idx > 0)
+    return read_connections_[idx - 1];
+
+  ReadConnection connection;
+  connection.database = database_;
+  connection.sql_lookup_md5path = sql_lookup_md5path_;
+  connection.sql_listing = sql_listing_;
+  connection.lock = lock_;
+  return connection;
+}
+
+
+/**
+ * Returns a locked connection.  Prefers an idle one, starting the search at
+ * a different connection on every call.  If all connections are busy, waits
+ * for the first one tried.
+ */
+Catalog::ReadConnection Catalog::AcquireReadConnection() const {
+  const unsigned num_connections = read_connections_.size() + 1;
+  unsigned start = 0;
+  if (num_connections > 1) {
+    start = static_cast<uint32_t>(atomic_xadd32(&next_read_connection_, 1)) %
+            num_connections;
+    for (unsigned i = 0; i < num_connections; ++i) {
+      ReadConnection connection =
+        GetReadConnection((start + i) % num_connections);
+      if (pthread_mutex_trylock(connection.lock) == 0)
+        return connection;
+    }
+  }
+
+  ReadConnection connection = GetReadConnection(start);
+  int retval = pthread_mutex_lock(connection.lock);
+  assert(retval == 0);
+  return connection;
+}
+
+
 /**
  * Removes the mountpoint and prepends the root prefix to path
  */
@@ -305,14 +418,31 @@ bool Catalog::LookupEntry(const shash::Md5 &md5path, const bool expand_symlink,
 {
   assert(IsInitialized());
 
-  MutexLockGuard m(lock_);
-  sql_lookup_md5path_->BindPathHash(md5path);
-  bool found = sql_lookup_md5path_->FetchRow();
+  const CatalogIndex *index = GetIndex();
+  if (index != NULL) {
+    const DirectoryEntry *indexed_dirent = index->Lookup(md5path);
+    if (indexed_dirent == NULL)
+      return false;
+    if (!expand_symlink || !NeedsSymlinkExpansion(*indexed_dirent)) {
+      if (dirent != NULL) {
+        *dirent = *indexed_dirent;
+        AnnotateIndexedEntry(dirent);
+        FixTransitionPoint(md5path, dirent);
+      }
+      return true;
+    }
+  }
+
+  const ReadConnection connection = AcquireReadConnection();
+  SqlLookupPathHash *sql_lookup_md5path = connection.sql_lookup_md5path;
+  sql_lookup_md5path->BindPathHash(md5path);
+  bool found = sql_lookup_md5path->FetchRow();
   if (found && (dirent != NULL)) {
-    *dirent = sql_lookup_md5path_->GetDirent(this, expand_symlink);
+    *dirent = sql_lookup_md5path->GetDirent(this, expand_symlink);
     FixTransitionPoint(md5path, dirent);
   }
-  sql_lookup_md5path_->Reset();
+  sql_lookup_md5path->Reset();
+  ReleaseReadConnection(connection);
 
   return found;
 }
@@ -374,10 +504,39 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
   DirectoryEntry dirent;
   StatEntry entry;
 
-  MutexLockGuard m(lock_);
-  sql_listing_->BindPathHash(md5path);
-  while (sql_listing_->FetchRow()) {
-    dirent = sql_listing_->GetDirent(this);
+  const CatalogIndex *index = GetIndex();
+  if (index != NULL) {
+    unsigned begin;
+    unsigned end;
+    index->ListingRange(md5path, &begin, &end);
+    bool has_variant_symlinks = false;
+    for (unsigned i = begin; i < end; ++i) {
+      if (NeedsSymlinkExpansion(index->GetListingEntry(i))) {
+        has_variant_symlinks = true;
+        break;
+      }
+    }
+    if (!has_variant_symlinks) {
+      for (unsigned i = begin; i < end; ++i) {
+        const DirectoryEntry &indexed_dirent = index->GetListingEntry(i);
+        if (indexed_dirent.IsHidden())
+          continue;
+        dirent = indexed_dirent;
+        AnnotateIndexedEntry(&dirent);
+        FixTransitionPoint(md5path, &dirent);
+        entry.name = dirent.name();
+        entry.info = dirent.GetStatStructure();
+        listing->PushBack(entry);
+      }
+      return true;
+    }
+  }
+
+  const ReadConnection connection = AcquireReadConnection();
+  SqlListing *sql_listing = connection.sql_listing;
+  sql_listing->BindPathHash(md5path);
+  while (sql_listing->FetchRow()) {
+    dirent = sql_listing->GetDirent(this);
     if (dirent.IsHidden())
       continue;
     FixTransitionPoint(md5path, &dirent);
@@ -385,7 +544,8 @@ bool Catalog::ListingMd5PathStat(const shash::Md5 &md5path,
     entry.info = dirent.GetStatStructure();
     listing->PushBack(entry);
   }
-  sql_listing_->Reset();
+  sql_listing->Reset();
+  ReleaseReadConnection(connection);
 
   return true;
 }
@@ -405,15 +565,16 @@ bool Catalog::ListingMd5Path(const shash::Md5 &md5path,
 {
   assert(IsInitialized());
 
-  MutexLockGuard m(lock_);
-
-  sql_listing_->BindPathHash(md5path);
-  while (sql_listing_->FetchRow()) {
-    DirectoryEntry dirent = sql_listing_->GetDirent(this, expand_symlink);
+  const ReadConnection connection = AcquireReadConnection();
+  SqlListing *sql_listing = connection.sql_listing;
+  sql_listing->BindPathHash(md5path);
+  while (sql_listing->FetchRow()) {
+    DirectoryEntry dirent = sql_listing->GetDirent(this, expand_symlink);
     FixTransitionPoint(md5path, &dirent);
     listing->push_back(dirent);
   }
-  sql_listing_->Reset();
+  sql_listing->Reset();
+  ReleaseReadConnection(connection);
 
   return true;
 }
@@ -598,22 +759,25 @@ inode_t Catalog::GetMangledInode(const uint64_t row_id,
     return DirectoryEntry::kInvalidInode;
   }
 
-  inode_t inode = row_id + inode_range_.offset;
+  uint64_t inode_row_id = row_id;
 
   // Hardlinks are encoded in catalog-wide unique hard link group ids.
   // These ids must be resolved to actual inode relationships at runtime.
   if (hardlink_group > 0) {
+    MutexLockGuard m(hardlink_lock_);
     HardlinkGroupMap::const_iterator inode_iter =
       hardlink_groups_.find(hardlink_group);
 
     // Use cached entry if possible
     if (inode_iter == hardlink_groups_.end()) {
-      hardlink_groups_[hardlink_group] = inode;
+      hardlink_groups_[hardlink_group] = row_id;
     } else {
-      inode = inode_iter->second;
+      inode_row_id = inode_iter->second;
     }
   }
 
+  inode_t inode = inode_row_id + inode_range_.offset;
+
   if (inode_annotation_) {
     inode = inode_annotation_->Annotate(inode);
   }
@@ -622,6 +786,29 @@ inode_t Catalog::GetMangledInode(const uint64_t row_id,
 }
 
 
+/**
+ * Reverts GetMangledInode() for entries that are not hard links.  Unlike the
+ * inode, the row id is stable across mounts of the same catalog.
+ * @return false if the inode was not issued by this catalog
+ */
+bool Catalog::DemangleInode(const inode_t inode, uint64_t *row_id) const {
+  if (!IsInitialized() || inode_range_.IsDummy())
+    return false;
+
+  inode_t raw_inode = inode;
+  if (inode_annotation_) {
+    if (!inode_annotation_->ValidInode(inode))
+      return false;
+    raw_inode = inode_annotation_->Strip(inode);
+  }
+  if (!inode_range_.ContainsInode(raw_inode))
+    return false;
+
+  *row_id = raw_inode - inode_range_.offset;
+  return true;
+}
+
+
 /**
  * Get a list of all registered nested catalogs and bind mountpoints in this
  * catalog.
@@ -817,6 +1004,94 @@ Catalog* Catalog::FindChild(const PathString &mountpoint) const {
 }
 
 
+/**
+ * Returns NULL if the index is disabled, the catalog is too large, or the
+ * index could not be built.  The first caller builds the index under the
+ * catalog lock.  The state is published with
+ * a memory barrier so that later callers can use the index without the lock.
+ */
+const CatalogIndex *Catalog::GetIndex() const {
+  if (!is_index_enabled_)
+    return NULL;
+
+  int32_t state = atomic_read32(&index_state_);
+  if (state == kIndexNone) {
+    MutexLockGuard m(lock_);
+    state = atomic_read32(&index_state_);
+    if (state == kIndexNone) {
+      state = BuildIndex() ? kIndexReady : kIndexFailed;
+      atomic_write32(&index_state_, state);
+    }
+  }
+  return (state == kIndexReady) ? index_ : NULL;
+}
+
+
+/**
+ * Reads all directory entries in a single table scan.  Runs under lock_, which
+ * protects the main database connection.  Catalogs above index_max_entries_
+ * are not indexed, so that the scan and the memory stay bounded.  The entry
+ * counters can be missing in old catalogs, so the limit is checked during the
+ * scan as well.
+ */
+bool Catalog::BuildIndex() const {
+  assert(index_ == NULL);
+  if (counters_.GetSelfEntries() > index_max_entries_) {
+    LogCvmfs(kLogCatalog, kLogDebug, "catalog %s too large for an index",
+             mountpoint_.c_str());
+    return false;
+  }
+  CatalogIndex *index = new CatalogIndex();
+  SqlAllEntries sql_all_entries(database());
+  while (sql_all_entries.FetchRow()) {
+    if (index->size() >= index_max_entries_) {
+      LogCvmfs(kLogCatalog, kLogDebug, "catalog %s too large for an index",
+               mountpoint_.c_str());
+      delete index;
+      return false;
+    }
+    DirectoryEntry dirent = sql_all_entries.GetDirent(this, false);
+    if (!inode_range_.IsDummy()) {
+      inode_t inode = dirent.inode();
+      if (inode_annotation_ != NULL)
+        inode = inode_annotation_->Strip(inode);
+      dirent.set_inode(inode - inode_range_.offset);
+    }
+    index->Add(sql_all_entries.GetPathHash(),
+               sql_all_entries.GetParentPathHash(),
+               dirent);
+  }
+  if (sql_all_entries.GetLastError() != SQLITE_DONE) {
+    LogCvmfs(kLogCatalog, kLogDebug | kLogSyslogWarn,
+             "failed to build index of catalog %s (%d), using SQLite lookups",
+             mountpoint_.c_str(), sql_all_entries.GetLastError());
+    delete index;
+    return false;
+  }
+  index->Freeze();
+  index_ = index;
+  if (sz_index_bytes_ != NULL)
+    perf::Xadd(sz_index_bytes_, index_->GetMemory());
+  LogCvmfs(kLogCatalog, kLogDebug, "built index of %u entries for catalog %s",
+           index_->size(), mountpoint_.c_str());
+  return true;
+}
+
+
+/**
+ * Applies the current inode range and inode generation, which might have
+ * changed since the index was built.
+ */
+void Catalog::AnnotateIndexedEntry(DirectoryEntry *dirent) const {
+  if (inode_range_.IsDummy())
+    return;
+  inode_t inode = dirent->inode() + inode_range_.offset;
+  if (inode_annotation_ != NULL)
+    inode = inode_annotation_->Annotate(inode);
+  dirent->set_inode(inode);
+}
+
+
 /**
  * For the transtion points for nested catalogs and bind mountpoints, the inode
  * is ambiguous. It has to be set to the parent inode because nested catalogs
@@ -13,6 +13,7 @@
 #include <string>
 #include <vector>
 
+#include "atomic.h"
 #include "catalog_counters.h"
 #include "catalog_sql.h"
 #include "directory_entry.h"
@@ -24,6 +25,10 @@
 #include "uid_map.h"
 #include "xattr.h"
 
+namespace perf {
+class Counter;
+}
+
 namespace swissknife {
 class CommandMigrate;
 }
@@ -34,6 +39,7 @@ template <class CatalogT>
 class AbstractCatalogManager;
 
 class Catalog;
+class CatalogIndex;
 
 class Counters;
 
@@ -120,6 +126,7 @@ class Catalog : SingleCopy {
                                const bool          is_nested = false);
 
   bool OpenDatabase(const std::string &db_path);
+  bool AddReadConnection(const std::string &db_path);
 
   inline bool LookupPath(const PathString &path, DirectoryEntry *dirent) const {
     return LookupMd5Path(NormalizePath(path), dirent);
@@ -214,8 +221,21 @@ class Catalog : SingleCopy {
   void SetInodeAnnotation(InodeAnnotation *new_annotation);
   inode_t GetMangledInode(const uint64_t row_id,
                           const uint64_t hardlink_group) const;
+  bool DemangleInode(const inode_t inode, uint64_t *row_id) const;
 
   void SetOwnerMaps(const OwnerMap *uid_map, const OwnerMap *gid_map);
+  /**
+   * Path lookups and stat listings are answered from a CatalogIndex without
+   * taking the catalog lock.  The index is built on first use.  Only for
+   * read-only catalogs.  Catalogs with more than max_entries entries keep
+   * using SQLite.  The memory of the index is accounted in sz_index_bytes,
+   * which can be NULL.
+   */
+  void EnableIndex(const uint64_t max_entries, perf::Counter *sz_index_bytes) {
+    is_index_enabled_ = true;
+    index_max_entries_ = max_entries;
+    sz_index_bytes_ = sz_index_bytes;
+  }
   uint64_t MapUid(const uint64_t uid) const {
     if (uid_map_) { return uid_map_->Map(uid); }
     return uid;
@@ -226,7 +246,11 @@ class Catalog : SingleCopy {
   }
 
  protected:
-  typedef std::map<uint64_t, inode_t> HardlinkGroupMap;
+  /**
+   * Maps hardlink groups to the row id of their first looked up entry.  Row
+   * ids instead of inodes keep the map valid if the inode range changes.
+   */
+  typedef std::map<uint64_t, uint64_t> HardlinkGroupMap;
   mutable HardlinkGroupMap hardlink_groups_;
 
   pthread_mutex_t *lock_;
@@ -276,6 +300,31 @@ class Catalog : SingleCopy {
   void FixTransitionPoint(const shash::Md5 &md5path,
                           DirectoryEntry *dirent) const;
 
+  const CatalogIndex *GetIndex() const;
+  bool BuildIndex() const;
+  void AnnotateIndexedEntry(DirectoryEntry *dirent) const;
+
+  /**
+   * A connection to the catalog database with its own prepared statements
+   * for path lookups and listings.  Queries on different connections run in
+   * parallel.  Connection 0 is the main connection, guarded by lock_.
+   */
+  struct ReadConnection {
+    ReadConnection()
+      : database(NULL), sql_lookup_md5path(NULL), sql_listing(NULL)
+      , lock(NULL) { }
+    CatalogDatabase *database;
+    SqlLookupPathHash *sql_lookup_md5path;
+    SqlListing *sql_listing;
+    pthread_mutex_t *lock;
+  };
+  ReadConnection GetReadConnection(unsigned idx) const;
+  ReadConnection AcquireReadConnection() const;
+  void ReleaseReadConnection(const ReadConnection &connection) const {
+    int retval = pthread_mutex_unlock(connection.lock);
+    assert(retval == 0);
+  }
+
   bool LookupXattrsMd5Path(const shash::Md5 &md5path, XattrList *xattrs) const;
   bool ListMd5PathChunks(const shash::Md5 &md5path,
                          const shash::Algorithms interpret_hashes_as,
@@ -335,6 +384,31 @@ class Catalog : SingleCopy {
   SqlLookupXattrs             *sql_lookup_xattrs_;
 
   mutable HashVector        referenced_hashes_;
+
+  enum IndexState {
+    kIndexNone = 0,
+    kIndexReady,
+    kIndexFailed,
+  };
+  bool is_index_enabled_;
+  uint64_t index_max_entries_;
+  perf::Counter *sz_index_bytes_;
+  /**
+   * Written once under lock_, then read without the lock once index_state_
+   * is kIndexReady
+   */
+  mutable CatalogIndex *index_;
+  mutable atomic_int32 index_state_;
+
+  /**
+   * Additional read-only connections, fixed before the catalog is shared
+   */
+  std::vector<ReadConnection> read_connections_;
+  mutable atomic_int32 next_read_connection_;
+  /**
+   * Protects hardlink_groups_, which is used from all read connections
+   */
+  pthread_mutex_t *hardlink_lock_;
 };  // class Catalog
 
 }  // namespace catalog
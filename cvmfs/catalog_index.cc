@@ -0,0 +1,69 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+void CatalogIndex::Add(
+  const shash::Md5 &md5path,
+  const shash::Md5 &parent_md5path,
+  const DirectoryEntry &dirent)
+{
+  assert(!is_frozen_);
+  Entry entry;
+  entry.md5path = Key(md5path);
+  entry.parent = Key(parent_md5path);
+  entry.sequence = entries_.size();
+  entry.dirent = dirent;
+  entries_.push_back(entry);
+}
+
+
+/**
+ * Sorts the tables.  No more entries can be added afterwards.
+ */
+void CatalogIndex::Freeze() {
+  assert(!is_frozen_);
+  sort(entries_.begin(), entries_.end(), EntryLessByPath());
+  listing_.reserve(entries_.size());
+  for (unsigned i = 0; i < entries_.size(); ++i)
+    listing_.push_back(i);
+  sort(listing_.begin(), listing_.end(), PositionLessByParent(&entries_));
+  is_frozen_ = true;
+}
+
+
+const DirectoryEntry *CatalogIndex::Lookup(const shash::Md5 &md5path) const {
+  assert(is_frozen_);
+  const Key key(md5path);
+  vector<Entry>::const_iterator i =
+    lower_bound(entries_.begin(), entries_.end(), key, EntryLessByPath());
+  if ((i == entries_.end()) || !(i->md5path == key))
+    return NULL;
+  return &i->dirent;
+}
+
+
+void CatalogIndex::ListingRange(
+  const shash::Md5 &parent_md5path,
+  unsigned *begin,
+  unsigned *end) const
+{
+  assert(is_frozen_);
+  const Key parent(parent_md5path);
+  const PositionLessByParent less(&entries_);
+  *begin = lower_bound(listing_.begin(), listing_.end(), parent, less) -
+           listing_.begin();
+  *end = upper_bound(listing_.begin(), listing_.end(), parent, less) -
+         listing_.begin();
+}
+
+}  // namespace catalog
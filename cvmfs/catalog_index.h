@@ -0,0 +1,124 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_INDEX_H_
+#define CVMFS_CATALOG_INDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "directory_entry.h"
+#include "hash.h"
+#include "util/single_copy.h"
+
+namespace catalog {
+
+/**
+ * Immutable in-memory copy of the directory entries of a client catalog,
+ * sorted by path hash with a second table sorted by parent path hash for
+ * listings.  Lookups are binary searches that neither take the catalog lock
+ * nor run the SQLite virtual machine.
+ *
+ * The entries are stored as they come from SqlLookup::GetDirent() without
+ * symlink expansion.  Their inodes are stored without the inode annotation and
+ * relative to the catalog's inode range, so that the catalog can apply the
+ * current inode range and generation on every lookup.  Extended attributes
+ * and chunk lists are not part of the index.
+ */
+class CatalogIndex : SingleCopy {
+ public:
+  CatalogIndex() : is_frozen_(false) { }
+
+  void Add(const shash::Md5 &md5path, const shash::Md5 &parent_md5path,
+           const DirectoryEntry &dirent);
+  void Freeze();
+
+  const DirectoryEntry *Lookup(const shash::Md5 &md5path) const;
+  /**
+   * The children of parent_md5path are at the listing positions [begin, end)
+   * in the order of the catalog table.
+   */
+  void ListingRange(const shash::Md5 &parent_md5path,
+                    unsigned *begin, unsigned *end) const;
+  const DirectoryEntry &GetListingEntry(unsigned position) const {
+    return entries_[listing_[position]].dirent;
+  }
+
+  unsigned size() const { return entries_.size(); }
+  /**
+   * Bytes taken by the tables, not counting names and symlinks that are too
+   * long for the inline storage of their ShortString
+   */
+  uint64_t GetMemory() const {
+    return entries_.capacity() * sizeof(Entry) +
+           listing_.capacity() * sizeof(unsigned);
+  }
+
+ private:
+  struct Key {
+    Key() : lo(0), hi(0) { }
+    explicit Key(const shash::Md5 &md5) { md5.ToIntPair(&lo, &hi); }
+    bool operator <(const Key &other) const {
+      return (hi < other.hi) || ((hi == other.hi) && (lo < other.lo));
+    }
+    bool operator ==(const Key &other) const {
+      return (hi == other.hi) && (lo == other.lo);
+    }
+    uint64_t lo;
+    uint64_t hi;
+  };
+
+  struct Entry {
+    Key md5path;
+    Key parent;
+    /**
+     * Position in the order of Add() calls
+     */
+    unsigned sequence;
+    DirectoryEntry dirent;
+  };
+
+  struct EntryLessByPath {
+    bool operator()(const Entry &a, const Entry &b) const {
+      return a.md5path < b.md5path;
+    }
+    bool operator()(const Entry &a, const Key &b) const {
+      return a.md5path < b;
+    }
+  };
+
+  struct PositionLessByParent {
+    explicit PositionLessByParent(const std::vector<Entry> *e) : entries(e) { }
+    bool operator()(unsigned a, unsigned b) const {
+      const Entry &ea = (*entries)[a];
+      const Entry &eb = (*entries)[b];
+      if (ea.parent == eb.parent)
+        return ea.sequence < eb.sequence;
+      return ea.parent < eb.parent;
+    }
+    bool operator()(unsigned a, const Key &b) const {
+      return (*entries)[a].parent < b;
+    }
+    bool operator()(const Key &a, unsigned b) const {
+      return a < (*entries)[b].parent;
+    }
+    const std::vector<Entry> *entries;
+  };
+
+  /**
+   * Sorted by path hash after Freeze()
+   */
+  std::vector<Entry> entries_;
+  /**
+   * Positions in entries_, sorted by parent path hash.  Entries with the same
+   * parent keep the order in which they were added.
+   */
+  std::vector<unsigned> listing_;
+  bool is_frozen_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_INDEX_H_
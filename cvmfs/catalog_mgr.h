@@ -72,6 +72,7 @@ struct Statistics {
   perf::Counter *n_listing;
   perf::Counter *n_nested_listing;
   perf::Counter *n_detach_siblings;
+  perf::Counter *n_reused_catalogs;
 
   explicit Statistics(perf::Statistics *statistics) {
     n_lookup_inode = statistics->Register("catalog_mgr.n_lookup_inode",
@@ -89,6 +90,8 @@ struct Statistics {
         "Number of listings of nested catalogs");
     n_detach_siblings = statistics->Register("catalog_mgr.n_detach_siblings",
         "Number of times the CVMFS_CATALOG_WATERMARK was hit");
+    n_reused_catalogs = statistics->Register("catalog_mgr.n_reused_catalogs",
+        "Number of nested catalogs kept across catalog reloads");
   }
 };
 
@@ -214,6 +217,29 @@ class AbstractCatalogManager : public SingleCopy {
                                 shash::Any   *catalog_hash) = 0;
   virtual void UnloadCatalog(const CatalogT *catalog) { }
   virtual void ActivateCatalog(CatalogT *catalog) { }
+  /**
+   * Called instead of ActivateCatalog() for a nested catalog that is carried
+   * over from the previous root catalog by Remount()
+   */
+  virtual void ReuseCatalog(CatalogT *catalog) { }
+  /**
+   * Makes the catalog locally available without holding the catalog manager
+   * lock, e.g. by downloading it into the cache.  Returns false if the derived
+   * class does not support staging or if it failed, in which case the catalog
+   * is loaded under the write lock by LoadCatalog().
+   */
+  virtual bool StageCatalog(const PathString &mountpoint,
+                            const shash::Any &hash)
+  {
+    return false;
+  }
+  /**
+   * Called with the write lock held for a staged catalog that did not get
+   * mounted, e.g. because the tree was remounted meanwhile.  Releases what
+   * StageCatalog() acquired.
+   */
+  virtual void UnstageCatalog(const PathString &mountpoint,
+                              const shash::Any &hash) { }
   const std::vector<CatalogT*>& GetCatalogs() const { return catalogs_; }
 
   /**
@@ -235,12 +261,16 @@ class AbstractCatalogManager : public SingleCopy {
                     const CatalogT *entry_point,
                     bool can_listing,
                     CatalogT **leaf_catalog);
+  void StageSubtree(const PathString &path, bool is_listable);
 
   bool AttachCatalog(const std::string &db_path, CatalogT *new_catalog);
   void DetachCatalog(CatalogT *catalog);
   void DetachSubtree(CatalogT *catalog);
   void DetachSiblings(const PathString &current_tree);
   void DetachAll() { if (!catalogs_.empty()) DetachSubtree(GetRootCatalog()); }
+  CatalogList DetachRoot();
+  void ReattachNested(CatalogT *new_root, const CatalogList &nested);
+  unsigned ListSubtree(CatalogT *catalog, const bool acquire_inodes);
   bool IsAttached(const PathString &root_path,
                   CatalogT **attached_catalog) const;
 
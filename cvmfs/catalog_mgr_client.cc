@@ -9,8 +9,10 @@
 #include <vector>
 
 #include "cache_posix.h"
+#include "catalog_prefetch.h"
 #include "download.h"
 #include "fetch.h"
+#include "lru_snapshot.h"
 #include "manifest.h"
 #include "mountpoint.h"
 #include "quota.h"
@@ -32,6 +34,100 @@ void ClientCatalogManager::ActivateCatalog(Catalog *catalog) {
     all_inodes_ = counters.GetAllEntries();
   }
   loaded_inodes_ += counters.GetSelfEntries();
+
+  if (num_catalog_connections_ > 1)
+    AddReadConnections(catalog);
+
+  if (catalog_prefetcher_ != NULL) {
+    if (catalog->IsRoot())
+      catalog_prefetcher_->OnRootCatalog(catalog->hash());
+    else
+      catalog_prefetcher_->OnNestedCatalog(catalog->mountpoint());
+  }
+
+  if (md5path_restorer_ != NULL)
+    md5path_restorer_->OnCatalog(*catalog);
+}
+
+
+/**
+ * A reused catalog is still in use, so it counts as accessed in the new
+ * prefetcher round.  Otherwise its score would decay at every reload.
+ */
+void ClientCatalogManager::ReuseCatalog(Catalog *catalog) {
+  if (catalog_prefetcher_ != NULL)
+    catalog_prefetcher_->OnNestedCatalog(catalog->mountpoint());
+  if (md5path_restorer_ != NULL)
+    md5path_restorer_->OnCatalog(*catalog);
+}
+
+
+/**
+ * Hands the already attached catalogs and, from now on, every newly attached
+ * catalog to the restorer, which is not owned.  The restorer completes the
+ * inodes of the md5path cache entries restored from a snapshot.
+ */
+void ClientCatalogManager::SetMd5PathRestorer(lru::Md5PathRestorer *value) {
+  WriteLock();
+  md5path_restorer_ = value;
+  if (md5path_restorer_ != NULL) {
+    const CatalogList &catalogs = GetCatalogs();
+    for (unsigned i = 0; i < catalogs.size(); ++i)
+      md5path_restorer_->OnCatalog(*catalogs[i]);
+  }
+  Unlock();
+}
+
+
+/**
+ * Finds the attached catalog that issued the inode and translates the inode
+ * into the row id within that catalog, for the md5path cache snapshot.
+ * @return false if the inode is not issued by any attached catalog
+ */
+bool ClientCatalogManager::RelativizeInode(
+  const inode_t inode,
+  PathString *catalog_mountpoint,
+  shash::Any *catalog_hash,
+  uint64_t *relative_inode)
+{
+  bool found = false;
+  ReadLock();
+  const CatalogList &catalogs = GetCatalogs();
+  for (unsigned i = 0; i < catalogs.size(); ++i) {
+    if (catalogs[i]->DemangleInode(inode, relative_inode)) {
+      *catalog_mountpoint = catalogs[i]->mountpoint();
+      *catalog_hash = catalogs[i]->hash();
+      found = true;
+      break;
+    }
+  }
+  Unlock();
+  return found;
+}
+
+
+/**
+ * Every connection opens the catalog on its own duplicate of the cache
+ * manager file descriptor, which is then owned by SQLite.  Restricted to the
+ * posix cache manager, whose file descriptors are plain kernel file
+ * descriptors.  With other cache managers, a reload only remaps the file
+ * descriptor of the root catalog's main connection (see cvmfs.cc).
+ */
+void ClientCatalogManager::AddReadConnections(Catalog *catalog) {
+  CacheManager *cache_mgr = fetcher_->cache_mgr();
+  if (cache_mgr->id() != kPosixCacheManager)
+    return;
+  const string db_path = catalog->database_path();
+  if (!HasPrefix(db_path, "@", false))
+    return;
+  const int fd = String2Int64(db_path.substr(1));
+  for (unsigned i = 1; i < num_catalog_connections_; ++i) {
+    const int dup_fd = cache_mgr->Dup(fd);
+    if (dup_fd < 0)
+      break;
+    if (!catalog->AddReadConnection("@" + StringifyInt(dup_fd)))
+      break;
+  }
 }
 
 
@@ -45,12 +141,19 @@ ClientCatalogManager::ClientCatalogManager(MountPoint *mountpoint)
   , all_inodes_(0)
   , loaded_inodes_(0)
   , fixed_alt_root_catalog_(false)
+  , is_catalog_index_enabled_(false)
+  , catalog_index_max_entries_(0)
+  , num_catalog_connections_(1)
+  , catalog_prefetcher_(NULL)
+  , md5path_restorer_(NULL)
 {
   LogCvmfs(kLogCatalog, kLogDebug, "constructing client catalog manager");
   n_certificate_hits_ = mountpoint->statistics()->Register(
     "cache.n_certificate_hits", "Number of certificate hits");
   n_certificate_misses_ = mountpoint->statistics()->Register(
     "cache.n_certificate_misses", "Number of certificate misses");
+  sz_catalog_index_ = mountpoint->statistics()->Register(
+    "catalog_mgr.sz_index", "Memory of the in-memory catalog indexes");
 }
 
 
@@ -72,7 +175,10 @@ Catalog *ClientCatalogManager::CreateCatalog(
 ) {
   mounted_catalogs_[mountpoint] = loaded_catalogs_[mountpoint];
   loaded_catalogs_.erase(mountpoint);
-  return new Catalog(mountpoint, catalog_hash, parent_catalog);
+  Catalog *catalog = new Catalog(mountpoint, catalog_hash, parent_catalog);
+  if (is_catalog_index_enabled_)
+    catalog->EnableIndex(catalog_index_max_entries_, sz_catalog_index_);
+  return catalog;
 }
 
 
@@ -248,6 +354,59 @@ LoadError ClientCatalogManager::LoadCatalog(
 }
 
 
+/**
+ * Downloads a nested catalog into the cache without holding the catalog
+ * manager lock.  Concurrent requests for the same catalog are collapsed by the
+ * fetcher.  The subsequent LoadCatalog() under the write lock is a cache hit.
+ */
+bool ClientCatalogManager::StageCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  assert(hash.suffix == shash::kSuffixCatalog);
+  const string cvmfs_path = "file catalog at " + repo_name_ + ":" +
+    (mountpoint.IsEmpty() ?
+      "/" : string(mountpoint.GetChars(), mountpoint.GetLength())) +
+    " (" + hash.ToString() + ")";
+  int fd = fetcher_->Fetch(hash, CacheManager::kSizeUnknown, cvmfs_path,
+    zlib::kZlibDefault, CacheManager::kTypeCatalog, "");
+  if (fd < 0) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to stage %s (%d)",
+             cvmfs_path.c_str(), fd);
+    return false;
+  }
+  fetcher_->cache_mgr()->Close(fd);
+  return true;
+}
+
+
+/**
+ * Staging pinned the catalog in the cache.  The pin is released unless the
+ * same catalog is loaded or mounted by now, e.g. by another thread.
+ */
+void ClientCatalogManager::UnstageCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash)
+{
+  map<PathString, shash::Any>::const_iterator i, iend;
+  for (i = mounted_catalogs_.begin(), iend = mounted_catalogs_.end();
+       i != iend; ++i)
+  {
+    if (i->second == hash)
+      return;
+  }
+  for (i = loaded_catalogs_.begin(), iend = loaded_catalogs_.end();
+       i != iend; ++i)
+  {
+    if (i->second == hash)
+      return;
+  }
+  LogCvmfs(kLogCatalog, kLogDebug, "unpinning staged catalog %s (%s)",
+           mountpoint.c_str(), hash.ToString().c_str());
+  fetcher_->cache_mgr()->quota_mgr()->Unpin(hash);
+}
+
+
 LoadError ClientCatalogManager::LoadCatalogCas(
   const shash::Any &hash,
   const string &name,
@@ -21,6 +21,9 @@ class CacheManager;
 namespace cvmfs {
 class Fetcher;
 }
+namespace lru {
+class Md5PathRestorer;
+}
 class MountPoint;
 namespace perf {
 class Counter;
@@ -32,6 +35,8 @@ class SignatureManager;
 
 namespace catalog {
 
+class CatalogPrefetcher;
+
 /**
  * A catalog manager that uses a Fetcher to get file catalgs in the form of
  * (virtual) file descriptors from a cache manager.  Sqlite has a path based
@@ -59,6 +64,32 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   shash::Any GetRootHash();
 
   bool IsRevisionBlacklisted();
+  /**
+   * Catalogs created from now on use a CatalogIndex for path lookups, unless
+   * they have more than max_entries entries
+   */
+  void EnableCatalogIndex(const uint64_t max_entries) {
+    is_catalog_index_enabled_ = true;
+    catalog_index_max_entries_ = max_entries;
+  }
+  /**
+   * Number of SQLite connections per catalog, see Catalog::AddReadConnection()
+   */
+  void SetNumCatalogConnections(unsigned value) {
+    assert(value > 0);
+    num_catalog_connections_ = value;
+  }
+  /**
+   * Reports attached catalogs to the prefetcher, which is not owned
+   */
+  void SetCatalogPrefetcher(CatalogPrefetcher *value) {
+    catalog_prefetcher_ = value;
+  }
+  void SetMd5PathRestorer(lru::Md5PathRestorer *value);
+  bool RelativizeInode(const inode_t inode,
+                       PathString *catalog_mountpoint,
+                       shash::Any *catalog_hash,
+                       uint64_t *relative_inode);
 
   bool offline_mode() const { return offline_mode_; }
   uint64_t all_inodes() const { return all_inodes_; }
@@ -72,12 +103,16 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
                         std::string       *catalog_path,
                         shash::Any        *catalog_hash);
   void UnloadCatalog(const catalog::Catalog *catalog);
+  bool StageCatalog(const PathString &mountpoint, const shash::Any &hash);
+  void UnstageCatalog(const PathString &mountpoint, const shash::Any &hash);
   catalog::Catalog* CreateCatalog(const PathString &mountpoint,
                                   const shash::Any  &catalog_hash,
                                   catalog::Catalog *parent_catalog);
   void ActivateCatalog(catalog::Catalog *catalog);
+  void ReuseCatalog(catalog::Catalog *catalog);
 
  private:
+  void AddReadConnections(Catalog *catalog);
   LoadError LoadCatalogCas(const shash::Any &hash,
                            const std::string &name,
                            const std::string &alt_catalog_path,
@@ -99,9 +134,15 @@ class ClientCatalogManager : public AbstractCatalogManager<Catalog> {
   uint64_t all_inodes_;
   uint64_t loaded_inodes_;
   bool fixed_alt_root_catalog_;  /**< fixed root hash but alternative url */
+  bool is_catalog_index_enabled_;
+  uint64_t catalog_index_max_entries_;
+  unsigned num_catalog_connections_;
+  CatalogPrefetcher *catalog_prefetcher_;
+  lru::Md5PathRestorer *md5path_restorer_;
   BackoffThrottle backoff_throttle_;
   perf::Counter *n_certificate_hits_;
   perf::Counter *n_certificate_misses_;
+  perf::Counter *sz_catalog_index_;
 };
 
 
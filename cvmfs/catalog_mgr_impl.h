@@ -111,8 +111,9 @@ bool AbstractCatalogManager<CatalogT>::Init() {
 
 /**
  * Remounts the root catalog if necessary.  If a newer root catalog exists,
- * it is mounted and replaces the currently mounted tree (all existing catalogs
- * are detached)
+ * it replaces the currently mounted root catalog.  Nested catalogs whose hash
+ * did not change in the new revision are moved to the new tree together with
+ * their subtrees, all other catalogs are detached.
  */
 template <class CatalogT>
 LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
@@ -131,13 +132,14 @@ LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
                                            &catalog_hash);
   if (load_error == kLoadNew) {
     inode_t old_inode_gauge = inode_gauge_;
-    DetachAll();
+    const CatalogList nested = DetachRoot();
     inode_gauge_ = AbstractCatalogManager<CatalogT>::kInodeOffset;
 
     CatalogT *new_root = CreateCatalog(PathString("", 0), catalog_hash, NULL);
     assert(new_root);
     bool retval = AttachCatalog(catalog_path, new_root);
     assert(retval);
+    ReattachNested(new_root, nested);
 
     if (inode_annotation_) {
       inode_annotation_->IncGeneration(old_inode_gauge);
@@ -150,6 +152,80 @@ LoadError AbstractCatalogManager<CatalogT>::Remount(const bool dry_run) {
 }
 
 
+/**
+ * Detaches the root catalog but keeps its nested catalogs.  The returned
+ * subtrees are orphaned and not listed in catalogs_ anymore; they have to be
+ * passed to ReattachNested().
+ */
+template <class CatalogT>
+typename AbstractCatalogManager<CatalogT>::CatalogList
+AbstractCatalogManager<CatalogT>::DetachRoot() {
+  CatalogList nested;
+  if (catalogs_.empty())
+    return nested;
+
+  CatalogT *root = GetRootCatalog();
+  nested = root->GetChildren();
+  for (unsigned i = 0; i < nested.size(); ++i)
+    root->RemoveChild(nested[i]);
+  DetachCatalog(root);
+  catalogs_.clear();
+  return nested;
+}
+
+
+/**
+ * Moves the orphaned subtrees of the previous root catalog to new_root if the
+ * new root catalog still references the same nested catalog.  An unchanged
+ * hash implies an unchanged subtree.  The reused catalogs get new inode
+ * ranges, the other subtrees are detached.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::ReattachNested(
+  CatalogT *new_root,
+  const CatalogList &nested)
+{
+  for (unsigned i = 0; i < nested.size(); ++i) {
+    CatalogT *catalog = nested[i];
+    shash::Any hash;
+    uint64_t size;
+    const bool is_unchanged =
+      new_root->FindNested(catalog->mountpoint(), &hash, &size) &&
+      (hash == catalog->hash());
+    const unsigned num_catalogs = ListSubtree(catalog, is_unchanged);
+    if (is_unchanged) {
+      new_root->AddChild(catalog);
+      perf::Xadd(statistics_.n_reused_catalogs, num_catalogs);
+    } else {
+      DetachSubtree(catalog);
+    }
+  }
+}
+
+
+/**
+ * Adds a catalog and its children to catalogs_, optionally with new inode
+ * ranges.  Returns the number of catalogs in the subtree.
+ */
+template <class CatalogT>
+unsigned AbstractCatalogManager<CatalogT>::ListSubtree(
+  CatalogT *catalog,
+  const bool acquire_inodes)
+{
+  catalogs_.push_back(catalog);
+  if (acquire_inodes) {
+    catalog->set_inode_range(AcquireInodes(catalog->max_row_id()));
+    ReuseCatalog(catalog);
+  }
+
+  unsigned result = 1;
+  const CatalogList children = catalog->GetChildren();
+  for (unsigned i = 0; i < children.size(); ++i)
+    result += ListSubtree(children[i], acquire_inodes);
+  return result;
+}
+
+
 /**
  * Detaches everything except the root catalog
  */
@@ -233,6 +309,7 @@ bool AbstractCatalogManager<CatalogT>::LookupPath(const PathString &path,
     LogCvmfs(kLogCatalog, kLogDebug, "looking up '%s' in a nested catalog",
              path.c_str());
     Unlock();
+    StageSubtree(path, false /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(path);
@@ -334,6 +411,7 @@ bool AbstractCatalogManager<CatalogT>::LookupNested(
   CatalogT *catalog = best_fit;
   if (MountSubtree(catalog_path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(catalog_path, false /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(catalog_path);
@@ -397,6 +475,7 @@ bool AbstractCatalogManager<CatalogT>::ListCatalogSkein(
   // True if there is an available nested catalog
   if (MountSubtree(test, best_fit, false /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(test, false /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(test);
@@ -453,6 +532,7 @@ bool AbstractCatalogManager<CatalogT>::LookupXattrs(
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(path, false /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(path);
@@ -491,6 +571,7 @@ bool AbstractCatalogManager<CatalogT>::Listing(const PathString &path,
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, true /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(path, true /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(path);
@@ -528,6 +609,7 @@ bool AbstractCatalogManager<CatalogT>::ListingStat(const PathString &path,
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, true /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(path, true /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(path);
@@ -568,6 +650,7 @@ bool AbstractCatalogManager<CatalogT>::ListFileChunks(
   CatalogT *catalog = best_fit;
   if (MountSubtree(path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(path, false /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(path);
@@ -602,6 +685,7 @@ catalog::Counters AbstractCatalogManager<CatalogT>::LookupCounters(
   CatalogT *catalog = best_fit;
   if (MountSubtree(catalog_path, best_fit, false /* is_listable */, NULL)) {
     Unlock();
+    StageSubtree(catalog_path, false /* is_listable */);
     WriteLock();
     // Check again to avoid race
     best_fit = FindCatalog(catalog_path);
@@ -820,6 +904,81 @@ bool AbstractCatalogManager<CatalogT>::MountSubtree(
 }
 
 
+/**
+ * Mounts the nested catalogs on the way to path one by one.  The catalogs are
+ * staged by the derived class without holding the lock, so that a slow
+ * download does not block lookups in the catalogs that are already mounted.
+ * Only attaching a staged catalog requires the write lock.  Stops silently at
+ * the first catalog that cannot be staged or mounted; the caller's
+ * MountSubtree() under the write lock takes over from there.
+ */
+template <class CatalogT>
+void AbstractCatalogManager<CatalogT>::StageSubtree(
+  const PathString &path,
+  bool is_listable)
+{
+  PathString path_slash(path);
+  path_slash.Append("/", 1);
+  while (true) {
+    PathString parent_mountpoint;
+    PathString mountpoint;
+    shash::Any hash;
+
+    ReadLock();
+    const CatalogT *parent = FindCatalog(path);
+    parent_mountpoint = parent->mountpoint();
+    typedef typename CatalogT::NestedCatalogList NestedCatalogList;
+    const NestedCatalogList& nested_catalogs = parent->ListNestedCatalogs();
+    for (typename NestedCatalogList::const_iterator i = nested_catalogs.begin(),
+         iEnd = nested_catalogs.end(); i != iEnd; ++i)
+    {
+      PathString nested_path_slash(i->mountpoint);
+      nested_path_slash.Append("/", 1);
+      if (path_slash.StartsWith(nested_path_slash)) {
+        if (is_listable || (path_slash != nested_path_slash)) {
+          mountpoint = i->mountpoint;
+          hash = i->hash;
+        }
+        break;
+      }
+    }
+    Unlock();
+
+    if (hash.IsNull() || !StageCatalog(mountpoint, hash))
+      return;
+
+    WriteLock();
+    // Another thread might have mounted the catalog, detached its parent or
+    // remounted the tree in the meantime.  In the latter case, the staged
+    // catalog can be outdated and the nested catalog is staged again.
+    CatalogT *current_parent = FindCatalog(path);
+    if (current_parent->mountpoint() == parent_mountpoint) {
+      shash::Any current_hash;
+      uint64_t size;
+      if (!current_parent->FindNested(mountpoint, &current_hash, &size)) {
+        UnstageCatalog(mountpoint, hash);
+        Unlock();
+        return;
+      }
+      if (current_hash != hash) {
+        UnstageCatalog(mountpoint, hash);
+        Unlock();
+        continue;
+      }
+      if (MountCatalog(mountpoint, hash, current_parent) == NULL)
+        UnstageCatalog(mountpoint, hash);
+    } else {
+      UnstageCatalog(mountpoint, hash);
+    }
+    const bool has_progress =
+      FindCatalog(path)->mountpoint() != parent_mountpoint;
+    Unlock();
+    if (!has_progress)
+      return;
+  }
+}
+
+
 /**
  * Load a catalog file and attach it to the tree of Catalog objects.
  * Loading of catalogs is implemented by derived classes.
@@ -9,6 +9,7 @@
 #include <inttypes.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -18,6 +19,7 @@
 #include "catalog_rw.h"
 #include "logging.h"
 #include "manifest.h"
+#include "platform.h"
 #include "smalloc.h"
 #include "statistics.h"
 #include "upload.h"
@@ -45,6 +47,8 @@ WritableCatalogManager::WritableCatalogManager(
   : SimpleCatalogManager(base_hash, stratum0, dir_temp, download_manager,
       statistics)
   , spooler_(spooler)
+  , num_catalogs_total_(0)
+  , num_catalogs_committed_(0)
   , enforce_limits_(enforce_limits)
   , nested_kcatalog_limit_(nested_kcatalog_limit)
   , root_kcatalog_limit_(root_kcatalog_limit)
@@ -926,6 +930,31 @@ bool WritableCatalogManager::SetVOMSAuthz(const std::string &voms_authz) {
 }
 
 
+/**
+ * Marks the repository as possibly containing zstd and lz4 compressed files.
+ * The marker is a property of the root catalog and cannot be removed.  The
+ * catalog schema stays the same, so older clients keep loading the catalogs.
+ */
+bool WritableCatalogManager::SetExtendedCompression() {
+  bool result;
+  SyncLock();
+  result = reinterpret_cast<WritableCatalog *>(
+    GetRootCatalog())->SetExtendedCompression();
+  SyncUnlock();
+  return result;
+}
+
+
+bool WritableCatalogManager::HasExtendedCompression() {
+  bool result;
+  SyncLock();
+  result = reinterpret_cast<WritableCatalog *>(
+    GetRootCatalog())->HasExtendedCompression();
+  SyncUnlock();
+  return result;
+}
+
+
 bool WritableCatalogManager::Commit(const bool           stop_for_tweaks,
                                     const uint64_t       manual_revision,
                                     manifest::Manifest  *manifest) {
@@ -974,8 +1003,9 @@ bool WritableCatalogManager::Commit(const bool           stop_for_tweaks,
 
 /**
  * Handles the snapshotting of dirty (i.e. modified) catalogs while trying to
- * parallize the compression and upload as much as possible. We use a parallel
- * depth first post order tree traversal based on 'continuations'.
+ * parallize the finalization, compression and upload as much as possible. We
+ * use a parallel depth first post order tree traversal based on
+ * 'continuations'.
  *
  * The idea is as follows:
  *  1. find all leaf-catalogs (i.e. dirty catalogs with no dirty children)
@@ -992,45 +1022,80 @@ bool WritableCatalogManager::Commit(const bool           stop_for_tweaks,
  *     --> done through a Future<> in WritableCatalogManager::SnapshotCatalogs
  *
  * Note: The catalog finalisation (see WritableCatalogManager::FinalizeCatalog)
- *       happens in a worker thread (i.e. the callback method) for non-leaf
- *       catalogs.
- *
- * TODO(rmeusel): since all leaf catalogs are finalized in the main thread, we
- *                sacrafice some potential concurrency for simplicity.
+ *       happens in a pool of TaskFinalizeCatalog threads, for leaf catalogs as
+ *       well as for non-leaf catalogs.  With stop_for_tweaks, there is only a
+ *       single thread so that the catalogs are presented one by one.
  */
 WritableCatalogManager::CatalogInfo WritableCatalogManager::SnapshotCatalogs(
                                                    const bool stop_for_tweaks) {
+  const uint64_t start_ns = platform_monotonic_time_ns();
+
+  // find dirty leaf catalogs and annotate non-leaf catalogs (dirty child count)
+  // post-condition: the entire catalog tree is ready for concurrent processing
+  WritableCatalogList leafs_to_snapshot;
+  GetModifiedCatalogLeafs(&leafs_to_snapshot);
+  WritableCatalogList catalogs_to_snapshot;
+  GetModifiedCatalogs(&catalogs_to_snapshot);
+  num_catalogs_total_ = catalogs_to_snapshot.size();
+  num_catalogs_committed_ = 0;
+
   // prepare environment for parallel processing
+  Tube<FinalizeJob> tube_finalize;
+  TubeConsumerGroup<FinalizeJob> tasks_finalize;
+  const unsigned num_threads = stop_for_tweaks ? 1 :
+    std::max(1U, std::min(GetNumberOfCpuCores(), num_catalogs_total_));
+  for (unsigned i = 0; i < num_threads; ++i) {
+    tasks_finalize.TakeConsumer(
+      new TaskFinalizeCatalog(&tube_finalize, this, stop_for_tweaks));
+  }
+
   Future<CatalogInfo>  root_catalog_info_future;
   CatalogUploadContext upload_context;
   upload_context.root_catalog_info = &root_catalog_info_future;
   upload_context.stop_for_tweaks   = stop_for_tweaks;
+  upload_context.tube_finalize     = &tube_finalize;
 
   spooler_->RegisterListener(
     &WritableCatalogManager::CatalogUploadCallback, this, upload_context);
-
-  // find dirty leaf catalogs and annotate non-leaf catalogs (dirty child count)
-  // post-condition: the entire catalog tree is ready for concurrent processing
-  WritableCatalogList leafs_to_snapshot;
-  GetModifiedCatalogLeafs(&leafs_to_snapshot);
+  tasks_finalize.Spawn();
 
   // finalize and schedule the catalog processing
         WritableCatalogList::const_iterator i    = leafs_to_snapshot.begin();
   const WritableCatalogList::const_iterator iend = leafs_to_snapshot.end();
   for (; i != iend; ++i) {
-    FinalizeCatalog(*i, stop_for_tweaks);
-    ScheduleCatalogProcessing(*i);
+    tube_finalize.EnqueueBack(new FinalizeJob(*i));
   }
 
-  LogCvmfs(kLogCatalog, kLogVerboseMsg, "waiting for upload of catalogs");
+  LogCvmfs(kLogCatalog, kLogVerboseMsg,
+           "waiting for upload of %u catalogs (%u finalizing threads)",
+           num_catalogs_total_, num_threads);
   CatalogInfo& root_catalog_info = root_catalog_info_future.Get();
   spooler_->WaitForUpload();
 
   spooler_->UnregisterListeners();
+  tasks_finalize.Terminate();
+
+  LogCvmfs(kLogCatalog, kLogDebug,
+           "Committed %u catalogs in %.2f seconds "
+           "(finalization took %.2f seconds)",
+           num_catalogs_total_,
+           static_cast<double>(platform_monotonic_time_ns() - start_ns) / 1e9,
+           static_cast<double>(tasks_finalize.GetBusyNs()) / 1e9);
   return root_catalog_info;
 }
 
 
+void TaskFinalizeCatalog::Process(WritableCatalogManager::FinalizeJob *job) {
+  WritableCatalog *catalog = job->catalog;
+  delete job;
+
+  const uint64_t start_ns = platform_monotonic_time_ns();
+  catalog_mgr_->FinalizeCatalog(catalog, stop_for_tweaks_);
+  catalog_mgr_->ScheduleCatalogProcessing(
+    catalog, platform_monotonic_time_ns() - start_ns);
+}
+
+
 void WritableCatalogManager::FinalizeCatalog(WritableCatalog *catalog,
                                              const bool stop_for_tweaks) {
   // update meta information of this catalog
@@ -1101,11 +1166,13 @@ void WritableCatalogManager::FinalizeCatalog(WritableCatalog *catalog,
 
 
 void WritableCatalogManager::ScheduleCatalogProcessing(
-                                                     WritableCatalog *catalog) {
+                                                  WritableCatalog *catalog,
+                                                  const uint64_t finalize_ns) {
   {
     MutexLockGuard guard(catalog_processing_lock_);
     // register catalog object for WritableCatalogManager::CatalogUploadCallback
-    catalog_processing_map_[catalog->database_path()] = catalog;
+    catalog_processing_map_[catalog->database_path()] =
+      CatalogProcessing(catalog, finalize_ns, platform_monotonic_time_ns());
   }
   spooler_->ProcessCatalog(catalog->database_path());
 }
@@ -1121,19 +1188,29 @@ void WritableCatalogManager::CatalogUploadCallback(
 
   // retrieve the catalog object based on the callback information
   // see WritableCatalogManager::ScheduleCatalogProcessing()
-  WritableCatalog *catalog = NULL;
+  CatalogProcessing processing;
   {
     MutexLockGuard guard(catalog_processing_lock_);
-    std::map<std::string, WritableCatalog*>::iterator c =
+    std::map<std::string, CatalogProcessing>::iterator c =
       catalog_processing_map_.find(result.local_path);
     assert(c != catalog_processing_map_.end());
-    catalog = c->second;
+    processing = c->second;
+    catalog_processing_map_.erase(c);
   }
+  WritableCatalog *catalog = processing.catalog;
 
   uint64_t catalog_size = GetFileSize(result.local_path);
   assert(catalog_size > 0);
 
   SyncLock();
+  num_catalogs_committed_++;
+  LogCvmfs(kLogCatalog, kLogVerboseMsg,
+           "committed catalog %u/%u '%s' (%" PRIu64 " bytes): finalized in "
+           "%" PRIu64 " ms, compressed and uploaded in %" PRIu64 " ms",
+           num_catalogs_committed_, num_catalogs_total_,
+           catalog->IsRoot() ? "/" : catalog->mountpoint().c_str(),
+           catalog_size, processing.finalize_ns / 1000000,
+           (platform_monotonic_time_ns() - processing.scheduled_ns) / 1000000);
   if (catalog->HasParent()) {
     // finalized nested catalogs will update their parent's pointer and schedule
     // them for processing (continuation) if the 'dirty children count' == 0
@@ -1154,8 +1231,8 @@ void WritableCatalogManager::CatalogUploadCallback(
     // continuation of the dirty catalog tree traversal
     // see WritableCatalogManager::SnapshotCatalogs()
     if (remaining_dirty_children == 0) {
-      FinalizeCatalog(parent, catalog_upload_context.stop_for_tweaks);
-      ScheduleCatalogProcessing(parent);
+      catalog_upload_context.tube_finalize->EnqueueBack(
+        new FinalizeJob(parent));
     }
 
   } else if (catalog->IsRoot()) {
@@ -1300,6 +1377,7 @@ WritableCatalogManager::SnapshotCatalogsSerialized(
   CatalogUploadContext unused;
   unused.root_catalog_info = NULL;
   unused.stop_for_tweaks = false;
+  unused.tube_finalize = NULL;
   spooler_->RegisterListener(
     &WritableCatalogManager::CatalogUploadSerializedCallback, this, unused);
 
@@ -39,6 +39,8 @@
 #include "catalog_mgr_ro.h"
 #include "catalog_rw.h"
 #include "file_chunk.h"
+#include "ingestion/task.h"
+#include "ingestion/tube.h"
 #include "upload_spooler_result.h"
 #include "util_concurrency.h"
 #include "xattr.h"
@@ -67,8 +69,11 @@ class CatalogBalancer;
 
 namespace catalog {
 
+class TaskFinalizeCatalog;
+
 class WritableCatalogManager : public SimpleCatalogManager {
   friend class CatalogBalancer<WritableCatalogManager>;
+  friend class TaskFinalizeCatalog;
   // TODO(jblomer): only needed to get Spooler's hash algorithm.  Remove me
   // after refactoring of the swissknife utility.
   friend class VirtualCatalog;
@@ -139,6 +144,8 @@ class WritableCatalogManager : public SimpleCatalogManager {
 
   void SetTTL(const uint64_t new_ttl);
   bool SetVOMSAuthz(const std::string &voms_authz);
+  bool SetExtendedCompression();
+  bool HasExtendedCompression();
   bool Commit(const bool           stop_for_tweaks,
               const uint64_t       manual_revision,
               manifest::Manifest  *manifest);
@@ -182,15 +189,42 @@ class WritableCatalogManager : public SimpleCatalogManager {
     unsigned int revision;
   };
 
+  /**
+   * A dirty catalog whose dirty children are all committed, i.e. a catalog
+   * that is ready to be finalized by a TaskFinalizeCatalog
+   */
+  struct FinalizeJob {
+    explicit FinalizeJob(WritableCatalog *c) : catalog(c) { }
+    static FinalizeJob *CreateQuitBeacon() { return new FinalizeJob(NULL); }
+    bool IsQuitBeacon() { return catalog == NULL; }
+
+    WritableCatalog *catalog;
+  };
+
   struct CatalogUploadContext {
     Future<CatalogInfo>* root_catalog_info;
     bool                 stop_for_tweaks;
+    Tube<FinalizeJob>   *tube_finalize;
+  };
+
+  /**
+   * Bookkeeping of a catalog from its finalization until its upload callback
+   */
+  struct CatalogProcessing {
+    CatalogProcessing() : catalog(NULL), finalize_ns(0), scheduled_ns(0) { }
+    CatalogProcessing(WritableCatalog *c, uint64_t f, uint64_t s)
+      : catalog(c), finalize_ns(f), scheduled_ns(s) { }
+
+    WritableCatalog *catalog;
+    uint64_t finalize_ns;   ///< time spent in FinalizeCatalog()
+    uint64_t scheduled_ns;  ///< when the catalog was handed to the spooler
   };
 
   CatalogInfo SnapshotCatalogs(const bool stop_for_tweaks);
   void FinalizeCatalog(WritableCatalog *catalog,
                        const bool stop_for_tweaks);
-  void ScheduleCatalogProcessing(WritableCatalog *catalog);
+  void ScheduleCatalogProcessing(WritableCatalog *catalog,
+                                 const uint64_t finalize_ns);
 
   void GetModifiedCatalogLeafs(WritableCatalogList *result) const {
     const bool dirty = GetModifiedCatalogLeafsRecursively(GetRootCatalog(),
@@ -229,8 +263,13 @@ class WritableCatalogManager : public SimpleCatalogManager {
   pthread_mutex_t *sync_lock_;
   upload::Spooler *spooler_;
 
-  pthread_mutex_t                         *catalog_processing_lock_;
-  std::map<std::string, WritableCatalog*>  catalog_processing_map_;
+  pthread_mutex_t                          *catalog_processing_lock_;
+  std::map<std::string, CatalogProcessing>  catalog_processing_map_;
+  /**
+   * Progress of SnapshotCatalogs(), protected by the sync lock
+   */
+  unsigned num_catalogs_total_;
+  unsigned num_catalogs_committed_;
 
   // TODO(jblomer): catalog limits should become its own struct
   bool enforce_limits_;
@@ -273,6 +312,32 @@ class WritableCatalogManager : public SimpleCatalogManager {
   const unsigned balance_weight_;
 };  // class WritableCatalogManager
 
+
+/**
+ * Finalizes catalogs and hands them over to the spooler for compression and
+ * upload.  Used by WritableCatalogManager::SnapshotCatalogs() so that
+ * independent catalogs are finalized concurrently.
+ */
+class TaskFinalizeCatalog
+  : public TubeConsumer<WritableCatalogManager::FinalizeJob>
+{
+ public:
+  TaskFinalizeCatalog(Tube<WritableCatalogManager::FinalizeJob> *tube,
+                      WritableCatalogManager *catalog_mgr,
+                      const bool stop_for_tweaks)
+    : TubeConsumer<WritableCatalogManager::FinalizeJob>(tube)
+    , catalog_mgr_(catalog_mgr)
+    , stop_for_tweaks_(stop_for_tweaks)
+  { }
+
+ protected:
+  virtual void Process(WritableCatalogManager::FinalizeJob *job);
+
+ private:
+  WritableCatalogManager *catalog_mgr_;
+  bool stop_for_tweaks_;
+};
+
 }  // namespace catalog
 
 #endif  // CVMFS_CATALOG_MGR_RW_H_
@@ -0,0 +1,447 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "catalog_prefetch.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include "cache.h"
+#include "catalog.h"
+#include "compression.h"
+#include "fetch.h"
+#include "logging.h"
+#include "platform.h"
+#include "util/posix.h"
+#include "util/string.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+const unsigned CatalogPrefetcher::kRecordWindow;
+const unsigned CatalogPrefetcher::kScoreHit;
+const unsigned CatalogPrefetcher::kScoreThreshold;
+const unsigned CatalogPrefetcher::kMaxCatalogs;
+const unsigned CatalogPrefetcher::kMaxWorkers;
+const char *CatalogPrefetcher::kHeader = "cvmfs catalog history v1";
+
+namespace {
+
+struct ScoreGreater {
+  bool operator()(const pair<string, uint32_t> &a,
+                  const pair<string, uint32_t> &b) const
+  {
+    return a.second > b.second;
+  }
+};
+
+/**
+ * Parents before children
+ */
+struct DepthLess {
+  bool operator()(const string &a, const string &b) const {
+    const size_t depth_a = count(a.begin(), a.end(), '/');
+    const size_t depth_b = count(b.begin(), b.end(), '/');
+    if (depth_a == depth_b)
+      return a < b;
+    return depth_a < depth_b;
+  }
+};
+
+}  // anonymous namespace
+
+
+CatalogPrefetcher::CatalogPrefetcher(
+  const string &history_path,
+  cvmfs::Fetcher *fetcher,
+  const unsigned num_workers,
+  perf::StatisticsTemplate statistics)
+  : history_path_(history_path)
+  , fetcher_(fetcher)
+  , num_workers_(std::max(1U, std::min(num_workers, kMaxWorkers)))
+  , spawned_(false)
+  , has_round_(false)
+  , round_start_(0)
+  , is_dirty_(false)
+  , has_request_(false)
+{
+  atomic_init32(&terminate_);
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_request_, NULL);
+  assert(retval == 0);
+
+  n_scheduled_ = statistics.RegisterTemplated("n_scheduled",
+    "Number of nested catalogs scheduled for prefetching");
+  n_prefetched_ = statistics.RegisterTemplated("n_prefetched",
+    "Number of prefetched nested catalogs");
+  n_stale_ = statistics.RegisterTemplated("n_stale",
+    "Number of nested catalogs of the history not found in their parent");
+  n_failed_ = statistics.RegisterTemplated("n_failed",
+    "Number of failed nested catalog prefetches");
+}
+
+
+/**
+ * The last round is recorded, too.
+ */
+CatalogPrefetcher::~CatalogPrefetcher() {
+  if (spawned_) {
+    {
+      MutexLockGuard m(&lock_);
+      atomic_inc32(&terminate_);
+      pthread_cond_signal(&cond_request_);
+    }
+    pthread_join(thread_prefetch_, NULL);
+  }
+  {
+    MutexLockGuard m(&lock_);
+    if (has_round_)
+      EndRound();
+  }
+  Save();
+  pthread_cond_destroy(&cond_request_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * One line per catalog: <score> <catalog path>.  A missing file is an empty
+ * history.
+ */
+bool CatalogPrefetcher::Load() {
+  FILE *f = fopen(history_path_.c_str(), "r");
+  if (f == NULL)
+    return errno == ENOENT;
+
+  string line;
+  if (!GetLineFile(f, &line) || (line != kHeader)) {
+    fclose(f);
+    LogCvmfs(kLogCatalog, kLogDebug,
+             "ignoring catalog history %s of unknown format",
+             history_path_.c_str());
+    return false;
+  }
+
+  MutexLockGuard m(&lock_);
+  while (GetLineFile(f, &line)) {
+    const size_t separator = line.find(' ');
+    if (separator == string::npos)
+      continue;
+    const uint64_t score = String2Uint64(line.substr(0, separator));
+    const string path = line.substr(separator + 1);
+    if ((score == 0) || path.empty() || (path[0] != '/'))
+      continue;
+    scores_[path] = score;
+  }
+  fclose(f);
+  LogCvmfs(kLogCatalog, kLogDebug, "loaded %lu catalogs from history %s",
+           scores_.size(), history_path_.c_str());
+  return true;
+}
+
+
+bool CatalogPrefetcher::Save() {
+  string content = string(kHeader) + "\n";
+  {
+    MutexLockGuard m(&lock_);
+    if (!is_dirty_)
+      return true;
+    for (map<string, uint32_t>::const_iterator i = scores_.begin(),
+         iEnd = scores_.end(); i != iEnd; ++i)
+    {
+      content += StringifyInt(i->second) + " " + i->first + "\n";
+    }
+    is_dirty_ = false;
+  }
+  const string tmp_path = history_path_ + ".tmp";
+  if (!SafeWriteToFile(content, tmp_path, 0644))
+    return false;
+  if (rename(tmp_path.c_str(), history_path_.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * Called with lock_ held
+ */
+void CatalogPrefetcher::EndRound() {
+  for (map<string, uint32_t>::iterator i = scores_.begin();
+       i != scores_.end(); )
+  {
+    i->second /= 2;
+    if ((i->second == 0) && (round_.count(i->first) == 0))
+      scores_.erase(i++);
+    else
+      ++i;
+  }
+  for (set<string>::const_iterator i = round_.begin(), iEnd = round_.end();
+       i != iEnd; ++i)
+  {
+    scores_[*i] += kScoreHit;
+  }
+
+  if (scores_.size() > kMaxCatalogs) {
+    vector<pair<string, uint32_t> > by_score(scores_.begin(), scores_.end());
+    sort(by_score.begin(), by_score.end(), ScoreGreater());
+    scores_.clear();
+    scores_.insert(by_score.begin(), by_score.begin() + kMaxCatalogs);
+  }
+
+  round_.clear();
+  has_round_ = false;
+  is_dirty_ = true;
+}
+
+
+/**
+ * Called by the catalog manager under its write lock whenever a root catalog
+ * is attached.  Ends the current round and schedules the prefetching.
+ */
+void CatalogPrefetcher::OnRootCatalog(const shash::Any &root_hash) {
+  MutexLockGuard m(&lock_);
+  if (has_round_)
+    EndRound();
+  has_round_ = true;
+  round_start_ = platform_monotonic_time();
+  root_hash_ = root_hash;
+  has_request_ = true;
+  pthread_cond_signal(&cond_request_);
+}
+
+
+void CatalogPrefetcher::OnNestedCatalog(const PathString &mountpoint) {
+  MutexLockGuard m(&lock_);
+  if (!has_round_ ||
+      (platform_monotonic_time() > round_start_ + kRecordWindow))
+  {
+    return;
+  }
+  round_.insert(mountpoint.ToString());
+}
+
+
+/**
+ * Catalogs above the score threshold, parents before their children
+ */
+vector<string> CatalogPrefetcher::GetLikelyCatalogs() {
+  vector<string> result;
+  {
+    MutexLockGuard m(&lock_);
+    for (map<string, uint32_t>::const_iterator i = scores_.begin(),
+         iEnd = scores_.end(); i != iEnd; ++i)
+    {
+      if (i->second >= kScoreThreshold)
+        result.push_back(i->first);
+    }
+  }
+  sort(result.begin(), result.end(), DepthLess());
+  return result;
+}
+
+
+void *CatalogPrefetcher::MainPrefetch(void *data) {
+  CatalogPrefetcher *prefetcher = reinterpret_cast<CatalogPrefetcher *>(data);
+  LogCvmfs(kLogCatalog, kLogDebug, "starting catalog prefetcher");
+
+  while (true) {
+    shash::Any root_hash;
+    {
+      MutexLockGuard m(&prefetcher->lock_);
+      while (!prefetcher->has_request_ &&
+             (atomic_read32(&prefetcher->terminate_) == 0))
+      {
+        pthread_cond_wait(&prefetcher->cond_request_, &prefetcher->lock_);
+      }
+      if (atomic_read32(&prefetcher->terminate_) != 0)
+        break;
+      prefetcher->has_request_ = false;
+      root_hash = prefetcher->root_hash_;
+    }
+    // Don't write the file from the catalog manager
+    prefetcher->Save();
+    prefetcher->Prefetch(root_hash, prefetcher->GetLikelyCatalogs());
+  }
+
+  LogCvmfs(kLogCatalog, kLogDebug, "stopping catalog prefetcher");
+  return NULL;
+}
+
+
+void *CatalogPrefetcher::MainWorker(void *data) {
+  Level *level = reinterpret_cast<Level *>(data);
+  const int32_t num_jobs = level->jobs->size();
+  while (atomic_read32(&level->prefetcher->terminate_) == 0) {
+    const int32_t idx = atomic_xadd32(&level->next_job, 1);
+    if (idx >= num_jobs)
+      break;
+    level->prefetcher->ProcessJob(&(*level->jobs)[idx]);
+  }
+  return NULL;
+}
+
+
+/**
+ * Maps every catalog path to the catalogs of the list directly below it.  The
+ * parent of a catalog is the deepest catalog of the list above it, or the root
+ * catalog "".  The list has to be sorted parents first.
+ */
+map<string, vector<string> > CatalogPrefetcher::GroupByParent(
+  const vector<string> &catalogs)
+{
+  map<string, vector<string> > result;
+  set<string> known;
+  known.insert("");
+  for (unsigned i = 0; i < catalogs.size(); ++i) {
+    const string &path = catalogs[i];
+    string parent_path;
+    for (set<string>::const_iterator j = known.begin(), jEnd = known.end();
+         j != jEnd; ++j)
+    {
+      if ((j->length() > parent_path.length()) &&
+          HasPrefix(path, *j + "/", false))
+      {
+        parent_path = *j;
+      }
+    }
+    result[parent_path].push_back(path);
+    known.insert(path);
+  }
+  return result;
+}
+
+
+/**
+ * The catalogs of one level are fetched in parallel.  The next level consists
+ * of the children that the workers found in the catalogs of this level.  The
+ * first level is the root catalog itself, which is in the cache.
+ */
+void CatalogPrefetcher::Prefetch(
+  const shash::Any &root_hash,
+  const vector<string> &catalogs)
+{
+  if (catalogs.empty())
+    return;
+  LogCvmfs(kLogCatalog, kLogDebug, "prefetching up to %lu nested catalogs",
+           catalogs.size());
+
+  map<string, vector<string> > children = GroupByParent(catalogs);
+  vector<Job> level_jobs(1);
+  level_jobs[0].hash = root_hash;
+  level_jobs[0].size = CacheManager::kSizeUnknown;
+  level_jobs[0].children = children[""];
+  while (!level_jobs.empty()) {
+    Level level;
+    level.prefetcher = this;
+    level.jobs = &level_jobs;
+    atomic_init32(&level.next_job);
+    const unsigned num_threads =
+      std::min(num_workers_, static_cast<unsigned>(level_jobs.size()));
+    vector<pthread_t> threads(num_threads);
+    for (unsigned i = 0; i < num_threads; ++i) {
+      int retval = pthread_create(&threads[i], NULL, MainWorker, &level);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < num_threads; ++i)
+      pthread_join(threads[i], NULL);
+    if (atomic_read32(&terminate_) != 0)
+      return;
+
+    vector<Job> next_jobs;
+    for (unsigned i = 0; i < level_jobs.size(); ++i) {
+      const Job &job = level_jobs[i];
+      for (unsigned j = 0; j < job.child_hashes.size(); ++j) {
+        if (job.child_hashes[j].IsNull())
+          continue;
+        Job next_job;
+        next_job.path = job.children[j];
+        next_job.hash = job.child_hashes[j];
+        next_job.size = job.child_sizes[j];
+        map<string, vector<string> >::const_iterator grandchildren =
+          children.find(next_job.path);
+        if (grandchildren != children.end())
+          next_job.children = grandchildren->second;
+        next_jobs.push_back(next_job);
+      }
+    }
+    level_jobs.swap(next_jobs);
+  }
+}
+
+
+/**
+ * Fetches the catalog and, if it has children in the history, looks up their
+ * hashes.  The root catalog is mounted, so that fetching it is a cache hit.
+ */
+void CatalogPrefetcher::ProcessJob(Job *job) {
+  const string description = "prefetched catalog " + job->path;
+  int fd = fetcher_->Fetch(job->hash, job->size, description,
+                           zlib::kZlibDefault, CacheManager::kTypeRegular, "");
+  if (fd < 0) {
+    LogCvmfs(kLogCatalog, kLogDebug, "failed to prefetch catalog %s (%d)",
+             job->path.c_str(), fd);
+    perf::Inc(n_failed_);
+    return;
+  }
+  const bool is_root = job->path.empty();
+  if (!is_root)
+    perf::Inc(n_prefetched_);
+  if (job->children.empty()) {
+    fetcher_->cache_mgr()->Close(fd);
+    return;
+  }
+
+  // The catalog owns the file descriptor from now on
+  Catalog *catalog = Catalog::AttachFreely(job->path,
+                                           "@" + StringifyInt(fd),
+                                           job->hash,
+                                           NULL,
+                                           !is_root);
+  if (catalog == NULL) {
+    perf::Inc(n_failed_);
+    return;
+  }
+  ResolveNested(*catalog, job);
+  delete catalog;
+}
+
+
+/**
+ * Children that are not (or no longer) nested catalogs of the given catalog
+ * are stale entries of the history.
+ */
+void CatalogPrefetcher::ResolveNested(const Catalog &catalog, Job *job) {
+  perf::Xadd(n_scheduled_, job->children.size());
+  job->child_hashes.assign(job->children.size(), shash::Any());
+  job->child_sizes.assign(job->children.size(), 0);
+  for (unsigned i = 0; i < job->children.size(); ++i) {
+    if (!catalog.FindNested(PathString(job->children[i]),
+                            &job->child_hashes[i], &job->child_sizes[i]))
+    {
+      LogCvmfs(kLogCatalog, kLogDebug, "catalog %s not found in %s",
+               job->children[i].c_str(), job->path.c_str());
+      job->child_hashes[i] = shash::Any();
+      perf::Inc(n_stale_);
+    }
+  }
+}
+
+
+void CatalogPrefetcher::Spawn() {
+  int retval = pthread_create(&thread_prefetch_, NULL, MainPrefetch, this);
+  assert(retval == 0);
+  spawned_ = true;
+}
+
+}  // namespace catalog
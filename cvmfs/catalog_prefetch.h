@@ -0,0 +1,151 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CATALOG_PREFETCH_H_
+#define CVMFS_CATALOG_PREFETCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "gtest/gtest_prod.h"
+#include "hash.h"
+#include "shortstring.h"
+#include "statistics.h"
+#include "util/single_copy.h"
+
+namespace cvmfs {
+class Fetcher;
+}
+
+namespace catalog {
+
+class Catalog;
+
+/**
+ * Warms the cache with the nested catalogs that are likely needed after the
+ * root catalog was attached, i.e. after mount and after a catalog reload.
+ *
+ * The client catalog manager reports the nested catalogs that it mounts
+ * within kRecordWindow seconds after the root catalog was attached.  Attaching
+ * the next root catalog closes such a round: all scores are halved and the
+ * catalogs of the round get kScoreHit points.  The scores are kept per
+ * repository in the workspace, so they survive remounts.
+ *
+ * The catalogs with a score of at least kScoreThreshold are fetched in the
+ * background, level by level, by a pool of worker threads.  Their hashes are
+ * taken from the parent catalogs of the new revision.  The parent of a catalog
+ * is the deepest catalog of the history above it.  Every parent is opened
+ * once, by the worker that fetched it, to look up all of its children.
+ * Catalogs are only fetched
+ * into the cache as regular objects; they are mounted on demand as before,
+ * which keeps the history free from prefetched catalogs.
+ */
+class CatalogPrefetcher : SingleCopy {
+ public:
+  /**
+   * Seconds after the root catalog was attached in which nested catalog
+   * mounts are recorded
+   */
+  static const unsigned kRecordWindow = 300;
+  static const unsigned kScoreHit = 16;
+  /**
+   * Reached by the catalogs mounted in one of the last two rounds
+   */
+  static const unsigned kScoreThreshold = kScoreHit / 2;
+  /**
+   * Upper bound for the number of catalogs in the history
+   */
+  static const unsigned kMaxCatalogs = 1024;
+  static const unsigned kMaxWorkers = 32;
+
+  CatalogPrefetcher(const std::string &history_path,
+                    cvmfs::Fetcher *fetcher,
+                    const unsigned num_workers,
+                    perf::StatisticsTemplate statistics);
+  ~CatalogPrefetcher();
+  bool Load();
+  bool Save();
+  void Spawn();
+
+  void OnRootCatalog(const shash::Any &root_hash);
+  void OnNestedCatalog(const PathString &mountpoint);
+
+  std::vector<std::string> GetLikelyCatalogs();
+
+ private:
+  FRIEND_TEST(T_CatalogPrefetcher, GroupByParent);
+  FRIEND_TEST(T_CatalogPrefetcher, ResolveNested);
+
+  static const char *kHeader;
+
+  /**
+   * A catalog to fetch and the catalogs of the history directly below it
+   */
+  struct Job {
+    Job() : size(0) { }
+    std::string path;
+    shash::Any hash;
+    uint64_t size;
+    std::vector<std::string> children;
+    /**
+     * Set by the worker thread, null for children not found in the catalog
+     */
+    std::vector<shash::Any> child_hashes;
+    std::vector<uint64_t> child_sizes;
+  };
+
+  /**
+   * The jobs of one level of the catalog tree
+   */
+  struct Level {
+    CatalogPrefetcher *prefetcher;
+    std::vector<Job> *jobs;
+    atomic_int32 next_job;
+  };
+
+  static void *MainPrefetch(void *data);
+  static void *MainWorker(void *data);
+  static std::map<std::string, std::vector<std::string> > GroupByParent(
+    const std::vector<std::string> &catalogs);
+  void EndRound();
+  void Prefetch(const shash::Any &root_hash,
+                const std::vector<std::string> &catalogs);
+  void ProcessJob(Job *job);
+  void ResolveNested(const Catalog &catalog, Job *job);
+
+  std::string history_path_;
+  cvmfs::Fetcher *fetcher_;
+  unsigned num_workers_;
+  bool spawned_;
+  pthread_t thread_prefetch_;
+  atomic_int32 terminate_;
+
+  /**
+   * Protects the history and the prefetch request
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_request_;
+  std::map<std::string, uint32_t> scores_;
+  std::set<std::string> round_;
+  bool has_round_;
+  uint64_t round_start_;
+  bool is_dirty_;
+  bool has_request_;
+  shash::Any root_hash_;
+
+  perf::Counter *n_scheduled_;
+  perf::Counter *n_prefetched_;
+  perf::Counter *n_stale_;
+  perf::Counter *n_failed_;
+};
+
+}  // namespace catalog
+
+#endif  // CVMFS_CATALOG_PREFETCH_H_
@@ -346,6 +346,16 @@ bool WritableCatalog::SetVOMSAuthz(const std::string &voms_authz) {
 }
 
 
+bool WritableCatalog::SetExtendedCompression() {
+  return database().SetExtendedCompression();
+}
+
+
+bool WritableCatalog::HasExtendedCompression() const {
+  return database().HasExtendedCompression();
+}
+
+
 /**
  * Sets the content hash of the previous catalog revision.
  */
@@ -795,15 +805,17 @@ void WritableCatalog::VacuumDatabaseIfNecessary() {
   }
 
   if (needs_defragmentation) {
-    LogCvmfs(kLogCatalog, kLogStdout | kLogNoLinebreak,
-             "Note: Catalog at %s gets defragmented (%.2f%% %s)... ",
+    // Catalogs are finalized concurrently, keep the note on a single line
+    LogCvmfs(kLogCatalog, kLogStdout,
+             "Note: Catalog at %s gets defragmented (%.2f%% %s)",
              (IsRoot()) ? "/" : mountpoint().c_str(),
              ratio * 100.0,
              reason.c_str());
     if (!db.Vacuum()) {
-      PANIC(kLogStderr, "failed (SQLite: %s)", db.GetLastErrorMsg().c_str());
+      PANIC(kLogStderr, "failed to defragment catalog at %s (SQLite: %s)",
+            (IsRoot()) ? "/" : mountpoint().c_str(),
+            db.GetLastErrorMsg().c_str());
     }
-    LogCvmfs(kLogCatalog, kLogStdout, "done");
   }
 }
 
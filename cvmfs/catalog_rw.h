@@ -105,6 +105,8 @@ class WritableCatalog : public Catalog {
   void SetPreviousRevision(const shash::Any &hash);
   void SetTTL(const uint64_t new_ttl);
   bool SetVOMSAuthz(const std::string &voms_authz);
+  bool SetExtendedCompression();
+  bool HasExtendedCompression() const;
 
  protected:
   static const double kMaximalFreePageRatio;  // = 0.2
@@ -347,6 +347,21 @@ CatalogDatabase::SetVOMSAuthz(const std::string &voms_authz) {
 }
 
 
+/**
+ * Marks the catalog as possibly referencing zstd or lz4 compressed files.  The
+ * schema does not change; the property is checked before such files are
+ * published.
+ */
+bool CatalogDatabase::SetExtendedCompression() {
+  return this->SetProperty("extended_compression", 1);
+}
+
+
+bool CatalogDatabase::HasExtendedCompression() const {
+  return this->HasProperty("extended_compression");
+}
+
+
 double CatalogDatabase::GetRowIdWasteRatio() const {
   SqlCatalog rowid_waste_ratio_query(*this,
     "SELECT 1.0 - CAST(COUNT(*) AS DOUBLE) / MAX(rowid) "
@@ -780,6 +795,15 @@ bool SqlLookupInode::BindRowId(const uint64_t inode) {
 //------------------------------------------------------------------------------
 
 
+SqlAllEntries::SqlAllEntries(const CatalogDatabase &database) {
+  MAKE_STATEMENTS("SELECT @DB_FIELDS@ FROM catalog ORDER BY rowid;");
+  DEFERRED_INITS(database);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 SqlLookupDanglingMountpoints::SqlLookupDanglingMountpoints(
                                      const catalog::CatalogDatabase &database) {
   MAKE_STATEMENTS("SELECT DISTINCT @DB_FIELDS@ FROM catalog "
@@ -58,6 +58,8 @@ class CatalogDatabase : public sqlite::Database<CatalogDatabase> {
 
   double GetRowIdWasteRatio() const;
   bool SetVOMSAuthz(const std::string&);
+  bool SetExtendedCompression();
+  bool HasExtendedCompression() const;
 
  protected:
   // TODO(rmeusel): C++11 - constructor inheritance
@@ -341,6 +343,19 @@ class SqlLookupInode : public SqlLookup {
 //------------------------------------------------------------------------------
 
 
+/**
+ * Iterates over all directory entries of a catalog in rowid order.  Used to
+ * build the CatalogIndex.
+ */
+class SqlAllEntries : public SqlLookup {
+ public:
+  explicit SqlAllEntries(const CatalogDatabase &database);
+};
+
+
+//------------------------------------------------------------------------------
+
+
 /**
  * This SQL statement is only used for legacy catalog migrations and has been
  * moved here as it needs to use a locally defined macro inside catalog_sql.cc
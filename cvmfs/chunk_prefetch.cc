@@ -0,0 +1,265 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "chunk_prefetch.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "clientctx.h"
+#include "fetch.h"
+#include "file_chunk.h"
+#include "logging.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace cvmfs {
+
+const unsigned ChunkPrefetcher::kMaxWindow;
+const unsigned ChunkPrefetcher::kMaxWorkers;
+const unsigned ChunkPrefetcher::kMaxQueuedPerWorker;
+
+
+ChunkPrefetcher::ChunkPrefetcher(
+  Fetcher *fetcher,
+  Fetcher *external_fetcher,
+  const unsigned window,
+  perf::StatisticsTemplate statistics)
+  : fetcher_(fetcher)
+  , external_fetcher_(external_fetcher)
+  , window_(std::min(window, kMaxWindow))
+  , num_workers_(std::max(1U, std::min(window_, kMaxWorkers)))
+  , spawned_(false)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_jobs_, NULL);
+  assert(retval == 0);
+
+  n_scheduled_ = statistics.RegisterTemplated("n_scheduled",
+    "Number of chunks scheduled for read-ahead");
+  n_hit_ = statistics.RegisterTemplated("n_hit",
+    "Number of chunk opens served by read-ahead");
+  n_dropped_ = statistics.RegisterTemplated("n_dropped",
+    "Number of read-ahead requests dropped due to a full queue");
+  n_failed_ = statistics.RegisterTemplated("n_failed",
+    "Number of failed read-ahead fetches");
+  sz_prefetched_ = statistics.RegisterTemplated("sz_prefetched",
+    "Number of bytes scheduled for read-ahead");
+  sz_wasted_ = statistics.RegisterTemplated("sz_wasted",
+    "Number of read-ahead bytes that were never read");
+}
+
+
+ChunkPrefetcher::~ChunkPrefetcher() {
+  if (spawned_) {
+    {
+      MutexLockGuard m(&lock_);
+      jobs_.clear();
+      for (unsigned i = 0; i < workers_.size(); ++i) {
+        Job terminator;
+        terminator.terminate = true;
+        jobs_.push_back(terminator);
+      }
+      pthread_cond_broadcast(&cond_jobs_);
+    }
+    for (unsigned i = 0; i < workers_.size(); ++i)
+      pthread_join(workers_[i], NULL);
+  }
+  pthread_cond_destroy(&cond_jobs_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Called on every switch of a chunk handle to a different chunk.  Detects
+ * sequential access and schedules the chunks in the read-ahead window.
+ */
+void ChunkPrefetcher::OnChunkOpen(
+  const uint64_t chunk_handle,
+  const FileChunkReflist &chunks,
+  const unsigned chunk_idx,
+  const CacheManager::ObjectType object_type)
+{
+  if (window_ == 0)
+    return;
+
+  uid_t uid = -1;
+  gid_t gid = -1;
+  pid_t pid = -1;
+  ClientCtx *ctx = ClientCtx::GetInstance();
+  if (ctx->IsSet())
+    ctx->Get(&uid, &gid, &pid);
+
+  MutexLockGuard m(&lock_);
+  map<uint64_t, HandleState>::iterator iter = handles_.find(chunk_handle);
+  if (iter == handles_.end()) {
+    HandleState state;
+    state.last_idx = chunk_idx;
+    state.next_idx = chunk_idx + 1;
+    handles_[chunk_handle] = state;
+    return;
+  }
+  HandleState *state = &iter->second;
+
+  map<unsigned, uint64_t>::iterator iter_pending =
+    state->pending.find(chunk_idx);
+  if (iter_pending != state->pending.end()) {
+    perf::Inc(n_hit_);
+    state->pending.erase(iter_pending);
+  }
+
+  const bool is_sequential = (chunk_idx == state->last_idx + 1);
+  state->last_idx = chunk_idx;
+  if (!is_sequential) {
+    // Random access: prefetched chunks behind the reader won't be used
+    state->next_idx = chunk_idx + 1;
+    return;
+  }
+
+  // Chunks that the reader skipped over are lost
+  while (!state->pending.empty() &&
+         (state->pending.begin()->first < chunk_idx))
+  {
+    perf::Xadd(sz_wasted_, state->pending.begin()->second);
+    state->pending.erase(state->pending.begin());
+  }
+
+  const unsigned num_chunks = chunks.list->size();
+  const unsigned begin = std::max(state->next_idx, chunk_idx + 1);
+  const unsigned end = std::min(chunk_idx + 1 + window_, num_chunks);
+  for (unsigned i = begin; i < end; ++i) {
+    if (jobs_.size() >= num_workers_ * kMaxQueuedPerWorker) {
+      perf::Inc(n_dropped_);
+      break;
+    }
+    const FileChunk *chunk = chunks.list->AtPtr(i);
+    Job job;
+    job.chunk_handle = chunk_handle;
+    job.chunk_idx = i;
+    job.hash = chunk->content_hash();
+    job.size = chunk->size();
+    job.offset = chunk->offset();
+    job.path = chunks.path.ToString();
+    job.compression_alg = chunks.compression_alg;
+    job.object_type = object_type;
+    job.external_data = chunks.external_data;
+    job.uid = uid;
+    job.gid = gid;
+    job.pid = pid;
+    jobs_.push_back(job);
+    state->pending[i] = job.size;
+    state->next_idx = i + 1;
+    perf::Inc(n_scheduled_);
+    perf::Xadd(sz_prefetched_, job.size);
+  }
+  pthread_cond_signal(&cond_jobs_);
+}
+
+
+/**
+ * Called when a chunk handle is released.  Removes the handle's jobs that did
+ * not yet start and accounts for the prefetched chunks that were never read.
+ */
+void ChunkPrefetcher::Forget(const uint64_t chunk_handle) {
+  if (window_ == 0)
+    return;
+
+  MutexLockGuard m(&lock_);
+  map<uint64_t, HandleState>::iterator iter = handles_.find(chunk_handle);
+  if (iter == handles_.end())
+    return;
+
+  for (deque<Job>::iterator i = jobs_.begin(); i != jobs_.end(); ) {
+    if (!i->terminate && (i->chunk_handle == chunk_handle)) {
+      perf::Xadd(sz_prefetched_, -static_cast<int64_t>(i->size));
+      iter->second.pending.erase(i->chunk_idx);
+      i = jobs_.erase(i);
+    } else {
+      ++i;
+    }
+  }
+  for (map<unsigned, uint64_t>::const_iterator i =
+       iter->second.pending.begin(), iEnd = iter->second.pending.end();
+       i != iEnd; ++i)
+  {
+    perf::Xadd(sz_wasted_, i->second);
+  }
+  handles_.erase(iter);
+}
+
+
+void *ChunkPrefetcher::MainWorker(void *data) {
+  ChunkPrefetcher *prefetcher = reinterpret_cast<ChunkPrefetcher *>(data);
+  LogCvmfs(kLogCvmfs, kLogDebug, "starting chunk read-ahead worker");
+
+  while (true) {
+    Job job;
+    {
+      MutexLockGuard m(&prefetcher->lock_);
+      while (prefetcher->jobs_.empty())
+        pthread_cond_wait(&prefetcher->cond_jobs_, &prefetcher->lock_);
+      job = prefetcher->jobs_.front();
+      prefetcher->jobs_.pop_front();
+    }
+    if (job.terminate)
+      break;
+    prefetcher->ProcessJob(job);
+  }
+
+  LogCvmfs(kLogCvmfs, kLogDebug, "stopping chunk read-ahead worker");
+  return NULL;
+}
+
+
+void ChunkPrefetcher::ProcessJob(const Job &job) {
+  ClientCtxGuard ctx_guard(job.uid, job.gid, job.pid);
+  const string verbose_path = "Part of " + job.path + " (read-ahead)";
+  Fetcher *fetcher = job.external_data ? external_fetcher_ : fetcher_;
+  int fd;
+  if (job.external_data) {
+    fd = fetcher->Fetch(job.hash, job.size, verbose_path, job.compression_alg,
+                        job.object_type, job.path, job.offset);
+  } else {
+    fd = fetcher->Fetch(job.hash, job.size, verbose_path, job.compression_alg,
+                        job.object_type);
+  }
+  if (fd < 0) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "read-ahead of chunk %u of %s failed (%d)",
+             job.chunk_idx, job.path.c_str(), fd);
+    OnJobFailed(job);
+    return;
+  }
+  fetcher->cache_mgr()->Close(fd);
+}
+
+
+/**
+ * The chunk was not prefetched, so it must not be accounted as wasted once
+ * its handle is released.
+ */
+void ChunkPrefetcher::OnJobFailed(const Job &job) {
+  perf::Inc(n_failed_);
+  MutexLockGuard m(&lock_);
+  perf::Xadd(sz_prefetched_, -static_cast<int64_t>(job.size));
+  map<uint64_t, HandleState>::iterator iter = handles_.find(job.chunk_handle);
+  if (iter != handles_.end())
+    iter->second.pending.erase(job.chunk_idx);
+}
+
+
+void ChunkPrefetcher::Spawn() {
+  if (window_ == 0)
+    return;
+  workers_.resize(num_workers_);
+  for (unsigned i = 0; i < num_workers_; ++i) {
+    int retval = pthread_create(&workers_[i], NULL, MainWorker, this);
+    assert(retval == 0);
+  }
+  spawned_ = true;
+}
+
+}  // namespace cvmfs
@@ -0,0 +1,138 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_CHUNK_PREFETCH_H_
+#define CVMFS_CHUNK_PREFETCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "compression.h"
+#include "gtest/gtest_prod.h"
+#include "hash.h"
+#include "statistics.h"
+#include "util/single_copy.h"
+
+struct FileChunkReflist;
+
+namespace cvmfs {
+
+class Fetcher;
+
+/**
+ * Read-ahead for chunked files in the Fuse module.  The fuse module reports
+ * every switch of a chunk handle to a new chunk.  If a handle moves through
+ * its chunks in order, the next chunks within the read-ahead window are
+ * fetched into the cache by a small pool of worker threads while the current
+ * chunk is consumed.  When the reader arrives at a prefetched chunk, the
+ * Fetcher either finds it in the cache or joins the still running download.
+ *
+ * The prefetcher holds no references to the chunk tables, the required chunk
+ * meta-data are copied into the jobs.
+ */
+class ChunkPrefetcher : SingleCopy {
+  FRIEND_TEST(T_ChunkPrefetcher, SequentialDetection);
+  FRIEND_TEST(T_ChunkPrefetcher, Forget);
+  FRIEND_TEST(T_ChunkPrefetcher, FailedJob);
+
+ public:
+  /**
+   * Upper bound for the read-ahead window in number of chunks.
+   */
+  static const unsigned kMaxWindow = 64;
+  /**
+   * The number of worker threads is the window size, capped by this value.
+   */
+  static const unsigned kMaxWorkers = 8;
+  /**
+   * Jobs beyond this number of queued jobs per worker are dropped rather than
+   * blocking the reader.
+   */
+  static const unsigned kMaxQueuedPerWorker = 16;
+
+  ChunkPrefetcher(Fetcher *fetcher,
+                  Fetcher *external_fetcher,
+                  const unsigned window,
+                  perf::StatisticsTemplate statistics);
+  ~ChunkPrefetcher();
+  void Spawn();
+
+  void OnChunkOpen(const uint64_t chunk_handle,
+                   const FileChunkReflist &chunks,
+                   const unsigned chunk_idx,
+                   const CacheManager::ObjectType object_type);
+  void Forget(const uint64_t chunk_handle);
+
+  unsigned window() const { return window_; }
+
+ private:
+  struct Job {
+    Job()
+      : chunk_handle(0), chunk_idx(0), size(0), offset(0)
+      , compression_alg(zlib::kZlibDefault)
+      , object_type(CacheManager::kTypeRegular), external_data(false)
+      , uid(-1), gid(-1), pid(-1), terminate(false) { }
+    uint64_t chunk_handle;
+    unsigned chunk_idx;
+    shash::Any hash;
+    uint64_t size;
+    off_t offset;
+    std::string path;
+    zlib::Algorithms compression_alg;
+    CacheManager::ObjectType object_type;
+    bool external_data;
+    uid_t uid;
+    gid_t gid;
+    pid_t pid;
+    bool terminate;
+  };
+
+  /**
+   * Per chunk handle access history.  Chunks in pending are scheduled or
+   * prefetched but have not yet been opened by the reader.
+   */
+  struct HandleState {
+    HandleState() : last_idx(0), next_idx(0) { }
+    unsigned last_idx;
+    unsigned next_idx;
+    std::map<unsigned, uint64_t> pending;
+  };
+
+  static void *MainWorker(void *data);
+  void ProcessJob(const Job &job);
+  void OnJobFailed(const Job &job);
+
+  Fetcher *fetcher_;
+  Fetcher *external_fetcher_;
+  unsigned window_;
+  unsigned num_workers_;
+  bool spawned_;
+  std::vector<pthread_t> workers_;
+
+  /**
+   * Protects jobs_ and handles_
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_jobs_;
+  std::deque<Job> jobs_;
+  std::map<uint64_t, HandleState> handles_;
+
+  perf::Counter *n_scheduled_;
+  perf::Counter *n_hit_;
+  perf::Counter *n_dropped_;
+  perf::Counter *n_failed_;
+  perf::Counter *sz_prefetched_;
+  perf::Counter *sz_wasted_;
+};
+
+}  // namespace cvmfs
+
+#endif  // CVMFS_CHUNK_PREFETCH_H_
@@ -5,6 +5,11 @@
  * a set of functions to conveniently compress and decompress stuff.
  * Allmost all of the functions return true on success, otherwise false.
  *
+ * If built with zstd and lz4, the corresponding compressors and decompressors
+ * are registered as additional plugins.  Decompression recognizes zstd and lz4
+ * frames by their magic number, so that objects compressed with these
+ * algorithms can be read through the zlib code paths, e.g. catalogs.
+ *
  * TODO: think about code deduplication
  */
 
@@ -12,6 +17,7 @@
 #include "compression.h"
 
 #include <alloca.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 
@@ -24,7 +30,9 @@
 #include "platform.h"
 #include "smalloc.h"
 #include "util/exception.h"
+#include "util/pointer.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -143,15 +151,104 @@ namespace zlib {
 const unsigned kBufferSize = 32768;
 
 /**
- * Aborts if string doesn't match any of the algorithms.
+ * Magic numbers at the beginning of zstd and lz4 frames.  A zlib stream
+ * starts with a CMF byte whose lower nibble is 8, which is never the case for
+ * the first byte of these frames.
+ */
+const unsigned char kMagicZstd[] = {0x28, 0xb5, 0x2f, 0xfd};
+const unsigned char kMagicLz4[] = {0x04, 0x22, 0x4d, 0x18};
+
+#ifdef HAS_ZSTD
+/**
+ * Process-wide zstd compression level, needs to be set before the first
+ * compressor is constructed.
+ */
+static int g_zstd_level = kZstdDefaultLevel;
+
+/**
+ * Every download constructs a new decompressor.  In order to not allocate a
+ * fresh (and rather large) decompression context each time, a finished
+ * decompressor parks its context in a thread-local slot from where the next
+ * decompressor on the same thread picks it up.
+ */
+static pthread_key_t g_zstd_dctx_key;
+static pthread_once_t g_zstd_dctx_once = PTHREAD_ONCE_INIT;
+
+static void FreeZstdDCtx(void *dctx) {
+  ZSTD_freeDCtx(reinterpret_cast<ZSTD_DCtx *>(dctx));
+}
+
+static void InitZstdDCtxKey() {
+  int retval = pthread_key_create(&g_zstd_dctx_key, FreeZstdDCtx);
+  assert(retval == 0);
+}
+
+static ZSTD_DCtx *AcquireZstdDCtx() {
+  pthread_once(&g_zstd_dctx_once, InitZstdDCtxKey);
+  ZSTD_DCtx *dctx =
+    reinterpret_cast<ZSTD_DCtx *>(pthread_getspecific(g_zstd_dctx_key));
+  if (dctx == NULL)
+    return ZSTD_createDCtx();
+  pthread_setspecific(g_zstd_dctx_key, NULL);
+  return dctx;
+}
+
+static void ReleaseZstdDCtx(ZSTD_DCtx *dctx) {
+  pthread_once(&g_zstd_dctx_once, InitZstdDCtxKey);
+  if (pthread_getspecific(g_zstd_dctx_key) != NULL) {
+    ZSTD_freeDCtx(dctx);
+    return;
+  }
+  pthread_setspecific(g_zstd_dctx_key, dctx);
+}
+#endif
+
+#ifdef HAS_LZ4
+static void InitLz4Preferences(LZ4F_preferences_t *preferences) {
+  memset(preferences, 0, sizeof(LZ4F_preferences_t));
+  preferences->frameInfo.blockSizeID = LZ4F_max64KB;
+}
+#endif
+
+
+/**
+ * Aborts if string doesn't match any of the algorithms or if the algorithm
+ * is not available in this build.  The zstd algorithm can be followed by a
+ * compression level, e.g. zstd:19.
  */
 Algorithms ParseCompressionAlgorithm(const std::string &algorithm_option) {
-  if ((algorithm_option == "default") || (algorithm_option == "zlib"))
-    return kZlibDefault;
-  if (algorithm_option == "none")
-    return kNoCompression;
-  PANIC(kLogStderr, "unknown compression algorithms: %s",
-        algorithm_option.c_str());
+  Algorithms result;
+  const std::string name =
+    algorithm_option.substr(0, algorithm_option.find(':'));
+  if ((algorithm_option == "default") || (algorithm_option == "zlib")) {
+    result = kZlibDefault;
+  } else if (algorithm_option == "none") {
+    result = kNoCompression;
+  } else if (name == "zstd") {
+    result = kZstd;
+  } else if (algorithm_option == "lz4") {
+    result = kLz4;
+  } else {
+    PANIC(kLogStderr, "unknown compression algorithms: %s",
+          algorithm_option.c_str());
+  }
+  if (!IsAvailable(result)) {
+    PANIC(kLogStderr, "compression algorithm %s not supported by this build",
+          algorithm_option.c_str());
+  }
+  return result;
+}
+
+
+/**
+ * Returns the level given after the colon of the algorithm option or 0 for the
+ * default level of the algorithm.
+ */
+int ParseCompressionLevel(const std::string &algorithm_option) {
+  const size_t pos = algorithm_option.find(':');
+  if (pos == std::string::npos)
+    return 0;
+  return String2Int64(algorithm_option.substr(pos + 1));
 }
 
 
@@ -163,6 +260,12 @@ std::string AlgorithmName(const zlib::Algorithms alg) {
     case kNoCompression:
       return "none";
       break;
+    case kZstd:
+      return "zstd";
+      break;
+    case kLz4:
+      return "lz4";
+      break;
     // Purposely did not add a 'default' statement here: this will
     // cause the compiler to generate a warning if a new algorithm
     // is added but this function is not updated.
@@ -171,6 +274,58 @@ std::string AlgorithmName(const zlib::Algorithms alg) {
 }
 
 
+bool IsAvailable(const zlib::Algorithms alg) {
+  switch (alg) {
+    case kZlibDefault:
+    case kNoCompression:
+      return true;
+    case kZstd:
+#ifdef HAS_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    case kLz4:
+#ifdef HAS_LZ4
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+
+/**
+ * Identifies zstd and lz4 frames, returns fallback for all other data.  Used
+ * where the compression algorithm is not recorded, e.g. for catalogs.
+ */
+Algorithms DetectAlgorithm(
+  const void *buf,
+  const int64_t size,
+  const Algorithms fallback)
+{
+  if (size < 4)
+    return fallback;
+  if (memcmp(buf, kMagicZstd, sizeof(kMagicZstd)) == 0)
+    return kZstd;
+  if (memcmp(buf, kMagicLz4, sizeof(kMagicLz4)) == 0)
+    return kLz4;
+  return fallback;
+}
+
+
+/**
+ * Levels outside the range of zstd are clamped by the library.  Without zstd,
+ * the level is ignored.
+ */
+void SetZstdLevel(const int level) {
+#ifdef HAS_ZSTD
+  g_zstd_level = (level == 0) ? kZstdDefaultLevel : level;
+#endif
+}
+
+
 void CompressInit(z_stream *strm) {
   strm->zalloc = Z_NULL;
   strm->zfree = Z_NULL;
@@ -315,6 +470,75 @@ StreamStates DecompressZStream2File(
 }
 
 
+namespace {
+
+/**
+ * Lets DecompressStream2File() share the implementation of
+ * DecompressStream2Sink()
+ */
+class FileSink : public cvmfs::Sink {
+ public:
+  explicit FileSink(FILE *f) : file_(f) { }
+  virtual ~FileSink() { }
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    if ((fwrite(buf, 1, sz, file_) != sz) || ferror(file_)) {
+      LogCvmfs(kLogCompress, kLogDebug, "Inflate to file failed with %s "
+               "(errno=%d)", strerror(errno), errno);
+      return -1;
+    }
+    return sz;
+  }
+  virtual int Reset() { return -1; }
+
+ private:
+  FILE *file_;
+};
+
+}  // anonymous namespace
+
+
+StreamStates DecompressStream2Sink(
+  const void *buf,
+  const int64_t size,
+  Decompressor *decompressor,
+  cvmfs::Sink *sink)
+{
+  unsigned char out[kZChunk];
+  unsigned char *in = static_cast<unsigned char *>(const_cast<void *>(buf));
+  size_t remaining = size;
+  StreamStates state;
+  size_t have;
+
+  // Run inflate until the input is consumed and the output buffer not full
+  do {
+    unsigned char *out_ptr = out;
+    const size_t remaining_before = remaining;
+    have = kZChunk;
+    state = decompressor->Inflate(&in, &remaining, &out_ptr, &have);
+    if ((state == kStreamDataError) || (state == kStreamIOError))
+      return state;
+    int64_t written = sink->Write(out, have);
+    if ((written < 0) || (static_cast<uint64_t>(written) != have))
+      return kStreamIOError;
+    if ((have == 0) && (remaining == remaining_before))
+      break;
+  } while ((state != kStreamEnd) && ((remaining > 0) || (have == kZChunk)));
+
+  return state;
+}
+
+
+StreamStates DecompressStream2File(
+  const void *buf,
+  const int64_t size,
+  Decompressor *decompressor,
+  FILE *f)
+{
+  FileSink sink(f);
+  return DecompressStream2Sink(buf, size, decompressor, &sink);
+}
+
+
 bool CompressPath2Path(const string &src, const string &dest) {
   FILE *fsrc = fopen(src.c_str(), "r");
   if (!fsrc) {
@@ -638,29 +862,26 @@ bool CompressFile2File(FILE *fsrc, FILE *fdest, shash::Any *compressed_hash) {
 
 
 bool DecompressFile2File(FILE *fsrc, FILE *fdest) {
-  bool result = false;
   StreamStates stream_state = kStreamIOError;
-  z_stream strm;
+  UniquePtr<Decompressor> decompressor;
   size_t have;
   unsigned char buf[kBufferSize];
 
-  DecompressInit(&strm);
-
   while ((have = fread(buf, 1, kBufferSize, fsrc)) > 0) {
-    stream_state = DecompressZStream2File(buf, have, &strm, fdest);
+    if (!decompressor.IsValid()) {
+      decompressor =
+        Decompressor::Construct(DetectAlgorithm(buf, have, kZlibDefault));
+      if (!decompressor.IsValid())
+        return false;
+    }
+    stream_state =
+      DecompressStream2File(buf, have, decompressor.weak_ref(), fdest);
     if ((stream_state == kStreamDataError) || (stream_state == kStreamIOError))
-      goto decompress_file2file_final;
+      return false;
   }
   LogCvmfs(kLogCompress, kLogDebug, "end of decompression, state=%d, error=%d",
            stream_state, ferror(fsrc));
-  if ((stream_state != kStreamEnd) || ferror(fsrc))
-    goto decompress_file2file_final;
-
-  result = true;
-
- decompress_file2file_final:
-  DecompressFini(&strm);
-  return result;
+  return (stream_state == kStreamEnd) && !ferror(fsrc);
 }
 
 
@@ -791,12 +1012,94 @@ bool CompressMem2Mem(const void *buf, const int64_t size,
 }
 
 
+/**
+ * Compression through the Compressor plugins.  User of this function has to
+ * free out_buf.
+ */
+bool CompressMem2Mem(const void *buf, const int64_t size,
+                     const Algorithms alg,
+                     void **out_buf, uint64_t *out_size)
+{
+  if (alg == kZlibDefault)
+    return CompressMem2Mem(buf, size, out_buf, out_size);
+
+  UniquePtr<Compressor> compressor(Compressor::Construct(alg));
+  if (!compressor.IsValid())
+    return false;
+  uint64_t alloc_size = compressor->DeflateBound(size);
+  *out_buf = smalloc(alloc_size);
+  *out_size = 0;
+
+  unsigned char *in = static_cast<unsigned char *>(const_cast<void *>(buf));
+  size_t remaining = size;
+  bool done;
+  do {
+    if (*out_size == alloc_size) {
+      alloc_size *= 2;
+      *out_buf = srealloc(*out_buf, alloc_size);
+    }
+    unsigned char *out = static_cast<unsigned char *>(*out_buf) + *out_size;
+    size_t have = alloc_size - *out_size;
+    done = compressor->Deflate(true, &in, &remaining, &out, &have);
+    *out_size += have;
+  } while (!done);
+  return true;
+}
+
+
+/**
+ * Decompression through the Decompressor plugins.  User of this function has
+ * to free out_buf.
+ */
+static bool DecompressMem2Mem(const void *buf, const int64_t size,
+                              const Algorithms alg,
+                              void **out_buf, uint64_t *out_size)
+{
+  UniquePtr<Decompressor> decompressor(Decompressor::Construct(alg));
+  if (!decompressor.IsValid())
+    return false;
+  uint64_t alloc_size = kZChunk;
+  *out_buf = smalloc(alloc_size);
+  *out_size = 0;
+
+  unsigned char *in = static_cast<unsigned char *>(const_cast<void *>(buf));
+  size_t remaining = size;
+  StreamStates state;
+  do {
+    if (*out_size == alloc_size) {
+      alloc_size *= 2;
+      *out_buf = srealloc(*out_buf, alloc_size);
+    }
+    unsigned char *out = static_cast<unsigned char *>(*out_buf) + *out_size;
+    const size_t remaining_before = remaining;
+    size_t have = alloc_size - *out_size;
+    state = decompressor->Inflate(&in, &remaining, &out, &have);
+    *out_size += have;
+    if ((have == 0) && (remaining == remaining_before))
+      break;
+  } while ((state == kStreamContinue) &&
+           ((remaining > 0) || (*out_size == alloc_size)));
+
+  if (state != kStreamEnd) {
+    free(*out_buf);
+    *out_buf = NULL;
+    *out_size = 0;
+    return false;
+  }
+  return true;
+}
+
+
 /**
  * User of this function has to free out_buf.
  */
 bool DecompressMem2Mem(const void *buf, const int64_t size,
                        void **out_buf, uint64_t *out_size)
 {
+  const Algorithms alg = DetectAlgorithm(buf, size, kZlibDefault);
+  if (alg != kZlibDefault)
+    return DecompressMem2Mem(buf, size, alg, out_buf, out_size);
+
   unsigned char out[kZChunk];
   int z_ret;
   z_stream strm;
@@ -858,6 +1161,23 @@ bool DecompressMem2Mem(const void *buf, const int64_t size,
 void Compressor::RegisterPlugins() {
   RegisterPlugin<ZlibCompressor>();
   RegisterPlugin<EchoCompressor>();
+#ifdef HAS_ZSTD
+  RegisterPlugin<ZstdCompressor>();
+#endif
+#ifdef HAS_LZ4
+  RegisterPlugin<Lz4Compressor>();
+#endif
+}
+
+
+void Decompressor::RegisterPlugins() {
+  RegisterPlugin<ZlibDecompressor>();
+#ifdef HAS_ZSTD
+  RegisterPlugin<ZstdDecompressor>();
+#endif
+#ifdef HAS_LZ4
+  RegisterPlugin<Lz4Decompressor>();
+#endif
 }
 
 
@@ -979,4 +1299,342 @@ size_t EchoCompressor::DeflateBound(const size_t bytes) {
   return (bytes == 0) ? 1 : bytes;
 }
 
+
+//------------------------------------------------------------------------------
+
+
+#ifdef HAS_ZSTD
+
+bool ZstdCompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kZstd;
+}
+
+
+ZstdCompressor::ZstdCompressor(const Algorithms &alg)
+  : Compressor(alg)
+  , stream_(ZSTD_createCCtx())
+  , is_pristine_(true)
+{
+  assert(stream_ != NULL);
+  const size_t retval =
+    ZSTD_CCtx_setParameter(stream_, ZSTD_c_compressionLevel, g_zstd_level);
+  assert(!ZSTD_isError(retval));
+}
+
+
+ZstdCompressor::~ZstdCompressor() {
+  ZSTD_freeCCtx(stream_);
+}
+
+
+/**
+ * The zstd streaming context cannot be copied, so only a compressor that did
+ * not see any data can be cloned.
+ */
+Compressor* ZstdCompressor::Clone() {
+  assert(is_pristine_);
+  return new ZstdCompressor(kZstd);
+}
+
+
+bool ZstdCompressor::Deflate(
+  const bool flush,
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  ZSTD_inBuffer input = {*inbuf, *inbufsize, 0};
+  ZSTD_outBuffer output = {*outbuf, *outbufsize, 0};
+  const ZSTD_EndDirective mode = flush ? ZSTD_e_end : ZSTD_e_continue;
+  is_pristine_ = false;
+
+  size_t remaining;
+  do {
+    // For ZSTD_e_end, the number of bytes left to flush
+    remaining = ZSTD_compressStream2(stream_, &output, &input, mode);
+    assert(!ZSTD_isError(remaining));
+  } while ((output.pos < output.size) &&
+           (flush ? (remaining > 0) : (input.pos < input.size)));
+
+  *inbuf += input.pos;
+  *inbufsize -= input.pos;
+  *outbufsize = output.pos;
+
+  return flush ? (remaining == 0) : (*inbufsize == 0);
+}
+
+
+size_t ZstdCompressor::DeflateBound(const size_t bytes) {
+  return ZSTD_compressBound(bytes);
+}
+
+
+//------------------------------------------------------------------------------
+
+
+bool ZstdDecompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kZstd;
+}
+
+
+ZstdDecompressor::ZstdDecompressor(const Algorithms &alg)
+  : Decompressor(alg)
+  , stream_(AcquireZstdDCtx())
+{
+  assert(stream_ != NULL);
+  // A recycled context may still carry the state of its previous stream
+  ZSTD_DCtx_reset(stream_, ZSTD_reset_session_and_parameters);
+}
+
+
+ZstdDecompressor::~ZstdDecompressor() {
+  ReleaseZstdDCtx(stream_);
+}
+
+
+StreamStates ZstdDecompressor::Inflate(
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  ZSTD_inBuffer input = {*inbuf, *inbufsize, 0};
+  ZSTD_outBuffer output = {*outbuf, *outbufsize, 0};
+  // Zero once a frame is completely decoded and flushed
+  const size_t retval = ZSTD_decompressStream(stream_, &output, &input);
+  if (ZSTD_isError(retval)) {
+    LogCvmfs(kLogCompress, kLogDebug, "zstd decompression failed: %s",
+             ZSTD_getErrorName(retval));
+    return kStreamDataError;
+  }
+
+  *inbuf += input.pos;
+  *inbufsize -= input.pos;
+  *outbufsize = output.pos;
+  return (retval == 0) ? kStreamEnd : kStreamContinue;
+}
+
+
+void ZstdDecompressor::Reset() {
+  ZSTD_DCtx_reset(stream_, ZSTD_reset_session_only);
+}
+
+#endif  // HAS_ZSTD
+
+
+//------------------------------------------------------------------------------
+
+
+#ifdef HAS_LZ4
+
+bool Lz4Compressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kLz4;
+}
+
+
+Lz4Compressor::Lz4Compressor(const Algorithms &alg)
+  : Compressor(alg)
+  , stream_(NULL)
+  , is_started_(false)
+  , is_finished_(false)
+  , staging_pos_(0)
+  , staging_size_(0)
+{
+  LZ4F_errorCode_t retval =
+    LZ4F_createCompressionContext(&stream_, LZ4F_VERSION);
+  assert(!LZ4F_isError(retval));
+  LZ4F_preferences_t preferences;
+  InitLz4Preferences(&preferences);
+  // Large enough for a compressed block including the frame header and footer
+  staging_capacity_ = LZ4F_compressBound(kBlockSize, &preferences) +
+                      LZ4F_HEADER_SIZE_MAX;
+  staging_ = reinterpret_cast<unsigned char *>(smalloc(staging_capacity_));
+}
+
+
+Lz4Compressor::~Lz4Compressor() {
+  LZ4F_freeCompressionContext(stream_);
+  free(staging_);
+}
+
+
+Compressor* Lz4Compressor::Clone() {
+  assert(!is_started_);
+  return new Lz4Compressor(kLz4);
+}
+
+
+/**
+ * Fills the staging buffer with the next piece of the lz4 frame
+ */
+void Lz4Compressor::Stage(const size_t size) {
+  assert(!LZ4F_isError(size));
+  staging_pos_ = 0;
+  staging_size_ = size;
+}
+
+
+bool Lz4Compressor::Deflate(
+  const bool flush,
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  size_t out_pos = 0;
+  while (true) {
+    if (staging_pos_ < staging_size_) {
+      const size_t nbytes =
+        std::min(staging_size_ - staging_pos_, *outbufsize - out_pos);
+      memcpy(*outbuf + out_pos, staging_ + staging_pos_, nbytes);
+      staging_pos_ += nbytes;
+      out_pos += nbytes;
+      if (staging_pos_ < staging_size_)
+        break;
+    }
+
+    if (!is_started_) {
+      LZ4F_preferences_t preferences;
+      InitLz4Preferences(&preferences);
+      Stage(LZ4F_compressBegin(stream_, staging_, staging_capacity_,
+                               &preferences));
+      is_started_ = true;
+    } else if (*inbufsize > 0) {
+      const size_t nbytes =
+        (*inbufsize < kBlockSize) ? *inbufsize : size_t(kBlockSize);
+      Stage(LZ4F_compressUpdate(stream_, staging_, staging_capacity_,
+                                *inbuf, nbytes, NULL));
+      *inbuf += nbytes;
+      *inbufsize -= nbytes;
+    } else if (flush && !is_finished_) {
+      Stage(LZ4F_compressEnd(stream_, staging_, staging_capacity_, NULL));
+      is_finished_ = true;
+    } else {
+      break;
+    }
+  }
+  *outbufsize = out_pos;
+
+  if (!flush)
+    return *inbufsize == 0;
+  if (!is_finished_ || (staging_pos_ < staging_size_))
+    return false;
+  // Ready for the next frame
+  is_started_ = is_finished_ = false;
+  return true;
+}
+
+
+size_t Lz4Compressor::DeflateBound(const size_t bytes) {
+  LZ4F_preferences_t preferences;
+  InitLz4Preferences(&preferences);
+  return LZ4F_compressBound(bytes, &preferences) + LZ4F_HEADER_SIZE_MAX;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+bool Lz4Decompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kLz4;
+}
+
+
+Lz4Decompressor::Lz4Decompressor(const Algorithms &alg)
+  : Decompressor(alg)
+  , stream_(NULL)
+  , is_finished_(false)
+{
+  LZ4F_errorCode_t retval =
+    LZ4F_createDecompressionContext(&stream_, LZ4F_VERSION);
+  assert(!LZ4F_isError(retval));
+}
+
+
+Lz4Decompressor::~Lz4Decompressor() {
+  LZ4F_freeDecompressionContext(stream_);
+}
+
+
+StreamStates Lz4Decompressor::Inflate(
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  if (is_finished_) {
+    *outbufsize = 0;
+    return kStreamEnd;
+  }
+  size_t consumed = *inbufsize;
+  size_t produced = *outbufsize;
+  // Zero once the frame is completely decoded and flushed
+  const size_t retval =
+    LZ4F_decompress(stream_, *outbuf, &produced, *inbuf, &consumed, NULL);
+  if (LZ4F_isError(retval)) {
+    LogCvmfs(kLogCompress, kLogDebug, "lz4 decompression failed: %s",
+             LZ4F_getErrorName(retval));
+    return kStreamDataError;
+  }
+
+  *inbuf += consumed;
+  *inbufsize -= consumed;
+  *outbufsize = produced;
+  is_finished_ = (retval == 0);
+  return is_finished_ ? kStreamEnd : kStreamContinue;
+}
+
+
+void Lz4Decompressor::Reset() {
+  LZ4F_resetDecompressionContext(stream_);
+  is_finished_ = false;
+}
+
+#endif  // HAS_LZ4
+
+
+//------------------------------------------------------------------------------
+
+
+bool ZlibDecompressor::WillHandle(const zlib::Algorithms &alg) {
+  return alg == kZlibDefault;
+}
+
+
+ZlibDecompressor::ZlibDecompressor(const Algorithms &alg)
+  : Decompressor(alg)
+{
+  DecompressInit(&stream_);
+}
+
+
+ZlibDecompressor::~ZlibDecompressor() {
+  DecompressFini(&stream_);
+}
+
+
+StreamStates ZlibDecompressor::Inflate(
+  unsigned char **inbuf, size_t *inbufsize,
+  unsigned char **outbuf, size_t *outbufsize)
+{
+  stream_.avail_in = *inbufsize;
+  stream_.next_in = *inbuf;
+  stream_.avail_out = *outbufsize;
+  stream_.next_out = *outbuf;
+
+  int z_ret = inflate(&stream_, Z_NO_FLUSH);
+  switch (z_ret) {
+    case Z_NEED_DICT:
+    case Z_STREAM_ERROR:
+    case Z_DATA_ERROR:
+      return kStreamDataError;
+    case Z_MEM_ERROR:
+      return kStreamIOError;
+  }
+
+  *outbufsize -= stream_.avail_out;
+  *inbuf = stream_.next_in;
+  *inbufsize = stream_.avail_in;
+  return (z_ret == Z_STREAM_END) ? kStreamEnd : kStreamContinue;
+}
+
+
+void ZlibDecompressor::Reset() {
+  int retval = inflateReset(&stream_);
+  assert(retval == Z_OK);
+}
+
 }  // namespace zlib
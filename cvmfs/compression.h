@@ -11,6 +11,13 @@
 
 #include <string>
 
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAS_LZ4
+#include <lz4frame.h>
+#endif
+
 #include "duplex_zlib.h"
 #include "sink.h"
 #include "util/plugin.h"
@@ -40,12 +47,19 @@ enum StreamStates {
   kStreamEnd,
 };
 
-// Do not change order of algorithms.  Used as flags in the catalog
+// Do not change order of algorithms.  Used as flags in the catalog (3 bits)
 enum Algorithms {
   kZlibDefault = 0,
   kNoCompression,
+  kZstd,
+  kLz4,
 };
 
+/**
+ * Compression level used by the zstd compressor if not set otherwise
+ */
+const int kZstdDefaultLevel = 3;
+
 /**
  * Abstract Compression class which is inherited by implementations of
  * compression engines such as zlib.
@@ -125,8 +139,142 @@ class EchoCompressor: public Compressor {
 };
 
 
+#ifdef HAS_ZSTD
+/**
+ * Uses the compression level set by SetZstdLevel().
+ */
+class ZstdCompressor: public Compressor {
+ public:
+  explicit ZstdCompressor(const Algorithms &alg);
+  ~ZstdCompressor();
+
+  bool Deflate(const bool flush,
+               unsigned char **inbuf, size_t *inbufsize,
+               unsigned char **outbuf, size_t *outbufsize);
+  size_t DeflateBound(const size_t bytes);
+  Compressor* Clone();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  ZSTD_CCtx *stream_;
+  bool is_pristine_;
+};
+#endif
+
+
+#ifdef HAS_LZ4
+/**
+ * Produces lz4 frames.  The lz4 frame API requires output buffers that can
+ * hold a complete compressed block, so the compressed data are staged in an
+ * internal buffer if the output buffer is too small.
+ */
+class Lz4Compressor: public Compressor {
+ public:
+  explicit Lz4Compressor(const Algorithms &alg);
+  ~Lz4Compressor();
+
+  bool Deflate(const bool flush,
+               unsigned char **inbuf, size_t *inbufsize,
+               unsigned char **outbuf, size_t *outbufsize);
+  size_t DeflateBound(const size_t bytes);
+  Compressor* Clone();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  static const size_t kBlockSize = 64 * 1024;
+
+  void Stage(const size_t size);
+
+  LZ4F_cctx *stream_;
+  bool is_started_;
+  bool is_finished_;
+  unsigned char *staging_;
+  size_t staging_capacity_;
+  size_t staging_pos_;
+  size_t staging_size_;
+};
+#endif
+
+
+/**
+ * Counterpart of the Compressor that inflates a stream of compressed data.
+ * The arguments of Inflate() work like the ones of Compressor::Deflate().
+ * Inflate() returns kStreamEnd when the end of the compressed stream has been
+ * reached, kStreamContinue if it needs more input or output space, and
+ * kStreamDataError on corrupted input.  Reset() prepares the decompressor for
+ * a new stream, e.g. when a download is retried.
+ */
+class Decompressor: public PolymorphicConstruction<Decompressor, Algorithms> {
+ public:
+  explicit Decompressor(const Algorithms &alg) { }
+  virtual ~Decompressor() { }
+
+  virtual StreamStates Inflate(unsigned char **inbuf, size_t *inbufsize,
+                               unsigned char **outbuf, size_t *outbufsize) = 0;
+  virtual void Reset() = 0;
+
+  static void RegisterPlugins();
+};
+
+
+class ZlibDecompressor: public Decompressor {
+ public:
+  explicit ZlibDecompressor(const Algorithms &alg);
+  ~ZlibDecompressor();
+
+  StreamStates Inflate(unsigned char **inbuf, size_t *inbufsize,
+                       unsigned char **outbuf, size_t *outbufsize);
+  void Reset();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  z_stream stream_;
+};
+
+
+#ifdef HAS_ZSTD
+class ZstdDecompressor: public Decompressor {
+ public:
+  explicit ZstdDecompressor(const Algorithms &alg);
+  ~ZstdDecompressor();
+
+  StreamStates Inflate(unsigned char **inbuf, size_t *inbufsize,
+                       unsigned char **outbuf, size_t *outbufsize);
+  void Reset();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  ZSTD_DCtx *stream_;
+};
+#endif
+
+
+#ifdef HAS_LZ4
+class Lz4Decompressor: public Decompressor {
+ public:
+  explicit Lz4Decompressor(const Algorithms &alg);
+  ~Lz4Decompressor();
+
+  StreamStates Inflate(unsigned char **inbuf, size_t *inbufsize,
+                       unsigned char **outbuf, size_t *outbufsize);
+  void Reset();
+  static bool WillHandle(const zlib::Algorithms &alg);
+
+ private:
+  LZ4F_dctx *stream_;
+  bool is_finished_;
+};
+#endif
+
+
 Algorithms ParseCompressionAlgorithm(const std::string &algorithm_option);
+int ParseCompressionLevel(const std::string &algorithm_option);
 std::string AlgorithmName(const zlib::Algorithms alg);
+bool IsAvailable(const zlib::Algorithms alg);
+Algorithms DetectAlgorithm(const void *buf, const int64_t size,
+                           const Algorithms fallback);
+
+void SetZstdLevel(const int level);
 
 
 void CompressInit(z_stream *strm);
@@ -141,6 +289,11 @@ StreamStates DecompressZStream2File(const void *buf, const int64_t size,
                                     z_stream *strm, FILE *f);
 StreamStates DecompressZStream2Sink(const void *buf, const int64_t size,
                                     z_stream *strm, cvmfs::Sink *sink);
+StreamStates DecompressStream2File(const void *buf, const int64_t size,
+                                   Decompressor *decompressor, FILE *f);
+StreamStates DecompressStream2Sink(const void *buf, const int64_t size,
+                                   Decompressor *decompressor,
+                                   cvmfs::Sink *sink);
 
 bool CompressPath2Path(const std::string &src, const std::string &dest);
 bool CompressPath2Path(const std::string &src, const std::string &dest,
@@ -164,6 +317,10 @@ bool CompressMem2File(const unsigned char *buf, const size_t size,
 // User of these functions has to free out_buf, if successful
 bool CompressMem2Mem(const void *buf, const int64_t size,
                      void **out_buf, uint64_t *out_size);
+bool CompressMem2Mem(const void *buf, const int64_t size,
+                     const Algorithms alg,
+                     void **out_buf, uint64_t *out_size);
+// Recognizes zstd and lz4 frames, everything else is inflated with zlib
 bool DecompressMem2Mem(const void *buf, const int64_t size,
                        void **out_buf, uint64_t *out_size);
 
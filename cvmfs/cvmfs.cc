@@ -71,6 +71,8 @@
 #include "backoff.h"
 #include "cache.h"
 #include "catalog_mgr_client.h"
+#include "catalog_prefetch.h"
+#include "chunk_prefetch.h"
 #include "clientctx.h"
 #include "compat.h"
 #include "compression.h"
@@ -89,6 +91,7 @@
 #include "loader.h"
 #include "logging.h"
 #include "lru_md.h"
+#include "lru_snapshot.h"
 #include "manifest_fetch.h"
 #include "monitor.h"
 #include "mountpoint.h"
@@ -287,7 +290,11 @@ static bool GetDirentForPath(const PathString &path,
       return false;
     if (!file_system_->IsNfsSource() && (live_inode != 0))
       dirent->set_inode(live_inode);
-    return true;
+    // Restored entries have no inode until their catalog is attached (see
+    // lru::Md5PathRestorer); unless the kernel still knows the path, the
+    // inode needs to be taken from the catalog
+    if (dirent->inode() != catalog::DirectoryEntry::kInvalidInode)
+      return true;
   }
 
   catalog::ClientCatalogManager *catalog_mgr = mount_point_->catalog_mgr();
@@ -1053,6 +1060,64 @@ static void cvmfs_open(fuse_req_t req, fuse_ino_t ino,
 }
 
 
+/**
+ * Zero-copy reads hand the cache file descriptors to libfuse, which can splice
+ * the data from the page cache into the fuse device instead of copying it
+ * through a buffer in user space.  Requires libfuse >= 2.9 and a cache manager
+ * that works on regular files.  Can be turned off with CVMFS_ZERO_COPY_READ=no.
+ */
+static bool UseZeroCopyRead() {
+#ifdef FUSE_CAP_SPLICE_WRITE
+  return mount_point_->zero_copy_read() &&
+         file_system_->cache_mgr()->HasCapability(
+           CacheManager::kCapFileDescriptor);
+#else
+  return false;
+#endif
+}
+
+
+struct FdRange {
+  int fd;
+  size_t size;
+  off_t pos;
+};
+
+
+/**
+ * Replies to a read request with the concatenation of the given file ranges.
+ * Short reads, e.g. at the end of the file, are handled by libfuse.
+ */
+static void ReplyFdRanges(
+  fuse_req_t req,
+  const FdRange *ranges,
+  const unsigned num_ranges)
+{
+#ifdef FUSE_CAP_SPLICE_WRITE
+  if (num_ranges == 0) {
+    fuse_reply_buf(req, NULL, 0);
+    return;
+  }
+  struct fuse_bufvec *bufvec = static_cast<struct fuse_bufvec *>(alloca(
+    sizeof(struct fuse_bufvec) + (num_ranges - 1) * sizeof(struct fuse_buf)));
+  bufvec->count = num_ranges;
+  bufvec->idx = 0;
+  bufvec->off = 0;
+  for (unsigned i = 0; i < num_ranges; ++i) {
+    bufvec->buf[i].size = ranges[i].size;
+    bufvec->buf[i].flags =
+      static_cast<fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    bufvec->buf[i].mem = NULL;
+    bufvec->buf[i].fd = ranges[i].fd;
+    bufvec->buf[i].pos = ranges[i].pos;
+  }
+  fuse_reply_data(req, bufvec, static_cast<fuse_buf_copy_flags>(0));
+#else
+  PANIC(kLogDebug | kLogSyslogErr, "zero-copy read not supported");
+#endif
+}
+
+
 /**
  * Redirected to pread into cache.
  */
@@ -1067,8 +1132,14 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
            size, off, fi->fh);
   perf::Inc(file_system_->n_fs_read());
 
-  // Get data chunk (<=128k guaranteed by Fuse)
-  char *data = static_cast<char *>(alloca(size));
+  // If the cache file descriptors are real files, hand them to libfuse instead
+  // of copying the data into a buffer
+  const bool zero_copy = UseZeroCopyRead();
+  char *data = NULL;
+  if (!zero_copy) {
+    // Get data chunk (<=128k guaranteed by Fuse)
+    data = static_cast<char *>(alloca(size));
+  }
   unsigned int overall_bytes_fetched = 0;
 
   // Do we have a a chunked file?
@@ -1097,6 +1168,26 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 
     unsigned chunk_idx = chunks.FindChunkIdx(off);
 
+    // For zero-copy reads, every chunk touched by the request needs its own
+    // file descriptor until the reply is sent.  All but the last one are
+    // closed afterwards.
+    FdRange *ranges = NULL;
+    unsigned num_ranges = 0;
+    int *fds_to_close = NULL;
+    unsigned num_fds_to_close = 0;
+    if (zero_copy) {
+      unsigned num_chunks = 0;
+      for (unsigned i = chunk_idx; (i < chunks.list->size()) &&
+           (chunks.list->AtPtr(i)->offset() < off + static_cast<off_t>(size));
+           ++i)
+      {
+        num_chunks++;
+      }
+      num_chunks = std::max(num_chunks, 1U);
+      ranges = static_cast<FdRange *>(alloca(num_chunks * sizeof(FdRange)));
+      fds_to_close = static_cast<int *>(alloca(num_chunks * sizeof(int)));
+    }
+
     // Lock chunk handle
     pthread_mutex_t *handle_lock = chunk_tables->Handle2Lock(chunk_handle);
     MutexLockGuard m(handle_lock);
@@ -1110,7 +1201,12 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     do {
       // Open file descriptor to chunk
       if ((chunk_fd.fd == -1) || (chunk_fd.chunk_idx != chunk_idx)) {
-        if (chunk_fd.fd != -1) file_system_->cache_mgr()->Close(chunk_fd.fd);
+        if (chunk_fd.fd != -1) {
+          if (zero_copy)
+            fds_to_close[num_fds_to_close++] = chunk_fd.fd;
+          else
+            file_system_->cache_mgr()->Close(chunk_fd.fd);
+        }
         string verbose_path = "Part of " + chunks.path.ToString();
         if (chunks.external_data) {
           chunk_fd.fd = mount_point_->external_fetcher()->Fetch(
@@ -1138,10 +1234,17 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
           chunk_tables->Lock();
           chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
           chunk_tables->Unlock();
+          for (unsigned i = 0; i < num_fds_to_close; ++i)
+            file_system_->cache_mgr()->Close(fds_to_close[i]);
           fuse_reply_err(req, EIO);
           return;
         }
         chunk_fd.chunk_idx = chunk_idx;
+        mount_point_->chunk_prefetcher()->OnChunkOpen(
+          chunk_handle, chunks, chunk_idx,
+          mount_point_->catalog_mgr()->volatile_flag()
+            ? CacheManager::kTypeVolatile
+            : CacheManager::kTypeRegular);
       }
 
       LogCvmfs(kLogCvmfs, kLogDebug, "reading from chunk fd %d",
@@ -1152,11 +1255,20 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
         chunks.list->AtPtr(chunk_idx)->size() - offset_in_chunk;
       size_t bytes_to_read_in_chunk =
         std::min(bytes_to_read, remaining_bytes_in_chunk);
-      const int64_t bytes_fetched = file_system_->cache_mgr()->Pread(
-        chunk_fd.fd,
-        data + overall_bytes_fetched,
-        bytes_to_read_in_chunk,
-        offset_in_chunk);
+      int64_t bytes_fetched;
+      if (zero_copy) {
+        ranges[num_ranges].fd = chunk_fd.fd;
+        ranges[num_ranges].size = bytes_to_read_in_chunk;
+        ranges[num_ranges].pos = offset_in_chunk;
+        num_ranges++;
+        bytes_fetched = bytes_to_read_in_chunk;
+      } else {
+        bytes_fetched = file_system_->cache_mgr()->Pread(
+          chunk_fd.fd,
+          data + overall_bytes_fetched,
+          bytes_to_read_in_chunk,
+          offset_in_chunk);
+      }
 
       if (bytes_fetched < 0) {
         LogCvmfs(kLogCvmfs, kLogSyslogErr, "read err no %" PRId64 " (%s)",
@@ -1175,14 +1287,39 @@ static void cvmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
     } while ((overall_bytes_fetched < size) &&
              (chunk_idx < chunks.list->size()));
 
+    if (zero_copy) {
+      // Reply while holding the handle lock: another read on the same handle
+      // could otherwise close the current chunk file descriptor
+      ReplyFdRanges(req, ranges, num_ranges);
+      for (unsigned i = 0; i < num_fds_to_close; ++i)
+        file_system_->cache_mgr()->Close(fds_to_close[i]);
+    }
+
     // Update chunk file descriptor
     chunk_tables->Lock();
     chunk_tables->handle2fd.Insert(chunk_handle, chunk_fd);
     chunk_tables->Unlock();
     LogCvmfs(kLogCvmfs, kLogDebug, "released chunk file descriptor %d",
              chunk_fd.fd);
+    if (zero_copy) {
+      LogCvmfs(kLogCvmfs, kLogDebug, "spliced %u bytes to user",
+               overall_bytes_fetched);
+      return;
+    }
   } else {
     const int64_t fd = fi->fh;
+    if (zero_copy) {
+      // The kernel does not call release before outstanding reads are done,
+      // so the file descriptor stays valid.  Reads beyond the end of the file
+      // are cut short by libfuse.
+      FdRange range;
+      range.fd = fd;
+      range.size = size;
+      range.pos = off;
+      ReplyFdRanges(req, &range, 1);
+      LogCvmfs(kLogCvmfs, kLogDebug, "spliced up to %zu bytes to user", size);
+      return;
+    }
     int64_t nbytes = file_system_->cache_mgr()->Pread(fd, data, size, off);
     if (nbytes < 0) {
       fuse_reply_err(req, -nbytes);
@@ -1252,6 +1389,7 @@ static void cvmfs_release(fuse_req_t req, fuse_ino_t ino,
       chunk_tables->inode2references.Insert(unique_inode, refctr);
     }
     chunk_tables->Unlock();
+    mount_point_->chunk_prefetcher()->Forget(chunk_handle);
 
     if (chunk_fd.fd != -1)
       file_system_->cache_mgr()->Close(chunk_fd.fd);
@@ -1810,6 +1948,15 @@ static void cvmfs_init(void *userdata, struct fuse_conn_info *conn) {
   conn->want |= FUSE_CAP_EXPORT_SUPPORT;
 #endif
 
+#ifdef FUSE_CAP_SPLICE_WRITE
+  // Zero-copy reads, see ReplyFdRanges()
+  if ((conn->capable & FUSE_CAP_SPLICE_WRITE) &&
+      mount_point_->zero_copy_read())
+  {
+    conn->want |= FUSE_CAP_SPLICE_WRITE;
+  }
+#endif
+
   if (mount_point_->enforce_acls()) {
 #ifdef FUSE_CAP_POSIX_ACL
     if ((conn->capable & FUSE_CAP_POSIX_ACL) == 0) {
@@ -2062,8 +2209,12 @@ static void Spawn() {
 
   cvmfs::mount_point_->download_mgr()->Spawn();
   cvmfs::mount_point_->external_download_mgr()->Spawn();
+  cvmfs::mount_point_->chunk_prefetcher()->Spawn();
+  if (cvmfs::mount_point_->catalog_prefetcher() != NULL)
+    cvmfs::mount_point_->catalog_prefetcher()->Spawn();
   if (cvmfs::mount_point_->resolv_conf_watcher() != NULL)
     cvmfs::mount_point_->resolv_conf_watcher()->Spawn();
+  cvmfs::mount_point_->SpawnMemcacheSnapshotWriter();
   QuotaManager *quota_mgr = cvmfs::file_system_->cache_mgr()->quota_mgr();
   quota_mgr->Spawn();
   if (quota_mgr->HasCapability(QuotaManager::kCapListeners)) {
@@ -2131,6 +2282,8 @@ static void ShutdownMountpoint() {
 
 
 static void Fini() {
+  if (cvmfs::mount_point_ != NULL)
+    cvmfs::mount_point_->WriteMemcacheSnapshot();
   ShutdownMountpoint();
 
   delete cvmfs::file_system_;
@@ -2219,6 +2372,15 @@ static bool SaveState(const int fd_progress, loader::StateList *saved_states) {
   state_nentry_tracker->state = saved_nentry_cache;
   saved_states->push_back(state_nentry_tracker);
 
+  msg_progress = "Saving meta-data cache\n";
+  SendMsg2Socket(fd_progress, msg_progress);
+  lru::Md5PathSnapshot *saved_md5path_cache =
+    cvmfs::mount_point_->CreateMemcacheSnapshot();
+  loader::SavedState *state_md5path_cache = new loader::SavedState();
+  state_md5path_cache->state_id = loader::kStateMd5PathCache;
+  state_md5path_cache->state = saved_md5path_cache;
+  saved_states->push_back(state_md5path_cache);
+
   msg_progress = "Saving chunk tables\n";
   SendMsg2Socket(fd_progress, msg_progress);
   ChunkTables *saved_chunk_tables = new ChunkTables(
@@ -2330,6 +2492,16 @@ static bool RestoreState(const int fd_progress,
       SendMsg2Socket(fd_progress, " done\n");
     }
 
+    if (saved_states[i]->state_id == loader::kStateMd5PathCache) {
+      SendMsg2Socket(fd_progress, "Restoring meta-data cache... ");
+      lru::Md5PathSnapshot *saved_md5path_cache =
+        reinterpret_cast<lru::Md5PathSnapshot *>(saved_states[i]->state);
+      // Supersedes entries from the on-disk snapshot
+      unsigned num_restored =
+        cvmfs::mount_point_->RestoreMemcacheSnapshot(*saved_md5path_cache);
+      SendMsg2Socket(fd_progress, StringifyInt(num_restored) + " entries\n");
+    }
+
     ChunkTables *chunk_tables = cvmfs::mount_point_->chunk_tables();
 
     if (saved_states[i]->state_id == loader::kStateOpenChunks) {
@@ -2447,6 +2619,10 @@ static void FreeSavedState(const int fd_progress,
         SendMsg2Socket(fd_progress, "Releasing saved negative entry cache\n");
         delete static_cast<glue::NentryTracker *>(saved_states[i]->state);
         break;
+      case loader::kStateMd5PathCache:
+        SendMsg2Socket(fd_progress, "Releasing saved meta-data cache\n");
+        delete static_cast<lru::Md5PathSnapshot *>(saved_states[i]->state);
+        break;
       case loader::kStateOpenChunks:
         SendMsg2Socket(fd_progress, "Releasing chunk tables (version 1)\n");
         delete static_cast<compat::chunk_tables::ChunkTables *>(
@@ -31,6 +31,9 @@ class SyncItemDummyCatalog;
 namespace swissknife {
 class CommandMigrate;
 }
+namespace lru {
+class Md5PathSnapshot;
+}
 
 namespace catalog {
 
@@ -256,6 +259,8 @@ class DirectoryEntry : public DirectoryEntryBase {
   friend class WritableCatalogManager;
   // Create DirectoryEntries for unit test purposes.
   friend class DirectoryEntryTestFactory;
+  // (De-)serialization of the meta-data cache
+  friend class lru::Md5PathSnapshot;
 
  public:
   /**
@@ -52,6 +52,7 @@
 #include "duplex_curl.h"
 #include "hash.h"
 #include "logging.h"
+#include "platform.h"
 #include "prng.h"
 #include "sanitizer.h"
 #include "smalloc.h"
@@ -65,6 +66,8 @@ using namespace std;  // NOLINT
 
 namespace download {
 
+static const char *kInfoHeaderName = "cvmfs-info: ";
+
 static inline bool EscapeUrlChar(char input, char output[3]) {
   if (((input >= '0') && (input <= '9')) ||
       ((input >= 'A') && (input <= 'Z')) ||
@@ -278,11 +281,27 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
   if (info->expected_hash)
     shash::Update((unsigned char *)ptr, num_bytes, info->hash_context);
 
+  if (info->compressed && (info->destination != kDestinationMem) &&
+      (info->decompressor == NULL))
+  {
+    const zlib::Algorithms alg =
+      zlib::DetectAlgorithm(ptr, num_bytes, info->compression_alg);
+    info->decompressor = zlib::Decompressor::Construct(alg);
+    if (info->decompressor == NULL) {
+      LogCvmfs(kLogDownload, kLogDebug | kLogSyslogErr,
+               "unsupported compression algorithm %s for %s",
+               zlib::AlgorithmName(alg).c_str(), info->url->c_str());
+      info->error_code = kFailBadData;
+      return 0;
+    }
+  }
+
   if (info->destination == kDestinationSink) {
     if (info->compressed) {
       zlib::StreamStates retval =
-        zlib::DecompressZStream2Sink(ptr, num_bytes,
-                                     &info->zstream, info->destination_sink);
+        zlib::DecompressStream2Sink(ptr, num_bytes,
+                                    info->decompressor,
+                                    info->destination_sink);
       if (retval == zlib::kStreamDataError) {
         LogCvmfs(kLogDownload, kLogDebug, "failed to decompress %s",
                  info->url->c_str());
@@ -329,8 +348,9 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
       // LogCvmfs(kLogDownload, kLogDebug, "REMOVE-ME: writing %d bytes for %s",
       //          num_bytes, info->url->c_str());
       zlib::StreamStates retval =
-        zlib::DecompressZStream2File(ptr, num_bytes,
-                                     &info->zstream, info->destination_file);
+        zlib::DecompressStream2File(ptr, num_bytes,
+                                    info->decompressor,
+                                    info->destination_file);
       if (retval == zlib::kStreamDataError) {
         LogCvmfs(kLogDownload, kLogDebug, "failed to decompress %s",
                  info->url->c_str());
@@ -375,6 +395,7 @@ const int DownloadManager::kProbeUnprobed = -1;
 const int DownloadManager::kProbeDown     = -2;
 const int DownloadManager::kProbeGeo      = -3;
 const unsigned DownloadManager::kMaxMemSize = 1024*1024;
+const unsigned DownloadManager::kMaxWorkers;
 
 
 /**
@@ -404,58 +425,58 @@ int DownloadManager::CallbackCurlSocket(CURL *easy,
 {
   // LogCvmfs(kLogDownload, kLogDebug, "CallbackCurlSocket called with easy "
   //          "handle %p, socket %d, action %d", easy, s, action);
-  DownloadManager *download_mgr = static_cast<DownloadManager *>(userp);
+  DownloadWorker *worker = static_cast<DownloadWorker *>(userp);
   if (action == CURL_POLL_NONE)
     return 0;
 
   // Find s in watch_fds_
   unsigned index;
-  for (index = 0; index < download_mgr->watch_fds_inuse_; ++index) {
-    if (download_mgr->watch_fds_[index].fd == s)
+  for (index = 0; index < worker->watch_fds_inuse; ++index) {
+    if (worker->watch_fds[index].fd == s)
       break;
   }
   // Or create newly
-  if (index == download_mgr->watch_fds_inuse_) {
+  if (index == worker->watch_fds_inuse) {
     // Extend array if necessary
-    if (download_mgr->watch_fds_inuse_ == download_mgr->watch_fds_size_)
+    if (worker->watch_fds_inuse == worker->watch_fds_size)
     {
-      download_mgr->watch_fds_size_ *= 2;
-      download_mgr->watch_fds_ = static_cast<struct pollfd *>(
-        srealloc(download_mgr->watch_fds_,
-                 download_mgr->watch_fds_size_*sizeof(struct pollfd)));
+      worker->watch_fds_size *= 2;
+      worker->watch_fds = static_cast<struct pollfd *>(
+        srealloc(worker->watch_fds,
+                 worker->watch_fds_size*sizeof(struct pollfd)));
     }
-    download_mgr->watch_fds_[download_mgr->watch_fds_inuse_].fd = s;
-    download_mgr->watch_fds_[download_mgr->watch_fds_inuse_].events = 0;
-    download_mgr->watch_fds_[download_mgr->watch_fds_inuse_].revents = 0;
-    download_mgr->watch_fds_inuse_++;
+    worker->watch_fds[worker->watch_fds_inuse].fd = s;
+    worker->watch_fds[worker->watch_fds_inuse].events = 0;
+    worker->watch_fds[worker->watch_fds_inuse].revents = 0;
+    worker->watch_fds_inuse++;
   }
 
   switch (action) {
     case CURL_POLL_IN:
-      download_mgr->watch_fds_[index].events = POLLIN | POLLPRI;
+      worker->watch_fds[index].events = POLLIN | POLLPRI;
       break;
     case CURL_POLL_OUT:
-      download_mgr->watch_fds_[index].events = POLLOUT | POLLWRBAND;
+      worker->watch_fds[index].events = POLLOUT | POLLWRBAND;
       break;
     case CURL_POLL_INOUT:
-      download_mgr->watch_fds_[index].events =
+      worker->watch_fds[index].events =
         POLLIN | POLLPRI | POLLOUT | POLLWRBAND;
       break;
     case CURL_POLL_REMOVE:
-      if (index < download_mgr->watch_fds_inuse_-1)
-        download_mgr->watch_fds_[index] =
-          download_mgr->watch_fds_[download_mgr->watch_fds_inuse_-1];
-      download_mgr->watch_fds_inuse_--;
+      if (index < worker->watch_fds_inuse-1)
+        worker->watch_fds[index] =
+          worker->watch_fds[worker->watch_fds_inuse-1];
+      worker->watch_fds_inuse--;
       // Shrink array if necessary
-      if ((download_mgr->watch_fds_inuse_ > download_mgr->watch_fds_max_) &&
-          (download_mgr->watch_fds_inuse_ < download_mgr->watch_fds_size_/2))
+      if ((worker->watch_fds_inuse > worker->watch_fds_max) &&
+          (worker->watch_fds_inuse < worker->watch_fds_size/2))
       {
-        download_mgr->watch_fds_size_ /= 2;
+        worker->watch_fds_size /= 2;
         // LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds_ (%d)",
         //          watch_fds_size_);
-        download_mgr->watch_fds_ = static_cast<struct pollfd *>(
-          srealloc(download_mgr->watch_fds_,
-                   download_mgr->watch_fds_size_*sizeof(struct pollfd)));
+        worker->watch_fds = static_cast<struct pollfd *>(
+          srealloc(worker->watch_fds,
+                   worker->watch_fds_size*sizeof(struct pollfd)));
         // LogCvmfs(kLogDownload, kLogDebug, "shrinking watch_fds_ done",
         //          watch_fds_size_);
       }
@@ -469,22 +490,62 @@ int DownloadManager::CallbackCurlSocket(CURL *easy,
 
 
 /**
- * Worker thread event loop.  Waits on new JobInfo structs on a pipe.
+ * Called by any thread.  Pushes a job onto the worker's lock-free job stack
+ * and notifies the worker if the stack was empty.  Otherwise the worker has
+ * been notified already and did not yet take the stack.
+ */
+void DownloadManager::PushJob(DownloadWorker *worker, JobInfo *info) {
+  JobInfo *head;
+  do {
+    head = worker->pending_jobs;
+    info->next_job = head;
+  } while (!__sync_bool_compare_and_swap(&worker->pending_jobs, head, info));
+  if (head == NULL)
+    platform_notify_eventfd(worker->job_event);
+}
+
+
+/**
+ * Called by the I/O thread.  Takes all pending jobs and returns them as a list
+ * in the order of arrival.
+ */
+JobInfo *DownloadManager::TakeJobs(DownloadWorker *worker) {
+  JobInfo *head;
+  do {
+    head = worker->pending_jobs;
+  } while (!__sync_bool_compare_and_swap(&worker->pending_jobs, head,
+                                         static_cast<JobInfo *>(NULL)));
+
+  JobInfo *result = NULL;
+  while (head != NULL) {
+    JobInfo *next_job = head->next_job;
+    head->next_job = result;
+    result = head;
+    head = next_job;
+  }
+  return result;
+}
+
+
+/**
+ * Worker thread event loop.  Waits on new JobInfo structs pushed onto the job
+ * stack.
  */
 void *DownloadManager::MainDownload(void *data) {
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread started");
-  DownloadManager *download_mgr = static_cast<DownloadManager *>(data);
+  DownloadWorker *worker = static_cast<DownloadWorker *>(data);
+  DownloadManager *download_mgr = worker->download_mgr;
 
-  download_mgr->watch_fds_ =
+  worker->watch_fds =
     static_cast<struct pollfd *>(smalloc(2 * sizeof(struct pollfd)));
-  download_mgr->watch_fds_size_ = 2;
-  download_mgr->watch_fds_[0].fd = download_mgr->pipe_terminate_[0];
-  download_mgr->watch_fds_[0].events = POLLIN | POLLPRI;
-  download_mgr->watch_fds_[0].revents = 0;
-  download_mgr->watch_fds_[1].fd = download_mgr->pipe_jobs_[0];
-  download_mgr->watch_fds_[1].events = POLLIN | POLLPRI;
-  download_mgr->watch_fds_[1].revents = 0;
-  download_mgr->watch_fds_inuse_ = 2;
+  worker->watch_fds_size = 2;
+  worker->watch_fds[0].fd = worker->pipe_terminate[0];
+  worker->watch_fds[0].events = POLLIN | POLLPRI;
+  worker->watch_fds[0].revents = 0;
+  worker->watch_fds[1].fd = worker->job_event[0];
+  worker->watch_fds[1].events = POLLIN | POLLPRI;
+  worker->watch_fds[1].revents = 0;
+  worker->watch_fds_inuse = 2;
 
   int still_running = 0;
   struct timeval timeval_start, timeval_stop;
@@ -509,7 +570,7 @@ void *DownloadManager::MainDownload(void *data) {
         1000 * DiffTimeSeconds(timeval_start, timeval_stop));
       perf::Xadd(download_mgr->counters_->sz_transfer_time, delta);
     }
-    int retval = poll(download_mgr->watch_fds_, download_mgr->watch_fds_inuse_,
+    int retval = poll(worker->watch_fds, worker->watch_fds_inuse,
                       timeout);
     if (retval < 0) {
       continue;
@@ -517,28 +578,33 @@ void *DownloadManager::MainDownload(void *data) {
 
     // Handle timeout
     if (retval == 0) {
-      retval = curl_multi_socket_action(download_mgr->curl_multi_,
+      retval = curl_multi_socket_action(worker->curl_multi,
                                         CURL_SOCKET_TIMEOUT,
                                         0,
                                         &still_running);
     }
 
     // Terminate I/O thread
-    if (download_mgr->watch_fds_[0].revents)
+    if (worker->watch_fds[0].revents)
       break;
 
-    // New job arrives
-    if (download_mgr->watch_fds_[1].revents) {
-      download_mgr->watch_fds_[1].revents = 0;
-      JobInfo *info;
-      ReadPipe(download_mgr->pipe_jobs_[0], &info, sizeof(info));
+    // New jobs arrive
+    if (worker->watch_fds[1].revents) {
+      worker->watch_fds[1].revents = 0;
+      // Drain before taking the jobs so that no notification is lost
+      platform_drain_eventfd(worker->job_event);
       if (!still_running)
         gettimeofday(&timeval_start, NULL);
-      CURL *handle = download_mgr->AcquireCurlHandle();
-      download_mgr->InitializeRequest(info, handle);
-      download_mgr->SetUrlOptions(info);
-      curl_multi_add_handle(download_mgr->curl_multi_, handle);
-      retval = curl_multi_socket_action(download_mgr->curl_multi_,
+      for (JobInfo *info = TakeJobs(worker); info != NULL; ) {
+        JobInfo *next_job = info->next_job;
+        info->next_job = NULL;
+        CURL *handle = download_mgr->AcquireCurlHandle(worker);
+        download_mgr->InitializeRequest(info, handle);
+        download_mgr->SetUrlOptions(info);
+        curl_multi_add_handle(worker->curl_multi, handle);
+        info = next_job;
+      }
+      retval = curl_multi_socket_action(worker->curl_multi,
                                         CURL_SOCKET_TIMEOUT,
                                         0,
                                         &still_running);
@@ -549,25 +615,25 @@ void *DownloadManager::MainDownload(void *data) {
     // to be removed from watch_fds_. If a socket is removed it is replaced
     // by the socket at the end of the array and the inuse count is decreased.
     // Therefore loop over the array in reverse order.
-    for (int64_t i = download_mgr->watch_fds_inuse_-1; i >= 2; --i) {
-      if (i >= download_mgr->watch_fds_inuse_) {
+    for (int64_t i = worker->watch_fds_inuse-1; i >= 2; --i) {
+      if (i >= worker->watch_fds_inuse) {
         continue;
       }
-      if (download_mgr->watch_fds_[i].revents) {
+      if (worker->watch_fds[i].revents) {
         int ev_bitmask = 0;
-        if (download_mgr->watch_fds_[i].revents & (POLLIN | POLLPRI))
+        if (worker->watch_fds[i].revents & (POLLIN | POLLPRI))
           ev_bitmask |= CURL_CSELECT_IN;
-        if (download_mgr->watch_fds_[i].revents & (POLLOUT | POLLWRBAND))
+        if (worker->watch_fds[i].revents & (POLLOUT | POLLWRBAND))
           ev_bitmask |= CURL_CSELECT_OUT;
-        if (download_mgr->watch_fds_[i].revents &
+        if (worker->watch_fds[i].revents &
             (POLLERR | POLLHUP | POLLNVAL))
         {
           ev_bitmask |= CURL_CSELECT_ERR;
         }
-        download_mgr->watch_fds_[i].revents = 0;
+        worker->watch_fds[i].revents = 0;
 
-        retval = curl_multi_socket_action(download_mgr->curl_multi_,
-                                          download_mgr->watch_fds_[i].fd,
+        retval = curl_multi_socket_action(worker->curl_multi,
+                                          worker->watch_fds[i].fd,
                                           ev_bitmask,
                                           &still_running);
       }
@@ -576,7 +642,7 @@ void *DownloadManager::MainDownload(void *data) {
     // Check if transfers are completed
     CURLMsg *curl_msg;
     int msgs_in_queue;
-    while ((curl_msg = curl_multi_info_read(download_mgr->curl_multi_,
+    while ((curl_msg = curl_multi_info_read(worker->curl_multi,
                                             &msgs_in_queue)))
     {
       if (curl_msg->msg == CURLMSG_DONE) {
@@ -586,32 +652,47 @@ void *DownloadManager::MainDownload(void *data) {
         int curl_error = curl_msg->data.result;
         curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
 
-        curl_multi_remove_handle(download_mgr->curl_multi_, easy_handle);
+        curl_multi_remove_handle(worker->curl_multi, easy_handle);
         if (download_mgr->VerifyAndFinalize(curl_error, info)) {
-          curl_multi_add_handle(download_mgr->curl_multi_, easy_handle);
-          retval = curl_multi_socket_action(download_mgr->curl_multi_,
+          curl_multi_add_handle(worker->curl_multi, easy_handle);
+          retval = curl_multi_socket_action(worker->curl_multi,
                                             CURL_SOCKET_TIMEOUT,
                                             0,
                                             &still_running);
         } else {
           // Return easy handle into pool and write result back
-          download_mgr->ReleaseCurlHandle(easy_handle);
-
-          WritePipe(info->wait_at[1], &info->error_code,
-                    sizeof(info->error_code));
+          download_mgr->ReleaseCurlHandle(worker, easy_handle);
+
+          atomic_dec32(&worker->num_jobs);
+          if (info->completions != NULL) {
+            FifoChannel<JobInfo *> *completions = info->completions;
+            info->completions = NULL;
+            free(info->async_buffer);
+            info->async_buffer = NULL;
+            info->hash_context.buffer = NULL;
+            info->info_header = NULL;
+            if (info->error_code != kFailOk)
+              download_mgr->CleanupFailedJob(info);
+            // Last access to info, the caller takes over from here
+            completions->Enqueue(info);
+          } else {
+            // Last access to info, the caller takes over from here
+            info->wait_at.Wakeup();
+          }
         }
       }
     }
   }
 
-  for (set<CURL *>::iterator i = download_mgr->pool_handles_inuse_->begin(),
-       iEnd = download_mgr->pool_handles_inuse_->end(); i != iEnd; ++i)
+  for (set<CURL *>::iterator i = worker->pool_handles_inuse->begin(),
+       iEnd = worker->pool_handles_inuse->end(); i != iEnd; ++i)
   {
-    curl_multi_remove_handle(download_mgr->curl_multi_, *i);
+    curl_multi_remove_handle(worker->curl_multi, *i);
     curl_easy_cleanup(*i);
   }
-  download_mgr->pool_handles_inuse_->clear();
-  free(download_mgr->watch_fds_);
+  worker->pool_handles_inuse->clear();
+  free(worker->watch_fds);
+  worker->watch_fds = NULL;
 
   LogCvmfs(kLogDownload, kLogDebug, "download I/O thread terminated");
   return NULL;
@@ -768,10 +849,10 @@ string DownloadManager::ProxyInfo::Print() {
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
  */
-CURL *DownloadManager::AcquireCurlHandle() {
+CURL *DownloadManager::AcquireCurlHandle(DownloadWorker *worker) {
   CURL *handle;
 
-  if (pool_handles_idle_->empty()) {
+  if (worker->pool_handles_idle->empty()) {
     // Create a new handle
     handle = curl_easy_init();
     assert(handle != NULL);
@@ -781,26 +862,26 @@ CURL *DownloadManager::AcquireCurlHandle() {
     curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, CallbackCurlHeader);
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, CallbackCurlData);
   } else {
-    handle = *(pool_handles_idle_->begin());
-    pool_handles_idle_->erase(pool_handles_idle_->begin());
+    handle = *(worker->pool_handles_idle->begin());
+    worker->pool_handles_idle->erase(worker->pool_handles_idle->begin());
   }
 
-  pool_handles_inuse_->insert(handle);
+  worker->pool_handles_inuse->insert(handle);
 
   return handle;
 }
 
 
-void DownloadManager::ReleaseCurlHandle(CURL *handle) {
-  set<CURL *>::iterator elem = pool_handles_inuse_->find(handle);
-  assert(elem != pool_handles_inuse_->end());
+void DownloadManager::ReleaseCurlHandle(DownloadWorker *worker, CURL *handle) {
+  set<CURL *>::iterator elem = worker->pool_handles_inuse->find(handle);
+  assert(elem != worker->pool_handles_inuse->end());
 
-  if (pool_handles_idle_->size() > pool_max_handles_)
+  if (worker->pool_handles_idle->size() > worker->pool_max_handles)
     curl_easy_cleanup(*elem);
   else
-    pool_handles_idle_->insert(*elem);
+    worker->pool_handles_idle->insert(*elem);
 
-  pool_handles_inuse_->erase(elem);
+  worker->pool_handles_inuse->erase(elem);
 }
 
 
@@ -818,18 +899,16 @@ void DownloadManager::InitializeRequest(JobInfo *info, CURL *handle) {
   info->num_used_hosts = 1;
   info->num_retries = 0;
   info->backoff_ms = 0;
-  info->headers = header_lists_->DuplicateList(default_headers_);
+  HeaderLists *header_lists = info->worker->header_lists;
+  info->headers = header_lists->DuplicateList(info->worker->default_headers);
   if (info->info_header) {
-    header_lists_->AppendHeader(info->headers, info->info_header);
+    header_lists->AppendHeader(info->headers, info->info_header);
   }
   if (info->force_nocache) {
     SetNocache(info);
   } else {
     info->nocache = false;
   }
-  if (info->compressed) {
-    zlib::DecompressInit(&(info->zstream));
-  }
   if (info->expected_hash) {
     assert(info->hash_context.buffer != NULL);
     shash::Init(info->hash_context);
@@ -1148,16 +1227,19 @@ bool DownloadManager::CanRetry(const JobInfo *info) {
 void DownloadManager::Backoff(JobInfo *info) {
   unsigned backoff_init_ms = 0;
   unsigned backoff_max_ms = 0;
+  unsigned backoff_jitter_ms = 0;
   {
+    // The lock also protects prng_, which is shared by the I/O threads
     MutexLockGuard m(lock_options_);
     backoff_init_ms = opt_backoff_init_ms_;
     backoff_max_ms = opt_backoff_max_ms_;
+    backoff_jitter_ms = prng_.Next(backoff_init_ms + 1);
   }
 
   info->num_retries++;
   perf::Inc(counters_->n_retries);
   if (info->backoff_ms == 0) {
-    info->backoff_ms = prng_.Next(backoff_init_ms + 1);  // Must be != 0
+    info->backoff_ms = backoff_jitter_ms;  // Must be != 0
   } else {
     info->backoff_ms *= 2;
   }
@@ -1170,8 +1252,9 @@ void DownloadManager::Backoff(JobInfo *info) {
 void DownloadManager::SetNocache(JobInfo *info) {
   if (info->nocache)
     return;
-  header_lists_->AppendHeader(info->headers, "Pragma: no-cache");
-  header_lists_->AppendHeader(info->headers, "Cache-Control: no-cache");
+  HeaderLists *header_lists = info->worker->header_lists;
+  header_lists->AppendHeader(info->headers, "Pragma: no-cache");
+  header_lists->AppendHeader(info->headers, "Cache-Control: no-cache");
   curl_easy_setopt(info->curl_handle, CURLOPT_HTTPHEADER, info->headers);
   info->nocache = true;
 }
@@ -1184,8 +1267,9 @@ void DownloadManager::SetNocache(JobInfo *info) {
 void DownloadManager::SetRegularCache(JobInfo *info) {
   if (info->nocache == false)
     return;
-  header_lists_->CutHeader("Pragma: no-cache", &(info->headers));
-  header_lists_->CutHeader("Cache-Control: no-cache", &(info->headers));
+  HeaderLists *header_lists = info->worker->header_lists;
+  header_lists->CutHeader("Pragma: no-cache", &(info->headers));
+  header_lists->CutHeader("Cache-Control: no-cache", &(info->headers));
   curl_easy_setopt(info->curl_handle, CURLOPT_HTTPHEADER, info->headers);
   info->nocache = false;
 }
@@ -1417,8 +1501,8 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     }
     if (info->expected_hash)
       shash::Init(info->hash_context);
-    if (info->compressed)
-      zlib::DecompressInit(&info->zstream);
+    if (info->decompressor != NULL)
+      info->decompressor->Reset();
     SetRegularCache(info);
 
     // Failure handling
@@ -1482,11 +1566,11 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     info->destination_file = NULL;
   }
 
-  if (info->compressed)
-    zlib::DecompressFini(&info->zstream);
+  delete info->decompressor;
+  info->decompressor = NULL;
 
   if (info->headers) {
-    header_lists_->PutList(info->headers);
+    info->worker->header_lists->PutList(info->headers);
     info->headers = NULL;
   }
 
@@ -1495,20 +1579,10 @@ bool DownloadManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
 
 
 DownloadManager::DownloadManager() {
-  pool_handles_idle_ = NULL;
-  pool_handles_inuse_ = NULL;
   pool_max_handles_ = 0;
-  curl_multi_ = NULL;
-  default_headers_ = NULL;
-
+  user_agent_ = NULL;
+  num_workers_ = 1;
   atomic_init32(&multi_threaded_);
-  pipe_terminate_[0] = pipe_terminate_[1] = -1;
-
-  pipe_jobs_[0] = pipe_jobs_[1] = -1;
-  watch_fds_ = NULL;
-  watch_fds_size_ = 0;
-  watch_fds_inuse_ = 0;
-  watch_fds_max_ = 0;
 
   lock_options_ =
   reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
@@ -1574,19 +1648,86 @@ void DownloadManager::InitHeaders() {
     sanitizer::InputSanitizer("az AZ 09 -").Filter(getenv("CERNVM_UUID"));
   }
   user_agent_ = strdup(cernvm_id.c_str());
+}
 
-  header_lists_ = new HeaderLists();
 
-  default_headers_ = header_lists_->GetList("Connection: Keep-Alive");
-  header_lists_->AppendHeader(default_headers_, "Pragma:");
-  header_lists_->AppendHeader(default_headers_, user_agent_);
+void DownloadManager::FiniHeaders() {
+  if (user_agent_)
+    free(user_agent_);
+  user_agent_ = NULL;
 }
 
 
-void DownloadManager::FiniHeaders() {
-  delete header_lists_;
-  header_lists_ = NULL;
-  default_headers_ = NULL;
+/**
+ * Creates the curl multi handle, the handle pool, and the header lists of an
+ * I/O worker.  The I/O thread itself is started by Spawn().
+ */
+void DownloadManager::InitWorker(DownloadWorker *worker,
+                                 const unsigned max_pool_handles)
+{
+  worker->download_mgr = this;
+  worker->pool_handles_idle = new set<CURL *>;
+  worker->pool_handles_inuse = new set<CURL *>;
+  worker->pool_max_handles = max_pool_handles;
+  worker->watch_fds_max = 4 * max_pool_handles;
+
+  worker->header_lists = new HeaderLists();
+  worker->default_headers =
+    worker->header_lists->GetList("Connection: Keep-Alive");
+  worker->header_lists->AppendHeader(worker->default_headers, "Pragma:");
+  worker->header_lists->AppendHeader(worker->default_headers, user_agent_);
+
+  worker->curl_multi = curl_multi_init();
+  assert(worker->curl_multi != NULL);
+  curl_multi_setopt(worker->curl_multi, CURLMOPT_SOCKETFUNCTION,
+                    CallbackCurlSocket);
+  curl_multi_setopt(worker->curl_multi, CURLMOPT_SOCKETDATA,
+                    static_cast<void *>(worker));
+  curl_multi_setopt(worker->curl_multi, CURLMOPT_MAXCONNECTS,
+                    worker->watch_fds_max);
+  curl_multi_setopt(worker->curl_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    worker->pool_max_handles);
+}
+
+
+/**
+ * The I/O thread of the worker must have been joined already.
+ */
+void DownloadManager::FiniWorker(DownloadWorker *worker) {
+  for (set<CURL *>::iterator i = worker->pool_handles_idle->begin(),
+       iEnd = worker->pool_handles_idle->end(); i != iEnd; ++i)
+  {
+    curl_easy_cleanup(*i);
+  }
+  delete worker->pool_handles_idle;
+  delete worker->pool_handles_inuse;
+  curl_multi_cleanup(worker->curl_multi);
+  worker->pool_handles_idle = NULL;
+  worker->pool_handles_inuse = NULL;
+  worker->curl_multi = NULL;
+
+  delete worker->header_lists;
+  worker->header_lists = NULL;
+  worker->default_headers = NULL;
+}
+
+
+/**
+ * Returns the worker with the fewest unfinished jobs.  Jobs are not bound to
+ * a particular host or proxy because all the workers share the same proxy and
+ * host chain.
+ */
+DownloadWorker *DownloadManager::SelectWorker() {
+  DownloadWorker *result = workers_[0];
+  int32_t min_jobs = atomic_read32(&result->num_jobs);
+  for (unsigned i = 1; (i < workers_.size()) && (min_jobs > 0); ++i) {
+    const int32_t num_jobs = atomic_read32(&workers_[i]->num_jobs);
+    if (num_jobs < min_jobs) {
+      result = workers_[i];
+      min_jobs = num_jobs;
+    }
+  }
+  return result;
 }
 
 
@@ -1597,10 +1738,7 @@ void DownloadManager::Init(const unsigned max_pool_handles,
   atomic_init32(&multi_threaded_);
   int retval = curl_global_init(CURL_GLOBAL_ALL);
   assert(retval == CURLE_OK);
-  pool_handles_idle_ = new set<CURL *>;
-  pool_handles_inuse_ = new set<CURL *>;
   pool_max_handles_ = max_pool_handles;
-  watch_fds_max_ = 4*pool_max_handles_;
 
   opt_timeout_proxy_ = 5;
   opt_timeout_direct_ = 10;
@@ -1616,14 +1754,9 @@ void DownloadManager::Init(const unsigned max_pool_handles,
   user_agent_ = NULL;
   InitHeaders();
 
-  curl_multi_ = curl_multi_init();
-  assert(curl_multi_ != NULL);
-  curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETFUNCTION, CallbackCurlSocket);
-  curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETDATA,
-                    static_cast<void *>(this));
-  curl_multi_setopt(curl_multi_, CURLMOPT_MAXCONNECTS, watch_fds_max_);
-  curl_multi_setopt(curl_multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
-                    pool_max_handles_);
+  DownloadWorker *worker = new DownloadWorker();
+  InitWorker(worker, pool_max_handles_);
+  workers_.push_back(worker);
 
   prng_.InitLocaltime();
 
@@ -1651,33 +1784,28 @@ void DownloadManager::Init(const unsigned max_pool_handles,
 
 void DownloadManager::Fini() {
   if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    // Shutdown I/O thread
-    char buf = 'T';
-    WritePipe(pipe_terminate_[1], &buf, 1);
-    pthread_join(thread_download_, NULL);
-    // All handles are removed from the multi stack
-    close(pipe_terminate_[1]);
-    close(pipe_terminate_[0]);
-    close(pipe_jobs_[1]);
-    close(pipe_jobs_[0]);
-  }
-
-  for (set<CURL *>::iterator i = pool_handles_idle_->begin(),
-       iEnd = pool_handles_idle_->end(); i != iEnd; ++i)
-  {
-    curl_easy_cleanup(*i);
+    // Shutdown I/O threads
+    for (unsigned i = 0; i < workers_.size(); ++i) {
+      char buf = 'T';
+      WritePipe(workers_[i]->pipe_terminate[1], &buf, 1);
+    }
+    for (unsigned i = 0; i < workers_.size(); ++i) {
+      DownloadWorker *worker = workers_[i];
+      pthread_join(worker->thread_download, NULL);
+      // All handles are removed from the multi stack
+      close(worker->pipe_terminate[1]);
+      close(worker->pipe_terminate[0]);
+      platform_close_eventfd(worker->job_event);
+    }
+  }
+
+  for (unsigned i = 0; i < workers_.size(); ++i) {
+    FiniWorker(workers_[i]);
+    delete workers_[i];
   }
-  delete pool_handles_idle_;
-  delete pool_handles_inuse_;
-  curl_multi_cleanup(curl_multi_);
-  pool_handles_idle_ = NULL;
-  pool_handles_inuse_ = NULL;
-  curl_multi_ = NULL;
+  workers_.clear();
 
   FiniHeaders();
-  if (user_agent_)
-    free(user_agent_);
-  user_agent_ = NULL;
 
   delete counters_;
   counters_ = NULL;
@@ -1697,16 +1825,38 @@ void DownloadManager::Fini() {
 
 
 /**
- * Spawns the I/O worker thread and switches the module in multi-threaded mode.
+ * Spawns the I/O worker threads and switches the module in multi-threaded mode.
  * No way back except Fini(); Init();
  */
 void DownloadManager::Spawn() {
-  MakePipe(pipe_terminate_);
-  MakePipe(pipe_jobs_);
+  if (num_workers_ > 1) {
+    // Split the connection pool among the workers.  The first worker has been
+    // created with the full pool for the synchronous mode.
+    const unsigned max_pool_handles =
+      std::max(1U, pool_max_handles_ / num_workers_);
+    DownloadWorker *first = workers_[0];
+    first->pool_max_handles = max_pool_handles;
+    first->watch_fds_max = 4 * max_pool_handles;
+    curl_multi_setopt(first->curl_multi, CURLMOPT_MAXCONNECTS,
+                      first->watch_fds_max);
+    curl_multi_setopt(first->curl_multi, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                      first->pool_max_handles);
+    for (unsigned i = 1; i < num_workers_; ++i) {
+      DownloadWorker *worker = new DownloadWorker();
+      InitWorker(worker, max_pool_handles);
+      workers_.push_back(worker);
+    }
+  }
 
-  int retval = pthread_create(&thread_download_, NULL, MainDownload,
-                              static_cast<void *>(this));
-  assert(retval == 0);
+  for (unsigned i = 0; i < workers_.size(); ++i) {
+    DownloadWorker *worker = workers_[i];
+    MakePipe(worker->pipe_terminate);
+    platform_make_eventfd(worker->job_event);
+
+    int retval = pthread_create(&worker->thread_download, NULL, MainDownload,
+                                static_cast<void *>(worker));
+    assert(retval == 0);
+  }
 
   atomic_inc32(&multi_threaded_);
 }
@@ -1724,40 +1874,30 @@ Failures DownloadManager::Fetch(JobInfo *info) {
   if (result != kFailOk)
     return result;
 
+  // Hash context and cvmfs-info: header are allocated on the stack
+  void *hash_context_buffer = NULL;
   if (info->expected_hash) {
-    const shash::Algorithms algorithm = info->expected_hash->algorithm;
-    info->hash_context.algorithm = algorithm;
-    info->hash_context.size = shash::GetContextSize(algorithm);
-    info->hash_context.buffer = alloca(info->hash_context.size);
-  }
-
-  // Prepare cvmfs-info: header, allocate string on the stack
-  info->info_header = NULL;
-  if (enable_info_header_ && info->extra_info) {
-    const char *header_name = "cvmfs-info: ";
-    const size_t header_name_len = strlen(header_name);
-    const unsigned header_size = 1 + header_name_len +
-      EscapeHeader(*(info->extra_info), NULL, 0);
-    info->info_header = static_cast<char *>(alloca(header_size));
-    memcpy(info->info_header, header_name, header_name_len);
-    EscapeHeader(*(info->extra_info), info->info_header + header_name_len,
-                 header_size - header_name_len);
-    info->info_header[header_size-1] = '\0';
+    hash_context_buffer =
+      alloca(shash::GetContextSize(info->expected_hash->algorithm));
   }
+  const unsigned info_header_size = GetInfoHeaderSize(info);
+  char *info_header_buffer = NULL;
+  if (info_header_size > 0)
+    info_header_buffer = static_cast<char *>(alloca(info_header_size));
+  InitJobBuffers(info, hash_context_buffer, info_header_buffer,
+                 info_header_size);
 
   if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    if (info->wait_at[0] == -1) {
-      MakePipe(info->wait_at);
-    }
-
-    // LogCvmfs(kLogDownload, kLogDebug, "send job to thread, pipe %d %d",
-    //          info->wait_at[0], info->wait_at[1]);
-    WritePipe(pipe_jobs_[1], &info, sizeof(info));
-    ReadPipe(info->wait_at[0], &result, sizeof(result));
+    info->worker = SelectWorker();
+    atomic_inc32(&info->worker->num_jobs);
+    PushJob(info->worker, info);
+    info->wait_at.Wait();
+    result = info->error_code;
     // LogCvmfs(kLogDownload, kLogDebug, "got result %d", result);
   } else {
     MutexLockGuard l(lock_synchronous_mode_);
-    CURL *handle = AcquireCurlHandle();
+    info->worker = workers_[0];
+    CURL *handle = AcquireCurlHandle(info->worker);
     InitializeRequest(info, handle);
     SetUrlOptions(info);
     // curl_easy_setopt(handle, CURLOPT_VERBOSE, 1);
@@ -1770,24 +1910,120 @@ Failures DownloadManager::Fetch(JobInfo *info) {
         perf::Xadd(counters_->sz_transfer_time, (int64_t)(elapsed * 1000));
     } while (VerifyAndFinalize(retval, info));
     result = info->error_code;
-    ReleaseCurlHandle(info->curl_handle);
+    ReleaseCurlHandle(info->worker, info->curl_handle);
   }
 
-  if (result != kFailOk) {
-    LogCvmfs(kLogDownload, kLogDebug, "download failed (error %d - %s)", result,
-             Code2Ascii(result));
+  if (result != kFailOk)
+    CleanupFailedJob(info);
 
-    if (info->destination == kDestinationPath)
-      unlink(info->destination_path->c_str());
+  return result;
+}
 
-    if (info->destination_mem.data) {
-      free(info->destination_mem.data);
-      info->destination_mem.data = NULL;
-      info->destination_mem.size = 0;
-    }
+
+/**
+ * Like Fetch() but returns immediately.  Once the job is finished, it is
+ * enqueued in the completions channel with the result in info->error_code.
+ * The channel must be large enough to take all the outstanding jobs because
+ * the I/O thread blocks on a full channel.  In single-threaded mode, the job
+ * is processed synchronously before FetchAsync() returns.
+ */
+void DownloadManager::FetchAsync(JobInfo *info,
+                                 FifoChannel<JobInfo *> *completions)
+{
+  assert(info != NULL);
+  assert(info->url != NULL);
+  assert(completions != NULL);
+
+  if (atomic_xadd32(&multi_threaded_, 0) == 0) {
+    Fetch(info);
+    completions->Enqueue(info);
+    return;
   }
 
-  return result;
+  info->error_code = PrepareDownloadDestination(info);
+  if (info->error_code != kFailOk) {
+    completions->Enqueue(info);
+    return;
+  }
+
+  // The caller's stack is gone by the time the job is processed, so hash
+  // context and cvmfs-info: header are allocated on the heap.  The I/O thread
+  // frees the buffer when the job is finished.
+  const unsigned hash_context_size = info->expected_hash ?
+    shash::GetContextSize(info->expected_hash->algorithm) : 0;
+  const unsigned info_header_size = GetInfoHeaderSize(info);
+  if (hash_context_size + info_header_size > 0)
+    info->async_buffer = smalloc(hash_context_size + info_header_size);
+  InitJobBuffers(info,
+                 info->expected_hash ? info->async_buffer : NULL,
+                 (info_header_size > 0) ?
+                   static_cast<char *>(info->async_buffer) + hash_context_size :
+                   NULL,
+                 info_header_size);
+
+  info->completions = completions;
+  info->worker = SelectWorker();
+  atomic_inc32(&info->worker->num_jobs);
+  PushJob(info->worker, info);
+}
+
+
+/**
+ * Size of the cvmfs-info: header including the trailing zero or 0 if there
+ * is no such header for the job.
+ */
+unsigned DownloadManager::GetInfoHeaderSize(const JobInfo *info) {
+  if (!enable_info_header_ || !info->extra_info)
+    return 0;
+  return 1 + strlen(kInfoHeaderName) +
+         EscapeHeader(*(info->extra_info), NULL, 0);
+}
+
+
+/**
+ * Connects the hash context and the cvmfs-info: header to the provided
+ * buffers.  Both buffers need to live until the job is finished.
+ */
+void DownloadManager::InitJobBuffers(
+  JobInfo *info,
+  void *hash_context_buffer,
+  char *info_header_buffer,
+  const unsigned info_header_size)
+{
+  if (info->expected_hash) {
+    const shash::Algorithms algorithm = info->expected_hash->algorithm;
+    info->hash_context.algorithm = algorithm;
+    info->hash_context.size = shash::GetContextSize(algorithm);
+    info->hash_context.buffer = hash_context_buffer;
+  }
+
+  info->info_header = NULL;
+  if (info_header_size > 0) {
+    const size_t header_name_len = strlen(kInfoHeaderName);
+    info->info_header = info_header_buffer;
+    memcpy(info->info_header, kInfoHeaderName, header_name_len);
+    EscapeHeader(*(info->extra_info), info->info_header + header_name_len,
+                 info_header_size - header_name_len);
+    info->info_header[info_header_size-1] = '\0';
+  }
+}
+
+
+/**
+ * Removes partial results of a failed job.
+ */
+void DownloadManager::CleanupFailedJob(JobInfo *info) {
+  LogCvmfs(kLogDownload, kLogDebug, "download failed (error %d - %s)",
+           info->error_code, Code2Ascii(info->error_code));
+
+  if (info->destination == kDestinationPath)
+    unlink(info->destination_path->c_str());
+
+  if (info->destination_mem.data) {
+    free(info->destination_mem.data);
+    info->destination_mem.data = NULL;
+    info->destination_mem.size = 0;
+  }
 }
 
 
@@ -2706,6 +2942,15 @@ void DownloadManager::EnableRedirects() {
 }
 
 
+/**
+ * Sets the number of download I/O threads.  Needs to be called before Spawn().
+ */
+void DownloadManager::SetNumWorkers(const unsigned num_workers) {
+  assert(atomic_xadd32(&multi_threaded_, 0) == 0);
+  num_workers_ = std::max(1U, std::min(num_workers, kMaxWorkers));
+}
+
+
 /**
  * Creates a copy of the existing download manager.  Must only be called in
  * single-threaded stage because it calls curl_global_init().
@@ -2728,6 +2973,7 @@ DownloadManager *DownloadManager::Clone(perf::StatisticsTemplate statistics) {
   clone->opt_backoff_max_ms_ = opt_backoff_max_ms_;
   clone->enable_info_header_ = enable_info_header_;
   clone->follow_redirects_ = follow_redirects_;
+  clone->num_workers_ = num_workers_;
   if (opt_host_chain_) {
     clone->opt_host_chain_ = new vector<string>(*opt_host_chain_);
     clone->opt_host_chain_rtt_ = new vector<int>(*opt_host_chain_rtt_);
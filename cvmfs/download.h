@@ -25,10 +25,13 @@
 #include "prng.h"
 #include "sink.h"
 #include "statistics.h"
+#include "util_concurrency.h"
 
 
 namespace download {
 
+struct DownloadWorker;
+
 /**
  * Possible return values.  Adjust ObjectFetcher error handling if new network
  * error conditions are added.
@@ -149,6 +152,11 @@ struct Counters {
 struct JobInfo {
   const std::string *url;
   bool compressed;
+  /**
+   * Only used if compressed is set.  Streams in zstd or lz4 frames are
+   * recognized regardless of this setting.
+   */
+  zlib::Algorithms compression_alg;
   bool probe_hosts;
   bool head_request;
   bool follow_redirects;
@@ -177,6 +185,7 @@ struct JobInfo {
   void Init() {
     url = NULL;
     compressed = false;
+    compression_alg = zlib::kZlibDefault;
     probe_hosts = false;
     head_request = false;
     follow_redirects = false;
@@ -195,10 +204,13 @@ struct JobInfo {
     extra_info = NULL;
 
     curl_handle = NULL;
+    worker = NULL;
     headers = NULL;
-    memset(&zstream, 0, sizeof(zstream));
+    decompressor = NULL;
     info_header = NULL;
-    wait_at[0] = wait_at[1] = -1;
+    next_job = NULL;
+    completions = NULL;
+    async_buffer = NULL;
     nocache = false;
     error_code = kFailOther;
     num_used_proxies = num_used_hosts = num_retries = 0;
@@ -262,13 +274,6 @@ struct JobInfo {
     head_request = true;
   }
 
-  ~JobInfo() {
-    if (wait_at[0] >= 0) {
-      close(wait_at[0]);
-      close(wait_at[1]);
-    }
-  }
-
   /**
    * Tells whether the error is because of a non-existing file. Should only
    * be called if error_code is not kFailOk
@@ -277,11 +282,15 @@ struct JobInfo {
 
   // Internal state, don't touch
   CURL *curl_handle;
+  DownloadWorker *worker;  /**< I/O thread context processing the job */
   curl_slist *headers;
   char *info_header;
-  z_stream zstream;
+  zlib::Decompressor *decompressor;  /**< Created with the first data */
   shash::ContextPtr hash_context;
-  int wait_at[2];  /**< Pipe used for the return value */
+  Signal wait_at;  /**< Wakes up the caller when the result is ready */
+  JobInfo *next_job;  /**< Link in the job queue of a download worker */
+  FifoChannel<JobInfo *> *completions;  /**< Set by FetchAsync() */
+  void *async_buffer;  /**< Hash context and info header of async jobs */
   std::string proxy;
   bool nocache;
   Failures error_code;
@@ -341,12 +350,71 @@ class CredentialsAttachment {
 };
 
 
+class DownloadManager;
+
+/**
+ * The state of a download I/O thread.  Every worker drives its own curl multi
+ * handle with its own pool of curl handles and connections.  The proxy and host
+ * fail-over state is shared by all the workers; it remains in the
+ * DownloadManager and is protected by the options lock.
+ */
+struct DownloadWorker {
+  DownloadWorker()
+    : download_mgr(NULL)
+    , pool_handles_idle(NULL)
+    , pool_handles_inuse(NULL)
+    , pool_max_handles(0)
+    , curl_multi(NULL)
+    , header_lists(NULL)
+    , default_headers(NULL)
+    , watch_fds(NULL)
+    , watch_fds_size(0)
+    , watch_fds_inuse(0)
+    , watch_fds_max(0)
+  {
+    pipe_terminate[0] = pipe_terminate[1] = -1;
+    job_event[0] = job_event[1] = -1;
+    pending_jobs = NULL;
+    atomic_init32(&num_jobs);
+  }
+
+  DownloadManager *download_mgr;
+  std::set<CURL *> *pool_handles_idle;
+  std::set<CURL *> *pool_handles_inuse;
+  uint32_t pool_max_handles;
+  CURLM *curl_multi;
+  HeaderLists *header_lists;
+  curl_slist *default_headers;
+
+  pthread_t thread_download;
+  int pipe_terminate[2];
+
+  /**
+   * New jobs are pushed onto a lock-free stack by the callers of Fetch().  The
+   * I/O thread takes the entire stack at once.  The event fd wakes up the I/O
+   * thread when the first job is pushed onto an empty stack.
+   */
+  JobInfo *pending_jobs;
+  int job_event[2];
+  struct pollfd *watch_fds;
+  uint32_t watch_fds_size;
+  uint32_t watch_fds_inuse;
+  uint32_t watch_fds_max;
+  /**
+   * Jobs handed over to the worker that are not yet finished.  Used to send
+   * new jobs to the least loaded worker.
+   */
+  atomic_int32 num_jobs;
+};
+
+
 /**
  * Note when adding new fields: Clone() probably needs to be adjusted, too.
  */
 class DownloadManager {
   FRIEND_TEST(T_Download, ValidateGeoReply);
   FRIEND_TEST(T_Download, StripDirect);
+  FRIEND_TEST(T_Download, MultipleWorkers);
 
  public:
   struct ProxyInfo {
@@ -389,6 +457,11 @@ class DownloadManager {
   static const unsigned kDnsDefaultRetries = 1;
   static const unsigned kDnsDefaultTimeoutMs = 3000;
 
+  /**
+   * Upper bound for the number of download I/O threads.
+   */
+  static const unsigned kMaxWorkers = 64;
+
   DownloadManager();
   ~DownloadManager();
 
@@ -401,6 +474,7 @@ class DownloadManager {
   void Spawn();
   DownloadManager *Clone(perf::StatisticsTemplate statistics);
   Failures Fetch(JobInfo *info);
+  void FetchAsync(JobInfo *info, FifoChannel<JobInfo *> *completions);
 
   void SetCredentialsAttachment(CredentialsAttachment *ca);
   std::string GetDnsServer() const;
@@ -443,6 +517,9 @@ class DownloadManager {
   void SetProxyTemplates(const std::string &direct, const std::string &forced);
   void EnableInfoHeader();
   void EnableRedirects();
+  void SetNumWorkers(const unsigned num_workers);
+
+  unsigned num_workers() const { return num_workers_; }
 
   unsigned num_hosts() {
     if (opt_host_chain_) return opt_host_chain_->size();
@@ -457,6 +534,8 @@ class DownloadManager {
   static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                 void *userp, void *socketp);
   static void *MainDownload(void *data);
+  static void PushJob(DownloadWorker *worker, JobInfo *info);
+  static JobInfo *TakeJobs(DownloadWorker *worker);
 
   bool StripDirect(const std::string &proxy_list, std::string *cleaned_list);
   bool ValidateGeoReply(const std::string &reply_order,
@@ -465,8 +544,11 @@ class DownloadManager {
   void SwitchHost(JobInfo *info);
   void SwitchProxy(JobInfo *info);
   void RebalanceProxiesUnlocked();
-  CURL *AcquireCurlHandle();
-  void ReleaseCurlHandle(CURL *handle);
+  void InitWorker(DownloadWorker *worker, const unsigned max_pool_handles);
+  void FiniWorker(DownloadWorker *worker);
+  DownloadWorker *SelectWorker();
+  CURL *AcquireCurlHandle(DownloadWorker *worker);
+  void ReleaseCurlHandle(DownloadWorker *worker, CURL *handle);
   void ReleaseCredential(JobInfo *info);
   void InitializeRequest(JobInfo *info, CURL *handle);
   void SetUrlOptions(JobInfo *info);
@@ -477,28 +559,27 @@ class DownloadManager {
   void SetNocache(JobInfo *info);
   void SetRegularCache(JobInfo *info);
   bool VerifyAndFinalize(const int curl_error, JobInfo *info);
+  unsigned GetInfoHeaderSize(const JobInfo *info);
+  void InitJobBuffers(JobInfo *info,
+                      void *hash_context_buffer,
+                      char *info_header_buffer,
+                      const unsigned info_header_size);
+  void CleanupFailedJob(JobInfo *info);
   void InitHeaders();
   void FiniHeaders();
   void CloneProxyConfig(DownloadManager *clone);
 
   Prng prng_;
-  std::set<CURL *> *pool_handles_idle_;
-  std::set<CURL *> *pool_handles_inuse_;
   uint32_t pool_max_handles_;
-  CURLM *curl_multi_;
-  HeaderLists *header_lists_;
-  curl_slist *default_headers_;
   char *user_agent_;
 
-  pthread_t thread_download_;
+  /**
+   * The first worker is also used for synchronous downloads before Spawn().
+   * The connection pool is split evenly among the workers.
+   */
+  std::vector<DownloadWorker *> workers_;
+  unsigned num_workers_;
   atomic_int32 multi_threaded_;
-  int pipe_terminate_[2];
-
-  int pipe_jobs_[2];
-  struct pollfd *watch_fds_;
-  uint32_t watch_fds_size_;
-  uint32_t watch_fds_inuse_;
-  uint32_t watch_fds_max_;
 
   pthread_mutex_t *lock_options_;
   pthread_mutex_t *lock_synchronous_mode_;
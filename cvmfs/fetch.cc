@@ -7,6 +7,9 @@
 
 #include <unistd.h>
 
+#include <map>
+#include <vector>
+
 #include "backoff.h"
 #include "cache.h"
 #include "clientctx.h"
@@ -157,7 +160,9 @@ int Fetcher::Fetch(
              &tls->download_job.gid,
              &tls->download_job.pid);
   }
-  tls->download_job.compressed = (compression_algorithm == zlib::kZlibDefault);
+  tls->download_job.compressed =
+    (compression_algorithm != zlib::kNoCompression);
+  tls->download_job.compression_alg = compression_algorithm;
   tls->download_job.range_offset = range_offset;
   tls->download_job.range_size = size;
   download_mgr_->Fetch(&tls->download_job);
@@ -194,6 +199,201 @@ int Fetcher::Fetch(
 }
 
 
+/**
+ * Fetches a set of objects with a single call.  Objects that are not in the
+ * cache are downloaded concurrently, up to max_parallel (at most
+ * kMaxParallelFetches) at a time.
+ * Duplicate requests within the set result in a single download.  Objects
+ * that other threads are downloading at the same time are picked up by a
+ * regular Fetch() after the own downloads finished.  The callback is invoked
+ * in the calling thread for every request as soon as its result is available.
+ */
+void Fetcher::FetchMany(
+  const std::vector<Request> &requests,
+  const CallbackBase<Result> &callback,
+  const unsigned max_parallel)
+{
+  unsigned num_parallel = (max_parallel > 0) ? max_parallel : 1;
+  if (num_parallel > kMaxParallelFetches)
+    num_parallel = kMaxParallelFetches;
+  FifoChannel<download::JobInfo *> completions(kMaxParallelFetches,
+                                               kMaxParallelFetches);
+  // Running downloads, by download job and by object id
+  map<download::JobInfo *, BatchDownload *> jobs;
+  map<shash::Any, BatchDownload *> downloads;
+  // Requests for objects that are downloaded by other threads
+  vector<unsigned> postponed;
+
+  for (unsigned i = 0; i < requests.size(); ++i) {
+    const Request &request = requests[i];
+    map<shash::Any, BatchDownload *>::iterator iter_download =
+      downloads.find(request.id);
+    if (iter_download != downloads.end()) {
+      iter_download->second->idxs.push_back(i);
+      continue;
+    }
+
+    int fd = OpenSelect(request.id, request.name, request.object_type);
+    if (fd >= 0) {
+      LogCvmfs(kLogCache, kLogDebug, "hit: %s", request.name.c_str());
+      callback(Result(i, fd));
+      continue;
+    }
+
+    // Synchronization point, like in Fetch()
+    BatchDownload *download = NULL;
+    {
+      MutexLockGuard m(lock_queues_download_);
+      if (queues_download_.find(request.id) != queues_download_.end()) {
+        postponed.push_back(i);
+        continue;
+      }
+      fd = OpenSelect(request.id, request.name, request.object_type);
+      if (fd < 0) {
+        download = new BatchDownload();
+        queues_download_[request.id] = &download->other_pipes_waiting;
+      }
+    }
+    if (fd >= 0) {
+      callback(Result(i, fd));
+      continue;
+    }
+
+    download->idxs.push_back(i);
+    int retval = StartBatchDownload(request, download, &completions);
+    if (retval < 0) {
+      SignalWaitingThreads(retval, request.id, &download->other_pipes_waiting);
+      delete download;
+      callback(Result(i, retval));
+      continue;
+    }
+    jobs[&download->download_job] = download;
+    downloads[request.id] = download;
+
+    // Limit the number of open transactions
+    while (jobs.size() >= num_parallel) {
+      BatchDownload *finished = jobs[completions.Dequeue()];
+      jobs.erase(&finished->download_job);
+      downloads.erase(requests[finished->idxs[0]].id);
+      FinishBatchDownload(requests[finished->idxs[0]], finished, callback);
+    }
+  }
+
+  while (!jobs.empty()) {
+    BatchDownload *finished = jobs[completions.Dequeue()];
+    jobs.erase(&finished->download_job);
+    downloads.erase(requests[finished->idxs[0]].id);
+    FinishBatchDownload(requests[finished->idxs[0]], finished, callback);
+  }
+
+  for (unsigned i = 0; i < postponed.size(); ++i) {
+    const Request &request = requests[postponed[i]];
+    const int fd = Fetch(request.id, request.size, request.name,
+                         request.compression_algorithm, request.object_type);
+    callback(Result(postponed[i], fd));
+  }
+}
+
+
+/**
+ * Opens the cache transaction and hands the download over to the download
+ * manager.  The request needs to stay valid until the download is finished.
+ */
+int Fetcher::StartBatchDownload(
+  const Request &request,
+  BatchDownload *download,
+  FifoChannel<download::JobInfo *> *completions)
+{
+  perf::Inc(n_downloads);
+
+  LogCvmfs(kLogCache, kLogDebug, "downloading %s", request.name.c_str());
+  if (external_)
+    download->url = request.name;
+  else
+    download->url = "/data/" + request.id.MakePath();
+  download->txn = smalloc(cache_mgr_->SizeOfTxn());
+  int retval = cache_mgr_->StartTxn(request.id, request.size, download->txn);
+  if (retval < 0) {
+    LogCvmfs(kLogCache, kLogDebug, "could not start transaction on %s",
+             request.name.c_str());
+    free(download->txn);
+    download->txn = NULL;
+    return retval;
+  }
+  cache_mgr_->CtrlTxn(CacheManager::ObjectInfo(request.object_type,
+                                               request.name),
+                      0, download->txn);
+
+  LogCvmfs(kLogCache, kLogDebug, "miss: %s %s",
+           request.name.c_str(), download->url.c_str());
+  download->sink = new TransactionSink(cache_mgr_, download->txn);
+  download::JobInfo *job = &download->download_job;
+  job->destination = download::kDestinationSink;
+  job->probe_hosts = true;
+  job->url = &download->url;
+  job->destination_sink = download->sink;
+  job->expected_hash = &request.id;
+  job->extra_info = &request.name;
+  ClientCtx *ctx = ClientCtx::GetInstance();
+  if (ctx->IsSet())
+    ctx->Get(&job->uid, &job->gid, &job->pid);
+  job->compressed = (request.compression_algorithm != zlib::kNoCompression);
+  job->compression_alg = request.compression_algorithm;
+  download_mgr_->FetchAsync(job, completions);
+  return 0;
+}
+
+
+/**
+ * Commits the downloaded object and reports the result for all the requests
+ * that refer to it.  Frees the download.
+ */
+void Fetcher::FinishBatchDownload(
+  const Request &request,
+  BatchDownload *download,
+  const CallbackBase<Result> &callback)
+{
+  int fd_return;
+  const download::Failures error_code = download->download_job.error_code;
+  if (error_code == download::kFailOk) {
+    LogCvmfs(kLogCache, kLogDebug, "finished downloading of %s",
+             download->url.c_str());
+    fd_return = cache_mgr_->OpenFromTxn(download->txn);
+    if (fd_return < 0) {
+      cache_mgr_->AbortTxn(download->txn);
+    } else {
+      int retval = cache_mgr_->CommitTxn(download->txn);
+      if (retval < 0) {
+        cache_mgr_->Close(fd_return);
+        fd_return = retval;
+      }
+    }
+  } else {
+    LogCvmfs(kLogCache, kLogDebug | kLogSyslogErr,
+             "failed to fetch %s (hash: %s, error %d [%s])",
+             request.name.c_str(), request.id.ToString().c_str(),
+             error_code, download::Code2Ascii(error_code));
+    cache_mgr_->AbortTxn(download->txn);
+    backoff_throttle_->Throttle();
+    fd_return = -EIO;
+  }
+  SignalWaitingThreads(fd_return, request.id, &download->other_pipes_waiting);
+
+  // Duplicate the file descriptor before the first receiver can close it
+  vector<int> fds(download->idxs.size(), fd_return);
+  if (fd_return >= 0) {
+    for (unsigned i = 1; i < fds.size(); ++i)
+      fds[i] = cache_mgr_->Dup(fd_return);
+  }
+  for (unsigned i = 0; i < fds.size(); ++i)
+    callback(Result(download->idxs[i], fds[i]));
+
+  delete download->sink;
+  free(download->txn);
+  delete download;
+}
+
+
 Fetcher::Fetcher(
   CacheManager *cache_mgr,
   download::DownloadManager *download_mgr,
@@ -267,13 +467,22 @@ void Fetcher::SignalWaitingThreads(
   const int fd,
   const shash::Any &id,
   ThreadLocalStorage *tls)
+{
+  SignalWaitingThreads(fd, id, &tls->other_pipes_waiting);
+}
+
+
+void Fetcher::SignalWaitingThreads(
+  const int fd,
+  const shash::Any &id,
+  std::vector<int> *other_pipes_waiting)
 {
   MutexLockGuard m(lock_queues_download_);
-  for (unsigned i = 0, s = tls->other_pipes_waiting.size(); i < s; ++i) {
+  for (unsigned i = 0, s = other_pipes_waiting->size(); i < s; ++i) {
     int fd_dup = (fd >= 0) ? cache_mgr_->Dup(fd) : fd;
-    WritePipe(tls->other_pipes_waiting[i], &fd_dup, sizeof(int));
+    WritePipe((*other_pipes_waiting)[i], &fd_dup, sizeof(int));
   }
-  tls->other_pipes_waiting.clear();
+  other_pipes_waiting->clear();
   queues_download_.erase(id);
 }
 
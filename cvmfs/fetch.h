@@ -16,6 +16,7 @@
 #include "gtest/gtest_prod.h"
 #include "hash.h"
 #include "sink.h"
+#include "util/async.h"
 
 class BackoffThrottle;
 
@@ -67,6 +68,46 @@ class Fetcher : SingleCopy {
   friend void TLSDestructor(void *data);
 
  public:
+  /**
+   * Maximum number of objects that FetchMany() downloads concurrently.  Every
+   * download keeps a cache transaction open.
+   */
+  static const unsigned kMaxParallelFetches = 64;
+
+  /**
+   * Describes an object requested by FetchMany()
+   */
+  struct Request {
+    Request()
+      : size(CacheManager::kSizeUnknown)
+      , compression_algorithm(zlib::kZlibDefault)
+      , object_type(CacheManager::kTypeRegular)
+    { }
+    Request(const shash::Any &i,
+            const uint64_t s,
+            const std::string &n,
+            const zlib::Algorithms c,
+            const CacheManager::ObjectType t)
+      : id(i), size(s), name(n), compression_algorithm(c), object_type(t)
+    { }
+    shash::Any id;
+    uint64_t size;
+    std::string name;
+    zlib::Algorithms compression_algorithm;
+    CacheManager::ObjectType object_type;
+  };
+
+  /**
+   * The outcome of a single request of FetchMany().  The file descriptor, or a
+   * negative error code, refers to the request at position idx.  The receiver
+   * of the result owns the file descriptor.
+   */
+  struct Result {
+    Result(const unsigned i, const int f) : idx(i), fd(f) { }
+    unsigned idx;
+    int fd;
+  };
+
   Fetcher(CacheManager *cache_mgr,
           download::DownloadManager *download_mgr,
           BackoffThrottle *backoff_throttle,
@@ -81,6 +122,9 @@ class Fetcher : SingleCopy {
             const CacheManager::ObjectType object_type,
             const std::string &alt_url = "",
             off_t range_offset = -1);
+  void FetchMany(const std::vector<Request> &requests,
+                 const CallbackBase<Result> &callback,
+                 const unsigned max_parallel = kMaxParallelFetches);
 
   CacheManager *cache_mgr() { return cache_mgr_; }
   download::DownloadManager *download_mgr() { return download_mgr_; }
@@ -129,8 +173,29 @@ class Fetcher : SingleCopy {
 
   ThreadLocalStorage *GetTls();
   void CleanupTls(ThreadLocalStorage *tls);
+  /**
+   * State of a download started by FetchMany()
+   */
+  struct BatchDownload {
+    BatchDownload() : txn(NULL), sink(NULL) { }
+    std::vector<unsigned> idxs;
+    std::string url;
+    void *txn;
+    TransactionSink *sink;
+    download::JobInfo download_job;
+    std::vector<int> other_pipes_waiting;
+  };
+
   void SignalWaitingThreads(const int fd, const shash::Any &id,
                             ThreadLocalStorage *tls);
+  void SignalWaitingThreads(const int fd, const shash::Any &id,
+                            std::vector<int> *other_pipes_waiting);
+  int StartBatchDownload(const Request &request,
+                         BatchDownload *download,
+                         FifoChannel<download::JobInfo *> *completions);
+  void FinishBatchDownload(const Request &request,
+                           BatchDownload *download,
+                           const CallbackBase<Result> &callback);
   int OpenSelect(const shash::Any &id,
                  const std::string &name,
                  const CacheManager::ObjectType object_type);
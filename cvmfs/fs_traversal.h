@@ -9,22 +9,300 @@
 #define CVMFS_FS_TRAVERSAL_H_
 
 #include <errno.h>
+#include <pthread.h>
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 
+#include <map>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "logging.h"
 #include "platform.h"
 #include "util/async.h"
 #include "util/exception.h"
+#include "util/single_copy.h"
 
 #ifdef CVMFS_NAMESPACE_GUARD
 namespace CVMFS_NAMESPACE_GUARD {
 #endif
 
+/**
+ * Reads directories ahead of a FileSystemTraversal in a pool of threads.  A
+ * directory is read by listing it and by lstat'ing all of its entries.  The
+ * traversal itself, and therefore every callback, remains in the calling
+ * thread, so that the order of the callbacks does not change.
+ *
+ * The sub directories of a directory are scheduled when the traversal enters
+ * the directory.  The most recently scheduled directories are read first,
+ * which is the order in which the depth-first traversal needs them.  If the
+ * traversal needs a directory that no thread has started to read yet, it
+ * reads the directory itself.
+ *
+ * Scheduled paths are only names; the memory is in the listings.  At most
+ * max_listings directories are being read or wait, read, to be collected.
+ * Once the limit is reached, the threads pause until the traversal collects
+ * or cancels a listing.
+ */
+class DirectoryPrefetcher : SingleCopy {
+ public:
+  struct Entry {
+    Entry() : stat_errno(0) { }
+    std::string name;
+    platform_stat64 info;
+    /**
+     * Non-zero if lstat() failed
+     */
+    int stat_errno;
+  };
+
+  struct Listing {
+    Listing() : open_errno(0) { }
+    std::vector<Entry> entries;
+    /**
+     * Non-zero if the directory could not be opened
+     */
+    int open_errno;
+  };
+
+  static const unsigned kDefaultMaxListings = 64;
+
+  explicit DirectoryPrefetcher(
+    const unsigned num_threads,
+    const unsigned max_listings = kDefaultMaxListings)
+    : max_listings_(max_listings)
+    , num_listings_(0)
+    , terminate_(false)
+  {
+    assert(max_listings_ > 0);
+    int retval = pthread_mutex_init(&lock_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_work_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_done_, NULL);
+    assert(retval == 0);
+    threads_.resize(num_threads);
+    for (unsigned i = 0; i < num_threads; ++i) {
+      retval = pthread_create(&threads_[i], NULL, MainPrefetch, this);
+      assert(retval == 0);
+    }
+  }
+
+  ~DirectoryPrefetcher() {
+    pthread_mutex_lock(&lock_);
+    terminate_ = true;
+    pthread_cond_broadcast(&cond_work_);
+    pthread_mutex_unlock(&lock_);
+    for (unsigned i = 0; i < threads_.size(); ++i)
+      pthread_join(threads_[i], NULL);
+    for (std::map<std::string, Job>::iterator i = jobs_.begin(),
+         iEnd = jobs_.end(); i != iEnd; ++i)
+    {
+      delete i->second.listing;
+    }
+    pthread_cond_destroy(&cond_done_);
+    pthread_cond_destroy(&cond_work_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  /**
+   * The paths are read in the given order, before anything that was scheduled
+   * earlier.  Every scheduled path has to be either collected by Get() or
+   * dropped by Cancel().  A path that is still known, e.g. cancelled by an
+   * enclosing traversal while being read, is claimed back.
+   */
+  void Schedule(const std::vector<std::string> &paths) {
+    if (paths.empty())
+      return;
+    pthread_mutex_lock(&lock_);
+    for (unsigned i = paths.size(); i > 0; --i) {
+      std::map<std::string, Job>::iterator job = jobs_.find(paths[i - 1]);
+      if (job != jobs_.end()) {
+        if (job->second.state == kCancelled)
+          job->second.state = kReading;
+        continue;
+      }
+      jobs_[paths[i - 1]] = Job();
+      stack_.push_back(paths[i - 1]);
+    }
+    pthread_cond_broadcast(&cond_work_);
+    pthread_mutex_unlock(&lock_);
+  }
+
+  /**
+   * Returns the listing of path, which is read in the calling thread unless
+   * it is already (being) read by the prefetch threads.  The caller takes
+   * ownership of the listing.
+   */
+  Listing *Get(const std::string &path) {
+    pthread_mutex_lock(&lock_);
+    std::map<std::string, Job>::iterator job = jobs_.find(path);
+    if ((job == jobs_.end()) || (job->second.state == kPending)) {
+      if (job != jobs_.end())
+        jobs_.erase(job);
+      pthread_mutex_unlock(&lock_);
+      Listing *listing = new Listing();
+      ReadDirectory(path, listing);
+      return listing;
+    }
+    if (job->second.state == kCancelled)
+      job->second.state = kReading;
+    while (job->second.state == kReading)
+      pthread_cond_wait(&cond_done_, &lock_);
+    assert(job->second.state == kDone);
+    Listing *listing = job->second.listing;
+    jobs_.erase(job);
+    ReleaseListing();
+    pthread_mutex_unlock(&lock_);
+    return listing;
+  }
+
+  /**
+   * For scheduled directories that the traversal does not enter after all
+   */
+  void Cancel(const std::string &path) {
+    pthread_mutex_lock(&lock_);
+    std::map<std::string, Job>::iterator job = jobs_.find(path);
+    if (job != jobs_.end()) {
+      if (job->second.state == kReading) {
+        job->second.state = kCancelled;
+      } else {
+        if (job->second.state == kDone) {
+          delete job->second.listing;
+          ReleaseListing();
+        }
+        jobs_.erase(job);
+      }
+    }
+    pthread_mutex_unlock(&lock_);
+  }
+
+  /**
+   * Number of directories that are being read or wait to be collected
+   */
+  unsigned num_listings() {
+    pthread_mutex_lock(&lock_);
+    const unsigned result = num_listings_;
+    pthread_mutex_unlock(&lock_);
+    return result;
+  }
+
+  static void ReadDirectory(const std::string &path, Listing *listing) {
+    DIR *dip = opendir(path.c_str());
+    if (!dip) {
+      listing->open_errno = errno;
+      return;
+    }
+    const int dir_fd = dirfd(dip);
+    platform_dirent64 *dit;
+    while ((dit = platform_readdir(dip)) != NULL) {
+      if ((strcmp(dit->d_name, ".") == 0) || (strcmp(dit->d_name, "..") == 0))
+        continue;
+      listing->entries.push_back(Entry());
+      Entry *entry = &listing->entries.back();
+      entry->name = dit->d_name;
+      if (platform_fstatat(dir_fd, dit->d_name, &entry->info) != 0)
+        entry->stat_errno = errno;
+    }
+    closedir(dip);
+  }
+
+ private:
+  enum JobState {
+    kPending = 0,
+    kReading,
+    kCancelled,
+    kDone
+  };
+
+  struct Job {
+    Job() : state(kPending), listing(NULL) { }
+    JobState state;
+    Listing *listing;
+  };
+
+  /**
+   * Called with lock_ held when a listing of a prefetch thread is collected or
+   * dropped
+   */
+  void ReleaseListing() {
+    assert(num_listings_ > 0);
+    if (num_listings_-- == max_listings_)
+      pthread_cond_broadcast(&cond_work_);
+  }
+
+  static void *MainPrefetch(void *data) {
+    DirectoryPrefetcher *prefetcher = reinterpret_cast<DirectoryPrefetcher *>(
+      data);
+    pthread_mutex_lock(&prefetcher->lock_);
+    while (true) {
+      while (!prefetcher->terminate_ &&
+             (prefetcher->stack_.empty() ||
+              (prefetcher->num_listings_ >= prefetcher->max_listings_)))
+      {
+        pthread_cond_wait(&prefetcher->cond_work_, &prefetcher->lock_);
+      }
+      if (prefetcher->terminate_)
+        break;
+      const std::string path = prefetcher->stack_.back();
+      prefetcher->stack_.pop_back();
+      // Stale if taken over by Get() or dropped by Cancel() in the meantime
+      std::map<std::string, Job>::iterator job = prefetcher->jobs_.find(path);
+      if ((job == prefetcher->jobs_.end()) ||
+          (job->second.state != kPending))
+      {
+        continue;
+      }
+      job->second.state = kReading;
+      prefetcher->num_listings_++;
+      pthread_mutex_unlock(&prefetcher->lock_);
+
+      Listing *listing = new Listing();
+      ReadDirectory(path, listing);
+
+      pthread_mutex_lock(&prefetcher->lock_);
+      if (job->second.state == kCancelled) {
+        delete listing;
+        prefetcher->jobs_.erase(job);
+        prefetcher->ReleaseListing();
+      } else {
+        job->second.state = kDone;
+        job->second.listing = listing;
+        pthread_cond_broadcast(&prefetcher->cond_done_);
+      }
+    }
+    pthread_mutex_unlock(&prefetcher->lock_);
+    return NULL;
+  }
+
+  /**
+   * Scheduled paths, the next one to be read at the back.  Can contain paths
+   * that are not (or no longer) pending.
+   */
+  std::vector<std::string> stack_;
+  std::map<std::string, Job> jobs_;
+  unsigned max_listings_;
+  /**
+   * Jobs taken by the prefetch threads that are not yet collected or dropped
+   */
+  unsigned num_listings_;
+  bool terminate_;
+  std::vector<pthread_t> threads_;
+  pthread_mutex_t lock_;
+  /**
+   * Signals new paths on the stack, released listings and termination
+   */
+  pthread_cond_t cond_work_;
+  /**
+   * Signals finished listings
+   */
+  pthread_cond_t cond_done_;
+};
+
+
 /**
  * @brief A simple recursion engine to abstract the recursion of directories.
  * It provides several callback hooks to instrument and control the recursion.
@@ -100,11 +378,33 @@ class FileSystemTraversal {
     fn_new_dir_postfix(NULL),
     delegate_(delegate),
     relative_to_directory_(relative_to_directory),
-    recurse_(recurse)
+    recurse_(recurse),
+    num_threads_(0),
+    prefetcher_(NULL)
   {
     Init();
   }
 
+  /**
+   * With num_threads > 0, recursive traversals read directories ahead in
+   * num_threads additional threads (see DirectoryPrefetcher).  The callbacks
+   * are still called one by one, in the same order, from the thread that
+   * calls Recurse().  The traversed tree must not change during the
+   * traversal.
+   */
+  void set_num_threads(const unsigned num_threads) {
+    num_threads_ = num_threads;
+  }
+
+  /**
+   * Reads ahead with the threads of an existing prefetcher instead of
+   * starting new ones, e.g. for a traversal that is started from a callback
+   * of another traversal.  Takes precedence over set_num_threads().
+   */
+  void set_prefetcher(DirectoryPrefetcher *prefetcher) {
+    prefetcher_ = prefetcher;
+  }
+
   /**
    * Start the recursion.
    * @param dir_path The directory to start the recursion at
@@ -124,7 +424,14 @@ class FileSystemTraversal {
            dir_path.substr(0, relative_to_directory_.length()) ==
              relative_to_directory_);
 
-    DoRecursion(dir_path, "");
+    if (recurse_ && (prefetcher_ != NULL)) {
+      DoRecursion(dir_path, "", prefetcher_);
+    } else if (recurse_ && (num_threads_ > 0)) {
+      DirectoryPrefetcher prefetcher(num_threads_);
+      DoRecursion(dir_path, "", &prefetcher);
+    } else {
+      DoRecursion(dir_path, "", NULL);
+    }
   }
 
  private:
@@ -134,22 +441,29 @@ class FileSystemTraversal {
   /** dir_path in callbacks will be relative to this directory */
   std::string relative_to_directory_;
   bool recurse_;
+  unsigned num_threads_;
+  DirectoryPrefetcher *prefetcher_;
 
 
   void Init() {
   }
 
-  void DoRecursion(const std::string &parent_path, const std::string &dir_name)
-    const
+  void DoRecursion(const std::string &parent_path, const std::string &dir_name,
+                   DirectoryPrefetcher *prefetcher) const
   {
-    DIR *dip;
-    platform_dirent64 *dit;
     const std::string path = parent_path + ((!dir_name.empty()) ?
                                            ("/" + dir_name) : "");
 
     // Change into directory and notify the user
     LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "entering %s (%s -- %s)",
              path.c_str(), parent_path.c_str(), dir_name.c_str());
+    if (prefetcher != NULL) {
+      DoPrefetchedRecursion(parent_path, dir_name, path, prefetcher);
+      return;
+    }
+
+    DIR *dip;
+    platform_dirent64 *dit;
     dip = opendir(path.c_str());
     if (!dip) {
       PANIC(kLogStderr,
@@ -164,16 +478,8 @@ class FileSystemTraversal {
       // Check if file should be ignored
       if (std::string(dit->d_name) == "." || std::string(dit->d_name) == "..") {
         continue;
-      } else if (fn_ignore_file != NULL) {
-        if (Notify(fn_ignore_file, path, dit->d_name)) {
-          LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "ignoring %s/%s",
-                   path.c_str(), dit->d_name);
-          continue;
-        }
-      } else {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg,
-                 "not ignoring %s/%s (fn_ignore_file not set)",
-                 path.c_str(), dit->d_name);
+      } else if (IsIgnored(path, dit->d_name)) {
+        continue;
       }
 
       // Notify user about found directory entry
@@ -183,42 +489,7 @@ class FileSystemTraversal {
         PANIC(kLogStderr, "failed to lstat '%s' errno: %d",
               (path + "/" + dit->d_name).c_str(), errno);
       }
-      if (S_ISDIR(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing directory %s/%s",
-                 path.c_str(), dit->d_name);
-        if (Notify(fn_new_dir_prefix, path, dit->d_name) && recurse_) {
-          DoRecursion(path, dit->d_name);
-        }
-        Notify(fn_new_dir_postfix, path, dit->d_name);
-      } else if (S_ISREG(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing regular file %s/%s",
-                 path.c_str(), dit->d_name);
-        Notify(fn_new_file, path, dit->d_name);
-      } else if (S_ISLNK(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing symlink %s/%s",
-                 path.c_str(), dit->d_name);
-        Notify(fn_new_symlink, path, dit->d_name);
-      } else if (S_ISSOCK(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing socket %s/%s",
-                 path.c_str(), dit->d_name);
-        Notify(fn_new_socket, path, dit->d_name);
-      } else if (S_ISBLK(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing block-device %s/%s",
-                 path.c_str(), dit->d_name);
-        Notify(fn_new_block_dev, path, dit->d_name);
-      } else if (S_ISCHR(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing character-device "
-                                                  "%s/%s",
-                 path.c_str(), dit->d_name);
-        Notify(fn_new_character_dev, path, dit->d_name);
-      } else if (S_ISFIFO(info.st_mode)) {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing FIFO %s/%s",
-                 path.c_str(), dit->d_name);
-        Notify(fn_new_fifo, path, dit->d_name);
-      } else {
-        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "unknown file type %s/%s",
-                 path.c_str(), dit->d_name);
-      }
+      ProcessEntry(path, dit->d_name, info, NULL);
     }
 
     // Close directory and notify user
@@ -227,6 +498,110 @@ class FileSystemTraversal {
     Notify(fn_leave_dir, parent_path, dir_name);
   }
 
+  /**
+   * Same as the loop in DoRecursion() but on a listing that was read ahead
+   */
+  void DoPrefetchedRecursion(const std::string &parent_path,
+                             const std::string &dir_name,
+                             const std::string &path,
+                             DirectoryPrefetcher *prefetcher) const
+  {
+    DirectoryPrefetcher::Listing *listing = prefetcher->Get(path);
+    if (listing->open_errno != 0) {
+      PANIC(kLogStderr,
+            "Failed to open %s (%d).\n"
+            "Please check directory permissions.",
+            path.c_str(), listing->open_errno);
+    }
+    std::vector<std::string> sub_dirs;
+    for (unsigned i = 0; i < listing->entries.size(); ++i) {
+      const DirectoryPrefetcher::Entry &entry = listing->entries[i];
+      if ((entry.stat_errno == 0) && S_ISDIR(entry.info.st_mode))
+        sub_dirs.push_back(path + "/" + entry.name);
+    }
+    prefetcher->Schedule(sub_dirs);
+    Notify(fn_enter_dir, parent_path, dir_name);
+
+    for (unsigned i = 0; i < listing->entries.size(); ++i) {
+      const DirectoryPrefetcher::Entry &entry = listing->entries[i];
+      if (IsIgnored(path, entry.name)) {
+        if ((entry.stat_errno == 0) && S_ISDIR(entry.info.st_mode))
+          prefetcher->Cancel(path + "/" + entry.name);
+        continue;
+      }
+      if (entry.stat_errno != 0) {
+        PANIC(kLogStderr, "failed to lstat '%s' errno: %d",
+              (path + "/" + entry.name).c_str(), entry.stat_errno);
+      }
+      ProcessEntry(path, entry.name, entry.info, prefetcher);
+    }
+    delete listing;
+
+    LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "leaving %s", path.c_str());
+    Notify(fn_leave_dir, parent_path, dir_name);
+  }
+
+  bool IsIgnored(const std::string &path, const std::string &name) const {
+    if (fn_ignore_file != NULL) {
+      if (Notify(fn_ignore_file, path, name)) {
+        LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "ignoring %s/%s",
+                 path.c_str(), name.c_str());
+        return true;
+      }
+    } else {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg,
+               "not ignoring %s/%s (fn_ignore_file not set)",
+               path.c_str(), name.c_str());
+    }
+    return false;
+  }
+
+  void ProcessEntry(const std::string &path,
+                    const std::string &name,
+                    const platform_stat64 &info,
+                    DirectoryPrefetcher *prefetcher) const
+  {
+    const char *d_name = name.c_str();
+    if (S_ISDIR(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing directory %s/%s",
+               path.c_str(), d_name);
+      if (Notify(fn_new_dir_prefix, path, name) && recurse_) {
+        DoRecursion(path, name, prefetcher);
+      } else if (prefetcher != NULL) {
+        prefetcher->Cancel(path + "/" + name);
+      }
+      Notify(fn_new_dir_postfix, path, name);
+    } else if (S_ISREG(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing regular file %s/%s",
+               path.c_str(), d_name);
+      Notify(fn_new_file, path, name);
+    } else if (S_ISLNK(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing symlink %s/%s",
+               path.c_str(), d_name);
+      Notify(fn_new_symlink, path, name);
+    } else if (S_ISSOCK(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing socket %s/%s",
+               path.c_str(), d_name);
+      Notify(fn_new_socket, path, name);
+    } else if (S_ISBLK(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing block-device %s/%s",
+               path.c_str(), d_name);
+      Notify(fn_new_block_dev, path, name);
+    } else if (S_ISCHR(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing character-device "
+                                                "%s/%s",
+               path.c_str(), d_name);
+      Notify(fn_new_character_dev, path, name);
+    } else if (S_ISFIFO(info.st_mode)) {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "passing FIFO %s/%s",
+               path.c_str(), d_name);
+      Notify(fn_new_fifo, path, name);
+    } else {
+      LogCvmfs(kLogFsTraversal, kLogVerboseMsg, "unknown file type %s/%s",
+               path.c_str(), d_name);
+    }
+  }
+
   inline bool Notify(const BoolCallback callback,
                      const std::string &parent_path,
                      const std::string &entry_name) const
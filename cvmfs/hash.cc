@@ -13,7 +13,14 @@
 #include <openssl/ripemd.h>
 #include <openssl/sha.h>
 #include <unistd.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
@@ -252,6 +259,284 @@ void Final(ContextPtr context, Any *any_digest) {
 }
 
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CVMFS_HASH_SHA1_LANES
+#endif
+
+/**
+ * Multi-buffer SHA-1: the message schedule and the rounds of up to
+ * kSha1Lanes independent streams run in the lanes of one AVX2 register.  On
+ * CPUs without the SHA extensions, this is about three times faster than
+ * hashing the streams one by one.  With the SHA extensions, it is still faster
+ * if enough streams are available.
+ */
+namespace {
+
+const unsigned kSha1Lanes = 8;
+const unsigned kSha1BlockSize = 64;
+/**
+ * Below this number of streams with complete blocks, UpdateMulti() falls back
+ * to serial hashing
+ */
+const unsigned kSha1MinLanes = 3;
+const unsigned kSha1MinLanesShaExtensions = 6;
+
+/**
+ * A SHA-1 stream that is ready for the lanes: the context has no buffered
+ * partial block and data points to num_blocks complete blocks followed by
+ * tail_size more bytes.
+ */
+struct Sha1Stream {
+  SHA_CTX *ctx;
+  const unsigned char *data;
+  unsigned num_blocks;
+  unsigned tail_size;
+};
+
+#ifdef CVMFS_HASH_SHA1_LANES
+
+typedef uint32_t Sha1Vector __attribute__((vector_size(4 * kSha1Lanes)));
+
+// Reads the big-endian word t of the current block of every lane.  The bytes
+// are swapped in the vector registers.
+#define CVMFS_SHA1_LOAD(l, t) \
+  (*reinterpret_cast<const uint32_t *>(data[l] + 4 * (t)))
+#define CVMFS_SHA1_LOAD_W(t) { \
+  const Sha1Vector word = { \
+    CVMFS_SHA1_LOAD(0, t), CVMFS_SHA1_LOAD(1, t), CVMFS_SHA1_LOAD(2, t), \
+    CVMFS_SHA1_LOAD(3, t), CVMFS_SHA1_LOAD(4, t), CVMFS_SHA1_LOAD(5, t), \
+    CVMFS_SHA1_LOAD(6, t), CVMFS_SHA1_LOAD(7, t)}; \
+  w[t] = (word << 24) | ((word << 8) & 0xff0000) | \
+         ((word >> 8) & 0xff00) | (word >> 24); }
+#define CVMFS_SHA1_LOAD4(t) \
+  CVMFS_SHA1_LOAD_W(t) CVMFS_SHA1_LOAD_W((t) + 1) \
+  CVMFS_SHA1_LOAD_W((t) + 2) CVMFS_SHA1_LOAD_W((t) + 3)
+#define CVMFS_SHA1_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define CVMFS_SHA1_CH(b, c, d) (((b) & (c)) | (~(b) & (d)))
+#define CVMFS_SHA1_PARITY(b, c, d) ((b) ^ (c) ^ (d))
+#define CVMFS_SHA1_MAJ(b, c, d) (((b) & (c)) | ((b) & (d)) | ((c) & (d)))
+// The message schedule is computed in place in a window of 16 words
+#define CVMFS_SHA1_W(t) (((t) < 16) ? w[(t) & 15] : \
+  (w[(t) & 15] = CVMFS_SHA1_ROTL(w[((t) + 13) & 15] ^ w[((t) + 8) & 15] ^ \
+                                 w[((t) + 2) & 15] ^ w[(t) & 15], 1)))
+#define CVMFS_SHA1_ROUND(a, b, c, d, e, F, k, t) { \
+  e += CVMFS_SHA1_ROTL(a, 5) + F(b, c, d) + k + CVMFS_SHA1_W(t); \
+  b = CVMFS_SHA1_ROTL(b, 30); }
+#define CVMFS_SHA1_ROUND5(F, k, t) \
+  CVMFS_SHA1_ROUND(a, b, c, d, e, F, k, (t)) \
+  CVMFS_SHA1_ROUND(e, a, b, c, d, F, k, (t) + 1) \
+  CVMFS_SHA1_ROUND(d, e, a, b, c, F, k, (t) + 2) \
+  CVMFS_SHA1_ROUND(c, d, e, a, b, F, k, (t) + 3) \
+  CVMFS_SHA1_ROUND(b, c, d, e, a, F, k, (t) + 4)
+
+/**
+ * Compresses num_blocks blocks of every stream.  Unused lanes are given a NULL
+ * stream; they hash a block of zeros and their result is discarded.
+ */
+__attribute__((target("avx2")))
+void Sha1CompressLanes(Sha1Stream * const *streams, const unsigned num_blocks)
+{
+  static const unsigned char kZeroBlock[kSha1BlockSize] = {0};
+  union {
+    Sha1Vector v;
+    uint32_t u[kSha1Lanes];
+  } lanes[5];
+  const unsigned char *data[kSha1Lanes];
+  unsigned advance[kSha1Lanes];
+  for (unsigned l = 0; l < kSha1Lanes; ++l) {
+    const SHA_CTX *ctx = streams[l] ? streams[l]->ctx : NULL;
+    lanes[0].u[l] = ctx ? ctx->h0 : 0;
+    lanes[1].u[l] = ctx ? ctx->h1 : 0;
+    lanes[2].u[l] = ctx ? ctx->h2 : 0;
+    lanes[3].u[l] = ctx ? ctx->h3 : 0;
+    lanes[4].u[l] = ctx ? ctx->h4 : 0;
+    data[l] = ctx ? streams[l]->data : kZeroBlock;
+    advance[l] = ctx ? kSha1BlockSize : 0;
+  }
+
+  Sha1Vector h0 = lanes[0].v;
+  Sha1Vector h1 = lanes[1].v;
+  Sha1Vector h2 = lanes[2].v;
+  Sha1Vector h3 = lanes[3].v;
+  Sha1Vector h4 = lanes[4].v;
+  for (unsigned i = 0; i < num_blocks; ++i) {
+    // Fully unrolled, so that the compiler can keep w in registers
+    Sha1Vector w[16];
+    CVMFS_SHA1_LOAD4(0) CVMFS_SHA1_LOAD4(4)
+    CVMFS_SHA1_LOAD4(8) CVMFS_SHA1_LOAD4(12)
+    for (unsigned l = 0; l < kSha1Lanes; ++l)
+      data[l] += advance[l];
+
+    Sha1Vector a = h0, b = h1, c = h2, d = h3, e = h4;
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_CH, 0x5a827999, 0)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_CH, 0x5a827999, 5)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_CH, 0x5a827999, 10)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_CH, 0x5a827999, 15)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0x6ed9eba1, 20)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0x6ed9eba1, 25)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0x6ed9eba1, 30)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0x6ed9eba1, 35)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_MAJ, 0x8f1bbcdc, 40)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_MAJ, 0x8f1bbcdc, 45)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_MAJ, 0x8f1bbcdc, 50)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_MAJ, 0x8f1bbcdc, 55)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0xca62c1d6, 60)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0xca62c1d6, 65)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0xca62c1d6, 70)
+    CVMFS_SHA1_ROUND5(CVMFS_SHA1_PARITY, 0xca62c1d6, 75)
+    h0 += a;
+    h1 += b;
+    h2 += c;
+    h3 += d;
+    h4 += e;
+  }
+  lanes[0].v = h0;
+  lanes[1].v = h1;
+  lanes[2].v = h2;
+  lanes[3].v = h3;
+  lanes[4].v = h4;
+
+  for (unsigned l = 0; l < kSha1Lanes; ++l) {
+    if (streams[l] == NULL)
+      continue;
+    SHA_CTX *ctx = streams[l]->ctx;
+    ctx->h0 = lanes[0].u[l];
+    ctx->h1 = lanes[1].u[l];
+    ctx->h2 = lanes[2].u[l];
+    ctx->h3 = lanes[3].u[l];
+    ctx->h4 = lanes[4].u[l];
+    // Length of the message in bits
+    const uint64_t nbits =
+      ((static_cast<uint64_t>(ctx->Nh) << 32) | ctx->Nl) +
+      static_cast<uint64_t>(num_blocks) * kSha1BlockSize * 8;
+    ctx->Nl = static_cast<uint32_t>(nbits);
+    ctx->Nh = static_cast<uint32_t>(nbits >> 32);
+    streams[l]->data += num_blocks * kSha1BlockSize;
+    streams[l]->num_blocks -= num_blocks;
+  }
+}
+
+#undef CVMFS_SHA1_ROUND5
+#undef CVMFS_SHA1_ROUND
+#undef CVMFS_SHA1_W
+#undef CVMFS_SHA1_MAJ
+#undef CVMFS_SHA1_PARITY
+#undef CVMFS_SHA1_CH
+#undef CVMFS_SHA1_ROTL
+#undef CVMFS_SHA1_LOAD4
+#undef CVMFS_SHA1_LOAD_W
+#undef CVMFS_SHA1_LOAD
+
+#endif  // CVMFS_HASH_SHA1_LANES
+
+
+/**
+ * Hashes the complete blocks of the streams in the lanes as long as at least
+ * min_lanes streams have blocks left.  The remaining blocks and the bytes that
+ * do not fill a complete block are hashed serially.
+ */
+void Sha1Lanes(Sha1Stream *streams, const unsigned num_streams,
+               const unsigned min_lanes)
+{
+#ifdef CVMFS_HASH_SHA1_LANES
+  while (true) {
+    Sha1Stream *active[kSha1Lanes];
+    unsigned num_active = 0;
+    unsigned num_blocks = 0;
+    for (unsigned i = 0; (i < num_streams) && (num_active < kSha1Lanes); ++i) {
+      if (streams[i].num_blocks == 0)
+        continue;
+      if ((num_active == 0) || (streams[i].num_blocks < num_blocks))
+        num_blocks = streams[i].num_blocks;
+      active[num_active++] = &streams[i];
+    }
+    if ((num_active == 0) || (num_active < min_lanes))
+      break;
+    for (unsigned l = num_active; l < kSha1Lanes; ++l)
+      active[l] = NULL;
+    Sha1CompressLanes(active, num_blocks);
+  }
+#endif
+
+  for (unsigned i = 0; i < num_streams; ++i) {
+    SHA1_Update(streams[i].ctx, streams[i].data,
+                streams[i].num_blocks * kSha1BlockSize + streams[i].tail_size);
+  }
+}
+
+}  // anonymous namespace
+
+
+bool HasShaExtensions() {
+#if defined(__x86_64__) && defined(__GNUC__)
+  if (__get_cpuid_max(0, NULL) < 7)
+    return false;
+  unsigned eax, ebx, ecx, edx;
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  // Bit 29 of EBX: SHA extensions
+  return ebx & (1U << 29);
+#elif defined(__aarch64__) && defined(__linux__)
+  return getauxval(AT_HWCAP) & HWCAP_SHA1;
+#else
+  return false;
+#endif
+}
+
+
+bool HasSha1Lanes() {
+#ifdef CVMFS_HASH_SHA1_LANES
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+
+void UpdateMulti(const unsigned num_streams,
+                 const unsigned char * const *buffers,
+                 const unsigned *buffer_sizes,
+                 const ContextPtr *contexts,
+                 const CodePaths code_path)
+{
+  static const bool has_sha1_lanes = HasSha1Lanes();
+  static const unsigned min_lanes =
+    HasShaExtensions() ? kSha1MinLanesShaExtensions : kSha1MinLanes;
+  const bool use_lanes = has_sha1_lanes && (code_path != kCodePathSerial);
+
+  Sha1Stream *streams =
+    reinterpret_cast<Sha1Stream *>(alloca(num_streams * sizeof(Sha1Stream)));
+  unsigned num_sha1 = 0;
+  for (unsigned i = 0; i < num_streams; ++i) {
+    if (!use_lanes || (contexts[i].algorithm != kSha1)) {
+      Update(buffers[i], buffer_sizes[i], contexts[i]);
+      continue;
+    }
+
+    assert(contexts[i].size == sizeof(SHA_CTX));
+    SHA_CTX *ctx = reinterpret_cast<SHA_CTX *>(contexts[i].buffer);
+    const unsigned char *data = buffers[i];
+    unsigned size = buffer_sizes[i];
+    // Complete the partial block of a previous update first
+    if (ctx->num > 0) {
+      const unsigned nbytes = std::min(size, kSha1BlockSize - ctx->num);
+      SHA1_Update(ctx, data, nbytes);
+      data += nbytes;
+      size -= nbytes;
+    }
+    streams[num_sha1].ctx = ctx;
+    streams[num_sha1].data = data;
+    streams[num_sha1].num_blocks = size / kSha1BlockSize;
+    streams[num_sha1].tail_size = size % kSha1BlockSize;
+    num_sha1++;
+  }
+  if (num_sha1 == 0)
+    return;
+
+  Sha1Lanes(streams, num_sha1, (code_path == kCodePathAuto) ? min_lanes : 1);
+}
+
+
 void HashMem(const unsigned char *buffer, const unsigned buffer_size,
              Any *any_digest)
 {
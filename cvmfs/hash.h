@@ -499,6 +499,32 @@ void Init(ContextPtr context);
 void Update(const unsigned char *buffer, const unsigned buffer_size,
             ContextPtr context);
 void Final(ContextPtr context, Any *any_digest);
+
+/**
+ * Code paths of UpdateMulti().  Single streams are always hashed by OpenSSL,
+ * which uses the SHA extensions of x86_64 and ARMv8 CPUs on its own if they
+ * are available.
+ */
+enum CodePaths {
+  kCodePathAuto = 0,  ///< Depends on the CPU and on the number of streams
+  kCodePathSerial,    ///< Update() one stream after the other
+  kCodePathLanes,     ///< SHA-1 streams in the lanes of AVX2 registers
+};
+
+/**
+ * Updates several independent hash contexts in one call.  The contexts can use
+ * different algorithms.  SHA-1 streams are, if the CPU supports it, hashed in
+ * parallel in SIMD lanes (multi-buffer hashing).  A context must not appear
+ * more than once.
+ */
+void UpdateMulti(const unsigned num_streams,
+                 const unsigned char * const *buffers,
+                 const unsigned *buffer_sizes,
+                 const ContextPtr *contexts,
+                 const CodePaths code_path = kCodePathAuto);
+bool HasShaExtensions();
+bool HasSha1Lanes();
+
 bool HashFile(const std::string &filename, Any *any_digest);
 bool HashFd(int fd, Any *any_digest);
 void HashMem(const unsigned char *buffer, const unsigned buffer_size,
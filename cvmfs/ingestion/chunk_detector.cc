@@ -10,6 +10,49 @@
 #include <limits>
 
 #include "ingestion/item.h"
+#include "util/exception.h"
+
+using namespace std;  // NOLINT
+
+
+ChunkingAlgorithms ParseChunkingAlgorithm(const string &algorithm_option) {
+  if ((algorithm_option == "") || (algorithm_option == "xor32"))
+    return kChunkingXor32;
+  if (algorithm_option == "fastcdc")
+    return kChunkingFastCdc;
+  return kChunkingUnknown;
+}
+
+
+string ChunkingAlgorithmName(const ChunkingAlgorithms algorithm) {
+  switch (algorithm) {
+    case kChunkingXor32:
+      return "xor32";
+    case kChunkingFastCdc:
+      return "fastcdc";
+    default:
+      return "unknown";
+  }
+}
+
+
+ChunkDetector *ChunkDetector::Create(
+  const ChunkingAlgorithms algorithm,
+  const uint64_t minimal_chunk_size,
+  const uint64_t average_chunk_size,
+  const uint64_t maximal_chunk_size)
+{
+  switch (algorithm) {
+    case kChunkingXor32:
+      return new Xor32Detector(minimal_chunk_size, average_chunk_size,
+                               maximal_chunk_size);
+    case kChunkingFastCdc:
+      return new FastCdcDetector(minimal_chunk_size, average_chunk_size,
+                                 maximal_chunk_size);
+    default:
+      PANIC(kLogStderr, "unknown chunking algorithm %d", algorithm);
+  }
+}
 
 
 uint64_t ChunkDetector::FindNextCutMark(BlockItem *block) {
@@ -135,3 +178,248 @@ uint64_t Xor32Detector::DoFindNextCutMark(BlockItem *buffer) {
     return NoCut(internal_offset + offset());
   }
 }
+
+
+//------------------------------------------------------------------------------
+
+
+// Random values for every byte, generated with splitmix64.  You should never
+// change this table, since it affects the definition of cut marks.
+const uint64_t FastCdcDetector::kGear[256] = {
+  0xb74ab59caa481d94ull, 0x4b5fbea0fedaf01eull, 0x4550717c6cd14903ull,
+  0x0c20fa968ec0deccull, 0x73d89d7218cc861full, 0x610c9528554cf41full,
+  0x05e9e6a6ae7e3176ull, 0x3e6f3ce951002466ull, 0xf4ecdea490027782ull,
+  0x46c57a8188d00246ull, 0xc35a936689b95965ull, 0x8cb711abb1bc1b66ull,
+  0x4f16e4c7cef30a52ull, 0xc9545dbdd611e073ull, 0xcd7218bd859a2491ull,
+  0xe82ac5dd99fcae6aull, 0x6734892f847ea9beull, 0xc4bc6399c38e4717ull,
+  0x890d93c6c2d7cc75ull, 0x9fb3d0ad03717a7cull, 0xf31ca8c3884b9ecbull,
+  0x35d40138b7319353ull, 0x70707acf7758444eull, 0x13314dcebcf2d049ull,
+  0x4ff74d1fdddc4dc8ull, 0xc385a28ef4dcdd8bull, 0x5b818556b65b21c6ull,
+  0x11740a1377e87a64ull, 0x081a1ecebc9ddb78ull, 0x844409d5a182e9d8ull,
+  0x2c58afeafe28371full, 0x045e01fc8efa8cdcull, 0xad1b17d57cedfd8bull,
+  0x7201f30a81a34422ull, 0xaec37ef6ba5a1808ull, 0xe141ceadf7726489ull,
+  0x8e942fcd3e6a7d17ull, 0x407f5016f17771ecull, 0x639f00e029c1896aull,
+  0xefc98d258fcb9cb3ull, 0x82b9a3899167beedull, 0x7ac440d3e35086d7ull,
+  0x70d80d2919641efbull, 0xf52476e095acd356ull, 0xf79c2f42be0de91cull,
+  0xae20ac5b257807f7ull, 0x936acb7395570de3ull, 0x63782fa5c755ec75ull,
+  0x5c0197d0eb3af6a7ull, 0x16fb5aa4c0452cedull, 0x607880cf732c1adcull,
+  0x3bf90e23f2656916ull, 0x3029fa92f4230324ull, 0xca135ab46c474df8ull,
+  0xc0264f76557426dfull, 0x1f3b39054ce122a4ull, 0x36d3da372a5f5a6aull,
+  0xec80768f5b887255ull, 0x29eebeb9150e3b2eull, 0xe0a7cf51bf6405deull,
+  0x4f65646f8bd50954ull, 0x4d5f56e97ec6b77bull, 0x4eebb3ee167e73a1ull,
+  0xf6e7924cc18ecb29ull, 0x99a96e405b192c0cull, 0x33a907df4900c594ull,
+  0xaee0f13d0cbccc04ull, 0x9286842dd4b4429cull, 0x24cab6e0e519c284ull,
+  0x1a82ca30e9e58f8cull, 0x5ab736b9aaa6a3e1ull, 0x519ee3935ff78bd3ull,
+  0x932070144c2e0134ull, 0x2d0f6898cb56244bull, 0x703925df2ebbd51bull,
+  0x02218566d15d5c8full, 0xe972e6e698857efaull, 0xbdde9d6ec80cfcf8ull,
+  0x4d9ae56152b31562ull, 0xe7e3e8924386557full, 0x7e83e0221c3e97eeull,
+  0x0a7745e734b49fb5ull, 0x7e8a675381d8d974ull, 0x526623700a34c46bull,
+  0x1edb05d9cbc6d391ull, 0xdf84524331bf2932ull, 0xb3e4bcdf8af529ceull,
+  0xf6c5e76ff0b61de4ull, 0xb5f13d0bec937960ull, 0x565d25a6fd64bd11ull,
+  0x668a1e3125315846ull, 0xee3c7f20f0a00252ull, 0x94579d2973aa5547ull,
+  0xb2ca96443f787853ull, 0x27c280088d5ac227ull, 0xbce8de3e2e05ee19ull,
+  0x639fa6339400fdd9ull, 0x388f8a5ca9969136ull, 0x54cb3c661ccfafa5ull,
+  0xc55392e49bdfd5c7ull, 0x956ceb7b12ba9d94ull, 0x51367a0bafac9228ull,
+  0xf9cdce1fa6ec9c0full, 0xdee0480d7524f358ull, 0xe34ddbeeb374e078ull,
+  0x7dacc0a8cf4ba72dull, 0xcc0997d12ddaeb02ull, 0x4974643462dae88bull,
+  0x73b791832a0cbe6cull, 0x1310528b776fffd0ull, 0xa05f49856fb8379full,
+  0x065d08ec63b063c1ull, 0x5dcf3aa89a8bab31ull, 0x823b6eac9a1f7627ull,
+  0x4275b05b928e608full, 0x42c43096fe3ed11bull, 0xe373def7f2b3e714ull,
+  0x4855f251368b5711ull, 0x825d732d4705d3bfull, 0xe088361df550a4ddull,
+  0x985d91813b88002aull, 0x1218064a5e2654b6ull, 0x4b6fc35f005f4fc6ull,
+  0xa74f5a074be4b8e0ull, 0x27f068494faed1e3ull, 0x3732a35cbbc6c569ull,
+  0x4b5c17af4692b6f1ull, 0xc37953a6468bd7b6ull, 0x4c8527ad72fc9c15ull,
+  0x4ab7406824e28a6full, 0x8a796bcde04cfc09ull, 0x711241d1461ab328ull,
+  0x69367415a37ac895ull, 0x45c6b4cdf6de7cdfull, 0x82670df6708acfeeull,
+  0x3f05932738a8236full, 0x2032b2ebdcbc895aull, 0x6db023c7b05798daull,
+  0x3b11659bae6b9419ull, 0x7572ba12f1b939cbull, 0x794635b7771a94eeull,
+  0x58dac27fda589105ull, 0x6056059809a110f2ull, 0xffb8c5a515653a73ull,
+  0xe65e0bab300e30ebull, 0xe53f116588021e56ull, 0x9976d8fecdf1f356ull,
+  0xbadfd7c41022d395ull, 0x294934bc079ea7b3ull, 0x015f987883b814a8ull,
+  0x346abc3ac9a22abfull, 0x63d81832aeed4a9full, 0xc72fa8f94ef793d5ull,
+  0xb2c597313e49184bull, 0xb6ca6db7d55f5dabull, 0x499f6b61884f79c3ull,
+  0x933085886004591bull, 0x68f37bf5d641c638ull, 0xcd78b233169f7344ull,
+  0x0bbcd6d32d12cd72ull, 0xca1e5ff163a1c5eeull, 0x06aec38c412eff68ull,
+  0x6262e0299723b522ull, 0xf2bb2163f179a32bull, 0xf72f519a9f5eb90aull,
+  0x7697599afb4760c5ull, 0x9b3dd4c24824dc94ull, 0x8df1cb1f4f37dda6ull,
+  0x47a73f4038053755ull, 0x635d672546049055ull, 0x0df88d791c27075cull,
+  0x8d6e4b9fa374904aull, 0xa6ef0c2aa948c140ull, 0xb3ff54156a4b4d1full,
+  0xe6380ec3e1cb779cull, 0x601b9b34fae36a27ull, 0x88e5e102a80bfa21ull,
+  0xb4ec179627c9b6a4ull, 0x21d844ca0576c782ull, 0xed80980165075f48ull,
+  0x92cd65b7d8ac1a6bull, 0x589b25ef0f5d5587ull, 0xc57850a28a89bcd5ull,
+  0x1beb3c27ea162503ull, 0xad71cc55aa4d1f20ull, 0xa9c285540eac1794ull,
+  0x8002e4fe808e9bbaull, 0x8c3a4b07c47fb265ull, 0x802e20f01d2278fdull,
+  0xa67f31aa7fb8f184ull, 0xfab5a96399df7c4full, 0x26e5163e8f484ecdull,
+  0x4900906e89322a6aull, 0x007aaeed6e9aaf01ull, 0x7cf119723bc1463aull,
+  0x75fc85557f1835f2ull, 0x7aaba03487a5e05dull, 0x4de6d9ce7e84c8f5ull,
+  0x2da1251a6cb9e6d6ull, 0x436986f53c4cb86cull, 0x66ab19992ffb10a8ull,
+  0x6778a56436347ef9ull, 0xc7cc4c10744e3c39ull, 0xef0080b56a4c1c0cull,
+  0x8a33fb94d21a8fa2ull, 0xef27cc43b7fcdd47ull, 0x30159aca6b13aed6ull,
+  0x698ed5c8e4b58080ull, 0x8a8a8a42796324f4ull, 0x5988062514b55855ull,
+  0xcd86ecc994ee3e07ull, 0x7249c62bf42a8f7bull, 0x8fcde7d34ee679c8ull,
+  0xb201760a08c4d00bull, 0x2cef8c57546f651eull, 0xa337793782e041abull,
+  0xa62978afd601d014ull, 0x45b63fd36338a297ull, 0x91d8fa6af8dad502ull,
+  0x6ff73ffe0c91118eull, 0x2466c5be17d0d53bull, 0x6bd2c9d66bc99029ull,
+  0x7c3175735a0b8944ull, 0x4b9cabf15d091a25ull, 0xa2e813fd7df6b4b5ull,
+  0x406a5c66fd86390cull, 0x215303280fad7b65ull, 0xa0da64444a63f676ull,
+  0xcb71aac8ded4934cull, 0x434d5d29bd72d77bull, 0xf7468d55ad5f0addull,
+  0x88ba8012a492c08cull, 0xf19f3536eaf0e4c5ull, 0x2af210b388f51b5eull,
+  0x6f0b9a7abc24d4a4ull, 0xb2d425b970f01838ull, 0x604d29c4b6f368b7ull,
+  0xbbf1b5ba53ce392eull, 0x3144c67ed5386369ull, 0x19fc298151751ce5ull,
+  0xf492910ad2409d15ull, 0xff9672e70bcf5cebull, 0xc021d68252d8c127ull,
+  0x2db3d7dc9d5aeb50ull, 0x171e9e3b5e9697c4ull, 0x753d704bfeeaae54ull,
+  0xd0505c92796ecfe1ull, 0x828a239f0bcd3154ull, 0x8cd34b1b8c5d3cedull,
+  0x31dc6a92366a4018ull, 0x921acb162e459c02ull, 0xff743fd3d1c020a7ull,
+  0x5bc589a996e2f58aull, 0xf955659df623109eull, 0x421b27c8cd47aa71ull,
+  0x1f1db9f7fdb68549ull,
+};
+
+
+FastCdcDetector::FastCdcDetector(const uint64_t minimal_chunk_size,
+                                 const uint64_t average_chunk_size,
+                                 const uint64_t maximal_chunk_size)
+  : minimal_chunk_size_(minimal_chunk_size)
+  , average_chunk_size_(average_chunk_size)
+  , maximal_chunk_size_(maximal_chunk_size)
+  , mask_small_(0)
+  , mask_large_(0)
+  , gear_ptr_(0)
+  , fingerprint_(0)
+{
+  assert((average_chunk_size_ == 0) || (minimal_chunk_size_ > 0));
+  if (minimal_chunk_size_ == 0)
+    return;
+  assert(minimal_chunk_size_ >= kGearWindow);
+  assert(minimal_chunk_size_ < average_chunk_size_);
+  assert(average_chunk_size_ < maximal_chunk_size_);
+
+  // Since the minimal chunk size is skipped, the expected distance from the
+  // minimal chunk size to the cut mark needs to be the difference to the
+  // average chunk size
+  unsigned nbits = 0;
+  while ((uint64_t(2) << nbits) <= average_chunk_size_ - minimal_chunk_size_)
+    nbits++;
+  mask_small_ = MakeMask(nbits + 2);
+  mask_large_ = MakeMask((nbits > 2) ? nbits - 2 : 1);
+}
+
+
+/**
+ * A mask with the nbits most significant bits set.  These bits depend on the
+ * entire window of the gear hash.
+ */
+uint64_t FastCdcDetector::MakeMask(const unsigned nbits) {
+  if (nbits >= 64)
+    return ~uint64_t(0);
+  return ~uint64_t(0) << (64 - nbits);
+}
+
+
+/**
+ * Translates a position of the data stream into an offset in the current
+ * buffer, bounded by the buffer.
+ */
+uint64_t FastCdcDetector::ToInternal(
+  const uint64_t global_offset,
+  const uint64_t size) const
+{
+  if (global_offset <= offset())
+    return 0;
+  return std::min(global_offset - offset(), size);
+}
+
+
+/**
+ * Hashes the buffer from *pos to end and stops after the first byte whose
+ * fingerprint matches the mask.  Returns true if a cut mark was found, in
+ * which case *pos points to the byte after the cut mark.
+ */
+bool FastCdcDetector::Scan(
+  const unsigned char *data,
+  const uint64_t mask,
+  const uint64_t end,
+  uint64_t *pos)
+{
+  uint64_t i = *pos;
+  uint64_t fp = fingerprint_;
+  for (; i + kStride <= end; i += kStride) {
+    const uint64_t g0 = kGear[data[i]];
+    const uint64_t g1 = kGear[data[i + 1]];
+    const uint64_t g2 = kGear[data[i + 2]];
+    const uint64_t g3 = kGear[data[i + 3]];
+    const uint64_t g4 = kGear[data[i + 4]];
+    const uint64_t g5 = kGear[data[i + 5]];
+    const uint64_t g6 = kGear[data[i + 6]];
+    const uint64_t g7 = kGear[data[i + 7]];
+    // Contributions of pairs and quadruples of bytes, independent of fp
+    const uint64_t p01 = (g0 << 1) + g1;
+    const uint64_t p45 = (g4 << 1) + g5;
+    const uint64_t p0123 = (p01 << 2) + (g2 << 1) + g3;
+    const uint64_t p4567 = (p45 << 2) + (g6 << 1) + g7;
+    // Fingerprints after every byte of the stride
+    const uint64_t fp0 = (fp << 1) + g0;
+    const uint64_t fp1 = (fp << 2) + p01;
+    const uint64_t fp2 = (fp1 << 1) + g2;
+    const uint64_t fp3 = (fp << 4) + p0123;
+    const uint64_t fp4 = (fp3 << 1) + g4;
+    const uint64_t fp5 = (fp3 << 2) + p45;
+    const uint64_t fp6 = (fp5 << 1) + g6;
+    const uint64_t fp7 = (fp << 8) + ((p0123 << 4) + p4567);
+    const bool hit =
+      ((fp0 & mask) == 0) | ((fp1 & mask) == 0) | ((fp2 & mask) == 0) |
+      ((fp3 & mask) == 0) | ((fp4 & mask) == 0) | ((fp5 & mask) == 0) |
+      ((fp6 & mask) == 0) | ((fp7 & mask) == 0);
+    // Find the exact position below
+    if (hit)
+      break;
+    fp = fp7;
+  }
+
+  for (; i < end; ++i) {
+    fp = (fp << 1) + kGear[data[i]];
+    if ((fp & mask) == 0) {
+      fingerprint_ = fp;
+      *pos = i + 1;
+      return true;
+    }
+  }
+  fingerprint_ = fp;
+  *pos = i;
+  return false;
+}
+
+
+uint64_t FastCdcDetector::DoFindNextCutMark(BlockItem *buffer) {
+  assert(minimal_chunk_size_ > 0);
+  const unsigned char *data = buffer->data();
+  const uint64_t size = buffer->size();
+
+  // Continue hashing where the last buffer ended or warm up the fingerprint
+  // in the last bytes before the minimal chunk size
+  const uint64_t global_offset =
+    std::max(last_cut() + minimal_chunk_size_ - kGearWindow, gear_ptr_);
+  if (global_offset >= offset() + size)
+    return NoCut(global_offset);
+  uint64_t internal_offset = global_offset - offset();
+
+  // The byte before the minimal chunk size is the first one that can complete
+  // a cut mark
+  const uint64_t internal_check_begin =
+    ToInternal(last_cut() + minimal_chunk_size_ - 1, size);
+  for (; internal_offset < internal_check_begin; ++internal_offset)
+    fingerprint_ = (fingerprint_ << 1) + kGear[data[internal_offset]];
+
+  const uint64_t internal_average_end =
+    ToInternal(last_cut() + average_chunk_size_ - 1, size);
+  if (Scan(data, mask_small_, internal_average_end, &internal_offset))
+    return DoCut(internal_offset + offset());
+  const uint64_t max_cut = last_cut() + maximal_chunk_size_;
+  if (Scan(data, mask_large_, ToInternal(max_cut, size), &internal_offset))
+    return DoCut(internal_offset + offset());
+
+  // Hard cut if we reached the maximal chunk size, otherwise continue with the
+  // next buffer
+  if (internal_offset + offset() == max_cut)
+    return DoCut(max_cut);
+  return NoCut(internal_offset + offset());
+}
@@ -11,9 +11,24 @@
 #include <cstdlib>
 
 #include <algorithm>
+#include <string>
 
 class BlockItem;
 
+/**
+ * Content-defined chunking algorithms, selectable per repository.  The
+ * algorithm affects the cut marks and thus the deduplication of chunks
+ * between different versions of a file.
+ */
+enum ChunkingAlgorithms {
+  kChunkingXor32 = 0,
+  kChunkingFastCdc,
+  kChunkingUnknown,
+};
+
+ChunkingAlgorithms ParseChunkingAlgorithm(const std::string &algorithm_option);
+std::string ChunkingAlgorithmName(const ChunkingAlgorithms algorithm);
+
 /**
  * Abstract base class for a cutmark detector. This decides on which file
  * positions a File should be chunked.
@@ -22,6 +37,10 @@ class ChunkDetector {
  public:
   ChunkDetector() : last_cut_(0), offset_(0) {}
   virtual ~ChunkDetector() { }
+  static ChunkDetector *Create(const ChunkingAlgorithms algorithm,
+                               const uint64_t minimal_chunk_size,
+                               const uint64_t average_chunk_size,
+                               const uint64_t maximal_chunk_size);
   uint64_t FindNextCutMark(BlockItem *block);
 
   virtual bool MightFindChunks(uint64_t size) const = 0;
@@ -135,4 +154,80 @@ class Xor32Detector : public ChunkDetector {
   uint32_t xor32_;
 };
 
+
+/**
+ * Gear hash based chunking as described in the FastCDC paper [1].
+ *
+ * The gear hash is a rolling checksum that shifts the fingerprint by one bit
+ * for every byte and adds a random 64-bit value for the byte from a fixed
+ * table.  Hence, the fingerprint only depends on the last 64 bytes of the
+ * stream.  A cut mark is placed after a byte if the most significant bits of
+ * the fingerprint are all zero.  The minimal chunk size is skipped without
+ * hashing (except for the last 64 bytes that warm up the fingerprint).
+ *
+ * Chunk sizes are normalized: up to the average chunk size, the mask checks
+ * two more bits than for the nominal chunk size, after the average it checks
+ * two bits less.  That makes very small and very large chunks less likely.
+ *
+ * The boundary search processes the data in strides of kStride bytes.  Byte
+ * by byte, every fingerprint depends on the previous one.  Within a stride,
+ * the contributions of pairs and quadruples of bytes are combined first, so
+ * that all the fingerprints of the stride are only a few instructions away
+ * from the fingerprint before the stride.  The cut mark conditions of a stride
+ * are folded into a single branch; only a stride with a hit is rescanned byte
+ * by byte.
+ *
+ * [1]     "FastCDC: a Fast and Efficient Content-Defined Chunking Approach for
+ *          Data Deduplication", Wen Xia et al., USENIX ATC '16
+ */
+class FastCdcDetector : public ChunkDetector {
+  FRIEND_TEST(T_ChunkDetectors, FastCdcMasks);
+
+ public:
+  FastCdcDetector(const uint64_t minimal_chunk_size,
+                  const uint64_t average_chunk_size,
+                  const uint64_t maximal_chunk_size);
+
+  bool MightFindChunks(const uint64_t size) const {
+    return size > minimal_chunk_size_;
+  }
+
+ protected:
+  virtual uint64_t DoFindNextCutMark(BlockItem *buffer);
+
+  virtual uint64_t DoCut(const uint64_t offset) {
+    fingerprint_ = 0;
+    gear_ptr_ = offset;
+    return ChunkDetector::DoCut(offset);
+  }
+
+  virtual uint64_t NoCut(const uint64_t offset) {
+    gear_ptr_ = offset;
+    return ChunkDetector::NoCut(offset);
+  }
+
+ private:
+  // The fingerprint only depends on a window of the last 64 bytes
+  static const unsigned kGearWindow = 64;
+  static const unsigned kStride = 8;
+  static const uint64_t kGear[256];
+
+  static uint64_t MakeMask(const unsigned nbits);
+  bool Scan(const unsigned char *data, const uint64_t mask, const uint64_t end,
+            uint64_t *pos);
+  uint64_t ToInternal(const uint64_t global_offset, const uint64_t size) const;
+
+  const uint64_t minimal_chunk_size_;
+  const uint64_t average_chunk_size_;
+  const uint64_t maximal_chunk_size_;
+  /**
+   * Used for cut marks below and above the average chunk size
+   */
+  uint64_t mask_small_;
+  uint64_t mask_large_;
+
+  uint64_t gear_ptr_;
+  uint64_t fingerprint_;
+};
+
 #endif  // CVMFS_INGESTION_CHUNK_DETECTOR_H_
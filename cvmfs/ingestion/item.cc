@@ -23,15 +23,21 @@ FileItem::FileItem(
   shash::Algorithms hash_algorithm,
   shash::Suffix hash_suffix,
   bool may_have_chunks,
-  bool has_legacy_bulk_chunk)
+  bool has_legacy_bulk_chunk,
+  ChunkingAlgorithms chunking_algorithm)
   : source_(source)
   , compression_algorithm_(compression_algorithm)
   , hash_algorithm_(hash_algorithm)
   , hash_suffix_(hash_suffix)
   , has_legacy_bulk_chunk_(has_legacy_bulk_chunk)
+  , chunking_algorithm_(chunking_algorithm)
+  , min_chunk_size_(min_chunk_size)
+  , avg_chunk_size_(avg_chunk_size)
+  , max_chunk_size_(max_chunk_size)
   , size_(kSizeUnknown)
   , may_have_chunks_(may_have_chunks)
-  , chunk_detector_(min_chunk_size, avg_chunk_size, max_chunk_size)
+  , chunk_detector_(ChunkDetector::Create(chunking_algorithm, min_chunk_size,
+                                          avg_chunk_size, max_chunk_size))
   , bulk_hash_(hash_algorithm)
   , chunks_(1)
 {
@@ -42,7 +42,8 @@ class FileItem : SingleCopy {
     shash::Algorithms hash_algorithm = shash::kSha1,
     shash::Suffix hash_suffix = shash::kSuffixNone,
     bool may_have_chunks = true,
-    bool has_legacy_bulk_chunk = false);
+    bool has_legacy_bulk_chunk = false,
+    ChunkingAlgorithms chunking_algorithm = kChunkingXor32);
   ~FileItem();
 
   static FileItem *CreateQuitBeacon() {
@@ -56,16 +57,22 @@ class FileItem : SingleCopy {
 
   std::string path() { return source_->GetPath(); }
   uint64_t size() { return size_; }
-  Xor32Detector *chunk_detector() { return &chunk_detector_; }
+  ChunkDetector *chunk_detector() { return chunk_detector_.weak_ref(); }
   shash::Any bulk_hash() { return bulk_hash_; }
+  shash::Any content_hash() { return content_hash_; }
   zlib::Algorithms compression_algorithm() { return compression_algorithm_; }
   shash::Algorithms hash_algorithm() { return hash_algorithm_; }
   shash::Suffix hash_suffix() { return hash_suffix_; }
   bool may_have_chunks() { return may_have_chunks_; }
   bool has_legacy_bulk_chunk() { return has_legacy_bulk_chunk_; }
+  ChunkingAlgorithms chunking_algorithm() { return chunking_algorithm_; }
+  uint64_t min_chunk_size() { return min_chunk_size_; }
+  uint64_t avg_chunk_size() { return avg_chunk_size_; }
+  uint64_t max_chunk_size() { return max_chunk_size_; }
 
   void set_size(uint64_t val) { size_ = val; }
   void set_may_have_chunks(bool val) { may_have_chunks_ = val; }
+  void set_content_hash(const shash::Any &val) { content_hash_ = val; }
   void set_is_fully_chunked() { atomic_inc32(&is_fully_chunked_); }
   bool is_fully_chunked() { return atomic_read32(&is_fully_chunked_) != 0; }
   uint64_t nchunks_in_fly() { return atomic_read64(&nchunks_in_fly_); }
@@ -79,6 +86,7 @@ class FileItem : SingleCopy {
   }
   bool Close() { return source_->Close(); }
   bool GetSize(uint64_t *size) { return source_->GetSize(size); }
+  bool IsRealFile() { return source_->IsRealFile(); }
 
   // Called by ChunkItem constructor, decremented when a chunk is registered
   void IncNchunksInFly() { atomic_inc64(&nchunks_in_fly_); }
@@ -96,12 +104,21 @@ class FileItem : SingleCopy {
   const shash::Algorithms hash_algorithm_;
   const shash::Suffix hash_suffix_;
   const bool has_legacy_bulk_chunk_;
+  const ChunkingAlgorithms chunking_algorithm_;
+  const uint64_t min_chunk_size_;
+  const uint64_t avg_chunk_size_;
+  const uint64_t max_chunk_size_;
 
   uint64_t size_;
   bool may_have_chunks_;
 
-  Xor32Detector chunk_detector_;
+  UniquePtr<ChunkDetector> chunk_detector_;
   shash::Any bulk_hash_;
+  /**
+   * Hash of the uncompressed file content, only set if known content is
+   * skipped, see KnownContent
+   */
+  shash::Any content_hash_;
   FileChunkList chunks_;
   /**
    * Number of chunks created but not yet uploaded and registered
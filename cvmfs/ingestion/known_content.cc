@@ -0,0 +1,290 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "known_content.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+
+#include "ingestion/item.h"
+#include "logging.h"
+#include "upload_facility.h"
+#include "util/posix.h"
+#include "util/string.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+const char *KnownContent::kHeader = "cvmfs known content v2";
+
+namespace {
+
+/**
+ * HexPtr::IsValid() does not accept a trailing hash suffix
+ */
+bool IsValidSuffixedHash(const string &str) {
+  if (shash::HexPtr(str).IsValid())
+    return true;
+  if (str.length() < 2)
+    return false;
+  const string without_suffix = str.substr(0, str.length() - 1);
+  return shash::HexPtr(without_suffix).IsValid();
+}
+
+}  // anonymous namespace
+
+
+KnownContent::KnownContent(
+  const string &path,
+  upload::AbstractUploader *uploader)
+  : path_(path)
+  , uploader_(uploader)
+  , is_dirty_(false)
+{
+  atomic_init64(&n_hits_);
+  atomic_init64(&sz_hits_);
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+}
+
+
+KnownContent::~KnownContent() {
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * One line per file:
+ * <content hash> <compression> <may have chunks> <chunking algorithm>
+ * <min chunk size> <avg chunk size> <max chunk size> <bulk hash or -> <#chunks>
+ * followed by <hash> <offset> <size> for every chunk
+ */
+string KnownContent::PrintEntry(const shash::Any &content_hash,
+                                const Entry &entry)
+{
+  string result = content_hash.ToString() + " " +
+    StringifyInt(entry.compression_algorithm) + " " +
+    (entry.may_have_chunks ? "1" : "0") + " " +
+    StringifyInt(entry.chunking_algorithm) + " " +
+    StringifyInt(entry.min_chunk_size) + " " +
+    StringifyInt(entry.avg_chunk_size) + " " +
+    StringifyInt(entry.max_chunk_size) + " " +
+    (entry.bulk_hash.IsNull() ? "-" : entry.bulk_hash.ToString(true)) + " " +
+    StringifyInt(entry.chunks.size());
+  for (unsigned i = 0; i < entry.chunks.size(); ++i) {
+    result += " " + entry.chunks[i].content_hash().ToString(true) + " " +
+      StringifyInt(entry.chunks[i].offset()) + " " +
+      StringifyInt(entry.chunks[i].size());
+  }
+  return result;
+}
+
+
+bool KnownContent::ParseEntry(
+  const string &line,
+  shash::Any *content_hash,
+  Entry *entry)
+{
+  const vector<string> tokens = SplitString(line, ' ');
+  if (tokens.size() < 9)
+    return false;
+  const uint64_t nchunks = String2Uint64(tokens[8]);
+  if (tokens.size() != 9 + 3 * nchunks)
+    return false;
+
+  if (!shash::HexPtr(tokens[0]).IsValid())
+    return false;
+  *content_hash = shash::MkFromHexPtr(shash::HexPtr(tokens[0]));
+  entry->compression_algorithm =
+    static_cast<zlib::Algorithms>(String2Uint64(tokens[1]));
+  entry->may_have_chunks = (tokens[2] == "1");
+  entry->chunking_algorithm =
+    static_cast<ChunkingAlgorithms>(String2Uint64(tokens[3]));
+  entry->min_chunk_size = String2Uint64(tokens[4]);
+  entry->avg_chunk_size = String2Uint64(tokens[5]);
+  entry->max_chunk_size = String2Uint64(tokens[6]);
+  if (tokens[7] != "-") {
+    if (!IsValidSuffixedHash(tokens[7]))
+      return false;
+    entry->bulk_hash = shash::MkFromSuffixedHexPtr(shash::HexPtr(tokens[7]));
+  }
+  for (unsigned i = 0; i < nchunks; ++i) {
+    const string &hash = tokens[9 + 3 * i];
+    if (!IsValidSuffixedHash(hash))
+      return false;
+    entry->chunks.push_back(FileChunk(
+      shash::MkFromSuffixedHexPtr(shash::HexPtr(hash)),
+      String2Uint64(tokens[10 + 3 * i]),
+      String2Uint64(tokens[11 + 3 * i])));
+  }
+  return true;
+}
+
+
+/**
+ * A missing file is an empty index.  Lines that cannot be parsed are skipped.
+ */
+bool KnownContent::Load() {
+  FILE *f = fopen(path_.c_str(), "r");
+  if (f == NULL)
+    return errno == ENOENT;
+
+  string line;
+  if (!GetLineFile(f, &line) || (line != kHeader)) {
+    fclose(f);
+    LogCvmfs(kLogSpooler, kLogDebug | kLogSyslogWarn,
+             "ignoring known content index %s of unknown format",
+             path_.c_str());
+    return false;
+  }
+
+  MutexLockGuard lock_guard(&lock_);
+  unsigned nskipped = 0;
+  while (GetLineFile(f, &line)) {
+    shash::Any content_hash;
+    Entry entry;
+    if (!ParseEntry(line, &content_hash, &entry)) {
+      nskipped++;
+      continue;
+    }
+    entries_[content_hash] = entry;
+  }
+  fclose(f);
+  LogCvmfs(kLogSpooler, kLogVerboseMsg,
+           "loaded %lu entries from known content index %s (%u skipped)",
+           entries_.size(), path_.c_str(), nskipped);
+  return true;
+}
+
+
+/**
+ * Written to a temporary file first, so that an interrupted ingestion leaves
+ * the previous index intact.
+ */
+bool KnownContent::Save() {
+  MutexLockGuard lock_guard(&lock_);
+  if (!is_dirty_)
+    return true;
+
+  string content = string(kHeader) + "\n";
+  for (map<shash::Any, Entry>::const_iterator i = entries_.begin(),
+       iEnd = entries_.end(); i != iEnd; ++i)
+  {
+    content += PrintEntry(i->first, i->second) + "\n";
+  }
+  const string tmp_path = path_ + ".tmp";
+  if (!SafeWriteToFile(content, tmp_path, 0644))
+    return false;
+  if (rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  is_dirty_ = false;
+  LogCvmfs(kLogSpooler, kLogVerboseMsg,
+           "saved %lu entries to known content index %s, "
+           "%" PRId64 " files (%" PRId64 " bytes) skipped",
+           entries_.size(), path_.c_str(), n_hits(), sz_hits());
+  return true;
+}
+
+
+bool KnownContent::ObjectsExist(const Entry &entry) {
+  if (!entry.bulk_hash.IsNull() &&
+      !uploader_->Peek("data/" + entry.bulk_hash.MakePath()))
+  {
+    return false;
+  }
+  for (unsigned i = 0; i < entry.chunks.size(); ++i) {
+    if (!uploader_->Peek("data/" + entry.chunks[i].content_hash().MakePath()))
+      return false;
+  }
+  return true;
+}
+
+
+/**
+ * Returns true if the content was processed before with the same compression
+ * and chunking parameters as the given file item and if its objects exist.
+ */
+bool KnownContent::Lookup(
+  const shash::Any &content_hash,
+  FileItem *file_item,
+  Entry *entry)
+{
+  {
+    MutexLockGuard lock_guard(&lock_);
+    map<shash::Any, Entry>::const_iterator i = entries_.find(content_hash);
+    if (i == entries_.end())
+      return false;
+    *entry = i->second;
+  }
+
+  if (entry->compression_algorithm != file_item->compression_algorithm())
+    return false;
+  if (entry->may_have_chunks != file_item->may_have_chunks())
+    return false;
+  if (entry->may_have_chunks &&
+      ((entry->chunking_algorithm != file_item->chunking_algorithm()) ||
+       (entry->min_chunk_size != file_item->min_chunk_size()) ||
+       (entry->avg_chunk_size != file_item->avg_chunk_size()) ||
+       (entry->max_chunk_size != file_item->max_chunk_size())))
+  {
+    return false;
+  }
+  if (!entry->chunks.empty() &&
+      (entry->bulk_hash.IsNull() == file_item->has_legacy_bulk_chunk()))
+  {
+    return false;
+  }
+  if (entry->chunks.empty() && entry->bulk_hash.IsNull())
+    return false;
+
+  // Peek() is synchronous and can go over the network, don't hold the lock
+  if (!entry->is_confirmed) {
+    if (!ObjectsExist(*entry))
+      return false;
+    MutexLockGuard lock_guard(&lock_);
+    entries_[content_hash].is_confirmed = true;
+  }
+
+  atomic_inc64(&n_hits_);
+  atomic_xadd64(&sz_hits_, file_item->size());
+  return true;
+}
+
+
+/**
+ * Records the result of a processed file.  Replaces an existing entry, e.g. one
+ * whose objects have been garbage collected meanwhile.
+ */
+void KnownContent::Insert(const shash::Any &content_hash, FileItem *file_item)
+{
+  Entry entry;
+  entry.compression_algorithm = file_item->compression_algorithm();
+  entry.may_have_chunks = file_item->may_have_chunks();
+  entry.chunking_algorithm = file_item->chunking_algorithm();
+  entry.min_chunk_size = file_item->min_chunk_size();
+  entry.avg_chunk_size = file_item->avg_chunk_size();
+  entry.max_chunk_size = file_item->max_chunk_size();
+  entry.bulk_hash = file_item->bulk_hash();
+  FileChunkList *chunks = file_item->GetChunksPtr();
+  for (unsigned i = 0; i < chunks->size(); ++i)
+    entry.chunks.push_back(chunks->At(i));
+  entry.is_confirmed = true;
+
+  MutexLockGuard lock_guard(&lock_);
+  entries_[content_hash] = entry;
+  is_dirty_ = true;
+}
+
+
+uint64_t KnownContent::size() {
+  MutexLockGuard lock_guard(&lock_);
+  return entries_.size();
+}
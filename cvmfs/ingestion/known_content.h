@@ -0,0 +1,109 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#ifndef CVMFS_INGESTION_KNOWN_CONTENT_H_
+#define CVMFS_INGESTION_KNOWN_CONTENT_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "compression.h"
+#include "file_chunk.h"
+#include "hash.h"
+#include "ingestion/chunk_detector.h"
+#include "util/single_copy.h"
+
+class FileItem;
+
+namespace upload {
+class AbstractUploader;
+}
+
+/**
+ * Remembers how files were processed by the ingestion pipeline, keyed by the
+ * hash of their uncompressed content.  The read stage hashes a file before it
+ * enters the pipeline; if the content is known and all of its objects are
+ * still present in the backend storage, compression and upload are skipped and
+ * the file is registered with the known bulk hash and chunks.
+ *
+ * The catalogs only know the hashes of the compressed objects, so the index is
+ * built from the results of previous ingestions and kept in a local file.
+ * Entries can outlive their objects, e.g. after garbage collection.  Hence the
+ * objects of an entry are checked with AbstractUploader::Peek() on the first
+ * hit in a process.
+ */
+class KnownContent : SingleCopy {
+ public:
+  struct Entry {
+    Entry()
+      : compression_algorithm(zlib::kZlibDefault)
+      , may_have_chunks(false)
+      , chunking_algorithm(kChunkingXor32)
+      , min_chunk_size(0)
+      , avg_chunk_size(0)
+      , max_chunk_size(0)
+      , is_confirmed(false)
+    { }
+    zlib::Algorithms compression_algorithm;
+    bool may_have_chunks;
+    /**
+     * Chunking parameters, only compared if may_have_chunks is set
+     */
+    ChunkingAlgorithms chunking_algorithm;
+    uint64_t min_chunk_size;
+    uint64_t avg_chunk_size;
+    uint64_t max_chunk_size;
+    /**
+     * Null if the file has only partial chunks
+     */
+    shash::Any bulk_hash;
+    std::vector<FileChunk> chunks;
+    /**
+     * Set once the objects have been found in or uploaded to the backend
+     * storage by this process
+     */
+    bool is_confirmed;
+  };
+
+  KnownContent(const std::string &path, upload::AbstractUploader *uploader);
+  ~KnownContent();
+
+  bool Load();
+  bool Save();
+
+  bool Lookup(const shash::Any &content_hash, FileItem *file_item,
+              Entry *entry);
+  void Insert(const shash::Any &content_hash, FileItem *file_item);
+
+  uint64_t size();
+  uint64_t n_hits() { return atomic_read64(&n_hits_); }
+  uint64_t sz_hits() { return atomic_read64(&sz_hits_); }
+
+ private:
+  static const char *kHeader;
+
+  static std::string PrintEntry(const shash::Any &content_hash,
+                                const Entry &entry);
+  static bool ParseEntry(const std::string &line, shash::Any *content_hash,
+                         Entry *entry);
+  bool ObjectsExist(const Entry &entry);
+
+  std::string path_;
+  upload::AbstractUploader *uploader_;
+  std::map<shash::Any, Entry> entries_;
+  /**
+   * Set by Insert(), reset by Save()
+   */
+  bool is_dirty_;
+  atomic_int64 n_hits_;
+  atomic_int64 sz_hits_;
+  pthread_mutex_t lock_;
+};
+
+#endif  // CVMFS_INGESTION_KNOWN_CONTENT_H_
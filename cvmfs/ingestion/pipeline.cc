@@ -5,15 +5,22 @@
 #include "cvmfs_config.h"
 #include "pipeline.h"
 
+#include <inttypes.h>
+#include <pthread.h>
+
 #include <algorithm>
+#include <cassert>
 #include <cstdlib>
+#include <ctime>
 
+#include "ingestion/known_content.h"
 #include "ingestion/task_chunk.h"
 #include "ingestion/task_compress.h"
 #include "ingestion/task_hash.h"
 #include "ingestion/task_read.h"
 #include "ingestion/task_register.h"
 #include "ingestion/task_write.h"
+#include "logging.h"
 #include "platform.h"
 #include "upload_facility.h"
 #include "upload_spooler_definition.h"
@@ -22,6 +29,29 @@
 #include "util_concurrency.h"
 
 const uint64_t IngestionPipeline::kMaxPipelineMem = 1024 * 1024 * 1024;
+const char *IngestionPipeline::kStageNames[] =
+  {"read", "chunk", "compress", "hash", "write", "register"};
+
+
+IngestionPipeline::Counters::Counters(perf::StatisticsTemplate statistics) {
+  // The data and the catalog spooler share the statistics
+  for (unsigned i = 0; i < kNumStages; ++i) {
+    const std::string prefix = std::string("pipeline_") + kStageNames[i];
+    busy_ms[i] = statistics.RegisterOrLookupTemplated(prefix + "_busy_ms",
+      std::string("Time spent processing items in the ") + kStageNames[i] +
+      " stage");
+    slot_ms[i] = statistics.RegisterOrLookupTemplated(prefix + "_slot_ms",
+      std::string("Time available to the threads of the ") + kStageNames[i] +
+      " stage");
+    utilization[i] = statistics.RegisterOrLookupTemplated(
+      prefix + "_utilization",
+      std::string("Utilization of the ") + kStageNames[i] +
+      " stage in percent");
+  }
+  n_rebalances = statistics.RegisterOrLookupTemplated("pipeline_n_rebalances",
+    "Number of times processing threads moved between pipeline stages");
+}
+
 
 IngestionPipeline::IngestionPipeline(
   upload::AbstractUploader *uploader,
@@ -33,53 +63,94 @@ IngestionPipeline::IngestionPipeline(
   , minimal_chunk_size_(spooler_definition.min_file_chunk_size)
   , average_chunk_size_(spooler_definition.avg_file_chunk_size)
   , maximal_chunk_size_(spooler_definition.max_file_chunk_size)
+  , chunking_algorithm_(spooler_definition.chunking_algorithm)
   , spawned_(false)
   , uploader_(uploader)
   , tube_counter_(kMaxFilesInFlight)
+  , tube_input_(kMaxFilesInFlight, kTubeRing)
+  , adaptive_(spooler_definition.adaptive_pipeline)
+  , terminate_balancer_(false)
 {
-  unsigned nfork_base = std::max(1U, GetNumberOfCpuCores() / 8);
+  const unsigned num_cores = GetNumberOfCpuCores();
+  unsigned nfork_base = std::max(1U, num_cores / 8);
+
+  // Unless sized explicitly or adaptive, the stages get the traditional fixed
+  // number of threads.  Otherwise, the processing slots are split according to
+  // the default ratio of the stages.  Every stage keeps at least one slot.
+  unsigned slots_chunk = nfork_base * kNforkChunk;
+  unsigned slots_compress = nfork_base * kNforkCompress;
+  unsigned slots_hash = nfork_base * kNforkHash;
+  unsigned num_processing = slots_chunk + slots_compress + slots_hash;
+  if ((spooler_definition.num_processing_tasks > 0) || adaptive_) {
+    const unsigned nfork_processing =
+      kNforkChunk + kNforkCompress + kNforkHash;
+    num_processing = std::max(3U,
+      (spooler_definition.num_processing_tasks > 0) ?
+        spooler_definition.num_processing_tasks : num_cores);
+    slots_chunk =
+      std::max(1U, num_processing * kNforkChunk / nfork_processing);
+    slots_hash =
+      std::max(1U, num_processing * kNforkHash / nfork_processing);
+    slots_compress = std::max(1U, num_processing - slots_chunk - slots_hash);
+  }
+  const unsigned max_slots = num_processing - 2;
+
+  if (!spooler_definition.known_content_path.empty()) {
+    known_content_ =
+      new KnownContent(spooler_definition.known_content_path, uploader_);
+    if (!known_content_->Load()) {
+      LogCvmfs(kLogCvmfs, kLogStderr,
+               "Warning: failed to load known content index %s",
+               spooler_definition.known_content_path.c_str());
+    }
+  }
 
   for (unsigned i = 0; i < nfork_base * kNforkRegister; ++i) {
-    Tube<FileItem> *tube = new Tube<FileItem>();
+    Tube<FileItem> *tube = new Tube<FileItem>(kMaxFilesInFlight, kTubeRing);
     tubes_register_.TakeTube(tube);
     TaskRegister *task = new TaskRegister(tube, &tube_counter_);
     task->RegisterListener(&IngestionPipeline::OnFileProcessed, this);
+    task->set_known_content(known_content_.weak_ref());
     tasks_register_.TakeConsumer(task);
   }
   tubes_register_.Activate();
 
   for (unsigned i = 0; i < nfork_base * kNforkWrite; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+    Tube<BlockItem> *t = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_write_.TakeTube(t);
     tasks_write_.TakeConsumer(new TaskWrite(t, &tubes_register_, uploader_));
   }
   tubes_write_.Activate();
 
-  for (unsigned i = 0; i < nfork_base * kNforkHash; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  for (unsigned i = 0; i < (adaptive_ ? max_slots : slots_hash); ++i) {
+    Tube<BlockItem> *t = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_hash_.TakeTube(t);
     tasks_hash_.TakeConsumer(new TaskHash(t, &tubes_write_));
   }
   tubes_hash_.Activate();
+  tasks_hash_.SetMaxActive(slots_hash);
 
-  for (unsigned i = 0; i < nfork_base * kNforkCompress; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  for (unsigned i = 0; i < (adaptive_ ? max_slots : slots_compress); ++i) {
+    Tube<BlockItem> *t = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_compress_.TakeTube(t);
     tasks_compress_.TakeConsumer(
       new TaskCompress(t, &tubes_hash_, &item_allocator_));
   }
   tubes_compress_.Activate();
+  tasks_compress_.SetMaxActive(slots_compress);
 
-  for (unsigned i = 0; i < nfork_base * kNforkChunk; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+  for (unsigned i = 0; i < (adaptive_ ? max_slots : slots_chunk); ++i) {
+    Tube<BlockItem> *t = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_chunk_.TakeTube(t);
     tasks_chunk_.TakeConsumer(
       new TaskChunk(t, &tubes_compress_, &item_allocator_));
   }
   tubes_chunk_.Activate();
+  tasks_chunk_.SetMaxActive(slots_chunk);
 
-  uint64_t high = kMaxPipelineMem;
-  high = std::min(high, platform_memsize() / 5);
+  uint64_t high = spooler_definition.max_pipeline_mem;
+  if (high == 0)
+    high = std::min(kMaxPipelineMem, platform_memsize() / 5);
   char *fixed_limit_mb = getenv("_CVMFS_SERVER_PIPELINE_MB");
   if (fixed_limit_mb != NULL) {
     high = String2Uint64(fixed_limit_mb) * 1024 * 1024;
@@ -88,16 +159,40 @@ IngestionPipeline::IngestionPipeline(
   LogCvmfs(kLogCvmfs, kLogDebug,
            "pipeline memory thresholds %" PRIu64 "/%" PRIu64 " M",
            low / (1024 * 1024), high / (1024 * 1024));
-  for (unsigned i = 0; i < nfork_base * kNforkRead; ++i) {
+  const unsigned num_read = (spooler_definition.num_read_tasks > 0) ?
+    spooler_definition.num_read_tasks : nfork_base * kNforkRead;
+  for (unsigned i = 0; i < num_read; ++i) {
     TaskRead *task_read =
       new TaskRead(&tube_input_, &tubes_chunk_, &item_allocator_);
     task_read->SetWatermarks(low, high);
+    if (known_content_.IsValid())
+      task_read->SetKnownContent(known_content_.weak_ref(), &tubes_register_);
     tasks_read_.TakeConsumer(task_read);
   }
+  LogCvmfs(kLogCvmfs, kLogDebug,
+           "pipeline: %u read threads, %u processing slots "
+           "(chunk %u, compress %u, hash %u), adaptive: %s",
+           num_read, num_processing, slots_chunk, slots_compress, slots_hash,
+           adaptive_ ? "yes" : "no");
+
+  for (unsigned i = 0; i < kNumStages; ++i)
+    busy_ns_[i] = 0;
+  int retval = pthread_mutex_init(&lock_balancer_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_balancer_, NULL);
+  assert(retval == 0);
 }
 
 
 IngestionPipeline::~IngestionPipeline() {
+  if (spawned_ && (adaptive_ || counters_.IsValid())) {
+    {
+      MutexLockGuard guard(&lock_balancer_);
+      terminate_balancer_ = true;
+      pthread_cond_signal(&cond_balancer_);
+    }
+    pthread_join(thread_balancer_, NULL);
+  }
   if (spawned_) {
     tasks_read_.Terminate();
     tasks_chunk_.Terminate();
@@ -106,6 +201,14 @@ IngestionPipeline::~IngestionPipeline() {
     tasks_write_.Terminate();
     tasks_register_.Terminate();
   }
+  pthread_cond_destroy(&cond_balancer_);
+  pthread_mutex_destroy(&lock_balancer_);
+}
+
+
+void IngestionPipeline::InitCounters(perf::StatisticsTemplate *statistics) {
+  assert(!spawned_);
+  counters_ = new Counters(*statistics);
 }
 
 
@@ -130,7 +233,8 @@ void IngestionPipeline::Process(
     hash_algorithm_,
     hash_suffix,
     allow_chunking && chunking_enabled_,
-    generate_legacy_bulk_chunks_);
+    generate_legacy_bulk_chunks_,
+    chunking_algorithm_);
   tube_counter_.EnqueueBack(file_item);
   tube_input_.EnqueueBack(file_item);
 }
@@ -143,12 +247,216 @@ void IngestionPipeline::Spawn() {
   tasks_compress_.Spawn();
   tasks_chunk_.Spawn();
   tasks_read_.Spawn();
+  if (adaptive_ || counters_.IsValid()) {
+    int retval =
+      pthread_create(&thread_balancer_, NULL, MainBalancer, this);
+    assert(retval == 0);
+  }
   spawned_ = true;
 }
 
 
+/**
+ * Also stores the known content index, so that it covers the files processed
+ * so far.
+ */
 void IngestionPipeline::WaitFor() {
   tube_counter_.Wait();
+  if (known_content_.IsValid() && !known_content_->Save()) {
+    LogCvmfs(kLogCvmfs, kLogStderr,
+             "Warning: failed to store known content index");
+  }
+}
+
+
+/**
+ * Decides on moving processing slots from an idle stage to a saturated stage
+ * with pending items.  Returns the number of slots to move from loads[donor]
+ * to loads[receiver], zero if the load is balanced.
+ */
+unsigned IngestionPipeline::Rebalance(
+  const std::vector<StageLoad> &loads,
+  unsigned *donor,
+  unsigned *receiver)
+{
+  int idx_receiver = -1;
+  for (unsigned i = 0; i < loads.size(); ++i) {
+    if ((loads[i].backlog == 0) ||
+        (loads[i].num_slots >= loads[i].max_slots) ||
+        (loads[i].utilization * 100.0 < kUtilizationHigh))
+    {
+      continue;
+    }
+    if ((idx_receiver < 0) ||
+        (loads[i].utilization > loads[idx_receiver].utilization))
+    {
+      idx_receiver = i;
+    }
+  }
+  if (idx_receiver < 0)
+    return 0;
+
+  int idx_donor = -1;
+  for (unsigned i = 0; i < loads.size(); ++i) {
+    if ((static_cast<int>(i) == idx_receiver) ||
+        (loads[i].num_slots <= 1) ||
+        (loads[i].utilization * 100.0 >= kUtilizationLow))
+    {
+      continue;
+    }
+    if ((idx_donor < 0) ||
+        (loads[i].utilization < loads[idx_donor].utilization))
+    {
+      idx_donor = i;
+    }
+  }
+  if (idx_donor < 0)
+    return 0;
+
+  // Hand over half of the idle slots, such that the stages converge without
+  // oscillating
+  const StageLoad &from = loads[idx_donor];
+  const StageLoad &to = loads[idx_receiver];
+  const double idle = from.num_slots * (1.0 - from.utilization);
+  unsigned amount = std::max(1U, static_cast<unsigned>(idle / 2.0));
+  amount = std::min(amount, from.num_slots - 1);
+  amount = std::min(amount, to.max_slots - to.num_slots);
+  *donor = idx_donor;
+  *receiver = idx_receiver;
+  return amount;
+}
+
+
+void IngestionPipeline::GetStageLoad(
+  const Stage stage,
+  uint64_t *busy_ns,
+  StageLoad *load)
+{
+  switch (stage) {
+    case kStageRead:
+      *busy_ns = tasks_read_.GetBusyNs();
+      load->num_slots = load->max_slots = tasks_read_.max_active();
+      load->backlog = tube_input_.size();
+      break;
+    case kStageChunk:
+      *busy_ns = tasks_chunk_.GetBusyNs();
+      load->num_slots = tasks_chunk_.max_active();
+      load->max_slots = tasks_chunk_.num_consumers();
+      load->backlog = tubes_chunk_.size();
+      break;
+    case kStageCompress:
+      *busy_ns = tasks_compress_.GetBusyNs();
+      load->num_slots = tasks_compress_.max_active();
+      load->max_slots = tasks_compress_.num_consumers();
+      load->backlog = tubes_compress_.size();
+      break;
+    case kStageHash:
+      *busy_ns = tasks_hash_.GetBusyNs();
+      load->num_slots = tasks_hash_.max_active();
+      load->max_slots = tasks_hash_.num_consumers();
+      load->backlog = tubes_hash_.size();
+      break;
+    case kStageWrite:
+      *busy_ns = tasks_write_.GetBusyNs();
+      load->num_slots = load->max_slots = tasks_write_.max_active();
+      load->backlog = tubes_write_.size();
+      break;
+    case kStageRegister:
+      *busy_ns = tasks_register_.GetBusyNs();
+      load->num_slots = load->max_slots = tasks_register_.max_active();
+      load->backlog = tubes_register_.size();
+      break;
+    default:
+      PANIC(NULL);
+  }
+}
+
+
+void IngestionPipeline::SetSlots(const Stage stage, const unsigned num_slots) {
+  switch (stage) {
+    case kStageChunk:
+      tasks_chunk_.SetMaxActive(num_slots);
+      break;
+    case kStageCompress:
+      tasks_compress_.SetMaxActive(num_slots);
+      break;
+    case kStageHash:
+      tasks_hash_.SetMaxActive(num_slots);
+      break;
+    default:
+      PANIC(NULL);
+  }
+}
+
+
+/**
+ * Samples the stages, updates the counters, and moves processing slots if the
+ * pipeline is adaptive.  Only the CPU bound stages take part in rebalancing.
+ */
+void IngestionPipeline::Balance(const uint64_t interval_ns) {
+  std::vector<StageLoad> loads(kNumStages);
+  for (unsigned i = 0; i < kNumStages; ++i) {
+    uint64_t busy_ns;
+    GetStageLoad(static_cast<Stage>(i), &busy_ns, &loads[i]);
+    const uint64_t delta_ns = busy_ns - busy_ns_[i];
+    busy_ns_[i] = busy_ns;
+    const uint64_t slot_ns = loads[i].num_slots * interval_ns;
+    loads[i].utilization = (slot_ns > 0) ?
+      std::min(1.0, static_cast<double>(delta_ns) / slot_ns) : 0.0;
+
+    if (counters_.IsValid()) {
+      const int64_t busy_ms =
+        perf::Xadd(counters_->busy_ms[i], delta_ns / 1000000) +
+        delta_ns / 1000000;
+      const int64_t slot_ms =
+        perf::Xadd(counters_->slot_ms[i], slot_ns / 1000000) +
+        slot_ns / 1000000;
+      if (slot_ms > 0)
+        counters_->utilization[i]->Set(busy_ms * 100 / slot_ms);
+    }
+  }
+
+  if (!adaptive_)
+    return;
+  const std::vector<StageLoad> processing(loads.begin() + kStageChunk,
+                                          loads.begin() + kStageHash + 1);
+  unsigned donor;
+  unsigned receiver;
+  const unsigned amount = Rebalance(processing, &donor, &receiver);
+  if (amount == 0)
+    return;
+  const Stage stage_donor = static_cast<Stage>(kStageChunk + donor);
+  const Stage stage_receiver = static_cast<Stage>(kStageChunk + receiver);
+  // Shrink first so that the number of busy threads never exceeds the budget
+  SetSlots(stage_donor, processing[donor].num_slots - amount);
+  SetSlots(stage_receiver, processing[receiver].num_slots + amount);
+  LogCvmfs(kLogCvmfs, kLogDebug, "pipeline: move %u slots from %s to %s",
+           amount, kStageNames[stage_donor], kStageNames[stage_receiver]);
+  if (counters_.IsValid())
+    perf::Inc(counters_->n_rebalances);
+}
+
+
+void *IngestionPipeline::MainBalancer(void *data) {
+  IngestionPipeline *pipeline = reinterpret_cast<IngestionPipeline *>(data);
+  uint64_t last_ns = platform_monotonic_time_ns();
+
+  MutexLockGuard guard(&pipeline->lock_balancer_);
+  while (!pipeline->terminate_balancer_) {
+    const uint64_t deadline = platform_realtime_ns() +
+                              uint64_t(kRebalanceIntervalMs) * 1000000ull;
+    struct timespec timeout;
+    timeout.tv_sec = deadline / 1000000000ull;
+    timeout.tv_nsec = deadline % 1000000000ull;
+    pthread_cond_timedwait(&pipeline->cond_balancer_,
+                           &pipeline->lock_balancer_, &timeout);
+
+    const uint64_t now_ns = platform_monotonic_time_ns();
+    if (now_ns > last_ns)
+      pipeline->Balance(now_ns - last_ns);
+    last_ns = now_ns;
+  }
+  return NULL;
 }
 
 
@@ -189,12 +497,13 @@ void TaskScrubbingCallback::Process(BlockItem *block_item) {
 
 ScrubbingPipeline::ScrubbingPipeline()
   : spawned_(false)
+  , tube_input_(kMaxFilesInFlight, kTubeRing)
   , tube_counter_(kMaxFilesInFlight)
 {
   unsigned nfork_base = std::max(1U, GetNumberOfCpuCores() / 8);
 
   for (unsigned i = 0; i < nfork_base * kNforkScrubbingCallback; ++i) {
-    Tube<BlockItem> *tube = new Tube<BlockItem>();
+    Tube<BlockItem> *tube = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_scrubbing_callback_.TakeTube(tube);
     TaskScrubbingCallback *task =
       new TaskScrubbingCallback(tube, &tube_counter_);
@@ -204,14 +513,14 @@ ScrubbingPipeline::ScrubbingPipeline()
   tubes_scrubbing_callback_.Activate();
 
   for (unsigned i = 0; i < nfork_base * kNforkHash; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+    Tube<BlockItem> *t = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_hash_.TakeTube(t);
     tasks_hash_.TakeConsumer(new TaskHash(t, &tubes_scrubbing_callback_));
   }
   tubes_hash_.Activate();
 
   for (unsigned i = 0; i < nfork_base * kNforkChunk; ++i) {
-    Tube<BlockItem> *t = new Tube<BlockItem>();
+    Tube<BlockItem> *t = new Tube<BlockItem>(kMaxBlocksInTube, kTubeRing);
     tubes_chunk_.TakeTube(t);
     tasks_chunk_.TakeConsumer(
       new TaskChunk(t, &tubes_hash_, &item_allocator_));
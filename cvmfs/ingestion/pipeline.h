@@ -5,7 +5,11 @@
 #ifndef CVMFS_INGESTION_PIPELINE_H_
 #define CVMFS_INGESTION_PIPELINE_H_
 
+#include <pthread.h>
+#include <stdint.h>
+
 #include <string>
+#include <vector>
 
 #include "compression.h"
 #include "hash.h"
@@ -13,21 +17,64 @@
 #include "ingestion/item_mem.h"
 #include "ingestion/task.h"
 #include "ingestion/tube.h"
+#include "statistics.h"
 #include "upload_spooler_result.h"
+#include "util/pointer.h"
 #include "util_concurrency.h"
 
+class KnownContent;
+
 namespace upload {
 class AbstractUploader;
 struct SpoolerDefinition;
 }
 
+/**
+ * The stages of the pipeline are connected by tubes and run by groups of
+ * consumer threads.  The chunk, compress, and hash stages are CPU bound and
+ * share a number of processing slots.  A balancer thread periodically
+ * measures the utilization and the backlog of every stage and moves slots
+ * from idle stages to the bottleneck stage.  Every processing stage has
+ * enough threads to take over all but one slot of the other stages.
+ */
 class IngestionPipeline : public Observable<upload::SpoolerResult> {
  public:
+  enum Stage {
+    kStageRead = 0,
+    kStageChunk,
+    kStageCompress,
+    kStageHash,
+    kStageWrite,
+    kStageRegister,
+    kNumStages,
+  };
+
+  /**
+   * Load of a stage during one balancing interval
+   */
+  struct StageLoad {
+    StageLoad() : num_slots(0), max_slots(0), backlog(0), utilization(0.0) { }
+    /**
+     * Number of threads that may process items at the same time
+     */
+    unsigned num_slots;
+    unsigned max_slots;
+    /**
+     * Number of items waiting in the tubes of the stage
+     */
+    uint64_t backlog;
+    /**
+     * Busy time relative to the time available to the slots
+     */
+    double utilization;
+  };
+
   explicit IngestionPipeline(
     upload::AbstractUploader *uploader,
     const upload::SpoolerDefinition &spooler_definition);
   ~IngestionPipeline();
 
+  void InitCounters(perf::StatisticsTemplate *statistics);
   void Spawn();
   void Process(IngestionSource* source, bool allow_chunking,
                shash::Suffix hash_suffix = shash::kSuffixNone);
@@ -35,15 +82,49 @@ class IngestionPipeline : public Observable<upload::SpoolerResult> {
 
   void OnFileProcessed(const upload::SpoolerResult &spooler_result);
 
+  static unsigned Rebalance(const std::vector<StageLoad> &loads,
+                            unsigned *donor, unsigned *receiver);
+
  private:
+  /**
+   * Exported as publish statistics.  Utilization is the busy time of a stage
+   * relative to the time available to its slots, in percent.
+   */
+  struct Counters {
+    explicit Counters(perf::StatisticsTemplate statistics);
+    perf::Counter *busy_ms[kNumStages];
+    perf::Counter *slot_ms[kNumStages];
+    perf::Counter *utilization[kNumStages];
+    perf::Counter *n_rebalances;
+  };
+
+  static const char *kStageNames[];
   static const uint64_t kMaxPipelineMem;  // 1G
   static const unsigned kMaxFilesInFlight = 8000;
+  /**
+   * Tubes between the pipeline stages are bounded ring buffers.  Tubes with
+   * file items cannot overflow due to kMaxFilesInFlight, tubes with blocks
+   * push back on the upstream stages when full.
+   */
+  static const unsigned kMaxBlocksInTube = 8192;
   static const unsigned kNforkRegister = 1;
   static const unsigned kNforkWrite = 1;
   static const unsigned kNforkHash = 2;
   static const unsigned kNforkCompress = 4;
   static const unsigned kNforkChunk = 1;
   static const unsigned kNforkRead = 8;
+  static const unsigned kRebalanceIntervalMs = 1000;
+  /**
+   * Stages with a backlog above this utilization (in percent) receive slots
+   * from stages below the lower threshold.
+   */
+  static const unsigned kUtilizationHigh = 85;
+  static const unsigned kUtilizationLow = 50;
+
+  static void *MainBalancer(void *data);
+  void Balance(const uint64_t interval_ns);
+  void GetStageLoad(const Stage stage, uint64_t *busy_ns, StageLoad *load);
+  void SetSlots(const Stage stage, const unsigned num_slots);
 
   const zlib::Algorithms compression_algorithm_;
   const shash::Algorithms hash_algorithm_;
@@ -52,6 +133,7 @@ class IngestionPipeline : public Observable<upload::SpoolerResult> {
   const size_t minimal_chunk_size_;
   const size_t average_chunk_size_;
   const size_t maximal_chunk_size_;
+  const ChunkingAlgorithms chunking_algorithm_;
 
   bool spawned_;
   upload::AbstractUploader *uploader_;
@@ -77,6 +159,18 @@ class IngestionPipeline : public Observable<upload::SpoolerResult> {
   TubeConsumerGroup<FileItem> tasks_register_;
 
   ItemAllocator item_allocator_;
+  /**
+   * Only set if files with known content should bypass compression and upload
+   */
+  UniquePtr<KnownContent> known_content_;
+
+  const bool adaptive_;
+  UniquePtr<Counters> counters_;
+  uint64_t busy_ns_[kNumStages];
+  pthread_t thread_balancer_;
+  pthread_mutex_t lock_balancer_;
+  pthread_cond_t cond_balancer_;
+  bool terminate_balancer_;
 };  // class IngestionPipeline
 
 
@@ -125,6 +219,7 @@ class ScrubbingPipeline : public Observable<ScrubbingResult> {
   static const uint64_t kMemLowWatermark = 384 * 1024 * 1024;
   static const uint64_t kMemHighWatermark = 512 * 1024 * 1024;
   static const unsigned kMaxFilesInFlight = 8000;
+  static const unsigned kMaxBlocksInTube = 8192;
   static const unsigned kNforkScrubbingCallback = 1;
   static const unsigned kNforkHash = 2;
   static const unsigned kNforkChunk = 1;
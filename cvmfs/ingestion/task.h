@@ -6,12 +6,17 @@
 #define CVMFS_INGESTION_TASK_H_
 
 #include <pthread.h>
+#include <stdint.h>
 
+#include <algorithm>
 #include <cassert>
 #include <vector>
 
+#include "atomic.h"
 #include "ingestion/tube.h"
+#include "platform.h"
 #include "util/single_copy.h"
+#include "util_concurrency.h"
 
 /**
  * Forward declaration of TubeConsumerGroup so that it can be used as a friend
@@ -23,7 +28,10 @@ class TubeConsumerGroup;
 
 /**
  * Base class for threads that processes items from a tube one by one.  Concrete
- * implementations overwrite the Process() method.
+ * implementations overwrite the Process() method.  The time spent in Process()
+ * is accounted for in busy_ns_, except for the time blocked_ns_ that Process()
+ * spent waiting for downstream stages, e.g. on full output tubes.  Otherwise,
+ * the stage in front of a bottleneck would look saturated as well.
  */
 template <class ItemT>
 class TubeConsumer : SingleCopy {
@@ -33,11 +41,19 @@ class TubeConsumer : SingleCopy {
   virtual ~TubeConsumer() { }
 
  protected:
-  explicit TubeConsumer(Tube<ItemT> *tube) : tube_(tube) { }
+  explicit TubeConsumer(Tube<ItemT> *tube)
+    : tube_(tube), blocked_ns_(0), group_(NULL)
+  {
+    atomic_init64(&busy_ns_);
+  }
   virtual void Process(ItemT *item) = 0;
   virtual void OnTerminate() { }
 
   Tube<ItemT> *tube_;
+  /**
+   * Only used by the consumer's own thread, reset for every item
+   */
+  uint64_t blocked_ns_;
 
  private:
   static void *MainConsumer(void *data) {
@@ -50,29 +66,83 @@ class TubeConsumer : SingleCopy {
         delete item;
         break;
       }
+      consumer->group_->Acquire();
+      consumer->blocked_ns_ = 0;
+      const uint64_t start_ns = platform_monotonic_time_ns();
       consumer->Process(item);
+      const uint64_t elapsed_ns = platform_monotonic_time_ns() - start_ns;
+      atomic_xadd64(&consumer->busy_ns_,
+                    elapsed_ns - std::min(elapsed_ns, consumer->blocked_ns_));
+      consumer->group_->Release();
     }
     consumer->OnTerminate();
     return NULL;
   }
+
+  TubeConsumerGroup<ItemT> *group_;
+  atomic_int64 busy_ns_;
 };
 
 
+/**
+ * Runs every consumer in its own thread.  The number of consumers that process
+ * an item at the same time can be limited with SetMaxActive(), e.g. in order
+ * to shift CPU time between pipeline stages.  Consumers beyond the limit wait
+ * after taking an item from their tube, so that the limit should only be
+ * lowered if the consumers can wait without holding up other consumers.
+ */
 template <class ItemT>
 class TubeConsumerGroup : SingleCopy {
+  friend class TubeConsumer<ItemT>;
+
  public:
-  TubeConsumerGroup() : is_active_(false) { }
+  TubeConsumerGroup() : is_active_(false), num_parked_(0) {
+    atomic_init32(&max_active_);
+    atomic_write32(&max_active_, kUnlimited);
+    atomic_init32(&num_busy_);
+    int retval = pthread_mutex_init(&lock_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_slot_, NULL);
+    assert(retval == 0);
+  }
 
   ~TubeConsumerGroup() {
     for (unsigned i = 0; i < consumers_.size(); ++i)
       delete consumers_[i];
+    pthread_cond_destroy(&cond_slot_);
+    pthread_mutex_destroy(&lock_);
   }
 
   void TakeConsumer(TubeConsumer<ItemT> *consumer) {
     assert(!is_active_);
+    consumer->group_ = this;
     consumers_.push_back(consumer);
   }
 
+  void SetMaxActive(unsigned max_active) {
+    assert(max_active > 0);
+    MutexLockGuard lock_guard(&lock_);
+    atomic_write32(&max_active_, max_active);
+    pthread_cond_broadcast(&cond_slot_);
+  }
+
+  unsigned max_active() {
+    const int32_t max_active = atomic_read32(&max_active_);
+    return (max_active == kUnlimited) ? consumers_.size() : max_active;
+  }
+
+  /**
+   * Sum of the time the consumers spent processing items
+   */
+  uint64_t GetBusyNs() {
+    uint64_t result = 0;
+    for (unsigned i = 0; i < consumers_.size(); ++i)
+      result += atomic_read64(&consumers_[i]->busy_ns_);
+    return result;
+  }
+
+  unsigned num_consumers() { return consumers_.size(); }
+
   void Spawn() {
     assert(!is_active_);
     unsigned N = consumers_.size();
@@ -101,9 +171,47 @@ class TubeConsumerGroup : SingleCopy {
   bool is_active() { return is_active_; }
 
  private:
+  static const int32_t kUnlimited = 0x7fffffff;
+
+  /**
+   * Blocks while max_active_ consumers are processing items
+   */
+  void Acquire() {
+    while (true) {
+      const int32_t num_busy = atomic_read32(&num_busy_);
+      if (num_busy < atomic_read32(&max_active_)) {
+        if (atomic_cas32(&num_busy_, num_busy, num_busy + 1))
+          return;
+        continue;
+      }
+      MutexLockGuard lock_guard(&lock_);
+      atomic_inc32(&num_parked_);
+      while (atomic_read32(&num_busy_) >= atomic_read32(&max_active_))
+        pthread_cond_wait(&cond_slot_, &lock_);
+      atomic_dec32(&num_parked_);
+    }
+  }
+
+  void Release() {
+    atomic_dec32(&num_busy_);
+    if (atomic_read32(&num_parked_) > 0) {
+      MutexLockGuard lock_guard(&lock_);
+      pthread_cond_signal(&cond_slot_);
+    }
+  }
+
   bool is_active_;
   std::vector<TubeConsumer<ItemT> *> consumers_;
   std::vector<pthread_t> threads_;
+
+  atomic_int32 max_active_;
+  atomic_int32 num_busy_;
+  /**
+   * Number of consumers waiting for a free slot, modified under the lock
+   */
+  atomic_int32 num_parked_;
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_slot_;
 };
 
 #endif  // CVMFS_INGESTION_TASK_H_
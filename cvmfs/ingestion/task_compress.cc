@@ -49,7 +49,7 @@ void TaskCompress::Process(BlockItem *input_block) {
     output_block->set_size(output_block->size() + remaining_in_output);
 
     if (output_block->IsFull()) {
-      tubes_out_->Dispatch(output_block);
+      tubes_out_->Dispatch(output_block, &blocked_ns_);
       output_block = new BlockItem(tag, allocator_);
       output_block->SetFileItem(input_block->file_item());
       output_block->SetChunkItem(input_block->chunk_item());
@@ -62,7 +62,7 @@ void TaskCompress::Process(BlockItem *input_block) {
     input_block->chunk_item()->ReleaseCompressor();
 
     if (output_block->size() > 0)
-      tubes_out_->Dispatch(output_block);
+      tubes_out_->Dispatch(output_block, &blocked_ns_);
     else
       delete output_block;
     tag_map_.Erase(tag);
@@ -71,7 +71,7 @@ void TaskCompress::Process(BlockItem *input_block) {
     stop_block->MakeStop();
     stop_block->SetFileItem(input_block->file_item());
     stop_block->SetChunkItem(input_block->chunk_item());
-    tubes_out_->Dispatch(stop_block);
+    tubes_out_->Dispatch(stop_block, &blocked_ns_);
   }
 
   delete input_block;
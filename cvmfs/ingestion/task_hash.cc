@@ -5,6 +5,7 @@
 #include "cvmfs_config.h"
 #include "task_hash.h"
 
+#include <algorithm>
 #include <cstdlib>
 
 #include "hash.h"
@@ -12,20 +13,60 @@
 
 
 void TaskHash::Process(BlockItem *input_block) {
-  ChunkItem *chunk = input_block->chunk_item();
-  assert(chunk != NULL);
-
-  switch (input_block->type()) {
-    case BlockItem::kBlockData:
-      shash::Update(input_block->data(), input_block->size(),
-                    chunk->hash_ctx());
+  batch_.clear();
+  batch_.push_back(input_block);
+  while (batch_.size() < kMaxBatchSize) {
+    BlockItem *block = tube_->TryPopFront();
+    if (block == NULL)
       break;
-    case BlockItem::kBlockStop:
-      shash::Final(chunk->hash_ctx(), chunk->hash_ptr());
+    if (block->IsQuitBeacon()) {
+      // Leave it to the main loop of the consumer
+      tube_->EnqueueBack(block);
       break;
-    default:
-      PANIC(NULL);
+    }
+    batch_.push_back(block);
+  }
+
+  for (unsigned i = 0; i < batch_.size(); ++i) {
+    BlockItem *block = batch_[i];
+    ChunkItem *chunk = block->chunk_item();
+    assert(chunk != NULL);
+
+    // Updates of the same chunk must happen in order
+    if (std::find(pending_chunks_.begin(), pending_chunks_.end(), chunk) !=
+        pending_chunks_.end())
+    {
+      FlushUpdates();
+    }
+
+    switch (block->type()) {
+      case BlockItem::kBlockData:
+        pending_chunks_.push_back(chunk);
+        pending_buffers_.push_back(block->data());
+        pending_sizes_.push_back(block->size());
+        pending_contexts_.push_back(chunk->hash_ctx());
+        break;
+      case BlockItem::kBlockStop:
+        shash::Final(chunk->hash_ctx(), chunk->hash_ptr());
+        break;
+      default:
+        PANIC(NULL);
+    }
   }
+  FlushUpdates();
+
+  for (unsigned i = 0; i < batch_.size(); ++i)
+    tubes_out_->Dispatch(batch_[i], &blocked_ns_);
+}
+
 
-  tubes_out_->Dispatch(input_block);
+void TaskHash::FlushUpdates() {
+  if (pending_chunks_.empty())
+    return;
+  shash::UpdateMulti(pending_chunks_.size(), &pending_buffers_[0],
+                     &pending_sizes_[0], &pending_contexts_[0]);
+  pending_chunks_.clear();
+  pending_buffers_.clear();
+  pending_sizes_.clear();
+  pending_contexts_.clear();
 }
@@ -5,19 +5,46 @@
 #ifndef CVMFS_INGESTION_TASK_HASH_H_
 #define CVMFS_INGESTION_TASK_HASH_H_
 
+#include <vector>
+
+#include "hash.h"
 #include "ingestion/item.h"
 #include "ingestion/task.h"
 
+/**
+ * Besides the block handed to Process(), takes the blocks that are already
+ * waiting in the tube.  The data blocks of different chunks are then hashed
+ * together by shash::UpdateMulti(), which can process several SHA-1 streams
+ * in parallel.  The blocks are dispatched in the order they were taken.
+ */
 class TaskHash : public TubeConsumer<BlockItem> {
  public:
+  /**
+   * Maximum number of blocks processed in one go
+   */
+  static const unsigned kMaxBatchSize = 16;
+
   TaskHash(Tube<BlockItem> *tube_in, TubeGroup<BlockItem> *tubes_out)
-    : TubeConsumer<BlockItem>(tube_in), tubes_out_(tubes_out) { }
+    : TubeConsumer<BlockItem>(tube_in), tubes_out_(tubes_out)
+  {
+    batch_.reserve(kMaxBatchSize);
+  }
 
  protected:
   virtual void Process(BlockItem *input_block);
 
  private:
+  void FlushUpdates();
+
   TubeGroup<BlockItem> *tubes_out_;
+  std::vector<BlockItem *> batch_;
+  /**
+   * Data blocks of distinct chunks that are not yet hashed
+   */
+  std::vector<ChunkItem *> pending_chunks_;
+  std::vector<const unsigned char *> pending_buffers_;
+  std::vector<unsigned> pending_sizes_;
+  std::vector<shash::ContextPtr> pending_contexts_;
 };
 
 #endif  // CVMFS_INGESTION_TASK_HASH_H_
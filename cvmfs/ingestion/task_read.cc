@@ -4,13 +4,16 @@
 
 #include "ingestion/task_read.h"
 
+#include <alloca.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include <cstring>
+#include <vector>
 
 #include "backoff.h"
+#include "ingestion/known_content.h"
 #include "logging.h"
 #include "platform.h"
 #include "smalloc.h"
@@ -25,9 +28,11 @@ void TaskRead::Process(FileItem *item) {
   BackoffThrottle throttle(kThrottleInitMs, kThrottleMaxMs, kThrottleResetMs);
   if ((high_watermark_ > 0) && (BlockItem::managed_bytes() > high_watermark_)) {
     atomic_inc64(&n_block_);
+    const uint64_t start_ns = platform_monotonic_time_ns();
     do {
       throttle.Throttle();
     } while (BlockItem::managed_bytes() > low_watermark_);
+    blocked_ns_ += platform_monotonic_time_ns() - start_ns;
   }
 
   if (item->Open() == false) {
@@ -46,6 +51,13 @@ void TaskRead::Process(FileItem *item) {
 
   unsigned char *buffer[kBlockSize];
   uint64_t tag = atomic_xadd64(&tag_seq_, 1);
+  if ((known_content_ != NULL) &&
+      (item->hash_suffix() == shash::kSuffixNone) &&
+      ProcessKnownContent(item, tag, reinterpret_cast<unsigned char *>(buffer)))
+  {
+    return;
+  }
+
   ssize_t nbytes = -1;
   unsigned cnt = 0;
   do {
@@ -63,17 +75,121 @@ void TaskRead::Process(FileItem *item) {
       block_item->MakeDataCopy(reinterpret_cast<unsigned char *>(buffer),
                                nbytes);
     }
-    tubes_out_->Dispatch(block_item);
+    tubes_out_->Dispatch(block_item, &blocked_ns_);
 
     cnt++;
     if ((cnt % 32) == 0) {
       if ((high_watermark_ > 0) &&
           (BlockItem::managed_bytes() > high_watermark_))
       {
+        const uint64_t start_ns = platform_monotonic_time_ns();
         throttle.Throttle();
+        blocked_ns_ += platform_monotonic_time_ns() - start_ns;
+      }
+    }
+  } while (nbytes > 0);
+}
+
+
+/**
+ * Reads and hashes the file before it enters the pipeline.  If the content is
+ * known, the file is registered with the known chunks and true is returned.
+ * Otherwise, the blocks read so far are passed on and the caller continues to
+ * read the file from the current position.
+ *
+ * The held blocks count towards the managed bytes of the pipeline.  Once a
+ * file exceeds kMaxPrehashSize or the blocks would push the pipeline above its
+ * high watermark, the blocks are released and the rest of the file is only
+ * hashed.  On a miss, such a file is reopened and read from the beginning.
+ * Sources that cannot be reopened abandon the check and pass on their blocks.
+ */
+bool TaskRead::ProcessKnownContent(
+  FileItem *item,
+  uint64_t tag,
+  unsigned char *buffer)
+{
+  shash::ContextPtr context(item->hash_algorithm());
+  context.buffer = alloca(context.size);
+  shash::Init(context);
+
+  std::vector<BlockItem *> blocks;
+  uint64_t size_blocks = 0;
+  bool reread = false;
+  ssize_t nbytes;
+  do {
+    nbytes = item->Read(buffer, kBlockSize);
+    if (nbytes < 0) {
+      PANIC(kLogStderr, "failed to read %s (%d)", item->path().c_str(), errno);
+    }
+    shash::Update(buffer, nbytes, context);
+    if (reread || (nbytes == 0))
+      continue;
+
+    const bool is_over_watermark = (high_watermark_ > 0) &&
+      (BlockItem::managed_bytes() + nbytes > high_watermark_);
+    if ((size_blocks + nbytes > kMaxPrehashSize) || is_over_watermark) {
+      if (!item->IsRealFile()) {
+        for (unsigned i = 0; i < blocks.size(); ++i)
+          tubes_out_->Dispatch(blocks[i], &blocked_ns_);
+        BlockItem *block_item = new BlockItem(tag, allocator_);
+        block_item->SetFileItem(item);
+        block_item->MakeDataCopy(buffer, nbytes);
+        tubes_out_->Dispatch(block_item, &blocked_ns_);
+        return false;
       }
+      for (unsigned i = 0; i < blocks.size(); ++i)
+        delete blocks[i];
+      blocks.clear();
+      reread = true;
+      continue;
     }
+    BlockItem *block_item = new BlockItem(tag, allocator_);
+    block_item->SetFileItem(item);
+    block_item->MakeDataCopy(buffer, nbytes);
+    blocks.push_back(block_item);
+    size_blocks += nbytes;
   } while (nbytes > 0);
+
+  shash::Any content_hash(item->hash_algorithm());
+  shash::Final(context, &content_hash);
+  item->set_content_hash(content_hash);
+
+  KnownContent::Entry entry;
+  if (known_content_->Lookup(content_hash, item, &entry)) {
+    for (unsigned i = 0; i < blocks.size(); ++i)
+      delete blocks[i];
+    item->Close();
+    if (!entry.bulk_hash.IsNull()) {
+      item->IncNchunksInFly();
+      item->RegisterChunk(FileChunk(entry.bulk_hash, 0, item->size()));
+    }
+    for (unsigned i = 0; i < entry.chunks.size(); ++i) {
+      item->IncNchunksInFly();
+      item->RegisterChunk(entry.chunks[i]);
+    }
+    item->set_is_fully_chunked();
+    tubes_register_->DispatchAny(item, &blocked_ns_);
+    return true;
+  }
+
+  if (reread) {
+    item->Close();
+    if (item->Open() == false) {
+      PANIC(kLogStderr, "failed to open %s (%d)", item->path().c_str(), errno);
+    }
+  }
+  for (unsigned i = 0; i < blocks.size(); ++i)
+    tubes_out_->Dispatch(blocks[i], &blocked_ns_);
+  return false;
+}
+
+
+void TaskRead::SetKnownContent(
+  KnownContent *known_content,
+  TubeGroup<FileItem> *tubes_register)
+{
+  known_content_ = known_content;
+  tubes_register_ = tubes_register;
 }
 
 
@@ -8,12 +8,14 @@
 #include <stdint.h>
 
 #include "atomic.h"
+#include "hash.h"
 #include "ingestion/item.h"
 #include "ingestion/task.h"
 #include "ingestion/tube.h"
 #include "util/posix.h"
 
 class ItemAllocator;
+class KnownContent;
 
 class TaskRead : public TubeConsumer<FileItem> {
  public:
@@ -21,6 +23,12 @@ class TaskRead : public TubeConsumer<FileItem> {
   static const unsigned kThrottleMaxMs = 500;
   static const unsigned kThrottleResetMs = 2000;
   static const unsigned kBlockSize = kPageSize * 4;
+  /**
+   * Files up to this size are kept in memory while their content is checked
+   * against the known content, memory permitting.  Other files are read
+   * twice, unless their source cannot be read twice.
+   */
+  static const unsigned kMaxPrehashSize = 32 * 1024 * 1024;
 
   TaskRead(
     Tube<FileItem> *tube_in,
@@ -31,9 +39,17 @@ class TaskRead : public TubeConsumer<FileItem> {
     , allocator_(allocator)
     , low_watermark_(0)
     , high_watermark_(0)
+    , known_content_(NULL)
+    , tubes_register_(NULL)
   { atomic_init64(&n_block_); }
 
   void SetWatermarks(uint64_t low, uint64_t high);
+  /**
+   * Files whose content is known bypass the pipeline and are sent directly
+   * to the register stage
+   */
+  void SetKnownContent(KnownContent *known_content,
+                       TubeGroup<FileItem> *tubes_register);
 
   uint64_t n_block() { return atomic_read64(&n_block_); }
 
@@ -41,6 +57,9 @@ class TaskRead : public TubeConsumer<FileItem> {
   virtual void Process(FileItem *item);
 
  private:
+  bool ProcessKnownContent(FileItem *item, uint64_t tag,
+                           unsigned char *buffer);
+
   /**
    * Every new file increases the tag sequence counter that is used to annotate
    * BlockItems.
@@ -63,6 +82,8 @@ class TaskRead : public TubeConsumer<FileItem> {
    * Number of times reading was blocked on a high watermark.
    */
   atomic_int64 n_block_;
+  KnownContent *known_content_;
+  TubeGroup<FileItem> *tubes_register_;
 };
 
 #endif  // CVMFS_INGESTION_TASK_READ_H_
@@ -7,6 +7,7 @@
 
 #include <cassert>
 
+#include "ingestion/known_content.h"
 #include "logging.h"
 
 void TaskRegister::Process(FileItem *file_item) {
@@ -26,6 +27,9 @@ void TaskRegister::Process(FileItem *file_item) {
            file_item->bulk_hash().ToString().c_str(),
            file_item->hash_suffix());
 
+  if ((known_content_ != NULL) && !file_item->content_hash().IsNull())
+    known_content_->Insert(file_item->content_hash(), file_item);
+
   NotifyListeners(upload::SpoolerResult(0,
     file_item->path(),
     file_item->bulk_hash(),
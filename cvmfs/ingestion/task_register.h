@@ -11,6 +11,8 @@
 #include "upload_spooler_result.h"
 #include "util_concurrency.h"
 
+class KnownContent;
+
 /**
  * Runs the callback to register processed files in the file catalog.
  * Encapsulated in a task so that only a single thread operates on the file
@@ -25,13 +27,21 @@ class TaskRegister
                Tube<FileItem> *tube_counter)
     : TubeConsumer<FileItem>(tube_in)
     , tube_counter_(tube_counter)
+    , known_content_(NULL)
   { }
 
+  /**
+   * Processed files whose content hash was computed by the read stage are
+   * added to the known content
+   */
+  void set_known_content(KnownContent *val) { known_content_ = val; }
+
  protected:
   virtual void Process(FileItem *file_item);
 
  private:
   Tube<FileItem> *tube_counter_;
+  KnownContent *known_content_;
 };  // class TaskRegister
 
 #endif  // CVMFS_INGESTION_TASK_REGISTER_H_
@@ -39,7 +39,7 @@ void TaskWrite::OnChunkComplete(
   delete chunk_item;
 
   if (file_item->IsProcessed()) {
-    tubes_out_->DispatchAny(file_item);
+    tubes_out_->DispatchAny(file_item, &blocked_ns_);
   }
 }
 
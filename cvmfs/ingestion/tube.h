@@ -6,16 +6,263 @@
 #define CVMFS_INGESTION_TUBE_H_
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdint.h>
 
 #include <cassert>
 #include <vector>
 
 #include "atomic.h"
+#include "platform.h"
 #include "util/pointer.h"
 #include "util/single_copy.h"
 #include "util_concurrency.h"
 
+/**
+ * Storage of the items in a Tube, see below
+ */
+enum TubeStorage {
+  kTubeList = 0,
+  kTubeRing,
+};
+
+
+/**
+ * A bounded, lock-free multi-producer multi-consumer FIFO queue of pointers to
+ * ItemT, used as the storage of ring buffer tubes.  The ring of cells is
+ * preallocated; every cell carries a sequence number that tells producers and
+ * consumers whether the cell is free or populated in the current round.
+ * Enqueue and dequeue only need a compare-and-swap on the head or tail
+ * position, which live on separate cache lines.
+ *
+ * Threads that find the queue full or empty spin for a short while and then
+ * park on a condition variable.  The mutex is only taken when threads are
+ * parked, so that it stays off the fast path.
+ */
+template <class ItemT>
+class TubeRing : SingleCopy {
+ public:
+  /**
+   * The capacity is rounded up to the next power of two
+   */
+  explicit TubeRing(uint64_t capacity)
+    : mask_(0)
+    , cells_(NULL)
+    , num_parked_producers_(0)
+    , num_parked_consumers_(0)
+    , num_parked_waiters_(0)
+  {
+    assert(capacity > 0);
+    uint64_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    mask_ = size - 1;
+    cells_ = new Cell[size];
+    for (uint64_t i = 0; i < size; ++i) {
+      cells_[i].seq = i;
+      cells_[i].item = NULL;
+    }
+    atomic_init64(&head_);
+    atomic_init64(&tail_);
+
+    int retval = pthread_mutex_init(&lock_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_populated_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_capacious_, NULL);
+    assert(retval == 0);
+    retval = pthread_cond_init(&cond_empty_, NULL);
+    assert(retval == 0);
+  }
+
+  ~TubeRing() {
+    delete[] cells_;
+    pthread_cond_destroy(&cond_populated_);
+    pthread_cond_destroy(&cond_capacious_);
+    pthread_cond_destroy(&cond_empty_);
+    pthread_mutex_destroy(&lock_);
+  }
+
+  /**
+   * Returns false if the queue is full
+   */
+  bool TryEnqueue(ItemT *item) {
+    int64_t pos = atomic_read64(&head_);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const int64_t diff = atomic_read64(&cell->seq) - pos;
+      if (diff == 0) {
+        if (atomic_cas64(&head_, pos, pos + 1))
+          break;
+        pos = atomic_read64(&head_);
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = atomic_read64(&head_);
+      }
+    }
+    cell->item = item;
+    atomic_write64(&cell->seq, pos + 1);
+
+    if (num_parked_consumers_ > 0) {
+      MutexLockGuard lock_guard(&lock_);
+      pthread_cond_signal(&cond_populated_);
+    }
+    return true;
+  }
+
+  /**
+   * Returns NULL if the queue is empty
+   */
+  ItemT *TryDequeue() {
+    int64_t pos = atomic_read64(&tail_);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      const int64_t diff = atomic_read64(&cell->seq) - (pos + 1);
+      if (diff == 0) {
+        if (atomic_cas64(&tail_, pos, pos + 1))
+          break;
+        pos = atomic_read64(&tail_);
+      } else if (diff < 0) {
+        return NULL;
+      } else {
+        pos = atomic_read64(&tail_);
+      }
+    }
+    ItemT *item = cell->item;
+    atomic_write64(&cell->seq, pos + mask_ + 1);
+
+    if ((num_parked_producers_ > 0) || (num_parked_waiters_ > 0)) {
+      MutexLockGuard lock_guard(&lock_);
+      pthread_cond_signal(&cond_capacious_);
+      if (IsEmpty())
+        pthread_cond_broadcast(&cond_empty_);
+    }
+    return item;
+  }
+
+  /**
+   * Blocks while the queue is full.  If given, the time spent blocked is added
+   * to blocked_ns.
+   */
+  void Enqueue(ItemT *item, uint64_t *blocked_ns = NULL) {
+    assert(item != NULL);
+    if (TryEnqueue(item))
+      return;
+    const uint64_t start_ns =
+      (blocked_ns != NULL) ? platform_monotonic_time_ns() : 0;
+    for (unsigned spin = 0; !TryEnqueue(item); ++spin) {
+      Relax(spin);
+      if (spin < kNumSpins)
+        continue;
+      MutexLockGuard lock_guard(&lock_);
+      atomic_inc32(&num_parked_producers_);
+      while (size() > mask_)
+        pthread_cond_wait(&cond_capacious_, &lock_);
+      atomic_dec32(&num_parked_producers_);
+    }
+    if (blocked_ns != NULL)
+      *blocked_ns += platform_monotonic_time_ns() - start_ns;
+  }
+
+  /**
+   * Blocks while the queue is empty
+   */
+  ItemT *Dequeue() {
+    ItemT *item;
+    for (unsigned spin = 0; (item = TryDequeue()) == NULL; ++spin) {
+      Relax(spin);
+      if (spin < kNumSpins)
+        continue;
+      MutexLockGuard lock_guard(&lock_);
+      atomic_inc32(&num_parked_consumers_);
+      while (IsEmpty())
+        pthread_cond_wait(&cond_populated_, &lock_);
+      atomic_dec32(&num_parked_consumers_);
+    }
+    return item;
+  }
+
+  /**
+   * Blocks until the queue is empty
+   */
+  void Wait() {
+    MutexLockGuard lock_guard(&lock_);
+    atomic_inc32(&num_parked_waiters_);
+    while (!IsEmpty())
+      pthread_cond_wait(&cond_empty_, &lock_);
+    atomic_dec32(&num_parked_waiters_);
+  }
+
+  /**
+   * Items that are being enqueued or dequeued can be counted in or not
+   */
+  uint64_t size() {
+    const int64_t tail = atomic_read64(&tail_);
+    const int64_t head = atomic_read64(&head_);
+    return (head > tail) ? (head - tail) : 0;
+  }
+  bool IsEmpty() { return size() == 0; }
+  uint64_t capacity() const { return mask_ + 1; }
+
+ private:
+  /**
+   * Number of attempts before a thread parks on the condition variable
+   */
+  static const unsigned kNumSpins = 64;
+
+  struct Cell {
+    atomic_int64 seq;
+    ItemT *item;
+  };
+
+  /**
+   * Busy-wait for the first rounds, then give up the time slice.  The latter
+   * is necessary for progress if there are more threads than cores, e.g. when
+   * a thread is preempted between claiming a cell and publishing it.
+   */
+  static inline void Relax(const unsigned spin) {
+    if (spin < kNumSpins / 4) {
+#if defined(__i386__) || defined(__x86_64__)
+      __asm__ __volatile__("pause" : : : "memory");
+#endif
+      return;
+    }
+    sched_yield();
+  }
+
+  /**
+   * Keeps the producer and consumer positions on different cache lines from
+   * each other and from the surrounding data
+   */
+  char padding_head_[64];
+  atomic_int64 head_;
+  char padding_tail_[64];
+  atomic_int64 tail_;
+  char padding_cells_[64];
+  uint64_t mask_;
+  Cell *cells_;
+
+  /**
+   * Only used to park and wake up threads
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_populated_;
+  pthread_cond_t cond_capacious_;
+  pthread_cond_t cond_empty_;
+  /**
+   * Number of threads waiting on the condition variables.  Modified with the
+   * lock held and atomic operations, so that the lock-free paths can read them
+   * after their compare-and-swap without missing a parked thread.
+   */
+  atomic_int32 num_parked_producers_;
+  atomic_int32 num_parked_consumers_;
+  atomic_int32 num_parked_waiters_;
+};
+
+
 /**
  * A thread-safe, doubly linked list of links containing pointers to ItemT.  The
  * ItemT elements are not owned by the Tube.  FIFO or LIFO semantics.  Using
@@ -34,6 +281,11 @@
  *
  * Internally, uses conditional variables to block when threads try to pop from
  * the empty tube or insert into the full tube.
+ *
+ * Tubes that are only used as FIFO queues between pipeline stages can instead
+ * be backed by a TubeRing.  Such tubes don't allocate links and don't take a
+ * lock in the common case.  They are always bounded and do not support
+ * EnqueueFront(), PopBack(), and Slice().  EnqueueBack() returns NULL.
  */
 template <class ItemT>
 class Tube : SingleCopy {
@@ -54,6 +306,16 @@ class Tube : SingleCopy {
   explicit Tube(uint64_t limit) : limit_(limit), size_(0) {
     Init();
   }
+  /**
+   * For kTubeRing, the limit is rounded up to the next power of two
+   */
+  Tube(uint64_t limit, TubeStorage storage) : limit_(limit), size_(0) {
+    Init();
+    if (storage == kTubeRing) {
+      ring_ = new TubeRing<ItemT>(limit);
+      limit_ = ring_->capacity();
+    }
+  }
   ~Tube() {
     Link *cursor = head_;
     do {
@@ -69,12 +331,23 @@ class Tube : SingleCopy {
 
   /**
    * Push an item to the back of the queue.  Block if queue is currently full.
+   * If given, the time spent blocked is added to blocked_ns.
    */
-  Link *EnqueueBack(ItemT *item) {
+  Link *EnqueueBack(ItemT *item, uint64_t *blocked_ns = NULL) {
     assert(item != NULL);
+    if (ring_.IsValid()) {
+      ring_->Enqueue(item, blocked_ns);
+      return NULL;
+    }
     MutexLockGuard lock_guard(&lock_);
-    while (size_ == limit_)
-      pthread_cond_wait(&cond_capacious_, &lock_);
+    if (size_ == limit_) {
+      const uint64_t start_ns =
+        (blocked_ns != NULL) ? platform_monotonic_time_ns() : 0;
+      while (size_ == limit_)
+        pthread_cond_wait(&cond_capacious_, &lock_);
+      if (blocked_ns != NULL)
+        *blocked_ns += platform_monotonic_time_ns() - start_ns;
+    }
 
     Link *link = new Link(item);
     link->next_ = head_->next_;
@@ -92,6 +365,7 @@ class Tube : SingleCopy {
    */
   Link *EnqueueFront(ItemT *item) {
     assert(item != NULL);
+    assert(!ring_.IsValid());
     MutexLockGuard lock_guard(&lock_);
     while (size_ == limit_)
       pthread_cond_wait(&cond_capacious_, &lock_);
@@ -112,6 +386,7 @@ class Tube : SingleCopy {
    * element.
    */
   ItemT *Slice(Link *link) {
+    assert(!ring_.IsValid());
     MutexLockGuard lock_guard(&lock_);
     return SliceUnlocked(link);
   }
@@ -121,17 +396,32 @@ class Tube : SingleCopy {
    * empty.
    */
   ItemT *PopFront() {
+    if (ring_.IsValid())
+      return ring_->Dequeue();
     MutexLockGuard lock_guard(&lock_);
     while (size_ == 0)
       pthread_cond_wait(&cond_populated_, &lock_);
     return SliceUnlocked(head_->prev_);
   }
 
+  /**
+   * Like PopFront() but returns NULL instead of blocking if the tube is empty
+   */
+  ItemT *TryPopFront() {
+    if (ring_.IsValid())
+      return ring_->TryDequeue();
+    MutexLockGuard lock_guard(&lock_);
+    if (size_ == 0)
+      return NULL;
+    return SliceUnlocked(head_->prev_);
+  }
+
   /**
    * Remove and return the last element from the queue.  Block if tube is
    * empty.
    */
   ItemT *PopBack() {
+    assert(!ring_.IsValid());
     MutexLockGuard lock_guard(&lock_);
     while (size_ == 0)
       pthread_cond_wait(&cond_populated_, &lock_);
@@ -142,17 +432,25 @@ class Tube : SingleCopy {
    * Blocks until the tube is empty
    */
   void Wait() {
+    if (ring_.IsValid()) {
+      ring_->Wait();
+      return;
+    }
     MutexLockGuard lock_guard(&lock_);
     while (size_ > 0)
       pthread_cond_wait(&cond_empty_, &lock_);
   }
 
   bool IsEmpty() {
+    if (ring_.IsValid())
+      return ring_->IsEmpty();
     MutexLockGuard lock_guard(&lock_);
     return size_ == 0;
   }
 
   uint64_t size() {
+    if (ring_.IsValid())
+      return ring_->size();
     MutexLockGuard lock_guard(&lock_);
     return size_;
   }
@@ -219,6 +517,10 @@ class Tube : SingleCopy {
    * Signals if the queue runs empty
    */
   pthread_cond_t cond_empty_;
+  /**
+   * Replaces the linked list if set
+   */
+  UniquePtr<TubeRing<ItemT> > ring_;
 };
 
 
@@ -253,21 +555,35 @@ class TubeGroup : SingleCopy {
   /**
    * Like Tube::EnqueueBack(), but pick a tube according to ItemT::tag()
    */
-  typename Tube<ItemT>::Link *Dispatch(ItemT *item) {
+  typename Tube<ItemT>::Link *Dispatch(ItemT *item,
+                                       uint64_t *blocked_ns = NULL)
+  {
     assert(is_active_);
     unsigned tube_idx = (tubes_.size() == 1)
                         ? 0 : (item->tag() % tubes_.size());
-    return tubes_[tube_idx]->EnqueueBack(item);
+    return tubes_[tube_idx]->EnqueueBack(item, blocked_ns);
   }
 
   /**
    * Like Tube::EnqueueBack(), use tubes one after another
    */
-  typename Tube<ItemT>::Link *DispatchAny(ItemT *item) {
+  typename Tube<ItemT>::Link *DispatchAny(ItemT *item,
+                                          uint64_t *blocked_ns = NULL)
+  {
     assert(is_active_);
     unsigned tube_idx = (tubes_.size() == 1)
                         ? 0 : (atomic_xadd32(&round_robin_, 1) % tubes_.size());
-    return tubes_[tube_idx]->EnqueueBack(item);
+    return tubes_[tube_idx]->EnqueueBack(item, blocked_ns);
+  }
+
+  /**
+   * Number of items in all the tubes of the group
+   */
+  uint64_t size() {
+    uint64_t result = 0;
+    for (unsigned i = 0; i < tubes_.size(); ++i)
+      result += tubes_[i]->size();
+    return result;
   }
 
  private:
@@ -39,6 +39,7 @@
 // If defined the cache is secured by a posix mutex
 #define LRU_CACHE_THREAD_SAFE
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include <algorithm>
@@ -49,6 +50,7 @@
 #include <string>
 
 #include "atomic.h"
+#include "lru_admission.h"
 #include "platform.h"
 #include "smallhash.h"
 #include "smalloc.h"
@@ -515,7 +517,9 @@ class LruCache : SingleCopy {
     cache_gauge_(0),
     cache_size_(cache_size),
     allocator_(cache_size),
-    lru_list_(&allocator_)
+    lru_list_(&allocator_),
+    hasher_(hasher),
+    admission_policy_(NULL)
   {
     assert(cache_size > 0);
 
@@ -538,15 +542,27 @@ class LruCache : SingleCopy {
   }
 
   virtual ~LruCache() {
+    delete admission_policy_;
 #ifdef LRU_CACHE_THREAD_SAFE
     pthread_mutex_destroy(&lock_);
 #endif
   }
 
+  /**
+   * Installs a policy that decides if new entries can replace old ones once
+   * the cache is full.  Without a policy, all new entries are admitted.  Must
+   * be called before the cache is used.  The cache takes ownership.
+   */
+  void SetAdmissionPolicy(AdmissionPolicy *policy) {
+    delete admission_policy_;
+    admission_policy_ = policy;
+  }
+
   /**
    * Insert a new key-value pair to the list.
    * If the cache is already full, the least recently used object is removed;
-   * afterwards the new object is inserted.
+   * afterwards the new object is inserted.  An admission policy can prevent
+   * the replacement, in which case the new object is not inserted.
    * If the object is already present it is updated and moved back to the end
    * of the list
    * @param key the key where the value is saved
@@ -572,10 +588,18 @@ class LruCache : SingleCopy {
       return false;
     }
 
-    perf::Inc(counters_.n_insert);
     // Check if we have to make some space in the cache a
-    if (this->IsFull())
+    if (this->IsFull()) {
+      if (admission_policy_ && !admission_policy_->Admit(hasher_(key),
+            hasher_(static_cast<ConcreteListEntryContent *>(
+              lru_list_.next)->content())))
+      {
+        Unlock();
+        return false;
+      }
       this->DeleteOldest();
+    }
+    perf::Inc(counters_.n_insert);
 
     entry.list_entry = lru_list_.PushBack(key);
     entry.value = value;
@@ -642,6 +666,7 @@ class LruCache : SingleCopy {
     Lock();
     if (pause_) {
       Unlock();
+      RecordAccess(key, false);
       return false;
     }
 
@@ -658,6 +683,7 @@ class LruCache : SingleCopy {
     }
 
     Unlock();
+    RecordAccess(key, found);
     return found;
   }
 
@@ -817,6 +843,15 @@ class LruCache : SingleCopy {
     lru_list_.MoveToBack(entry.list_entry);
   }
 
+  /**
+   * Reports a lookup to the admission policy, if any.  Called without the
+   * cache lock.
+   */
+  inline void RecordAccess(const Key &key, const bool hit) {
+    if (admission_policy_)
+      admission_policy_->RecordAccess(hasher_(key), hit);
+  }
+
   /**
    * Deletes the least recently used entry from the cache.
    */
@@ -866,11 +901,600 @@ class LruCache : SingleCopy {
   SmallHashFixed<Key, CacheEntry> cache_;
 
   ListEntry<Key> *filter_entry_;
+  uint32_t (*hasher_)(const Key &key);
+  AdmissionPolicy *admission_policy_;
 #ifdef LRU_CACHE_THREAD_SAFE
   pthread_mutex_t lock_;  /**< Mutex to make cache thread safe. */
 #endif
 };  // class LruCache
 
+
+/**
+ * Replacement policy of the ShardedLruCache
+ */
+enum RecencyMode {
+  kRecencyLru = 0,  ///< Exact LRU order
+  kRecencyClock     ///< Approximate LRU order (CLOCK), cheaper hits
+};
+
+
+/**
+ * Variant of the LruCache for caches that are used concurrently by many
+ * threads, such as the meta-data caches of the Fuse module.  The entries are
+ * partitioned by their key hash into shards.  Every shard has its own
+ * read-write lock, hash table and LRU list, so threads working on different
+ * shards don't contend.  The cache size is split evenly among the shards and
+ * the replacement policy applies per shard.
+ *
+ * With kRecencyLru, a hit moves the entry to the back of the shard's LRU list
+ * under the write lock, like in the LruCache.  With kRecencyClock, a hit only
+ * sets a reference bit under the read lock.  On replacement, referenced
+ * entries at the front of the list get a second chance (CLOCK).  Concurrent
+ * hits in the same shard then proceed in parallel.
+ *
+ * The interface is the one of the LruCache.  The Filter* functions lock all
+ * the shards and visit them one after another.
+ */
+template<class Key, class Value>
+class ShardedLruCache : SingleCopy {
+ public:
+  static const unsigned kMaxShards = 64;
+
+ private:
+  static const uint32_t kNil = uint32_t(-1);
+
+  /**
+   * Position in the doubly linked LRU list of a shard.  The list is threaded
+   * through an array of slots, so that it needs no further allocations.
+   */
+  struct Slot {
+    Slot() : prev(kNil), next(kNil), referenced(0) { }
+    Key key;
+    uint32_t prev;
+    uint32_t next;
+    atomic_int32 referenced;  /**< Set by hits in kRecencyClock mode */
+  };
+
+  struct CacheEntry {
+    uint32_t slot;
+    Value value;
+  };
+
+  class Shard : SingleCopy {
+   public:
+    Shard() : pause(false), gauge(0), capacity(0), slots(NULL),
+              free_head(kNil)
+    {
+      int retval = pthread_rwlock_init(&lock, NULL);
+      assert(retval == 0);
+    }
+
+    ~Shard() {
+      delete[] slots;
+      pthread_rwlock_destroy(&lock);
+    }
+
+    void Init(const uint32_t shard_capacity,
+              const Key &empty_key,
+              uint32_t (*hasher)(const Key &key))
+    {
+      capacity = shard_capacity;
+      // The slot at index capacity is the list head
+      slots = new Slot[capacity + 1];
+      cache.Init(capacity, empty_key, hasher);
+      Reset();
+    }
+
+    void Reset() {
+      slots[capacity].prev = slots[capacity].next = capacity;
+      for (uint32_t i = 0; i < capacity; ++i) {
+        slots[i].prev = kNil;
+        slots[i].next = (i + 1 < capacity) ? i + 1 : kNil;
+        atomic_write32(&slots[i].referenced, 0);
+      }
+      free_head = (capacity > 0) ? 0 : kNil;
+      gauge = 0;
+    }
+
+    inline uint32_t head() const { return capacity; }
+    inline bool IsFull() const { return gauge >= capacity; }
+
+    inline uint32_t PushBack(const Key &key) {
+      assert(free_head != kNil);
+      const uint32_t s = free_head;
+      free_head = slots[s].next;
+      slots[s].key = key;
+      atomic_write32(&slots[s].referenced, 0);
+      Link(s);
+      gauge++;
+      return s;
+    }
+
+    inline void Remove(const uint32_t s) {
+      Unlink(s);
+      slots[s].next = free_head;
+      free_head = s;
+      gauge--;
+    }
+
+    inline void MoveToBack(const uint32_t s) {
+      Unlink(s);
+      Link(s);
+    }
+
+    pthread_rwlock_t lock;
+    bool pause;
+    uint32_t gauge;
+    uint32_t capacity;
+    Slot *slots;
+    uint32_t free_head;  /**< Unused slots, chained by their next index */
+    SmallHashFixed<Key, CacheEntry> cache;
+    /**
+     * Keeps the locks of neighboring shards on different cache lines
+     */
+    char padding[64];
+
+   private:
+    inline void Link(const uint32_t s) {
+      const uint32_t last = slots[capacity].prev;
+      slots[s].prev = last;
+      slots[s].next = capacity;
+      slots[last].next = s;
+      slots[capacity].prev = s;
+    }
+
+    inline void Unlink(const uint32_t s) {
+      slots[slots[s].prev].next = slots[s].next;
+      slots[slots[s].next].prev = slots[s].prev;
+      slots[s].prev = slots[s].next = kNil;
+    }
+  };
+
+ public:
+  /**
+   * Create a new sharded LRU cache object
+   * @param cache_size the maximal size of the cache, summed over all shards
+   * @param num_shards the number of independently locked partitions
+   * @param recency exact LRU order or CLOCK approximation
+   */
+  ShardedLruCache(const unsigned    cache_size,
+                  const Key        &empty_key,
+                  uint32_t (*hasher)(const Key &key),
+                  perf::StatisticsTemplate statistics,
+                  const unsigned    num_shards,
+                  const RecencyMode recency) :
+    counters_(statistics),
+    hasher_(hasher),
+    recency_(recency),
+    cache_size_(cache_size),
+    admission_policy_(NULL),
+    filter_shard_(0),
+    filter_slot_(kNil)
+  {
+    assert(cache_size > 0);
+    num_shards_ = std::max(1U, std::min(num_shards, kMaxShards));
+    num_shards_ = std::min(num_shards_, cache_size);
+    shards_ = new Shard[num_shards_];
+    uint64_t bytes_allocated = 0;
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      const uint32_t shard_capacity =
+        cache_size / num_shards_ + ((i < cache_size % num_shards_) ? 1 : 0);
+      shards_[i].Init(shard_capacity, empty_key, hasher);
+      bytes_allocated += shards_[i].cache.bytes_allocated() +
+                         (shard_capacity + 1) * sizeof(Slot);
+    }
+    bytes_allocated_ = bytes_allocated;
+
+    counters_.sz_size->Set(cache_size_);
+    perf::Xadd(counters_.sz_allocated, bytes_allocated_);
+  }
+
+  static double GetEntrySize() {
+    return SmallHashFixed<Key, CacheEntry>::GetEntrySize() + sizeof(Slot);
+  }
+
+  virtual ~ShardedLruCache() {
+    delete[] shards_;
+    delete admission_policy_;
+  }
+
+  /**
+   * See LruCache::SetAdmissionPolicy().  One policy serves all the shards.
+   */
+  void SetAdmissionPolicy(AdmissionPolicy *policy) {
+    delete admission_policy_;
+    admission_policy_ = policy;
+  }
+
+  /**
+   * Insert a new key-value pair.  If the shard of the key is full, its least
+   * recently used object is removed, unless the admission policy rejects the
+   * new object.  If the object is already present, it is updated and marked
+   * as recently used.
+   * @return true on insert, false on update or rejection
+   */
+  virtual bool Insert(const Key &key, const Value &value) {
+    Shard *shard = SelectShard(key);
+    WriteLock(shard);
+    if (shard->pause) {
+      Unlock(shard);
+      return false;
+    }
+
+    CacheEntry entry;
+    if (shard->cache.Lookup(key, &entry)) {
+      perf::Inc(counters_.n_update);
+      entry.value = value;
+      shard->cache.Insert(key, entry);
+      Touch(shard, entry.slot);
+      Unlock(shard);
+      return false;
+    }
+
+    if (shard->IsFull()) {
+      const uint32_t victim = SelectVictim(shard);
+      if (admission_policy_ && !admission_policy_->Admit(hasher_(key),
+            hasher_(shard->slots[victim].key)))
+      {
+        Unlock(shard);
+        return false;
+      }
+      perf::Inc(counters_.n_replace);
+      EvictVictim(shard, victim);
+    }
+    perf::Inc(counters_.n_insert);
+
+    entry.slot = shard->PushBack(key);
+    entry.value = value;
+    shard->cache.Insert(key, entry);
+
+    Unlock(shard);
+    return true;
+  }
+
+  /**
+   * Marks the object as recently used.  The object must be present.
+   */
+  virtual void Update(const Key &key) {
+    Shard *shard = SelectShard(key);
+    WriteLock(shard);
+    assert(!shard->pause);
+    CacheEntry entry;
+    bool retval = shard->cache.Lookup(key, &entry);
+    assert(retval);
+    perf::Inc(counters_.n_update);
+    Touch(shard, entry.slot);
+    Unlock(shard);
+  }
+
+  /**
+   * Changes the value of an entry without updating the LRU order.
+   */
+  virtual bool UpdateValue(const Key &key, const Value &value) {
+    Shard *shard = SelectShard(key);
+    WriteLock(shard);
+    if (shard->pause) {
+      Unlock(shard);
+      return false;
+    }
+
+    CacheEntry entry;
+    if (!shard->cache.Lookup(key, &entry)) {
+      Unlock(shard);
+      return false;
+    }
+
+    perf::Inc(counters_.n_update_value);
+    entry.value = value;
+    shard->cache.Insert(key, entry);
+    Unlock(shard);
+    return true;
+  }
+
+  /**
+   * Retrieve an element from the cache.  In kRecencyClock mode and without
+   * update of the LRU order, only the read lock of the shard is taken.
+   * @return true on successful lookup, false if key was not found
+   */
+  virtual bool Lookup(const Key &key, Value *value, bool update_lru = true) {
+    Shard *shard = SelectShard(key);
+    const bool exclusive = update_lru && (recency_ == kRecencyLru);
+    if (exclusive)
+      WriteLock(shard);
+    else
+      ReadLock(shard);
+    if (shard->pause) {
+      Unlock(shard);
+      RecordAccess(key, false);
+      return false;
+    }
+
+    bool found = false;
+    CacheEntry entry;
+    if (shard->cache.Lookup(key, &entry)) {
+      perf::Inc(counters_.n_hit);
+      if (update_lru)
+        Touch(shard, entry.slot);
+      *value = entry.value;
+      found = true;
+    } else {
+      perf::Inc(counters_.n_miss);
+    }
+
+    Unlock(shard);
+    RecordAccess(key, found);
+    return found;
+  }
+
+  /**
+   * Forgets about a specific cache entry
+   * @return true if key was deleted, false if key was not in the cache
+   */
+  virtual bool Forget(const Key &key) {
+    Shard *shard = SelectShard(key);
+    WriteLock(shard);
+    if (shard->pause) {
+      Unlock(shard);
+      return false;
+    }
+
+    bool found = false;
+    CacheEntry entry;
+    if (shard->cache.Lookup(key, &entry)) {
+      found = true;
+      perf::Inc(counters_.n_forget);
+      shard->Remove(entry.slot);
+      shard->cache.Erase(key);
+    }
+
+    Unlock(shard);
+    return found;
+  }
+
+  /**
+   * Clears all elements from all shards.
+   */
+  virtual void Drop() {
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      WriteLock(&shards_[i]);
+      shards_[i].Reset();
+      shards_[i].cache.Clear();
+      Unlock(&shards_[i]);
+    }
+    perf::Inc(counters_.n_drop);
+    counters_.sz_allocated->Set(bytes_allocated_);
+  }
+
+  void Pause() {
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      WriteLock(&shards_[i]);
+      shards_[i].pause = true;
+      Unlock(&shards_[i]);
+    }
+  }
+
+  void Resume() {
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      WriteLock(&shards_[i]);
+      shards_[i].pause = false;
+      Unlock(&shards_[i]);
+    }
+  }
+
+  /**
+   * True if all the shards are full
+   */
+  bool IsFull() {
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      ReadLock(&shards_[i]);
+      const bool is_full = shards_[i].IsFull();
+      Unlock(&shards_[i]);
+      if (!is_full)
+        return false;
+    }
+    return true;
+  }
+
+  bool IsEmpty() {
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      ReadLock(&shards_[i]);
+      const bool is_empty = (shards_[i].gauge == 0);
+      Unlock(&shards_[i]);
+      if (!is_empty)
+        return false;
+    }
+    return true;
+  }
+
+  Counters counters() {
+    Counters result = counters_;
+    result.num_collisions = 0;
+    result.max_collisions = 0;
+    for (unsigned i = 0; i < num_shards_; ++i) {
+      uint64_t num_collisions;
+      uint32_t max_collisions;
+      ReadLock(&shards_[i]);
+      shards_[i].cache.GetCollisionStats(&num_collisions, &max_collisions);
+      Unlock(&shards_[i]);
+      result.num_collisions += num_collisions;
+      result.max_collisions = std::max(result.max_collisions, max_collisions);
+    }
+    return result;
+  }
+
+  unsigned num_shards() const { return num_shards_; }
+  RecencyMode recency() const { return recency_; }
+
+  /**
+   * Prepares for iteration of the cache entries to perform a filter operation.
+   * All the shards are locked until FilterEnd().  Within a shard, entries are
+   * visited from the least to the most recently used one.
+   */
+  virtual void FilterBegin() {
+    assert(filter_slot_ == kNil);
+    for (unsigned i = 0; i < num_shards_; ++i)
+      WriteLock(&shards_[i]);
+    filter_shard_ = 0;
+    filter_slot_ = shards_[0].head();
+  }
+
+  virtual void FilterGet(Key *key, Value *value) {
+    assert(filter_slot_ != kNil);
+    Shard *shard = &shards_[filter_shard_];
+    assert(filter_slot_ != shard->head());
+    *key = shard->slots[filter_slot_].key;
+    CacheEntry entry;
+    bool rc = shard->cache.Lookup(*key, &entry);
+    assert(rc);
+    *value = entry.value;
+  }
+
+  /**
+   * Advance to the next entry, moving on to the next shard if necessary
+   * @returns false upon reaching the end of the last shard
+   */
+  virtual bool FilterNext() {
+    assert(filter_slot_ != kNil);
+    filter_slot_ = shards_[filter_shard_].slots[filter_slot_].next;
+    while (filter_slot_ == shards_[filter_shard_].head()) {
+      if (filter_shard_ + 1 == num_shards_)
+        return false;
+      filter_shard_++;
+      filter_slot_ = shards_[filter_shard_].slots[
+        shards_[filter_shard_].head()].next;
+    }
+    return true;
+  }
+
+  virtual void FilterDelete() {
+    assert(filter_slot_ != kNil);
+    Shard *shard = &shards_[filter_shard_];
+    assert(filter_slot_ != shard->head());
+    const uint32_t new_current = shard->slots[filter_slot_].prev;
+    perf::Inc(counters_.n_forget);
+    shard->cache.Erase(shard->slots[filter_slot_].key);
+    shard->Remove(filter_slot_);
+    filter_slot_ = new_current;
+  }
+
+  virtual void FilterEnd() {
+    assert(filter_slot_ != kNil);
+    filter_slot_ = kNil;
+    for (unsigned i = 0; i < num_shards_; ++i)
+      Unlock(&shards_[i]);
+  }
+
+ protected:
+  Counters counters_;
+
+ private:
+  inline Shard *SelectShard(const Key &key) {
+    return &shards_[hasher_(key) % num_shards_];
+  }
+
+  /**
+   * Reports a lookup to the admission policy, if any.  Called without the
+   * shard lock.
+   */
+  inline void RecordAccess(const Key &key, const bool hit) {
+    if (admission_policy_)
+      admission_policy_->RecordAccess(hasher_(key), hit);
+  }
+
+  /**
+   * Marks an entry as recently used.  In kRecencyClock mode, this only needs
+   * the read lock.  The reference bit is only written if it is not yet set,
+   * so that repeated hits don't bounce the cache line between processors.
+   */
+  inline void Touch(Shard *shard, const uint32_t slot) {
+    if (recency_ == kRecencyClock) {
+      if (atomic_read32(&shard->slots[slot].referenced) == 0)
+        atomic_write32(&shard->slots[slot].referenced, 1);
+    } else {
+      shard->MoveToBack(slot);
+    }
+  }
+
+  /**
+   * Finds the least recently used entry of the shard.  In kRecencyClock mode,
+   * this is the first entry without reference bit or, if all entries are
+   * referenced, the first entry.  The shard is not modified, so that a
+   * candidate rejected by the admission policy leaves the reference bits
+   * intact.  EvictVictim() advances the clock hand.
+   */
+  inline uint32_t SelectVictim(Shard *shard) {
+    assert(shard->gauge > 0);
+    const uint32_t first = shard->slots[shard->head()].next;
+    if (recency_ != kRecencyClock)
+      return first;
+    for (uint32_t s = first; s != shard->head(); s = shard->slots[s].next) {
+      if (atomic_read32(&shard->slots[s].referenced) == 0)
+        return s;
+    }
+    return first;
+  }
+
+  /**
+   * Removes the victim found by SelectVictim().  In kRecencyClock mode, the
+   * referenced entries in front of the victim lose their reference bit and
+   * move to the back of the list, as if the clock hand passed over them.
+   */
+  inline void EvictVictim(Shard *shard, const uint32_t victim) {
+    if (recency_ == kRecencyClock) {
+      if (atomic_read32(&shard->slots[victim].referenced) != 0) {
+        // All entries were referenced: a full turn of the clock hand clears
+        // every bit and leaves the order unchanged
+        for (uint32_t s = shard->slots[shard->head()].next;
+             s != shard->head(); s = shard->slots[s].next)
+        {
+          atomic_write32(&shard->slots[s].referenced, 0);
+        }
+      } else {
+        uint32_t s = shard->slots[shard->head()].next;
+        while (s != victim) {
+          const uint32_t next = shard->slots[s].next;
+          atomic_write32(&shard->slots[s].referenced, 0);
+          shard->MoveToBack(s);
+          s = next;
+        }
+      }
+    }
+    shard->cache.Erase(shard->slots[victim].key);
+    shard->Remove(victim);
+  }
+
+  inline void ReadLock(Shard *shard) {
+    int retval = pthread_rwlock_rdlock(&shard->lock);
+    assert(retval == 0);
+  }
+
+  inline void WriteLock(Shard *shard) {
+    int retval = pthread_rwlock_wrlock(&shard->lock);
+    assert(retval == 0);
+  }
+
+  inline void Unlock(Shard *shard) {
+    int retval = pthread_rwlock_unlock(&shard->lock);
+    assert(retval == 0);
+  }
+
+  uint32_t (*hasher_)(const Key &key);
+  const RecencyMode recency_;
+  const unsigned cache_size_;
+  unsigned num_shards_;
+  Shard *shards_;
+  uint64_t bytes_allocated_;
+  AdmissionPolicy *admission_policy_;
+
+  unsigned filter_shard_;
+  uint32_t filter_slot_;
+};  // class ShardedLruCache
+
+template<class Key, class Value>
+const unsigned ShardedLruCache<Key, Value>::kMaxShards;
+template<class Key, class Value>
+const uint32_t ShardedLruCache<Key, Value>::kNil;
+
 }  // namespace lru
 
 #endif  // CVMFS_LRU_H_
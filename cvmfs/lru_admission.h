@@ -0,0 +1,247 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Admission policies for the LRU caches.  When a cache is full, a new entry
+ * replaces the least recently used one.  An admission policy can veto the
+ * replacement if the new entry is unlikely to be used again, which protects
+ * the working set from one-time scans such as "ls -R" or updatedb.
+ */
+
+#ifndef CVMFS_LRU_ADMISSION_H_
+#define CVMFS_LRU_ADMISSION_H_
+
+#include <stdint.h>
+
+#include <cstdlib>
+
+#include "atomic.h"
+#include "murmur.h"
+#include "smalloc.h"
+#include "statistics.h"
+#include "util/single_copy.h"
+
+namespace lru {
+
+/**
+ * Interface of admission policies.  Policies work on the 32bit key hashes of
+ * the cache.  The caches report every lookup and whether it was a hit through
+ * RecordAccess() without holding their locks, so implementations need to be
+ * thread-safe.
+ */
+class AdmissionPolicy {
+ public:
+  virtual ~AdmissionPolicy() { }
+  virtual void RecordAccess(const uint32_t hash, const bool hit) = 0;
+  /**
+   * Called when the cache is full.  Returns true if the candidate should
+   * replace the victim, false if the candidate should not enter the cache.
+   */
+  virtual bool Admit(const uint32_t candidate, const uint32_t victim) = 0;
+};
+
+
+/**
+ * TinyLFU admission: a count-min sketch estimates the recent access frequency
+ * of keys.  A candidate is admitted if it was accessed at least as often as
+ * the victim.  Keys that are accessed once, as during a scan, don't displace
+ * entries that are in use.  Once the number of recorded accesses reaches ten
+ * times the cache capacity, all counters are halved so that past popularity
+ * fades out.
+ *
+ * The first access of a key only sets its bit in the doorkeeper, a bloom
+ * filter that is cleared on aging.  Further accesses go to the sketch.  Scans
+ * thus don't pollute the sketch and a key accessed once is estimated lower
+ * than a key accessed twice.  Admitting on ties lets a new working set replace
+ * an old one once both saturate the counters.
+ *
+ * The sketch uses 4 rows of 4bit counters that share a single table.  Sixteen
+ * counters are packed in a 64bit word and updated with compare-and-swap, so
+ * that RecordAccess() doesn't need a lock.
+ */
+class TinyLfuPolicy : public AdmissionPolicy, SingleCopy {
+ public:
+  TinyLfuPolicy(const unsigned capacity, perf::StatisticsTemplate statistics)
+    : num_words_(64)
+    , sample_size_(kSampleFactor * static_cast<uint64_t>(capacity))
+  {
+    // At least 16 counters per cache entry
+    while (num_words_ < capacity)
+      num_words_ *= 2;
+    table_ = static_cast<atomic_int64 *>(
+      smalloc(num_words_ * sizeof(atomic_int64)));
+    doorkeeper_ = static_cast<atomic_int64 *>(
+      smalloc(num_words_ * sizeof(atomic_int64)));
+    for (unsigned i = 0; i < num_words_; ++i) {
+      atomic_init64(&table_[i]);
+      atomic_init64(&doorkeeper_[i]);
+    }
+    atomic_init64(&num_accesses_);
+    if (sample_size_ == 0)
+      sample_size_ = kSampleFactor;
+
+    n_admit_ = statistics.RegisterTemplated("n_admit",
+      "Number of new entries admitted to a full cache");
+    n_reject_ = statistics.RegisterTemplated("n_reject",
+      "Number of new entries rejected from a full cache");
+    n_age_ = statistics.RegisterTemplated("n_age",
+      "Number of times the access frequencies were halved");
+    n_hit_ = statistics.RegisterTemplated("n_hit",
+      "Number of recorded lookups that found the key in the cache");
+    n_miss_ = statistics.RegisterTemplated("n_miss",
+      "Number of recorded lookups that missed the cache");
+  }
+
+  virtual ~TinyLfuPolicy() {
+    free(table_);
+    free(doorkeeper_);
+  }
+
+  virtual void RecordAccess(const uint32_t hash, const bool hit) {
+    perf::Inc(hit ? n_hit_ : n_miss_);
+    if (SetDoorkeeper(hash)) {
+      for (unsigned i = 0; i < kDepth; ++i)
+        Increment(Index(hash, i));
+    }
+    if (atomic_xadd64(&num_accesses_, 1) + 1 ==
+        static_cast<int64_t>(sample_size_))
+    {
+      Age();
+    }
+  }
+
+  virtual bool Admit(const uint32_t candidate, const uint32_t victim) {
+    if (Frequency(candidate) >= Frequency(victim)) {
+      perf::Inc(n_admit_);
+      return true;
+    }
+    perf::Inc(n_reject_);
+    return false;
+  }
+
+  /**
+   * Estimated number of accesses since the last aging, saturates at 16
+   */
+  unsigned Frequency(const uint32_t hash) {
+    for (unsigned i = 0; i < kDoorkeeperHashes; ++i) {
+      const uint64_t index = DoorkeeperIndex(hash, i);
+      if ((atomic_read64(&doorkeeper_[index / 64]) &
+           (int64_t(1) << (index % 64))) == 0)
+      {
+        return 0;
+      }
+    }
+    unsigned result = kMaxCount;
+    for (unsigned i = 0; i < kDepth; ++i) {
+      const unsigned count = Get(Index(hash, i));
+      result = (count < result) ? count : result;
+    }
+    return result + 1;
+  }
+
+ private:
+  static const unsigned kDepth = 4;
+  static const unsigned kDoorkeeperHashes = 3;
+  static const unsigned kSampleFactor = 10;
+  static const unsigned kMaxCount = 15;
+  static const unsigned kCountersPerWord = 16;
+
+  /**
+   * Counter index of a key hash in the given row
+   */
+  inline uint64_t Index(const uint32_t hash, const unsigned row) const {
+    static const uint32_t kSeeds[kDepth] =
+      { 0x97cb3127, 0xb1e6a2f3, 0x2f7d1a4b, 0x5c3ce6d9 };
+    return MurmurHash2(&hash, sizeof(hash), kSeeds[row]) %
+           (static_cast<uint64_t>(num_words_) * kCountersPerWord);
+  }
+
+  inline uint64_t DoorkeeperIndex(const uint32_t hash, const unsigned i) const {
+    static const uint32_t kSeeds[kDoorkeeperHashes] =
+      { 0x7a3e91c5, 0x1d58b2e7, 0xe4c0763b };
+    return MurmurHash2(&hash, sizeof(hash), kSeeds[i]) %
+           (static_cast<uint64_t>(num_words_) * 64);
+  }
+
+  /**
+   * Returns true if all the key's doorkeeper bits were set already
+   */
+  inline bool SetDoorkeeper(const uint32_t hash) {
+    bool was_set = true;
+    for (unsigned i = 0; i < kDoorkeeperHashes; ++i) {
+      const uint64_t index = DoorkeeperIndex(hash, i);
+      atomic_int64 *word = &doorkeeper_[index / 64];
+      const int64_t bit = int64_t(1) << (index % 64);
+      while (true) {
+        const int64_t old_value = atomic_read64(word);
+        if (old_value & bit)
+          break;
+        if (atomic_cas64(word, old_value, old_value | bit)) {
+          was_set = false;
+          break;
+        }
+      }
+    }
+    return was_set;
+  }
+
+  inline unsigned Get(const uint64_t index) {
+    const uint64_t word = atomic_read64(&table_[index / kCountersPerWord]);
+    return (word >> (4 * (index % kCountersPerWord))) & 0xF;
+  }
+
+  /**
+   * Saturates at kMaxCount
+   */
+  inline void Increment(const uint64_t index) {
+    atomic_int64 *word = &table_[index / kCountersPerWord];
+    const unsigned shift = 4 * (index % kCountersPerWord);
+    while (true) {
+      const int64_t old_value = atomic_read64(word);
+      if (((static_cast<uint64_t>(old_value) >> shift) & 0xF) == kMaxCount)
+        return;
+      const int64_t new_value = old_value + (int64_t(1) << shift);
+      if (atomic_cas64(word, old_value, new_value))
+        return;
+    }
+  }
+
+  /**
+   * Halves all counters and clears the doorkeeper.  Concurrent increments land
+   * either before or after the halving of their word, which is good enough for
+   * an estimate.
+   */
+  void Age() {
+    for (unsigned i = 0; i < num_words_; ++i) {
+      while (true) {
+        const int64_t old_value = atomic_read64(&table_[i]);
+        const int64_t new_value = static_cast<int64_t>(
+          (static_cast<uint64_t>(old_value) >> 1) &
+          uint64_t(0x7777777777777777ULL));
+        if (atomic_cas64(&table_[i], old_value, new_value))
+          break;
+      }
+      atomic_write64(&doorkeeper_[i], 0);
+    }
+    atomic_xadd64(&num_accesses_, -static_cast<int64_t>(sample_size_ / 2));
+    perf::Inc(n_age_);
+  }
+
+  unsigned num_words_;
+  atomic_int64 *table_;
+  /**
+   * Bloom filter with num_words_ * 64 bits
+   */
+  atomic_int64 *doorkeeper_;
+  atomic_int64 num_accesses_;
+  uint64_t sample_size_;
+
+  perf::Counter *n_admit_;
+  perf::Counter *n_reject_;
+  perf::Counter *n_age_;
+  perf::Counter *n_hit_;
+  perf::Counter *n_miss_;
+};
+
+}  // namespace lru
+
+#endif  // CVMFS_LRU_ADMISSION_H_
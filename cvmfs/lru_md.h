@@ -1,7 +1,8 @@
 /**
  * This file is part of the CernVM File System.
  *
- * Provides the LRU sub classes used for the file system client meta-data cache
+ * Provides the LRU sub classes used for the file system client meta-data cache.
+ * They are hit by every Fuse thread on every lookup, so they are sharded.
  */
 
 #ifndef CVMFS_LRU_MD_H_
@@ -38,13 +39,16 @@ static inline uint32_t hasher_inode(const fuse_ino_t &inode) {
 // uint32_t hasher_inode(const fuse_ino_t &inode);
 
 
-class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
+class InodeCache :
+  public ShardedLruCache<fuse_ino_t, catalog::DirectoryEntry>
 {
  public:
-  explicit InodeCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<fuse_ino_t, catalog::DirectoryEntry>(
+  InodeCache(unsigned int cache_size, perf::Statistics *statistics,
+             unsigned num_shards = 1, RecencyMode recency = kRecencyLru) :
+    ShardedLruCache<fuse_ino_t, catalog::DirectoryEntry>(
       cache_size, fuse_ino_t(-1), hasher_inode,
-      perf::StatisticsTemplate("inode_cache", statistics))
+      perf::StatisticsTemplate("inode_cache", statistics),
+      num_shards, recency)
   {
   }
 
@@ -52,7 +56,8 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
     LogCvmfs(kLogLru, kLogDebug, "insert inode --> dirent: %u -> '%s'",
              inode, dirent.name().c_str());
     const bool result =
-      LruCache<fuse_ino_t, catalog::DirectoryEntry>::Insert(inode, dirent);
+      ShardedLruCache<fuse_ino_t, catalog::DirectoryEntry>::Insert(
+        inode, dirent);
     return result;
   }
 
@@ -60,7 +65,8 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
               bool update_lru = true)
   {
     const bool result =
-      LruCache<fuse_ino_t, catalog::DirectoryEntry>::Lookup(inode, dirent);
+      ShardedLruCache<fuse_ino_t, catalog::DirectoryEntry>::Lookup(
+        inode, dirent);
     LogCvmfs(kLogLru, kLogDebug, "lookup inode --> dirent: %u (%s)",
              inode, result ? "hit" : "miss");
     return result;
@@ -68,16 +74,19 @@ class InodeCache : public LruCache<fuse_ino_t, catalog::DirectoryEntry>
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping inode cache");
-    LruCache<fuse_ino_t, catalog::DirectoryEntry>::Drop();
+    ShardedLruCache<fuse_ino_t, catalog::DirectoryEntry>::Drop();
   }
 };  // InodeCache
 
 
-class PathCache : public LruCache<fuse_ino_t, PathString> {
+class PathCache : public ShardedLruCache<fuse_ino_t, PathString> {
  public:
-  explicit PathCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<fuse_ino_t, PathString>(cache_size, fuse_ino_t(-1), hasher_inode,
-      perf::StatisticsTemplate("path_cache", statistics))
+  PathCache(unsigned int cache_size, perf::Statistics *statistics,
+            unsigned num_shards = 1, RecencyMode recency = kRecencyLru) :
+    ShardedLruCache<fuse_ino_t, PathString>(
+      cache_size, fuse_ino_t(-1), hasher_inode,
+      perf::StatisticsTemplate("path_cache", statistics),
+      num_shards, recency)
   {
   }
 
@@ -85,7 +94,7 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
     LogCvmfs(kLogLru, kLogDebug, "insert inode --> path %u -> '%s'",
              inode, path.c_str());
     const bool result =
-      LruCache<fuse_ino_t, PathString>::Insert(inode, path);
+      ShardedLruCache<fuse_ino_t, PathString>::Insert(inode, path);
     return result;
   }
 
@@ -93,7 +102,7 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
               bool update_lru = true)
   {
     const bool found =
-      LruCache<fuse_ino_t, PathString>::Lookup(inode, path);
+      ShardedLruCache<fuse_ino_t, PathString>::Lookup(inode, path);
     LogCvmfs(kLogLru, kLogDebug, "lookup inode --> path: %u (%s)",
              inode, found ? "hit" : "miss");
     return found;
@@ -101,19 +110,21 @@ class PathCache : public LruCache<fuse_ino_t, PathString> {
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping path cache");
-    LruCache<fuse_ino_t, PathString>::Drop();
+    ShardedLruCache<fuse_ino_t, PathString>::Drop();
   }
 };  // PathCache
 
 
 class Md5PathCache :
-  public LruCache<shash::Md5, catalog::DirectoryEntry>
+  public ShardedLruCache<shash::Md5, catalog::DirectoryEntry>
 {
  public:
-  explicit Md5PathCache(unsigned int cache_size, perf::Statistics *statistics) :
-    LruCache<shash::Md5, catalog::DirectoryEntry>(
+  Md5PathCache(unsigned int cache_size, perf::Statistics *statistics,
+               unsigned num_shards = 1, RecencyMode recency = kRecencyLru) :
+    ShardedLruCache<shash::Md5, catalog::DirectoryEntry>(
       cache_size, shash::Md5(shash::AsciiPtr("!")), hasher_md5,
-      perf::StatisticsTemplate("md5_path_cache", statistics))
+      perf::StatisticsTemplate("md5_path_cache", statistics),
+      num_shards, recency)
   {
     dirent_negative_ = catalog::DirectoryEntry(catalog::kDirentNegative);
   }
@@ -122,7 +133,8 @@ class Md5PathCache :
     LogCvmfs(kLogLru, kLogDebug, "insert md5 --> dirent: %s -> '%s'",
              hash.ToString().c_str(), dirent.name().c_str());
     const bool result =
-      LruCache<shash::Md5, catalog::DirectoryEntry>::Insert(hash, dirent);
+      ShardedLruCache<shash::Md5, catalog::DirectoryEntry>::Insert(
+        hash, dirent);
     return result;
   }
 
@@ -137,7 +149,8 @@ class Md5PathCache :
               bool update_lru = true)
   {
     const bool result =
-      LruCache<shash::Md5, catalog::DirectoryEntry>::Lookup(hash, dirent);
+      ShardedLruCache<shash::Md5, catalog::DirectoryEntry>::Lookup(
+        hash, dirent);
     LogCvmfs(kLogLru, kLogDebug, "lookup md5 --> dirent: %s (%s)",
              hash.ToString().c_str(), result ? "hit" : "miss");
     return result;
@@ -146,12 +159,12 @@ class Md5PathCache :
   bool Forget(const shash::Md5 &hash) {
     LogCvmfs(kLogLru, kLogDebug, "forget md5: %s",
              hash.ToString().c_str());
-    return LruCache<shash::Md5, catalog::DirectoryEntry>::Forget(hash);
+    return ShardedLruCache<shash::Md5, catalog::DirectoryEntry>::Forget(hash);
   }
 
   void Drop() {
     LogCvmfs(kLogLru, kLogDebug, "dropping md5path cache");
-    LruCache<shash::Md5, catalog::DirectoryEntry>::Drop();
+    ShardedLruCache<shash::Md5, catalog::DirectoryEntry>::Drop();
   }
 
  private:
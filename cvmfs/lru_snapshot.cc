@@ -0,0 +1,540 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "lru_snapshot.h"
+
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "compression.h"
+#include "directory_entry.h"
+#include "logging.h"
+#include "lru_md.h"
+#include "shortstring.h"
+#include "smalloc.h"
+#include "util/mmap_file.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+namespace lru {
+
+const char Md5PathSnapshot::kMagic[8] =
+  { 'C', 'V', 'M', 'F', 'S', 'M', 'D', '5' };
+
+namespace {
+
+/**
+ * Fixed-size part of a catalog, followed by the mount point
+ */
+struct CatalogRecord {
+  uint8_t hash_algorithm;
+  uint8_t hash_suffix;
+  uint16_t mountpoint_length;
+  unsigned char hash_digest[shash::kMaxDigestSize];
+};
+
+/**
+ * Fixed-size part of an entry, followed by the name and the symlink.  Records
+ * are not aligned in the buffer, so they are always accessed through memcpy.
+ * The catalog is an index into the catalogs of the snapshot.
+ */
+struct EntryRecord {
+  unsigned char md5path[16];
+  uint64_t relative_inode;
+  uint32_t catalog;
+  uint64_t size;
+  int64_t mtime;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t linkcount;
+  uint32_t hardlink_group;
+  uint16_t name_length;
+  uint16_t symlink_length;
+  uint8_t flags;
+  uint8_t compression_algorithm;
+  uint8_t hash_algorithm;
+  uint8_t hash_suffix;
+  unsigned char hash_digest[shash::kMaxDigestSize];
+};
+
+const uint8_t kFlagNegative = 0x01;
+const uint8_t kFlagXattrs = 0x02;
+const uint8_t kFlagExternal = 0x04;
+const uint8_t kFlagNestedRoot = 0x08;
+const uint8_t kFlagNestedMountpoint = 0x10;
+const uint8_t kFlagBindMountpoint = 0x20;
+const uint8_t kFlagChunked = 0x40;
+const uint8_t kFlagHidden = 0x80;
+
+}  // anonymous namespace
+
+
+Md5PathSnapshot::Md5PathSnapshot()
+  : mapped_file_(NULL)
+  , buffer_(NULL)
+  , size_(0)
+  , num_entries_(0)
+  , num_catalogs_(0)
+{ }
+
+
+Md5PathSnapshot::~Md5PathSnapshot() {
+  delete mapped_file_;
+}
+
+
+/**
+ * Serializes the content of the cache.  The entries are copied out of the
+ * locked cache first, so that the cache lock is not held while the resolver
+ * takes the catalog lock.  The resolver can be NULL, in which case no inodes
+ * are stored.
+ */
+Md5PathSnapshot *Md5PathSnapshot::Create(
+  const shash::Any &catalog_hash,
+  Md5PathCache *cache,
+  InodeResolver *resolver)
+{
+  vector<pair<shash::Md5, catalog::DirectoryEntry> > entries;
+  shash::Md5 md5path;
+  catalog::DirectoryEntry dirent;
+  cache->FilterBegin();
+  while (cache->FilterNext()) {
+    cache->FilterGet(&md5path, &dirent);
+    entries.push_back(make_pair(md5path, dirent));
+  }
+  cache->FilterEnd();
+
+  Md5PathSnapshot *snapshot = new Md5PathSnapshot();
+  snapshot->catalog_hash_ = catalog_hash;
+  snapshot->num_entries_ = entries.size();
+
+  string catalogs;
+  string records;
+  map<PathString, uint32_t> catalog_indexes;
+  PathString catalog_mountpoint;
+  shash::Any catalog_hash_entry;
+  for (unsigned i = 0; i < entries.size(); ++i) {
+    const catalog::DirectoryEntry &entry = entries[i].second;
+    uint32_t catalog = kNoCatalog;
+    uint64_t relative_inode = 0;
+    // Hard link groups are resolved to inodes in the order of access, which
+    // does not survive a remount
+    if ((resolver != NULL) && !entry.IsNegative() &&
+        (entry.hardlink_group() == 0) &&
+        (entry.inode() != catalog::DirectoryEntry::kInvalidInode) &&
+        resolver->Relativize(entry.inode(), &catalog_mountpoint,
+                             &catalog_hash_entry, &relative_inode))
+    {
+      map<PathString, uint32_t>::const_iterator iter =
+        catalog_indexes.find(catalog_mountpoint);
+      if (iter == catalog_indexes.end()) {
+        catalog = catalog_indexes.size();
+        catalog_indexes[catalog_mountpoint] = catalog;
+        SerializeCatalog(catalog_mountpoint, catalog_hash_entry, &catalogs);
+      } else {
+        catalog = iter->second;
+      }
+    }
+    Serialize(entries[i].first, entry, catalog, relative_inode, &records);
+  }
+  snapshot->num_catalogs_ = catalog_indexes.size();
+
+  Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  header.num_entries = snapshot->num_entries_;
+  header.num_catalogs = snapshot->num_catalogs_;
+  header.hash_algorithm = catalog_hash.algorithm;
+  header.hash_suffix = catalog_hash.suffix;
+  memcpy(header.hash_digest, catalog_hash.digest, shash::kMaxDigestSize);
+  snapshot->data_.reserve(sizeof(header) + catalogs.size() + records.size());
+  snapshot->data_.append(reinterpret_cast<char *>(&header), sizeof(header));
+  snapshot->data_.append(catalogs);
+  snapshot->data_.append(records);
+
+  snapshot->buffer_ =
+    reinterpret_cast<const unsigned char *>(snapshot->data_.data());
+  snapshot->size_ = snapshot->data_.size();
+  return snapshot;
+}
+
+
+/**
+ * Maps a snapshot file that was previously stored with Write().
+ * @return NULL if the file does not exist or if it is not a valid snapshot
+ */
+Md5PathSnapshot *Md5PathSnapshot::Open(const string &path) {
+  if (!FileExists(path))
+    return NULL;
+
+  UniquePtr<Md5PathSnapshot> snapshot(new Md5PathSnapshot());
+  snapshot->mapped_file_ = new MemoryMappedFile(path);
+  if (!snapshot->mapped_file_->Map())
+    return NULL;
+  snapshot->buffer_ = snapshot->mapped_file_->buffer();
+  snapshot->size_ = snapshot->mapped_file_->size();
+  if (!snapshot->ParseHeader()) {
+    LogCvmfs(kLogLru, kLogDebug | kLogSyslogWarn,
+             "ignoring invalid meta-data cache snapshot %s", path.c_str());
+    return NULL;
+  }
+  return snapshot.Release();
+}
+
+
+bool Md5PathSnapshot::ParseHeader() {
+  if (size_ < sizeof(Header))
+    return false;
+  Header header;
+  memcpy(&header, buffer_, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(header.magic)) != 0)
+    return false;
+  if (header.version != kVersion)
+    return false;
+  if (header.hash_algorithm > shash::kAny)
+    return false;
+  catalog_hash_.algorithm =
+    static_cast<shash::Algorithms>(header.hash_algorithm);
+  catalog_hash_.suffix = header.hash_suffix;
+  memcpy(catalog_hash_.digest, header.hash_digest, shash::kMaxDigestSize);
+  num_entries_ = header.num_entries;
+  num_catalogs_ = header.num_catalogs;
+  return true;
+}
+
+
+/**
+ * Stores the snapshot atomically under the given path.
+ */
+bool Md5PathSnapshot::Write(const string &path) const {
+  string tmp_path;
+  FILE *fsnapshot = CreateTempFile(path, 0600, "w", &tmp_path);
+  if (fsnapshot == NULL)
+    return false;
+  size_t written = fwrite(buffer_, 1, size_, fsnapshot);
+  int retval = fclose(fsnapshot);
+  if ((written != size_) || (retval != 0)) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  retval = rename(tmp_path.c_str(), path.c_str());
+  if (retval != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+/**
+ * Inserts the entries of the snapshot into the cache, provided that the
+ * snapshot was taken from the given root catalog.  Entries that belong to a
+ * catalog are handed to the restorer, if any, which completes their inodes.
+ * A truncated or corrupted snapshot is restored up to the first invalid
+ * entry.
+ * @return the number of entries inserted into the cache
+ */
+unsigned Md5PathSnapshot::Restore(
+  const shash::Any &catalog_hash,
+  Md5PathCache *cache,
+  Md5PathRestorer *restorer) const
+{
+  if (catalog_hash != catalog_hash_) {
+    LogCvmfs(kLogLru, kLogDebug, "rejecting meta-data cache snapshot of %s "
+             "(current root catalog %s)", catalog_hash_.ToString().c_str(),
+             catalog_hash.ToString().c_str());
+    return 0;
+  }
+
+  size_t pos = sizeof(Header);
+  vector<PathString> catalog_mountpoints;
+  vector<shash::Any> catalog_hashes;
+  PathString catalog_mountpoint;
+  shash::Any catalog_hash_entry;
+  for (unsigned i = 0; i < num_catalogs_; ++i) {
+    if (!DeserializeCatalog(buffer_, size_, &pos, &catalog_mountpoint,
+                            &catalog_hash_entry))
+    {
+      LogCvmfs(kLogLru, kLogDebug, "meta-data cache snapshot corrupted in "
+               "catalog %u", i);
+      return 0;
+    }
+    catalog_mountpoints.push_back(catalog_mountpoint);
+    catalog_hashes.push_back(catalog_hash_entry);
+  }
+
+  unsigned num_restored = 0;
+  Md5PathRestorer::PendingEntry entry;
+  uint32_t catalog;
+  for (unsigned i = 0; i < num_entries_; ++i) {
+    if (!Deserialize(buffer_, size_, &pos, &entry.md5path, &entry.dirent,
+                     &catalog, &entry.relative_inode))
+    {
+      LogCvmfs(kLogLru, kLogDebug, "meta-data cache snapshot corrupted after "
+               "%u entries", i);
+      break;
+    }
+    if (cache->Insert(entry.md5path, entry.dirent))
+      num_restored++;
+    if ((restorer != NULL) && (catalog < num_catalogs_)) {
+      restorer->AddPending(catalog_mountpoints[catalog],
+                           catalog_hashes[catalog], entry);
+    }
+  }
+  return num_restored;
+}
+
+
+void Md5PathSnapshot::SerializeCatalog(
+  const PathString &mountpoint,
+  const shash::Any &hash,
+  string *buffer)
+{
+  CatalogRecord record;
+  memset(&record, 0, sizeof(record));
+  record.hash_algorithm = hash.algorithm;
+  record.hash_suffix = hash.suffix;
+  record.mountpoint_length = mountpoint.GetLength();
+  memcpy(record.hash_digest, hash.digest, shash::kMaxDigestSize);
+  buffer->append(reinterpret_cast<char *>(&record), sizeof(record));
+  buffer->append(mountpoint.GetChars(), mountpoint.GetLength());
+}
+
+
+bool Md5PathSnapshot::DeserializeCatalog(
+  const unsigned char *buffer,
+  const size_t size,
+  size_t *pos,
+  PathString *mountpoint,
+  shash::Any *hash)
+{
+  CatalogRecord record;
+  if (size - *pos < sizeof(record))
+    return false;
+  memcpy(&record, buffer + *pos, sizeof(record));
+  *pos += sizeof(record);
+  if ((size - *pos < record.mountpoint_length) ||
+      (record.hash_algorithm > shash::kAny))
+  {
+    return false;
+  }
+
+  *hash = shash::Any(static_cast<shash::Algorithms>(record.hash_algorithm));
+  hash->suffix = record.hash_suffix;
+  memcpy(hash->digest, record.hash_digest, shash::kMaxDigestSize);
+  mountpoint->Assign(reinterpret_cast<const char *>(buffer + *pos),
+                     record.mountpoint_length);
+  *pos += record.mountpoint_length;
+  return true;
+}
+
+
+void Md5PathSnapshot::Serialize(
+  const shash::Md5 &md5path,
+  const catalog::DirectoryEntry &dirent,
+  const uint32_t catalog,
+  const uint64_t relative_inode,
+  string *buffer)
+{
+  EntryRecord record;
+  memset(&record, 0, sizeof(record));
+  memcpy(record.md5path, md5path.digest, sizeof(record.md5path));
+  record.catalog = catalog;
+  record.relative_inode = relative_inode;
+  if (dirent.IsNegative()) {
+    record.flags = kFlagNegative;
+    buffer->append(reinterpret_cast<char *>(&record), sizeof(record));
+    return;
+  }
+
+  record.size = dirent.size_;
+  record.mtime = dirent.mtime_;
+  record.mode = dirent.mode_;
+  record.uid = dirent.uid_;
+  record.gid = dirent.gid_;
+  record.linkcount = dirent.linkcount_;
+  record.hardlink_group = dirent.hardlink_group_;
+  record.name_length = dirent.name_.GetLength();
+  record.symlink_length = dirent.symlink_.GetLength();
+  record.flags =
+    (dirent.has_xattrs_ ? kFlagXattrs : 0) |
+    (dirent.is_external_file_ ? kFlagExternal : 0) |
+    (dirent.is_nested_catalog_root_ ? kFlagNestedRoot : 0) |
+    (dirent.is_nested_catalog_mountpoint_ ? kFlagNestedMountpoint : 0) |
+    (dirent.is_bind_mountpoint_ ? kFlagBindMountpoint : 0) |
+    (dirent.is_chunked_file_ ? kFlagChunked : 0) |
+    (dirent.is_hidden_ ? kFlagHidden : 0);
+  record.compression_algorithm = dirent.compression_algorithm_;
+  record.hash_algorithm = dirent.checksum_.algorithm;
+  record.hash_suffix = dirent.checksum_.suffix;
+  memcpy(record.hash_digest, dirent.checksum_.digest, shash::kMaxDigestSize);
+
+  buffer->append(reinterpret_cast<char *>(&record), sizeof(record));
+  buffer->append(dirent.name_.GetChars(), dirent.name_.GetLength());
+  buffer->append(dirent.symlink_.GetChars(), dirent.symlink_.GetLength());
+}
+
+
+bool Md5PathSnapshot::Deserialize(
+  const unsigned char *buffer,
+  const size_t size,
+  size_t *pos,
+  shash::Md5 *md5path,
+  catalog::DirectoryEntry *dirent,
+  uint32_t *catalog,
+  uint64_t *relative_inode)
+{
+  EntryRecord record;
+  if (size - *pos < sizeof(record))
+    return false;
+  memcpy(&record, buffer + *pos, sizeof(record));
+  *pos += sizeof(record);
+  memcpy(md5path->digest, record.md5path, sizeof(record.md5path));
+  *catalog = record.catalog;
+  *relative_inode = record.relative_inode;
+
+  if (record.flags & kFlagNegative) {
+    *dirent = catalog::DirectoryEntry(catalog::kDirentNegative);
+    return true;
+  }
+
+  if (size - *pos <
+      static_cast<size_t>(record.name_length) + record.symlink_length)
+  {
+    return false;
+  }
+  if ((record.hash_algorithm > shash::kAny) ||
+      (record.compression_algorithm > zlib::kLz4))
+  {
+    return false;
+  }
+
+  *dirent = catalog::DirectoryEntry();
+  dirent->inode_ = catalog::DirectoryEntry::kInvalidInode;
+  dirent->size_ = record.size;
+  dirent->mtime_ = record.mtime;
+  dirent->mode_ = record.mode;
+  dirent->uid_ = record.uid;
+  dirent->gid_ = record.gid;
+  dirent->linkcount_ = record.linkcount;
+  dirent->hardlink_group_ = record.hardlink_group;
+  dirent->has_xattrs_ = record.flags & kFlagXattrs;
+  dirent->is_external_file_ = record.flags & kFlagExternal;
+  dirent->is_nested_catalog_root_ = record.flags & kFlagNestedRoot;
+  dirent->is_nested_catalog_mountpoint_ = record.flags & kFlagNestedMountpoint;
+  dirent->is_bind_mountpoint_ = record.flags & kFlagBindMountpoint;
+  dirent->is_chunked_file_ = record.flags & kFlagChunked;
+  dirent->is_hidden_ = record.flags & kFlagHidden;
+  dirent->compression_algorithm_ =
+    static_cast<zlib::Algorithms>(record.compression_algorithm);
+  dirent->checksum_.algorithm =
+    static_cast<shash::Algorithms>(record.hash_algorithm);
+  dirent->checksum_.suffix = record.hash_suffix;
+  memcpy(dirent->checksum_.digest, record.hash_digest, shash::kMaxDigestSize);
+  dirent->name_.Assign(reinterpret_cast<const char *>(buffer + *pos),
+                       record.name_length);
+  *pos += record.name_length;
+  dirent->symlink_.Assign(reinterpret_cast<const char *>(buffer + *pos),
+                          record.symlink_length);
+  *pos += record.symlink_length;
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+
+
+Md5PathRestorer::Md5PathRestorer(Md5PathCache *cache)
+  : cache_(cache)
+  , num_pending_(0)
+{
+  lock_ =
+    reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  int retval = pthread_mutex_init(lock_, NULL);
+  assert(retval == 0);
+}
+
+
+Md5PathRestorer::~Md5PathRestorer() {
+  pthread_mutex_destroy(lock_);
+  free(lock_);
+}
+
+
+void Md5PathRestorer::AddPending(
+  const PathString &catalog_mountpoint,
+  const shash::Any &catalog_hash,
+  const PendingEntry &entry)
+{
+  MutexLockGuard guard(lock_);
+  PendingCatalog *catalog = &pending_[catalog_mountpoint];
+  catalog->hash = catalog_hash;
+  catalog->entries.push_back(entry);
+  num_pending_++;
+}
+
+
+/**
+ * Removes the pending entries of the catalog, which are only valid for the
+ * inode range of this attach.
+ * @return false if there are no entries for this catalog revision
+ */
+bool Md5PathRestorer::TakePending(
+  const PathString &catalog_mountpoint,
+  const shash::Any &catalog_hash,
+  vector<PendingEntry> *entries)
+{
+  MutexLockGuard guard(lock_);
+  map<PathString, PendingCatalog>::iterator iter =
+    pending_.find(catalog_mountpoint);
+  if (iter == pending_.end())
+    return false;
+  const bool is_match = (iter->second.hash == catalog_hash);
+  if (is_match)
+    entries->swap(iter->second.entries);
+  num_pending_ -= iter->second.entries.size() + entries->size();
+  pending_.erase(iter);
+  return is_match;
+}
+
+
+void Md5PathRestorer::Complete(const vector<PendingEntry> &entries) {
+  unsigned num_completed = 0;
+  for (unsigned i = 0; i < entries.size(); ++i) {
+    if (entries[i].dirent.inode() == catalog::DirectoryEntry::kInvalidInode)
+      continue;
+    if (cache_->UpdateValue(entries[i].md5path, entries[i].dirent))
+      num_completed++;
+  }
+  LogCvmfs(kLogLru, kLogDebug, "completed inodes of %u/%lu restored "
+           "meta-data cache entries", num_completed, entries.size());
+}
+
+
+void Md5PathRestorer::Clear() {
+  MutexLockGuard guard(lock_);
+  pending_.clear();
+  num_pending_ = 0;
+}
+
+
+unsigned Md5PathRestorer::num_pending() const {
+  MutexLockGuard guard(lock_);
+  return num_pending_;
+}
+
+}  // namespace lru
@@ -0,0 +1,192 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * A serialized copy of the md5path cache.  It carries the hot meta-data of a
+ * mount point over a reload (in memory) or over a remount or a reboot (on
+ * disk, in the workspace).  Snapshots are tied to the root catalog they were
+ * taken from and are rejected if the repository moved on in the meantime.
+ */
+
+#ifndef CVMFS_LRU_SNAPSHOT_H_
+#define CVMFS_LRU_SNAPSHOT_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "directory_entry.h"
+#include "hash.h"
+#include "shortstring.h"
+#include "util/single_copy.h"
+
+class MemoryMappedFile;
+
+namespace lru {
+
+class Md5PathCache;
+class Md5PathRestorer;
+
+/**
+ * Translates inodes into inodes relative to the catalog that issued them.
+ * Relative inodes are stable for a given catalog, unlike the inode ranges
+ * that are assigned when catalogs are attached.
+ */
+class InodeResolver {
+ public:
+  virtual ~InodeResolver() { }
+  virtual bool Relativize(const uint64_t inode,
+                          PathString *catalog_mountpoint,
+                          shash::Any *catalog_hash,
+                          uint64_t *relative_inode) = 0;
+};
+
+
+/**
+ * Entries are stored in the LRU order of their shards, so that restoring them
+ * preserves the recency information as long as the number of shards does not
+ * change.  Instead of the inode, entries store their catalog and their inode
+ * relative to that catalog.  Restored entries carry the invalid inode until
+ * the Md5PathRestorer sees their catalog attached.  Hard links and entries
+ * whose inode was not issued by an attached catalog keep the invalid inode
+ * (see GetDirentForPath() in cvmfs.cc).
+ */
+class Md5PathSnapshot : SingleCopy {
+ public:
+  static const unsigned kVersion = 2;
+
+  static Md5PathSnapshot *Create(const shash::Any &catalog_hash,
+                                 Md5PathCache *cache,
+                                 InodeResolver *resolver);
+  static Md5PathSnapshot *Open(const std::string &path);
+  ~Md5PathSnapshot();
+
+  bool Write(const std::string &path) const;
+  unsigned Restore(const shash::Any &catalog_hash,
+                   Md5PathCache *cache,
+                   Md5PathRestorer *restorer) const;
+
+  shash::Any catalog_hash() const { return catalog_hash_; }
+  unsigned num_entries() const { return num_entries_; }
+  size_t size() const { return size_; }
+
+ private:
+  /**
+   * Written at the beginning of the snapshot, followed by the catalogs and
+   * the entries
+   */
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_entries;
+    uint32_t num_catalogs;
+    uint8_t hash_algorithm;
+    uint8_t hash_suffix;
+    unsigned char hash_digest[shash::kMaxDigestSize];
+  };
+
+  static const char kMagic[8];
+  static const uint32_t kNoCatalog = uint32_t(-1);
+
+  Md5PathSnapshot();
+  bool ParseHeader();
+
+  static void SerializeCatalog(const PathString &mountpoint,
+                               const shash::Any &hash,
+                               std::string *buffer);
+  static bool DeserializeCatalog(const unsigned char *buffer,
+                                 const size_t size,
+                                 size_t *pos,
+                                 PathString *mountpoint,
+                                 shash::Any *hash);
+  static void Serialize(const shash::Md5 &md5path,
+                        const catalog::DirectoryEntry &dirent,
+                        const uint32_t catalog,
+                        const uint64_t relative_inode,
+                        std::string *buffer);
+  static bool Deserialize(const unsigned char *buffer,
+                          const size_t size,
+                          size_t *pos,
+                          shash::Md5 *md5path,
+                          catalog::DirectoryEntry *dirent,
+                          uint32_t *catalog,
+                          uint64_t *relative_inode);
+
+  /**
+   * Either the snapshot is owned in memory or it is a mapped file
+   */
+  std::string data_;
+  MemoryMappedFile *mapped_file_;
+  const unsigned char *buffer_;
+  size_t size_;
+
+  shash::Any catalog_hash_;
+  unsigned num_entries_;
+  unsigned num_catalogs_;
+};
+
+
+/**
+ * Completes the inodes of restored md5path cache entries once their catalog
+ * is attached.  Pending entries are matched by catalog mount point and hash,
+ * so that entries of a catalog that changed in the meantime stay without
+ * inode.  Entries that were evicted from the cache in the meantime are not
+ * brought back.
+ */
+class Md5PathRestorer : SingleCopy {
+  friend class Md5PathSnapshot;
+
+ public:
+  explicit Md5PathRestorer(Md5PathCache *cache);
+  ~Md5PathRestorer();
+
+  /**
+   * Called by the catalog manager for every attached catalog.  Templated so
+   * that it does not depend on the catalog class.
+   */
+  template <class CatalogT>
+  void OnCatalog(const CatalogT &catalog) {
+    std::vector<PendingEntry> entries;
+    if (!TakePending(catalog.mountpoint(), catalog.hash(), &entries))
+      return;
+    for (unsigned i = 0; i < entries.size(); ++i) {
+      entries[i].dirent.set_inode(
+        catalog.GetMangledInode(entries[i].relative_inode, 0));
+    }
+    Complete(entries);
+  }
+
+  void Clear();
+  unsigned num_pending() const;
+
+ private:
+  struct PendingEntry {
+    PendingEntry() : relative_inode(0) { }
+    shash::Md5 md5path;
+    catalog::DirectoryEntry dirent;
+    uint64_t relative_inode;
+  };
+  struct PendingCatalog {
+    shash::Any hash;
+    std::vector<PendingEntry> entries;
+  };
+
+  void AddPending(const PathString &catalog_mountpoint,
+                  const shash::Any &catalog_hash,
+                  const PendingEntry &entry);
+  bool TakePending(const PathString &catalog_mountpoint,
+                   const shash::Any &catalog_hash,
+                   std::vector<PendingEntry> *entries);
+  void Complete(const std::vector<PendingEntry> &entries);
+
+  Md5PathCache *cache_;
+  std::map<PathString, PendingCatalog> pending_;
+  unsigned num_pending_;
+  pthread_mutex_t *lock_;
+};
+
+}  // namespace lru
+
+#endif  // CVMFS_LRU_SNAPSHOT_H_
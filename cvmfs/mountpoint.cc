@@ -7,12 +7,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdint.h>
 #include <unistd.h>
 
 #include <algorithm>
 #include <cassert>
 #include <climits>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 
@@ -37,6 +39,8 @@
 #include "cache_tiered.h"
 #include "catalog.h"
 #include "catalog_mgr_client.h"
+#include "catalog_prefetch.h"
+#include "chunk_prefetch.h"
 #include "clientctx.h"
 #include "download.h"
 #include "duplex_sqlite3.h"
@@ -49,6 +53,7 @@
 #include "history_sqlite.h"
 #include "logging.h"
 #include "lru_md.h"
+#include "lru_snapshot.h"
 #include "manifest.h"
 #include "manifest_fetch.h"
 #include "nfs_maps.h"
@@ -75,6 +80,31 @@
 using namespace std;  // NOLINT
 
 
+namespace {
+
+/**
+ * Lets the md5path cache snapshot store inodes relative to their catalogs
+ */
+class CatalogInodeResolver : public lru::InodeResolver {
+ public:
+  explicit CatalogInodeResolver(catalog::ClientCatalogManager *catalog_mgr)
+    : catalog_mgr_(catalog_mgr) { }
+  virtual bool Relativize(const uint64_t inode,
+                          PathString *catalog_mountpoint,
+                          shash::Any *catalog_hash,
+                          uint64_t *relative_inode)
+  {
+    return catalog_mgr_->RelativizeInode(inode, catalog_mountpoint,
+                                         catalog_hash, relative_inode);
+  }
+
+ private:
+  catalog::ClientCatalogManager *catalog_mgr_;
+};
+
+}  // anonymous namespace
+
+
 bool FileSystem::g_alive = false;
 const char *FileSystem::kDefaultCacheBase = "/var/lib/cvmfs";
 const char *FileSystem::kDefaultCacheMgrInstance = "default";
@@ -269,6 +299,21 @@ FileSystem::PosixCacheSettings FileSystem::DeterminePosixCacheSettings(
   }
   if (settings.quota_limit > 0)
     settings.is_managed = true;
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_QUOTA_BACKEND", instance),
+                             &optarg))
+  {
+    if (optarg == "memory") {
+      settings.quota_in_memory = true;
+    } else if (optarg != "sqlite") {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "unknown quota backend %s, using sqlite", optarg.c_str());
+    }
+  }
+  if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_UNLINK_RATE", instance),
+                             &optarg))
+  {
+    settings.quota_unlink_rate = String2Uint64(optarg);
+  }
 
   settings.cache_path = kDefaultCacheBase;
   if (options_mgr_->GetValue(MkCacheParm("CVMFS_CACHE_BASE", instance),
@@ -904,6 +949,8 @@ bool FileSystem::SetupPosixQuotaMgr(
              settings.workspace.c_str(), settings.cache_path.c_str());
     cache_workspace += ":" + settings.workspace;
   }
+  const PosixQuotaManager::Backend backend = settings.quota_in_memory ?
+    PosixQuotaManager::kBackendMemory : PosixQuotaManager::kBackendSqlite;
   PosixQuotaManager *quota_mgr;
 
   if (settings.is_shared) {
@@ -912,7 +959,9 @@ bool FileSystem::SetupPosixQuotaMgr(
                   cache_workspace,
                   settings.quota_limit,
                   quota_threshold,
-                  foreground_);
+                  foreground_,
+                  backend,
+                  settings.quota_unlink_rate);
     if (quota_mgr == NULL) {
       boot_error_ = "Failed to initialize shared lru cache";
       boot_status_ = loader::kFailQuota;
@@ -923,7 +972,9 @@ bool FileSystem::SetupPosixQuotaMgr(
                   cache_workspace,
                   settings.quota_limit,
                   quota_threshold,
-                  found_previous_crash_);
+                  found_previous_crash_,
+                  backend,
+                  settings.quota_unlink_rate);
     if (quota_mgr == NULL) {
       boot_error_ = "Failed to initialize lru cache";
       boot_status_ = loader::kFailQuota;
@@ -1202,6 +1253,40 @@ bool MountPoint::CreateCatalogManager() {
   string optarg;
 
   catalog_mgr_ = new catalog::ClientCatalogManager(this);
+  if (options_mgr_->GetValue("CVMFS_CATALOG_INDEX", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    uint64_t max_entries = kDefaultCatalogIndexMaxEntries;
+    if (options_mgr_->GetValue("CVMFS_CATALOG_INDEX_MAX_ENTRIES", &optarg))
+      max_entries = String2Uint64(optarg);
+    catalog_mgr_->EnableCatalogIndex(max_entries);
+  }
+  unsigned num_catalog_connections = 1;
+  if (options_mgr_->GetValue("CVMFS_CATALOG_CONNECTIONS", &optarg) &&
+      (String2Uint64(optarg) > 0))
+  {
+    if (String2Uint64(optarg) > kMaxCatalogConnections) {
+      LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+               "CVMFS_CATALOG_CONNECTIONS limited to %u",
+               kMaxCatalogConnections);
+      num_catalog_connections = kMaxCatalogConnections;
+    } else {
+      num_catalog_connections = String2Uint64(optarg);
+    }
+    catalog_mgr_->SetNumCatalogConnections(num_catalog_connections);
+  }
+  // Needs the spawned worker thread, i.e. the fuse module
+  if ((file_system_->type() == FileSystem::kFsFuse) &&
+      options_mgr_->GetValue("CVMFS_CATALOG_PREFETCH", &optarg) &&
+      (String2Uint64(optarg) > 0))
+  {
+    catalog_prefetcher_ = new catalog::CatalogPrefetcher(
+      file_system_->workspace() + "/catalog_history." + fqrn_, fetcher_,
+      String2Uint64(optarg),
+      perf::StatisticsTemplate("catalog_prefetch", statistics_));
+    catalog_prefetcher_->Load();
+    catalog_mgr_->SetCatalogPrefetcher(catalog_prefetcher_);
+  }
 
   SetupInodeAnnotation();
   if (!SetupOwnerMaps())
@@ -1244,7 +1329,9 @@ bool MountPoint::CreateCatalogManager() {
     unsigned soft_limit;
     unsigned hard_limit;
     GetLimitNoFile(&soft_limit, &hard_limit);
-    catalog_mgr_->SetCatalogWatermark(soft_limit / 4);
+    // Every catalog connection uses a file descriptor
+    catalog_mgr_->SetCatalogWatermark(
+      soft_limit / (4 * num_catalog_connections));
   }
 
   if (catalog_mgr_->volatile_flag()) {
@@ -1416,16 +1503,36 @@ void MountPoint::CreateStatistics() {
 
 
 void MountPoint::CreateTables() {
+  string optarg;
+  unsigned memcache_shards = kDefaultMemcacheShards;
+  if (options_mgr_->GetValue("CVMFS_MEMCACHE_SHARDS", &optarg))
+    memcache_shards = String2Uint64(optarg);
+  lru::RecencyMode memcache_recency = lru::kRecencyLru;
+  if (options_mgr_->GetValue("CVMFS_MEMCACHE_CLOCK", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    memcache_recency = lru::kRecencyClock;
+  }
+
   if (file_system_->type() != FileSystem::kFsFuse) {
     // Libcvmfs simplified tables
-    md5path_cache_ = new lru::Md5PathCache(kLibPathCacheSize, statistics_);
+    md5path_cache_ = new lru::Md5PathCache(kLibPathCacheSize, statistics_,
+                                           memcache_shards, memcache_recency);
+    md5path_cache_->SetAdmissionPolicy(CreateAdmissionPolicy(
+      "CVMFS_MD5PATH_CACHE_ADMISSION", kLibPathCacheSize, "md5_path_cache"));
     simple_chunk_tables_ = new SimpleChunkTables();
     return;
   }
 
   chunk_tables_ = new ChunkTables();
 
-  string optarg;
+  unsigned chunk_readahead = kDefaultChunkReadahead;
+  if (options_mgr_->GetValue("CVMFS_CHUNK_READAHEAD", &optarg))
+    chunk_readahead = String2Uint64(optarg);
+  chunk_prefetcher_ = new cvmfs::ChunkPrefetcher(
+    fetcher_, external_fetcher_, chunk_readahead,
+    perf::StatisticsTemplate("readahead", statistics_));
+
   uint64_t mem_cache_size = kDefaultMemcacheSize;
   if (options_mgr_->GetValue("CVMFS_MEMCACHE_SIZE", &optarg))
     mem_cache_size = String2Uint64(optarg) * 1024 * 1024;
@@ -1437,13 +1544,187 @@ void MountPoint::CreateTables() {
     mem_cache_size / static_cast<unsigned>(memcache_unit_size);
   // Number of cache entries must be a multiple of 64
   const unsigned mask_64 = ~((1 << 6) - 1);
-  inode_cache_ = new lru::InodeCache(memcache_num_units & mask_64, statistics_);
-  path_cache_ = new lru::PathCache(memcache_num_units & mask_64, statistics_);
-  md5path_cache_ = new lru::Md5PathCache((memcache_num_units * 7) & mask_64,
-                                         statistics_);
+  const unsigned inode_cache_size = memcache_num_units & mask_64;
+  const unsigned md5path_cache_size = (memcache_num_units * 7) & mask_64;
+  inode_cache_ = new lru::InodeCache(inode_cache_size, statistics_,
+                                     memcache_shards, memcache_recency);
+  inode_cache_->SetAdmissionPolicy(CreateAdmissionPolicy(
+    "CVMFS_INODE_CACHE_ADMISSION", inode_cache_size, "inode_cache"));
+  path_cache_ = new lru::PathCache(inode_cache_size, statistics_,
+                                   memcache_shards, memcache_recency);
+  path_cache_->SetAdmissionPolicy(CreateAdmissionPolicy(
+    "CVMFS_PATH_CACHE_ADMISSION", inode_cache_size, "path_cache"));
+  md5path_cache_ = new lru::Md5PathCache(md5path_cache_size, statistics_,
+                                         memcache_shards, memcache_recency);
+  md5path_cache_->SetAdmissionPolicy(CreateAdmissionPolicy(
+    "CVMFS_MD5PATH_CACHE_ADMISSION", md5path_cache_size, "md5_path_cache"));
 
   inode_tracker_ = new glue::InodeTracker();
   nentry_tracker_ = new glue::NentryTracker();
+
+  if (options_mgr_->GetValue("CVMFS_MEMCACHE_SNAPSHOT", &optarg) &&
+      options_mgr_->IsOn(optarg))
+  {
+    memcache_snapshot_path_ = file_system_->workspace() + "/memcache." + fqrn_;
+    memcache_snapshot_interval_s_ = kDefaultMemcacheSnapshotIntervalSec;
+    if (options_mgr_->GetValue("CVMFS_MEMCACHE_SNAPSHOT_INTERVAL", &optarg))
+      memcache_snapshot_interval_s_ = String2Uint64(optarg);
+    LoadMemcacheSnapshot();
+  }
+}
+
+
+/**
+ * Warms up the md5path cache with the snapshot written by the previous mount,
+ * unless the root catalog changed in the meantime.
+ */
+void MountPoint::LoadMemcacheSnapshot() {
+  UniquePtr<lru::Md5PathSnapshot> snapshot(
+    lru::Md5PathSnapshot::Open(memcache_snapshot_path_));
+  if (!snapshot.IsValid())
+    return;
+  const unsigned num_restored = RestoreMemcacheSnapshot(*snapshot);
+  LogCvmfs(kLogCvmfs, kLogDebug,
+           "restored %u out of %u md5path cache entries from %s",
+           num_restored, snapshot->num_entries(),
+           memcache_snapshot_path_.c_str());
+}
+
+
+/**
+ * Serializes the md5path cache.  Inodes are stored relative to their catalog,
+ * except in NFS mode, where they come from the NFS maps.
+ */
+lru::Md5PathSnapshot *MountPoint::CreateMemcacheSnapshot() {
+  if (file_system_->IsNfsSource()) {
+    return lru::Md5PathSnapshot::Create(catalog_mgr_->GetRootHash(),
+                                        md5path_cache_, NULL);
+  }
+  CatalogInodeResolver resolver(catalog_mgr_);
+  return lru::Md5PathSnapshot::Create(catalog_mgr_->GetRootHash(),
+                                      md5path_cache_, &resolver);
+}
+
+
+/**
+ * Replaces the content of the md5path cache by the snapshot.  The inodes of
+ * the restored entries are completed as their catalogs get attached.
+ * @return the number of restored entries
+ */
+unsigned MountPoint::RestoreMemcacheSnapshot(
+  const lru::Md5PathSnapshot &snapshot)
+{
+  md5path_cache_->Drop();
+  if (file_system_->IsNfsSource()) {
+    return snapshot.Restore(catalog_mgr_->GetRootHash(), md5path_cache_, NULL);
+  }
+
+  if (md5path_restorer_ == NULL)
+    md5path_restorer_ = new lru::Md5PathRestorer(md5path_cache_);
+  else
+    md5path_restorer_->Clear();
+  const unsigned num_restored = snapshot.Restore(
+    catalog_mgr_->GetRootHash(), md5path_cache_, md5path_restorer_);
+  catalog_mgr_->SetMd5PathRestorer(md5path_restorer_);
+  return num_restored;
+}
+
+
+/**
+ * Stores the md5path cache in the workspace, if CVMFS_MEMCACHE_SNAPSHOT is
+ * set.  Called on unmount and periodically by the snapshot writer.
+ */
+bool MountPoint::WriteMemcacheSnapshot() {
+  if (memcache_snapshot_path_.empty() || (catalog_mgr_ == NULL))
+    return false;
+  // Keep the previous snapshot if the mount point didn't get to serve requests
+  if (md5path_cache_->IsEmpty())
+    return false;
+  UniquePtr<lru::Md5PathSnapshot> snapshot(CreateMemcacheSnapshot());
+  if (!snapshot->Write(memcache_snapshot_path_)) {
+    LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+             "failed to write md5path cache snapshot to %s",
+             memcache_snapshot_path_.c_str());
+    return false;
+  }
+  LogCvmfs(kLogCvmfs, kLogDebug, "wrote %u md5path cache entries to %s",
+           snapshot->num_entries(), memcache_snapshot_path_.c_str());
+  return true;
+}
+
+
+void MountPoint::SpawnMemcacheSnapshotWriter() {
+  if (memcache_snapshot_path_.empty() || (memcache_snapshot_interval_s_ == 0))
+    return;
+  assert(pipe_memcache_snapshot_[0] == -1);
+  MakePipe(pipe_memcache_snapshot_);
+  int retval = pthread_create(&thread_memcache_snapshot_, NULL,
+                              MainMemcacheSnapshotWriter, this);
+  assert(retval == 0);
+}
+
+
+void *MountPoint::MainMemcacheSnapshotWriter(void *data) {
+  MountPoint *mount_point = reinterpret_cast<MountPoint *>(data);
+  LogCvmfs(kLogCvmfs, kLogDebug, "starting md5path cache snapshot writer");
+
+  struct pollfd watch_term;
+  watch_term.fd = mount_point->pipe_memcache_snapshot_[0];
+  watch_term.events = POLLIN | POLLPRI;
+  const int interval_ms = mount_point->memcache_snapshot_interval_s_ * 1000;
+  int timeout_ms = interval_ms;
+  uint64_t deadline = platform_monotonic_time() + timeout_ms / 1000;
+  while (true) {
+    watch_term.revents = 0;
+    int retval = poll(&watch_term, 1, timeout_ms);
+    if (retval < 0) {
+      if (errno == EINTR) {
+        uint64_t now = platform_monotonic_time();
+        timeout_ms = (now > deadline) ? 0 : (deadline - now) * 1000;
+        continue;
+      }
+      abort();
+    }
+    timeout_ms = interval_ms;
+    deadline = platform_monotonic_time() + timeout_ms / 1000;
+
+    if (retval == 0) {
+      mount_point->WriteMemcacheSnapshot();
+      continue;
+    }
+
+    assert(watch_term.revents != 0);
+
+    char c = 0;
+    ReadPipe(mount_point->pipe_memcache_snapshot_[0], &c, 1);
+    assert(c == 'T');
+    break;
+  }
+  LogCvmfs(kLogCvmfs, kLogDebug, "stopping md5path cache snapshot writer");
+  return NULL;
+}
+
+
+/**
+ * Reads the admission policy of a meta-data cache from the given parameter.
+ * Returns NULL if all new entries should be admitted, which is the default.
+ */
+lru::AdmissionPolicy *MountPoint::CreateAdmissionPolicy(
+  const string &parameter,
+  const unsigned cache_size,
+  const string &cache_name)
+{
+  string optarg;
+  if (!options_mgr_->GetValue(parameter, &optarg) || (optarg == "none"))
+    return NULL;
+  if (optarg == "tinylfu") {
+    return new lru::TinyLfuPolicy(cache_size,
+      perf::StatisticsTemplate(cache_name + ".tinylfu", statistics_));
+  }
+  LogCvmfs(kLogCvmfs, kLogDebug | kLogSyslogWarn,
+           "unknown admission policy %s=%s, admitting all entries",
+           parameter.c_str(), optarg.c_str());
+  return NULL;
 }
 
 /**
@@ -1635,7 +1916,9 @@ MountPoint::MountPoint(
   , external_fetcher_(NULL)
   , inode_annotation_(NULL)
   , catalog_mgr_(NULL)
+  , catalog_prefetcher_(NULL)
   , chunk_tables_(NULL)
+  , chunk_prefetcher_(NULL)
   , simple_chunk_tables_(NULL)
   , inode_cache_(NULL)
   , path_cache_(NULL)
@@ -1649,16 +1932,27 @@ MountPoint::MountPoint(
   , fixed_catalog_(false)
   , hide_magic_xattrs_(false)
   , enforce_acls_(false)
+  , zero_copy_read_(true)
+  , memcache_snapshot_interval_s_(0)
+  , md5path_restorer_(NULL)
   , has_membership_req_(false)
 {
   int retval = pthread_mutex_init(&lock_max_ttl_, NULL);
   assert(retval == 0);
+  pipe_memcache_snapshot_[0] = pipe_memcache_snapshot_[1] = -1;
 }
 
 
 MountPoint::~MountPoint() {
   pthread_mutex_destroy(&lock_max_ttl_);
 
+  if (pipe_memcache_snapshot_[1] >= 0) {
+    char t = 'T';
+    WritePipe(pipe_memcache_snapshot_[1], &t, 1);
+    pthread_join(thread_memcache_snapshot_, NULL);
+    ClosePipe(pipe_memcache_snapshot_);
+  }
+
   delete nentry_tracker_;
   delete inode_tracker_;
   delete tracer_;
@@ -1666,9 +1960,12 @@ MountPoint::~MountPoint() {
   delete path_cache_;
   delete inode_cache_;
   delete simple_chunk_tables_;
+  delete chunk_prefetcher_;
   delete chunk_tables_;
 
   delete catalog_mgr_;
+  delete catalog_prefetcher_;
+  delete md5path_restorer_;
   delete inode_annotation_;
   delete external_fetcher_;
   delete fetcher_;
@@ -1740,6 +2037,12 @@ void MountPoint::SetupBehavior() {
   {
     enforce_acls_ = true;
   }
+
+  if (options_mgr_->GetValue("CVMFS_ZERO_COPY_READ", &optarg)
+      && !options_mgr_->IsOn(optarg))
+  {
+    zero_copy_read_ = false;
+  }
 }
 
 
@@ -1872,6 +2175,9 @@ void MountPoint::SetupHttpTuning() {
     backoff_max = String2Uint64(optarg) * 1000;
   download_mgr_->SetRetryParameters(max_retries, backoff_init, backoff_max);
 
+  if (options_mgr_->GetValue("CVMFS_DOWNLOAD_THREADS", &optarg))
+    download_mgr_->SetNumWorkers(String2Uint64(optarg));
+
   if (options_mgr_->GetValue("CVMFS_LOW_SPEED_LIMIT", &optarg))
     download_mgr_->SetLowSpeedLimit(String2Uint64(optarg));
   if (options_mgr_->GetValue("CVMFS_PROXY_RESET_AFTER", &optarg))
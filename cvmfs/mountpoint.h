@@ -29,11 +29,13 @@ class AuthzSessionManager;
 class BackoffThrottle;
 class CacheManager;
 namespace catalog {
+class CatalogPrefetcher;
 class ClientCatalogManager;
 class InodeAnnotation;
 }
 struct ChunkTables;
 namespace cvmfs {
+class ChunkPrefetcher;
 class Fetcher;
 class Uuid;
 }
@@ -45,8 +47,11 @@ class InodeTracker;
 class NentryTracker;
 }
 namespace lru {
+class AdmissionPolicy;
 class InodeCache;
 class Md5PathCache;
+class Md5PathRestorer;
+class Md5PathSnapshot;
 class PathCache;
 }
 class NfsMaps;
@@ -219,7 +224,7 @@ class FileSystem : SingleCopy, public BootFactory {
     PosixCacheSettings() :
       is_shared(false), is_alien(false), is_managed(false),
       avoid_rename(false), cache_base_defined(false), cache_dir_defined(false),
-      quota_limit(0)
+      quota_limit(0), quota_in_memory(false), quota_unlink_rate(0)
       { }
     bool is_shared;
     bool is_alien;
@@ -232,6 +237,16 @@ class FileSystem : SingleCopy, public BootFactory {
      * cache when the limit is exceeded.
      */
     int64_t quota_limit;
+    /**
+     * Use the in-memory cache index instead of the SQlite cache database for
+     * the quota manager bookkeeping.
+     */
+    bool quota_in_memory;
+    /**
+     * Maximum number of evicted files removed per second during a cleanup,
+     * 0 means unlimited.
+     */
+    unsigned quota_unlink_rate;
     std::string cache_path;
     /**
      * Different from cache_path only if CVMFS_WORKSPACE or
@@ -406,7 +421,11 @@ class MountPoint : SingleCopy, public BootFactory {
   AuthzSessionManager *authz_session_mgr() { return authz_session_mgr_; }
   BackoffThrottle *backoff_throttle() { return backoff_throttle_; }
   catalog::ClientCatalogManager *catalog_mgr() { return catalog_mgr_; }
+  catalog::CatalogPrefetcher *catalog_prefetcher() {
+    return catalog_prefetcher_;
+  }
   ChunkTables *chunk_tables() { return chunk_tables_; }
+  cvmfs::ChunkPrefetcher *chunk_prefetcher() { return chunk_prefetcher_; }
   download::DownloadManager *download_mgr() { return download_mgr_; }
   download::DownloadManager *external_download_mgr() {
     return external_download_mgr_;
@@ -422,6 +441,7 @@ class MountPoint : SingleCopy, public BootFactory {
   bool has_membership_req() { return has_membership_req_; }
   bool hide_magic_xattrs() { return hide_magic_xattrs_; }
   bool enforce_acls() { return enforce_acls_; }
+  bool zero_copy_read() { return zero_copy_read_; }
   catalog::InodeAnnotation *inode_annotation() {
     return inode_annotation_;
   }
@@ -440,6 +460,10 @@ class MountPoint : SingleCopy, public BootFactory {
   cvmfs::Uuid *uuid() { return uuid_; }
 
   bool ReloadBlacklists();
+  lru::Md5PathSnapshot *CreateMemcacheSnapshot();
+  unsigned RestoreMemcacheSnapshot(const lru::Md5PathSnapshot &snapshot);
+  bool WriteMemcacheSnapshot();
+  void SpawnMemcacheSnapshotWriter();
 
  private:
   /**
@@ -463,6 +487,31 @@ class MountPoint : SingleCopy, public BootFactory {
    * Default to 16M RAM for meta-data caches; does not include the inode tracker
    */
   static const unsigned kDefaultMemcacheSize = 16 * 1024 * 1024;
+  /**
+   * The meta-data caches are only split into independently locked shards if
+   * CVMFS_MEMCACHE_SHARDS is set.
+   */
+  static const unsigned kDefaultMemcacheShards = 1;
+  /**
+   * With CVMFS_MEMCACHE_SNAPSHOT, the md5path cache is also written to disk
+   * every 15 minutes, so that a crash or a reboot does not lose it.
+   */
+  static const unsigned kDefaultMemcacheSnapshotIntervalSec = 900;
+  /**
+   * Number of chunks of a sequentially read file that are fetched ahead of the
+   * reader.  Disabled by default.
+   */
+  static const unsigned kDefaultChunkReadahead = 0;
+  /**
+   * Larger catalogs are not indexed in memory.  At about 220 bytes per entry,
+   * the largest index takes some 45MB.
+   */
+  static const unsigned kDefaultCatalogIndexMaxEntries = 200000;
+  /**
+   * Every catalog connection uses a file descriptor; the catalog watermark is
+   * divided by the number of connections.
+   */
+  static const unsigned kMaxCatalogConnections = 8;
   /**
    * Where to look for external authz helpers.
    */
@@ -498,6 +547,11 @@ class MountPoint : SingleCopy, public BootFactory {
   void CreateFetchers();
   bool CreateCatalogManager();
   void CreateTables();
+  lru::AdmissionPolicy *CreateAdmissionPolicy(const std::string &parameter,
+                                              const unsigned cache_size,
+                                              const std::string &cache_name);
+  void LoadMemcacheSnapshot();
+  static void *MainMemcacheSnapshotWriter(void *data);
   bool CreateTracer();
   void SetupBehavior();
   void SetupDnsTuning(download::DownloadManager *manager);
@@ -533,7 +587,9 @@ class MountPoint : SingleCopy, public BootFactory {
   cvmfs::Fetcher *external_fetcher_;
   catalog::InodeAnnotation *inode_annotation_;
   catalog::ClientCatalogManager *catalog_mgr_;
+  catalog::CatalogPrefetcher *catalog_prefetcher_;
   ChunkTables *chunk_tables_;
+  cvmfs::ChunkPrefetcher *chunk_prefetcher_;
   SimpleChunkTables *simple_chunk_tables_;
   lru::InodeCache *inode_cache_;
   lru::PathCache *path_cache_;
@@ -550,8 +606,29 @@ class MountPoint : SingleCopy, public BootFactory {
   bool fixed_catalog_;
   bool hide_magic_xattrs_;
   bool enforce_acls_;
+  /**
+   * Reply to reads from the posix cache with file descriptors instead of
+   * buffers, see CVMFS_ZERO_COPY_READ
+   */
+  bool zero_copy_read_;
   std::string repository_tag_;
   std::vector<std::string> blacklist_paths_;
+  /**
+   * Location of the on-disk md5path cache snapshot, empty if disabled
+   */
+  std::string memcache_snapshot_path_;
+  /**
+   * The on-disk snapshot is rewritten every so many seconds, 0 if only on
+   * unmount
+   */
+  unsigned memcache_snapshot_interval_s_;
+  int pipe_memcache_snapshot_[2];
+  pthread_t thread_memcache_snapshot_;
+  /**
+   * Completes the inodes of restored md5path cache entries, NULL if nothing
+   * was restored
+   */
+  lru::Md5PathRestorer *md5path_restorer_;
 
   // TODO(jblomer): this should go in the catalog manager
   std::string membership_req_;
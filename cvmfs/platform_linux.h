@@ -19,6 +19,8 @@
 #include <mntent.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/file.h>
 #include <sys/mount.h>
 #include <sys/prctl.h>
@@ -158,6 +160,38 @@ inline void platform_spinlock_unlock(platform_spinlock *lock) {
   pthread_spin_unlock(lock);
 }
 
+/**
+ * Wake-up notifications for a poll() loop.  On Linux, this is an eventfd and
+ * the read and the write end are the same file descriptor.  Multiple
+ * notifications before a drain collapse into one.
+ */
+inline void platform_make_eventfd(int fds[2]) {
+  fds[0] = fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  assert(fds[0] >= 0);
+}
+
+inline void platform_close_eventfd(int fds[2]) {
+  close(fds[0]);
+  fds[0] = fds[1] = -1;
+}
+
+inline void platform_notify_eventfd(int fds[2]) {
+  const uint64_t one = 1;
+  ssize_t retval;
+  do {
+    retval = write(fds[1], &one, sizeof(one));
+  } while ((retval < 0) && (errno == EINTR));
+  assert((retval == sizeof(one)) || (errno == EAGAIN));
+}
+
+inline void platform_drain_eventfd(int fds[2]) {
+  uint64_t counter;
+  ssize_t retval;
+  do {
+    retval = read(fds[0], &counter, sizeof(counter));
+  } while ((retval < 0) && (errno == EINTR));
+}
+
 /**
  * pthread_self() is not necessarily an unsigned long.
  */
@@ -215,6 +249,14 @@ inline int platform_lstat(const char *path, platform_stat64 *buf) {
   return lstat64(path, buf);
 }
 
+/**
+ * lstat() of a path relative to the directory dirfd
+ */
+inline int platform_fstatat(int dirfd, const char *path, platform_stat64 *buf)
+{
+  return fstatat64(dirfd, path, buf, AT_SYMLINK_NOFOLLOW);
+}
+
 inline int platform_fstat(int filedes, platform_stat64 *buf) {
   return fstat64(filedes, buf);
 }
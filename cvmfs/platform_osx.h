@@ -9,6 +9,7 @@
 
 #include <alloca.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #if defined(__MAC_OS_X_VERSION_MIN_REQUIRED) && \
     __MAC_OS_X_VERSION_MIN_REQUIRED >= 101200
@@ -28,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/ucred.h>
 #include <sys/xattr.h>
+#include <unistd.h>
 
 #include <cassert>
 #include <cstdio>
@@ -117,6 +119,46 @@ inline void platform_spinlock_unlock(platform_spinlock *lock) {
 
 #endif
 
+/**
+ * Wake-up notifications for a poll() loop.  There is no eventfd on OS X, so
+ * this is a non-blocking pipe.  Multiple notifications before a drain
+ * collapse into one.
+ */
+inline void platform_make_eventfd(int fds[2]) {
+  int retval = pipe(fds);
+  assert(retval == 0);
+  for (unsigned i = 0; i < 2; ++i) {
+    retval = fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    assert(retval == 0);
+    retval = fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    assert(retval == 0);
+  }
+}
+
+inline void platform_close_eventfd(int fds[2]) {
+  close(fds[0]);
+  close(fds[1]);
+  fds[0] = fds[1] = -1;
+}
+
+inline void platform_notify_eventfd(int fds[2]) {
+  const char c = 'N';
+  ssize_t retval;
+  do {
+    retval = write(fds[1], &c, 1);
+  } while ((retval < 0) && (errno == EINTR));
+  // A full pipe has notifications pending already
+  assert((retval == 1) || (errno == EAGAIN));
+}
+
+inline void platform_drain_eventfd(int fds[2]) {
+  char buf[64];
+  ssize_t retval;
+  do {
+    retval = read(fds[0], buf, sizeof(buf));
+  } while ((retval > 0) || ((retval < 0) && (errno == EINTR)));
+}
+
 /**
  * pthread_self() is not necessarily an unsigned long.
  */
@@ -159,6 +201,14 @@ inline int platform_lstat(const char *path, platform_stat64 *buf) {
   return lstat(path, buf);
 }
 
+/**
+ * lstat() of a path relative to the directory dirfd
+ */
+inline int platform_fstatat(int dirfd, const char *path, platform_stat64 *buf)
+{
+  return fstatat(dirfd, path, buf, AT_SYMLINK_NOFOLLOW);
+}
+
 inline int platform_fstat(int filedes, platform_stat64 *buf) {
   return fstat(filedes, buf);
 }
@@ -0,0 +1,641 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#define __STDC_LIMIT_MACROS
+
+#include "cvmfs_config.h"
+#include "quota_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "logging.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+const char QuotaIndex::kMagic[8] = { 'C', 'V', 'M', 'F', 'S', 'Q', 'I', 'X' };
+
+namespace {
+
+/**
+ * Written at the beginning of the checkpoint and of the journal
+ */
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+};
+
+const uint8_t kFlagCatalog = 0x01;
+const uint8_t kFlagVolatile = 0x02;
+
+/**
+ * Above this size, the checkpoint is written in pieces
+ */
+const unsigned kCheckpointBuffer = 1024 * 1024;
+
+}  // anonymous namespace
+
+
+QuotaIndex::QuotaIndex(const string &path)
+  : path_(path)
+  , fd_journal_(-1)
+  , num_journal_records_(0)
+  , gauge_(0)
+  , max_seq_(0)
+{
+  entries_.Init(1024, shash::Any(), hasher_any);
+}
+
+
+QuotaIndex::~QuotaIndex() {
+  if (fd_journal_ >= 0) {
+    if (!Checkpoint())
+      FlushJournal();
+    close(fd_journal_);
+  }
+}
+
+
+/**
+ * Recovers the index from the checkpoint and the journal under the given path
+ * prefix.  An invalid checkpoint results in an empty index.  The recovered
+ * state is immediately written into a new checkpoint.
+ *
+ * @return NULL if the checkpoint cannot be written
+ */
+QuotaIndex *QuotaIndex::Open(const string &path) {
+  UniquePtr<QuotaIndex> index(new QuotaIndex(path));
+
+  unsigned num_records = 0;
+  if (index->Replay(path, &num_records)) {
+    if (!index->Replay(index->journal_path(), &num_records)) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+               "cache index journal %s truncated after %u records",
+               index->journal_path().c_str(), num_records);
+    }
+  } else {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
+             "ignoring invalid cache index %s", path.c_str());
+    index->Clear();
+  }
+  LogCvmfs(kLogQuota, kLogDebug,
+           "recovered %u cache index entries from %u records",
+           index->num_entries(), num_records);
+
+  if (!index->Checkpoint())
+    return NULL;
+  return index.Release();
+}
+
+
+bool QuotaIndex::Contains(const shash::Any &hash) const {
+  uint32_t slot;
+  return entries_.Lookup(hash, &slot);
+}
+
+
+bool QuotaIndex::Lookup(
+  const shash::Any &hash,
+  uint64_t *size,
+  bool *is_pinned) const
+{
+  uint32_t slot;
+  if (!entries_.Lookup(hash, &slot))
+    return false;
+  *size = slots_[slot].size;
+  *is_pinned = slots_[slot].is_pinned;
+  return true;
+}
+
+
+/**
+ * Inserts or replaces an entry and moves it to the end of its LRU list.  The
+ * sequence number is used for listings only, the LRU order is given by the
+ * order of operations.
+ */
+void QuotaIndex::Insert(
+  const shash::Any &hash,
+  const uint64_t size,
+  const uint64_t seq,
+  const string &description,
+  const bool is_catalog,
+  const bool is_volatile,
+  const bool is_pinned)
+{
+  DoInsert(hash, size, seq, description, is_catalog, is_volatile, is_pinned);
+  uint32_t slot;
+  entries_.Lookup(hash, &slot);
+  AppendInsertRecord(slots_[slot], &journal_buffer_);
+  num_journal_records_++;
+  if (journal_buffer_.size() > kMaxJournalBuffer)
+    FlushJournal();
+}
+
+
+/**
+ * Moves an entry to the end of its LRU list.  Unknown entries are ignored.
+ */
+void QuotaIndex::Touch(const shash::Any &hash, const uint64_t seq) {
+  uint32_t slot;
+  if (!entries_.Lookup(hash, &slot))
+    return;
+  DoTouch(slot, seq);
+
+  journal_buffer_.push_back(kRecordTouch);
+  AppendHash(hash, &journal_buffer_);
+  journal_buffer_.append(reinterpret_cast<const char *>(&seq), sizeof(seq));
+  num_journal_records_++;
+  if (journal_buffer_.size() > kMaxJournalBuffer)
+    FlushJournal();
+}
+
+
+void QuotaIndex::Unpin(const shash::Any &hash) {
+  uint32_t slot;
+  if (entries_.Lookup(hash, &slot))
+    slots_[slot].is_pinned = false;
+}
+
+
+/**
+ * @return false if the entry was not found
+ */
+bool QuotaIndex::Remove(const shash::Any &hash) {
+  uint32_t slot;
+  if (!entries_.Lookup(hash, &slot))
+    return false;
+  DoRemove(slot);
+
+  journal_buffer_.push_back(kRecordRemove);
+  AppendHash(hash, &journal_buffer_);
+  num_journal_records_++;
+  if (journal_buffer_.size() > kMaxJournalBuffer)
+    FlushJournal();
+  return true;
+}
+
+
+/**
+ * Drops all entries.  Only the in-memory state is changed, Checkpoint()
+ * persists the empty index or the index that is rebuilt after clearing.
+ */
+void QuotaIndex::Clear() {
+  entries_.Clear();
+  slots_.clear();
+  free_slots_.clear();
+  for (unsigned i = 0; i < kNumLists; ++i)
+    lists_[i] = LruList();
+  gauge_ = 0;
+  max_seq_ = 0;
+  journal_buffer_.clear();
+}
+
+
+/**
+ * The least recently used entry that is not blocked.  Volatile entries come
+ * first.
+ */
+bool QuotaIndex::GetLru(shash::Any *hash, uint64_t *size) const {
+  uint32_t slot = lists_[kLruVolatile].head;
+  if (slot == kNil)
+    slot = lists_[kLruRegular].head;
+  if (slot == kNil)
+    return false;
+  *hash = slots_[slot].hash;
+  *size = slots_[slot].size;
+  return true;
+}
+
+
+/**
+ * Excludes an entry from the LRU lists until the next UnblockAll().  Used by
+ * the cleanup for pinned entries that are not yet inserted.  Blocked entries
+ * are pinned.
+ */
+void QuotaIndex::Block(const shash::Any &hash) {
+  uint32_t slot;
+  if (!entries_.Lookup(hash, &slot))
+    return;
+  Entry *entry = &slots_[slot];
+  entry->is_pinned = true;
+  if (entry->list == kLruVolatile) {
+    Unlink(slot);
+    Link(slot, kBlockedVolatile);
+  } else if (entry->list == kLruRegular) {
+    Unlink(slot);
+    Link(slot, kBlockedRegular);
+  }
+}
+
+
+/**
+ * Entries are blocked in LRU order from the head of their lists, so they
+ * return to the head of their lists.
+ */
+void QuotaIndex::UnblockAll() {
+  const ListId blocked[] = { kBlockedVolatile, kBlockedRegular };
+  const ListId lru[] = { kLruVolatile, kLruRegular };
+  for (unsigned i = 0; i < 2; ++i) {
+    LruList *from = &lists_[blocked[i]];
+    LruList *to = &lists_[lru[i]];
+    if (from->head == kNil)
+      continue;
+    for (uint32_t slot = from->head; slot != kNil; slot = slots_[slot].next)
+      slots_[slot].list = lru[i];
+    slots_[from->tail].next = to->head;
+    if (to->head != kNil)
+      slots_[to->head].prev = from->tail;
+    else
+      to->tail = from->tail;
+    to->head = from->head;
+    *from = LruList();
+  }
+}
+
+
+/**
+ * Descriptions of the matching entries in the order of their sequence numbers
+ */
+vector<string> QuotaIndex::List(const ListType type) const {
+  vector<pair<uint64_t, uint32_t> > matches;
+  for (unsigned i = 0; i < kNumLists; ++i) {
+    for (uint32_t slot = lists_[i].head; slot != kNil;
+         slot = slots_[slot].next)
+    {
+      const Entry &entry = slots_[slot];
+      bool match = false;
+      switch (type) {
+        case kListRegular:
+          match = !entry.is_catalog;
+          break;
+        case kListPinned:
+          match = entry.is_pinned;
+          break;
+        case kListCatalogs:
+          match = entry.is_catalog;
+          break;
+        case kListVolatile:
+          match = (entry.list == kLruVolatile) ||
+                  (entry.list == kBlockedVolatile);
+          break;
+      }
+      if (match)
+        matches.push_back(make_pair(entry.seq, slot));
+    }
+  }
+  sort(matches.begin(), matches.end());
+
+  vector<string> result;
+  result.reserve(matches.size());
+  for (unsigned i = 0; i < matches.size(); ++i)
+    result.push_back(slots_[matches[i].second].description);
+  return result;
+}
+
+
+/**
+ * Writes the buffered journal records.  Condenses the journal into a new
+ * checkpoint once it becomes longer than the index.
+ */
+bool QuotaIndex::Commit() {
+  if ((num_journal_records_ >= kMinCheckpointRecords) &&
+      (num_journal_records_ > num_entries()))
+  {
+    return Checkpoint();
+  }
+  return FlushJournal();
+}
+
+
+/**
+ * Atomically replaces the checkpoint by the current state of the index and
+ * starts a new, empty journal.
+ */
+bool QuotaIndex::Checkpoint() {
+  const string tmp_path = path_ + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to create cache index checkpoint %s (%d)",
+             tmp_path.c_str(), errno);
+    return false;
+  }
+
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  string buffer(reinterpret_cast<char *>(&header), sizeof(header));
+
+  // Blocked entries precede the available ones of the same kind
+  const ListId order[] =
+    { kBlockedVolatile, kLruVolatile, kBlockedRegular, kLruRegular };
+  bool retval = true;
+  for (unsigned i = 0; (i < kNumLists) && retval; ++i) {
+    for (uint32_t slot = lists_[order[i]].head; slot != kNil;
+         slot = slots_[slot].next)
+    {
+      AppendInsertRecord(slots_[slot], &buffer);
+      if (buffer.size() > kCheckpointBuffer) {
+        retval = SafeWrite(fd, buffer.data(), buffer.size());
+        buffer.clear();
+        if (!retval)
+          break;
+      }
+    }
+  }
+  if (retval)
+    retval = SafeWrite(fd, buffer.data(), buffer.size());
+  if ((close(fd) != 0) || !retval ||
+      (rename(tmp_path.c_str(), path_.c_str()) != 0))
+  {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to write cache index checkpoint %s (%d)",
+             path_.c_str(), errno);
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  journal_buffer_.clear();
+  num_journal_records_ = 0;
+  return OpenJournal();
+}
+
+
+/**
+ * Truncates the journal and writes its header
+ */
+bool QuotaIndex::OpenJournal() {
+  if (fd_journal_ >= 0)
+    close(fd_journal_);
+  fd_journal_ = open(journal_path().c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  if (fd_journal_ < 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to open cache index journal %s (%d)",
+             journal_path().c_str(), errno);
+    return false;
+  }
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(header.magic));
+  header.version = kVersion;
+  return SafeWrite(fd_journal_, &header, sizeof(header));
+}
+
+
+bool QuotaIndex::FlushJournal() {
+  if (journal_buffer_.empty())
+    return true;
+  bool retval = (fd_journal_ >= 0) &&
+    SafeWrite(fd_journal_, journal_buffer_.data(), journal_buffer_.size());
+  journal_buffer_.clear();
+  if (!retval) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to write cache index journal %s (%d)",
+             journal_path().c_str(), errno);
+  }
+  return retval;
+}
+
+
+/**
+ * Applies the records of a checkpoint or a journal file.  A missing file is
+ * an empty file.
+ *
+ * @return false if the file cannot be read or if it contains an invalid or
+ * truncated record
+ */
+bool QuotaIndex::Replay(const string &path, unsigned *num_records) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT;
+  string content;
+  bool retval = SafeReadToString(fd, &content);
+  close(fd);
+  if (!retval)
+    return false;
+
+  const unsigned char *buffer =
+    reinterpret_cast<const unsigned char *>(content.data());
+  FileHeader header;
+  if (content.size() < sizeof(header))
+    return false;
+  memcpy(&header, buffer, sizeof(header));
+  if ((memcmp(header.magic, kMagic, sizeof(header.magic)) != 0) ||
+      (header.version != kVersion))
+  {
+    return false;
+  }
+
+  size_t pos = sizeof(header);
+  while (pos < content.size()) {
+    if (!ReplayRecord(buffer, content.size(), &pos))
+      return false;
+    (*num_records)++;
+  }
+  return true;
+}
+
+
+bool QuotaIndex::ReplayRecord(
+  const unsigned char *buffer,
+  const size_t size,
+  size_t *pos)
+{
+  if (size - *pos < 2)
+    return false;
+  const uint8_t type = buffer[*pos];
+  const uint8_t algorithm = buffer[*pos + 1];
+  if (algorithm >= shash::kAny)
+    return false;
+  shash::Any hash(static_cast<shash::Algorithms>(algorithm));
+  const unsigned digest_size = shash::kDigestSizes[algorithm];
+  if (size - *pos - 2 < digest_size)
+    return false;
+  memcpy(hash.digest, buffer + *pos + 2, digest_size);
+  size_t p = *pos + 2 + digest_size;
+
+  uint32_t slot;
+  switch (type) {
+    case kRecordInsert: {
+      uint64_t entry_size;
+      uint64_t seq;
+      uint8_t flags;
+      uint16_t desc_length;
+      if (size - p < sizeof(entry_size) + sizeof(seq) + sizeof(flags) +
+                     sizeof(desc_length))
+      {
+        return false;
+      }
+      memcpy(&entry_size, buffer + p, sizeof(entry_size));
+      p += sizeof(entry_size);
+      memcpy(&seq, buffer + p, sizeof(seq));
+      p += sizeof(seq);
+      flags = buffer[p];
+      p += sizeof(flags);
+      memcpy(&desc_length, buffer + p, sizeof(desc_length));
+      p += sizeof(desc_length);
+      if (size - p < desc_length)
+        return false;
+      DoInsert(hash, entry_size, seq,
+               string(reinterpret_cast<const char *>(buffer + p), desc_length),
+               flags & kFlagCatalog, flags & kFlagVolatile, false);
+      p += desc_length;
+      break;
+    }
+    case kRecordTouch: {
+      uint64_t seq;
+      if (size - p < sizeof(seq))
+        return false;
+      memcpy(&seq, buffer + p, sizeof(seq));
+      p += sizeof(seq);
+      if (entries_.Lookup(hash, &slot))
+        DoTouch(slot, seq);
+      break;
+    }
+    case kRecordRemove:
+      if (entries_.Lookup(hash, &slot))
+        DoRemove(slot);
+      break;
+    default:
+      return false;
+  }
+  *pos = p;
+  return true;
+}
+
+
+void QuotaIndex::AppendHash(const shash::Any &hash, string *buffer) {
+  buffer->push_back(static_cast<char>(hash.algorithm));
+  buffer->append(reinterpret_cast<const char *>(hash.digest),
+                 hash.GetDigestSize());
+}
+
+
+void QuotaIndex::AppendInsertRecord(const Entry &entry, string *buffer) {
+  buffer->push_back(kRecordInsert);
+  AppendHash(entry.hash, buffer);
+  buffer->append(reinterpret_cast<const char *>(&entry.size),
+                 sizeof(entry.size));
+  buffer->append(reinterpret_cast<const char *>(&entry.seq),
+                 sizeof(entry.seq));
+  const bool is_volatile =
+    (entry.list == kLruVolatile) || (entry.list == kBlockedVolatile);
+  buffer->push_back((entry.is_catalog ? kFlagCatalog : 0) |
+                    (is_volatile ? kFlagVolatile : 0));
+  const uint16_t desc_length = std::min(entry.description.length(),
+                                        size_t(UINT16_MAX));
+  buffer->append(reinterpret_cast<const char *>(&desc_length),
+                 sizeof(desc_length));
+  buffer->append(entry.description.data(), desc_length);
+}
+
+
+uint32_t QuotaIndex::AllocSlot() {
+  if (!free_slots_.empty()) {
+    const uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+  }
+  slots_.push_back(Entry());
+  return slots_.size() - 1;
+}
+
+
+/**
+ * Appends the entry to the tail of the list
+ */
+void QuotaIndex::Link(const uint32_t slot, const ListId list) {
+  Entry *entry = &slots_[slot];
+  LruList *lru_list = &lists_[list];
+  entry->list = list;
+  entry->prev = lru_list->tail;
+  entry->next = kNil;
+  if (lru_list->tail != kNil)
+    slots_[lru_list->tail].next = slot;
+  else
+    lru_list->head = slot;
+  lru_list->tail = slot;
+}
+
+
+void QuotaIndex::Unlink(const uint32_t slot) {
+  Entry *entry = &slots_[slot];
+  LruList *lru_list = &lists_[entry->list];
+  if (entry->prev != kNil)
+    slots_[entry->prev].next = entry->next;
+  else
+    lru_list->head = entry->next;
+  if (entry->next != kNil)
+    slots_[entry->next].prev = entry->prev;
+  else
+    lru_list->tail = entry->prev;
+  entry->prev = entry->next = kNil;
+}
+
+
+void QuotaIndex::DoInsert(
+  const shash::Any &hash,
+  const uint64_t size,
+  const uint64_t seq,
+  const string &description,
+  const bool is_catalog,
+  const bool is_volatile,
+  const bool is_pinned)
+{
+  uint32_t slot;
+  if (entries_.Lookup(hash, &slot)) {
+    Unlink(slot);
+    gauge_ -= slots_[slot].size;
+  } else {
+    slot = AllocSlot();
+    entries_.Insert(hash, slot);
+  }
+
+  Entry *entry = &slots_[slot];
+  entry->hash = hash;
+  entry->hash.suffix = shash::kSuffixNone;
+  entry->size = size;
+  entry->seq = seq;
+  entry->is_catalog = is_catalog;
+  entry->is_pinned = is_pinned;
+  entry->description = description;
+  Link(slot, is_volatile ? kLruVolatile : kLruRegular);
+  gauge_ += size;
+  max_seq_ = std::max(max_seq_, seq);
+}
+
+
+void QuotaIndex::DoTouch(const uint32_t slot, const uint64_t seq) {
+  Entry *entry = &slots_[slot];
+  entry->seq = seq;
+  max_seq_ = std::max(max_seq_, seq);
+  // Blocked entries stay blocked until the end of the cleanup
+  if ((entry->list == kLruVolatile) || (entry->list == kLruRegular)) {
+    const ListId list = static_cast<ListId>(entry->list);
+    Unlink(slot);
+    Link(slot, list);
+  }
+}
+
+
+void QuotaIndex::DoRemove(const uint32_t slot) {
+  Entry *entry = &slots_[slot];
+  Unlink(slot);
+  entries_.Erase(entry->hash);
+  gauge_ -= entry->size;
+  *entry = Entry();
+  free_slots_.push_back(slot);
+}
@@ -0,0 +1,175 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * An in-memory alternative to the SQlite cache database of the
+ * PosixQuotaManager.  Cache entries are kept in a hash table and threaded
+ * through intrusive LRU lists, so that touch, insert, and evict are O(1).
+ * Changes are appended to a journal and periodically condensed into a
+ * checkpoint, from which the index is recovered on the next start.
+ */
+
+#ifndef CVMFS_QUOTA_INDEX_H_
+#define CVMFS_QUOTA_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "murmur.h"
+#include "smallhash.h"
+#include "util/single_copy.h"
+
+/**
+ * Keeps track of the cache content: size, description (usually the path),
+ * type, and access order of every cached object.  Volatile entries are kept in
+ * a separate LRU list that is evicted first.
+ *
+ * The checkpoint and the journal share the same record format.  A checkpoint
+ * is the sequence of insert records that reproduces the current index in LRU
+ * order, the journal contains the insert, touch, and remove records since the
+ * last checkpoint.  Replaying the journal on top of the checkpoint is
+ * idempotent, so that a crash between writing a new checkpoint and truncating
+ * the journal is harmless.  A torn record at the end of the journal, e.g.
+ * after a crash during a write, ends the recovery.  Journal writes are not
+ * synced, just like the SQlite cache database runs with synchronous=0.
+ *
+ * Pinned and blocked flags are not persisted, the quota manager resets them on
+ * start anyway.  Not thread-safe, the index is owned by the quota manager
+ * thread or process.
+ */
+class QuotaIndex : SingleCopy {
+ public:
+  enum ListType {
+    kListRegular = 0,
+    kListPinned,
+    kListCatalogs,
+    kListVolatile,
+  };
+
+  /**
+   * Rewrite the checkpoint when the journal has more records than the index
+   * has entries but no earlier than after this number of records.
+   */
+  static const unsigned kMinCheckpointRecords = 64 * 1024;
+
+  static QuotaIndex *Open(const std::string &path);
+  ~QuotaIndex();
+
+  bool Contains(const shash::Any &hash) const;
+  bool Lookup(const shash::Any &hash, uint64_t *size, bool *is_pinned) const;
+  void Insert(const shash::Any &hash, const uint64_t size, const uint64_t seq,
+              const std::string &description, const bool is_catalog,
+              const bool is_volatile, const bool is_pinned);
+  void Touch(const shash::Any &hash, const uint64_t seq);
+  void Unpin(const shash::Any &hash);
+  bool Remove(const shash::Any &hash);
+  void Clear();
+
+  bool GetLru(shash::Any *hash, uint64_t *size) const;
+  void Block(const shash::Any &hash);
+  void UnblockAll();
+
+  std::vector<std::string> List(const ListType type) const;
+
+  bool Commit();
+  bool Checkpoint();
+
+  uint64_t gauge() const { return gauge_; }
+  uint64_t max_seq() const { return max_seq_; }
+  uint32_t num_entries() const { return entries_.size(); }
+  std::string path() const { return path_; }
+  std::string journal_path() const { return path_ + ".journal"; }
+
+ private:
+  static const uint32_t kNil = uint32_t(-1);
+  static const char kMagic[8];
+  static const unsigned kVersion = 1;
+  /**
+   * Flush the journal buffer when it grows beyond this number of bytes, even
+   * within a batch of commands.
+   */
+  static const unsigned kMaxJournalBuffer = 64 * 1024;
+
+  enum RecordType {
+    kRecordInsert = 1,
+    kRecordTouch,
+    kRecordRemove,
+  };
+
+  /**
+   * Entries are in one of four lists: volatile or regular, each either
+   * available for eviction or blocked during a cleanup.
+   */
+  enum ListId {
+    kLruVolatile = 0,
+    kLruRegular,
+    kBlockedVolatile,
+    kBlockedRegular,
+    kNumLists,
+  };
+
+  struct Entry {
+    Entry()
+      : size(0), seq(0), prev(kNil), next(kNil), list(kLruRegular)
+      , is_catalog(false), is_pinned(false)
+    { }
+    shash::Any hash;
+    uint64_t size;
+    uint64_t seq;
+    uint32_t prev;
+    uint32_t next;
+    uint8_t list;
+    bool is_catalog;
+    bool is_pinned;
+    std::string description;
+  };
+
+  struct LruList {
+    LruList() : head(kNil), tail(kNil) { }
+    uint32_t head;
+    uint32_t tail;
+  };
+
+  static inline uint32_t hasher_any(const shash::Any &key) {
+    return MurmurHash2(key.digest, shash::kDigestSizes[key.algorithm],
+                       0x07387a4f);
+  }
+
+  explicit QuotaIndex(const std::string &path);
+
+  uint32_t AllocSlot();
+  void Link(const uint32_t slot, const ListId list);
+  void Unlink(const uint32_t slot);
+  void DoInsert(const shash::Any &hash, const uint64_t size, const uint64_t seq,
+                const std::string &description, const bool is_catalog,
+                const bool is_volatile, const bool is_pinned);
+  void DoTouch(const uint32_t slot, const uint64_t seq);
+  void DoRemove(const uint32_t slot);
+
+  static void AppendHash(const shash::Any &hash, std::string *buffer);
+  static void AppendInsertRecord(const Entry &entry, std::string *buffer);
+  bool Replay(const std::string &path, unsigned *num_records);
+  bool ReplayRecord(const unsigned char *buffer, const size_t size,
+                    size_t *pos);
+  bool OpenJournal();
+  bool FlushJournal();
+
+  std::string path_;
+  int fd_journal_;
+  std::string journal_buffer_;
+  /**
+   * Number of records in the journal file, including the buffered ones
+   */
+  unsigned num_journal_records_;
+
+  SmallHashDynamic<shash::Any, uint32_t> entries_;
+  std::vector<Entry> slots_;
+  std::vector<uint32_t> free_slots_;
+  LruList lists_[kNumLists];
+  uint64_t gauge_;
+  uint64_t max_seq_;
+};
+
+#endif  // CVMFS_QUOTA_INDEX_H_
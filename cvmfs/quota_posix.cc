@@ -6,7 +6,9 @@
  * and remove files based on least recently used strategy.
  *
  * We setup another SQLite catalog, a "cache catalog", that helps us
- * in the bookkeeping of files, file sizes and access times.
+ * in the bookkeeping of files, file sizes and access times.  Alternatively,
+ * the bookkeeping is done by a QuotaIndex in memory.  Evicted files are
+ * removed in the background by a QuotaTrash.
  *
  * We might choose to not manage the local cache.  This is indicated
  * by limit == 0 and everything succeeds in that case.
@@ -32,7 +34,6 @@
 #endif
 #include <sys/statvfs.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 #include <cassert>
@@ -40,6 +41,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -50,6 +52,8 @@
 #include "logging.h"
 #include "monitor.h"
 #include "platform.h"
+#include "quota_index.h"
+#include "quota_trash.h"
 #include "smalloc.h"
 #include "statistics.h"
 #include "util/exception.h"
@@ -60,6 +64,83 @@
 
 using namespace std;  // NOLINT
 
+namespace {
+
+/**
+ * A file found in the cache directory during a rebuild of the cache database
+ */
+struct CachedFile {
+  CachedFile(const int64_t a, const string &h, const uint64_t s)
+    : atime(a), hash_str(h), size(s) { }
+  bool operator <(const CachedFile &other) const {
+    return atime < other.atime;
+  }
+  int64_t atime;
+  string hash_str;
+  uint64_t size;
+};
+
+
+/**
+ * A rebuild thread scans the cache sub directories first, first + stride, ...
+ */
+struct RebuildScan {
+  RebuildScan() : first(0), stride(1), size(0), failed(false) { }
+  string cache_dir;
+  unsigned first;
+  unsigned stride;
+  vector<CachedFile> files;
+  uint64_t size;
+  bool failed;
+};
+
+
+void *MainRebuildScan(void *data) {
+  RebuildScan *scan = reinterpret_cast<RebuildScan *>(data);
+  char hex[4];
+  struct stat info;
+  platform_dirent64 *d;
+
+  for (unsigned i = scan->first; i <= 0xff; i += scan->stride) {
+    snprintf(hex, sizeof(hex), "%02x", i);
+    const string path = scan->cache_dir + "/" + string(hex);
+    DIR *dirp = opendir(path.c_str());
+    if (dirp == NULL) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "failed to open directory %s (tmpwatch interfering?)",
+               path.c_str());
+      scan->failed = true;
+      return NULL;
+    }
+    // Stat relative to the directory saves the path lookup
+    const int fd_dir = dirfd(dirp);
+    while ((d = platform_readdir(dirp)) != NULL) {
+      if (fstatat(fd_dir, d->d_name, &info, 0) != 0) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not stat %s/%s",
+                 path.c_str(), d->d_name);
+        continue;
+      }
+      if (!S_ISREG(info.st_mode))
+        continue;
+      if (info.st_size == 0) {
+        LogCvmfs(kLogQuota, kLogSyslog | kLogDebug,
+                 "removing empty file %s/%s during automatic cache db rebuild",
+                 path.c_str(), d->d_name);
+        unlinkat(fd_dir, d->d_name, 0);
+        continue;
+      }
+      scan->files.push_back(
+        CachedFile(info.st_atime, string(hex) + string(d->d_name),
+                   info.st_size));
+      scan->size += info.st_size;
+    }
+    closedir(dirp);
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
 
 int PosixQuotaManager::BindReturnPipe(int pipe_wronly) {
   if (!shared_)
@@ -118,7 +199,7 @@ void PosixQuotaManager::CleanupPipes() {
 
 /**
  * Cleans up in data cache, until cache size is below leave_size.
- * The actual unlinking is done in a separate process (fork).
+ * The actual unlinking is done asynchronously by the unlink threads.
  *
  * \return True on success, false otherwise
  */
@@ -157,6 +238,9 @@ void PosixQuotaManager::CloseDatabase() {
   if (stmt_unblock_) sqlite3_finalize(stmt_unblock_);
   if (stmt_new_) sqlite3_finalize(stmt_new_);
   if (database_) sqlite3_close(database_);
+  delete index_;
+  // Files still queued stay in the trash for the next run
+  delete trash_;
   UnlockFile(fd_lock_cachedb_);
 
   stmt_list_catalogs_ = NULL;
@@ -171,6 +255,8 @@ void PosixQuotaManager::CloseDatabase() {
   stmt_unblock_ = NULL;
   stmt_new_ = NULL;
   database_ = NULL;
+  index_ = NULL;
+  trash_ = NULL;
 
   pinned_chunks_.clear();
 }
@@ -189,11 +275,15 @@ void PosixQuotaManager::CloseReturnPipe(int pipe[2]) {
 bool PosixQuotaManager::Contains(const string &hash_str) {
   bool result = false;
 
-  sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
-                    SQLITE_STATIC);
-  if (sqlite3_step(stmt_size_) == SQLITE_ROW)
-    result = true;
-  sqlite3_reset(stmt_size_);
+  if (index_ != NULL) {
+    result = index_->Contains(shash::MkFromHexPtr(shash::HexPtr(hash_str)));
+  } else {
+    sqlite3_bind_text(stmt_size_, 1, &hash_str[0], hash_str.length(),
+                      SQLITE_STATIC);
+    if (sqlite3_step(stmt_size_) == SQLITE_ROW)
+      result = true;
+    sqlite3_reset(stmt_size_);
+  }
   LogCvmfs(kLogQuota, kLogDebug, "contains %s returns %d",
            hash_str.c_str(), result);
 
@@ -206,7 +296,7 @@ void PosixQuotaManager::CheckFreeSpace() {
     return;
 
   struct statvfs vfs_info;
-  int retval = statvfs((cache_dir_ + "/cachedb").c_str(), &vfs_info);
+  int retval = statvfs(cache_dir_.c_str(), &vfs_info);
   if (retval != 0) {
     LogCvmfs(kLogQuota, kLogDebug | kLogSyslogWarn,
              "failed to query %s for free space (%d)",
@@ -231,7 +321,9 @@ PosixQuotaManager *PosixQuotaManager::Create(
   const string &cache_workspace,
   const uint64_t limit,
   const uint64_t cleanup_threshold,
-  const bool rebuild_database)
+  const bool rebuild_database,
+  const Backend backend,
+  const unsigned unlink_rate)
 {
   if (cleanup_threshold >= limit) {
     LogCvmfs(kLogQuota, kLogDebug, "invalid parameters: limit %" PRIu64 ", "
@@ -241,6 +333,8 @@ PosixQuotaManager *PosixQuotaManager::Create(
 
   PosixQuotaManager *quota_manager =
     new PosixQuotaManager(limit, cleanup_threshold, cache_workspace);
+  quota_manager->backend_ = backend;
+  quota_manager->unlink_rate_ = unlink_rate;
 
   // Initialize cache catalog
   if (!quota_manager->InitDatabase(rebuild_database)) {
@@ -264,7 +358,9 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
   const std::string &cache_workspace,
   const uint64_t limit,
   const uint64_t cleanup_threshold,
-  bool foreground)
+  bool foreground,
+  const Backend backend,
+  const unsigned unlink_rate)
 {
   string cache_dir;
   string workspace_dir;
@@ -351,6 +447,8 @@ PosixQuotaManager *PosixQuotaManager::CreateShared(
   command_line.push_back(StringifyInt(GetLogSyslogLevel()));
   command_line.push_back(StringifyInt(GetLogSyslogFacility()));
   command_line.push_back(GetLogDebugFile() + ":" + GetLogMicroSyslog());
+  command_line.push_back(StringifyInt(backend));
+  command_line.push_back(StringifyInt(unlink_rate));
 
   set<int> preserve_filedes;
   preserve_filedes.insert(0);
@@ -433,33 +531,47 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
 
   bool result;
   string hash_str;
-  vector<string> trash;
+  shash::Any hash;
+  uint64_t size;
+  vector<shash::Any> trash;
 
   do {
-    sqlite3_reset(stmt_lru_);
-    if (sqlite3_step(stmt_lru_) != SQLITE_ROW) {
-      LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
-      break;
+    if (index_ != NULL) {
+      if (!index_->GetLru(&hash, &size)) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
+        break;
+      }
+      hash_str = hash.ToString();
+    } else {
+      sqlite3_reset(stmt_lru_);
+      if (sqlite3_step(stmt_lru_) != SQLITE_ROW) {
+        LogCvmfs(kLogQuota, kLogDebug, "could not get lru-entry");
+        break;
+      }
+      hash_str = string(reinterpret_cast<const char *>(
+                        sqlite3_column_text(stmt_lru_, 0)));
+      hash = shash::MkFromHexPtr(shash::HexPtr(hash_str));
+      size = sqlite3_column_int64(stmt_lru_, 1);
     }
-
-    hash_str = string(reinterpret_cast<const char *>(
-                      sqlite3_column_text(stmt_lru_, 0)));
     LogCvmfs(kLogQuota, kLogDebug, "removing %s", hash_str.c_str());
-    shash::Any hash = shash::MkFromHexPtr(shash::HexPtr(hash_str));
 
     // That's a critical condition.  We must not delete a not yet inserted
     // pinned file as it is already reserved (but will be inserted later).
     // Instead, set the pin bit in the db to not run into an endless loop
     if (pinned_chunks_.find(hash) == pinned_chunks_.end()) {
-      trash.push_back(cache_dir_ + "/" + hash.MakePathWithoutSuffix());
-      gauge_ -= sqlite3_column_int64(stmt_lru_, 1);
+      trash.push_back(hash);
+      gauge_ -= size;
       LogCvmfs(kLogQuota, kLogDebug, "lru cleanup %s, new gauge %" PRIu64,
                hash_str.c_str(), gauge_);
 
-      sqlite3_bind_text(stmt_rm_, 1, &hash_str[0], hash_str.length(),
-                        SQLITE_STATIC);
-      result = (sqlite3_step(stmt_rm_) == SQLITE_DONE);
-      sqlite3_reset(stmt_rm_);
+      if (index_ != NULL) {
+        result = index_->Remove(hash);
+      } else {
+        sqlite3_bind_text(stmt_rm_, 1, &hash_str[0], hash_str.length(),
+                          SQLITE_STATIC);
+        result = (sqlite3_step(stmt_rm_) == SQLITE_DONE);
+        sqlite3_reset(stmt_rm_);
+      }
 
       if (!result) {
         LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
@@ -468,6 +580,8 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
                  "Restart cvmfs with clean cache.", hash_str.c_str(), result);
         return false;
       }
+    } else if (index_ != NULL) {
+      index_->Block(hash);
     } else {
       sqlite3_bind_text(stmt_block_, 1, &hash_str[0], hash_str.length(),
                         SQLITE_STATIC);
@@ -477,43 +591,28 @@ bool PosixQuotaManager::DoCleanup(const uint64_t leave_size) {
     }
   } while (gauge_ > leave_size);
 
-  result = (sqlite3_step(stmt_unblock_) == SQLITE_DONE);
-  sqlite3_reset(stmt_unblock_);
-  assert(result);
+  if (index_ != NULL) {
+    index_->UnblockAll();
+    index_->Commit();
+  } else {
+    result = (sqlite3_step(stmt_unblock_) == SQLITE_DONE);
+    sqlite3_reset(stmt_unblock_);
+    assert(result);
+  }
 
-  // Double fork avoids zombie, forked removal process must not flush file
-  // buffers
   if (!trash.empty()) {
-    if (async_delete_) {
-      pid_t pid;
-      int statloc;
-      if ((pid = fork()) == 0) {
-        // TODO(jblomer): eviciting files in the cache should perhaps become a
-        // thread.  This would also allow to block the chunks and prevent the
-        // race with re-insertion.  Then again, a thread can block umount.
-#ifndef DEBUGMSG
-        int max_fd = sysconf(_SC_OPEN_MAX);
-        for (int i = 0; i < max_fd; ++i)
-          close(i);
-#endif
-        if (fork() == 0) {
-          for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i) {
-            LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].c_str());
-            unlink(trash[i].c_str());
-          }
-          _exit(0);
-        }
-        _exit(0);
-      } else {
-        if (pid > 0)
-          waitpid(pid, &statloc, 0);
-        else
-          return false;
-      }
-    } else {  // !async_delete_
+    if (async_delete_ && (trash_ == NULL)) {
+      trash_ = QuotaTrash::Create(cache_dir_, QuotaTrash::kDefaultNumThreads,
+                                  unlink_rate_);
+    }
+    if (async_delete_ && (trash_ != NULL)) {
+      for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i)
+        trash_->Add(trash[i]);
+    } else {
       for (unsigned i = 0, iEnd = trash.size(); i < iEnd; ++i) {
-        LogCvmfs(kLogQuota, kLogDebug, "unlink %s", trash[i].c_str());
-        unlink(trash[i].c_str());
+        const string path = cache_dir_ + "/" + trash[i].MakePathWithoutSuffix();
+        LogCvmfs(kLogQuota, kLogDebug, "unlink %s", path.c_str());
+        unlink(path.c_str());
       }
     }
   }
@@ -717,6 +816,14 @@ bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
 
   bool retry = false;
   const string db_file = cache_dir_ + "/cachedb";
+  const string index_file = cache_dir_ + "/cacheidx";
+  if (backend_ == kBackendMemory) {
+    unlink(db_file.c_str());
+    unlink((db_file + "-journal").c_str());
+    return InitIndex(index_file, rebuild_database);
+  }
+  unlink(index_file.c_str());
+  unlink((index_file + ".journal").c_str());
   if (rebuild_database) {
     LogCvmfs(kLogQuota, kLogDebug, "rebuild database, unlinking existing (%s)",
              db_file.c_str());
@@ -887,6 +994,47 @@ bool PosixQuotaManager::InitDatabase(const bool rebuild_database) {
 }
 
 
+/**
+ * Counterpart of InitDatabase() for kBackendMemory.  The lock on the cache
+ * database is already taken.
+ */
+bool PosixQuotaManager::InitIndex(
+  const string &index_file,
+  const bool rebuild_index)
+{
+  if (rebuild_index) {
+    LogCvmfs(kLogQuota, kLogDebug, "rebuild index, unlinking existing (%s)",
+             index_file.c_str());
+    unlink(index_file.c_str());
+    unlink((index_file + ".journal").c_str());
+  }
+
+  index_ = QuotaIndex::Open(index_file);
+  if (index_ == NULL) {
+    LogCvmfs(kLogQuota, kLogDebug, "could not open cache index");
+    UnlockFile(fd_lock_cachedb_);
+    return false;
+  }
+
+  // If the index is empty, recreate from file system
+  if ((index_->num_entries() == 0) || rebuild_index) {
+    LogCvmfs(kLogCvmfs, kLogDebug, "CernVM-FS: building lru cache index...");
+    if (!RebuildDatabase()) {
+      LogCvmfs(kLogQuota, kLogDebug,
+               "could not build cache index from file system");
+      delete index_;
+      index_ = NULL;
+      UnlockFile(fd_lock_cachedb_);
+      return false;
+    }
+  }
+
+  gauge_ = index_->gauge();
+  seq_ = index_->max_seq() + 1;
+  return true;
+}
+
+
 /**
  * Inserts a new file into cache catalog.  This file gets a new,
  * highest sequence number. Does cache cleanup if necessary.
@@ -974,6 +1122,11 @@ int PosixQuotaManager::MainCacheManager(int argc, char **argv) {
   int syslog_level = String2Int64(argv[8]);
   int syslog_facility = String2Int64(argv[9]);
   vector<string> logfiles = SplitString(argv[10], ':');
+  // Older clients don't pass the backend
+  if (argc > 11)
+    shared_manager.backend_ = static_cast<Backend>(String2Int64(argv[11]));
+  if (argc > 12)
+    shared_manager.unlink_rate_ = String2Int64(argv[12]);
 
   SetLogSyslogLevel(syslog_level);
   SetLogSyslogFacility(syslog_facility);
@@ -1088,6 +1241,11 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
 
   LogCvmfs(kLogQuota, kLogDebug, "starting quota manager");
   sqlite3_soft_heap_limit(quota_mgr->kSqliteMemPerThread);
+  // Removes evicted files that a previous run left in the trash
+  if (quota_mgr->async_delete_ && (quota_mgr->trash_ == NULL)) {
+    quota_mgr->trash_ = QuotaTrash::Create(quota_mgr->cache_dir_,
+      QuotaTrash::kDefaultNumThreads, quota_mgr->unlink_rate_);
+  }
 
   LruCommand command_buffer[kCommandBufferSize];
   char description_buffer[kCommandBufferSize*kMaxDescription];
@@ -1239,23 +1397,34 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
           LogCvmfs(kLogQuota, kLogDebug,
                    "remove orphaned pinned hash %s from cache database",
                    hash_str.c_str());
-          sqlite3_bind_text(quota_mgr->stmt_size_, 1, &hash_str[0],
-                            hash_str.length(), SQLITE_STATIC);
-          int retval;
-          if ((retval = sqlite3_step(quota_mgr->stmt_size_)) == SQLITE_ROW) {
-            uint64_t size = sqlite3_column_int64(quota_mgr->stmt_size_, 0);
-            sqlite3_bind_text(quota_mgr->stmt_rm_, 1, &(hash_str[0]),
+          if (quota_mgr->index_ != NULL) {
+            uint64_t entry_size;
+            bool is_pinned;
+            if (quota_mgr->index_->Lookup(hash, &entry_size, &is_pinned)) {
+              quota_mgr->index_->Remove(hash);
+              quota_mgr->index_->Commit();
+              quota_mgr->gauge_ -= entry_size;
+            }
+          } else {
+            sqlite3_bind_text(quota_mgr->stmt_size_, 1, &hash_str[0],
                               hash_str.length(), SQLITE_STATIC);
-            retval = sqlite3_step(quota_mgr->stmt_rm_);
-            if ((retval == SQLITE_DONE) || (retval == SQLITE_OK)) {
-              quota_mgr->gauge_ -= size;
-            } else {
-              LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
-                       "failed to delete %s (%d)", hash_str.c_str(), retval);
+            int retval;
+            if ((retval = sqlite3_step(quota_mgr->stmt_size_)) == SQLITE_ROW)
+            {
+              uint64_t size = sqlite3_column_int64(quota_mgr->stmt_size_, 0);
+              sqlite3_bind_text(quota_mgr->stmt_rm_, 1, &(hash_str[0]),
+                                hash_str.length(), SQLITE_STATIC);
+              retval = sqlite3_step(quota_mgr->stmt_rm_);
+              if ((retval == SQLITE_DONE) || (retval == SQLITE_OK)) {
+                quota_mgr->gauge_ -= size;
+              } else {
+                LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+                         "failed to delete %s (%d)", hash_str.c_str(), retval);
+              }
+              sqlite3_reset(quota_mgr->stmt_rm_);
             }
-            sqlite3_reset(quota_mgr->stmt_rm_);
+            sqlite3_reset(quota_mgr->stmt_size_);
           }
-          sqlite3_reset(quota_mgr->stmt_size_);
         }
       } else {
         LogCvmfs(kLogQuota, kLogDebug, "this chunk was not pinned");
@@ -1296,6 +1465,23 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
                    hash_str.c_str());
           bool success = false;
 
+          if (quota_mgr->index_ != NULL) {
+            uint64_t entry_size;
+            bool is_pinned;
+            if (quota_mgr->index_->Lookup(hash, &entry_size, &is_pinned)) {
+              quota_mgr->index_->Remove(hash);
+              quota_mgr->index_->Commit();
+              quota_mgr->gauge_ -= entry_size;
+              if (is_pinned) {
+                quota_mgr->pinned_chunks_.erase(hash);
+                quota_mgr->pinned_ -= entry_size;
+              }
+            }
+            success = true;
+            WritePipe(return_pipe, &success, sizeof(success));
+            break;
+          }
+
           sqlite3_bind_text(quota_mgr->stmt_size_, 1, &hash_str[0],
                             hash_str.length(), SQLITE_STATIC);
           int retval;
@@ -1341,21 +1527,38 @@ void *PosixQuotaManager::MainCommandServer(void *data) {
 
           // Pipe back the list, one by one
           int length;
-          while (sqlite3_step(this_stmt_list) == SQLITE_ROW) {
-            string path = "(NULL)";
-            if (sqlite3_column_type(this_stmt_list, 0) != SQLITE_NULL) {
-              path = string(
-                reinterpret_cast<const char *>(
-                  sqlite3_column_text(this_stmt_list, 0)));
+          if (quota_mgr->index_ != NULL) {
+            QuotaIndex::ListType list_type = QuotaIndex::kListRegular;
+            if (command_type == kListPinned)
+              list_type = QuotaIndex::kListPinned;
+            else if (command_type == kListCatalogs)
+              list_type = QuotaIndex::kListCatalogs;
+            else if (command_type == kListVolatile)
+              list_type = QuotaIndex::kListVolatile;
+            const vector<string> paths = quota_mgr->index_->List(list_type);
+            for (unsigned i = 0; i < paths.size(); ++i) {
+              length = paths[i].length();
+              WritePipe(return_pipe, &length, sizeof(length));
+              if (length > 0)
+                WritePipe(return_pipe, paths[i].data(), length);
+            }
+          } else {
+            while (sqlite3_step(this_stmt_list) == SQLITE_ROW) {
+              string path = "(NULL)";
+              if (sqlite3_column_type(this_stmt_list, 0) != SQLITE_NULL) {
+                path = string(
+                  reinterpret_cast<const char *>(
+                    sqlite3_column_text(this_stmt_list, 0)));
+              }
+              length = path.length();
+              WritePipe(return_pipe, &length, sizeof(length));
+              if (length > 0)
+                WritePipe(return_pipe, &path[0], length);
             }
-            length = path.length();
-            WritePipe(return_pipe, &length, sizeof(length));
-            if (length > 0)
-              WritePipe(return_pipe, &path[0], length);
+            sqlite3_reset(this_stmt_list);
           }
           length = -1;
           WritePipe(return_pipe, &length, sizeof(length));
-          sqlite3_reset(this_stmt_list);
           break;
         case kStatus:
           WritePipe(return_pipe, &quota_mgr->gauge_, sizeof(quota_mgr->gauge_));
@@ -1474,24 +1677,31 @@ bool PosixQuotaManager::Pin(
         CheckHighPinWatermark();
       }
     }
-    bool exists = Contains(hash_str);
+    bool exists =
+      (index_ != NULL) ? index_->Contains(hash) : Contains(hash_str);
     if (!exists && (gauge_ + size > limit_)) {
       LogCvmfs(kLogQuota, kLogDebug, "over limit, gauge %lu, file size %lu",
                gauge_, size);
       int retval = DoCleanup(cleanup_threshold_);
       assert(retval != 0);
     }
-    sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
-                      SQLITE_STATIC);
-    sqlite3_bind_int64(stmt_new_, 2, size);
-    sqlite3_bind_int64(stmt_new_, 3, seq_++);
-    sqlite3_bind_text(stmt_new_, 4, &description[0], description.length(),
-                      SQLITE_STATIC);
-    sqlite3_bind_int64(stmt_new_, 5, is_catalog ? kFileCatalog : kFileRegular);
-    sqlite3_bind_int64(stmt_new_, 6, 1);
-    int retval = sqlite3_step(stmt_new_);
-    assert((retval == SQLITE_DONE) || (retval == SQLITE_OK));
-    sqlite3_reset(stmt_new_);
+    if (index_ != NULL) {
+      index_->Insert(hash, size, seq_++, description, is_catalog, false, true);
+      index_->Commit();
+    } else {
+      sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
+                        SQLITE_STATIC);
+      sqlite3_bind_int64(stmt_new_, 2, size);
+      sqlite3_bind_int64(stmt_new_, 3, seq_++);
+      sqlite3_bind_text(stmt_new_, 4, &description[0], description.length(),
+                        SQLITE_STATIC);
+      sqlite3_bind_int64(stmt_new_, 5,
+                         is_catalog ? kFileCatalog : kFileRegular);
+      sqlite3_bind_int64(stmt_new_, 6, 1);
+      int retval = sqlite3_step(stmt_new_);
+      assert((retval == SQLITE_DONE) || (retval == SQLITE_OK));
+      sqlite3_reset(stmt_new_);
+    }
     if (!exists) gauge_ += size;
     return true;
   }
@@ -1531,6 +1741,10 @@ PosixQuotaManager::PosixQuotaManager(
   , workspace_dir_()  // initialized in body
   , fd_lock_cachedb_(-1)
   , async_delete_(true)
+  , unlink_rate_(0)
+  , trash_(NULL)
+  , backend_(kBackendSqlite)
+  , index_(NULL)
   , database_(NULL)
   , stmt_touch_(NULL)
   , stmt_unpin_(NULL)
@@ -1585,8 +1799,11 @@ void PosixQuotaManager::ProcessCommandBunch(
   const LruCommand *commands,
   const char *descriptions)
 {
-  int retval = sqlite3_exec(database_, "BEGIN", NULL, NULL, NULL);
-  assert(retval == SQLITE_OK);
+  int retval;
+  if (index_ == NULL) {
+    retval = sqlite3_exec(database_, "BEGIN", NULL, NULL, NULL);
+    assert(retval == SQLITE_OK);
+  }
 
   for (unsigned i = 0; i < num; ++i) {
     const shash::Any hash = commands[i].RetrieveHash();
@@ -1598,6 +1815,10 @@ void PosixQuotaManager::ProcessCommandBunch(
     bool exists;
     switch (commands[i].command_type) {
       case kTouch:
+        if (index_ != NULL) {
+          index_->Touch(hash, seq_++);
+          break;
+        }
         sqlite3_bind_int64(stmt_touch_, 1, seq_++);
         sqlite3_bind_text(stmt_touch_, 2, &hash_str[0], hash_str.length(),
                           SQLITE_STATIC);
@@ -1611,6 +1832,10 @@ void PosixQuotaManager::ProcessCommandBunch(
         sqlite3_reset(stmt_touch_);
         break;
       case kUnpin:
+        if (index_ != NULL) {
+          index_->Unpin(hash);
+          break;
+        }
         sqlite3_bind_text(stmt_unpin_, 1, &hash_str[0], hash_str.length(),
                           SQLITE_STATIC);
         retval = sqlite3_step(stmt_unpin_);
@@ -1627,7 +1852,7 @@ void PosixQuotaManager::ProcessCommandBunch(
       case kInsert:
       case kInsertVolatile:
         // It could already be in, check
-        exists = Contains(hash_str);
+        exists = (index_ != NULL) ? index_->Contains(hash) : Contains(hash_str);
 
         // Cleanup, move to trash and unlink
         if (!exists && (gauge_ + size > limit_)) {
@@ -1638,6 +1863,16 @@ void PosixQuotaManager::ProcessCommandBunch(
         }
 
         // Insert or replace
+        if (index_ != NULL) {
+          index_->Insert(hash, size, seq_++,
+            string(&descriptions[i*kMaxDescription], commands[i].desc_length),
+            commands[i].command_type == kPin,
+            commands[i].command_type == kInsertVolatile,
+            (commands[i].command_type == kPin) ||
+            (commands[i].command_type == kPinRegular));
+          if (!exists) gauge_ += size;
+          break;
+        }
         sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
                           SQLITE_STATIC);
         sqlite3_bind_int64(stmt_new_, 2, size);
@@ -1670,6 +1905,12 @@ void PosixQuotaManager::ProcessCommandBunch(
     }
   }
 
+  if (index_ != NULL) {
+    // Failures are logged by the index.  The in-memory index stays intact
+    // and is completely written into its next checkpoint.
+    index_->Commit();
+    return;
+  }
   retval = sqlite3_exec(database_, "COMMIT", NULL, NULL, NULL);
   if (retval != SQLITE_OK) {
     PANIC(kLogSyslogErr, "failed to commit to cachedb, error %d", retval);
@@ -1684,69 +1925,89 @@ bool PosixQuotaManager::RebuildDatabase() {
   sqlite3_stmt *stmt_insert = NULL;
   int sqlerr;
   int seq = 0;
-  char hex[4];
-  struct stat info;
-  platform_dirent64 *d;
-  DIR *dirp = NULL;
-  string path;
+  RebuildScan scans[kNumRebuildThreads];
+  vector<pthread_t> threads;
+  vector<CachedFile> cached_files;
 
   LogCvmfs(kLogQuota, kLogSyslog | kLogDebug, "re-building cache database");
 
   // Empty cache catalog and fscache
-  sql = "DELETE FROM cache_catalog; DELETE FROM fscache;";
-  sqlerr = sqlite3_exec(database_, sql.c_str(), NULL, NULL, NULL);
-  if (sqlerr != SQLITE_OK) {
-    LogCvmfs(kLogQuota, kLogDebug, "could not clear cache database");
-    goto build_return;
+  if (index_ != NULL) {
+    index_->Clear();
+  } else {
+    sql = "DELETE FROM cache_catalog; DELETE FROM fscache;";
+    sqlerr = sqlite3_exec(database_, sql.c_str(), NULL, NULL, NULL);
+    if (sqlerr != SQLITE_OK) {
+      LogCvmfs(kLogQuota, kLogDebug, "could not clear cache database");
+      goto build_return;
+    }
   }
 
   gauge_ = 0;
 
-  // Insert files from cache sub-directories 00 - ff
+  // Scan the cache sub-directories 00 - ff in parallel
   // TODO(jblomer): fs_traversal
-  sqlite3_prepare_v2(database_, "INSERT INTO fscache (sha1, size, actime) "
-                     "VALUES (:sha1, :s, :t);", -1, &stmt_insert, NULL);
+  for (unsigned i = 0; i < kNumRebuildThreads; ++i) {
+    scans[i].cache_dir = cache_dir_;
+    scans[i].first = i;
+    scans[i].stride = kNumRebuildThreads;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, MainRebuildScan, &scans[i]) == 0)
+      threads.push_back(thread);
+    else
+      MainRebuildScan(&scans[i]);
+  }
+  for (unsigned i = 0; i < threads.size(); ++i)
+    pthread_join(threads[i], NULL);
+  for (unsigned i = 0; i < kNumRebuildThreads; ++i) {
+    if (scans[i].failed)
+      goto build_return;
+    cached_files.insert(cached_files.end(),
+                        scans[i].files.begin(), scans[i].files.end());
+    gauge_ += scans[i].size;
+  }
 
-  for (int i = 0; i <= 0xff; i++) {
-    snprintf(hex, sizeof(hex), "%02x", i);
-    path = cache_dir_ + "/" + string(hex);
-    if ((dirp = opendir(path.c_str())) == NULL) {
+  if (index_ != NULL) {
+    sort(cached_files.begin(), cached_files.end());
+    for (unsigned i = 0; i < cached_files.size(); ++i) {
+      const shash::Any hash =
+        shash::MkFromHexPtr(shash::HexPtr(cached_files[i].hash_str));
+      if (hash.algorithm == shash::kAny) {
+        LogCvmfs(kLogQuota, kLogDebug, "ignoring %s",
+                 cached_files[i].hash_str.c_str());
+        gauge_ -= cached_files[i].size;
+        continue;
+      }
+      // Might also be a catalog (information is lost)
+      index_->Insert(hash, cached_files[i].size, seq++,
+                     "unknown (automatic rebuild)", false, false, false);
+    }
+    if (!index_->Checkpoint()) {
       LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
-               "failed to open directory %s (tmpwatch interfering?)",
-               path.c_str());
+               "could not store cache index");
       goto build_return;
     }
-    while ((d = platform_readdir(dirp)) != NULL) {
-      string file_path = path + "/" + string(d->d_name);
-      if (stat(file_path.c_str(), &info) == 0) {
-        if (!S_ISREG(info.st_mode))
-          continue;
-        if (info.st_size == 0) {
-          LogCvmfs(kLogQuota, kLogSyslog | kLogDebug,
-                   "removing empty file %s during automatic cache db rebuild",
-                   file_path.c_str());
-          unlink(file_path.c_str());
-          continue;
-        }
-
-        string hash = string(hex) + string(d->d_name);
-        sqlite3_bind_text(stmt_insert, 1, hash.data(), hash.length(),
-                          SQLITE_STATIC);
-        sqlite3_bind_int64(stmt_insert, 2, info.st_size);
-        sqlite3_bind_int64(stmt_insert, 3, info.st_atime);
-        if (sqlite3_step(stmt_insert) != SQLITE_DONE) {
-          LogCvmfs(kLogQuota, kLogDebug, "could not insert into temp table");
-          goto build_return;
-        }
-        sqlite3_reset(stmt_insert);
+    seq_ = seq;
+    result = true;
+    LogCvmfs(kLogQuota, kLogDebug,
+             "rebuilding finished, seqence %" PRIu64 ", gauge %" PRIu64,
+             seq_, gauge_);
+    goto build_return;
+  }
 
-        gauge_ += info.st_size;
-      } else {
-        LogCvmfs(kLogQuota, kLogDebug, "could not stat %s", file_path.c_str());
-      }
+  sqlite3_prepare_v2(database_, "INSERT INTO fscache (sha1, size, actime) "
+                     "VALUES (:sha1, :s, :t);", -1, &stmt_insert, NULL);
+  for (unsigned i = 0; i < cached_files.size(); ++i) {
+    const string &hash = cached_files[i].hash_str;
+    sqlite3_bind_text(stmt_insert, 1, hash.data(), hash.length(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(stmt_insert, 2, cached_files[i].size);
+    sqlite3_bind_int64(stmt_insert, 3, cached_files[i].atime);
+    if (sqlite3_step(stmt_insert) != SQLITE_DONE) {
+      LogCvmfs(kLogQuota, kLogDebug, "could not insert into temp table");
+      goto build_return;
     }
-    closedir(dirp);
-    dirp = NULL;
+    sqlite3_reset(stmt_insert);
   }
   sqlite3_finalize(stmt_insert);
   stmt_insert = NULL;
@@ -1797,7 +2058,6 @@ bool PosixQuotaManager::RebuildDatabase() {
  build_return:
   if (stmt_insert) sqlite3_finalize(stmt_insert);
   if (stmt_select) sqlite3_finalize(stmt_select);
-  if (dirp) closedir(dirp);
   return result;
 }
 
@@ -25,10 +25,13 @@
 namespace perf {
 class Recorder;
 }
+class QuotaIndex;
+class QuotaTrash;
 
 /**
- * Works with the PosixCacheManager.  Uses an SQlite database for cache contents
- * tracking.  Tracking is asynchronously.
+ * Works with the PosixCacheManager.  Uses an SQlite database or an in-memory
+ * index (see quota_index.h) for cache contents tracking.  Tracking is
+ * asynchronously.
  *
  * TODO(jblomer): split into client, server, and protocol classes.
  */
@@ -38,17 +41,36 @@ class PosixQuotaManager : public QuotaManager {
   FRIEND_TEST(T_QuotaManager, Contains);
   FRIEND_TEST(T_QuotaManager, InitDatabase);
   FRIEND_TEST(T_QuotaManager, MakeReturnPipe);
+  FRIEND_TEST(T_QuotaManager, IndexBackend);
+  FRIEND_TEST(T_QuotaManager, UnlinkThreads);
 
  public:
+  /**
+   * Bookkeeping of the cache contents.  Only the selected backend is kept up
+   * to date, the files of the other backend are removed.  Switching the
+   * backend thus rebuilds the bookkeeping from the cache directory.
+   */
+  enum Backend {
+    kBackendSqlite = 0,
+    kBackendMemory,
+  };
+
+  /**
+   * The unlink_rate limits the number of evicted files that are removed per
+   * second, 0 means unlimited.
+   */
   static PosixQuotaManager *Create(const std::string &cache_workspace,
     const uint64_t limit, const uint64_t cleanup_threshold,
-    const bool rebuild_database);
+    const bool rebuild_database, const Backend backend = kBackendSqlite,
+    const unsigned unlink_rate = 0);
   static PosixQuotaManager *CreateShared(
     const std::string &exe_path,
     const std::string &cache_workspace,
     const uint64_t limit,
     const uint64_t cleanup_threshold,
-    bool foreground);
+    bool foreground,
+    const Backend backend = kBackendSqlite,
+    const unsigned unlink_rate = 0);
   static int MainCacheManager(int argc, char **argv);
 
   virtual ~PosixQuotaManager();
@@ -203,7 +225,13 @@ class PosixQuotaManager : public QuotaManager {
    */
   static const uint64_t kVolatileFlag = 1ULL << 63;
 
+  /**
+   * Number of threads that scan the 256 cache sub directories during a rebuild
+   */
+  static const unsigned kNumRebuildThreads = 8;
+
   bool InitDatabase(const bool rebuild_database);
+  bool InitIndex(const std::string &index_file, const bool rebuild_index);
   bool RebuildDatabase();
   void CloseDatabase();
   bool Contains(const std::string &hash_str);
@@ -307,16 +335,34 @@ class PosixQuotaManager : public QuotaManager {
 
   /**
    * If this is true, the unlink operations that correspond to a cleanup run
-   * will be performed in a detached, asynchronous process.
+   * will be performed asynchronously by the unlink threads.
    */
   bool async_delete_;
 
+  /**
+   * Maximum number of evicted files unlinked per second, 0 for unlimited
+   */
+  unsigned unlink_rate_;
+
+  /**
+   * Background unlink threads, created when the command server starts or with
+   * the first asynchronous cleanup
+   */
+  QuotaTrash *trash_;
+
   /**
    * Keeps track of the number of cleanups over time.  Use by
    * `cvmfs_talk cleanup rate`
    */
   perf::MultiRecorder cleanup_recorder_;
 
+  Backend backend_;
+
+  /**
+   * Used instead of the SQlite database for kBackendMemory
+   */
+  QuotaIndex *index_;
+
   sqlite3 *database_;
   sqlite3_stmt *stmt_touch_;
   sqlite3_stmt *stmt_unpin_;
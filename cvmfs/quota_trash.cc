@@ -0,0 +1,226 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include "cvmfs_config.h"
+#include "quota_trash.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+
+#include "logging.h"
+#include "platform.h"
+#include "util/string.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+const char *QuotaTrash::kTrashPrefix = "trash.";
+
+
+QuotaTrash *QuotaTrash::Create(
+  const string &cache_dir,
+  const unsigned num_threads,
+  const unsigned max_rate)
+{
+  assert(num_threads > 0);
+  QuotaTrash *trash = new QuotaTrash(cache_dir, max_rate);
+  trash->fd_cache_dir_ = open(cache_dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (trash->fd_cache_dir_ < 0) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to open cache directory %s (%d)",
+             cache_dir.c_str(), errno);
+    delete trash;
+    return NULL;
+  }
+  if ((mkdirat(trash->fd_cache_dir_, "txn", 0700) != 0) && (errno != EEXIST)) {
+    LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+             "failed to create %s/txn (%d)", cache_dir.c_str(), errno);
+    delete trash;
+    return NULL;
+  }
+
+  // Files left over by a previous instance
+  DIR *dirp = opendir((cache_dir + "/txn").c_str());
+  if (dirp != NULL) {
+    platform_dirent64 *d;
+    while ((d = platform_readdir(dirp)) != NULL) {
+      if (HasPrefix(d->d_name, kTrashPrefix, false))
+        trash->queue_.push_back(string("txn/") + d->d_name);
+    }
+    closedir(dirp);
+  }
+
+  for (unsigned i = 0; i < num_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, MainUnlink, trash) != 0) {
+      LogCvmfs(kLogQuota, kLogDebug | kLogSyslogErr,
+               "failed to start unlink thread");
+      delete trash;
+      return NULL;
+    }
+    trash->threads_.push_back(thread);
+  }
+  LogCvmfs(kLogQuota, kLogDebug,
+           "started %u unlink threads, max rate %u/s, %u left over files",
+           num_threads, max_rate, static_cast<unsigned>(trash->queue_.size()));
+  return trash;
+}
+
+
+QuotaTrash::QuotaTrash(const string &cache_dir, const unsigned max_rate)
+  : cache_dir_(cache_dir)
+  , fd_cache_dir_(-1)
+  , max_rate_(max_rate)
+  , num_busy_(0)
+  , num_unlinked_(0)
+  , next_slot_ns_(0)
+  , terminate_(false)
+{
+  int retval = pthread_mutex_init(&lock_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_work_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_throttle_, NULL);
+  assert(retval == 0);
+  retval = pthread_cond_init(&cond_empty_, NULL);
+  assert(retval == 0);
+}
+
+
+QuotaTrash::~QuotaTrash() {
+  {
+    MutexLockGuard guard(&lock_);
+    terminate_ = true;
+    pthread_cond_broadcast(&cond_work_);
+    pthread_cond_broadcast(&cond_throttle_);
+  }
+  for (unsigned i = 0; i < threads_.size(); ++i)
+    pthread_join(threads_[i], NULL);
+  if (fd_cache_dir_ >= 0)
+    close(fd_cache_dir_);
+  pthread_cond_destroy(&cond_empty_);
+  pthread_cond_destroy(&cond_throttle_);
+  pthread_cond_destroy(&cond_work_);
+  pthread_mutex_destroy(&lock_);
+}
+
+
+/**
+ * Called by the quota manager before it processes further commands, so that
+ * the file is out of the way before a new copy can be inserted.
+ */
+void QuotaTrash::Add(const shash::Any &hash) {
+  const string path = hash.MakePathWithoutSuffix();
+  const string trash_path = string("txn/") + kTrashPrefix + hash.ToString();
+  if (renameat(fd_cache_dir_, path.c_str(),
+               fd_cache_dir_, trash_path.c_str()) != 0)
+  {
+    if (errno == ENOENT)
+      return;
+    LogCvmfs(kLogQuota, kLogDebug, "failed to move %s to trash (%d)",
+             path.c_str(), errno);
+    unlinkat(fd_cache_dir_, path.c_str(), 0);
+    return;
+  }
+
+  MutexLockGuard guard(&lock_);
+  queue_.push_back(trash_path);
+  pthread_cond_signal(&cond_work_);
+}
+
+
+void QuotaTrash::WaitForEmpty() {
+  MutexLockGuard guard(&lock_);
+  while (!queue_.empty() || (num_busy_ > 0))
+    pthread_cond_wait(&cond_empty_, &lock_);
+}
+
+
+uint64_t QuotaTrash::num_pending() {
+  MutexLockGuard guard(&lock_);
+  return queue_.size();
+}
+
+
+uint64_t QuotaTrash::num_unlinked() {
+  MutexLockGuard guard(&lock_);
+  return num_unlinked_;
+}
+
+
+/**
+ * Reserves a time slot for unlinking a batch of files according to the rate
+ * limit.  Returns the monotonic time at which the batch may start.  Must be
+ * called with the lock held.
+ */
+uint64_t QuotaTrash::ScheduleBatch(const unsigned size) {
+  if (max_rate_ == 0)
+    return 0;
+  const uint64_t now = platform_monotonic_time_ns();
+  const uint64_t start = (next_slot_ns_ > now) ? next_slot_ns_ : now;
+  next_slot_ns_ = start + uint64_t(size) * 1000000000ull / max_rate_;
+  return start;
+}
+
+
+void *QuotaTrash::MainUnlink(void *data) {
+  QuotaTrash *trash = reinterpret_cast<QuotaTrash *>(data);
+  vector<string> batch;
+
+  while (true) {
+    batch.clear();
+    {
+      MutexLockGuard guard(&trash->lock_);
+      while (trash->queue_.empty() && !trash->terminate_)
+        pthread_cond_wait(&trash->cond_work_, &trash->lock_);
+      // Queued files are picked up again by the next instance
+      if (trash->terminate_)
+        break;
+      while (!trash->queue_.empty() && (batch.size() < kBatchSize)) {
+        batch.push_back(trash->queue_.front());
+        trash->queue_.pop_front();
+      }
+      trash->num_busy_++;
+
+      // Throttle; a batch interrupted by shutdown stays in the trash
+      const uint64_t start = trash->ScheduleBatch(batch.size());
+      while (!trash->terminate_) {
+        const uint64_t now = platform_monotonic_time_ns();
+        if (now >= start)
+          break;
+        const uint64_t deadline = platform_realtime_ns() + (start - now);
+        struct timespec timeout;
+        timeout.tv_sec = deadline / 1000000000ull;
+        timeout.tv_nsec = deadline % 1000000000ull;
+        pthread_cond_timedwait(&trash->cond_throttle_, &trash->lock_,
+                               &timeout);
+      }
+      if (trash->terminate_) {
+        trash->num_busy_--;
+        break;
+      }
+    }
+
+    unsigned num_unlinked = 0;
+    for (unsigned i = 0; i < batch.size(); ++i) {
+      LogCvmfs(kLogQuota, kLogDebug, "unlink %s", batch[i].c_str());
+      if (unlinkat(trash->fd_cache_dir_, batch[i].c_str(), 0) == 0)
+        num_unlinked++;
+    }
+
+    MutexLockGuard guard(&trash->lock_);
+    trash->num_busy_--;
+    trash->num_unlinked_ += num_unlinked;
+    if (trash->queue_.empty() && (trash->num_busy_ == 0))
+      pthread_cond_broadcast(&trash->cond_empty_);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,95 @@
+/**
+ * This file is part of the CernVM File System.
+ *
+ * Background removal of files evicted by the PosixQuotaManager.
+ */
+
+#ifndef CVMFS_QUOTA_TRASH_H_
+#define CVMFS_QUOTA_TRASH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "util/single_copy.h"
+
+/**
+ * A small pool of threads that unlinks evicted files from the cache directory
+ * while the quota manager continues to serve commands.  Files are unlinked in
+ * batches relative to a directory descriptor of the cache directory.  The
+ * number of unlinks per second can be limited in order to keep the I/O load
+ * of a large cleanup from competing with cache misses.
+ *
+ * Add() renames the evicted file to a per-hash name in the txn directory
+ * before it returns.  A new copy of the file that is committed afterwards
+ * can therefore never be hit by the delayed unlink.  The rename is cheap
+ * compared to the unlink, which releases the data blocks.
+ *
+ * On destruction, the threads finish their current batch and stop.  Queued
+ * files remain in the txn directory; the next QuotaTrash for the cache
+ * directory finds and removes them.
+ */
+class QuotaTrash : SingleCopy {
+ public:
+  static const unsigned kDefaultNumThreads = 2;
+  /**
+   * Maximum number of files a worker takes off the queue at once
+   */
+  static const unsigned kBatchSize = 64;
+  /**
+   * Evicted files are moved to txn/<kTrashPrefix><hash>
+   */
+  static const char *kTrashPrefix;
+
+  /**
+   * max_rate is the maximum number of unlinks per second, 0 means unlimited.
+   */
+  static QuotaTrash *Create(const std::string &cache_dir,
+                            const unsigned num_threads,
+                            const unsigned max_rate);
+  ~QuotaTrash();
+
+  void Add(const shash::Any &hash);
+  void WaitForEmpty();
+
+  uint64_t num_pending();
+  uint64_t num_unlinked();
+
+ private:
+  QuotaTrash(const std::string &cache_dir, const unsigned max_rate);
+  static void *MainUnlink(void *data);
+  uint64_t ScheduleBatch(const unsigned size);
+
+  std::string cache_dir_;
+  int fd_cache_dir_;
+  unsigned max_rate_;
+  std::vector<pthread_t> threads_;
+
+  /**
+   * Protects all members below
+   */
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_work_;
+  /**
+   * Only signaled on termination, interrupts throttled workers
+   */
+  pthread_cond_t cond_throttle_;
+  pthread_cond_t cond_empty_;
+  /**
+   * Trash names relative to the cache directory
+   */
+  std::deque<std::string> queue_;
+  unsigned num_busy_;
+  uint64_t num_unlinked_;
+  /**
+   * Monotonic time in ns before which the next batch must not start
+   */
+  uint64_t next_slot_ns_;
+  bool terminate_;
+};
+
+#endif  // CVMFS_QUOTA_TRASH_H_
@@ -4,11 +4,18 @@
 
 #include "params.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "options.h"
 #include "util/string.h"
 
+namespace {
+
+const unsigned kDefaultNumUploadTasks = 4;
+
+}  // anonymous namespace
+
 namespace receiver {
 
 std::string GetSpoolerTempDir(const std::string& spooler_config) {
@@ -180,6 +187,14 @@ bool GetParamsFromFile(const std::string& repo_name, Params* params) {
     params->upload_stats_db = false;
   }
 
+  // Objects unpacked from a payload are uploaded by that many threads
+  params->num_upload_tasks = kDefaultNumUploadTasks;
+  std::string num_upload_tasks_str;
+  if (parser.GetValue("CVMFS_NUM_UPLOAD_TASKS", &num_upload_tasks_str)) {
+    params->num_upload_tasks =
+      std::max(1U, static_cast<unsigned>(String2Uint64(num_upload_tasks_str)));
+  }
+
   return true;
 }
 
@@ -34,6 +34,7 @@ struct Params {
   size_t max_weight;
   size_t min_weight;
   bool upload_stats_db;
+  unsigned num_upload_tasks;
 };
 
 bool GetParamsFromFile(const std::string& repo_name, Params* params);
@@ -217,6 +217,7 @@ PayloadProcessor::Result PayloadProcessor::Initialize() {
       params.generate_legacy_bulk_chunks, params.use_file_chunking,
       params.min_chunk_size, params.avg_chunk_size, params.max_chunk_size,
       "dummy_token", "dummy_key");
+  definition.num_upload_tasks = params.num_upload_tasks;
 
   uploader_.Destroy();
 
@@ -31,6 +31,10 @@ const unsigned S3FanoutManager::kDefault429ThrottleMs = 250;
 const unsigned S3FanoutManager::kMax429ThrottleMs = 10000;
 const unsigned S3FanoutManager::kThrottleReportIntervalSec = 10;
 const unsigned S3FanoutManager::kDefaultHTTPPort = 80;
+const uint64_t S3FanoutManager::kMinMultipartPartSize = 5 * 1024 * 1024;
+const uint64_t S3FanoutManager::kMaxMultipartPartSize =
+  5ULL * 1024 * 1024 * 1024;
+const unsigned S3FanoutManager::kMaxMultipartParts = 10000;
 
 
 /**
@@ -119,6 +123,12 @@ static size_t CallbackCurlHeader(void *ptr, size_t size, size_t nmemb,
     S3FanoutManager::DetectThrottleIndicator(header_line, info);
   }
 
+  if ((info->request == JobInfo::kReqPutPart) &&
+      HasPrefix(header_line, "etag:", true /* ignore_case */))
+  {
+    info->etag = Trim(header_line.substr(5), true /* trim_newline */);
+  }
+
   return num_bytes;
 }
 
@@ -136,7 +146,21 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
   if (num_bytes == 0)
     return 0;
 
-  uint64_t read_bytes = info->origin->Read(ptr, num_bytes);
+  uint64_t read_bytes;
+  if ((info->request == JobInfo::kReqPutPart) && !info->origin.IsValid()) {
+    const uint64_t remaining = info->part_size - info->part_pos;
+    read_bytes = info->parent->origin->ReadP(
+      ptr, std::min(static_cast<uint64_t>(num_bytes), remaining),
+      info->part_offset + info->part_pos);
+    info->part_pos += read_bytes;
+  } else if ((info->request == JobInfo::kReqInitMultipart) ||
+             (info->request == JobInfo::kReqCopyPart))
+  {
+    // The origin holds the object, which is uploaded by the parts
+    read_bytes = 0;
+  } else {
+    read_bytes = info->origin->Read(ptr, num_bytes);
+  }
 
   LogCvmfs(kLogS3Fanout, kLogDebug,
            "source buffer pushed out %d bytes", read_bytes);
@@ -146,75 +170,129 @@ static size_t CallbackCurlData(void *ptr, size_t size, size_t nmemb,
 
 
 /**
- * For the time being, ignore all received information in the HTTP body
+ * Only the replies to the multipart requests carry information in the body
  */
 static size_t CallbackCurlBody(
-  char * /*ptr*/, size_t size, size_t nmemb, void * /*userdata*/)
+  char *ptr, size_t size, size_t nmemb, void *info_link)
 {
+  JobInfo *info = static_cast<JobInfo *>(info_link);
+  if ((info->request == JobInfo::kReqInitMultipart) ||
+      (info->request == JobInfo::kReqCopyPart) ||
+      (info->request == JobInfo::kReqCompleteMultipart))
+  {
+    info->response_body.append(ptr, size * nmemb);
+  }
   return size * nmemb;
 }
 
 
+/**
+ * Extracts an element from the reply to a multipart request, such as the
+ * UploadId of kReqInitMultipart or the ETag of kReqCopyPart
+ */
+static bool ParseXmlElement(const string &body, const string &name,
+                            string *value)
+{
+  const string tag_begin = "<" + name + ">";
+  const string tag_end = "</" + name + ">";
+  const size_t begin = body.find(tag_begin);
+  if (begin == string::npos)
+    return false;
+  const size_t end = body.find(tag_end, begin + tag_begin.length());
+  if (end == string::npos)
+    return false;
+  *value = body.substr(begin + tag_begin.length(),
+                       end - begin - tag_begin.length());
+  return !value->empty();
+}
+
+
+/**
+ * Size of the data that is sent with the request
+ */
+static uint64_t GetPayloadSize(const JobInfo &info) {
+  if (info.request == JobInfo::kReqPutPart)
+    return info.part_size;
+  if ((info.request == JobInfo::kReqInitMultipart) ||
+      (info.request == JobInfo::kReqCopyPart) || !info.origin.IsValid())
+  {
+    return 0;
+  }
+  return info.origin->GetSize();
+}
+
+
+/**
+ * Size of the object that is uploaded by the job
+ */
+static uint64_t GetObjectSize(const JobInfo &info) {
+  if (!info.copy_source.empty())
+    return info.copy_size;
+  return info.origin->GetSize();
+}
+
+
 /**
  * Called when new curl sockets arrive or existing curl sockets depart.
  */
 int S3FanoutManager::CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                         void *userp, void *socketp) {
-  S3FanoutManager *s3fanout_mgr = static_cast<S3FanoutManager *>(userp);
+  IoThread *io_thread = static_cast<IoThread *>(userp);
+  S3FanoutManager *s3fanout_mgr = io_thread->mgr;
   const int ajobs = *s3fanout_mgr->available_jobs_;
   LogCvmfs(kLogS3Fanout, kLogDebug, "CallbackCurlSocket called with easy "
            "handle %p, socket %d, action %d, up %d, "
            "sp %d, fds_inuse %d, jobs %d",
            easy, s, action, userp,
-           socketp, s3fanout_mgr->watch_fds_inuse_, ajobs);
+           socketp, io_thread->watch_fds_inuse, ajobs);
   if (action == CURL_POLL_NONE)
     return 0;
 
-  // Find s in watch_fds_
+  // Find s in watch_fds
   // First 2 fds are job and terminate pipes (not curl related)
   unsigned index;
-  for (index = 2; index < s3fanout_mgr->watch_fds_inuse_; ++index) {
-    if (s3fanout_mgr->watch_fds_[index].fd == s)
+  for (index = 2; index < io_thread->watch_fds_inuse; ++index) {
+    if (io_thread->watch_fds[index].fd == s)
       break;
   }
   // Or create newly
-  if (index == s3fanout_mgr->watch_fds_inuse_) {
+  if (index == io_thread->watch_fds_inuse) {
     // Extend array if necessary
-    if (s3fanout_mgr->watch_fds_inuse_ == s3fanout_mgr->watch_fds_size_) {
-      s3fanout_mgr->watch_fds_size_ *= 2;
-      s3fanout_mgr->watch_fds_ = static_cast<struct pollfd *>(
-          srealloc(s3fanout_mgr->watch_fds_,
-                   s3fanout_mgr->watch_fds_size_*sizeof(struct pollfd)));
+    if (io_thread->watch_fds_inuse == io_thread->watch_fds_size) {
+      io_thread->watch_fds_size *= 2;
+      io_thread->watch_fds = static_cast<struct pollfd *>(
+          srealloc(io_thread->watch_fds,
+                   io_thread->watch_fds_size*sizeof(struct pollfd)));
     }
-    s3fanout_mgr->watch_fds_[s3fanout_mgr->watch_fds_inuse_].fd = s;
-    s3fanout_mgr->watch_fds_[s3fanout_mgr->watch_fds_inuse_].events = 0;
-    s3fanout_mgr->watch_fds_[s3fanout_mgr->watch_fds_inuse_].revents = 0;
-    s3fanout_mgr->watch_fds_inuse_++;
+    io_thread->watch_fds[io_thread->watch_fds_inuse].fd = s;
+    io_thread->watch_fds[io_thread->watch_fds_inuse].events = 0;
+    io_thread->watch_fds[io_thread->watch_fds_inuse].revents = 0;
+    io_thread->watch_fds_inuse++;
   }
 
   switch (action) {
     case CURL_POLL_IN:
-      s3fanout_mgr->watch_fds_[index].events = POLLIN | POLLPRI;
+      io_thread->watch_fds[index].events = POLLIN | POLLPRI;
       break;
     case CURL_POLL_OUT:
-      s3fanout_mgr->watch_fds_[index].events = POLLOUT | POLLWRBAND;
+      io_thread->watch_fds[index].events = POLLOUT | POLLWRBAND;
       break;
     case CURL_POLL_INOUT:
-      s3fanout_mgr->watch_fds_[index].events =
+      io_thread->watch_fds[index].events =
           POLLIN | POLLPRI | POLLOUT | POLLWRBAND;
       break;
     case CURL_POLL_REMOVE:
-      if (index < s3fanout_mgr->watch_fds_inuse_-1)
-        s3fanout_mgr->watch_fds_[index] =
-            s3fanout_mgr->watch_fds_[s3fanout_mgr->watch_fds_inuse_-1];
-      s3fanout_mgr->watch_fds_inuse_--;
+      if (index < io_thread->watch_fds_inuse-1)
+        io_thread->watch_fds[index] =
+            io_thread->watch_fds[io_thread->watch_fds_inuse-1];
+      io_thread->watch_fds_inuse--;
       // Shrink array if necessary
-      if ((s3fanout_mgr->watch_fds_inuse_ > s3fanout_mgr->watch_fds_max_) &&
-          (s3fanout_mgr->watch_fds_inuse_ < s3fanout_mgr->watch_fds_size_/2)) {
-        s3fanout_mgr->watch_fds_size_ /= 2;
-        s3fanout_mgr->watch_fds_ = static_cast<struct pollfd *>(
-            srealloc(s3fanout_mgr->watch_fds_,
-                     s3fanout_mgr->watch_fds_size_*sizeof(struct pollfd)));
+      if ((io_thread->watch_fds_inuse > s3fanout_mgr->watch_fds_max_) &&
+          (io_thread->watch_fds_inuse < io_thread->watch_fds_size/2)) {
+        io_thread->watch_fds_size /= 2;
+        io_thread->watch_fds = static_cast<struct pollfd *>(
+            srealloc(io_thread->watch_fds,
+                     io_thread->watch_fds_size*sizeof(struct pollfd)));
       }
       break;
     default:
@@ -225,14 +303,34 @@ int S3FanoutManager::CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
 }
 
 
+void S3FanoutManager::CallbackCurlShareLock(
+  CURL * /* handle */,
+  curl_lock_data /* data */,
+  curl_lock_access /* access */,
+  void *userptr)
+{
+  pthread_mutex_lock(static_cast<pthread_mutex_t *>(userptr));
+}
+
+
+void S3FanoutManager::CallbackCurlShareUnlock(
+  CURL * /* handle */,
+  curl_lock_data /* data */,
+  void *userptr)
+{
+  pthread_mutex_unlock(static_cast<pthread_mutex_t *>(userptr));
+}
+
+
 /**
  * Worker thread event loop.
  */
 void *S3FanoutManager::MainUpload(void *data) {
   LogCvmfs(kLogS3Fanout, kLogDebug, "Upload I/O thread started");
-  S3FanoutManager *s3fanout_mgr = static_cast<S3FanoutManager *>(data);
+  IoThread *io_thread = static_cast<IoThread *>(data);
+  S3FanoutManager *s3fanout_mgr = io_thread->mgr;
 
-  s3fanout_mgr->InitPipeWatchFds();
+  s3fanout_mgr->InitPipeWatchFds(io_thread);
 
   // Don't schedule more jobs into the multi handle than the maximum number of
   // parallel connections.  This should prevent starvation and thus a timeout
@@ -242,12 +340,12 @@ void *S3FanoutManager::MainUpload(void *data) {
   while (true) {
     // Check events with 100ms timeout
     int timeout_ms = 100;
-    int retval = poll(s3fanout_mgr->watch_fds_, s3fanout_mgr->watch_fds_inuse_,
+    int retval = poll(io_thread->watch_fds, io_thread->watch_fds_inuse,
                       timeout_ms);
     if (retval == 0) {
       // Handle timeout
       int still_running = 0;
-      retval = curl_multi_socket_action(s3fanout_mgr->curl_multi_,
+      retval = curl_multi_socket_action(io_thread->curl_multi,
                                         CURL_SOCKET_TIMEOUT,
                                         0,
                                         &still_running);
@@ -261,66 +359,54 @@ void *S3FanoutManager::MainUpload(void *data) {
     }
 
     // Terminate I/O thread
-    if (s3fanout_mgr->watch_fds_[0].revents)
+    if (io_thread->watch_fds[0].revents)
       break;
 
     // New job incoming
-    if (s3fanout_mgr->watch_fds_[1].revents) {
-      s3fanout_mgr->watch_fds_[1].revents = 0;
+    if (io_thread->watch_fds[1].revents) {
+      io_thread->watch_fds[1].revents = 0;
       JobInfo *info;
-      ReadPipe(s3fanout_mgr->pipe_jobs_[0], &info, sizeof(info));
-      CURL *handle = s3fanout_mgr->AcquireCurlHandle();
-      if (handle == NULL) {
-        PANIC(kLogStderr, "Failed to acquire CURL handle.");
-      }
-      s3fanout::Failures init_failure =
-        s3fanout_mgr->InitializeRequest(info, handle);
-      if (init_failure != s3fanout::kFailOk) {
-        PANIC(kLogStderr,
-              "Failed to initialize CURL handle (error: %d - %s | errno: %d)",
-              init_failure, Code2Ascii(init_failure), errno);
+      ReadPipe(io_thread->pipe_jobs[0], &info, sizeof(info));
+      if (info->request == JobInfo::kReqPutPart) {
+        // The next part of a streamed upload, not a job of its own
+        JobInfo *parent = info->parent;
+        if (!s3fanout_mgr->OnStreamedPart(io_thread, info)) {
+          jobs_in_flight--;
+          s3fanout_mgr->ReportJob(parent);
+        }
+      } else {
+        if (s3fanout_mgr->IsMultipartCandidate(*info))
+          s3fanout_mgr->StartMultipart(info);
+        s3fanout_mgr->ScheduleJob(io_thread, info);
+        jobs_in_flight++;
       }
-      s3fanout_mgr->SetUrlOptions(info);
-
-      curl_multi_add_handle(s3fanout_mgr->curl_multi_, handle);
-      s3fanout_mgr->active_requests_->insert(info);
-      jobs_in_flight++;
-      int still_running = 0, retval = 0;
-      retval = curl_multi_socket_action(s3fanout_mgr->curl_multi_,
-                                        CURL_SOCKET_TIMEOUT,
-                                        0,
-                                        &still_running);
-
-      LogCvmfs(kLogS3Fanout, kLogDebug,
-               "curl_multi_socket_action: %d - %d",
-               retval, still_running);
     }
 
 
     // Activity on curl sockets
     // Within this loop the curl_multi_socket_action() may cause socket(s)
-    // to be removed from watch_fds_. If a socket is removed it is replaced
+    // to be removed from watch_fds. If a socket is removed it is replaced
     // by the socket at the end of the array and the inuse count is decreased.
     // Therefore loop over the array in reverse order.
     // First 2 fds are job and terminate pipes (not curl related)
-    for (int32_t i = s3fanout_mgr->watch_fds_inuse_ - 1; i >= 2; --i) {
-      if (static_cast<uint32_t>(i) >= s3fanout_mgr->watch_fds_inuse_) {
+    for (int32_t i = io_thread->watch_fds_inuse - 1; i >= 2; --i) {
+      if (static_cast<uint32_t>(i) >= io_thread->watch_fds_inuse) {
         continue;
       }
-      if (s3fanout_mgr->watch_fds_[i].revents) {
+      if (io_thread->watch_fds[i].revents) {
         int ev_bitmask = 0;
-        if (s3fanout_mgr->watch_fds_[i].revents & (POLLIN | POLLPRI))
+        if (io_thread->watch_fds[i].revents & (POLLIN | POLLPRI))
           ev_bitmask |= CURL_CSELECT_IN;
-        if (s3fanout_mgr->watch_fds_[i].revents & (POLLOUT | POLLWRBAND))
+        if (io_thread->watch_fds[i].revents & (POLLOUT | POLLWRBAND))
           ev_bitmask |= CURL_CSELECT_OUT;
-        if (s3fanout_mgr->watch_fds_[i].revents &
+        if (io_thread->watch_fds[i].revents &
             (POLLERR | POLLHUP | POLLNVAL))
           ev_bitmask |= CURL_CSELECT_ERR;
-        s3fanout_mgr->watch_fds_[i].revents = 0;
+        io_thread->watch_fds[i].revents = 0;
 
         int still_running = 0;
-        retval = curl_multi_socket_action(s3fanout_mgr->curl_multi_,
-                                          s3fanout_mgr->watch_fds_[i].fd,
+        retval = curl_multi_socket_action(io_thread->curl_multi,
+                                          io_thread->watch_fds[i].fd,
                                           ev_bitmask,
                                           &still_running);
       }
@@ -329,53 +415,311 @@ void *S3FanoutManager::MainUpload(void *data) {
     // Check if transfers are completed
     CURLMsg *curl_msg;
     int msgs_in_queue;
-    while ((curl_msg = curl_multi_info_read(s3fanout_mgr->curl_multi_,
+    while ((curl_msg = curl_multi_info_read(io_thread->curl_multi,
                                             &msgs_in_queue)))
     {
       assert(curl_msg->msg == CURLMSG_DONE);
 
-      s3fanout_mgr->statistics_->num_requests++;
+      {
+        MutexLockGuard m(s3fanout_mgr->statistics_lock_);
+        s3fanout_mgr->statistics_->num_requests++;
+      }
       JobInfo *info;
       CURL *easy_handle = curl_msg->easy_handle;
       int curl_error = curl_msg->data.result;
       curl_easy_getinfo(easy_handle, CURLINFO_PRIVATE, &info);
 
-      curl_multi_remove_handle(s3fanout_mgr->curl_multi_, easy_handle);
+      curl_multi_remove_handle(io_thread->curl_multi, easy_handle);
       if (s3fanout_mgr->VerifyAndFinalize(curl_error, info)) {
-        curl_multi_add_handle(s3fanout_mgr->curl_multi_, easy_handle);
+        curl_multi_add_handle(io_thread->curl_multi, easy_handle);
         int still_running = 0;
-        curl_multi_socket_action(s3fanout_mgr->curl_multi_,
+        curl_multi_socket_action(io_thread->curl_multi,
                                  CURL_SOCKET_TIMEOUT,
                                  0,
                                  &still_running);
       } else {
         // Return easy handle into pool and write result back
-        jobs_in_flight--;
-        s3fanout_mgr->active_requests_->erase(info);
+        io_thread->active_requests.erase(info);
         s3fanout_mgr->ReleaseCurlHandle(info, easy_handle);
-        s3fanout_mgr->available_jobs_->Decrement();
+        if (s3fanout_mgr->ContinueMultipart(io_thread, info))
+          continue;
 
-        MutexLockGuard m(s3fanout_mgr->jobs_completed_lock_);
-        s3fanout_mgr->jobs_completed_.push_back(info);
+        jobs_in_flight--;
+        s3fanout_mgr->ReportJob(info);
       }
     }
   }
 
-  set<CURL *>::iterator i = s3fanout_mgr->pool_handles_inuse_->begin();
-  const set<CURL *>::const_iterator i_end =
-    s3fanout_mgr->pool_handles_inuse_->end();
+  // Only the handles of this thread's multi handle; the handle pool is shared
+  // with the other I/O threads
+  set<JobInfo *>::const_iterator i = io_thread->active_requests.begin();
+  const set<JobInfo *>::const_iterator i_end =
+    io_thread->active_requests.end();
   for (; i != i_end; ++i) {
-    curl_multi_remove_handle(s3fanout_mgr->curl_multi_, *i);
-    curl_easy_cleanup(*i);
+    curl_multi_remove_handle(io_thread->curl_multi, (*i)->curl_handle);
   }
-  s3fanout_mgr->pool_handles_inuse_->clear();
-  free(s3fanout_mgr->watch_fds_);
+  free(io_thread->watch_fds);
+  io_thread->watch_fds = NULL;
 
   LogCvmfs(kLogS3Fanout, kLogDebug, "Upload I/O thread terminated");
   return NULL;
 }
 
 
+/**
+ * Hands a job to the multi handle of the I/O thread.  Only called from within
+ * the I/O thread.
+ */
+void S3FanoutManager::ScheduleJob(IoThread *io_thread, JobInfo *info) {
+  CURL *handle = AcquireCurlHandle();
+  if (handle == NULL) {
+    PANIC(kLogStderr, "Failed to acquire CURL handle.");
+  }
+  s3fanout::Failures init_failure = InitializeRequest(info, handle);
+  if (init_failure != s3fanout::kFailOk) {
+    PANIC(kLogStderr,
+          "Failed to initialize CURL handle (error: %d - %s | errno: %d)",
+          init_failure, Code2Ascii(init_failure), errno);
+  }
+  SetUrlOptions(info);
+
+  curl_multi_add_handle(io_thread->curl_multi, handle);
+  io_thread->active_requests.insert(info);
+  int still_running = 0, retval = 0;
+  retval = curl_multi_socket_action(io_thread->curl_multi,
+                                    CURL_SOCKET_TIMEOUT,
+                                    0,
+                                    &still_running);
+
+  LogCvmfs(kLogS3Fanout, kLogDebug,
+           "curl_multi_socket_action: %d - %d",
+           retval, still_running);
+}
+
+
+/**
+ * Hands a finished job over to S3FanoutManager::PopCompletedJobs().  Only
+ * called from within the I/O thread.
+ */
+void S3FanoutManager::ReportJob(JobInfo *info) {
+  available_jobs_->Decrement();
+
+  MutexLockGuard m(jobs_completed_lock_);
+  jobs_completed_.push_back(info);
+}
+
+
+bool S3FanoutManager::IsMultipartCandidate(const JobInfo &info) const {
+  if ((info.request != JobInfo::kReqPutCas) &&
+      (info.request != JobInfo::kReqPutDotCvmfs) &&
+      (info.request != JobInfo::kReqPutHtml))
+  {
+    return false;
+  }
+  // There is no single request that copies objects of all sizes
+  if (!info.copy_source.empty())
+    return true;
+  if (config_.multipart_threshold == 0)
+    return false;
+  const uint64_t size = info.origin->GetSize();
+  return (size >= config_.multipart_threshold) &&
+         (size > config_.multipart_part_size);
+}
+
+
+/**
+ * Turns a PUT job into the first request of a multipart upload.  The object
+ * remains in the origin until all the parts are uploaded.
+ */
+void S3FanoutManager::StartMultipart(JobInfo *info) const {
+  const uint64_t size = GetObjectSize(*info);
+  uint64_t part_size = config_.multipart_part_size;
+  if (size > part_size * kMaxMultipartParts)
+    part_size = (size + kMaxMultipartParts - 1) / kMaxMultipartParts;
+  const unsigned num_parts = (size + part_size - 1) / part_size;
+  LogCvmfs(kLogS3Fanout, kLogDebug, "uploading %s in %u parts",
+           info->object_key.c_str(), num_parts);
+
+  info->multipart =
+    new JobInfo::MultipartState(info->request, part_size, num_parts);
+  info->request = JobInfo::kReqInitMultipart;
+  info->payload_size = size;
+}
+
+
+/**
+ * Schedules the next parts of a multipart upload, so that at most
+ * multipart_parallel_parts parts of the object are uploaded at a time.  The
+ * parts read from the origin of the object, which is either in memory or in a
+ * memory mapped file.  The parts of a copied object are copied by the server.
+ * The parts of a streamed upload are already bounded by the producer.
+ */
+void S3FanoutManager::ScheduleParts(IoThread *io_thread, JobInfo *info) {
+  JobInfo::MultipartState *multipart = info->multipart.weak_ref();
+  if (multipart->streamed) {
+    for (unsigned i = 0; i < multipart->parts_waiting.size(); ++i) {
+      if (multipart->error_code != kFailOk) {
+        delete multipart->parts_waiting[i];
+        multipart->parts_pending->Decrement();
+        continue;
+      }
+      multipart->parts_in_flight++;
+      ScheduleJob(io_thread, multipart->parts_waiting[i]);
+    }
+    multipart->parts_waiting.clear();
+    return;
+  }
+
+  const uint64_t size = GetObjectSize(*info);
+  while ((multipart->next_part < multipart->num_parts) &&
+         (multipart->parts_in_flight < config_.multipart_parallel_parts))
+  {
+    JobInfo *part = new JobInfo(info->object_key, NULL, NULL);
+    part->request = info->copy_source.empty() ?
+                    JobInfo::kReqPutPart : JobInfo::kReqCopyPart;
+    part->parent = info;
+    part->part_number = multipart->next_part + 1;
+    part->part_offset = multipart->next_part * multipart->part_size;
+    part->part_size =
+      std::min(multipart->part_size, size - part->part_offset);
+    multipart->next_part++;
+    multipart->parts_in_flight++;
+    ScheduleJob(io_thread, part);
+  }
+}
+
+
+/**
+ * Streamed parts wait until the upload is initiated.  Parts of an upload that
+ * failed are dropped.  A part without origin marks the end of the stream, see
+ * CloseStreamedJob().
+ * Returns false if that finishes the upload, i.e. it could not be initiated.
+ */
+bool S3FanoutManager::OnStreamedPart(IoThread *io_thread, JobInfo *part) {
+  JobInfo *info = part->parent;
+  JobInfo::MultipartState *multipart = info->multipart.weak_ref();
+  if (!part->origin.IsValid()) {
+    multipart->sealed = true;
+    multipart->num_parts = multipart->next_part;
+    if ((part->error_code != kFailOk) && (multipart->error_code == kFailOk))
+      multipart->error_code = part->error_code;
+    delete part;
+  } else {
+    multipart->parts_waiting.push_back(part);
+  }
+
+  if (!multipart->initiated)
+    return true;
+  ScheduleParts(io_thread, info);
+  return FinishMultipart(io_thread, info);
+}
+
+
+/**
+ * Once all parts are through, the upload is either completed or aborted.
+ */
+bool S3FanoutManager::OnPartDone(IoThread *io_thread, JobInfo *part) {
+  JobInfo *info = part->parent;
+  JobInfo::MultipartState *multipart = info->multipart.weak_ref();
+  multipart->parts_in_flight--;
+  if ((part->error_code == kFailOk) && part->etag.empty())
+    part->error_code = kFailOther;
+  if (part->error_code == kFailOk) {
+    if (multipart->etags.size() < part->part_number)
+      multipart->etags.resize(part->part_number);
+    multipart->etags[part->part_number - 1] = part->etag;
+  } else if (multipart->error_code == kFailOk) {
+    LogCvmfs(kLogS3Fanout, kLogStderr, "S3: failed to upload part %u of %s",
+             part->part_number, info->object_key.c_str());
+    multipart->error_code = part->error_code;
+  }
+  delete part;
+  if (multipart->streamed)
+    multipart->parts_pending->Decrement();
+
+  if (multipart->error_code == kFailOk)
+    ScheduleParts(io_thread, info);
+  return FinishMultipart(io_thread, info);
+}
+
+
+/**
+ * Completes or aborts the upload if all its parts are through.  Returns false
+ * if the job is finished because the upload was never initiated.
+ */
+bool S3FanoutManager::FinishMultipart(IoThread *io_thread, JobInfo *info) {
+  JobInfo::MultipartState *multipart = info->multipart.weak_ref();
+  if ((multipart->parts_in_flight > 0) || !multipart->sealed)
+    return true;
+
+  if (multipart->error_code != kFailOk) {
+    if (multipart->upload_id.empty()) {
+      info->error_code = multipart->error_code;
+      info->origin.Destroy();
+      return false;
+    }
+    info->request = JobInfo::kReqAbortMultipart;
+    info->origin.Destroy();
+    ScheduleJob(io_thread, info);
+    return true;
+  }
+
+  string body = "<CompleteMultipartUpload>";
+  for (unsigned i = 0; i < multipart->num_parts; ++i) {
+    body += "<Part><PartNumber>" + StringifyInt(i + 1) + "</PartNumber>"
+            "<ETag>" + multipart->etags[i] + "</ETag></Part>";
+  }
+  body += "</CompleteMultipartUpload>";
+  FileBackedBuffer *origin = FileBackedBuffer::Create(body.length() + 1);
+  origin->Append(body.data(), body.length());
+  origin->Commit();
+  info->request = JobInfo::kReqCompleteMultipart;
+  info->origin = origin;
+  ScheduleJob(io_thread, info);
+  return true;
+}
+
+
+/**
+ * Called for finished jobs.  Returns true if the job is not yet done because
+ * it is part of a multipart upload that goes on.
+ */
+bool S3FanoutManager::ContinueMultipart(IoThread *io_thread, JobInfo *info) {
+  switch (info->request) {
+    case JobInfo::kReqPutPart:
+    case JobInfo::kReqCopyPart:
+      return OnPartDone(io_thread, info);
+    case JobInfo::kReqInitMultipart:
+      if (!info->multipart->streamed) {
+        if (info->error_code != kFailOk)
+          return false;
+        ScheduleParts(io_thread, info);
+        return true;
+      }
+      // Even a failed upload waits for the end of the stream because the
+      // producer may still push parts that refer to the job
+      info->multipart->initiated = true;
+      if ((info->error_code != kFailOk) &&
+          (info->multipart->error_code == kFailOk))
+      {
+        info->multipart->error_code = info->error_code;
+      }
+      ScheduleParts(io_thread, info);
+      return FinishMultipart(io_thread, info);
+    case JobInfo::kReqCompleteMultipart:
+      if (info->error_code == kFailOk)
+        return false;
+      // Clean up the parts
+      info->multipart->error_code = info->error_code;
+      info->request = JobInfo::kReqAbortMultipart;
+      ScheduleJob(io_thread, info);
+      return true;
+    default:
+      return false;
+  }
+}
+
+
 /**
  * Gets an idle CURL handle from the pool. Creates a new one and adds it to
  * the pool if necessary.
@@ -438,17 +782,17 @@ void S3FanoutManager::ReleaseCurlHandle(JobInfo *info, CURL *handle) const {
   pool_handles_inuse_->erase(elem);
 }
 
-void S3FanoutManager::InitPipeWatchFds() {
-  assert(watch_fds_inuse_ == 0);
-  assert(watch_fds_size_ >= 2);
-  watch_fds_[0].fd = pipe_terminate_[0];
-  watch_fds_[0].events = POLLIN | POLLPRI;
-  watch_fds_[0].revents = 0;
-  ++watch_fds_inuse_;
-  watch_fds_[1].fd = pipe_jobs_[0];
-  watch_fds_[1].events = POLLIN | POLLPRI;
-  watch_fds_[1].revents = 0;
-  ++watch_fds_inuse_;
+void S3FanoutManager::InitPipeWatchFds(IoThread *io_thread) {
+  assert(io_thread->watch_fds_inuse == 0);
+  assert(io_thread->watch_fds_size >= 2);
+  io_thread->watch_fds[0].fd = pipe_terminate_[0];
+  io_thread->watch_fds[0].events = POLLIN | POLLPRI;
+  io_thread->watch_fds[0].revents = 0;
+  ++io_thread->watch_fds_inuse;
+  io_thread->watch_fds[1].fd = io_thread->pipe_jobs[0];
+  io_thread->watch_fds[1].events = POLLIN | POLLPRI;
+  io_thread->watch_fds[1].revents = 0;
+  ++io_thread->watch_fds_inuse;
 }
 
 /**
@@ -465,13 +809,20 @@ bool S3FanoutManager::MkV2Authz(const JobInfo &info, vector<string> *headers)
   string content_type = GetContentType(info);
   string request = GetRequestString(info);
 
+  string query = GetQueryString(info);
+  if (!query.empty())
+    query = "?" + query;
+
+  const vector<pair<string, string> > copy_headers = GetCopyHeaders(info);
   string timestamp = RfcTimestamp();
   string to_sign = request + "\n" +
                    payload_hash + "\n" +
                    content_type + "\n" +
                    timestamp + "\n" +
-                   "x-amz-acl:public-read" + "\n" +  // default ACL
-                   "/" + config_.bucket + "/" + info.object_key;
+                   "x-amz-acl:public-read" + "\n";  // default ACL
+  for (unsigned i = 0; i < copy_headers.size(); ++i)
+    to_sign += copy_headers[i].first + ":" + copy_headers[i].second + "\n";
+  to_sign += "/" + config_.bucket + "/" + info.object_key + query;
   LogCvmfs(kLogS3Fanout, kLogDebug, "%s string to sign for: %s",
            request.c_str(), info.object_key.c_str());
 
@@ -486,6 +837,8 @@ bool S3FanoutManager::MkV2Authz(const JobInfo &info, vector<string> *headers)
                                    hmac.GetDigestSize())));
   headers->push_back("Date: " + timestamp);
   headers->push_back("X-Amz-Acl: public-read");
+  for (unsigned i = 0; i < copy_headers.size(); ++i)
+    headers->push_back(copy_headers[i].first + ": " + copy_headers[i].second);
   if (!payload_hash.empty())
     headers->push_back("Content-MD5: " + payload_hash);
   if (!content_type.empty())
@@ -526,6 +879,7 @@ string S3FanoutManager::GetUriEncode(const string &val, bool encode_slash)
 
 string S3FanoutManager::GetAwsV4SigningKey(const string &date) const
 {
+  MutexLockGuard guard(signing_key_lock_);
   if (last_signing_key_.first == date)
     return last_signing_key_.second;
 
@@ -567,22 +921,40 @@ bool S3FanoutManager::MkV4Authz(const JobInfo &info, vector<string> *headers)
     headers->push_back("Content-Type: " + content_type);
     canonical_headers += "content-type:" + content_type + "\n";
   }
-  signed_headers += "host;x-amz-acl;x-amz-content-sha256;x-amz-date";
+  signed_headers += "host;x-amz-acl;x-amz-content-sha256;";
   canonical_headers +=
     "host:" + canonical_hostname + "\n" +
     "x-amz-acl:public-read\n"
-    "x-amz-content-sha256:" + payload_hash + "\n" +
-    "x-amz-date:" + timestamp + "\n";
+    "x-amz-content-sha256:" + payload_hash + "\n";
+  const vector<pair<string, string> > copy_headers = GetCopyHeaders(info);
+  for (unsigned i = 0; i < copy_headers.size(); ++i) {
+    signed_headers += copy_headers[i].first + ";";
+    canonical_headers +=
+      copy_headers[i].first + ":" + copy_headers[i].second + "\n";
+    headers->push_back(copy_headers[i].first + ": " + copy_headers[i].second);
+  }
+  signed_headers += "x-amz-date";
+  canonical_headers += "x-amz-date:" + timestamp + "\n";
 
   string scope = date + "/" + config_.region + "/s3/aws4_request";
   string uri = config_.dns_buckets ?
                  (string("/") + info.object_key) :
                  (string("/") + config_.bucket + "/" + info.object_key);
 
+  // Parameters without a value need a trailing '=' in the canonical query
+  vector<string> query_params;
+  const string query = GetQueryString(info);
+  if (!query.empty())
+    query_params = SplitString(query, '&');
+  for (unsigned i = 0; i < query_params.size(); ++i) {
+    if (query_params[i].find('=') == string::npos)
+      query_params[i] += "=";
+  }
+
   string canonical_request =
     GetRequestString(info) + "\n" +
     GetUriEncode(uri, false) + "\n" +
-    "\n" +
+    JoinStrings(query_params, "&") + "\n" +
     canonical_headers + "\n" +
     signed_headers + "\n" +
     payload_hash;
@@ -626,6 +998,8 @@ int S3FanoutManager::InitializeDnsSettings(
   CURL *handle,
   std::string host_with_port) const
 {
+  MutexLockGuard guard(curl_handle_lock_);
+
   // Use existing handle
   std::map<CURL *, S3FanOutDnsEntry *>::const_iterator it =
       curl_sharehandles_->find(handle);
@@ -684,6 +1058,15 @@ int S3FanoutManager::InitializeDnsSettings(
                                                 CURLSHOPT_SHARE,
                                                 CURL_LOCK_DATA_DNS);
     assert(share_retval == CURLSHE_OK);
+    share_retval = curl_share_setopt(dnse->sharehandle, CURLSHOPT_LOCKFUNC,
+                                     CallbackCurlShareLock);
+    assert(share_retval == CURLSHE_OK);
+    share_retval = curl_share_setopt(dnse->sharehandle, CURLSHOPT_UNLOCKFUNC,
+                                     CallbackCurlShareUnlock);
+    assert(share_retval == CURLSHE_OK);
+    share_retval = curl_share_setopt(dnse->sharehandle, CURLSHOPT_USERDATA,
+                                     share_lock_);
+    assert(share_retval == CURLSHE_OK);
     sharehandles_->insert(dnse);
   }
   if (dnse == NULL) {
@@ -707,7 +1090,10 @@ bool S3FanoutManager::MkPayloadHash(const JobInfo &info, string *hex_hash)
 {
   if ((info.request == JobInfo::kReqHeadOnly) ||
       (info.request == JobInfo::kReqHeadPut) ||
-      (info.request == JobInfo::kReqDelete))
+      (info.request == JobInfo::kReqDelete) ||
+      (info.request == JobInfo::kReqInitMultipart) ||
+      (info.request == JobInfo::kReqCopyPart) ||
+      (info.request == JobInfo::kReqAbortMultipart))
   {
     switch (config_.authz_method) {
       case kAuthzAwsV2:
@@ -728,10 +1114,16 @@ bool S3FanoutManager::MkPayloadHash(const JobInfo &info, string *hex_hash)
   shash::Any payload_hash(shash::kMd5);
 
   unsigned char *data;
-  unsigned int nbytes =
-    info.origin->Data(reinterpret_cast<void **>(&data),
-                             info.origin->GetSize(), 0);
-  assert(nbytes == info.origin->GetSize());
+  unsigned int nbytes;
+  if ((info.request == JobInfo::kReqPutPart) && !info.origin.IsValid()) {
+    nbytes = info.parent->origin->Data(reinterpret_cast<void **>(&data),
+                                       info.part_size, info.part_offset);
+    assert(nbytes == info.part_size);
+  } else {
+    nbytes = info.origin->Data(reinterpret_cast<void **>(&data),
+                               info.origin->GetSize(), 0);
+    assert(nbytes == info.origin->GetSize());
+  }
 
   switch (config_.authz_method) {
     case kAuthzAwsV2:
@@ -758,20 +1150,54 @@ string S3FanoutManager::GetRequestString(const JobInfo &info) const {
     case JobInfo::kReqPutDotCvmfs:
     case JobInfo::kReqPutHtml:
     case JobInfo::kReqPutBucket:
+    case JobInfo::kReqPutPart:
+    case JobInfo::kReqCopyPart:
       return "PUT";
     case JobInfo::kReqDelete:
+    case JobInfo::kReqAbortMultipart:
       return "DELETE";
+    case JobInfo::kReqInitMultipart:
+    case JobInfo::kReqCompleteMultipart:
+      return "POST";
     default:
       PANIC(NULL);
   }
 }
 
 
-string S3FanoutManager::GetContentType(const JobInfo &info) const {
+/**
+ * The sub-resource of the multipart requests.  The parameters are sorted and
+ * URI encoded, as required by the signatures.
+ */
+string S3FanoutManager::GetQueryString(const JobInfo &info) const {
   switch (info.request) {
+    case JobInfo::kReqInitMultipart:
+      return "uploads";
+    case JobInfo::kReqPutPart:
+    case JobInfo::kReqCopyPart:
+      return "partNumber=" + StringifyInt(info.part_number) + "&uploadId=" +
+             GetUriEncode(info.parent->multipart->upload_id, true);
+    case JobInfo::kReqCompleteMultipart:
+    case JobInfo::kReqAbortMultipart:
+      return "uploadId=" + GetUriEncode(info.multipart->upload_id, true);
+    default:
+      return "";
+  }
+}
+
+
+string S3FanoutManager::GetContentType(const JobInfo &info) const {
+  // The object gets its content type when the multipart upload starts
+  const JobInfo::RequestType request =
+    (info.request == JobInfo::kReqInitMultipart) ?
+    info.multipart->put_request : info.request;
+  switch (request) {
     case JobInfo::kReqHeadOnly:
     case JobInfo::kReqHeadPut:
     case JobInfo::kReqDelete:
+    case JobInfo::kReqPutPart:
+    case JobInfo::kReqCopyPart:
+    case JobInfo::kReqAbortMultipart:
       return "";
     case JobInfo::kReqPutCas:
       return "application/octet-stream";
@@ -780,6 +1206,7 @@ string S3FanoutManager::GetContentType(const JobInfo &info) const {
     case JobInfo::kReqPutHtml:
       return "text/html";
     case JobInfo::kReqPutBucket:
+    case JobInfo::kReqCompleteMultipart:
       return "text/xml";
     default:
       PANIC(NULL);
@@ -787,6 +1214,25 @@ string S3FanoutManager::GetContentType(const JobInfo &info) const {
 }
 
 
+/**
+ * The source of a copied part as headers with lower case names, sorted as
+ * required by the signatures
+ */
+vector<pair<string, string> > S3FanoutManager::GetCopyHeaders(
+  const JobInfo &info) const
+{
+  vector<pair<string, string> > headers;
+  if (info.request != JobInfo::kReqCopyPart)
+    return headers;
+  headers.push_back(make_pair("x-amz-copy-source", GetUriEncode(
+    "/" + config_.bucket + "/" + info.parent->copy_source, false)));
+  headers.push_back(make_pair("x-amz-copy-source-range", "bytes=" +
+    StringifyInt(info.part_offset) + "-" +
+    StringifyInt(info.part_offset + info.part_size - 1)));
+  return headers;
+}
+
+
 /**
  * Request parameters set the URL and other options such as timeout and
  * proxy.
@@ -801,16 +1247,23 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   info->throttle_ms = 0;
   info->throttle_timestamp = 0;
   info->http_headers = NULL;
+  info->etag.clear();
+  info->response_body.clear();
   // info->payload_size is needed in S3Uploader::MainCollectResults,
-  // where info->origin is already destroyed.
-  info->payload_size = info->origin->GetSize();
+  // where info->origin is already destroyed.  A multipart upload keeps the
+  // size of the object.
+  if (!info->multipart.IsValid()) {
+    info->payload_size = info->copy_source.empty() ?
+                         GetPayloadSize(*info) : info->copy_size;
+  }
 
   InitializeDnsSettings(handle, complete_hostname_);
 
   CURLcode retval;
   if ((info->request == JobInfo::kReqHeadOnly) ||
       (info->request == JobInfo::kReqHeadPut) ||
-      (info->request == JobInfo::kReqDelete))
+      (info->request == JobInfo::kReqDelete) ||
+      (info->request == JobInfo::kReqAbortMultipart))
   {
     retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 0);
     assert(retval == CURLE_OK);
@@ -819,7 +1272,9 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
     info->http_headers =
       curl_slist_append(info->http_headers, "Content-Length: 0");
 
-    if (info->request == JobInfo::kReqDelete) {
+    if ((info->request == JobInfo::kReqDelete) ||
+        (info->request == JobInfo::kReqAbortMultipart))
+    {
       retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST,
                                 GetRequestString(*info).c_str());
       assert(retval == CURLE_OK);
@@ -828,20 +1283,32 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
       assert(retval == CURLE_OK);
     }
   } else {
-    retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
-    assert(retval == CURLE_OK);
+    if ((info->request == JobInfo::kReqInitMultipart) ||
+        (info->request == JobInfo::kReqCompleteMultipart))
+    {
+      retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST,
+                                GetRequestString(*info).c_str());
+      assert(retval == CURLE_OK);
+    } else {
+      retval = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
+      assert(retval == CURLE_OK);
+    }
     retval = curl_easy_setopt(handle, CURLOPT_UPLOAD, 1);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_NOBODY, 0);
     assert(retval == CURLE_OK);
     retval = curl_easy_setopt(handle, CURLOPT_INFILESIZE_LARGE,
-                              static_cast<curl_off_t>(info->origin->GetSize()));
+                              static_cast<curl_off_t>(GetPayloadSize(*info)));
     assert(retval == CURLE_OK);
 
-    if (info->request == JobInfo::kReqPutDotCvmfs) {
+    // The object gets its cache control when the multipart upload starts
+    const JobInfo::RequestType object_request =
+      (info->request == JobInfo::kReqInitMultipart) ?
+      info->multipart->put_request : info->request;
+    if (object_request == JobInfo::kReqPutDotCvmfs) {
       info->http_headers =
           curl_slist_append(info->http_headers, kCacheControlDotCvmfs);
-    } else if (info->request == JobInfo::kReqPutCas) {
+    } else if (object_request == JobInfo::kReqPutCas) {
       info->http_headers =
           curl_slist_append(info->http_headers, kCacheControlCas);
     }
@@ -888,6 +1355,9 @@ Failures S3FanoutManager::InitializeRequest(JobInfo *info, CURL *handle) const {
   retval = curl_easy_setopt(handle, CURLOPT_READDATA,
                             static_cast<void *>(info));
   assert(retval == CURLE_OK);
+  retval = curl_easy_setopt(handle, CURLOPT_WRITEDATA,
+                            static_cast<void *>(info));
+  assert(retval == CURLE_OK);
   retval = curl_easy_setopt(handle, CURLOPT_HTTPHEADER, info->http_headers);
   assert(retval == CURLE_OK);
   if (opt_ipv4_only_) {
@@ -924,7 +1394,7 @@ void S3FanoutManager::SetUrlOptions(JobInfo *info) const {
     assert(retval == CURLE_OK);
   }
 
-  string url = MkUrl(info->object_key);
+  string url = MkUrl(info->object_key, GetQueryString(*info));
   retval = curl_easy_setopt(curl_handle, CURLOPT_URL, url.c_str());
   assert(retval == CURLE_OK);
 }
@@ -936,8 +1406,10 @@ void S3FanoutManager::SetUrlOptions(JobInfo *info) const {
 void S3FanoutManager::UpdateStatistics(CURL *handle) {
   double val;
 
-  if (curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD, &val) == CURLE_OK)
+  if (curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD, &val) == CURLE_OK) {
+    MutexLockGuard guard(statistics_lock_);
     statistics_->transferred_bytes += val;
+  }
 }
 
 
@@ -962,28 +1434,36 @@ bool S3FanoutManager::CanRetry(const JobInfo *info) {
 void S3FanoutManager::Backoff(JobInfo *info) {
   if (info->error_code != kFailRetry)
     info->num_retries++;
-  statistics_->num_retries++;
+  {
+    MutexLockGuard guard(statistics_lock_);
+    statistics_->num_retries++;
+  }
 
   if (info->throttle_ms > 0) {
     LogCvmfs(kLogS3Fanout, kLogDebug, "throttling for %d ms",
              info->throttle_ms);
     uint64_t now = platform_monotonic_time();
     if ((info->throttle_timestamp + (info->throttle_ms / 1000)) >= now) {
-      if ((now - timestamp_last_throttle_report_) > kThrottleReportIntervalSec)
       {
-        LogCvmfs(kLogS3Fanout, kLogStdout,
-                 "Warning: S3 backend throttling %ums "
-                 "(total backoff time so far %ums)",
-                 info->throttle_ms,
-                 statistics_->ms_throttled);
-        timestamp_last_throttle_report_ = now;
+        MutexLockGuard guard(statistics_lock_);
+        if ((now - timestamp_last_throttle_report_) >
+            kThrottleReportIntervalSec)
+        {
+          LogCvmfs(kLogS3Fanout, kLogStdout,
+                   "Warning: S3 backend throttling %ums "
+                   "(total backoff time so far %ums)",
+                   info->throttle_ms,
+                   statistics_->ms_throttled);
+          timestamp_last_throttle_report_ = now;
+        }
+        statistics_->ms_throttled += info->throttle_ms;
       }
-      statistics_->ms_throttled += info->throttle_ms;
       SafeSleepMs(info->throttle_ms);
     }
   } else {
     if (info->backoff_ms == 0) {
       // Must be != 0
+      MutexLockGuard guard(statistics_lock_);
       info->backoff_ms = prng_.Next(config_.opt_backoff_init_ms + 1);
     } else {
       info->backoff_ms *= 2;
@@ -1045,6 +1525,30 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
       break;
   }
 
+  if ((info->error_code == kFailOk) &&
+      (info->request == JobInfo::kReqInitMultipart) &&
+      !ParseXmlElement(info->response_body, "UploadId",
+                       &info->multipart->upload_id))
+  {
+    LogCvmfs(kLogS3Fanout, kLogStderr, "S3: no upload id for %s",
+             info->object_key.c_str());
+    info->error_code = kFailOther;
+  }
+  // Completing a multipart upload or copying a part can fail after the 200
+  // status line was sent
+  if ((info->error_code == kFailOk) &&
+      ((info->request == JobInfo::kReqCompleteMultipart) ||
+       (info->request == JobInfo::kReqCopyPart)) &&
+      (info->response_body.find("<Error>") != string::npos))
+  {
+    info->error_code = kFailServiceUnavailable;
+  }
+  if ((info->error_code == kFailOk) &&
+      (info->request == JobInfo::kReqCopyPart))
+  {
+    ParseXmlElement(info->response_body, "ETag", &info->etag);
+  }
+
   // Transform HEAD to PUT request
   if ((info->error_code == kFailNotFound) &&
       (info->request == JobInfo::kReqHeadPut))
@@ -1052,6 +1556,8 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     LogCvmfs(kLogS3Fanout, kLogDebug, "not found: %s, uploading",
              info->object_key.c_str());
     info->request = JobInfo::kReqPutCas;
+    if (IsMultipartCandidate(*info))
+      StartMultipart(info);
     curl_slist_free_all(info->http_headers);
     info->http_headers = NULL;
     s3fanout::Failures init_failure = InitializeRequest(info,
@@ -1077,12 +1583,19 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
   if (try_again) {
     if (info->request == JobInfo::kReqPutCas ||
         info->request == JobInfo::kReqPutDotCvmfs ||
-        info->request == JobInfo::kReqPutHtml) {
+        info->request == JobInfo::kReqPutHtml ||
+        info->request == JobInfo::kReqCompleteMultipart) {
       LogCvmfs(kLogS3Fanout, kLogDebug, "Trying again to upload %s",
                info->object_key.c_str());
       // Reset origin
       info->origin->Rewind();
+    } else if (info->request == JobInfo::kReqPutPart) {
+      info->part_pos = 0;
+      if (info->origin.IsValid())
+        info->origin->Rewind();
     }
+    info->etag.clear();
+    info->response_body.clear();
     Backoff(info);
     info->error_code = kFailOk;
     info->http_error = 0;
@@ -1092,8 +1605,16 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
     return true;  // try again
   }
 
-  // Cleanup opened resources
-  info->origin.Destroy();
+  // The abort request only cleans up the parts of a failed multipart upload
+  if (info->request == JobInfo::kReqAbortMultipart)
+    info->error_code = info->multipart->error_code;
+
+  // Cleanup opened resources; the parts still need the object
+  if ((info->request != JobInfo::kReqInitMultipart) ||
+      (info->error_code != kFailOk))
+  {
+    info->origin.Destroy();
+  }
 
   if ((info->error_code != kFailOk) &&
       (info->http_error != 0) && (info->http_error != 404))
@@ -1104,9 +1625,13 @@ bool S3FanoutManager::VerifyAndFinalize(const int curl_error, JobInfo *info) {
 }
 
 S3FanoutManager::S3FanoutManager(const S3Config &config) : config_(config) {
+  assert(config_.num_io_threads > 0);
+  assert((config_.multipart_threshold == 0) ||
+         ((config_.multipart_part_size >= kMinMultipartPartSize) &&
+          (config_.multipart_parallel_parts > 0)));
   atomic_init32(&multi_threaded_);
+  atomic_init32(&next_io_thread_);
   MakePipe(pipe_terminate_);
-  MakePipe(pipe_jobs_);
 
   jobs_completed_lock_ =
       reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
@@ -1121,8 +1646,19 @@ S3FanoutManager::S3FanoutManager(const S3Config &config) : config_(config) {
       reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
   retval = pthread_mutex_init(curl_handle_lock_, NULL);
   assert(retval == 0);
+  signing_key_lock_ =
+      reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(signing_key_lock_, NULL);
+  assert(retval == 0);
+  statistics_lock_ =
+      reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(statistics_lock_, NULL);
+  assert(retval == 0);
+  share_lock_ =
+      reinterpret_cast<pthread_mutex_t *>(smalloc(sizeof(pthread_mutex_t)));
+  retval = pthread_mutex_init(share_lock_, NULL);
+  assert(retval == 0);
 
-  active_requests_ = new set<JobInfo *>;
   pool_handles_idle_ = new set<CURL *>;
   pool_handles_inuse_ = new set<CURL *>;
   curl_sharehandles_ = new map<CURL *, S3FanOutDnsEntry *>;
@@ -1139,22 +1675,40 @@ S3FanoutManager::S3FanoutManager(const S3Config &config) : config_(config) {
 
   CURLcode cretval = curl_global_init(CURL_GLOBAL_ALL);
   assert(cretval == CURLE_OK);
-  curl_multi_ = curl_multi_init();
-  assert(curl_multi_ != NULL);
-  CURLMcode mretval;
-  mretval = curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETFUNCTION,
-                              CallbackCurlSocket);
-  assert(mretval == CURLM_OK);
-  mretval = curl_multi_setopt(curl_multi_, CURLMOPT_SOCKETDATA,
-                              static_cast<void *>(this));
-  assert(mretval == CURLM_OK);
-  mretval = curl_multi_setopt(curl_multi_, CURLMOPT_MAX_TOTAL_CONNECTIONS,
-                              config_.pool_max_handles);
-  assert(mretval == CURLM_OK);
+
+  // The parallel connections are split among the I/O threads.  Every multi
+  // handle keeps its idle connections open for the next requests.
+  const long max_connections = std::max(  // NOLINT(runtime/int)
+    1U, config_.pool_max_handles / config_.num_io_threads);
+  for (unsigned i = 0; i < config_.num_io_threads; ++i) {
+    IoThread *io_thread = new IoThread();
+    io_thread->mgr = this;
+    MakePipe(io_thread->pipe_jobs);
+    io_thread->curl_multi = curl_multi_init();
+    assert(io_thread->curl_multi != NULL);
+    CURLMcode mretval;
+    mretval = curl_multi_setopt(io_thread->curl_multi, CURLMOPT_SOCKETFUNCTION,
+                                CallbackCurlSocket);
+    assert(mretval == CURLM_OK);
+    mretval = curl_multi_setopt(io_thread->curl_multi, CURLMOPT_SOCKETDATA,
+                                static_cast<void *>(io_thread));
+    assert(mretval == CURLM_OK);
+    mretval = curl_multi_setopt(io_thread->curl_multi,
+                                CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                                max_connections);
+    assert(mretval == CURLM_OK);
+    mretval = curl_multi_setopt(io_thread->curl_multi, CURLMOPT_MAXCONNECTS,
+                                max_connections);
+    assert(mretval == CURLM_OK);
+    io_thread->watch_fds =
+      static_cast<struct pollfd *>(smalloc(4 * sizeof(struct pollfd)));
+    io_thread->watch_fds_size = 4;
+    io_thread->watch_fds_inuse = 0;
+    io_threads_.push_back(io_thread);
+  }
 
   prng_.InitLocaltime();
 
-  thread_upload_ = 0;
   timestamp_last_throttle_report_ = 0;
   is_curl_debug_ = (getenv("_CVMFS_CURL_DEBUG") != NULL);
 
@@ -1167,34 +1721,42 @@ S3FanoutManager::S3FanoutManager(const S3Config &config) : config_(config) {
   }
 
   resolver_ = dns::CaresResolver::Create(opt_ipv4_only_, 2, 2000);
-
-  watch_fds_ = static_cast<struct pollfd *>(smalloc(4 * sizeof(struct pollfd)));
-  watch_fds_size_ = 4;
-  watch_fds_inuse_ = 0;
 }
 
 S3FanoutManager::~S3FanoutManager() {
+  if (atomic_xadd32(&multi_threaded_, 0) == 1) {
+    // Shutdown I/O threads
+    char buf = 'T';
+    WritePipe(pipe_terminate_[1], &buf, 1);
+    for (unsigned i = 0; i < io_threads_.size(); ++i)
+      pthread_join(io_threads_[i]->thread, NULL);
+  }
+  ClosePipe(pipe_terminate_);
+
   pthread_mutex_destroy(jobs_completed_lock_);
   free(jobs_completed_lock_);
   pthread_mutex_destroy(jobs_todo_lock_);
   free(jobs_todo_lock_);
   pthread_mutex_destroy(curl_handle_lock_);
   free(curl_handle_lock_);
+  pthread_mutex_destroy(signing_key_lock_);
+  free(signing_key_lock_);
 
-  if (atomic_xadd32(&multi_threaded_, 0) == 1) {
-    // Shutdown I/O thread
-    char buf = 'T';
-    WritePipe(pipe_terminate_[1], &buf, 1);
-    pthread_join(thread_upload_, NULL);
-  }
-  ClosePipe(pipe_terminate_);
-  ClosePipe(pipe_jobs_);
-
-  set<CURL *>::iterator             i    = pool_handles_idle_->begin();
-  const set<CURL *>::const_iterator iEnd = pool_handles_idle_->end();
+  set<CURL *>::iterator             i    = pool_handles_inuse_->begin();
+  const set<CURL *>::const_iterator iEnd = pool_handles_inuse_->end();
   for (; i != iEnd; ++i) {
     curl_easy_cleanup(*i);
   }
+  for (i = pool_handles_idle_->begin(); i != pool_handles_idle_->end(); ++i) {
+    curl_easy_cleanup(*i);
+  }
+
+  for (unsigned i = 0; i < io_threads_.size(); ++i) {
+    ClosePipe(io_threads_[i]->pipe_jobs);
+    curl_multi_cleanup(io_threads_[i]->curl_multi);
+    free(io_threads_[i]->watch_fds);
+    delete io_threads_[i];
+  }
 
   set<S3FanOutDnsEntry *>::iterator             is    = sharehandles_->begin();
   const set<S3FanOutDnsEntry *>::const_iterator isEnd = sharehandles_->end();
@@ -1203,18 +1765,21 @@ S3FanoutManager::~S3FanoutManager() {
     curl_slist_free_all((*is)->clist);
     delete *is;
   }
+  pthread_mutex_destroy(share_lock_);
+  free(share_lock_);
+  pool_handles_inuse_->clear();
   pool_handles_idle_->clear();
   curl_sharehandles_->clear();
   sharehandles_->clear();
-  delete active_requests_;
   delete pool_handles_idle_;
   delete pool_handles_inuse_;
   delete curl_sharehandles_;
   delete sharehandles_;
   delete user_agent_;
-  curl_multi_cleanup(curl_multi_);
 
   delete statistics_;
+  pthread_mutex_destroy(statistics_lock_);
+  free(statistics_lock_);
 
   delete available_jobs_;
 
@@ -1222,14 +1787,16 @@ S3FanoutManager::~S3FanoutManager() {
 }
 
 /**
- * Spawns the I/O worker thread.  No way back except ~S3FanoutManager.
+ * Spawns the I/O worker threads.  No way back except ~S3FanoutManager.
  */
 void S3FanoutManager::Spawn() {
   LogCvmfs(kLogS3Fanout, kLogDebug, "S3FanoutManager spawned");
 
-  int retval = pthread_create(&thread_upload_, NULL, MainUpload,
-                              static_cast<void *>(this));
-  assert(retval == 0);
+  for (unsigned i = 0; i < io_threads_.size(); ++i) {
+    int retval = pthread_create(&io_threads_[i]->thread, NULL, MainUpload,
+                                static_cast<void *>(io_threads_[i]));
+    assert(retval == 0);
+  }
 
   atomic_inc32(&multi_threaded_);
 }
@@ -1258,7 +1825,68 @@ int S3FanoutManager::PopCompletedJobs(std::vector<s3fanout::JobInfo*> *jobs) {
  */
 void S3FanoutManager::PushNewJob(JobInfo *info) {
   available_jobs_->Increment();
-  WritePipe(pipe_jobs_[1], &info, sizeof(info));
+  const unsigned idx = static_cast<uint32_t>(atomic_xadd32(&next_io_thread_, 1))
+                       % io_threads_.size();
+  if (info->multipart.IsValid())
+    info->multipart->io_thread = idx;
+  WritePipe(io_threads_[idx]->pipe_jobs[1], &info, sizeof(info));
+}
+
+/**
+ * Starts the multipart upload of an object whose size is not yet known.  The
+ * parts are pushed with PushStreamedPart() while the object is written, the
+ * job is finished after the last part.
+ */
+void S3FanoutManager::PushStreamedJob(JobInfo *info) {
+  assert(config_.multipart_parallel_parts > 0);
+  info->multipart = new JobInfo::MultipartState(
+    info->request, config_.multipart_part_size, 0);
+  info->multipart->streamed = true;
+  info->multipart->sealed = false;
+  info->multipart->parts_pending =
+    new SynchronizingCounter<uint32_t>(config_.multipart_parallel_parts);
+  info->request = JobInfo::kReqInitMultipart;
+  info->payload_size = 0;
+  PushNewJob(info);
+}
+
+/**
+ * Hands the next part of a streamed upload to the I/O thread of the upload.
+ * Blocks while multipart_parallel_parts parts of the upload are pending, so
+ * that the producer cannot run ahead of the uploads.  Only called from the
+ * producer of the object.
+ */
+void S3FanoutManager::PushStreamedPart(JobInfo *info, FileBackedBuffer *part) {
+  JobInfo::MultipartState *multipart = info->multipart.weak_ref();
+  assert(multipart->streamed && (part != NULL));
+  assert(multipart->next_part < kMaxMultipartParts);
+  multipart->parts_pending->Increment();
+  JobInfo *part_info = new JobInfo(info->object_key, NULL, part);
+  part_info->request = JobInfo::kReqPutPart;
+  part_info->parent = info;
+  part_info->part_number = ++multipart->next_part;
+  part_info->part_size = part->GetSize();
+  info->payload_size += part->GetSize();
+  WritePipe(io_threads_[multipart->io_thread]->pipe_jobs[1],
+            &part_info, sizeof(part_info));
+}
+
+/**
+ * Marks the end of a streamed upload.  The producer must not touch the job
+ * afterwards.  With an error code, the upload is aborted.
+ */
+void S3FanoutManager::CloseStreamedJob(JobInfo *info, Failures error_code) {
+  JobInfo::MultipartState *multipart = info->multipart.weak_ref();
+  assert(multipart->streamed);
+  // An empty object cannot be uploaded in parts
+  if (multipart->next_part == 0)
+    error_code = kFailLocalIO;
+  JobInfo *part_info = new JobInfo(info->object_key, NULL, NULL);
+  part_info->request = JobInfo::kReqPutPart;
+  part_info->parent = info;
+  part_info->error_code = error_code;
+  WritePipe(io_threads_[multipart->io_thread]->pipe_jobs[1],
+            &part_info, sizeof(part_info));
 }
 
 //------------------------------------------------------------------------------
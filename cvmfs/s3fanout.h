@@ -98,6 +98,59 @@ struct JobInfo {
     kReqPutHtml,  // HTML file - display instead of downloading
     kReqPutBucket,  // bucket creation
     kReqDelete,
+    kReqInitMultipart,  // start of the multipart upload of a large object
+    kReqPutPart,  // one part of a multipart upload
+    kReqCopyPart,  // one part copied from another object in the bucket
+    kReqCompleteMultipart,
+    kReqAbortMultipart,
+  };
+
+  /**
+   * State of a multipart upload, owned by the job of the object.  The parts
+   * are uploaded by separate jobs that read their byte range of the origin.
+   * The parts of a streamed upload instead carry their own origin; they are
+   * pushed by the producer while the object is written (see
+   * S3FanoutManager::PushStreamedPart()).
+   */
+  struct MultipartState {
+    MultipartState(RequestType put_request, uint64_t part_size,
+                   unsigned num_parts)
+      : put_request(put_request)
+      , part_size(part_size)
+      , num_parts(num_parts)
+      , next_part(0)
+      , parts_in_flight(0)
+      , error_code(kFailOk)
+      , etags(num_parts)
+      , streamed(false)
+      , sealed(true)
+      , initiated(false)
+      , io_thread(0)
+    { }
+    // Determines content type and cache control of the object
+    RequestType put_request;
+    std::string upload_id;
+    uint64_t part_size;
+    unsigned num_parts;
+    // For streamed uploads, the number of parts pushed by the producer
+    unsigned next_part;
+    unsigned parts_in_flight;
+    // First failure of a part; reported after the upload is aborted
+    Failures error_code;
+    std::vector<std::string> etags;
+
+    bool streamed;
+    // False until the producer of a streamed upload pushed the last part
+    bool sealed;
+    // Streamed parts are scheduled once the upload id is known
+    bool initiated;
+    // The I/O thread that drives the upload and receives the streamed parts
+    unsigned io_thread;
+    // Streamed parts that arrived before the upload was initiated
+    std::vector<JobInfo *> parts_waiting;
+    // Streamed parts that are not yet uploaded, bounded by
+    // multipart_parallel_parts.  Blocks the producer.
+    UniquePtr<SynchronizingCounter<uint32_t> > parts_pending;
   };
 
   const std::string object_key;
@@ -110,11 +163,27 @@ struct JobInfo {
     void *callback,
     FileBackedBuffer *origin)
     : object_key(object_key),
-      origin(origin)
+      origin(origin),
+      copy_size(0)
   {
     JobInfoInit();
     this->callback = callback;
   }
+  // The object is copied from another object in the bucket
+  JobInfo(
+    const std::string &object_key,
+    void *callback,
+    const std::string &copy_source,
+    uint64_t copy_size)
+    : object_key(object_key),
+      origin(FileBackedBuffer::Create(0)),
+      copy_source(copy_source),
+      copy_size(copy_size)
+  {
+    JobInfoInit();
+    this->callback = callback;
+    this->origin->Commit();
+  }
   void JobInfoInit() {
     curl_handle = NULL;
     http_headers = NULL;
@@ -126,9 +195,29 @@ struct JobInfo {
     backoff_ms = 0;
     throttle_ms = 0;
     throttle_timestamp = 0;
+    payload_size = 0;
+    parent = NULL;
+    part_number = 0;
+    part_offset = 0;
+    part_size = 0;
+    part_pos = 0;
   }
   ~JobInfo() {}
 
+  // Object key and size of the source of a copied object.  Copies are
+  // multipart uploads whose parts are copied by the server.
+  const std::string copy_source;
+  const uint64_t copy_size;
+
+  UniquePtr<MultipartState> multipart;
+  // Only for kReqPutPart and kReqCopyPart: the job of the object and the range
+  // of the part.  Streamed parts have their own origin instead.
+  JobInfo *parent;
+  unsigned part_number;  // starts with 1
+  uint64_t part_offset;
+  uint64_t part_size;
+  uint64_t part_pos;  // read position within the part
+
   // Internal state, don't touch
   CURL *curl_handle;
   struct curl_slist *http_headers;
@@ -143,6 +232,10 @@ struct JobInfo {
   unsigned throttle_ms;
   // Remember when the 429 reply came in to only throttle if still necessary
   uint64_t throttle_timestamp;
+  // ETag of an uploaded or copied part
+  std::string etag;
+  // Only recorded for the replies to multipart requests
+  std::string response_body;
 };  // JobInfo
 
 struct S3FanOutDnsEntry {
@@ -169,6 +262,10 @@ class S3FanoutManager : SingleCopy {
   // Report throttle operations only every so often
   static const unsigned kThrottleReportIntervalSec;
   static const unsigned kDefaultHTTPPort;
+  // S3 rejects smaller parts (except for the last one)
+  static const uint64_t kMinMultipartPartSize;
+  static const uint64_t kMaxMultipartPartSize;
+  static const unsigned kMaxMultipartParts;
 
   struct S3Config {
     S3Config() {
@@ -179,6 +276,10 @@ class S3FanoutManager : SingleCopy {
       opt_max_retries = 3;
       opt_backoff_init_ms = 100;
       opt_backoff_max_ms = 2000;
+      num_io_threads = 1;
+      multipart_threshold = 0;
+      multipart_part_size = 16 * 1024 * 1024;
+      multipart_parallel_parts = 4;
     }
     std::string access_key;
     std::string secret_key;
@@ -192,6 +293,13 @@ class S3FanoutManager : SingleCopy {
     unsigned opt_max_retries;
     unsigned opt_backoff_init_ms;
     unsigned opt_backoff_max_ms;
+    // Every I/O thread drives its own share of the parallel connections
+    unsigned num_io_threads;
+    // Objects of at least this size are uploaded in parts, 0 to disable
+    uint64_t multipart_threshold;
+    uint64_t multipart_part_size;
+    // Parts of a single object that are uploaded at the same time
+    unsigned multipart_parallel_parts;
   };
 
   static void DetectThrottleIndicator(const std::string &header, JobInfo *info);
@@ -203,6 +311,9 @@ class S3FanoutManager : SingleCopy {
   void Spawn();
 
   void PushNewJob(JobInfo *info);
+  void PushStreamedJob(JobInfo *info);
+  void PushStreamedPart(JobInfo *info, FileBackedBuffer *part);
+  void CloseStreamedJob(JobInfo *info, Failures error_code);
   int PopCompletedJobs(std::vector<s3fanout::JobInfo*> *jobs);
 
   const Statistics &GetStatistics();
@@ -213,8 +324,43 @@ class S3FanoutManager : SingleCopy {
   static const char *kCacheControlDotCvmfs;  // Cache-Control: max-age=61
   static const unsigned kLowSpeedLimit = 1024;  // Require at least 1kB/s
 
+  /**
+   * Every I/O thread drives its own curl multi handle
+   */
+  struct IoThread {
+    IoThread()
+      : mgr(NULL)
+      , thread(0)
+      , curl_multi(NULL)
+      , watch_fds(NULL)
+      , watch_fds_size(0)
+      , watch_fds_inuse(0)
+    {
+      pipe_jobs[0] = pipe_jobs[1] = -1;
+    }
+
+    S3FanoutManager *mgr;
+    pthread_t thread;
+    CURLM *curl_multi;
+    struct pollfd *watch_fds;
+    uint32_t watch_fds_size;
+    uint32_t watch_fds_inuse;
+    // A pipe to used to push jobs from S3FanoutManager to the I/O thread.
+    // S3FanoutManager writes a JobInfo* pointer. The I/O thread then reads
+    // the pointer and processes the job.
+    int pipe_jobs[2];
+    /**
+     * This is not strictly necessary but it helps the debugging
+     */
+    std::set<JobInfo *> active_requests;
+  };
+
   static int CallbackCurlSocket(CURL *easy, curl_socket_t s, int action,
                                 void *userp, void *socketp);
+  static void CallbackCurlShareLock(CURL *handle, curl_lock_data data,
+                                    curl_lock_access access, void *userptr);
+  static void CallbackCurlShareUnlock(CURL *handle, curl_lock_data data,
+                                      void *userptr);
   static void *MainUpload(void *data);
   std::vector<s3fanout::JobInfo*> jobs_todo_;
   pthread_mutex_t *jobs_todo_lock_;
@@ -224,7 +370,16 @@ class S3FanoutManager : SingleCopy {
 
   CURL *AcquireCurlHandle() const;
   void ReleaseCurlHandle(JobInfo *info, CURL *handle) const;
-  void InitPipeWatchFds();
+  void InitPipeWatchFds(IoThread *io_thread);
+  void ScheduleJob(IoThread *io_thread, JobInfo *info);
+  bool IsMultipartCandidate(const JobInfo &info) const;
+  void StartMultipart(JobInfo *info) const;
+  void ScheduleParts(IoThread *io_thread, JobInfo *info);
+  bool OnStreamedPart(IoThread *io_thread, JobInfo *part);
+  bool OnPartDone(IoThread *io_thread, JobInfo *part);
+  bool FinishMultipart(IoThread *io_thread, JobInfo *info);
+  bool ContinueMultipart(IoThread *io_thread, JobInfo *info);
+  void ReportJob(JobInfo *info);
   int InitializeDnsSettings(CURL *handle,
                             std::string remote_host) const;
   void InitializeDnsSettingsCurl(CURL *handle, CURLSH *sharehandle,
@@ -236,7 +391,10 @@ class S3FanoutManager : SingleCopy {
   void Backoff(JobInfo *info);
   bool VerifyAndFinalize(const int curl_error, JobInfo *info);
   std::string GetRequestString(const JobInfo &info) const;
+  std::string GetQueryString(const JobInfo &info) const;
   std::string GetContentType(const JobInfo &info) const;
+  std::vector<std::pair<std::string, std::string> > GetCopyHeaders(
+    const JobInfo &info) const;
   std::string GetUriEncode(const std::string &val, bool encode_slash) const;
   std::string GetAwsV4SigningKey(const std::string &date) const;
   bool MkPayloadHash(const JobInfo &info, std::string *hex_hash) const;
@@ -244,12 +402,14 @@ class S3FanoutManager : SingleCopy {
                  std::vector<std::string> *headers) const;
   bool MkV4Authz(const JobInfo &info,
                  std::vector<std::string> *headers) const;
-  std::string MkUrl(const std::string &objkey) const {
+  std::string MkUrl(const std::string &objkey,
+                    const std::string &query) const {
+    const std::string suffix = query.empty() ? "" : ("?" + query);
     if (config_.dns_buckets) {
-      return "http://" + complete_hostname_ + "/" + objkey;
+      return "http://" + complete_hostname_ + "/" + objkey + suffix;
     } else {
       return "http://" + complete_hostname_ + "/" + config_.bucket +
-             "/" + objkey;
+             "/" + objkey + suffix;
     }
   }
   std::string MkCompleteHostname() {
@@ -264,17 +424,12 @@ class S3FanoutManager : SingleCopy {
   std::string complete_hostname_;
 
   Prng prng_;
-  /**
-   * This is not strictly necessary but it helps the debugging
-   */
-  std::set<JobInfo *> *active_requests_;
 
   std::set<CURL *> *pool_handles_idle_;
   std::set<CURL *> *pool_handles_inuse_;
   std::set<S3FanOutDnsEntry *> *sharehandles_;
   std::map<CURL *, S3FanOutDnsEntry *> *curl_sharehandles_;
   dns::CaresResolver *resolver_;
-  CURLM *curl_multi_;
   std::string *user_agent_;
 
   /**
@@ -282,22 +437,18 @@ class S3FanoutManager : SingleCopy {
    * The signing key for current day can be cached.
    */
   mutable std::pair<std::string, std::string> last_signing_key_;
+  pthread_mutex_t *signing_key_lock_;
 
-  pthread_t thread_upload_;
+  std::vector<IoThread *> io_threads_;
+  // Round-robin distribution of new jobs to the I/O threads
+  atomic_int32 next_io_thread_;
   atomic_int32 multi_threaded_;
 
-  struct pollfd *watch_fds_;
-  uint32_t watch_fds_size_;
-  uint32_t watch_fds_inuse_;
   uint32_t watch_fds_max_;
 
-  // A pipe used to signal termination from S3FanoutManager to MainUpload
-  // thread. Anything written into it results in MainUpload thread exit.
+  // A pipe used to signal termination from S3FanoutManager to the MainUpload
+  // threads. Anything written into it results in MainUpload threads exit.
   int pipe_terminate_[2];
-  // A pipe to used to push jobs from S3FanoutManager to MainUpload thread.
-  // S3FanoutManager writes a JobInfo* pointer. MainUpload then reads the
-  // pointer and processes the job.
-  int pipe_jobs_[2];
 
   bool opt_ipv4_only_;
 
@@ -307,6 +458,15 @@ class S3FanoutManager : SingleCopy {
   // Writes and reads should be atomic because reading happens in a different
   // thread than writing.
   Statistics *statistics_;
+  /**
+   * Protects statistics_, prng_, and timestamp_last_throttle_report_ among the
+   * I/O threads
+   */
+  pthread_mutex_t *statistics_lock_;
+  /**
+   * The DNS share handles are used by all I/O threads
+   */
+  pthread_mutex_t *share_lock_;
 
   // Report not every occurance of throtteling but only every so often
   uint64_t timestamp_last_throttle_report_;
@@ -232,6 +232,23 @@ cvmfs_server_ingest() {
     ingest_command="$ingest_command -I"
   fi
 
+  if [ "x$CVMFS_INGEST_KNOWN_CONTENT" = "xtrue" ]; then
+    ingest_command="$ingest_command -k ${spool_dir}/known_content"
+  fi
+
+  if [ "x$CVMFS_NUM_READ_TASKS" != "x" ]; then
+    ingest_command="$ingest_command -2 $CVMFS_NUM_READ_TASKS"
+  fi
+  if [ "x$CVMFS_NUM_PROCESSING_TASKS" != "x" ]; then
+    ingest_command="$ingest_command -3 $CVMFS_NUM_PROCESSING_TASKS"
+  fi
+  if [ "x$CVMFS_PIPELINE_MEMORY_MB" != "x" ]; then
+    ingest_command="$ingest_command -4 $CVMFS_PIPELINE_MEMORY_MB"
+  fi
+  if [ "x$CVMFS_ADAPTIVE_PIPELINE" = "xtrue" ]; then
+    ingest_command="$ingest_command -5"
+  fi
+
   local upstream_storage=$CVMFS_UPSTREAM_STORAGE
   local upstream_type=$(get_upstream_type $upstream_storage)
   gw_key_file=/etc/cvmfs/keys/${name}.gw
@@ -126,6 +126,17 @@ cvmfs_server_publish() {
     is_in_transaction $name        || { echo "Repository $name is not in a transaction"; retcode=1; continue; }
     [ $(count_wr_fds /cvmfs/$name) -eq 0 ] || { echo "Open writable file descriptors on $name"; retcode=1; continue; }
     is_cwd_on_path "/cvmfs/$name" && { echo "Current working directory is in /cvmfs/$name.  Please release, e.g. by 'cd \$HOME'."; retcode=1; continue; } || true
+    case "$compression_alg" in
+      zstd*|lz4)
+        if [ "x$CVMFS_EXTENDED_COMPRESSION" != "xtrue" ]; then
+          echo "Files compressed with $compression_alg are returned as garbage by clients without zstd and lz4 support."
+          echo "Set CVMFS_EXTENDED_COMPRESSION=true in the repository configuration to publish anyway."
+          echo "This permanently marks $name as containing zstd and lz4 compressed files."
+          retcode=1
+          continue
+        fi
+      ;;
+    esac
     gc_timespan="$(get_auto_garbage_collection_timespan $name)" || { retcode=1; continue; }
     if [ x"$manual_revision" != x"" ]; then
       if [ "x$(echo "$manual_revision" | tr -cd 0-9)" != "x$manual_revision" ]; then
@@ -219,6 +230,9 @@ cvmfs_server_publish() {
     if [ "x$CVMFS_UNION_FS_TYPE" != "x" ]; then
       sync_command="$sync_command -f $CVMFS_UNION_FS_TYPE"
     fi
+    if [ "x$CVMFS_EXTENDED_COMPRESSION" = "xtrue" ]; then
+      sync_command="$sync_command -W"
+    fi
     if [ "x${CVMFS_GENERATE_LEGACY_BULK_CHUNKS:-$CVMFS_DEFAULT_GENERATE_LEGACY_BULK_CHUNKS}" = "xtrue" ]; then
       sync_command="$sync_command -O"
     fi
@@ -227,6 +241,9 @@ cvmfs_server_publish() {
        -l $CVMFS_MIN_CHUNK_SIZE \
        -a $CVMFS_AVG_CHUNK_SIZE \
        -h $CVMFS_MAX_CHUNK_SIZE"
+      if [ "x$CVMFS_CHUNKING_ALGORITHM" != "x" ]; then
+        sync_command="$sync_command -j $CVMFS_CHUNKING_ALGORITHM"
+      fi
     fi
     if [ "x$CVMFS_AUTOCATALOGS" = "xtrue" ]; then
       sync_command="$sync_command -A"
@@ -258,6 +275,21 @@ cvmfs_server_publish() {
     if [ "x$CVMFS_NUM_UPLOAD_TASKS" != "x" ]; then
       sync_command="$sync_command -0 $CVMFS_NUM_UPLOAD_TASKS"
     fi
+    if [ "x$CVMFS_NUM_TRAVERSAL_THREADS" != "x" ]; then
+      sync_command="$sync_command -1 $CVMFS_NUM_TRAVERSAL_THREADS"
+    fi
+    if [ "x$CVMFS_NUM_READ_TASKS" != "x" ]; then
+      sync_command="$sync_command -2 $CVMFS_NUM_READ_TASKS"
+    fi
+    if [ "x$CVMFS_NUM_PROCESSING_TASKS" != "x" ]; then
+      sync_command="$sync_command -3 $CVMFS_NUM_PROCESSING_TASKS"
+    fi
+    if [ "x$CVMFS_PIPELINE_MEMORY_MB" != "x" ]; then
+      sync_command="$sync_command -4 $CVMFS_PIPELINE_MEMORY_MB"
+    fi
+    if [ "x$CVMFS_ADAPTIVE_PIPELINE" = "xtrue" ]; then
+      sync_command="$sync_command -5"
+    fi
     if [ "x$manual_revision" != "x" ]; then
       sync_command="$sync_command -v $manual_revision"
     fi
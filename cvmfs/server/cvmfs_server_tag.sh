@@ -158,6 +158,9 @@ cvmfs_server_tag() {
       -N $name                                           \
       -K $CVMFS_PUBLIC_KEY                               \
       $(get_follow_http_redirects_flag) $log_level -S snapshots"
+  if [ "x$CVMFS_EXTENDED_COMPRESSION" = "xtrue" ]; then
+    sync_command_virtual_dir="$sync_command_virtual_dir -W"
+  fi
   local tag_command_undo_tags="$(__swissknife_cmd dbg) tag_edit \
       -r $CVMFS_UPSTREAM_STORAGE                        \
       -w $CVMFS_STRATUM0                                \
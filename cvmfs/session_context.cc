@@ -77,12 +77,14 @@ SessionContextBase::SessionContextBase()
       session_token_(),
       key_id_(),
       secret_(),
-      queue_was_flushed_(1, 1),
       max_pack_size_(ObjectPack::kDefaultLimit),
       active_handles_(),
       current_pack_(NULL),
       current_pack_mtx_(),
       objects_dispatched_(0),
+      jobs_finished_(0),
+      jobs_finished_mtx_(),
+      jobs_finished_cond_(),
       bytes_committed_(0),
       bytes_dispatched_(0) {}
 
@@ -93,7 +95,8 @@ bool SessionContextBase::Initialize(const std::string& api_url,
                                     const std::string& key_id,
                                     const std::string& secret,
                                     uint64_t max_pack_size,
-                                    uint64_t max_queue_size) {
+                                    uint64_t max_queue_size,
+                                    unsigned num_upload_threads) {
   bool ret = true;
 
   // Initialize session context lock
@@ -106,6 +109,12 @@ bool SessionContextBase::Initialize(const std::string& api_url,
              "Could not initialize SessionContext lock.");
     return false;
   }
+  if (pthread_mutex_init(&jobs_finished_mtx_, NULL) ||
+      pthread_cond_init(&jobs_finished_cond_, NULL)) {
+    LogCvmfs(kLogUploadGateway, kLogStderr,
+             "Could not initialize SessionContext job counter.");
+    return false;
+  }
 
   // Set upstream URL and session token
   api_url_ = api_url;
@@ -115,15 +124,13 @@ bool SessionContextBase::Initialize(const std::string& api_url,
   max_pack_size_ = max_pack_size;
 
   atomic_init64(&objects_dispatched_);
+  jobs_finished_ = 0;
   bytes_committed_ = 0u;
   bytes_dispatched_ = 0u;
 
   // Ensure that the upload job and result queues are empty
   upload_results_.Drop();
 
-  queue_was_flushed_.Drop();
-  queue_was_flushed_.Enqueue(true);
-
   // Ensure that there are not open object packs
   if (current_pack_) {
     LogCvmfs(
@@ -132,7 +139,7 @@ bool SessionContextBase::Initialize(const std::string& api_url,
     ret = false;
   }
 
-  ret = InitializeDerived(max_queue_size) && ret;
+  ret = InitializeDerived(max_queue_size, num_upload_threads) && ret;
 
   return ret;
 }
@@ -174,12 +181,15 @@ bool SessionContextBase::Finalize(bool commit, const std::string& old_root_hash,
   results &= FinalizeDerived() && (bytes_committed_ == bytes_dispatched_);
 
   pthread_mutex_destroy(&current_pack_mtx_);
+  pthread_cond_destroy(&jobs_finished_cond_);
+  pthread_mutex_destroy(&jobs_finished_mtx_);
   return results;
 }
 
 void SessionContextBase::WaitForUpload() {
-  if (!upload_results_.IsEmpty()) {
-    queue_was_flushed_.Dequeue();
+  MutexLockGuard lock(jobs_finished_mtx_);
+  while (jobs_finished_ < NumJobsSubmitted()) {
+    pthread_cond_wait(&jobs_finished_cond_, &jobs_finished_mtx_);
   }
 }
 
@@ -247,6 +257,12 @@ int64_t SessionContextBase::NumJobsSubmitted() const {
   return atomic_read64(&objects_dispatched_);
 }
 
+void SessionContextBase::NotifyJobFinished() {
+  MutexLockGuard lock(jobs_finished_mtx_);
+  jobs_finished_++;
+  pthread_cond_broadcast(&jobs_finished_cond_);
+}
+
 void SessionContextBase::Dispatch() {
   MutexLockGuard lock(current_pack_mtx_);
 
@@ -262,26 +278,37 @@ void SessionContextBase::Dispatch() {
 SessionContext::SessionContext()
     : SessionContextBase(),
       upload_jobs_(),
-      worker_terminate_(),
-      worker_() {}
-
-bool SessionContext::InitializeDerived(uint64_t max_queue_size) {
-  // Start worker thread
-  atomic_init32(&worker_terminate_);
+      workers_() {}
 
+bool SessionContext::InitializeDerived(uint64_t max_queue_size,
+                                       unsigned num_upload_threads) {
   upload_jobs_ = new FifoChannel<UploadJob*>(max_queue_size, max_queue_size);
   upload_jobs_->Drop();
 
-  int retval =
-      pthread_create(&worker_, NULL, UploadLoop, reinterpret_cast<void*>(this));
+  // Start worker threads
+  workers_.clear();
+  for (unsigned i = 0; i < std::max(1U, num_upload_threads); ++i) {
+    pthread_t worker;
+    int retval = pthread_create(&worker, NULL, UploadLoop,
+                                reinterpret_cast<void*>(this));
+    if (retval != 0) {
+      FinalizeDerived();
+      return false;
+    }
+    workers_.push_back(worker);
+  }
 
-  return !retval;
+  return true;
 }
 
 bool SessionContext::FinalizeDerived() {
-  atomic_write32(&worker_terminate_, 1);
-
-  pthread_join(worker_, NULL);
+  for (unsigned i = 0; i < workers_.size(); ++i) {
+    upload_jobs_->Enqueue(NULL);
+  }
+  for (unsigned i = 0; i < workers_.size(); ++i) {
+    pthread_join(workers_[i], NULL);
+  }
+  workers_.clear();
 
   return true;
 }
@@ -305,8 +332,11 @@ Future<bool>* SessionContext::DispatchObjectPack(ObjectPack* pack) {
   UploadJob* job = new UploadJob;
   job->pack = pack;
   job->result = new Future<bool>();
+  job->curl_handle = NULL;
+  // The job is deleted by the upload thread, possibly before Enqueue() returns
+  Future<bool>* result = job->result;
   upload_jobs_->Enqueue(job);
-  return job->result;
+  return result;
 }
 
 bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
@@ -333,12 +363,13 @@ bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
   const size_t payload_size =
       json_msg.size() + serializer.GetHeaderSize() + job->pack->size();
 
-  // Prepare the Curl POST request
-  CURL* h_curl = curl_easy_init();
-
+  // Prepare the Curl POST request.  The handle comes from the upload thread;
+  // resetting it keeps the connection to the gateway open.
+  CURL* h_curl = job->curl_handle;
   if (!h_curl) {
     return false;
   }
+  curl_easy_reset(h_curl);
 
   // Set HTTP headers (Authorization and Message-Size)
   std::string header_str = std::string("Authorization: ") + key_id_ + " " +
@@ -382,8 +413,7 @@ bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
              reply.c_str());
   }
 
-  curl_easy_cleanup(h_curl);
-  h_curl = NULL;
+  curl_slist_free_all(auth_header);
 
   return ok && !ret;
 }
@@ -391,29 +421,25 @@ bool SessionContext::DoUpload(const SessionContext::UploadJob* job) {
 void* SessionContext::UploadLoop(void* data) {
   SessionContext* ctx = reinterpret_cast<SessionContext*>(data);
 
-  int64_t jobs_processed = 0;
-  while (!ctx->ShouldTerminate()) {
-    while (jobs_processed < ctx->NumJobsSubmitted()) {
-      UploadJob* job = ctx->upload_jobs_->Dequeue();
-      if (!ctx->DoUpload(job)) {
-        PANIC(kLogStderr,
-              "SessionContext: could not submit payload. Aborting.");
-      }
-      job->result->Set(true);
-      delete job->pack;
-      delete job;
-      jobs_processed++;
-    }
-    if (ctx->queue_was_flushed_.IsEmpty()) {
-      ctx->queue_was_flushed_.Enqueue(true);
+  CURL* h_curl = curl_easy_init();
+  while (true) {
+    UploadJob* job = ctx->upload_jobs_->Dequeue();
+    if (job == NULL)
+      break;
+    job->curl_handle = h_curl;
+    if (!ctx->DoUpload(job)) {
+      PANIC(kLogStderr,
+            "SessionContext: could not submit payload. Aborting.");
     }
+    job->result->Set(true);
+    delete job->pack;
+    delete job;
+    ctx->NotifyJobFinished();
   }
+  if (h_curl)
+    curl_easy_cleanup(h_curl);
 
   return NULL;
 }
 
-bool SessionContext::ShouldTerminate() {
-  return atomic_read32(&worker_terminate_);
-}
-
 }  // namespace upload
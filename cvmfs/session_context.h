@@ -5,9 +5,12 @@
 #ifndef CVMFS_SESSION_CONTEXT_H_
 #define CVMFS_SESSION_CONTEXT_H_
 
+#include <pthread.h>
+
 #include <string>
 #include <vector>
 
+#include "curl/curl.h"
 #include "pack.h"
 #include "repository_tag.h"
 #include "util/pointer.h"
@@ -42,12 +45,17 @@ class SessionContextBase {
 
   virtual ~SessionContextBase();
 
-// By default, the maximum number of queued jobs is limited to 10,
-// representing 10 * 200 MB = 2GB max memory used by the queue
-bool Initialize(const std::string& api_url, const std::string& session_token,
+  // By default, the maximum number of queued jobs is limited to 10,
+  // representing 10 * 200 MB = 2GB max memory used by the queue
+  static const uint64_t kDefaultMaxQueueSize = 10;
+
+  // Up to num_upload_threads object packs are sent to the gateway at the same
+  // time, in addition to the queued ones
+  bool Initialize(const std::string& api_url, const std::string& session_token,
                   const std::string& key_id, const std::string& secret,
                   uint64_t max_pack_size = ObjectPack::kDefaultLimit,
-                  uint64_t max_queue_size = 10);
+                  uint64_t max_queue_size = kDefaultMaxQueueSize,
+                  unsigned num_upload_threads = 1);
   bool Finalize(bool commit, const std::string& old_root_hash,
                 const std::string& new_root_hash,
                 const RepositoryTag& tag);
@@ -62,7 +70,8 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
                     const bool force_dispatch = false);
 
  protected:
-  virtual bool InitializeDerived(uint64_t max_queue_size) = 0;
+  virtual bool InitializeDerived(uint64_t max_queue_size,
+                                 unsigned num_upload_threads) = 0;
 
   virtual bool FinalizeDerived() = 0;
 
@@ -74,6 +83,11 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
 
   int64_t NumJobsSubmitted() const;
 
+  /**
+   * Called by the upload threads after an object pack has been sent
+   */
+  void NotifyJobFinished();
+
   FifoChannel<Future<bool>*> upload_results_;
 
   std::string api_url_;
@@ -81,8 +95,6 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
   std::string key_id_;
   std::string secret_;
 
-  FifoChannel<bool> queue_was_flushed_;
-
  private:
   void Dispatch();
 
@@ -94,6 +106,12 @@ bool Initialize(const std::string& api_url, const std::string& session_token,
   pthread_mutex_t current_pack_mtx_;
 
   mutable atomic_int64 objects_dispatched_;
+  /**
+   * WaitForUpload() blocks until all dispatched object packs are sent
+   */
+  int64_t jobs_finished_;
+  pthread_mutex_t jobs_finished_mtx_;
+  pthread_cond_t jobs_finished_cond_;
   uint64_t bytes_committed_;
   uint64_t bytes_dispatched_;
 };
@@ -106,9 +124,12 @@ class SessionContext : public SessionContextBase {
   struct UploadJob {
     ObjectPack* pack;
     Future<bool>* result;
+    // Owned by the upload thread, reused to keep the connection alive
+    CURL* curl_handle;
   };
 
-  virtual bool InitializeDerived(uint64_t max_queue_size);
+  virtual bool InitializeDerived(uint64_t max_queue_size,
+                                 unsigned num_upload_threads);
 
   virtual bool FinalizeDerived();
 
@@ -123,12 +144,12 @@ class SessionContext : public SessionContextBase {
  private:
   static void* UploadLoop(void* data);
 
-  bool ShouldTerminate();
-
+  /**
+   * A NULL job terminates an upload thread
+   */
   UniquePtr<FifoChannel<UploadJob*> > upload_jobs_;
 
-  atomic_int32 worker_terminate_;
-  pthread_t worker_;
+  std::vector<pthread_t> workers_;
 };
 
 }  // namespace upload
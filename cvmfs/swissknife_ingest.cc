@@ -18,6 +18,7 @@
 #include "sync_union_tarball.h"
 #include "util/pointer.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 /*
  * Many of the options possible to set in the ArgumentList are not actually used
@@ -67,6 +68,8 @@ int swissknife::Ingest::Main(const swissknife::ArgumentList &args) {
   if (args.find('Z') != args.end()) {
     params.compression_alg =
         zlib::ParseCompressionAlgorithm(*args.find('Z')->second);
+    zlib::SetZstdLevel(
+        zlib::ParseCompressionLevel(*args.find('Z')->second));
   }
 
   bool create_catalog = args.find('C') != args.end();
@@ -85,6 +88,17 @@ int swissknife::Ingest::Main(const swissknife::ArgumentList &args) {
     params.key_file = *args.find('H')->second;
   }
 
+  if (args.find('2') != args.end()) {
+    params.num_read_tasks = String2Uint64(*args.find('2')->second);
+  }
+  if (args.find('3') != args.end()) {
+    params.num_processing_tasks = String2Uint64(*args.find('3')->second);
+  }
+  if (args.find('4') != args.end()) {
+    params.max_pipeline_mb = String2Uint64(*args.find('4')->second);
+  }
+  params.adaptive_pipeline = (args.find('5') != args.end());
+
   const bool upload_statsdb = (args.count('I') > 0);
 
   perf::StatisticsTemplate publish_statistics("Publish", this->statistics());
@@ -100,6 +114,13 @@ int swissknife::Ingest::Main(const swissknife::ArgumentList &args) {
     spooler_definition.number_of_concurrent_uploads =
         params.max_concurrent_write_jobs;
   }
+  if (args.find('k') != args.end()) {
+    spooler_definition.known_content_path = *args.find('k')->second;
+  }
+  spooler_definition.num_read_tasks = params.num_read_tasks;
+  spooler_definition.num_processing_tasks = params.num_processing_tasks;
+  spooler_definition.adaptive_pipeline = params.adaptive_pipeline;
+  spooler_definition.max_pipeline_mem = params.max_pipeline_mb * 1024 * 1024;
 
   upload::SpoolerDefinition spooler_definition_catalogs(
       spooler_definition.Dup2DefaultCompression());
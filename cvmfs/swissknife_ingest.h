@@ -38,6 +38,17 @@ class Ingest : public Command {
     r.push_back(Parameter::Optional(
         'C', "create a new catalog where the tar file is extracted"));
 
+    r.push_back(Parameter::Optional(
+        'k', "index of known content, skips compression and upload of "
+             "files found in it"));
+
+    r.push_back(Parameter::Optional('2', "number of file read threads"));
+    r.push_back(Parameter::Optional(
+        '3', "number of chunk, compress, and hash threads"));
+    r.push_back(Parameter::Optional('4', "pipeline memory limit in megabytes"));
+    r.push_back(Parameter::Switch(
+        '5', "rebalance threads between the pipeline stages"));
+
     r.push_back(Parameter::Optional('P', "session_token_file"));
     r.push_back(Parameter::Optional('H', "key file for HTTP API"));
     r.push_back(Parameter::Switch('I', "upload updated statistics DB file"));
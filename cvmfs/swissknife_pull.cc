@@ -22,9 +22,12 @@
 #include <vector>
 
 #include "atomic.h"
+#include "backoff.h"
+#include "cache_posix.h"
 #include "catalog.h"
 #include "compression.h"
 #include "download.h"
+#include "fetch.h"
 #include "hash.h"
 #include "history_sqlite.h"
 #include "logging.h"
@@ -114,6 +117,12 @@ atomic_int64         overall_new;
 atomic_int64         chunk_queue;
 bool                 preload_cache = false;
 string              *preload_cachedir = NULL;
+// Chunks are preloaded through the fetcher, in batches of kPreloadBatchSize
+const unsigned       kPreloadBatchSize = 1024;
+PosixCacheManager   *preload_cache_mgr = NULL;
+BackoffThrottle     *preload_backoff = NULL;
+cvmfs::Fetcher      *preload_fetcher = NULL;
+vector<cvmfs::Fetcher::Request> preload_requests;
 bool                 inspect_existing_catalogs = false;
 manifest::Reflog    *reflog = NULL;
 
@@ -246,6 +255,64 @@ static void WaitForStorage() {
 }
 
 
+static void CountChunk() {
+  if (atomic_xadd64(&overall_chunks, 1) % 1000 == 0)
+    LogCvmfs(kLogCvmfs, kLogStdout | kLogNoLinebreak, ".");
+}
+
+
+namespace {
+
+/**
+ * Receives the chunks downloaded into the preload cache by FetchMany()
+ */
+class PreloadCallback : public CallbackBase<cvmfs::Fetcher::Result> {
+ public:
+  virtual void operator()(const cvmfs::Fetcher::Result &result) const {
+    if (result.fd < 0) {
+      PANIC(kLogStderr, "failed to preload chunk %s (%d)",
+            preload_requests[result.idx].id.ToString().c_str(), result.fd);
+    }
+    preload_cache_mgr->Close(result.fd);
+    atomic_inc64(&overall_new);
+    CountChunk();
+  }
+};
+
+}  // anonymous namespace
+
+
+static void FlushPreloadChunks() {
+  if (preload_requests.empty())
+    return;
+  PreloadCallback callback;
+  preload_fetcher->FetchMany(preload_requests, callback, num_parallel);
+  preload_requests.clear();
+}
+
+
+/**
+ * In preload mode, the worker threads are replaced by the fetcher.  Missing
+ * chunks are collected and downloaded in batches by FetchMany(), which
+ * decompresses them into the cache directory with up to num_parallel
+ * concurrent downloads.
+ */
+static void PreloadChunk(
+  const shash::Any &chunk_hash,
+  const zlib::Algorithms compression_alg)
+{
+  if (Peek(chunk_hash)) {
+    CountChunk();
+    return;
+  }
+  preload_requests.push_back(cvmfs::Fetcher::Request(
+    chunk_hash, CacheManager::kSizeUnknown, chunk_hash.ToString(),
+    compression_alg, CacheManager::kTypeRegular));
+  if (preload_requests.size() >= kPreloadBatchSize)
+    FlushPreloadChunks();
+}
+
+
 struct MainWorkerContext {
   download::DownloadManager *download_manager;
 };
@@ -285,11 +352,10 @@ static void *MainWorker(void *data) {
       }
       fclose(fchunk);
       Store(tmp_file, chunk_hash,
-            (compression_alg == zlib::kZlibDefault) ? true : false);
+            compression_alg != zlib::kNoCompression);
       atomic_inc64(&overall_new);
     }
-    if (atomic_xadd64(&overall_chunks, 1) % 1000 == 0)
-      LogCvmfs(kLogCvmfs, kLogStdout | kLogNoLinebreak, ".");
+    CountChunk();
     atomic_dec64(&chunk_queue);
   }
   return NULL;
@@ -453,11 +519,16 @@ bool CommandPull::Pull(const shash::Any   &catalog_hash,
     goto pull_cleanup;
   }
   while (catalog->AllChunksNext(&chunk_hash, &compression_alg)) {
+    if (preload_cache) {
+      PreloadChunk(chunk_hash, compression_alg);
+      continue;
+    }
     ChunkJob next_chunk(chunk_hash, compression_alg);
     WritePipe(pipe_chunks[1], &next_chunk, sizeof(next_chunk));
     atomic_inc64(&chunk_queue);
   }
   catalog->AllChunksEnd();
+  FlushPreloadChunks();
   while (atomic_read64(&chunk_queue) != 0) {
     SafeSleepMs(100);
   }
@@ -618,6 +689,20 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
   download_manager()->SetRetryParameters(retries, 500, 2000);
   download_manager()->Spawn();
 
+  if (preload_cache) {
+    preload_cache_mgr = PosixCacheManager::Create(*preload_cachedir, true);
+    if (preload_cache_mgr == NULL) {
+      LogCvmfs(kLogCvmfs, kLogStderr, "failed to open cache directory %s",
+               preload_cachedir->c_str());
+      return 1;
+    }
+    // The fetcher downloads relative to the host chain
+    download_manager()->SetHostChain(*stratum0_url);
+    preload_backoff = new BackoffThrottle();
+    preload_fetcher = new cvmfs::Fetcher(preload_cache_mgr, download_manager(),
+      preload_backoff, perf::StatisticsTemplate("fetch", statistics()));
+  }
+
   // init the download helper
   ObjectFetcher object_fetcher(repository_name,
                                *stratum0_url,
@@ -625,6 +710,7 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
                                download_manager(),
                                signature_manager());
 
+  const unsigned num_workers = preload_cache ? 0 : num_parallel;
   pthread_t *workers =
     reinterpret_cast<pthread_t *>(smalloc(sizeof(pthread_t) * num_parallel));
 
@@ -770,12 +856,13 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
     }
   }
 
-  // Starting threads
+  // Starting threads, not needed for preloading, see PreloadChunk()
   MakePipe(pipe_chunks);
-  LogCvmfs(kLogCvmfs, kLogStdout, "Starting %u workers", num_parallel);
+  if (!preload_cache)
+    LogCvmfs(kLogCvmfs, kLogStdout, "Starting %u workers", num_workers);
   MainWorkerContext mwc;
   mwc.download_manager = download_manager();
-  for (unsigned i = 0; i < num_parallel; ++i) {
+  for (unsigned i = 0; i < num_workers; ++i) {
     int retval = pthread_create(&workers[i], NULL, MainWorker,
                                 static_cast<void*>(&mwc));
     assert(retval == 0);
@@ -801,12 +888,13 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
   }
 
   // Stopping threads
-  LogCvmfs(kLogCvmfs, kLogStdout, "Stopping %u workers", num_parallel);
-  for (unsigned i = 0; i < num_parallel; ++i) {
+  if (!preload_cache)
+    LogCvmfs(kLogCvmfs, kLogStdout, "Stopping %u workers", num_workers);
+  for (unsigned i = 0; i < num_workers; ++i) {
     ChunkJob terminate_workers;
     WritePipe(pipe_chunks[1], &terminate_workers, sizeof(terminate_workers));
   }
-  for (unsigned i = 0; i < num_parallel; ++i) {
+  for (unsigned i = 0; i < num_workers; ++i) {
     int retval = pthread_join(workers[i], NULL);
     assert(retval == 0);
   }
@@ -910,6 +998,9 @@ int swissknife::CommandPull::Main(const swissknife::ArgumentList &args) {
   free(workers);
   delete spooler;
   delete pathfilter;
+  delete preload_fetcher;
+  delete preload_backoff;
+  delete preload_cache_mgr;
   return result;
 }
 
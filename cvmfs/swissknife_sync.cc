@@ -96,6 +96,12 @@ bool swissknife::CommandSync::CheckParams(const SyncParameters &p) {
           "when upstream type is gw.");
       return false;
     }
+    // The gateway merges the changes into its own root catalog, which would
+    // lose the extended compression marker
+    if (p.extended_compression) {
+      PrintError("zstd and lz4 are not supported when upstream type is gw.");
+      return false;
+    }
   }
 
   return true;
@@ -620,9 +626,20 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
       return 2;
     }
   }
+  if (args.find('j') != args.end()) {
+    params.chunking_algorithm =
+        ParseChunkingAlgorithm(*args.find('j')->second);
+    if (params.chunking_algorithm == kChunkingUnknown) {
+      PrintError("unknown chunking algorithm");
+      return 1;
+    }
+  }
   if (args.find('O') != args.end()) {
     params.generate_legacy_bulk_chunks = true;
   }
+  if (args.find('W') != args.end()) {
+    params.extended_compression = true;
+  }
   shash::Algorithms hash_algorithm = shash::kSha1;
   if (args.find('e') != args.end()) {
     hash_algorithm = shash::ParseHashAlgorithm(*args.find('e')->second);
@@ -634,6 +651,8 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
   if (args.find('Z') != args.end()) {
     params.compression_alg =
         zlib::ParseCompressionAlgorithm(*args.find('Z')->second);
+    zlib::SetZstdLevel(
+        zlib::ParseCompressionLevel(*args.find('Z')->second));
   }
 
   if (args.find('C') != args.end()) {
@@ -676,6 +695,21 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     params.num_upload_tasks = String2Uint64(*args.find('0')->second);
   }
 
+  if (args.find('1') != args.end()) {
+    params.num_traversal_threads = String2Uint64(*args.find('1')->second);
+  }
+
+  if (args.find('2') != args.end()) {
+    params.num_read_tasks = String2Uint64(*args.find('2')->second);
+  }
+  if (args.find('3') != args.end()) {
+    params.num_processing_tasks = String2Uint64(*args.find('3')->second);
+  }
+  if (args.find('4') != args.end()) {
+    params.max_pipeline_mb = String2Uint64(*args.find('4')->second);
+  }
+  params.adaptive_pipeline = (args.find('5') != args.end());
+
   if (args.find('T') != args.end()) {
     params.ttl_seconds = String2Uint64(*args.find('T')->second);
   }
@@ -723,6 +757,11 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
         params.max_concurrent_write_jobs;
   }
   spooler_definition.num_upload_tasks = params.num_upload_tasks;
+  spooler_definition.chunking_algorithm = params.chunking_algorithm;
+  spooler_definition.num_read_tasks = params.num_read_tasks;
+  spooler_definition.num_processing_tasks = params.num_processing_tasks;
+  spooler_definition.adaptive_pipeline = params.adaptive_pipeline;
+  spooler_definition.max_pipeline_mem = params.max_pipeline_mb * 1024 * 1024;
 
   upload::SpoolerDefinition spooler_definition_catalogs(
       spooler_definition.Dup2DefaultCompression());
@@ -801,6 +840,24 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
     catalog_manager.SetTTL(params.ttl_seconds);
   }
 
+  if (params.extended_compression &&
+      !catalog_manager.SetExtendedCompression())
+  {
+    PrintError("failed to mark the repository as containing zstd and lz4 "
+               "compressed files");
+    return 3;
+  }
+  if (((params.compression_alg == zlib::kZstd) ||
+       (params.compression_alg == zlib::kLz4)) &&
+      !catalog_manager.HasExtendedCompression())
+  {
+    PrintError("files compressed with " +
+               zlib::AlgorithmName(params.compression_alg) + " are not "
+               "readable by older clients, the repository needs to be marked "
+               "as containing zstd and lz4 compressed files (-W)");
+    return 3;
+  }
+
   // Either real catalogs or virtual catalog
   if (params.virtual_dir_actions == catalog::VirtualCatalog::kActionNone) {
     publish::SyncUnion *sync;
@@ -823,6 +880,7 @@ int swissknife::CommandSync::Main(const swissknife::ArgumentList &args) {
       return 4;
     }
 
+    sync->set_num_traversal_threads(params.num_traversal_threads);
     sync->Traverse();
   } else {
     assert(!manifest->history().IsNull());
@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "compression.h"
+#include "ingestion/chunk_detector.h"
 #include "repository_tag.h"
 #include "swissknife.h"
 #include "upload.h"
@@ -22,6 +23,7 @@ struct SyncParameters {
   static const unsigned kDefaultNestedKcatalogLimit = 500;
   static const unsigned kDefaultRootKcatalogLimit = 200;
   static const unsigned kDefaultFileMbyteLimit = 1024;
+  static const unsigned kDefaultNumTraversalThreads = 4;
 
   SyncParameters()
       : spooler(NULL),
@@ -41,6 +43,7 @@ struct SyncParameters {
         ignore_special_files(false),
         branched_catalog(false),
         compression_alg(zlib::kZlibDefault),
+        extended_compression(false),
         enforce_limits(false),
         nested_kcatalog_limit(0),
         root_kcatalog_limit(0),
@@ -48,10 +51,16 @@ struct SyncParameters {
         min_file_chunk_size(kDefaultMinFileChunkSize),
         avg_file_chunk_size(kDefaultAvgFileChunkSize),
         max_file_chunk_size(kDefaultMaxFileChunkSize),
+        chunking_algorithm(kChunkingXor32),
         manual_revision(0),
         ttl_seconds(0),
         max_concurrent_write_jobs(0),
         num_upload_tasks(1),
+        num_traversal_threads(kDefaultNumTraversalThreads),
+        num_read_tasks(0),
+        num_processing_tasks(0),
+        adaptive_pipeline(false),
+        max_pipeline_mb(0),
         is_balanced(false),
         max_weight(kDefaultMaxWeight),
         min_weight(kDefaultMinWeight),
@@ -90,6 +99,11 @@ struct SyncParameters {
   bool ignore_special_files;
   bool branched_catalog;
   zlib::Algorithms compression_alg;
+  /**
+   * Sets the extended compression property of the root catalog.  Publishing
+   * with zstd or lz4 requires the property.
+   */
+  bool extended_compression;
   bool enforce_limits;
   unsigned nested_kcatalog_limit;
   unsigned root_kcatalog_limit;
@@ -97,10 +111,24 @@ struct SyncParameters {
   size_t min_file_chunk_size;
   size_t avg_file_chunk_size;
   size_t max_file_chunk_size;
+  ChunkingAlgorithms chunking_algorithm;
   uint64_t manual_revision;
   uint64_t ttl_seconds;
   uint64_t max_concurrent_write_jobs;
   unsigned num_upload_tasks;
+  /**
+   * Threads that read directories of the scratch area ahead of the traversal,
+   * 0 for a single-threaded traversal
+   */
+  unsigned num_traversal_threads;
+  /**
+   * Sizing of the ingestion pipeline of the data spooler, zero values select
+   * the defaults.  See upload::SpoolerDefinition.
+   */
+  unsigned num_read_tasks;
+  unsigned num_processing_tasks;
+  bool adaptive_pipeline;
+  uint64_t max_pipeline_mb;
   bool is_balanced;
   unsigned max_weight;
   unsigned min_weight;
@@ -262,8 +290,19 @@ class CommandSync : public Command {
     r.push_back(Parameter::Optional('f', "union filesystem type"));
     r.push_back(Parameter::Optional('h', "maximal file chunk size in bytes"));
     r.push_back(Parameter::Optional('l', "minimal file chunk size in bytes"));
+    r.push_back(Parameter::Optional('j',
+                                    "chunking algorithm "
+                                    "[xor32, fastcdc] (default: xor32)"));
     r.push_back(Parameter::Optional('q', "number of concurrent write jobs"));
     r.push_back(Parameter::Optional('0', "number of upload tasks"));
+    r.push_back(
+        Parameter::Optional('1', "number of scratch traversal threads"));
+    r.push_back(Parameter::Optional('2', "number of file read threads"));
+    r.push_back(Parameter::Optional(
+        '3', "number of chunk, compress, and hash threads"));
+    r.push_back(Parameter::Optional('4', "pipeline memory limit in megabytes"));
+    r.push_back(Parameter::Switch(
+        '5', "rebalance threads between the pipeline stages"));
     r.push_back(Parameter::Optional('v', "manual revision number"));
     r.push_back(Parameter::Optional('z', "log level (0-4, default: 2)"));
     r.push_back(Parameter::Optional('C', "trusted certificates"));
@@ -298,6 +337,8 @@ class CommandSync : public Command {
     r.push_back(Parameter::Switch('n', "create new repository"));
     r.push_back(Parameter::Switch('p', "enable file chunking"));
     r.push_back(Parameter::Switch('O', "generate legacy bulk chunks"));
+    r.push_back(Parameter::Switch('W', "mark repository as containing zstd "
+                                       "and lz4 compressed files"));
     r.push_back(Parameter::Switch('x', "print change set"));
     r.push_back(Parameter::Switch('y', "dry run"));
     r.push_back(Parameter::Switch('A', "autocatalog enabled/disabled"));
@@ -491,9 +491,11 @@ void SyncMediator::AddDirectoryRecursively(SharedPtr<SyncItem> entry) {
   AddDirectory(entry);
 
   // Create a recursion engine, which recursively adds all entries in a newly
-  // created directory
+  // created directory.  It is started from the scratch area traversal and
+  // shares its read-ahead threads.
   FileSystemTraversal<SyncMediator> traversal(
     this, union_engine_->scratch_path(), true);
+  traversal.set_prefetcher(union_engine_->GetPrefetcher());
   traversal.fn_enter_dir      = &SyncMediator::EnterAddedDirectoryCallback;
   traversal.fn_leave_dir      = &SyncMediator::LeaveAddedDirectoryCallback;
   traversal.fn_new_file       = &SyncMediator::AddFileCallback;
@@ -18,9 +18,16 @@ SyncUnion::SyncUnion(AbstractSyncMediator *mediator,
     : rdonly_path_(rdonly_path),
       scratch_path_(scratch_path),
       union_path_(union_path),
+      num_traversal_threads_(0),
       mediator_(mediator),
       initialized_(false) {}
 
+DirectoryPrefetcher *SyncUnion::GetPrefetcher() {
+  if (!prefetcher_.IsValid() && (num_traversal_threads_ > 0))
+    prefetcher_ = new DirectoryPrefetcher(num_traversal_threads_);
+  return prefetcher_.weak_ref();
+}
+
 bool SyncUnion::Initialize() {
   mediator_->RegisterUnionEngine(this);
   initialized_ = true;
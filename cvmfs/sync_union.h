@@ -33,7 +33,9 @@
 #include <set>
 #include <string>
 
+#include "fs_traversal.h"
 #include "sync_item.h"
+#include "util/pointer.h"
 #include "util/shared_ptr.h"
 
 namespace publish {
@@ -139,10 +141,25 @@ class SyncUnion {
   bool IsInitialized() const { return initialized_; }
   virtual bool SupportsHardlinks() const { return false; }
 
+  /**
+   * See FileSystemTraversal::set_num_threads()
+   */
+  void set_num_traversal_threads(const unsigned num_threads) {
+    num_traversal_threads_ = num_threads;
+  }
+  /**
+   * The read-ahead threads of the scratch area traversal, shared with the
+   * traversals of new directories by the sync mediator.  NULL if the
+   * traversal is sequential.
+   */
+  DirectoryPrefetcher *GetPrefetcher();
+
  protected:
   std::string rdonly_path_;
   std::string scratch_path_;
   std::string union_path_;
+  unsigned num_traversal_threads_;
+  UniquePtr<DirectoryPrefetcher> prefetcher_;
 
   AbstractSyncMediator *mediator_;
 
@@ -34,6 +34,7 @@ void SyncUnionAufs::Traverse() {
   assert(this->IsInitialized());
 
   FileSystemTraversal<SyncUnionAufs> traversal(this, scratch_path(), true);
+  traversal.set_prefetcher(GetPrefetcher());
 
   traversal.fn_enter_dir = &SyncUnionAufs::EnterDirectory;
   traversal.fn_leave_dir = &SyncUnionAufs::LeaveDirectory;
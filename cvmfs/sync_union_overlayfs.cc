@@ -154,6 +154,7 @@ void SyncUnionOverlayfs::Traverse() {
   assert(this->IsInitialized());
 
   FileSystemTraversal<SyncUnionOverlayfs> traversal(this, scratch_path(), true);
+  traversal.set_prefetcher(GetPrefetcher());
 
   traversal.fn_enter_dir = &SyncUnionOverlayfs::EnterDirectory;
   traversal.fn_leave_dir = &SyncUnionOverlayfs::LeaveDirectory;
@@ -51,6 +51,9 @@ bool Spooler::Initialize(perf::StatisticsTemplate *statistics) {
   ingestion_pipeline_ =
       new IngestionPipeline(uploader_.weak_ref(), spooler_definition_);
   ingestion_pipeline_->RegisterListener(&Spooler::ProcessingCallback, this);
+  if (statistics != NULL) {
+    ingestion_pipeline_->InitCounters(statistics);
+  }
   ingestion_pipeline_->Spawn();
 
   // all done...
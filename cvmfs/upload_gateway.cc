@@ -94,8 +94,11 @@ bool GatewayUploader::Initialize() {
     return false;
   }
 
-  return session_context_->Initialize(config_.api_url, session_token, key_id,
-                                      secret);
+  // As many object packs are in flight as there are upload tasks
+  return session_context_->Initialize(
+    config_.api_url, session_token, key_id, secret, ObjectPack::kDefaultLimit,
+    SessionContextBase::kDefaultMaxQueueSize,
+    spooler_definition().num_upload_tasks);
 }
 
 bool GatewayUploader::FinalizeSession(bool commit,
@@ -12,12 +12,14 @@
 #endif
 #include <unistd.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "compression.h"
 #include "logging.h"
 #include "options.h"
+#include "prng.h"
 #include "s3fanout.h"
 #include "util/exception.h"
 #include "util/posix.h"
@@ -39,6 +41,10 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   , num_parallel_uploads_(kDefaultNumParallelUploads)
   , num_retries_(kDefaultNumRetries)
   , timeout_sec_(kDefaultTimeoutSec)
+  , num_io_threads_(kDefaultNumIoThreads)
+  , multipart_threshold_(0)
+  , multipart_part_size_(s3fanout::S3FanoutManager::kMinMultipartPartSize)
+  , multipart_parallel_parts_(kDefaultMultipartParallelParts)
   , authz_method_(s3fanout::kAuthzAwsV2)
   , peek_before_put_(true)
   , temporary_path_(spooler_definition.temporary_path)
@@ -48,11 +54,19 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
 
   atomic_init32(&io_errors_);
   atomic_init32(&terminate_);
+  atomic_init64(&num_staged_);
 
   if (!ParseSpoolerDefinition(spooler_definition)) {
     PANIC(kLogStderr, "Error in parsing the spooler definition");
   }
 
+  // Unique among the publishers that write to the same bucket
+  Prng prng;
+  prng.InitLocaltime();
+  staging_prefix_ = repository_alias_ + "/data/txn/" +
+                    StringifyInt(getpid()) + "." +
+                    StringifyInt(prng.Next(1ULL << 32)) + ".";
+
   s3fanout::S3FanoutManager::S3Config s3config;
   s3config.access_key = access_key_;
   s3config.secret_key = secret_key_;
@@ -66,6 +80,10 @@ S3Uploader::S3Uploader(const SpoolerDefinition &spooler_definition)
   s3config.opt_max_retries = num_retries_;
   s3config.opt_backoff_init_ms = kDefaultBackoffInitMs;
   s3config.opt_backoff_max_ms = kDefaultBackoffMaxMs;
+  s3config.num_io_threads = num_io_threads_;
+  s3config.multipart_threshold = multipart_threshold_;
+  s3config.multipart_part_size = multipart_part_size_;
+  s3config.multipart_parallel_parts = multipart_parallel_parts_;
 
   s3fanout_mgr_ = new s3fanout::S3FanoutManager(s3config);
   s3fanout_mgr_->Spawn();
@@ -162,6 +180,40 @@ bool S3Uploader::ParseSpoolerDefinition(
   if (options_manager.GetValue("CVMFS_S3_PEEK_BEFORE_PUT", &parameter)) {
     peek_before_put_ = options_manager.IsOn(parameter);
   }
+  if (options_manager.GetValue("CVMFS_S3_NUM_IO_THREADS", &parameter)) {
+    num_io_threads_ = std::max(1U, static_cast<unsigned>(
+      String2Uint64(parameter)));
+  }
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_THRESHOLD", &parameter)) {
+    multipart_threshold_ = String2Uint64(parameter);
+  }
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_PART_SIZE", &parameter)) {
+    multipart_part_size_ = String2Uint64(parameter);
+    if (multipart_part_size_ <
+        s3fanout::S3FanoutManager::kMinMultipartPartSize)
+    {
+      LogCvmfs(kLogUploadS3, kLogStderr | kLogSyslogWarn,
+               "CVMFS_S3_MULTIPART_PART_SIZE below the S3 minimum, "
+               "using %" PRIu64 " bytes",
+               s3fanout::S3FanoutManager::kMinMultipartPartSize);
+      multipart_part_size_ = s3fanout::S3FanoutManager::kMinMultipartPartSize;
+    }
+  }
+  // The first part of a staged object holds everything up to the threshold
+  if (multipart_threshold_ > s3fanout::S3FanoutManager::kMaxMultipartPartSize)
+  {
+    LogCvmfs(kLogUploadS3, kLogStderr | kLogSyslogWarn,
+             "CVMFS_S3_MULTIPART_THRESHOLD above the S3 part size limit, "
+             "using %" PRIu64 " bytes",
+             s3fanout::S3FanoutManager::kMaxMultipartPartSize);
+    multipart_threshold_ = s3fanout::S3FanoutManager::kMaxMultipartPartSize;
+  }
+  if (options_manager.GetValue("CVMFS_S3_MULTIPART_PARALLEL_PARTS",
+                               &parameter))
+  {
+    multipart_parallel_parts_ = std::max(1U, static_cast<unsigned>(
+      String2Uint64(parameter)));
+  }
 
   return true;
 }
@@ -243,6 +295,14 @@ void *S3Uploader::MainCollectResults(void *data) {
                           UploaderResults(UploaderResults::kLookup,
                                           reply_code));
       } else {
+        if (!info->copy_source.empty()) {
+          // The staging object of a streamed upload is no longer needed
+          uploader->IncJobsInFlight();
+          s3fanout::JobInfo *remove =
+            uploader->CreateJobInfo(info->copy_source);
+          remove->request = s3fanout::JobInfo::kReqDelete;
+          uploader->UploadJobInfo(remove);
+        }
         if (info->request == s3fanout::JobInfo::kReqHeadPut) {
           // The HEAD request was not transformed into a PUT request, thus this
           // was a duplicate
@@ -284,6 +344,23 @@ void S3Uploader::DoUpload(
   rvb = source->GetSize(&size);
   assert(rvb);
 
+  s3fanout::JobInfo::RequestType request = s3fanout::JobInfo::kReqPutCas;
+  if (HasPrefix(remote_path, ".cvmfs", false /*ignore_case*/)) {
+    request = s3fanout::JobInfo::kReqPutDotCvmfs;
+  } else if (HasSuffix(remote_path, ".html", false)) {
+    request = s3fanout::JobInfo::kReqPutHtml;
+  } else {
+    if (peek_before_put_)
+      request = s3fanout::JobInfo::kReqHeadPut;
+  }
+
+  if ((multipart_threshold_ > 0) &&
+      (size >= std::max(multipart_threshold_, multipart_part_size_)))
+  {
+    DoUploadInParts(remote_path, source, request, callback);
+    return;
+  }
+
   FileBackedBuffer *origin =
     FileBackedBuffer::Create(kInMemoryObjectThreshold,
                              spooler_definition().temporary_path);
@@ -308,15 +385,7 @@ void S3Uploader::DoUpload(
                           const_cast<void*>(
                               static_cast<void const*>(callback)),
                           origin);
-
-  if (HasPrefix(remote_path, ".cvmfs", false /*ignore_case*/)) {
-    info->request = s3fanout::JobInfo::kReqPutDotCvmfs;
-  } else if (HasSuffix(remote_path, ".html", false)) {
-    info->request = s3fanout::JobInfo::kReqPutHtml;
-  } else {
-    if (peek_before_put_)
-      info->request = s3fanout::JobInfo::kReqHeadPut;
-  }
+  info->request = request;
 
   RequestCtrl req_ctrl;
   MakePipe(req_ctrl.pipe_wait);
@@ -332,6 +401,108 @@ void S3Uploader::DoUpload(
 }
 
 
+/**
+ * Large files are uploaded in parts while they are read, so that no more than
+ * multipart_parallel_parts parts are buffered at a time.  Content-addressed
+ * files are looked up before they are read.
+ */
+void S3Uploader::DoUploadInParts(
+  const std::string &remote_path,
+  IngestionSource *source,
+  s3fanout::JobInfo::RequestType request,
+  const CallbackTN *callback)
+{
+  if (request == s3fanout::JobInfo::kReqHeadPut) {
+    if (Peek(remote_path)) {
+      // Same accounting as for duplicates in MainCollectResults()
+      uint64_t size;
+      source->GetSize(&size);
+      source->Close();
+      CountDuplicates();
+      DecUploadedChunks();
+      CountUploadedBytes(-static_cast<int64_t>(size));
+      Respond(callback, UploaderResults(0, source->GetPath()));
+      return;
+    }
+    request = s3fanout::JobInfo::kReqPutCas;
+  }
+
+  RequestCtrl req_ctrl;
+  MakePipe(req_ctrl.pipe_wait);
+  req_ctrl.callback_forward = callback;
+  req_ctrl.original_path = source->GetPath();
+  s3fanout::JobInfo *info =
+    new s3fanout::JobInfo(repository_alias_ + "/" + remote_path,
+                          const_cast<void*>(static_cast<void const*>(
+                            MakeClosure(&S3Uploader::OnReqComplete, this,
+                                        &req_ctrl))),
+                          NULL);
+  info->request = request;
+  LogCvmfs(kLogUploadS3, kLogDebug, "Uploading %s in parts",
+           info->object_key.c_str());
+  s3fanout_mgr_->PushStreamedJob(info);
+
+  s3fanout::Failures error_code = s3fanout::kFailOk;
+  UniquePtr<FileBackedBuffer> part(
+    FileBackedBuffer::Create(kInMemoryObjectThreshold,
+                             spooler_definition().temporary_path));
+  unsigned char buffer[kPageSize];
+  ssize_t nbytes;
+  do {
+    nbytes = source->Read(buffer, kPageSize);
+    if (nbytes < 0) {
+      error_code = s3fanout::kFailLocalIO;
+      break;
+    }
+    if (nbytes > 0) part->Append(buffer, nbytes);
+    if (IsStreamedPartFull(*info, part->GetSize()))
+      PushStreamedPart(info, &part);
+  } while (nbytes == kPageSize);
+  source->Close();
+  if ((error_code == s3fanout::kFailOk) && (part->GetSize() > 0))
+    PushStreamedPart(info, &part);
+  s3fanout_mgr_->CloseStreamedJob(info, error_code);
+
+  req_ctrl.WaitFor();
+  LogCvmfs(kLogUploadS3, kLogDebug, "Uploading from source finished: %s",
+           source->GetPath().c_str());
+}
+
+
+/**
+ * The parts of streamed objects grow by the configured part size every 1000
+ * parts, so that objects of unknown size fit into the maximum number of parts.
+ * The last possible part takes the rest of the object.
+ */
+bool S3Uploader::IsStreamedPartFull(
+  const s3fanout::JobInfo &info,
+  uint64_t size) const
+{
+  const unsigned num_parts = info.multipart->next_part;
+  if (num_parts + 1 >= s3fanout::S3FanoutManager::kMaxMultipartParts)
+    return false;
+  const uint64_t part_size = std::min(
+    multipart_part_size_ * (1 + num_parts / 1000),
+    s3fanout::S3FanoutManager::kMaxMultipartPartSize);
+  return size >= part_size;
+}
+
+
+/**
+ * Hands the buffer as the next part to the S3 fanout and replaces it by an
+ * empty one.  Blocks while too many parts of the object are pending.
+ */
+void S3Uploader::PushStreamedPart(
+  s3fanout::JobInfo *info,
+  UniquePtr<FileBackedBuffer> *buffer)
+{
+  (*buffer)->Commit();
+  s3fanout_mgr_->PushStreamedPart(info, buffer->Release());
+  *buffer = FileBackedBuffer::Create(kInMemoryObjectThreshold,
+                                     spooler_definition().temporary_path);
+}
+
+
 void S3Uploader::UploadJobInfo(s3fanout::JobInfo *info) {
   LogCvmfs(kLogUploadS3, kLogDebug,
            "Uploading:\n"
@@ -360,6 +531,26 @@ void S3Uploader::StreamedUpload(
   S3StreamHandle *s3_handle = static_cast<S3StreamHandle*>(handle);
 
   s3_handle->buffer->Append(buffer.data, buffer.size);
+  if ((s3_handle->staging == NULL) && (multipart_threshold_ > 0) &&
+      (s3_handle->buffer->GetSize() >=
+       std::max(multipart_threshold_, multipart_part_size_)))
+  {
+    const std::string staging_key =
+      staging_prefix_ + StringifyInt(atomic_xadd64(&num_staged_, 1));
+    LogCvmfs(kLogUploadS3, kLogDebug, "Staging streamed object as %s",
+             staging_key.c_str());
+    s3_handle->staging = new s3fanout::JobInfo(
+      staging_key,
+      const_cast<void*>(static_cast<void const*>(MakeClosure(
+        &S3Uploader::OnStagingComplete, this, s3_handle))),
+      NULL);
+    s3fanout_mgr_->PushStreamedJob(s3_handle->staging);
+  }
+  if ((s3_handle->staging != NULL) &&
+      IsStreamedPartFull(*s3_handle->staging, s3_handle->buffer->GetSize()))
+  {
+    PushStreamedPart(s3_handle->staging, &s3_handle->buffer);
+  }
   Respond(callback, UploaderResults(UploaderResults::kBufferUpload, 0));
 }
 
@@ -378,23 +569,34 @@ void S3Uploader::FinalizeStreamedUpload(
     final_path = repository_alias_ + "/data/" + content_hash.MakePath();
   }
 
-  s3_handle->buffer->Commit();
-
-  size_t bytes_uploaded = s3_handle->buffer->GetSize();
+  size_t bytes_uploaded;
+  if (s3_handle->staging != NULL) {
+    if (s3_handle->buffer->GetSize() > 0)
+      PushStreamedPart(s3_handle->staging, &s3_handle->buffer);
+    bytes_uploaded = s3_handle->staging->payload_size;
+    s3_handle->final_path = final_path;
+    // The staging object is responded to and the handle is deleted by
+    // OnStagingComplete()
+    IncJobsInFlight();
+    s3fanout_mgr_->CloseStreamedJob(s3_handle->staging, s3fanout::kFailOk);
+  } else {
+    s3_handle->buffer->Commit();
+    bytes_uploaded = s3_handle->buffer->GetSize();
 
-  s3fanout::JobInfo *info =
-      new s3fanout::JobInfo(final_path,
-                            const_cast<void*>(
-                                static_cast<void const*>(
-                                    handle->commit_callback)),
-                            s3_handle->buffer.Release());
+    s3fanout::JobInfo *info =
+        new s3fanout::JobInfo(final_path,
+                              const_cast<void*>(
+                                  static_cast<void const*>(
+                                      handle->commit_callback)),
+                              s3_handle->buffer.Release());
 
-  if (peek_before_put_)
-      info->request = s3fanout::JobInfo::kReqHeadPut;
-  UploadJobInfo(info);
+    if (peek_before_put_)
+        info->request = s3fanout::JobInfo::kReqHeadPut;
+    UploadJobInfo(info);
 
-  // Remove the temporary file
-  delete s3_handle;
+    // Remove the temporary file
+    delete s3_handle;
+  }
 
   // Update statistics counters
   if (!content_hash.HasSuffix() ||
@@ -408,6 +610,35 @@ void S3Uploader::FinalizeStreamedUpload(
 }
 
 
+/**
+ * The staging object of a large streamed object is complete.  It is copied to
+ * its final name, which reports to the commit callback.  The staging object
+ * is removed in MainCollectResults() once it is copied.
+ */
+void S3Uploader::OnStagingComplete(
+  const upload::UploaderResults &results,
+  S3StreamHandle *handle)
+{
+  if (results.return_code != 0) {
+    // We are already in Respond() for the staging object
+    Respond(handle->commit_callback,
+            UploaderResults(UploaderResults::kChunkCommit,
+                            results.return_code));
+  } else {
+    s3fanout::JobInfo *info =
+      new s3fanout::JobInfo(handle->final_path,
+                            const_cast<void*>(static_cast<void const*>(
+                              handle->commit_callback)),
+                            handle->staging->object_key,
+                            handle->staging->payload_size);
+    if (peek_before_put_)
+      info->request = s3fanout::JobInfo::kReqHeadPut;
+    UploadJobInfo(info);
+  }
+  delete handle;
+}
+
+
 s3fanout::JobInfo *S3Uploader::CreateJobInfo(const std::string& path) const {
   FileBackedBuffer *buf = FileBackedBuffer::Create(kInMemoryObjectThreshold);
   return new s3fanout::JobInfo(path, NULL, buf);
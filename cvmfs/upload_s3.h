@@ -26,12 +26,23 @@ struct S3StreamHandle : public UploadStreamHandle {
     uint64_t in_memory_threshold,
     const std::string &tmp_dir = "/tmp/")
     : UploadStreamHandle(commit_callback)
+    , staging(NULL)
   {
     buffer = FileBackedBuffer::Create(in_memory_threshold, tmp_dir);
   }
 
-  // Ownership is later transferred to the S3 fanout
+  // Ownership is later transferred to the S3 fanout.  Once the object is
+  // staged, it only holds the part that is currently written.
   UniquePtr<FileBackedBuffer> buffer;
+  /**
+   * The name of a streamed object is only known at the end, when the content
+   * hash is computed.  Objects above the multipart threshold are therefore
+   * uploaded in parts to a staging object while they are written.  Once they
+   * are complete, the staging object is copied to the final object.  The
+   * handle lives until the staging object is complete.
+   */
+  s3fanout::JobInfo *staging;
+  std::string final_path;
 };
 
 /**
@@ -86,6 +97,8 @@ class S3Uploader : public AbstractUploader {
   static const unsigned kDefaultTimeoutSec = 60;
   static const unsigned kDefaultBackoffInitMs = 100;
   static const unsigned kDefaultBackoffMaxMs = 2000;
+  static const unsigned kDefaultNumIoThreads = 1;
+  static const unsigned kDefaultMultipartParallelParts = 4;
   static const unsigned kInMemoryObjectThreshold = 500*1024;  // 500KiB
 
   // Used to make the async HTTP requests synchronous in Peek() Create(),
@@ -104,11 +117,20 @@ class S3Uploader : public AbstractUploader {
   };
 
   void OnReqComplete(const upload::UploaderResults &results, RequestCtrl *ctrl);
+  void OnStagingComplete(const upload::UploaderResults &results,
+                         S3StreamHandle *handle);
 
   static void *MainCollectResults(void *data);
 
   bool ParseSpoolerDefinition(const SpoolerDefinition &spooler_definition);
   void UploadJobInfo(s3fanout::JobInfo *info);
+  void DoUploadInParts(const std::string &remote_path,
+                       IngestionSource *source,
+                       s3fanout::JobInfo::RequestType request,
+                       const CallbackTN *callback);
+  bool IsStreamedPartFull(const s3fanout::JobInfo &info, uint64_t size) const;
+  void PushStreamedPart(s3fanout::JobInfo *info,
+                        UniquePtr<FileBackedBuffer> *buffer);
 
   s3fanout::JobInfo *CreateJobInfo(const std::string &path) const;
 
@@ -122,6 +144,18 @@ class S3Uploader : public AbstractUploader {
   int num_parallel_uploads_;
   unsigned num_retries_;
   unsigned timeout_sec_;
+  unsigned num_io_threads_;
+  /**
+   * Objects larger than that are uploaded in parts, 0 turns it off
+   */
+  uint64_t multipart_threshold_;
+  uint64_t multipart_part_size_;
+  unsigned multipart_parallel_parts_;
+  /**
+   * Large streamed objects are staged under <staging_prefix_><number>
+   */
+  std::string staging_prefix_;
+  atomic_int64 num_staged_;
   std::string access_key_;
   std::string secret_key_;
   s3fanout::AuthzMethods authz_method_;
@@ -33,8 +33,13 @@ SpoolerDefinition::SpoolerDefinition(
       min_file_chunk_size(min_file_chunk_size),
       avg_file_chunk_size(avg_file_chunk_size),
       max_file_chunk_size(max_file_chunk_size),
+      chunking_algorithm(kChunkingXor32),
       number_of_concurrent_uploads(kDefaultMaxConcurrentUploads),
       num_upload_tasks(kDefaultNumUploadTasks),
+      num_read_tasks(0),
+      num_processing_tasks(0),
+      adaptive_pipeline(false),
+      max_pipeline_mem(0),
       session_token_file(session_token_file),
       key_file(key_file),
       valid_(false) {
@@ -77,6 +82,12 @@ SpoolerDefinition::SpoolerDefinition(
 SpoolerDefinition SpoolerDefinition::Dup2DefaultCompression() const {
   SpoolerDefinition result(*this);
   result.compression_alg = zlib::kZlibDefault;
+  // Meta-objects are not checked against the known content
+  result.known_content_path = "";
+  // Meta-objects are few, a small fixed pipeline suffices
+  result.num_read_tasks = 0;
+  result.num_processing_tasks = 0;
+  result.adaptive_pipeline = false;
   return result;
 }
 
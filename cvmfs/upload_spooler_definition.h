@@ -5,10 +5,13 @@
 #ifndef CVMFS_UPLOAD_SPOOLER_DEFINITION_H_
 #define CVMFS_UPLOAD_SPOOLER_DEFINITION_H_
 
+#include <stdint.h>
+
 #include <string>
 
 #include "compression.h"
 #include "hash.h"
+#include "ingestion/chunk_detector.h"
 
 namespace upload {
 
@@ -51,7 +54,7 @@ struct SpoolerDefinition {
   /**
    * Creates a new SpoolerDefinition based on an existing one.  The new spooler
    * has compression set to zlib, which is required for catalogs and other meta-
-   * objects.
+   * objects, and it does not use a known content index.
    */
   SpoolerDefinition Dup2DefaultCompression() const;
 
@@ -75,6 +78,10 @@ struct SpoolerDefinition {
   size_t min_file_chunk_size;
   size_t avg_file_chunk_size;
   size_t max_file_chunk_size;
+  /**
+   * Content-defined chunking algorithm, Xor32 unless set otherwise
+   */
+  ChunkingAlgorithms chunking_algorithm;
 
   /**
    * This is the number of concurrently open files to be uploaded. It does not,
@@ -88,6 +95,28 @@ struct SpoolerDefinition {
    */
   unsigned int num_upload_tasks;
 
+  /**
+   * Sizing of the IngestionPipeline.  The read stage is I/O bound and has a
+   * fixed number of threads.  The chunk, compress, and hash stages share the
+   * given number of processing slots, which are rebalanced at runtime between
+   * the stages if adaptive_pipeline is set.  Zero values select the defaults,
+   * which depend on the number of CPU cores.  By default, the pipeline is not
+   * adaptive and uses the traditional fixed number of threads per stage.
+   */
+  unsigned int num_read_tasks;
+  unsigned int num_processing_tasks;
+  bool adaptive_pipeline;
+  /**
+   * Upper bound for the memory used by blocks in flight, zero selects the
+   * default.  Overruled by the _CVMFS_SERVER_PIPELINE_MB environment variable.
+   */
+  uint64_t max_pipeline_mem;
+  /**
+   * If set, files whose uncompressed content is found in this index of
+   * previously processed files skip compression and upload
+   */
+  std::string known_content_path;
+
   // The session_token_file parameter is only used for the HTTP driver
   std::string session_token_file;
   std::string key_file;
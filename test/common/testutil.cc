@@ -320,6 +320,7 @@ void MockCatalog::RemoveChild(MockCatalog *child) {
   while (iter != active_children_.end()) {
     if (iter->hash == child->hash()) {
       active_children_.erase(iter);
+      child->parent_ = NULL;
       return;
     }
     iter++;
@@ -402,6 +403,7 @@ void MockCatalog::AddChild(MockCatalog *child) {
   nested.child = child;
   nested.size = child->catalog_size();
   active_children_.push_back(nested);
+  child->parent_ = this;
 }
 
 void MockCatalog::AddFile(const shash::Any   &content_hash,
@@ -564,7 +564,8 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
   explicit MockCatalogManager(perf::Statistics *statistics) :
     AbstractCatalogManager<MockCatalog>(statistics), spooler_(new Spooler()),
     max_weight_(5), min_weight_(1), balance_weight_(3),
-    autogenerated_catalogs_(0), num_added_files_(0) { }
+    autogenerated_catalogs_(0), num_added_files_(0), num_staged_catalogs_(0)
+  { }
 
   virtual ~MockCatalogManager() { delete spooler_; }
 
@@ -576,6 +577,18 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
   virtual MockCatalog* CreateCatalog(const PathString  &mountpoint,
                                  const shash::Any  &catalog_hash,
                                  MockCatalog *parent_catalog);
+  /**
+   * Staging must happen without the lock, otherwise taking the write lock from
+   * the same thread fails
+   */
+  virtual bool StageCatalog(const PathString &mountpoint,
+                            const shash::Any &hash)
+  {
+    WriteLock();
+    Unlock();
+    ++num_staged_catalogs_;
+    return true;
+  }
   MockCatalog* RetrieveRootCatalog() { return GetRootCatalog(); }
   void AddFile(const DirectoryEntryBase &entry,
                const XattrList &xattrs,
@@ -592,6 +605,7 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
 
   unsigned GetNumAutogeneratedCatalogs() { return autogenerated_catalogs_; }
   unsigned GetNumAddedFiles() { return num_added_files_; }
+  unsigned GetNumStagedCatalogs() { return num_staged_catalogs_; }
 
   MockCatalog *FindCatalog(const PathString &path) {
     map<PathString, MockCatalog*>::iterator it;
@@ -634,6 +648,7 @@ class MockCatalogManager : public AbstractCatalogManager<MockCatalog> {
   unsigned balance_weight_;
   unsigned autogenerated_catalogs_;
   unsigned num_added_files_;
+  unsigned num_staged_catalogs_;
 };
 
 }  // namespace catalog
@@ -0,0 +1,88 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <pthread.h>
+
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "bm_util.h"
+#include "catalog.h"
+#include "catalog_sql.h"
+#include "directory_entry.h"
+#include "hash.h"
+#include "shortstring.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Parallel lookups of the root entry of a catalog by st.range(0) threads with
+ * st.range(1) SQLite connections.
+ */
+class BM_Catalog : public benchmark::Fixture {
+ protected:
+  static const unsigned kLookupsPerThread = 1000;
+
+  virtual void SetUp(const benchmark::State &st) {
+    sandbox_ = CreateTempDir("./cvmfs_ub_catalog");
+    assert(!sandbox_.empty());
+    const string db_path = sandbox_ + "/catalog";
+    {
+      UniquePtr<catalog::CatalogDatabase>
+        db(catalog::CatalogDatabase::Create(db_path));
+      assert(db.IsValid());
+      bool retval = db->InsertInitialValues("", false, "",
+                                            catalog::DirectoryEntry());
+      assert(retval);
+    }
+    catalog_ = catalog::Catalog::AttachFreely("", db_path, shash::Any());
+    assert(catalog_ != NULL);
+    for (int i = 1; i < st.range(1); ++i) {
+      bool retval = catalog_->AddReadConnection(db_path);
+      assert(retval);
+    }
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    delete catalog_;
+    RemoveTree(sandbox_);
+  }
+
+  static void *MainLookup(void *data) {
+    catalog::Catalog *catalog = reinterpret_cast<catalog::Catalog *>(data);
+    const PathString root_path("");
+    for (unsigned i = 0; i < kLookupsPerThread; ++i) {
+      catalog::DirectoryEntry dirent;
+      bool retval = catalog->LookupPath(root_path, &dirent);
+      assert(retval);
+      Escape(&dirent);
+    }
+    return NULL;
+  }
+
+  string sandbox_;
+  catalog::Catalog *catalog_;
+};
+
+
+BENCHMARK_DEFINE_F(BM_Catalog, ParallelLookup)(benchmark::State &st) {
+  const unsigned num_threads = st.range(0);
+  vector<pthread_t> threads(num_threads);
+  while (st.KeepRunning()) {
+    for (unsigned i = 0; i < num_threads; ++i) {
+      int retval = pthread_create(&threads[i], NULL, MainLookup, catalog_);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < num_threads; ++i)
+      pthread_join(threads[i], NULL);
+  }
+  st.SetItemsProcessed(st.iterations() * num_threads * kLookupsPerThread);
+}
+BENCHMARK_REGISTER_F(BM_Catalog, ParallelLookup)->Repetitions(3)->
+  ArgPair(1, 1)->ArgPair(4, 1)->ArgPair(4, 4)->ArgPair(8, 1)->ArgPair(8, 4)->
+  UseRealTime();
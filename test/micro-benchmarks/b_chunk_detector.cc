@@ -0,0 +1,179 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "ingestion/chunk_detector.h"
+#include "ingestion/item.h"
+#include "ingestion/item_mem.h"
+#include "prng.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Chunks two versions of a synthetic file that resembles a software layer: a
+ * mix of incompressible blobs and repetitive text-like runs.  The second
+ * version has small insertions and deletions every few megabytes.  The file is
+ * fed to the detector in blocks of the size used by the read stage of the
+ * ingestion pipeline.  Chunking throughput is measured on the second version,
+ * the deduplication ratio of both versions (total bytes / unique chunk bytes)
+ * is reported in the label.
+ */
+class BM_ChunkDetector : public benchmark::Fixture {
+ protected:
+  static const unsigned kDataSize = 64 * 1024 * 1024;
+  static const unsigned kBlockSize = 16 * 1024;
+  static const unsigned kEditDistance = 3 * 1024 * 1024;
+
+  virtual void SetUp(const benchmark::State &st) {
+    algorithm_ = static_cast<ChunkingAlgorithms>(st.range(0));
+    avg_chunk_size_ = st.range(1) * 1024;
+    prng_.InitSeed(42);
+
+    string original;
+    original.reserve(kDataSize);
+    while (original.size() < kDataSize) {
+      const unsigned run = 1024 + prng_.Next(64 * 1024);
+      if (prng_.Next(2) == 0) {
+        for (unsigned i = 0; i < run; ++i)
+          original.push_back(static_cast<char>(prng_.Next(256)));
+      } else {
+        const char *words[] = {"lib", "include", "x86_64", "cvmfs", "\n"};
+        const size_t end = original.size() + run;
+        while (original.size() < end)
+          original.append(words[prng_.Next(5)]);
+      }
+    }
+    original.resize(kDataSize);
+
+    string modified;
+    modified.reserve(kDataSize + kDataSize / kEditDistance * 64);
+    for (unsigned pos = 0; pos < kDataSize; pos += kEditDistance) {
+      const unsigned len = min(kEditDistance, kDataSize - pos);
+      if (prng_.Next(2) == 0) {
+        modified.append(string(1 + prng_.Next(64), 'x'));
+        modified.append(original, pos, len);
+      } else {
+        const unsigned skip = 1 + prng_.Next(64);
+        modified.append(original, pos + skip, len - skip);
+      }
+    }
+
+    MakeBlocks(original, &blocks_original_);
+    MakeBlocks(modified, &blocks_modified_);
+    size_modified_ = modified.size();
+    size_total_ = original.size() + modified.size();
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    for (unsigned i = 0; i < blocks_original_.size(); ++i)
+      delete blocks_original_[i];
+    for (unsigned i = 0; i < blocks_modified_.size(); ++i)
+      delete blocks_modified_[i];
+    blocks_original_.clear();
+    blocks_modified_.clear();
+  }
+
+  void MakeBlocks(const string &data, vector<BlockItem *> *blocks) {
+    for (unsigned pos = 0; pos < data.size(); pos += kBlockSize) {
+      BlockItem *block = new BlockItem(&allocator_);
+      block->MakeDataCopy(
+        reinterpret_cast<const unsigned char *>(data.data()) + pos,
+        min(static_cast<size_t>(kBlockSize), data.size() - pos));
+      blocks->push_back(block);
+    }
+  }
+
+  ChunkDetector *CreateDetector() {
+    return ChunkDetector::Create(algorithm_, avg_chunk_size_ / 2,
+                                 avg_chunk_size_, avg_chunk_size_ * 2);
+  }
+
+  /**
+   * Returns the cut marks including the end of the file
+   */
+  vector<uint64_t> Chunk(const vector<BlockItem *> &blocks, uint64_t size) {
+    vector<uint64_t> cut_marks;
+    ChunkDetector *detector = CreateDetector();
+    for (unsigned i = 0; i < blocks.size(); ++i) {
+      uint64_t cut_mark;
+      while ((cut_mark = detector->FindNextCutMark(blocks[i])) != 0)
+        cut_marks.push_back(cut_mark);
+    }
+    delete detector;
+    if (cut_marks.empty() || (cut_marks.back() != size))
+      cut_marks.push_back(size);
+    return cut_marks;
+  }
+
+  /**
+   * Adds the hashes and sizes of the chunks to the set of unique chunks
+   */
+  uint64_t CountUnique(const vector<BlockItem *> &blocks, uint64_t size,
+                       set<shash::Any> *unique)
+  {
+    string data;
+    for (unsigned i = 0; i < blocks.size(); ++i) {
+      data.append(reinterpret_cast<char *>(blocks[i]->data()),
+                  blocks[i]->size());
+    }
+    const vector<uint64_t> cut_marks = Chunk(blocks, size);
+    uint64_t unique_bytes = 0;
+    uint64_t last_cut = 0;
+    for (unsigned i = 0; i < cut_marks.size(); ++i) {
+      shash::Any hash(shash::kMd5);
+      shash::HashMem(
+        reinterpret_cast<const unsigned char *>(data.data()) + last_cut,
+        cut_marks[i] - last_cut, &hash);
+      if (unique->insert(hash).second)
+        unique_bytes += cut_marks[i] - last_cut;
+      last_cut = cut_marks[i];
+    }
+    return unique_bytes;
+  }
+
+  double DedupRatio() {
+    set<shash::Any> unique;
+    uint64_t unique_bytes = CountUnique(blocks_original_, kDataSize, &unique);
+    unique_bytes += CountUnique(blocks_modified_, size_modified_, &unique);
+    return static_cast<double>(size_total_) / unique_bytes;
+  }
+
+  ChunkingAlgorithms algorithm_;
+  uint64_t avg_chunk_size_;
+  Prng prng_;
+  ItemAllocator allocator_;
+  vector<BlockItem *> blocks_original_;
+  vector<BlockItem *> blocks_modified_;
+  uint64_t size_modified_;
+  uint64_t size_total_;
+};
+
+
+/**
+ * Arguments: chunking algorithm (0: xor32, 1: fastcdc), average chunk size in
+ * kB.  The minimal and maximal chunk sizes are half and twice the average,
+ * like in the default repository configuration.
+ */
+BENCHMARK_DEFINE_F(BM_ChunkDetector, Chunk)(benchmark::State &st) {
+  while (st.KeepRunning()) {
+    Chunk(blocks_modified_, size_modified_);
+  }
+  st.SetBytesProcessed(st.iterations() * size_modified_);
+
+  char label[64];
+  snprintf(label, sizeof(label), "%s dedup %.2f",
+           ChunkingAlgorithmName(algorithm_).c_str(), DedupRatio());
+  st.SetLabel(label);
+}
+BENCHMARK_REGISTER_F(BM_ChunkDetector, Chunk)->Repetitions(3)->
+  ArgPair(kChunkingXor32, 256)->ArgPair(kChunkingFastCdc, 256)->
+  ArgPair(kChunkingXor32, 8192)->ArgPair(kChunkingFastCdc, 8192);
@@ -10,6 +10,7 @@
 
 #include "bm_util.h"
 #include "compression.h"
+#include "util/string.h"
 
 class BM_Compression : public benchmark::Fixture {
  protected:
@@ -34,3 +35,79 @@ BENCHMARK_DEFINE_F(BM_Compression, Zlib)(benchmark::State &st) {
 }
 BENCHMARK_REGISTER_F(BM_Compression, Zlib)->Repetitions(3)->
   Arg(100)->Arg(4096)->Arg(100*1024);
+
+
+/**
+ * Compresses and decompresses a buffer of mixed, partly compressible content
+ * with the algorithm given as second argument.  Reports the compression ratio
+ * in the label.
+ */
+class BM_CompressionAlg : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+    size_ = st.range(0);
+    alg_ = static_cast<zlib::Algorithms>(st.range(1));
+    buffer_ = reinterpret_cast<unsigned char *>(malloc(size_));
+    for (unsigned i = 0; i < size_; ++i)
+      buffer_[i] = (i % 1024 < 512) ? i % 7 : i % 251;
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    free(buffer_);
+  }
+
+  unsigned size_;
+  zlib::Algorithms alg_;
+  unsigned char *buffer_;
+};
+
+
+/**
+ * Arguments: buffer size, algorithm (0: zlib, 2: zstd, 3: lz4).  Only the
+ * algorithms compiled in are registered.
+ */
+static void AlgorithmArgs(benchmark::internal::Benchmark *b) {
+  const int sizes[] = {4096, 1024 * 1024};
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    b->ArgPair(sizes[i], zlib::kZlibDefault);
+#ifdef HAS_ZSTD
+    b->ArgPair(sizes[i], zlib::kZstd);
+#endif
+#ifdef HAS_LZ4
+    b->ArgPair(sizes[i], zlib::kLz4);
+#endif
+  }
+}
+
+
+BENCHMARK_DEFINE_F(BM_CompressionAlg, Compress)(benchmark::State &st) {
+  uint64_t out_size = 0;
+  while (st.KeepRunning()) {
+    void *out_buf;
+    zlib::CompressMem2Mem(buffer_, size_, alg_, &out_buf, &out_size);
+    free(out_buf);
+  }
+  st.SetBytesProcessed(st.iterations() * size_);
+  st.SetLabel(zlib::AlgorithmName(alg_) + " ratio " +
+              StringifyInt(size_ / (out_size ? out_size : 1)));
+}
+BENCHMARK_REGISTER_F(BM_CompressionAlg, Compress)->Repetitions(3)->
+  Apply(AlgorithmArgs);
+
+
+BENCHMARK_DEFINE_F(BM_CompressionAlg, Decompress)(benchmark::State &st) {
+  void *compressed;
+  uint64_t compressed_size;
+  zlib::CompressMem2Mem(buffer_, size_, alg_, &compressed, &compressed_size);
+  while (st.KeepRunning()) {
+    void *out_buf;
+    uint64_t out_size;
+    zlib::DecompressMem2Mem(compressed, compressed_size, &out_buf, &out_size);
+    free(out_buf);
+  }
+  free(compressed);
+  st.SetBytesProcessed(st.iterations() * size_);
+  st.SetLabel(zlib::AlgorithmName(alg_));
+}
+BENCHMARK_REGISTER_F(BM_CompressionAlg, Decompress)->Repetitions(3)->
+  Apply(AlgorithmArgs);
@@ -0,0 +1,181 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdlib>
+#include <string>
+
+#include "bm_util.h"
+#include "download.h"
+#include "platform.h"
+#include "statistics.h"
+#include "util/posix.h"
+#include "util_concurrency.h"
+
+using namespace std;  // NOLINT
+
+class BM_Download : public benchmark::Fixture {
+ protected:
+  virtual void SetUp(const benchmark::State &st) {
+    tmp_path_ = CreateTempDir("/tmp/cvmfs_benchmark_download");
+    assert(!tmp_path_.empty());
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    RemoveTree(tmp_path_);
+  }
+
+  string tmp_path_;
+};
+
+
+/**
+ * Round trip of a small object through the download I/O thread.  The objects
+ * are local files, so the overhead of handing the job to the I/O thread and
+ * back dominates.
+ */
+BENCHMARK_DEFINE_F(BM_Download, FetchLocalMem)(benchmark::State &st) {
+  const unsigned size = st.range(0);
+  const string path = tmp_path_ + "/object";
+  string content(size, 'x');
+  bool retval = SafeWriteToFile(content, path, 0600);
+  assert(retval);
+  const string url = "file://" + path;
+
+  perf::Statistics statistics;
+  download::DownloadManager download_mgr;
+  download_mgr.Init(16, false, perf::StatisticsTemplate("bm", &statistics));
+  download_mgr.Spawn();
+
+  while (st.KeepRunning()) {
+    download::JobInfo info(&url, false /* compressed */,
+                           false /* probe hosts */, NULL);
+    download_mgr.Fetch(&info);
+    assert(info.error_code == download::kFailOk);
+    Escape(info.destination_mem.data);
+    free(info.destination_mem.data);
+  }
+  st.SetItemsProcessed(st.iterations());
+  st.SetBytesProcessed(int64_t(st.iterations()) * int64_t(size));
+
+  download_mgr.Fini();
+}
+BENCHMARK_REGISTER_F(BM_Download, FetchLocalMem)->Repetitions(3)->
+  UseRealTime()->Arg(512)->Arg(4096)->Arg(64 * 1024);
+
+
+namespace {
+
+struct PipeEcho {
+  int pipe_jobs[2];
+  int pipe_result[2];
+};
+
+void *MainPipeEcho(void *data) {
+  PipeEcho *echo = reinterpret_cast<PipeEcho *>(data);
+  struct pollfd watch_fd;
+  watch_fd.fd = echo->pipe_jobs[0];
+  watch_fd.events = POLLIN;
+  while (true) {
+    watch_fd.revents = 0;
+    int retval = poll(&watch_fd, 1, -1);
+    if (retval <= 0)
+      continue;
+    int job;
+    ReadPipe(echo->pipe_jobs[0], &job, sizeof(job));
+    if (job < 0)
+      break;
+    WritePipe(echo->pipe_result[1], &job, sizeof(job));
+  }
+  return NULL;
+}
+
+struct EventEcho {
+  int job_event[2];
+  atomic_int32 job;
+  Signal result;
+};
+
+void *MainEventEcho(void *data) {
+  EventEcho *echo = reinterpret_cast<EventEcho *>(data);
+  struct pollfd watch_fd;
+  watch_fd.fd = echo->job_event[0];
+  watch_fd.events = POLLIN;
+  while (true) {
+    watch_fd.revents = 0;
+    int retval = poll(&watch_fd, 1, -1);
+    if (retval <= 0)
+      continue;
+    platform_drain_eventfd(echo->job_event);
+    if (atomic_read32(&echo->job) < 0)
+      break;
+    echo->result.Wakeup();
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+
+/**
+ * Job hand-over and result notification through a pair of pipes, as done by
+ * the download manager with the job pipe and the per-job wait pipe.
+ */
+BENCHMARK_DEFINE_F(BM_Download, HandoffPipe)(benchmark::State &st) {
+  PipeEcho echo;
+  MakePipe(echo.pipe_jobs);
+  MakePipe(echo.pipe_result);
+  pthread_t thread;
+  int retval = pthread_create(&thread, NULL, MainPipeEcho, &echo);
+  assert(retval == 0);
+
+  int job = 0;
+  while (st.KeepRunning()) {
+    WritePipe(echo.pipe_jobs[1], &job, sizeof(job));
+    ReadPipe(echo.pipe_result[0], &job, sizeof(job));
+    Escape(&job);
+  }
+  st.SetItemsProcessed(st.iterations());
+
+  job = -1;
+  WritePipe(echo.pipe_jobs[1], &job, sizeof(job));
+  pthread_join(thread, NULL);
+  ClosePipe(echo.pipe_jobs);
+  ClosePipe(echo.pipe_result);
+}
+BENCHMARK_REGISTER_F(BM_Download, HandoffPipe)->Repetitions(3)->
+  UseRealTime();
+
+
+/**
+ * Job hand-over through an event fd and result notification through a
+ * condition variable, as done by the download manager with the worker's job
+ * stack and the per-job Signal.
+ */
+BENCHMARK_DEFINE_F(BM_Download, HandoffEvent)(benchmark::State &st) {
+  EventEcho echo;
+  atomic_init32(&echo.job);
+  platform_make_eventfd(echo.job_event);
+  pthread_t thread;
+  int retval = pthread_create(&thread, NULL, MainEventEcho, &echo);
+  assert(retval == 0);
+
+  while (st.KeepRunning()) {
+    platform_notify_eventfd(echo.job_event);
+    echo.result.Wait();
+  }
+  st.SetItemsProcessed(st.iterations());
+
+  atomic_write32(&echo.job, -1);
+  platform_notify_eventfd(echo.job_event);
+  pthread_join(thread, NULL);
+  platform_close_eventfd(echo.job_event);
+}
+BENCHMARK_REGISTER_F(BM_Download, HandoffEvent)->Repetitions(3)->
+  UseRealTime();
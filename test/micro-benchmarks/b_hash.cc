@@ -5,6 +5,8 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <string>
+#include <vector>
 
 #include "bm_util.h"
 #include "hash.h"
@@ -63,3 +65,74 @@ BENCHMARK_DEFINE_F(BM_Hash, Sha1)(benchmark::State &st) {
 }
 BENCHMARK_REGISTER_F(BM_Hash, Sha1)->Repetitions(3)->Arg(100)->Arg(4096)->
   Arg(100*1024);
+
+
+/**
+ * Argument: hash algorithm.  Single stream throughput, the label shows if
+ * OpenSSL can use the SHA extensions of the CPU.
+ */
+BENCHMARK_DEFINE_F(BM_Hash, Algorithm)(benchmark::State &st) {
+  const shash::Algorithms algorithm =
+    static_cast<shash::Algorithms>(st.range(0));
+  const unsigned size = 1024 * 1024;
+  std::vector<unsigned char> buffer(size, 42);
+  shash::Any digest(algorithm);
+  while (st.KeepRunning()) {
+    shash::HashMem(&buffer[0], size, &digest);
+    Escape(&digest);
+  }
+  st.SetBytesProcessed(st.iterations() * size);
+  std::string label = (algorithm == shash::kMd5) ? "md5" :
+                      shash::kAlgorithmIds[algorithm];
+  if (algorithm == shash::kSha1)
+    label = shash::HasShaExtensions() ? "sha1 sha-ext" : "sha1";
+  st.SetLabel(label.c_str());
+}
+BENCHMARK_REGISTER_F(BM_Hash, Algorithm)->Repetitions(3)->
+  Arg(shash::kMd5)->Arg(shash::kSha1)->Arg(shash::kRmd160)->
+  Arg(shash::kShake128);
+
+
+/**
+ * Arguments: code path of UpdateMulti(), number of streams.  Every stream is a
+ * block of 16kB, the block size of the ingestion pipeline.  The throughput is
+ * the sum over all streams.
+ */
+BENCHMARK_DEFINE_F(BM_Hash, Sha1Multi)(benchmark::State &st) {
+  const shash::CodePaths code_path = static_cast<shash::CodePaths>(st.range(0));
+  const unsigned num_streams = st.range(1);
+  const unsigned size = 16 * 1024;
+  std::vector<unsigned char> buffer(num_streams * size, 42);
+  std::vector<unsigned char> context_buffers(
+    num_streams * shash::kMaxContextSize);
+  std::vector<shash::ContextPtr> contexts(num_streams);
+  std::vector<const unsigned char *> buffers(num_streams);
+  std::vector<unsigned> buffer_sizes(num_streams, size);
+  for (unsigned i = 0; i < num_streams; ++i) {
+    contexts[i] = shash::ContextPtr(
+      shash::kSha1, &context_buffers[i * shash::kMaxContextSize]);
+    shash::Init(contexts[i]);
+    buffers[i] = &buffer[i * size];
+  }
+  while (st.KeepRunning()) {
+    shash::UpdateMulti(num_streams, &buffers[0], &buffer_sizes[0],
+                       &contexts[0], code_path);
+    ClobberMemory();
+  }
+  st.SetBytesProcessed(st.iterations() * num_streams * size);
+
+  const char *names[] = {"auto", "serial", "lanes"};
+  std::string label = names[code_path];
+  if ((code_path == shash::kCodePathLanes) && !shash::HasSha1Lanes())
+    label += " (unsupported, serial)";
+  if (shash::HasShaExtensions())
+    label += " sha-ext";
+  st.SetLabel(label.c_str());
+}
+BENCHMARK_REGISTER_F(BM_Hash, Sha1Multi)->Repetitions(3)->
+  ArgPair(shash::kCodePathSerial, 8)->
+  ArgPair(shash::kCodePathLanes, 1)->ArgPair(shash::kCodePathLanes, 2)->
+  ArgPair(shash::kCodePathLanes, 4)->ArgPair(shash::kCodePathLanes, 8)->
+  ArgPair(shash::kCodePathLanes, 16)->
+  ArgPair(shash::kCodePathAuto, 2)->ArgPair(shash::kCodePathAuto, 4)->
+  ArgPair(shash::kCodePathAuto, 8);
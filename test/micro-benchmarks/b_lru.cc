@@ -0,0 +1,106 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+
+#include <stdint.h>
+
+#include "bm_util.h"
+#include "lru.h"
+#include "murmur.h"
+#include "prng.h"
+#include "shortstring.h"
+#include "statistics.h"
+
+/**
+ * Lookup-heavy access to a meta-data cache from a varying number of threads,
+ * similar to the path cache during a find-style scan of a repository.  The
+ * working set fits into the cache, one in 16 operations is an insert.
+ */
+class BM_Lru : public benchmark::Fixture {
+ protected:
+  static const unsigned kCacheSize = 64 * 1024;
+  static const unsigned kNumKeys = kCacheSize / 2;
+
+  typedef lru::LruCache<uint64_t, PathString> PlainCache;
+  typedef lru::ShardedLruCache<uint64_t, PathString> ShardedCache;
+
+  virtual void SetUp(const benchmark::State &st) {
+    if (st.thread_index != 0)
+      return;
+    statistics_ = new perf::Statistics();
+    const unsigned num_shards = st.range(0);
+    plain_cache_ = NULL;
+    sharded_cache_ = NULL;
+    if (num_shards == 0) {
+      plain_cache_ = new PlainCache(kCacheSize, 0, hasher_uint64t,
+        perf::StatisticsTemplate("lru", statistics_));
+    } else {
+      sharded_cache_ = new ShardedCache(kCacheSize, 0, hasher_uint64t,
+        perf::StatisticsTemplate("lru", statistics_), num_shards,
+        static_cast<lru::RecencyMode>(st.range(1)));
+    }
+    PathString path("/cvmfs/atlas.cern.ch/repo/sw/software/x86_64");
+    for (unsigned i = 1; i <= kNumKeys; ++i) {
+      if (plain_cache_)
+        plain_cache_->Insert(i, path);
+      else
+        sharded_cache_->Insert(i, path);
+    }
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    if (st.thread_index != 0)
+      return;
+    delete plain_cache_;
+    delete sharded_cache_;
+    delete statistics_;
+  }
+
+  static inline uint32_t hasher_uint64t(const uint64_t &value) {
+    return MurmurHash2(&value, sizeof(value), 0x07387a4f);
+  }
+
+  static perf::Statistics *statistics_;
+  static PlainCache *plain_cache_;
+  static ShardedCache *sharded_cache_;
+};
+
+perf::Statistics *BM_Lru::statistics_ = NULL;
+BM_Lru::PlainCache *BM_Lru::plain_cache_ = NULL;
+BM_Lru::ShardedCache *BM_Lru::sharded_cache_ = NULL;
+
+
+/**
+ * Arguments: number of shards (0 for the plain LruCache), recency mode
+ */
+BENCHMARK_DEFINE_F(BM_Lru, LookupInsert)(benchmark::State &st) {
+  Prng prng;
+  prng.InitSeed(st.thread_index + 1);
+  PathString path("/cvmfs/atlas.cern.ch/repo/sw/software/x86_64");
+  PathString result;
+  // The caches are created by the first thread; they are only safe to use
+  // once all threads passed the start barrier in KeepRunning()
+  while (st.KeepRunning()) {
+    const uint64_t key = prng.Next(kNumKeys) + 1;
+    if ((key % 16) == 0) {
+      if (plain_cache_)
+        plain_cache_->Insert(key, path);
+      else
+        sharded_cache_->Insert(key, path);
+    } else {
+      if (plain_cache_)
+        plain_cache_->Lookup(key, &result);
+      else
+        sharded_cache_->Lookup(key, &result);
+      Escape(&result);
+    }
+  }
+  st.SetItemsProcessed(st.iterations());
+}
+BENCHMARK_REGISTER_F(BM_Lru, LookupInsert)->Repetitions(3)->UseRealTime()->
+  ArgPair(0, lru::kRecencyLru)->
+  ArgPair(1, lru::kRecencyLru)->
+  ArgPair(16, lru::kRecencyLru)->
+  ArgPair(16, lru::kRecencyClock)->
+  ThreadRange(1, 64);
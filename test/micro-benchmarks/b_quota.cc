@@ -0,0 +1,175 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <sqlite3.h>
+
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "prng.h"
+#include "quota_index.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Replays a trace of touch and insert commands against the bookkeeping of the
+ * posix quota manager, in bunches of 32 commands as they come through the
+ * command pipe.  Accesses are skewed towards a small part of the cache
+ * content, one in eight commands is an insert.  The SQlite baseline uses the
+ * same schema and statements as the cache database.
+ */
+class BM_Quota : public benchmark::Fixture {
+ protected:
+  static const unsigned kNumObjects = 100000;
+  static const unsigned kBunchSize = 32;
+
+  enum Backend {
+    kBackendSqlite = 0,
+    kBackendMemory,
+  };
+
+  virtual void SetUp(const benchmark::State &st) {
+    tmp_path_ = CreateTempDir("/tmp/cvmfs_ubench_quota");
+    assert(!tmp_path_.empty());
+    backend_ = static_cast<Backend>(st.range(0));
+    seq_ = 0;
+    hashes_.clear();
+    for (unsigned i = 0; i < kNumObjects; ++i) {
+      shash::Any hash(shash::kSha1);
+      memcpy(hash.digest, &i, sizeof(i));
+      hashes_.push_back(hash);
+    }
+
+    database_ = NULL;
+    index_ = NULL;
+    if (backend_ == kBackendMemory) {
+      index_ = QuotaIndex::Open(tmp_path_ + "/cacheidx");
+      assert(index_ != NULL);
+    } else {
+      OpenDatabase();
+    }
+    for (unsigned i = 0; i < kNumObjects; i += kBunchSize) {
+      Begin();
+      for (unsigned j = i; (j < i + kBunchSize) && (j < kNumObjects); ++j)
+        Insert(j);
+      Commit();
+    }
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    delete index_;
+    if (database_ != NULL) {
+      sqlite3_finalize(stmt_touch_);
+      sqlite3_finalize(stmt_new_);
+      sqlite3_close(database_);
+    }
+    RemoveTree(tmp_path_);
+  }
+
+  void OpenDatabase() {
+    const string db_file = tmp_path_ + "/cachedb";
+    int retval = sqlite3_open(db_file.c_str(), &database_);
+    assert(retval == SQLITE_OK);
+    retval = sqlite3_exec(database_,
+      "PRAGMA synchronous=0; PRAGMA locking_mode=EXCLUSIVE; "
+      "PRAGMA auto_vacuum=1; "
+      "CREATE TABLE cache_catalog (sha1 TEXT, size INTEGER, "
+      "  acseq INTEGER, path TEXT, type INTEGER, pinned INTEGER, "
+      "CONSTRAINT pk_cache_catalog PRIMARY KEY (sha1)); "
+      "CREATE UNIQUE INDEX idx_cache_catalog_acseq "
+      "  ON cache_catalog (acseq);", NULL, NULL, NULL);
+    assert(retval == SQLITE_OK);
+    sqlite3_prepare_v2(database_,
+                       "UPDATE cache_catalog SET acseq=:seq | (acseq&(1<<63)) "
+                       "WHERE sha1=:sha1;", -1, &stmt_touch_, NULL);
+    sqlite3_prepare_v2(database_,
+                       "INSERT OR REPLACE INTO cache_catalog "
+                       "(sha1, size, acseq, path, type, pinned) "
+                       "VALUES (:sha1, :s, :seq, :p, :t, :pin);",
+                       -1, &stmt_new_, NULL);
+  }
+
+  void Begin() {
+    if (database_ != NULL)
+      sqlite3_exec(database_, "BEGIN", NULL, NULL, NULL);
+  }
+
+  void Commit() {
+    if (database_ != NULL)
+      sqlite3_exec(database_, "COMMIT", NULL, NULL, NULL);
+    else
+      index_->Commit();
+  }
+
+  void Touch(const unsigned i) {
+    seq_++;
+    if (index_ != NULL) {
+      index_->Touch(hashes_[i], seq_);
+      return;
+    }
+    const string hash_str = hashes_[i].ToString();
+    sqlite3_bind_int64(stmt_touch_, 1, seq_);
+    sqlite3_bind_text(stmt_touch_, 2, &hash_str[0], hash_str.length(),
+                      SQLITE_STATIC);
+    sqlite3_step(stmt_touch_);
+    sqlite3_reset(stmt_touch_);
+  }
+
+  void Insert(const unsigned i) {
+    seq_++;
+    const string path = "/cvmfs/atlas.cern.ch/repo/sw/software/x86_64/file";
+    if (index_ != NULL) {
+      index_->Insert(hashes_[i], 4096, seq_, path, false, false, false);
+      return;
+    }
+    const string hash_str = hashes_[i].ToString();
+    sqlite3_bind_text(stmt_new_, 1, &hash_str[0], hash_str.length(),
+                      SQLITE_STATIC);
+    sqlite3_bind_int64(stmt_new_, 2, 4096);
+    sqlite3_bind_int64(stmt_new_, 3, seq_);
+    sqlite3_bind_text(stmt_new_, 4, &path[0], path.length(), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt_new_, 5, 0);
+    sqlite3_bind_int64(stmt_new_, 6, 0);
+    sqlite3_step(stmt_new_);
+    sqlite3_reset(stmt_new_);
+  }
+
+  string tmp_path_;
+  Backend backend_;
+  uint64_t seq_;
+  vector<shash::Any> hashes_;
+  QuotaIndex *index_;
+  sqlite3 *database_;
+  sqlite3_stmt *stmt_touch_;
+  sqlite3_stmt *stmt_new_;
+};
+
+
+/**
+ * Argument: 0 for the SQlite cache database, 1 for the in-memory index
+ */
+BENCHMARK_DEFINE_F(BM_Quota, TouchInsert)(benchmark::State &st) {
+  Prng prng;
+  prng.InitSeed(42);
+  while (st.KeepRunning()) {
+    Begin();
+    for (unsigned i = 0; i < kBunchSize; ++i) {
+      // The product of two uniform numbers favors the lower object indexes
+      const unsigned object = static_cast<uint64_t>(prng.Next(kNumObjects)) *
+                              prng.Next(kNumObjects) / kNumObjects;
+      if ((i % 8) == 0)
+        Insert(object);
+      else
+        Touch(object);
+    }
+    Commit();
+  }
+  st.SetItemsProcessed(st.iterations() * kBunchSize);
+}
+BENCHMARK_REGISTER_F(BM_Quota, TouchInsert)->Repetitions(3)->
+  Arg(0)->Arg(1);
@@ -0,0 +1,113 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+
+#include <cassert>
+#include <vector>
+
+#include "ingestion/tube.h"
+
+using namespace std;  // NOLINT
+
+/**
+ * Passes items from a number of producer threads through a single tube to a
+ * number of consumer threads, like the links between the ingestion pipeline
+ * stages.  Every iteration moves kNumItems items plus one quit beacon per
+ * consumer.
+ */
+class BM_Tube : public benchmark::Fixture {
+ protected:
+  static const unsigned kNumItems = 100000;
+  static const unsigned kCapacity = 1024;
+
+  struct Item {
+    Item() : is_quit_beacon(false) { }
+    bool is_quit_beacon;
+  };
+
+  struct Producer {
+    BM_Tube *fixture;
+    unsigned num_items;
+  };
+
+  virtual void SetUp(const benchmark::State &st) {
+    tube_ = NULL;
+    num_producers_ = st.range(0);
+    num_consumers_ = st.range(1);
+    quit_beacon_.is_quit_beacon = true;
+  }
+
+  virtual void TearDown(const benchmark::State &st) {
+    delete tube_;
+  }
+
+  static void *MainProducer(void *data) {
+    Producer *producer = reinterpret_cast<Producer *>(data);
+    Item *item = &producer->fixture->item_;
+    for (unsigned i = 0; i < producer->num_items; ++i)
+      producer->fixture->tube_->EnqueueBack(item);
+    return NULL;
+  }
+
+  static void *MainConsumer(void *data) {
+    BM_Tube *fixture = reinterpret_cast<BM_Tube *>(data);
+    while (!fixture->tube_->PopFront()->is_quit_beacon) { }
+    return NULL;
+  }
+
+  void Run(const TubeStorage storage) {
+    if (tube_ == NULL)
+      tube_ = new Tube<Item>(kCapacity, storage);
+    vector<pthread_t> consumers(num_consumers_);
+    for (unsigned i = 0; i < num_consumers_; ++i) {
+      int retval = pthread_create(&consumers[i], NULL, MainConsumer, this);
+      assert(retval == 0);
+    }
+    vector<Producer> producers(num_producers_);
+    vector<pthread_t> producer_threads(num_producers_);
+    for (unsigned i = 0; i < num_producers_; ++i) {
+      producers[i].fixture = this;
+      producers[i].num_items = kNumItems / num_producers_;
+      int retval = pthread_create(&producer_threads[i], NULL, MainProducer,
+                                  &producers[i]);
+      assert(retval == 0);
+    }
+    for (unsigned i = 0; i < num_producers_; ++i)
+      pthread_join(producer_threads[i], NULL);
+    for (unsigned i = 0; i < num_consumers_; ++i)
+      tube_->EnqueueBack(&quit_beacon_);
+    for (unsigned i = 0; i < num_consumers_; ++i)
+      pthread_join(consumers[i], NULL);
+  }
+
+  Tube<Item> *tube_;
+  unsigned num_producers_;
+  unsigned num_consumers_;
+  Item item_;
+  Item quit_beacon_;
+};
+
+
+/**
+ * Arguments: number of producers, number of consumers
+ */
+BENCHMARK_DEFINE_F(BM_Tube, TransferList)(benchmark::State &st) {
+  while (st.KeepRunning()) {
+    Run(kTubeList);
+  }
+  st.SetItemsProcessed(st.iterations() * kNumItems);
+}
+BENCHMARK_REGISTER_F(BM_Tube, TransferList)->Repetitions(3)->UseRealTime()->
+  ArgPair(1, 1)->ArgPair(1, 4)->ArgPair(4, 1)->ArgPair(4, 4);
+
+
+BENCHMARK_DEFINE_F(BM_Tube, TransferRing)(benchmark::State &st) {
+  while (st.KeepRunning()) {
+    Run(kTubeRing);
+  }
+  st.SetItemsProcessed(st.iterations() * kNumItems);
+}
+BENCHMARK_REGISTER_F(BM_Tube, TransferRing)->Repetitions(3)->UseRealTime()->
+  ArgPair(1, 1)->ArgPair(1, 4)->ArgPair(4, 1)->ArgPair(4, 4);
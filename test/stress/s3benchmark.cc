@@ -93,6 +93,11 @@ int S3TestScenario::Run()
   start = platform_monotonic_time_ns();
   GeneratePayload();
   payload_generated = platform_monotonic_time_ns();
+  uint64_t payload_bytes = 0;
+  for (vector<TestDataChunk>::const_iterator chunk = data_chunks_.begin();
+       chunk != data_chunks_.end(); ++chunk) {
+    payload_bytes += chunk->size;
+  }
   for (vector<TestDataChunk>::iterator chunk = data_chunks_.begin();
        chunk != data_chunks_.end(); ++chunk) {
     UploadFile(*chunk);
@@ -136,6 +141,10 @@ int S3TestScenario::Run()
            "HEAD(Found): %f\n"
            "DELETE: %f", num_uploads_/duration_upload,
            num_uploads_/duration_reupload, num_uploads_/duration_delete);
+  LogCvmfs(kLogCvmfs, kLogStdout, "Upload throughput: %f MB/s\n"
+           "Transfer statistics:\n%s",
+           payload_bytes / duration_upload / (1024.0 * 1024.0),
+           uploader_->GetS3FanoutManager()->GetStatistics().Print().c_str());
   return 0;
 }
 
@@ -205,7 +214,11 @@ void Usage() {
            "CVMFS S3Uploader benchmark.\n"
            "Generates random files, uploads them to specified S3 storage,\n"
            "reuploads the same files and finally deletes them.\n"
-           "Outputs the time duration of each step.\n\n"
+           "Outputs the time duration of each step and the upload throughput.\n"
+           "The number of I/O threads and the multipart upload of large files\n"
+           "are set in the S3 config file (CVMFS_S3_NUM_IO_THREADS,\n"
+           "CVMFS_S3_MULTIPART_THRESHOLD, CVMFS_S3_MULTIPART_PART_SIZE,\n"
+           "CVMFS_S3_MULTIPART_PARALLEL_PARTS).\n\n"
            "Usage: s3benchmark [-n num-files] [-s average-file-size] "
            "[-t tmp-path] [-d duplicate-ratio] [-h] -c path/to/s3.cfg\n"
            "Options:\n"
@@ -64,6 +64,7 @@ int GetValue(std::string body, std::string param,
 
 int main() {
   set<string> existing_files;
+  unsigned num_multipart_uploads = 0;
 
   int listen_sockfd, accept_sockfd;
   socklen_t clilen;
@@ -95,27 +96,59 @@ int main() {
     std::string req_header = "";
     char buf[10001];
     int nread = read(accept_sockfd, buf, 10000);
+    assert(nread > 0);
     buf[nread] = 0;
     char *occ = strstr(buf, "\r\n\r\n");
-    if (!occ) occ = strstr(buf, "\n\n");
+    unsigned header_end = 4;
+    if (!occ) {
+      occ = strstr(buf, "\n\n");
+      header_end = 2;
+    }
     assert(occ);
     req_header += std::string(buf, occ-buf);
 
     // Parse header
     std::string req_type = "";
     std::string req_file = "";  // target name without bucket prefix
+    std::string req_query = "";
     int content_length = 0;
     req_type = GetField(req_header, ' ', 0);
     req_file = GetField(req_header, ' ', 1);
     req_file = req_file.substr(req_file.find("/", 1) + 1);  // no bucket
-    if (req_type == "PUT") {
+    if (req_file.find('?') != std::string::npos) {
+      req_query = req_file.substr(req_file.find('?') + 1);
+      req_file = req_file.substr(0, req_file.find('?'));
+    }
+    if ((req_type == "PUT") || (req_type == "POST")) {
       content_length = GetValue(req_header, "Content-Length");
       assert(content_length >= 0);
     }
 
-    string reply = "HTTP/1.1 200 OK\r\n";
+    // Drain the body, large uploads would otherwise be reset by close()
+    std::string req_body(occ + header_end, buf + nread);
+    while (req_body.length() < static_cast<unsigned>(content_length)) {
+      nread = read(accept_sockfd, buf, 10000);
+      assert(nread > 0);
+      req_body.append(buf, nread);
+    }
 
-    if (req_type == "PUT") {
+    string reply = "HTTP/1.1 200 OK\r\n";
+    string reply_body;
+
+    if ((req_type == "POST") && (req_query == "uploads")) {
+      // Initiate multipart upload
+      reply_body = "<InitiateMultipartUploadResult><UploadId>" +
+                   StringifyInt(++num_multipart_uploads) +
+                   "</UploadId></InitiateMultipartUploadResult>";
+    } else if ((req_type == "PUT") && HasPrefix(req_query, "partNumber=",
+                                                false /* ignore_case */)) {
+      reply += "ETag: \"" + StringifyInt(content_length) + "\"\r\n";
+    } else if (req_type == "POST") {
+      // Complete multipart upload
+      existing_files.insert(req_file);
+      reply_body = "<CompleteMultipartUploadResult>"
+                   "</CompleteMultipartUploadResult>";
+    } else if (req_type == "PUT") {
       existing_files.insert(req_file);
     } else if (req_type == "HEAD") {
       if (existing_files.find(req_file) == existing_files.end()) {
@@ -124,12 +157,14 @@ int main() {
         reply = "HTTP/1.1 200 OK\r\n";
       }
     } else if (req_type == "DELETE") {
-      existing_files.erase(req_file);
+      if (req_query.empty())
+        existing_files.erase(req_file);
       // "No Content"-reply even if file did not exist
       reply = "HTTP/1.1 204 No Content\r\n";
     }
-    reply += "Content-Length: 0\r\n";
+    reply += "Content-Length: " + StringifyInt(reply_body.length()) + "\r\n";
     reply += "Connection: close\r\n\r\n";
+    reply += reply_body;
 
     int n = write(accept_sockfd, reply.c_str(), reply.length());
     assert(n >= 0);
@@ -82,6 +82,7 @@ class IngestionMockUploader
     const upload::SpoolerDefinition &spooler_definition)
     : AbstractMockUploader<IngestionMockUploader>(spooler_definition)
     , keep_results(true)
+    , peek_result(true)
   { }
 
   virtual std::string name() const { return "IngestionMockUploader"; }
@@ -123,8 +124,14 @@ class IngestionMockUploader
 
   virtual int64_t DoGetObjectSize(const std::string &file_name) { return 0;}
 
+  virtual bool Peek(const std::string &path) { return peek_result; }
+
   Results results;
   bool keep_results;
+  /**
+   * Pretends that all objects exist (or none)
+   */
+  bool peek_result;
 };
 
 #endif  // TEST_UNITTESTS_C_MOCK_UPLOADER_H_
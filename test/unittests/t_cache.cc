@@ -597,6 +597,17 @@ TEST_F(T_CacheManager, Create) {
 }
 
 
+TEST_F(T_CacheManager, HasCapability) {
+  EXPECT_TRUE(cache_mgr_->HasCapability(CacheManager::kCapFileDescriptor));
+  int fd = cache_mgr_->Open(CacheManager::Bless(hash_null_));
+  EXPECT_GE(fd, 0);
+  platform_stat64 info;
+  EXPECT_EQ(0, platform_fstat(fd, &info));
+  EXPECT_TRUE(S_ISREG(info.st_mode));
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+}
+
+
 TEST_F(T_CacheManager, Dup) {
   EXPECT_EQ(-EBADF, cache_mgr_->Dup(-1));
   int fd = cache_mgr_->Open(CacheManager::Bless(hash_null_));
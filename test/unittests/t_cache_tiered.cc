@@ -107,3 +107,10 @@ TEST_F(T_TieredCacheManager, ReadOnly) {
   EXPECT_EQ(0, tiered_cache_->Reset(txn));
   EXPECT_EQ(0, tiered_cache_->AbortTxn(txn));
 }
+
+
+TEST_F(T_TieredCacheManager, HasCapability) {
+  // The RAM cache manager does not provide real file descriptors
+  EXPECT_FALSE(upper_cache_->HasCapability(CacheManager::kCapFileDescriptor));
+  EXPECT_FALSE(tiered_cache_->HasCapability(CacheManager::kCapFileDescriptor));
+}
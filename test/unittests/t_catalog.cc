@@ -4,6 +4,7 @@
 
 #include <gtest/gtest.h>
 
+#include <pthread.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -12,6 +13,7 @@
 #include "compression.h"
 #include "hash.h"
 #include "shortstring.h"
+#include "statistics.h"
 #include "testutil.h"
 #include "util/posix.h"
 
@@ -367,6 +369,123 @@ TEST_F(T_Catalog, Listing) {
     EXPECT_NE(NameString("hidden"), root_stat_entry_list.At(i).name);
 }
 
+TEST_F(T_Catalog, IndexedLookup) {
+  Catalog *sql_catalog = catalog::Catalog::AttachFreely("",
+                                                        catalog_db_root,
+                                                        shash::Any(),
+                                                        NULL,
+                                                        false);
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  perf::Counter sz_index;
+  catalog->EnableIndex(1000, &sz_index);
+
+  const char *paths[] = {"", "/dir", "/dir/dir", "/dir/dir/bar",
+                         "/dir/dir/link", "/hidden", "/foo",
+                         "/fakepath/fakefile"};
+  for (unsigned i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+    DirectoryEntry sql_dirent;
+    DirectoryEntry indexed_dirent;
+    const PathString path(paths[i]);
+    EXPECT_EQ(sql_catalog->LookupPath(path, &sql_dirent),
+              catalog->LookupPath(path, &indexed_dirent)) << paths[i];
+    EXPECT_TRUE(sql_dirent == indexed_dirent) << paths[i];
+  }
+  LinkString symlink;
+  EXPECT_TRUE(catalog->LookupRawSymlink(PathString("/dir/dir/link"),
+                                        &symlink));
+  EXPECT_EQ("/foo", symlink.ToString());
+
+  const char *directories[] = {"", "/dir/dir", "/fakepath"};
+  for (unsigned i = 0; i < sizeof(directories) / sizeof(directories[0]); ++i)
+  {
+    StatEntryList sql_listing;
+    StatEntryList indexed_listing;
+    const PathString path(directories[i]);
+    EXPECT_TRUE(sql_catalog->ListingPathStat(path, &sql_listing));
+    EXPECT_TRUE(catalog->ListingPathStat(path, &indexed_listing));
+    ASSERT_EQ(sql_listing.size(), indexed_listing.size());
+    for (unsigned j = 0; j < sql_listing.size(); ++j) {
+      EXPECT_EQ(sql_listing.At(j).name, indexed_listing.At(j).name);
+      EXPECT_EQ(sql_listing.At(j).info.st_mode,
+                indexed_listing.At(j).info.st_mode);
+      EXPECT_EQ(sql_listing.At(j).info.st_size,
+                indexed_listing.At(j).info.st_size);
+    }
+  }
+  EXPECT_GT(sz_index.Get(), 0);
+  delete catalog;
+  catalog = NULL;
+  EXPECT_EQ(0, sz_index.Get());
+  delete sql_catalog;
+}
+
+TEST_F(T_Catalog, IndexTooLarge) {
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  perf::Counter sz_index;
+  catalog->EnableIndex(2, &sz_index);
+
+  DirectoryEntry dirent;
+  EXPECT_TRUE(catalog->LookupPath(PathString("/dir/dir/bar"), &dirent));
+  EXPECT_EQ("bar", dirent.name().ToString());
+  EXPECT_FALSE(catalog->LookupPath(PathString("/fakepath/fakefile"), &dirent));
+  EXPECT_EQ(0, sz_index.Get());
+}
+
+namespace {
+
+void *MainReadConnectionLookups(void *data) {
+  Catalog *catalog = reinterpret_cast<Catalog *>(data);
+  for (unsigned i = 0; i < 200; ++i) {
+    DirectoryEntry dirent;
+    if (!catalog->LookupPath(PathString("/dir/dir/bar"), &dirent) ||
+        (dirent.name().ToString() != "bar"))
+    {
+      return data;
+    }
+    StatEntryList listing;
+    if (!catalog->ListingPathStat(PathString("/dir/dir"), &listing) ||
+        (listing.size() != 3))
+    {
+      return data;
+    }
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+TEST_F(T_Catalog, ReadConnections) {
+  catalog = catalog::Catalog::AttachFreely("",
+                                           catalog_db_root,
+                                           shash::Any(),
+                                           NULL,
+                                           false);
+  ASSERT_TRUE(catalog != NULL);
+  EXPECT_FALSE(catalog->AddReadConnection(sandbox + "/no_such_catalog"));
+  EXPECT_TRUE(catalog->AddReadConnection(catalog_db_root));
+  EXPECT_TRUE(catalog->AddReadConnection(catalog_db_root));
+
+  const unsigned kNumThreads = 4;
+  pthread_t threads[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL,
+                                MainReadConnectionLookups, catalog));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    void *result;
+    ASSERT_EQ(0, pthread_join(threads[i], &result));
+    EXPECT_EQ(NULL, result);
+  }
+}
+
 TEST_F(T_Catalog, Chunks) {
   catalog = catalog::Catalog::AttachFreely("",
                                            catalog_db_root,
@@ -227,6 +227,8 @@ TEST_F(T_CatalogManager, LongLookup) {
   EXPECT_TRUE(dirent.IsRegular());
   // we should have mounted two catalogs
   EXPECT_EQ(3, catalog_mgr_.GetNumCatalogs());
+  // the catalog with a known hash was staged outside the lock
+  EXPECT_EQ(1u, catalog_mgr_.GetNumStagedCatalogs());
 }
 
 TEST_F(T_CatalogManager, Listing) {
@@ -4,11 +4,17 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <vector>
+
+#include "catalog_mgr_ro.h"
 #include "catalog_mgr_rw.h"
 #include "catalog_test_tools.h"
 #include "download.h"
 #include "statistics.h"
 #include "upload.h"
+#include "util/posix.h"
+#include "util/string.h"
 
 using namespace std;  // NOLINT
 
@@ -61,11 +67,100 @@ DirSpec MakeBaseSpec() {
   return spec;
 }
 
+/**
+ * Creates two revisions with the nested catalogs /a, /a/sub, and /b.  Only /b
+ * changes in the second revision.
+ */
+void MakeRevisions(CatalogTestTool *tester,
+                   shash::Any *first_revision,
+                   shash::Any *second_revision)
+{
+  DirSpec spec;
+  EXPECT_TRUE(spec.AddDirectory("a", "", g_file_size));
+  EXPECT_TRUE(spec.AddFile("file", "a", g_hashes[0], g_file_size));
+  EXPECT_TRUE(spec.AddDirectory("sub", "a", g_file_size));
+  EXPECT_TRUE(spec.AddFile("file", "a/sub", g_hashes[1], g_file_size));
+  EXPECT_TRUE(spec.AddDirectory("b", "", g_file_size));
+  EXPECT_TRUE(spec.AddFile("file", "b", g_hashes[2], g_file_size));
+  EXPECT_TRUE(spec.AddNestedCatalog("a"));
+  EXPECT_TRUE(spec.AddNestedCatalog("a/sub"));
+  EXPECT_TRUE(spec.AddNestedCatalog("b"));
+  EXPECT_TRUE(
+    tester->ApplyAtRootHash(tester->manifest()->catalog_hash(), spec));
+  *first_revision = tester->manifest()->catalog_hash();
+
+  DirSpec change;
+  EXPECT_TRUE(change.AddDirectory("b", "", g_file_size));
+  EXPECT_TRUE(change.AddFile("new_file", "b", g_hashes[3], g_file_size));
+  const DirSpecItem *new_file = change.Item("b/new_file");
+  ASSERT_TRUE(new_file != NULL);
+  tester->catalog_mgr()->AddFile(new_file->entry_base(), new_file->xattrs(),
+                                 new_file->parent());
+  EXPECT_TRUE(tester->catalog_mgr()->Commit(false, 0, tester->manifest()));
+  *second_revision = tester->manifest()->catalog_hash();
+}
+
 }  // anonymous namespace
 
 
 namespace catalog {
 
+/**
+ * Read-only catalog manager that can be switched to another root catalog
+ */
+class RemountableCatalogManager : public SimpleCatalogManager {
+ public:
+  RemountableCatalogManager(const shash::Any &base_hash,
+                            const string &stratum0,
+                            const string &dir_temp,
+                            download::DownloadManager *download_manager,
+                            perf::Statistics *statistics)
+    : SimpleCatalogManager(base_hash, stratum0, dir_temp, download_manager,
+                           statistics, true /* manage_catalog_files */)
+  { }
+  using SimpleCatalogManager::set_base_hash;
+  using SimpleCatalogManager::FindCatalog;
+
+  /**
+   * Remounts to the given revision while the next nested catalog is staged,
+   * i.e. without the catalog manager lock
+   */
+  void RemountOnStage(const shash::Any &hash) { remount_hash_ = hash; }
+  const vector<string> &reused_catalogs() const { return reused_catalogs_; }
+  const vector<shash::Any> &staged() const { return staged_; }
+  const vector<shash::Any> &unstaged() const { return unstaged_; }
+
+ protected:
+  virtual bool StageCatalog(const PathString &mountpoint,
+                            const shash::Any &hash)
+  {
+    staged_.push_back(hash);
+    if (!remount_hash_.IsNull()) {
+      set_base_hash(remount_hash_);
+      remount_hash_ = shash::Any();
+      EXPECT_EQ(kLoadNew, Remount(false));
+    }
+    return true;
+  }
+
+  virtual void UnstageCatalog(const PathString &mountpoint,
+                              const shash::Any &hash)
+  {
+    unstaged_.push_back(hash);
+  }
+
+  virtual void ReuseCatalog(Catalog *catalog) {
+    reused_catalogs_.push_back(catalog->mountpoint().ToString());
+  }
+
+ private:
+  shash::Any remount_hash_;
+  vector<string> reused_catalogs_;
+  vector<shash::Any> staged_;
+  vector<shash::Any> unstaged_;
+};
+
+
 class T_CatalogMgrRw : public ::testing::Test {
  protected:
   virtual void SetUp() {
@@ -118,4 +213,120 @@ TEST_F(T_CatalogMgrRw, CloneTree) {
   EXPECT_TRUE(dirent.IsNestedCatalogRoot());
 }
 
+
+
+TEST_F(T_CatalogMgrRw, CommitNestedTree) {
+  CatalogTestTool tester("commit_nested_tree");
+  EXPECT_TRUE(tester.Init());
+
+  // Independent subtrees of nested catalogs are finalized concurrently
+  DirSpec spec;
+  for (unsigned i = 0; i < 8; ++i) {
+    const string dir = "dir" + StringifyInt(i);
+    EXPECT_TRUE(spec.AddDirectory(dir, "", g_file_size));
+    EXPECT_TRUE(spec.AddFile("file", dir, g_hashes[i % 5], g_file_size));
+    EXPECT_TRUE(spec.AddNestedCatalog(dir));
+    for (unsigned j = 0; j < 4; ++j) {
+      const string subdir = "sub" + StringifyInt(j);
+      EXPECT_TRUE(spec.AddDirectory(subdir, dir, g_file_size));
+      EXPECT_TRUE(spec.AddFile("file", dir + "/" + subdir, g_hashes[j],
+                               g_file_size));
+      EXPECT_TRUE(spec.AddNestedCatalog(dir + "/" + subdir));
+    }
+  }
+  EXPECT_TRUE(tester.ApplyAtRootHash(tester.manifest()->catalog_hash(), spec));
+
+  // Every catalog is reachable through the links in its parent
+  DirSpec committed_spec;
+  EXPECT_TRUE(tester.DirSpecAtRootHash(tester.manifest()->catalog_hash(),
+                                       &committed_spec));
+  string spec_str;
+  spec.ToString(&spec_str);
+  string committed_spec_str;
+  committed_spec.ToString(&committed_spec_str);
+  EXPECT_EQ(spec_str, committed_spec_str);
+
+  char *nc_hash = NULL;
+  EXPECT_TRUE(tester.LookupNestedCatalogHash(tester.manifest()->catalog_hash(),
+                                             "/dir7/sub3", &nc_hash));
+  free(nc_hash);
+}
+
+
+
+TEST_F(T_CatalogMgrRw, RemountReusesNested) {
+  CatalogTestTool tester("remount_reuses_nested");
+  EXPECT_TRUE(tester.Init());
+
+  shash::Any first_revision;
+  shash::Any second_revision;
+  MakeRevisions(&tester, &first_revision, &second_revision);
+
+  const string sandbox = CreateTempDir("./cvmfs_ut_catalog_mgr_rw");
+  ASSERT_FALSE(sandbox.empty());
+  perf::Statistics statistics;
+  RemountableCatalogManager catalog_mgr(first_revision,
+    "file://" + tester.repo_name(), sandbox, tester.download_manager(),
+    &statistics);
+  ASSERT_TRUE(catalog_mgr.Init());
+
+  DirectoryEntry dirent;
+  EXPECT_TRUE(catalog_mgr.LookupPath("/a/sub/file", kLookupSole, &dirent));
+  EXPECT_TRUE(catalog_mgr.LookupPath("/b/file", kLookupSole, &dirent));
+  EXPECT_FALSE(catalog_mgr.LookupPath("/b/new_file", kLookupSole, &dirent));
+  EXPECT_EQ(4, catalog_mgr.GetNumCatalogs());
+  const Catalog *catalog_a = catalog_mgr.FindCatalog(PathString("/a"));
+  const Catalog *catalog_sub = catalog_mgr.FindCatalog(PathString("/a/sub"));
+
+  catalog_mgr.set_base_hash(second_revision);
+  EXPECT_EQ(kLoadNew, catalog_mgr.Remount(false));
+  EXPECT_EQ(3, catalog_mgr.GetNumCatalogs());
+  EXPECT_EQ(2, catalog_mgr.statistics().n_reused_catalogs->Get());
+  ASSERT_EQ(2U, catalog_mgr.reused_catalogs().size());
+  EXPECT_EQ("/a", catalog_mgr.reused_catalogs()[0]);
+  EXPECT_EQ("/a/sub", catalog_mgr.reused_catalogs()[1]);
+  EXPECT_EQ(catalog_a, catalog_mgr.FindCatalog(PathString("/a")));
+  EXPECT_EQ(catalog_sub, catalog_mgr.FindCatalog(PathString("/a/sub")));
+
+  // Reused catalogs hand out inodes from their new inode range
+  EXPECT_TRUE(catalog_mgr.LookupPath("/a/sub/file", kLookupSole, &dirent));
+  EXPECT_TRUE(catalog_sub->inode_range().ContainsInode(dirent.inode()));
+  EXPECT_TRUE(catalog_mgr.LookupPath("/b/new_file", kLookupSole, &dirent));
+  EXPECT_EQ(4, catalog_mgr.GetNumCatalogs());
+
+  RemoveTree(sandbox);
+}
+
+
+
+TEST_F(T_CatalogMgrRw, RemountWhileStaging) {
+  CatalogTestTool tester("remount_while_staging");
+  EXPECT_TRUE(tester.Init());
+  shash::Any first_revision;
+  shash::Any second_revision;
+  MakeRevisions(&tester, &first_revision, &second_revision);
+
+  const string sandbox = CreateTempDir("./cvmfs_ut_catalog_mgr_rw");
+  ASSERT_FALSE(sandbox.empty());
+  perf::Statistics statistics;
+  RemountableCatalogManager catalog_mgr(first_revision,
+    "file://" + tester.repo_name(), sandbox, tester.download_manager(),
+    &statistics);
+  ASSERT_TRUE(catalog_mgr.Init());
+
+  // The hash of /b staged from the first revision must not be mounted into
+  // the tree of the second revision
+  catalog_mgr.RemountOnStage(second_revision);
+  DirectoryEntry dirent;
+  EXPECT_TRUE(catalog_mgr.LookupPath("/b/new_file", kLookupSole, &dirent));
+  EXPECT_EQ(2, catalog_mgr.GetNumCatalogs());
+  // The outdated catalog is released, the one staged again is mounted
+  ASSERT_EQ(2U, catalog_mgr.staged().size());
+  ASSERT_EQ(1U, catalog_mgr.unstaged().size());
+  EXPECT_EQ(catalog_mgr.staged()[0], catalog_mgr.unstaged()[0]);
+  EXPECT_NE(catalog_mgr.staged()[1], catalog_mgr.unstaged()[0]);
+
+  RemoveTree(sandbox);
+}
+
 }  // namespace catalog
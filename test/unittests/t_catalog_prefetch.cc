@@ -0,0 +1,166 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catalog.h"
+#include "catalog_prefetch.h"
+#include "catalog_rw.h"
+#include "catalog_sql.h"
+#include "hash.h"
+#include "shortstring.h"
+#include "statistics.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+namespace catalog {
+
+class T_CatalogPrefetcher : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    sandbox_ = CreateTempDir("./cvmfs_ut_catalog_prefetch");
+    ASSERT_FALSE(sandbox_.empty());
+    history_path_ = sandbox_ + "/catalog_history";
+    // Not spawned, only the history is used
+    prefetcher_ = new CatalogPrefetcher(history_path_, NULL, 1,
+      perf::StatisticsTemplate("catalog_prefetch", &statistics_));
+  }
+
+  virtual void TearDown() {
+    delete prefetcher_;
+    RemoveTree(sandbox_);
+  }
+
+  void Round(const char **catalogs, unsigned num_catalogs) {
+    prefetcher_->OnRootCatalog(shash::Any(shash::kSha1));
+    for (unsigned i = 0; i < num_catalogs; ++i)
+      prefetcher_->OnNestedCatalog(PathString(catalogs[i]));
+  }
+
+  perf::Statistics statistics_;
+  string sandbox_;
+  string history_path_;
+  CatalogPrefetcher *prefetcher_;
+};
+
+
+TEST_F(T_CatalogPrefetcher, Rounds) {
+  const char *first[] = {"/sw/x86_64/gcc", "/sw", "/data"};
+  const char *second[] = {"/conditions"};
+
+  Round(first, 3);
+  // The round is not closed yet
+  EXPECT_TRUE(prefetcher_->GetLikelyCatalogs().empty());
+
+  Round(second, 1);
+  vector<string> likely = prefetcher_->GetLikelyCatalogs();
+  ASSERT_EQ(3U, likely.size());
+  EXPECT_EQ("/data", likely[0]);
+  EXPECT_EQ("/sw", likely[1]);
+  EXPECT_EQ("/sw/x86_64/gcc", likely[2]);
+
+  Round(NULL, 0);
+  likely = prefetcher_->GetLikelyCatalogs();
+  ASSERT_EQ(4U, likely.size());
+  EXPECT_EQ("/conditions", likely[0]);
+
+  Round(NULL, 0);
+  likely = prefetcher_->GetLikelyCatalogs();
+  ASSERT_EQ(1U, likely.size());
+  EXPECT_EQ("/conditions", likely[0]);
+}
+
+
+TEST_F(T_CatalogPrefetcher, Persistence) {
+  EXPECT_TRUE(prefetcher_->Load());
+  const char *catalogs[] = {"/sw", "/sw/with space"};
+  Round(catalogs, 2);
+  Round(NULL, 0);
+  EXPECT_TRUE(prefetcher_->Save());
+
+  CatalogPrefetcher reloaded(history_path_, NULL, 1,
+    perf::StatisticsTemplate("reloaded", &statistics_));
+  EXPECT_TRUE(reloaded.Load());
+  vector<string> likely = reloaded.GetLikelyCatalogs();
+  ASSERT_EQ(2U, likely.size());
+  EXPECT_EQ("/sw", likely[0]);
+  EXPECT_EQ("/sw/with space", likely[1]);
+
+  EXPECT_TRUE(SafeWriteToFile("garbage\n", history_path_, 0644));
+  CatalogPrefetcher garbage(history_path_, NULL, 1,
+    perf::StatisticsTemplate("garbage", &statistics_));
+  EXPECT_FALSE(garbage.Load());
+  EXPECT_TRUE(garbage.GetLikelyCatalogs().empty());
+}
+
+
+
+TEST_F(T_CatalogPrefetcher, GroupByParent) {
+  // Parents first, as returned by GetLikelyCatalogs()
+  const char *catalogs[] =
+    {"/a", "/ab", "/a/b", "/x/y", "/a/b/c", "/a/d/e"};
+  map<string, vector<string> > children = CatalogPrefetcher::GroupByParent(
+    vector<string>(catalogs, catalogs + 6));
+  EXPECT_EQ(3U, children.size());
+  ASSERT_EQ(3U, children[""].size());
+  EXPECT_EQ("/a", children[""][0]);
+  EXPECT_EQ("/ab", children[""][1]);
+  EXPECT_EQ("/x/y", children[""][2]);
+  ASSERT_EQ(2U, children["/a"].size());
+  EXPECT_EQ("/a/b", children["/a"][0]);
+  EXPECT_EQ("/a/d/e", children["/a"][1]);
+  ASSERT_EQ(1U, children["/a/b"].size());
+  EXPECT_EQ("/a/b/c", children["/a/b"][0]);
+
+  EXPECT_TRUE(CatalogPrefetcher::GroupByParent(vector<string>()).empty());
+}
+
+
+TEST_F(T_CatalogPrefetcher, ResolveNested) {
+  const string db_path = sandbox_ + "/catalog.db";
+  {
+    UniquePtr<CatalogDatabase> db(CatalogDatabase::Create(db_path));
+    ASSERT_TRUE(db.IsValid());
+    ASSERT_TRUE(db->InsertInitialValues("", false, ""));
+  }
+  shash::Any hash_a(shash::kSha1);
+  shash::Any hash_b(shash::kSha1);
+  hash_a.Randomize();
+  hash_b.Randomize();
+  WritableCatalog *writable =
+    WritableCatalog::AttachFreely("", db_path, shash::Any(shash::kSha1));
+  ASSERT_TRUE(writable != NULL);
+  writable->Transaction();
+  writable->InsertNestedCatalog("/a", NULL, hash_a, 100);
+  writable->InsertNestedCatalog("/b", NULL, hash_b, 200);
+  writable->Commit();
+  delete writable;
+
+  Catalog *parent = Catalog::AttachFreely("", db_path, shash::Any());
+  ASSERT_TRUE(parent != NULL);
+  CatalogPrefetcher::Job job;
+  job.children.push_back("/a");
+  job.children.push_back("/stale");
+  job.children.push_back("/b");
+  prefetcher_->ResolveNested(*parent, &job);
+  delete parent;
+
+  ASSERT_EQ(3U, job.child_hashes.size());
+  ASSERT_EQ(3U, job.child_sizes.size());
+  EXPECT_EQ(hash_a, job.child_hashes[0]);
+  EXPECT_EQ(100U, job.child_sizes[0]);
+  EXPECT_TRUE(job.child_hashes[1].IsNull());
+  EXPECT_EQ(hash_b, job.child_hashes[2]);
+  EXPECT_EQ(200U, job.child_sizes[2]);
+  EXPECT_EQ(3, statistics_.Lookup("catalog_prefetch.n_scheduled")->Get());
+  EXPECT_EQ(1, statistics_.Lookup("catalog_prefetch.n_stale")->Get());
+}
+
+}  // namespace catalog
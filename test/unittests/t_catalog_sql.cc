@@ -220,3 +220,31 @@ TEST_F(T_CatalogSql, SchemaMigration) {
     EXPECT_EQ(0, sql11.RetrieveInt(0));
   }
 }
+
+
+TEST_F(T_CatalogSql, ExtendedCompression) {
+  string path;
+  FILE *ftmp = CreateTempFile("./cvmfs_ut_catalog_sql", 0600, "w+", &path);
+  ASSERT_TRUE(ftmp != NULL);
+  fclose(ftmp);
+  UnlinkGuard unlink_guard(path);
+
+  {
+    UniquePtr<catalog::CatalogDatabase>
+      db(catalog::CatalogDatabase::Create(path));
+    ASSERT_TRUE(db.IsValid());
+    EXPECT_FALSE(db->HasExtendedCompression());
+    EXPECT_TRUE(db->SetExtendedCompression());
+    EXPECT_TRUE(db->SetExtendedCompression());
+  }
+  {
+    UniquePtr<catalog::CatalogDatabase> db(catalog::CatalogDatabase::Open(
+      path, catalog::CatalogDatabase::kOpenReadOnly));
+    ASSERT_TRUE(db.IsValid());
+    EXPECT_TRUE(db->HasExtendedCompression());
+    // Older clients keep loading the catalog
+    EXPECT_TRUE(db->IsEqualSchema(db->schema_version(), 2.5));
+    EXPECT_EQ(catalog::CatalogDatabase::kLatestSchemaRevision,
+              db->schema_revision());
+  }
+}
@@ -309,3 +309,144 @@ TEST_F(T_ChunkDetectors, Xor32ChunkDetectorZerosBufferPowerOfTwo) {
     }
   }
 }
+
+
+TEST_F(T_ChunkDetectors, FastCdcMasks) {
+  FastCdcDetector detector(512000, 1024000, 2048000);
+  // 2^18 <= 1024000 - 512000 < 2^19
+  EXPECT_EQ(0xfffff00000000000ull, detector.mask_small_);
+  EXPECT_EQ(0xffff000000000000ull, detector.mask_large_);
+
+  FastCdcDetector detector_default(4 * 1024 * 1024, 8 * 1024 * 1024,
+                                   16 * 1024 * 1024);
+  EXPECT_EQ(0xffffff0000000000ull, detector_default.mask_small_);
+  EXPECT_EQ(0xfffff00000000000ull, detector_default.mask_large_);
+}
+
+
+TEST_F(T_ChunkDetectors, FastCdcChunkDetectorSlow) {
+  const size_t base = 512000;
+  const size_t min_chk_size = base;
+  const size_t avg_chk_size = base * 2;
+  const size_t max_chk_size = base * 4;
+
+  FastCdcDetector fastcdc_detector(min_chk_size, avg_chk_size, max_chk_size);
+  EXPECT_FALSE(fastcdc_detector.MightFindChunks(0));
+  EXPECT_FALSE(fastcdc_detector.MightFindChunks(base));
+  EXPECT_TRUE(fastcdc_detector.MightFindChunks(base + 1));
+
+  std::vector<size_t> buffer_sizes;
+  buffer_sizes.push_back(102400);    // 100kB
+  buffer_sizes.push_back(base);      // same as minimal chunk size
+  buffer_sizes.push_back(base * 2);  // same as average chunk size
+  buffer_sizes.push_back(10485760);  // 10MB
+
+  // The cut marks must not depend on the buffer sizes
+  std::vector<uint64_t> reference;
+  for (unsigned i = 0; i < buffer_sizes.size(); ++i) {
+    CreateBuffers(buffer_sizes[i]);
+
+    ChunkDetector *detector = ChunkDetector::Create(
+      kChunkingFastCdc, min_chk_size, avg_chk_size, max_chk_size);
+    std::vector<uint64_t> cut_marks;
+    uint64_t next_cut = 0;
+    uint64_t last_cut = 0;
+    for (unsigned j = 0; j < buffers_.size(); ++j) {
+      while ((next_cut = detector->FindNextCutMark(buffers_[j])) != 0) {
+        ASSERT_LE(min_chk_size, next_cut - last_cut)
+          << "too small chunk with buffer size " << buffer_sizes[i];
+        ASSERT_GE(max_chk_size, next_cut - last_cut)
+          << "too large chunk with buffer size " << buffer_sizes[i];
+        cut_marks.push_back(next_cut);
+        last_cut = next_cut;
+      }
+    }
+    delete detector;
+
+    if (i == 0) {
+      reference = cut_marks;
+      continue;
+    }
+    EXPECT_EQ(reference, cut_marks)
+      << "unexpected cut marks with buffer size " << buffer_sizes[i];
+  }
+
+  // The gear table defines the cut marks
+  const uint64_t expected[] = {
+    1150213, 1860199, 2493190, 3663675, 4699424, 5728331
+  };
+  ASSERT_LE(sizeof(expected) / sizeof(expected[0]), reference.size());
+  for (unsigned i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i)
+    EXPECT_EQ(expected[i], reference[i]);
+
+  // Chunk sizes are normalized around the average chunk size
+  ASSERT_FALSE(reference.empty());
+  const uint64_t avg = reference.back() / reference.size();
+  EXPECT_LE(avg_chk_size * 3 / 4, avg);
+  EXPECT_GE(avg_chk_size * 5 / 4, avg);
+}
+
+
+TEST_F(T_ChunkDetectors, FastCdcShiftResistance) {
+  const size_t min_chk_size = 16 * 1024;
+  const size_t avg_chk_size = 32 * 1024;
+  const size_t max_chk_size = 64 * 1024;
+  // One large buffer is enough, the data set has 100MB
+  CreateBuffers(data_size());
+  ASSERT_EQ(1U, buffers_.size());
+  BlockItem *original = buffers_[0];
+
+  // Insert a few bytes close to the beginning
+  const size_t edit_pos = 1000000;
+  const size_t edit_size = 100;
+  ItemAllocator allocator;
+  BlockItem modified(&allocator);
+  modified.MakeData(data_size() + edit_size);
+  memcpy(modified.data(), original->data(), edit_pos);
+  memset(modified.data() + edit_pos, 'x', edit_size);
+  memcpy(modified.data() + edit_pos + edit_size, original->data() + edit_pos,
+         data_size() - edit_pos);
+  modified.set_size(modified.capacity());
+
+  std::vector<uint64_t> cuts_original;
+  std::vector<uint64_t> cuts_modified;
+  FastCdcDetector detector_original(min_chk_size, avg_chk_size, max_chk_size);
+  FastCdcDetector detector_modified(min_chk_size, avg_chk_size, max_chk_size);
+  uint64_t next_cut;
+  while ((next_cut = detector_original.FindNextCutMark(original)) != 0)
+    cuts_original.push_back(next_cut);
+  while ((next_cut = detector_modified.FindNextCutMark(&modified)) != 0)
+    cuts_modified.push_back(next_cut - edit_size);
+
+  // Cut marks before the edit are unchanged, cut marks shortly after the edit
+  // are shifted by the size of the edit
+  unsigned nshared = 0;
+  for (unsigned i = 0; i < cuts_original.size(); ++i) {
+    if (cuts_original[i] < edit_pos)
+      cuts_original[i] -= edit_size;
+    nshared += std::binary_search(cuts_modified.begin(), cuts_modified.end(),
+                                  cuts_original[i]);
+  }
+  EXPECT_GE(nshared + 3, cuts_original.size());
+}
+
+
+TEST_F(T_ChunkDetectors, FastCdcChunkDetectorZeros) {
+  const size_t min_chk_size = data_size() / 64;
+  const size_t avg_chk_size = data_size() / 32;
+  const size_t max_chk_size = data_size() / 16;
+  FastCdcDetector fastcdc_detector(min_chk_size, avg_chk_size, max_chk_size);
+
+  CreateZeroBuffers(512000);
+
+  uint64_t next_cut = 0;
+  unsigned ncuts = 0;
+  for (unsigned i = 0; i < buffers_.size(); ++i) {
+    while ((next_cut = fastcdc_detector.FindNextCutMark(buffers_[i])) != 0) {
+      EXPECT_EQ(0U, next_cut % max_chk_size);
+      EXPECT_GE(data_size(), next_cut);
+      ncuts++;
+    }
+  }
+  EXPECT_EQ(16U, ncuts);
+}
@@ -0,0 +1,113 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include "chunk_prefetch.h"
+#include "file_chunk.h"
+#include "hash.h"
+#include "statistics.h"
+
+namespace cvmfs {
+
+class T_ChunkPrefetcher : public ::testing::Test {
+ protected:
+  static const unsigned kNumChunks = 10;
+  static const unsigned kChunkSize = 1000;
+
+  virtual void SetUp() {
+    chunk_list_ = new FileChunkList();
+    for (unsigned i = 0; i < kNumChunks; ++i) {
+      shash::Any hash(shash::kSha1);
+      hash.Randomize();
+      chunk_list_->PushBack(FileChunk(hash, i * kChunkSize, kChunkSize));
+    }
+    chunks_ = FileChunkReflist(chunk_list_, PathString("/chunked"),
+                               zlib::kZlibDefault, false);
+    // Not spawned, so jobs stay in the queue
+    prefetcher_ = new ChunkPrefetcher(NULL, NULL, 3,
+      perf::StatisticsTemplate("readahead", &statistics_));
+  }
+
+  virtual void TearDown() {
+    delete prefetcher_;
+    delete chunk_list_;
+  }
+
+  int64_t GetCounter(const std::string &name) {
+    return statistics_.Lookup("readahead." + name)->Get();
+  }
+
+  perf::Statistics statistics_;
+  FileChunkList *chunk_list_;
+  FileChunkReflist chunks_;
+  ChunkPrefetcher *prefetcher_;
+};
+
+
+TEST_F(T_ChunkPrefetcher, SequentialDetection) {
+  prefetcher_->OnChunkOpen(1, chunks_, 0, CacheManager::kTypeRegular);
+  EXPECT_TRUE(prefetcher_->jobs_.empty());
+
+  prefetcher_->OnChunkOpen(1, chunks_, 1, CacheManager::kTypeRegular);
+  ASSERT_EQ(3U, prefetcher_->jobs_.size());
+  EXPECT_EQ(2U, prefetcher_->jobs_[0].chunk_idx);
+  EXPECT_EQ(4U, prefetcher_->jobs_[2].chunk_idx);
+  EXPECT_EQ(static_cast<off_t>(2 * kChunkSize), prefetcher_->jobs_[0].offset);
+  EXPECT_EQ(3, GetCounter("n_scheduled"));
+
+  // Only the chunk entering the window is scheduled
+  prefetcher_->OnChunkOpen(1, chunks_, 2, CacheManager::kTypeRegular);
+  EXPECT_EQ(4U, prefetcher_->jobs_.size());
+  EXPECT_EQ(5U, prefetcher_->jobs_[3].chunk_idx);
+  EXPECT_EQ(1, GetCounter("n_hit"));
+
+  // Random access doesn't trigger read-ahead
+  prefetcher_->OnChunkOpen(1, chunks_, 8, CacheManager::kTypeRegular);
+  EXPECT_EQ(4U, prefetcher_->jobs_.size());
+
+  // Window is capped by the end of the file
+  prefetcher_->OnChunkOpen(1, chunks_, 9, CacheManager::kTypeRegular);
+  EXPECT_EQ(4U, prefetcher_->jobs_.size());
+}
+
+
+TEST_F(T_ChunkPrefetcher, Forget) {
+  prefetcher_->OnChunkOpen(1, chunks_, 0, CacheManager::kTypeRegular);
+  prefetcher_->OnChunkOpen(1, chunks_, 1, CacheManager::kTypeRegular);
+  prefetcher_->OnChunkOpen(2, chunks_, 4, CacheManager::kTypeRegular);
+  prefetcher_->OnChunkOpen(2, chunks_, 5, CacheManager::kTypeRegular);
+  EXPECT_EQ(6U, prefetcher_->jobs_.size());
+
+  // Pretend that one job of handle 1 has been processed already
+  prefetcher_->jobs_.pop_front();
+  prefetcher_->Forget(1);
+  EXPECT_EQ(3U, prefetcher_->jobs_.size());
+  EXPECT_EQ(2U, prefetcher_->jobs_[0].chunk_handle);
+  EXPECT_EQ(static_cast<int64_t>(kChunkSize), GetCounter("sz_wasted"));
+  EXPECT_EQ(static_cast<int64_t>(4 * kChunkSize), GetCounter("sz_prefetched"));
+
+  prefetcher_->Forget(2);
+  EXPECT_TRUE(prefetcher_->jobs_.empty());
+  EXPECT_TRUE(prefetcher_->handles_.empty());
+}
+
+
+TEST_F(T_ChunkPrefetcher, FailedJob) {
+  prefetcher_->OnChunkOpen(1, chunks_, 0, CacheManager::kTypeRegular);
+  prefetcher_->OnChunkOpen(1, chunks_, 1, CacheManager::kTypeRegular);
+  ASSERT_EQ(3U, prefetcher_->jobs_.size());
+
+  ChunkPrefetcher::Job job = prefetcher_->jobs_.front();
+  prefetcher_->jobs_.pop_front();
+  prefetcher_->OnJobFailed(job);
+  EXPECT_EQ(1, GetCounter("n_failed"));
+  EXPECT_EQ(static_cast<int64_t>(2 * kChunkSize), GetCounter("sz_prefetched"));
+
+  prefetcher_->Forget(1);
+  EXPECT_EQ(0, GetCounter("sz_wasted"));
+  EXPECT_EQ(0, GetCounter("sz_prefetched"));
+}
+
+}  // namespace cvmfs
@@ -4,8 +4,12 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <cstring>
+#include <string>
 
 #include "compression.h"
+#include "sink.h"
 #include "smalloc.h"
 #include "util/pointer.h"
 
@@ -155,4 +159,154 @@ TEST_F(T_Compressor, EchoCompressionLong) {
   EXPECT_EQ(0, memcmp(compress_buf.weak_ref(), long_string, long_size));
 }
 
+
+namespace {
+
+class StringSink : public cvmfs::Sink {
+ public:
+  virtual ~StringSink() { }
+  virtual int64_t Write(const void *buf, uint64_t sz) {
+    data.append(reinterpret_cast<const char *>(buf), sz);
+    return sz;
+  }
+  virtual int Reset() { data.clear(); return 0; }
+  std::string data;
+};
+
+}  // anonymous namespace
+
+
+TEST_F(T_Compressor, Algorithms) {
+  EXPECT_EQ(kZlibDefault, ParseCompressionAlgorithm("default"));
+  EXPECT_EQ(kNoCompression, ParseCompressionAlgorithm("none"));
+  EXPECT_EQ(0, ParseCompressionLevel("zlib"));
+  EXPECT_EQ(19, ParseCompressionLevel("zstd:19"));
+  EXPECT_EQ("zstd", AlgorithmName(kZstd));
+  EXPECT_EQ("lz4", AlgorithmName(kLz4));
+  EXPECT_TRUE(IsAvailable(kZlibDefault));
+
+  const unsigned char zstd_frame[] = {0x28, 0xb5, 0x2f, 0xfd, 0x00};
+  const unsigned char lz4_frame[] = {0x04, 0x22, 0x4d, 0x18, 0x00};
+  EXPECT_EQ(kZstd, DetectAlgorithm(zstd_frame, sizeof(zstd_frame),
+                                   kZlibDefault));
+  EXPECT_EQ(kLz4, DetectAlgorithm(lz4_frame, sizeof(lz4_frame),
+                                  kZlibDefault));
+  EXPECT_EQ(kZlibDefault, DetectAlgorithm(zstd_frame, 3, kZlibDefault));
+  EXPECT_EQ(kNoCompression, DetectAlgorithm(test_string, size_input,
+                                            kNoCompression));
+
+  void *compressed;
+  uint64_t compressed_size;
+  EXPECT_TRUE(CompressMem2Mem(test_string, size_input, kZlibDefault,
+                              &compressed, &compressed_size));
+  // Only the frame magic of zstd and lz4 is recognized
+  EXPECT_EQ(kNoCompression,
+            DetectAlgorithm(compressed, compressed_size, kNoCompression));
+  free(compressed);
+}
+
+
+/**
+ * Compresses the long string in small pieces with the given algorithm and
+ * decompresses it again, both in one go and as a stream.
+ */
+static void CheckRoundTrip(const Algorithms alg,
+                           unsigned char *data, const size_t size)
+{
+  for (unsigned i = 0; i < size; ++i)
+    data[i] = (i % 1024 < 512) ? i % 7 : i % 251;
+
+  UniquePtr<Compressor> compressor(Compressor::Construct(alg));
+  ASSERT_TRUE(compressor.IsValid());
+  std::string compressed;
+  unsigned char *input = data;
+  size_t remaining = size;
+  const size_t kPiece = 100000;
+  unsigned char out[4096];
+  bool finished = false;
+  while (!finished) {
+    const bool flush = remaining <= kPiece;
+    size_t piece = flush ? remaining : kPiece;
+    const size_t piece_before = piece;
+    do {
+      unsigned char *out_ptr = out;
+      size_t out_size = sizeof(out);
+      const bool done =
+        compressor->Deflate(flush, &input, &piece, &out_ptr, &out_size);
+      compressed.append(reinterpret_cast<char *>(out), out_size);
+      finished = flush && done;
+    } while ((piece > 0) || (flush && !finished));
+    remaining -= piece_before;
+  }
+  EXPECT_EQ(0U, remaining);
+  EXPECT_LT(compressed.size(), size);
+  EXPECT_LE(compressed.size(), compressor->DeflateBound(size));
+  EXPECT_EQ(alg, DetectAlgorithm(compressed.data(), compressed.size(),
+                                 kZlibDefault));
+
+  void *decompressed;
+  uint64_t decompressed_size;
+  ASSERT_TRUE(DecompressMem2Mem(compressed.data(), compressed.size(),
+                                &decompressed, &decompressed_size));
+  ASSERT_EQ(size, decompressed_size);
+  EXPECT_EQ(0, memcmp(data, decompressed, size));
+  free(decompressed);
+
+  // Streaming in odd pieces, as it comes from the network
+  UniquePtr<Decompressor> decompressor(Decompressor::Construct(alg));
+  ASSERT_TRUE(decompressor.IsValid());
+  StringSink sink;
+  StreamStates state = kStreamContinue;
+  for (size_t pos = 0; pos < compressed.size(); pos += 1357) {
+    const size_t nbytes = std::min(size_t(1357), compressed.size() - pos);
+    state = DecompressStream2Sink(compressed.data() + pos, nbytes,
+                                  decompressor.weak_ref(), &sink);
+    ASSERT_NE(kStreamDataError, state);
+  }
+  EXPECT_EQ(kStreamEnd, state);
+  ASSERT_EQ(size, sink.data.size());
+  EXPECT_EQ(0, memcmp(data, sink.data.data(), size));
+
+  // Corrupted input
+  decompressor->Reset();
+  compressed[compressed.size() / 2] ^= 0xff;
+  compressed[compressed.size() / 2 + 1] ^= 0xff;
+  sink.Reset();
+  state = DecompressStream2Sink(compressed.data(), compressed.size(),
+                                decompressor.weak_ref(), &sink);
+  EXPECT_TRUE((state == kStreamDataError) ||
+              (sink.data.size() != size) ||
+              (memcmp(data, sink.data.data(), size) != 0));
+
+  void *buf;
+  uint64_t buf_size;
+  ASSERT_TRUE(CompressMem2Mem(data, 0, alg, &buf, &buf_size));
+  EXPECT_TRUE(DecompressMem2Mem(buf, buf_size, &decompressed,
+                                &decompressed_size));
+  EXPECT_EQ(0U, decompressed_size);
+  free(decompressed);
+  free(buf);
+}
+
+
+TEST_F(T_Compressor, ZlibRoundTrip) {
+  CheckRoundTrip(kZlibDefault, long_string, long_size);
+}
+
+
+#ifdef HAS_ZSTD
+TEST_F(T_Compressor, ZstdRoundTrip) {
+  EXPECT_EQ(kZstd, ParseCompressionAlgorithm("zstd:19"));
+  CheckRoundTrip(kZstd, long_string, long_size);
+}
+#endif
+
+
+#ifdef HAS_LZ4
+TEST_F(T_Compressor, Lz4RoundTrip) {
+  EXPECT_EQ(kLz4, ParseCompressionAlgorithm("lz4"));
+  CheckRoundTrip(kLz4, long_string, long_size);
+}
+#endif
+
 }  // end namespace zlib
@@ -4,10 +4,13 @@
 
 #include "gtest/gtest.h"
 
+#include <pthread.h>
 #include <unistd.h>
 
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
+#include <utility>
 
 #include "c_file_sandbox.h"
 #include "c_http_server.h"
@@ -180,6 +183,59 @@ TEST_F(T_Download, Multiple) {
 }
 
 
+static void *MainFetchFile(void *data) {
+  std::pair<DownloadManager *, string> *args =
+    static_cast<std::pair<DownloadManager *, string> *>(data);
+  for (unsigned i = 0; i < 16; ++i) {
+    JobInfo info(&args->second, false /* compressed */,
+                 false /* probe hosts */, NULL);
+    args->first->Fetch(&info);
+    if (info.error_code != kFailOk)
+      return reinterpret_cast<void *>(1);
+    free(info.destination_mem.data);
+  }
+  return NULL;
+}
+
+TEST_F(T_Download, MultipleWorkers) {
+  string src_path = GetAbsolutePath(GetSmallFile());
+  string src_url = "file://" + src_path;
+
+  DownloadManager threaded_mgr;
+  threaded_mgr.Init(8, false, /* use_system_proxy */
+    perf::StatisticsTemplate("threaded", &statistics));
+  threaded_mgr.SetNumWorkers(4);
+  EXPECT_EQ(4U, threaded_mgr.num_workers());
+  threaded_mgr.Spawn();
+  EXPECT_EQ(4U, threaded_mgr.workers_.size());
+  EXPECT_EQ(2U, threaded_mgr.workers_[3]->pool_max_handles);
+
+  const unsigned kNumThreads = 8;
+  std::pair<DownloadManager *, string> args(&threaded_mgr, src_url);
+  pthread_t threads[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, MainFetchFile, &args));
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    void *retval;
+    pthread_join(threads[i], &retval);
+    EXPECT_EQ(NULL, retval);
+  }
+  EXPECT_EQ(kNumThreads * 16,
+            statistics.Lookup("threaded.n_requests")->Get());
+  for (unsigned i = 0; i < threaded_mgr.workers_.size(); ++i)
+    EXPECT_EQ(0, atomic_read32(&threaded_mgr.workers_[i]->num_jobs));
+
+  // Clones inherit the number of workers
+  DownloadManager *cloned_mgr =
+    threaded_mgr.Clone(perf::StatisticsTemplate("cloned", &statistics));
+  EXPECT_EQ(4U, cloned_mgr->num_workers());
+  cloned_mgr->Fini();
+  delete cloned_mgr;
+
+  threaded_mgr.Fini();
+}
+
+
 TEST_F(T_Download, RemoteFile2Mem) {
   string src_path = GetSmallFile();
   string src_content = GetFileContents(src_path);
@@ -285,6 +285,77 @@ TEST_F(T_Fetcher, Fetch) {
 }
 
 
+namespace {
+
+class FetchManyCollector : public CallbackBase<Fetcher::Result> {
+ public:
+  explicit FetchManyCollector(unsigned n) : fds(n, 0), calls(n, 0) { }
+  virtual void operator()(const Fetcher::Result &result) const {
+    fds[result.idx] = result.fd;
+    calls[result.idx]++;
+  }
+  mutable vector<int> fds;
+  mutable vector<unsigned> calls;
+};
+
+}  // anonymous namespace
+
+TEST_F(T_Fetcher, FetchMany) {
+  download_mgr_->Spawn();
+
+  unsigned char x = 'x';
+  shash::Any hash_avail(shash::kSha1);
+  EXPECT_TRUE(cache_mgr_->CommitFromMem(hash_avail, &x, 1, ""));
+  shash::Any rnd_hash(shash::kSha1);
+  rnd_hash.Randomize();
+
+  vector<Fetcher::Request> requests;
+  requests.push_back(Fetcher::Request(hash_regular_, CacheManager::kSizeUnknown,
+    "reg", zlib::kZlibDefault, CacheManager::kTypeRegular));
+  requests.push_back(Fetcher::Request(hash_avail, 1,
+    "avail", zlib::kZlibDefault, CacheManager::kTypeRegular));
+  requests.push_back(Fetcher::Request(rnd_hash, CacheManager::kSizeUnknown,
+    "rnd", zlib::kZlibDefault, CacheManager::kTypeRegular));
+  requests.push_back(Fetcher::Request(hash_catalog_, CacheManager::kSizeUnknown,
+    "cat", zlib::kZlibDefault, CacheManager::kTypeCatalog));
+  requests.push_back(Fetcher::Request(hash_regular_, CacheManager::kSizeUnknown,
+    "reg-dup", zlib::kZlibDefault, CacheManager::kTypeRegular));
+  requests.push_back(Fetcher::Request(hash_uncompressed_, 1,
+    "x", zlib::kNoCompression, CacheManager::kTypeRegular));
+
+  FetchManyCollector collector(requests.size());
+  fetcher_->FetchMany(requests, collector);
+  for (unsigned i = 0; i < requests.size(); ++i) {
+    EXPECT_EQ(1U, collector.calls[i]) << i;
+    if (i == 2) {
+      EXPECT_EQ(-EIO, collector.fds[i]);
+      continue;
+    }
+    EXPECT_GE(collector.fds[i], 0) << i;
+    EXPECT_EQ(0, cache_mgr_->Close(collector.fds[i]));
+  }
+  // The duplicate request does not result in a second download
+  EXPECT_EQ(4, statistics_.Lookup("fetch.n_downloads")->Get());
+
+  int fd = cache_mgr_->Open(CacheManager::Bless(hash_regular_));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+  fd = cache_mgr_->Open(CacheManager::Bless(hash_catalog_));
+  EXPECT_GE(fd, 0);
+  EXPECT_EQ(0, cache_mgr_->Close(fd));
+
+  // Everything cached now
+  FetchManyCollector collector_cached(requests.size());
+  requests.erase(requests.begin() + 2);
+  fetcher_->FetchMany(requests, collector_cached);
+  for (unsigned i = 0; i < requests.size(); ++i) {
+    EXPECT_GE(collector_cached.fds[i], 0) << i;
+    EXPECT_EQ(0, cache_mgr_->Close(collector_cached.fds[i]));
+  }
+  EXPECT_EQ(4, statistics_.Lookup("fetch.n_downloads")->Get());
+}
+
+
 TEST_F(T_Fetcher, FetchUncompressed) {
   EXPECT_EQ(-ENOENT, cache_mgr_->Open(CacheManager::Bless(hash_uncompressed_)));
 
@@ -14,11 +14,13 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "fs_traversal.h"
 #include "platform.h"
 #include "util/file_guard.h"
 #include "util/posix.h"
+#include "util/string.h"
 
 class T_FsTraversal : public ::testing::Test {
  public:
@@ -481,6 +483,19 @@ TEST_F(T_FsTraversal, FullTraversal) {
 }
 
 
+TEST_F(T_FsTraversal, FullTraversalThreaded) {
+  BaseTraversalDelegate delegate(reference_);
+  FileSystemTraversal<BaseTraversalDelegate> traverse(&delegate,
+                                                       testbed_path_,
+                                                       true);
+  RegisterDelegate(&traverse);
+  traverse.set_num_threads(4);
+
+  traverse.Recurse(testbed_path_);
+  delegate.Check();
+}
+
+
 //
 // # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
 //
@@ -588,6 +603,25 @@ TEST_F(T_FsTraversal, IgnoringTraversal) {
 }
 
 
+TEST_F(T_FsTraversal, IgnoringTraversalThreaded) {
+  std::set<std::string> ignored_filenames;
+  ignored_filenames.insert("baz");
+  ignored_filenames.insert("d");
+
+  IgnoringTraversalDelegate delegate(reference_);
+  delegate.SetIgnoreNames(ignored_filenames);
+  FileSystemTraversal<IgnoringTraversalDelegate> traverse(&delegate,
+                                                           testbed_path_,
+                                                           true);
+  RegisterDelegate(&traverse);
+  traverse.fn_ignore_file = &IgnoringTraversalDelegate::IgnoreFilePredicate;
+  traverse.set_num_threads(4);
+
+  traverse.Recurse(testbed_path_);
+  delegate.Check();
+}
+
+
 //
 // # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
 //
@@ -659,6 +693,175 @@ TEST_F(T_FsTraversal, SteeredTraversal) {
   delegate.Check();
 }
 
+
+TEST_F(T_FsTraversal, SteeredTraversalThreaded) {
+  SteeringTraversalDelegate delegate(reference_);
+  FileSystemTraversal<SteeringTraversalDelegate> traverse(&delegate,
+                                                           testbed_path_,
+                                                           true);
+  RegisterDelegate(&traverse);
+  traverse.set_num_threads(4);
+
+  traverse.Recurse(testbed_path_);
+  delegate.Check();
+}
+
+
+//
+// # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
+//
+
+
+/**
+ * Records the sequence of callbacks
+ */
+class RecordingDelegate {
+ public:
+  void EnterDir(const std::string &relative_path,
+                const std::string &dir_name) {
+    Record("enter", relative_path, dir_name);
+  }
+  void LeaveDir(const std::string &relative_path,
+                const std::string &dir_name) {
+    Record("leave", relative_path, dir_name);
+  }
+  void File(const std::string &relative_path,
+            const std::string &file_name) {
+    Record("file", relative_path, file_name);
+  }
+  void Symlink(const std::string &relative_path,
+               const std::string &link_name) {
+    Record("symlink", relative_path, link_name);
+  }
+  bool DirPrefix(const std::string &relative_path,
+                 const std::string &dir_name) {
+    Record("prefix", relative_path, dir_name);
+    return dir_name != "c";
+  }
+  void DirPostfix(const std::string &relative_path,
+                  const std::string &dir_name) {
+    Record("postfix", relative_path, dir_name);
+  }
+  bool Ignore(const std::string &relative_path,
+              const std::string &name) {
+    return name == "foo";
+  }
+
+  std::vector<std::string> sequence;
+
+ private:
+  void Record(const std::string &event,
+              const std::string &relative_path,
+              const std::string &name)
+  {
+    sequence.push_back(event + " " + relative_path + " " + name);
+  }
+};
+
+TEST_F(T_FsTraversal, ThreadedCallbackOrder) {
+  RecordingDelegate delegate_sequential;
+  RecordingDelegate delegate_threaded;
+  FileSystemTraversal<RecordingDelegate> traverse_sequential(
+    &delegate_sequential, testbed_path_, true);
+  FileSystemTraversal<RecordingDelegate> traverse_threaded(
+    &delegate_threaded, testbed_path_, true);
+  FileSystemTraversal<RecordingDelegate> *traversals[] =
+    {&traverse_sequential, &traverse_threaded};
+  for (unsigned i = 0; i < 2; ++i) {
+    traversals[i]->fn_enter_dir = &RecordingDelegate::EnterDir;
+    traversals[i]->fn_leave_dir = &RecordingDelegate::LeaveDir;
+    traversals[i]->fn_new_file = &RecordingDelegate::File;
+    traversals[i]->fn_new_symlink = &RecordingDelegate::Symlink;
+    traversals[i]->fn_new_dir_prefix = &RecordingDelegate::DirPrefix;
+    traversals[i]->fn_new_dir_postfix = &RecordingDelegate::DirPostfix;
+    traversals[i]->fn_ignore_file = &RecordingDelegate::Ignore;
+  }
+  traverse_threaded.set_num_threads(3);
+
+  traverse_sequential.Recurse(testbed_path_);
+  traverse_threaded.Recurse(testbed_path_);
+  EXPECT_FALSE(delegate_sequential.sequence.empty());
+  EXPECT_EQ(delegate_sequential.sequence, delegate_threaded.sequence);
+}
+
+/**
+ * Does not enter directories but runs a nested traversal on each of them,
+ * like SyncMediator::AddDirectoryRecursively()
+ */
+class NestingDelegate {
+ public:
+  NestingDelegate(const std::string &root_path,
+                  DirectoryPrefetcher *prefetcher)
+    : root_path_(root_path), prefetcher_(prefetcher) { }
+
+  bool DirPrefix(const std::string &relative_path,
+                 const std::string &dir_name) {
+    FileSystemTraversal<RecordingDelegate> traversal(&recorder, root_path_,
+                                                     true);
+    traversal.fn_enter_dir = &RecordingDelegate::EnterDir;
+    traversal.fn_leave_dir = &RecordingDelegate::LeaveDir;
+    traversal.fn_new_file = &RecordingDelegate::File;
+    traversal.fn_new_dir_prefix = &RecordingDelegate::DirPrefix;
+    traversal.fn_ignore_file = &RecordingDelegate::Ignore;
+    traversal.set_prefetcher(prefetcher_);
+    const std::string parent = relative_path.empty() ?
+      root_path_ : root_path_ + "/" + relative_path;
+    traversal.Recurse(parent + "/" + dir_name);
+    return false;
+  }
+
+  RecordingDelegate recorder;
+
+ private:
+  std::string root_path_;
+  DirectoryPrefetcher *prefetcher_;
+};
+
+TEST_F(T_FsTraversal, NestedSharedPrefetcher) {
+  NestingDelegate delegate_sequential(testbed_path_, NULL);
+  DirectoryPrefetcher prefetcher(3);
+  NestingDelegate delegate_shared(testbed_path_, &prefetcher);
+  FileSystemTraversal<NestingDelegate> traverse_sequential(
+    &delegate_sequential, testbed_path_, true);
+  FileSystemTraversal<NestingDelegate> traverse_shared(
+    &delegate_shared, testbed_path_, true);
+  traverse_sequential.fn_new_dir_prefix = &NestingDelegate::DirPrefix;
+  traverse_shared.fn_new_dir_prefix = &NestingDelegate::DirPrefix;
+  traverse_shared.set_prefetcher(&prefetcher);
+
+  traverse_sequential.Recurse(testbed_path_);
+  traverse_shared.Recurse(testbed_path_);
+  EXPECT_FALSE(delegate_sequential.recorder.sequence.empty());
+  EXPECT_EQ(delegate_sequential.recorder.sequence,
+            delegate_shared.recorder.sequence);
+}
+
+TEST_F(T_FsTraversal, PrefetcherBounded) {
+  const std::string wide_path = CreateTempDir(testbed_path_ + "_wide");
+  ASSERT_FALSE(wide_path.empty());
+  std::vector<std::string> paths;
+  for (unsigned i = 0; i < 64; ++i) {
+    paths.push_back(wide_path + "/" + StringifyInt(i));
+    ASSERT_TRUE(MkdirDeep(paths.back() + "/sub", 0700));
+  }
+
+  DirectoryPrefetcher prefetcher(4, 2);
+  prefetcher.Schedule(paths);
+  SafeSleepMs(100);
+  EXPECT_EQ(2U, prefetcher.num_listings());
+  for (unsigned i = 0; i < paths.size(); ++i) {
+    DirectoryPrefetcher::Listing *listing = prefetcher.Get(paths[i]);
+    EXPECT_EQ(0, listing->open_errno);
+    ASSERT_EQ(1U, listing->entries.size());
+    EXPECT_EQ("sub", listing->entries[0].name);
+    delete listing;
+    EXPECT_LE(prefetcher.num_listings(), 2U);
+  }
+  EXPECT_EQ(0U, prefetcher.num_listings());
+
+  RemoveTree(wide_path);
+}
+
 class CustomDelegate {
  public:
   explicit CustomDelegate(const std::string &path) :
@@ -9,6 +9,7 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 
 #include "atomic.h"
 #include "c_mock_uploader.h"
@@ -24,6 +25,7 @@
 #include "ingestion/task_read.h"
 #include "ingestion/task_write.h"
 #include "smalloc.h"
+#include "statistics.h"
 #include "testutil.h"
 #include "upload_facility.h"
 #include "util/pointer.h"
@@ -58,6 +60,48 @@ class TestTask : public TubeConsumer<DummyItem> {
 };
 atomic_int32 TestTask::cnt_terminate = 0;
 atomic_int32 TestTask::cnt_process = 0;
+
+
+/**
+ * Records the maximum number of concurrently running Process() calls
+ */
+class SlowTask : public TubeConsumer<DummyItem> {
+ public:
+  static atomic_int32 cnt_active;
+  static atomic_int32 max_active;
+  explicit SlowTask(Tube<DummyItem> *tube) : TubeConsumer<DummyItem>(tube) { }
+
+ protected:
+  virtual void Process(DummyItem *item) {
+    const int32_t active = atomic_xadd32(&cnt_active, 1) + 1;
+    int32_t max = atomic_read32(&max_active);
+    while ((active > max) && !atomic_cas32(&max_active, max, active))
+      max = atomic_read32(&max_active);
+    SafeSleepMs(1);
+    atomic_xadd32(&item->sum, item->summand);
+    atomic_dec32(&cnt_active);
+  }
+};
+atomic_int32 SlowTask::cnt_active = 0;
+atomic_int32 SlowTask::max_active = 0;
+
+
+/**
+ * Passes items on to a tube group
+ */
+class ForwardTask : public TubeConsumer<DummyItem> {
+ public:
+  ForwardTask(Tube<DummyItem> *tube, TubeGroup<DummyItem> *tubes_out)
+    : TubeConsumer<DummyItem>(tube), tubes_out_(tubes_out) { }
+
+ protected:
+  virtual void Process(DummyItem *item) {
+    tubes_out_->DispatchAny(item, &blocked_ns_);
+  }
+
+ private:
+  TubeGroup<DummyItem> *tubes_out_;
+};
 }  // anonymous namespace
 
 
@@ -69,9 +113,11 @@ struct FnFileProcessed {
   FnFileProcessed() { atomic_init64(&ncall); }
 
   void OnFileProcessed(const upload::SpoolerResult &spooler_result) {
+    last_result = spooler_result;
     atomic_inc64(&ncall);
   }
 
+  upload::SpoolerResult last_result;
   atomic_int64 ncall;
 };
 
@@ -170,6 +216,61 @@ TEST_F(T_Ingestion, TaskStress) {
 }
 
 
+TEST_F(T_Ingestion, TaskMaxActive) {
+  SlowTask::cnt_active = 0;
+  SlowTask::max_active = 0;
+  Tube<DummyItem> tube;
+  TubeConsumerGroup<DummyItem> group;
+  for (unsigned i = 0; i < 8; ++i)
+    group.TakeConsumer(new SlowTask(&tube));
+  EXPECT_EQ(8U, group.max_active());
+  group.SetMaxActive(2);
+  EXPECT_EQ(2U, group.max_active());
+  EXPECT_EQ(0U, group.GetBusyNs());
+  group.Spawn();
+
+  DummyItem item(1);
+  for (unsigned i = 0; i < 200; ++i)
+    tube.EnqueueBack(&item);
+  tube.Wait();
+  EXPECT_LE(atomic_read32(&SlowTask::max_active), 2);
+
+  group.SetMaxActive(4);
+  for (unsigned i = 0; i < 200; ++i)
+    tube.EnqueueBack(&item);
+  tube.Wait();
+  group.Terminate();
+  EXPECT_LE(atomic_read32(&SlowTask::max_active), 4);
+  EXPECT_EQ(400, atomic_read32(&DummyItem::sum));
+  // Every item took at least a millisecond
+  EXPECT_GE(group.GetBusyNs(), 400U * 1000000U);
+}
+
+
+TEST_F(T_Ingestion, TaskBlocked) {
+  Tube<DummyItem> tube;
+  TubeGroup<DummyItem> tubes_out;
+  Tube<DummyItem> *tube_out = new Tube<DummyItem>(2, kTubeRing);
+  tubes_out.TakeTube(tube_out);
+  tubes_out.Activate();
+  TubeConsumerGroup<DummyItem> group;
+  group.TakeConsumer(new ForwardTask(&tube, &tubes_out));
+  group.Spawn();
+
+  DummyItem item(1);
+  for (unsigned i = 0; i < 20; ++i)
+    tube.EnqueueBack(&item);
+  for (unsigned i = 0; i < 20; ++i) {
+    SafeSleepMs(10);
+    EXPECT_EQ(&item, tube_out->PopFront());
+  }
+  tube.Wait();
+  group.Terminate();
+  // Waiting for the slow consumer of the output tube is not busy time
+  EXPECT_LT(group.GetBusyNs(), 100U * 1000000U);
+}
+
+
 TEST_F(T_Ingestion, TaskRead) {
   Tube<FileItem> tube_in;
   Tube<BlockItem> *tube_out = new Tube<BlockItem>();
@@ -685,6 +786,62 @@ TEST_F(T_Ingestion, TaskHash) {
 }
 
 
+TEST_F(T_Ingestion, TaskHashBatch) {
+  // Interleaved data blocks of several chunks are queued before the consumer
+  // starts so that they are hashed in batches
+  const unsigned kNumChunks = 11;
+  const unsigned kNumBlocks = 5;
+  Tube<BlockItem> tube_in;
+  Tube<BlockItem> *tube_out = new Tube<BlockItem>();
+  TubeGroup<BlockItem> tube_group_out;
+  tube_group_out.TakeTube(tube_out);
+  tube_group_out.Activate();
+
+  FileItem file_null(new FileIngestionSource(std::string("/dev/null")));
+  std::vector<ChunkItem *> chunks;
+  std::vector<std::string> contents(kNumChunks);
+  std::vector<BlockItem *> blocks;
+  for (unsigned i = 0; i < kNumChunks; ++i)
+    chunks.push_back(new ChunkItem(&file_null, 0));
+  for (unsigned j = 0; j <= kNumBlocks; ++j) {
+    for (unsigned i = 0; i < kNumChunks; ++i) {
+      BlockItem *block = new BlockItem(i, &allocator_);
+      block->SetFileItem(&file_null);
+      block->SetChunkItem(chunks[i]);
+      if (j == kNumBlocks) {
+        block->MakeStop();
+      } else {
+        const std::string data((i + 1) * 1000 + j * 77, 'a' + i + j);
+        contents[i] += data;
+        block->MakeDataCopy(reinterpret_cast<const unsigned char *>(
+                            data.data()), data.size());
+      }
+      blocks.push_back(block);
+      tube_in.EnqueueBack(block);
+    }
+  }
+
+  TubeConsumerGroup<BlockItem> task_group;
+  task_group.TakeConsumer(new TaskHash(&tube_in, &tube_group_out));
+  task_group.Spawn();
+
+  for (unsigned i = 0; i < blocks.size(); ++i) {
+    EXPECT_EQ(blocks[i], tube_out->PopFront());
+  }
+  for (unsigned i = 0; i < kNumChunks; ++i) {
+    shash::Any expected(shash::kSha1);
+    shash::HashString(contents[i], &expected);
+    EXPECT_EQ(expected, *chunks[i]->hash_ptr());
+  }
+  EXPECT_EQ(0U, tube_out->size());
+  task_group.Terminate();
+
+  for (unsigned i = 0; i < blocks.size(); ++i)
+    delete blocks[i];
+  for (unsigned i = 0; i < kNumChunks; ++i)
+    delete chunks[i];
+}
+
 TEST_F(T_Ingestion, TaskWriteNull) {
   Tube<BlockItem> tube_in;
   Tube<FileItem> *tube_out = new Tube<FileItem>();
@@ -826,6 +983,162 @@ TEST_F(T_Ingestion, PipelineNull) {
 }
 
 
+TEST_F(T_Ingestion, PipelineRebalance) {
+  std::vector<IngestionPipeline::StageLoad> loads(3);
+  for (unsigned i = 0; i < loads.size(); ++i) {
+    loads[i].num_slots = 2;
+    loads[i].max_slots = 4;
+    loads[i].utilization = 0.7;
+  }
+  unsigned donor = 42;
+  unsigned receiver = 42;
+  EXPECT_EQ(0U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+  EXPECT_EQ(42U, donor);
+
+  // Saturated stage without backlog
+  loads[1].utilization = 1.0;
+  loads[0].utilization = 0.1;
+  EXPECT_EQ(0U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+
+  // Saturated stage with backlog but the idle stage has only a single slot
+  loads[1].backlog = 100;
+  loads[0].num_slots = 1;
+  EXPECT_EQ(0U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+
+  loads[0].num_slots = 2;
+  EXPECT_EQ(1U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+  EXPECT_EQ(0U, donor);
+  EXPECT_EQ(1U, receiver);
+
+  // Half of the idle slots move, limited by the headroom of the receiver
+  loads[0].num_slots = 9;
+  loads[0].max_slots = 9;
+  loads[0].utilization = 0.0;
+  EXPECT_EQ(2U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+  loads[1].max_slots = 16;
+  EXPECT_EQ(4U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+
+  // The least utilized stage donates to the most utilized one
+  loads[2].utilization = 0.0;
+  loads[2].num_slots = 3;
+  loads[0].utilization = 0.3;
+  loads[2].backlog = 1;
+  EXPECT_EQ(1U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+  EXPECT_EQ(2U, donor);
+  EXPECT_EQ(1U, receiver);
+
+  // Receiver at its maximum
+  loads[1].num_slots = loads[1].max_slots;
+  EXPECT_EQ(0U, IngestionPipeline::Rebalance(loads, &donor, &receiver));
+}
+
+
+TEST_F(T_Ingestion, PipelineFixed) {
+  upload::SpoolerDefinition spooler_definition = MockSpoolerDefinition();
+  spooler_definition.num_read_tasks = 1;
+  spooler_definition.num_processing_tasks = 3;
+  spooler_definition.adaptive_pipeline = false;
+  spooler_definition.max_pipeline_mem = 64 * 1024 * 1024;
+
+  perf::Statistics statistics;
+  perf::StatisticsTemplate publish_statistics("Publish", &statistics);
+  UniquePtr<IngestionPipeline> pipeline(
+    new IngestionPipeline(uploader_, spooler_definition));
+  pipeline->InitCounters(&publish_statistics);
+  pipeline->Spawn();
+  pipeline->Process(new FileIngestionSource(std::string("/dev/null")), true);
+  pipeline->WaitFor();
+  EXPECT_EQ(1U, uploader_->results.size());
+  EXPECT_TRUE(
+    statistics.Lookup("Publish.pipeline_compress_utilization") != NULL);
+  EXPECT_TRUE(statistics.Lookup("Publish.pipeline_n_rebalances") != NULL);
+  pipeline.Destroy();
+  EXPECT_EQ(0, statistics.Lookup("Publish.pipeline_n_rebalances")->Get());
+}
+
+
+TEST_F(T_Ingestion, PipelineKnownContent) {
+  const string tmp_path = CreateTempDir("./cvmfs_ut_ingestion");
+  ASSERT_FALSE(tmp_path.empty());
+  const string path_data = tmp_path + "/data";
+  string content;
+  for (unsigned i = 0; i < 1000000; ++i)
+    content += StringifyInt(i);
+  ASSERT_TRUE(SafeWriteToFile(content, path_data, 0600));
+
+  upload::SpoolerDefinition spooler_definition = MockSpoolerDefinition();
+  spooler_definition.known_content_path = tmp_path + "/known_content";
+  FnFileProcessed fn_processed;
+
+  UniquePtr<IngestionPipeline> pipeline(
+    new IngestionPipeline(uploader_, spooler_definition));
+  pipeline->RegisterListener(&FnFileProcessed::OnFileProcessed, &fn_processed);
+  pipeline->Spawn();
+  pipeline->Process(new FileIngestionSource(path_data), true);
+  pipeline->WaitFor();
+  pipeline.Destroy();
+  EXPECT_TRUE(FileExists(spooler_definition.known_content_path));
+  const upload::SpoolerResult uploaded = fn_processed.last_result;
+  EXPECT_FALSE(uploaded.content_hash.IsNull());
+  EXPECT_TRUE(uploaded.IsChunked());
+  const unsigned nobjects = uploader_->results.size();
+
+  // Known content from the index file, nothing is uploaded
+  uploader_->ClearResults();
+  pipeline = new IngestionPipeline(uploader_, spooler_definition);
+  pipeline->RegisterListener(&FnFileProcessed::OnFileProcessed, &fn_processed);
+  pipeline->Spawn();
+  pipeline->Process(new FileIngestionSource(path_data), true);
+  pipeline->WaitFor();
+  pipeline.Destroy();
+  EXPECT_EQ(0U, uploader_->results.size());
+  EXPECT_EQ(2, atomic_read64(&fn_processed.ncall));
+  EXPECT_EQ(uploaded.content_hash, fn_processed.last_result.content_hash);
+  EXPECT_EQ(uploaded.return_code, fn_processed.last_result.return_code);
+  ASSERT_EQ(uploaded.file_chunks.size(),
+            fn_processed.last_result.file_chunks.size());
+  for (unsigned i = 0; i < uploaded.file_chunks.size(); ++i) {
+    EXPECT_EQ(uploaded.file_chunks.At(i).content_hash(),
+              fn_processed.last_result.file_chunks.At(i).content_hash());
+  }
+
+  // Objects have disappeared from the backend storage
+  uploader_->peek_result = false;
+  pipeline = new IngestionPipeline(uploader_, spooler_definition);
+  pipeline->Spawn();
+  pipeline->Process(new FileIngestionSource(path_data), true);
+  pipeline->WaitFor();
+  pipeline.Destroy();
+  EXPECT_EQ(nobjects, uploader_->results.size());
+
+  // Different compression, processed again
+  uploader_->ClearResults();
+  uploader_->peek_result = true;
+  spooler_definition.compression_alg = zlib::kNoCompression;
+  pipeline = new IngestionPipeline(uploader_, spooler_definition);
+  pipeline->Spawn();
+  pipeline->Process(new FileIngestionSource(path_data), true);
+  pipeline->WaitFor();
+  pipeline.Destroy();
+  EXPECT_EQ(nobjects, uploader_->results.size());
+
+  // Different chunk sizes, processed again
+  uploader_->ClearResults();
+  spooler_definition.compression_alg = zlib::kZlibDefault;
+  spooler_definition.min_file_chunk_size *= 2;
+  spooler_definition.avg_file_chunk_size *= 2;
+  spooler_definition.max_file_chunk_size *= 2;
+  pipeline = new IngestionPipeline(uploader_, spooler_definition);
+  pipeline->Spawn();
+  pipeline->Process(new FileIngestionSource(path_data), true);
+  pipeline->WaitFor();
+  pipeline.Destroy();
+  EXPECT_GT(uploader_->results.size(), 0U);
+
+  EXPECT_TRUE(RemoveTree(tmp_path));
+}
+
+
 TEST_F(T_Ingestion, Scrubbing) {
   UniquePtr<ScrubbingPipeline> pipeline_scrubbing(new ScrubbingPipeline());
   FnFileHashed fn_hashed;
@@ -4,6 +4,8 @@
 
 #include <gtest/gtest.h>
 
+#include <pthread.h>
+
 #include <string>
 
 #include "lru.h"
@@ -569,3 +571,360 @@ TEST(T_LruCache, PauseAndResume) {
   EXPECT_TRUE(cache.IsEmpty());
   EXPECT_FALSE(cache.IsFull());
 }
+
+
+TEST(T_ShardedLruCache, InsertLookupForget) {
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics), 8, lru::kRecencyLru);
+  EXPECT_EQ(8U, cache.num_shards());
+  EXPECT_TRUE(cache.IsEmpty());
+
+  for (unsigned i = 1; i <= 100; ++i)
+    EXPECT_TRUE(cache.Insert(i, StringifyInt(i)));
+  EXPECT_FALSE(cache.Insert(42, "fourtytwo"));
+  EXPECT_FALSE(cache.IsEmpty());
+  EXPECT_FALSE(cache.IsFull());
+
+  std::string v;
+  EXPECT_TRUE(cache.Lookup(42, &v)); EXPECT_EQ("fourtytwo", v);
+  EXPECT_TRUE(cache.Lookup(7, &v)); EXPECT_EQ("7", v);
+  EXPECT_FALSE(cache.Lookup(101, &v));
+  EXPECT_TRUE(cache.UpdateValue(7, "sieben"));
+  EXPECT_FALSE(cache.UpdateValue(101, "x"));
+  EXPECT_TRUE(cache.Lookup(7, &v)); EXPECT_EQ("sieben", v);
+
+  EXPECT_TRUE(cache.Forget(7));
+  EXPECT_FALSE(cache.Forget(7));
+  EXPECT_FALSE(cache.Lookup(7, &v));
+
+  lru::Counters counters = cache.counters();
+  EXPECT_EQ(100, counters.n_insert->Get());
+  EXPECT_EQ(3, counters.n_hit->Get());
+  EXPECT_EQ(2, counters.n_miss->Get());
+  EXPECT_EQ(1, counters.n_forget->Get());
+
+  cache.Pause();
+  EXPECT_FALSE(cache.Insert(200, "x"));
+  EXPECT_FALSE(cache.Lookup(42, &v));
+  cache.Resume();
+  EXPECT_TRUE(cache.Lookup(42, &v));
+
+  cache.Drop();
+  EXPECT_TRUE(cache.IsEmpty());
+  EXPECT_FALSE(cache.Lookup(42, &v));
+}
+
+
+TEST(T_ShardedLruCache, LeastRecentlyUsedReplacement) {
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(64, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics), 4, lru::kRecencyLru);
+  // With the identity hash, shard i holds the keys that are i modulo 4
+  for (unsigned i = 0; i < 64; ++i)
+    cache.Insert(i, StringifyInt(i));
+  EXPECT_TRUE(cache.IsFull());
+
+  std::string v;
+  EXPECT_TRUE(cache.Lookup(0, &v));
+  EXPECT_TRUE(cache.Lookup(8, &v, false));
+  // Replaces 4 and 8 from shard 0, the other shards are unaffected
+  cache.Insert(64, "64");
+  cache.Insert(68, "68");
+  EXPECT_TRUE(cache.Lookup(0, &v));
+  EXPECT_FALSE(cache.Lookup(4, &v));
+  EXPECT_FALSE(cache.Lookup(8, &v));
+  EXPECT_TRUE(cache.Lookup(12, &v));
+  EXPECT_TRUE(cache.Lookup(1, &v));
+  EXPECT_EQ(2, cache.counters().n_replace->Get());
+}
+
+
+TEST(T_ShardedLruCache, ClockReplacement) {
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(64, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics), 1, lru::kRecencyClock);
+  for (unsigned i = 0; i < 64; ++i)
+    cache.Insert(i, StringifyInt(i));
+
+  std::string v;
+  EXPECT_TRUE(cache.Lookup(0, &v));
+  EXPECT_TRUE(cache.Lookup(2, &v));
+  EXPECT_TRUE(cache.Lookup(3, &v, false));
+  // 0 and 2 get a second chance
+  cache.Insert(64, "64");
+  cache.Insert(65, "65");
+  cache.Insert(66, "66");
+  EXPECT_TRUE(cache.Lookup(0, &v, false));
+  EXPECT_FALSE(cache.Lookup(1, &v));
+  EXPECT_TRUE(cache.Lookup(2, &v, false));
+  EXPECT_FALSE(cache.Lookup(3, &v));
+  EXPECT_FALSE(cache.Lookup(4, &v));
+  EXPECT_TRUE(cache.Lookup(5, &v, false));
+
+  // Reference bits were cleared, so 0 and 2 age normally
+  for (unsigned i = 67; i < 67 + 62; ++i)
+    cache.Insert(i, StringifyInt(i));
+  EXPECT_FALSE(cache.Lookup(0, &v));
+  EXPECT_FALSE(cache.Lookup(2, &v));
+}
+
+
+TEST(T_ShardedLruCache, Filter) {
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics), 4, lru::kRecencyClock);
+
+  // Empty cache
+  cache.FilterBegin();
+  EXPECT_FALSE(cache.FilterNext());
+  cache.FilterEnd();
+
+  for (unsigned i = 0; i < 10; ++i)
+    cache.Insert(i, StringifyInt(i));
+  int key;
+  std::string value;
+  unsigned visited = 0;
+  cache.FilterBegin();
+  while (cache.FilterNext()) {
+    cache.FilterGet(&key, &value);
+    EXPECT_EQ(StringifyInt(key), value);
+    visited++;
+    if (key % 2 == 0)
+      cache.FilterDelete();
+  }
+  cache.FilterEnd();
+  EXPECT_EQ(10U, visited);
+
+  for (int i = 0; i < 10; ++i)
+    EXPECT_EQ(i % 2 == 1, cache.Lookup(i, &value));
+}
+
+
+namespace {
+
+struct ConcurrentLruInfo {
+  lru::ShardedLruCache<int, std::string> *cache;
+  int offset;
+};
+
+void *MainConcurrentLru(void *data) {
+  ConcurrentLruInfo *info = static_cast<ConcurrentLruInfo *>(data);
+  std::string v;
+  for (int i = 0; i < 10000; ++i) {
+    const int key = info->offset + (i % 500);
+    if (!info->cache->Lookup(key, &v))
+      info->cache->Insert(key, StringifyInt(key));
+    else
+      EXPECT_EQ(StringifyInt(key), v);
+    if (i % 7 == 0)
+      info->cache->Forget(key);
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+TEST(T_ShardedLruCache, Concurrent) {
+  const unsigned kNumThreads = 8;
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics), 4, lru::kRecencyClock);
+
+  pthread_t threads[kNumThreads];
+  ConcurrentLruInfo infos[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    infos[i].cache = &cache;
+    infos[i].offset = (i % 2) * 250;
+    int retval = pthread_create(&threads[i], NULL, MainConcurrentLru,
+                                &infos[i]);
+    ASSERT_EQ(0, retval);
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(threads[i], NULL);
+
+  lru::Counters counters = cache.counters();
+  EXPECT_EQ(kNumThreads * 10000,
+            counters.n_hit->Get() + counters.n_miss->Get());
+}
+
+
+TEST(T_TinyLfuPolicy, Frequency) {
+  perf::Statistics statistics;
+  lru::TinyLfuPolicy policy(64, perf::StatisticsTemplate("tinylfu",
+                                                         &statistics));
+  EXPECT_EQ(0U, policy.Frequency(1));
+  policy.RecordAccess(1, false);
+  policy.RecordAccess(1, false);
+  policy.RecordAccess(2, false);
+  EXPECT_EQ(2U, policy.Frequency(1));
+  EXPECT_EQ(1U, policy.Frequency(2));
+  for (unsigned i = 0; i < 100; ++i)
+    policy.RecordAccess(3, false);
+  EXPECT_EQ(16U, policy.Frequency(3));
+
+  EXPECT_TRUE(policy.Admit(1, 2));
+  EXPECT_FALSE(policy.Admit(2, 1));
+  // Ties are admitted
+  EXPECT_TRUE(policy.Admit(1, 1));
+  EXPECT_EQ(2, statistics.Lookup("tinylfu.n_admit")->Get());
+  EXPECT_EQ(1, statistics.Lookup("tinylfu.n_reject")->Get());
+
+  // The 640th access triggers aging, which also clears the doorkeeper
+  for (unsigned i = 1000; i < 1000 + 640 - 103; ++i)
+    policy.RecordAccess(i, false);
+  EXPECT_EQ(1, statistics.Lookup("tinylfu.n_age")->Get());
+  EXPECT_EQ(0U, policy.Frequency(3));
+  policy.RecordAccess(3, true);
+  EXPECT_EQ(8U, policy.Frequency(3));
+
+  EXPECT_EQ(1, statistics.Lookup("tinylfu.n_hit")->Get());
+  EXPECT_EQ(640, statistics.Lookup("tinylfu.n_miss")->Get());
+}
+
+
+TEST(T_LruCache, ScanResistance) {
+  perf::Statistics statistics;
+  LruCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics));
+  cache.SetAdmissionPolicy(new lru::TinyLfuPolicy(cache_size,
+    perf::StatisticsTemplate("tinylfu", &statistics)));
+
+  std::string v;
+  // Working set, used twice
+  for (unsigned round = 0; round < 2; ++round) {
+    for (int i = 0; i < static_cast<int>(cache_size); ++i) {
+      if (!cache.Lookup(i, &v))
+        cache.Insert(i, StringifyInt(i));
+    }
+  }
+  // Scan over other keys, each used once.  The sketch overestimates
+  // frequencies on hash collisions, so a few scanned keys get in.
+  for (int i = cache_size; i < 4 * static_cast<int>(cache_size); ++i) {
+    if (!cache.Lookup(i, &v))
+      cache.Insert(i, StringifyInt(i));
+  }
+  unsigned hits = 0;
+  for (int i = 0; i < static_cast<int>(cache_size); ++i)
+    hits += cache.Lookup(i, &v) ? 1 : 0;
+  EXPECT_GE(hits, cache_size * 95 / 100);
+  EXPECT_GE(statistics.Lookup("tinylfu.n_reject")->Get(),
+            static_cast<int64_t>(3 * cache_size * 95 / 100));
+
+  // A key that is used often enough gets in
+  for (unsigned i = 0; i < 10; ++i)
+    EXPECT_FALSE(cache.Lookup(100000, &v));
+  EXPECT_TRUE(cache.Insert(100000, "x"));
+  EXPECT_TRUE(cache.Lookup(100000, &v));
+  EXPECT_EQ(cache.counters().n_hit->Get(),
+            statistics.Lookup("tinylfu.n_hit")->Get());
+  EXPECT_EQ(cache.counters().n_miss->Get(),
+            statistics.Lookup("tinylfu.n_miss")->Get());
+}
+
+
+TEST(T_LruCache, ShiftedWorkingSet) {
+  perf::Statistics statistics;
+  LruCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics));
+  cache.SetAdmissionPolicy(new lru::TinyLfuPolicy(cache_size,
+    perf::StatisticsTemplate("tinylfu", &statistics)));
+
+  std::string v;
+  // Old working set, used until its frequencies saturate
+  for (unsigned round = 0; round < 20; ++round) {
+    for (int i = 0; i < static_cast<int>(cache_size); ++i) {
+      if (!cache.Lookup(i, &v))
+        cache.Insert(i, StringifyInt(i));
+    }
+  }
+  // The working set moves to other keys, which are as popular as the old
+  // ones were.  They have to replace the old working set eventually.
+  const int begin = cache_size;
+  const int end = 2 * cache_size;
+  for (unsigned round = 0; round < 20; ++round) {
+    for (int i = begin; i < end; ++i) {
+      if (!cache.Lookup(i, &v))
+        cache.Insert(i, StringifyInt(i));
+    }
+  }
+  unsigned hits = 0;
+  for (int i = begin; i < end; ++i)
+    hits += cache.Lookup(i, &v) ? 1 : 0;
+  EXPECT_GE(hits, cache_size * 95 / 100);
+}
+
+
+TEST(T_ShardedLruCache, ScanResistance) {
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(cache_size, -1, hasher_int,
+      perf::StatisticsTemplate(name, &statistics), 4, lru::kRecencyClock);
+  cache.SetAdmissionPolicy(new lru::TinyLfuPolicy(cache_size,
+    perf::StatisticsTemplate("tinylfu", &statistics)));
+
+  std::string v;
+  for (unsigned round = 0; round < 2; ++round) {
+    for (int i = 0; i < static_cast<int>(cache_size); ++i) {
+      if (!cache.Lookup(i, &v))
+        cache.Insert(i, StringifyInt(i));
+    }
+  }
+  for (int i = cache_size; i < 4 * static_cast<int>(cache_size); ++i) {
+    if (!cache.Lookup(i, &v))
+      cache.Insert(i, StringifyInt(i));
+  }
+  unsigned hits = 0;
+  for (int i = 0; i < static_cast<int>(cache_size); ++i)
+    hits += cache.Lookup(i, &v) ? 1 : 0;
+  EXPECT_GE(hits, cache_size * 95 / 100);
+  EXPECT_GE(statistics.Lookup("tinylfu.n_reject")->Get(),
+            static_cast<int64_t>(3 * cache_size * 95 / 100));
+}
+
+
+namespace {
+
+class RejectAllPolicy : public lru::AdmissionPolicy {
+ public:
+  virtual void RecordAccess(const uint32_t hash, const bool hit) { }
+  virtual bool Admit(const uint32_t candidate, const uint32_t victim) {
+    return false;
+  }
+};
+
+}  // anonymous namespace
+
+
+TEST(T_ShardedLruCache, ClockRejectKeepsReferences) {
+  perf::Statistics statistics;
+  lru::ShardedLruCache<int, std::string> cache(4, -1, hasher_int,
+      perf::StatisticsTemplate("with_reject", &statistics), 1,
+      lru::kRecencyClock);
+  lru::ShardedLruCache<int, std::string> reference(4, -1, hasher_int,
+      perf::StatisticsTemplate("without_reject", &statistics), 1,
+      lru::kRecencyClock);
+
+  std::string v;
+  for (int i = 0; i < 4; ++i) {
+    cache.Insert(i, StringifyInt(i));
+    reference.Insert(i, StringifyInt(i));
+  }
+  EXPECT_TRUE(cache.Lookup(0, &v));
+  EXPECT_TRUE(reference.Lookup(0, &v));
+
+  // A rejected candidate must not advance the clock hand
+  cache.SetAdmissionPolicy(new RejectAllPolicy());
+  EXPECT_FALSE(cache.Insert(100, "x"));
+  cache.SetAdmissionPolicy(NULL);
+
+  EXPECT_TRUE(cache.Lookup(0, &v));
+  EXPECT_TRUE(reference.Lookup(0, &v));
+  for (int i = 4; i < 8; ++i) {
+    EXPECT_TRUE(cache.Insert(i, StringifyInt(i)));
+    EXPECT_TRUE(reference.Insert(i, StringifyInt(i)));
+  }
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(reference.Lookup(i, &v, false), cache.Lookup(i, &v, false))
+      << "key " << i;
+  }
+}
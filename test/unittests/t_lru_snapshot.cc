@@ -0,0 +1,296 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <string>
+
+#include "../common/testutil.h"
+#include "directory_entry.h"
+#include "hash.h"
+#include "lru_md.h"
+#include "lru_snapshot.h"
+#include "statistics.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+namespace lru {
+
+/**
+ * Issues the inodes 1000 to 1999 for the catalog mounted on /nested
+ */
+class MockInodeResolver : public InodeResolver {
+ public:
+  static const uint64_t kOffset = 999;
+  explicit MockInodeResolver(const shash::Any &hash) : hash_(hash) { }
+  virtual bool Relativize(const uint64_t inode,
+                          PathString *catalog_mountpoint,
+                          shash::Any *catalog_hash,
+                          uint64_t *relative_inode)
+  {
+    if ((inode <= kOffset) || (inode >= 2000))
+      return false;
+    *catalog_mountpoint = PathString("/nested");
+    *catalog_hash = hash_;
+    *relative_inode = inode - kOffset;
+    return true;
+  }
+
+ private:
+  shash::Any hash_;
+};
+
+
+/**
+ * The same catalog after a remount, with a different inode range
+ */
+class MockCatalog {
+ public:
+  MockCatalog(const string &mountpoint, const shash::Any &hash,
+              const uint64_t offset)
+    : mountpoint_(PathString(mountpoint)), hash_(hash), offset_(offset) { }
+  PathString mountpoint() const { return mountpoint_; }
+  shash::Any hash() const { return hash_; }
+  catalog::inode_t GetMangledInode(const uint64_t row_id,
+                                   const uint64_t hardlink_group) const
+  {
+    return row_id + offset_;
+  }
+
+ private:
+  PathString mountpoint_;
+  shash::Any hash_;
+  uint64_t offset_;
+};
+
+
+class T_Md5PathSnapshot : public ::testing::Test {
+ protected:
+  static const unsigned kCacheSize = 1024;
+
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_lru_snapshot");
+    ASSERT_FALSE(tmp_path_.empty());
+    cache_ = new Md5PathCache(kCacheSize, &statistics_, 4);
+    restored_ = new Md5PathCache(kCacheSize, &statistics_restored_, 4);
+    root_hash_ = shash::Any(shash::kSha1);
+    root_hash_.Randomize();
+    root_hash_.suffix = shash::kSuffixCatalog;
+
+    regular_ = catalog::DirectoryEntryTestFactory::RegularFile("regular", 42,
+                                                               RandomHash());
+    regular_.set_inode(1000);
+    regular_.set_hardlink_group(3);
+    directory_ = catalog::DirectoryEntryTestFactory::Directory("dir", 4096,
+      shash::Any(), true);
+    directory_.set_inode(1001);
+    symlink_ = catalog::DirectoryEntryTestFactory::Symlink("link", 8,
+                                                           "/cvmfs/target");
+    symlink_.set_inode(1002);
+    chunked_ = catalog::DirectoryEntryTestFactory::ChunkedFile(RandomHash());
+    chunked_.set_inode(1003);
+  }
+
+  virtual void TearDown() {
+    delete cache_;
+    delete restored_;
+    RemoveTree(tmp_path_);
+  }
+
+  static shash::Any RandomHash() {
+    shash::Any hash(shash::kSha1);
+    hash.Randomize();
+    return hash;
+  }
+
+  static shash::Md5 Md5(const string &path) {
+    return shash::Md5(path.data(), path.length());
+  }
+
+  void Populate() {
+    cache_->Insert(Md5("/regular"), regular_);
+    cache_->Insert(Md5("/dir"), directory_);
+    cache_->Insert(Md5("/dir/link"), symlink_);
+    cache_->Insert(Md5("/chunked"), chunked_);
+    cache_->InsertNegative(Md5("/enoent"));
+  }
+
+  void ExpectRestored(const string &path,
+                      const catalog::DirectoryEntry &expected)
+  {
+    catalog::DirectoryEntry dirent;
+    ASSERT_TRUE(restored_->Lookup(Md5(path), &dirent)) << path;
+    EXPECT_EQ(catalog::inode_t(catalog::DirectoryEntry::kInvalidInode),
+              dirent.inode()) << path;
+    dirent.set_inode(expected.inode());
+    EXPECT_TRUE(dirent == expected) << path;
+    EXPECT_EQ(expected.IsChunkedFile(), dirent.IsChunkedFile()) << path;
+  }
+
+  string tmp_path_;
+  perf::Statistics statistics_;
+  perf::Statistics statistics_restored_;
+  Md5PathCache *cache_;
+  Md5PathCache *restored_;
+  shash::Any root_hash_;
+  catalog::DirectoryEntry regular_;
+  catalog::DirectoryEntry directory_;
+  catalog::DirectoryEntry symlink_;
+  catalog::DirectoryEntry chunked_;
+};
+
+
+TEST_F(T_Md5PathSnapshot, RoundTrip) {
+  Populate();
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, NULL));
+  EXPECT_EQ(5U, snapshot->num_entries());
+  EXPECT_EQ(root_hash_, snapshot->catalog_hash());
+
+  EXPECT_EQ(5U, snapshot->Restore(root_hash_, restored_, NULL));
+  ExpectRestored("/regular", regular_);
+  ExpectRestored("/dir", directory_);
+  ExpectRestored("/dir/link", symlink_);
+  ExpectRestored("/chunked", chunked_);
+  catalog::DirectoryEntry dirent;
+  EXPECT_TRUE(restored_->Lookup(Md5("/enoent"), &dirent));
+  EXPECT_TRUE(dirent.IsNegative());
+  EXPECT_FALSE(restored_->Lookup(Md5("/other"), &dirent));
+}
+
+
+TEST_F(T_Md5PathSnapshot, File) {
+  const string path = tmp_path_ + "/memcache";
+  EXPECT_EQ(NULL, Md5PathSnapshot::Open(path));
+
+  Populate();
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, NULL));
+  EXPECT_TRUE(snapshot->Write(path));
+
+  UniquePtr<Md5PathSnapshot> mapped(Md5PathSnapshot::Open(path));
+  ASSERT_TRUE(mapped.IsValid());
+  EXPECT_EQ(snapshot->size(), mapped->size());
+  EXPECT_EQ(root_hash_, mapped->catalog_hash());
+  EXPECT_EQ(5U, mapped->Restore(root_hash_, restored_, NULL));
+  ExpectRestored("/regular", regular_);
+  ExpectRestored("/dir/link", symlink_);
+}
+
+
+TEST_F(T_Md5PathSnapshot, StaleCatalog) {
+  Populate();
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, NULL));
+  EXPECT_EQ(0U, snapshot->Restore(RandomHash(), restored_, NULL));
+  EXPECT_TRUE(restored_->IsEmpty());
+}
+
+
+TEST_F(T_Md5PathSnapshot, Corrupted) {
+  const string path = tmp_path_ + "/memcache";
+  EXPECT_TRUE(SafeWriteToFile("not a snapshot", path, 0600));
+  EXPECT_EQ(NULL, Md5PathSnapshot::Open(path));
+
+  Populate();
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, NULL));
+  EXPECT_TRUE(snapshot->Write(path));
+  // Cut the last entry in half
+  EXPECT_EQ(0, truncate(path.c_str(), snapshot->size() - 10));
+  UniquePtr<Md5PathSnapshot> mapped(Md5PathSnapshot::Open(path));
+  ASSERT_TRUE(mapped.IsValid());
+  EXPECT_EQ(4U, mapped->Restore(root_hash_, restored_, NULL));
+}
+
+
+TEST_F(T_Md5PathSnapshot, RelativeInodes) {
+  const shash::Any nested_hash = RandomHash();
+  MockInodeResolver resolver(nested_hash);
+  Populate();
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, &resolver));
+  const string path = tmp_path_ + "/memcache";
+  EXPECT_TRUE(snapshot->Write(path));
+  UniquePtr<Md5PathSnapshot> mapped(Md5PathSnapshot::Open(path));
+  ASSERT_TRUE(mapped.IsValid());
+
+  Md5PathRestorer restorer(restored_);
+  EXPECT_EQ(5U, mapped->Restore(root_hash_, restored_, &restorer));
+  // The hard link and the negative entry have no catalog
+  EXPECT_EQ(3U, restorer.num_pending());
+  ExpectRestored("/dir", directory_);
+
+  // Other catalogs and other revisions of the catalog don't match
+  restorer.OnCatalog(MockCatalog("", nested_hash, 5000));
+  EXPECT_EQ(3U, restorer.num_pending());
+  restorer.OnCatalog(MockCatalog("/nested", nested_hash, 5000));
+  EXPECT_EQ(0U, restorer.num_pending());
+
+  catalog::DirectoryEntry dirent;
+  ASSERT_TRUE(restored_->Lookup(Md5("/dir"), &dirent));
+  EXPECT_EQ(catalog::inode_t(5000 + 1001 - MockInodeResolver::kOffset),
+            dirent.inode());
+  dirent.set_inode(directory_.inode());
+  EXPECT_TRUE(dirent == directory_);
+  ASSERT_TRUE(restored_->Lookup(Md5("/dir/link"), &dirent));
+  EXPECT_EQ(catalog::inode_t(5000 + 1002 - MockInodeResolver::kOffset),
+            dirent.inode());
+  ExpectRestored("/regular", regular_);
+
+  // A new revision of the catalog
+  Md5PathRestorer stale_restorer(restored_);
+  restored_->Drop();
+  EXPECT_EQ(5U, mapped->Restore(root_hash_, restored_, &stale_restorer));
+  stale_restorer.OnCatalog(MockCatalog("/nested", RandomHash(), 5000));
+  EXPECT_EQ(0U, stale_restorer.num_pending());
+  ExpectRestored("/dir", directory_);
+}
+
+
+TEST_F(T_Md5PathSnapshot, RestoreEvicted) {
+  const shash::Any nested_hash = RandomHash();
+  MockInodeResolver resolver(nested_hash);
+  Populate();
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, &resolver));
+
+  Md5PathRestorer restorer(restored_);
+  EXPECT_EQ(5U, snapshot->Restore(root_hash_, restored_, &restorer));
+  EXPECT_TRUE(restored_->Forget(Md5("/dir")));
+  restorer.OnCatalog(MockCatalog("/nested", nested_hash, 5000));
+
+  catalog::DirectoryEntry dirent;
+  EXPECT_FALSE(restored_->Lookup(Md5("/dir"), &dirent));
+  ASSERT_TRUE(restored_->Lookup(Md5("/chunked"), &dirent));
+  EXPECT_EQ(catalog::inode_t(5000 + 1003 - MockInodeResolver::kOffset),
+            dirent.inode());
+}
+
+
+TEST_F(T_Md5PathSnapshot, Recency) {
+  // With the same number of shards, the most recently used entries survive
+  // when the snapshot is restored into a smaller cache
+  perf::Statistics statistics;
+  Md5PathCache small_cache(64, &statistics, 4);
+  for (unsigned i = 0; i < 128; ++i) {
+    regular_.set_inode(i + 1);
+    cache_->Insert(Md5("/file" + StringifyInt(i)), regular_);
+  }
+  UniquePtr<Md5PathSnapshot> snapshot(
+    Md5PathSnapshot::Create(root_hash_, cache_, NULL));
+  EXPECT_EQ(128U, snapshot->num_entries());
+  snapshot->Restore(root_hash_, &small_cache, NULL);
+
+  catalog::DirectoryEntry dirent;
+  EXPECT_TRUE(small_cache.Lookup(Md5("/file127"), &dirent));
+  EXPECT_FALSE(small_cache.Lookup(Md5("/file0"), &dirent));
+}
+
+}  // namespace lru
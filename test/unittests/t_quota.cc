@@ -16,6 +16,7 @@
 #include "fs_traversal.h"
 #include "hash.h"
 #include "quota_posix.h"
+#include "quota_trash.h"
 #include "testutil.h"
 #include "util/algorithm.h"
 
@@ -550,3 +551,129 @@ TEST_F(T_QuotaManager, Touch) {
   quota_mgr_->Cleanup(1);
   EXPECT_EQ("a\n", PrintStringVector(quota_mgr_->List()));
 }
+
+
+TEST_F(T_QuotaManager, IndexBackend) {
+  delete quota_mgr_;
+  quota_mgr_ = PosixQuotaManager::Create(tmp_path_, limit_, threshold_, false,
+                                         PosixQuotaManager::kBackendMemory);
+  ASSERT_TRUE(quota_mgr_ != NULL);
+  EXPECT_TRUE(quota_mgr_->index_ != NULL);
+  EXPECT_FALSE(FileExists(tmp_path_ + "/cachedb"));
+  quota_mgr_->Spawn();
+  quota_mgr_->async_delete_ = false;
+
+  quota_mgr_->Insert(hashes_[0], 1, "regular");
+  quota_mgr_->InsertVolatile(hashes_[1], 1, "volatile");
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[2], 1, "pinned", false));
+  EXPECT_TRUE(quota_mgr_->Pin(hashes_[3], 1, "catalog", true));
+  EXPECT_EQ(4U, quota_mgr_->GetSize());
+  EXPECT_EQ("regular\nvolatile\npinned\n",
+            PrintStringVector(quota_mgr_->List()));
+  EXPECT_EQ("catalog\n", PrintStringVector(quota_mgr_->ListCatalogs()));
+  EXPECT_EQ("pinned\ncatalog\n", PrintStringVector(quota_mgr_->ListPinned()));
+  EXPECT_EQ("volatile\n", PrintStringVector(quota_mgr_->ListVolatile()));
+  EXPECT_TRUE(quota_mgr_->Contains(hashes_[0].ToString()));
+  EXPECT_FALSE(quota_mgr_->Contains(hashes_[4].ToString()));
+
+  quota_mgr_->Remove(hashes_[3]);
+  EXPECT_EQ(3U, quota_mgr_->GetSize());
+  // Volatile entries first, the pinned entry stays
+  EXPECT_TRUE(quota_mgr_->Cleanup(1));
+  EXPECT_EQ("pinned\n", PrintStringVector(quota_mgr_->List()));
+  EXPECT_EQ(1U, quota_mgr_->GetSize());
+
+  // The index survives a restart
+  quota_mgr_->Insert(hashes_[4], 1, "x");
+  delete quota_mgr_;
+  quota_mgr_ = PosixQuotaManager::Create(tmp_path_, limit_, threshold_, false,
+                                         PosixQuotaManager::kBackendMemory);
+  ASSERT_TRUE(quota_mgr_ != NULL);
+  quota_mgr_->Spawn();
+  EXPECT_EQ(2U, quota_mgr_->GetSize());
+  vector<string> content = quota_mgr_->List();
+  sort(content.begin(), content.end());
+  EXPECT_EQ("pinned\nx\n", PrintStringVector(content));
+
+  // Switching the backend rebuilds the bookkeeping from the cache directory
+  delete quota_mgr_;
+  unsigned char buf = 'x';
+  EXPECT_TRUE(CopyMem2Path(&buf, 1, tmp_path_ + "/" + hashes_[5].MakePath()));
+  quota_mgr_ = PosixQuotaManager::Create(tmp_path_, limit_, threshold_, false);
+  ASSERT_TRUE(quota_mgr_ != NULL);
+  quota_mgr_->Spawn();
+  EXPECT_FALSE(FileExists(tmp_path_ + "/cacheidx"));
+  EXPECT_EQ(1U, quota_mgr_->GetSize());
+  delete quota_mgr_;
+  quota_mgr_ = PosixQuotaManager::Create(tmp_path_, limit_, threshold_, false,
+                                         PosixQuotaManager::kBackendMemory);
+  ASSERT_TRUE(quota_mgr_ != NULL);
+  quota_mgr_->Spawn();
+  EXPECT_EQ(1U, quota_mgr_->GetSize());
+  EXPECT_EQ("unknown (automatic rebuild)\n",
+            PrintStringVector(quota_mgr_->List()));
+}
+
+
+TEST_F(T_QuotaManager, UnlinkThreads) {
+  for (unsigned i = 0; i < 4; ++i) {
+    CreateFile(tmp_path_ + "/" + hashes_[i].MakePath(), 0600);
+    quota_mgr_->Insert(hashes_[i], 1, "");
+  }
+  EXPECT_TRUE(quota_mgr_->Cleanup(2));
+  ASSERT_TRUE(quota_mgr_->trash_ != NULL);
+  quota_mgr_->trash_->WaitForEmpty();
+  EXPECT_FALSE(FileExists(tmp_path_ + "/" + hashes_[0].MakePath()));
+  EXPECT_FALSE(FileExists(tmp_path_ + "/" + hashes_[1].MakePath()));
+  EXPECT_TRUE(FileExists(tmp_path_ + "/" + hashes_[2].MakePath()));
+  EXPECT_TRUE(FileExists(tmp_path_ + "/" + hashes_[3].MakePath()));
+  EXPECT_EQ(2U, quota_mgr_->trash_->num_unlinked());
+
+  // With a rate of 1 file per second, the second eviction is delayed.  A new
+  // copy of the file that is inserted meanwhile must survive.
+  delete quota_mgr_;
+  quota_mgr_ = PosixQuotaManager::Create(tmp_path_, limit_, threshold_, false,
+                                         PosixQuotaManager::kBackendSqlite, 1);
+  ASSERT_TRUE(quota_mgr_ != NULL);
+  quota_mgr_->Spawn();
+  EXPECT_TRUE(quota_mgr_->Cleanup(1));
+  EXPECT_TRUE(quota_mgr_->Cleanup(0));
+  EXPECT_FALSE(FileExists(tmp_path_ + "/" + hashes_[3].MakePath()));
+  CreateFile(tmp_path_ + "/" + hashes_[3].MakePath(), 0600);
+  quota_mgr_->Insert(hashes_[3], 1, "");
+  EXPECT_EQ(1U, quota_mgr_->GetSize());
+  quota_mgr_->trash_->WaitForEmpty();
+  EXPECT_FALSE(FileExists(tmp_path_ + "/" + hashes_[2].MakePath()));
+  EXPECT_TRUE(FileExists(tmp_path_ + "/" + hashes_[3].MakePath()));
+  EXPECT_EQ(2U, quota_mgr_->trash_->num_unlinked());
+}
+
+
+TEST_F(T_QuotaManager, RebuildParallel) {
+  const unsigned N = 300;
+  uint64_t size = 0;
+  for (unsigned i = 0; i < N; ++i) {
+    shash::Any hash(shash::kSha1);
+    hash.Randomize(&prng_);
+    const string content(i % 7 + 1, 'x');
+    EXPECT_TRUE(SafeWriteToFile(content, tmp_path_ + "/" + hash.MakePath(),
+                                0600));
+    size += content.length();
+  }
+  shash::Any hash_empty(shash::kSha1);
+  hash_empty.Randomize(&prng_);
+  CreateFile(tmp_path_ + "/" + hash_empty.MakePath(), 0600);
+
+  PosixQuotaManager::Backend backends[] = {
+    PosixQuotaManager::kBackendSqlite, PosixQuotaManager::kBackendMemory };
+  for (unsigned i = 0; i < 2; ++i) {
+    delete quota_mgr_;
+    quota_mgr_ = PosixQuotaManager::Create(tmp_path_, limit_, threshold_, true,
+                                           backends[i]);
+    ASSERT_TRUE(quota_mgr_ != NULL);
+    quota_mgr_->Spawn();
+    EXPECT_EQ(size, quota_mgr_->GetSize());
+    EXPECT_EQ(N, quota_mgr_->List().size());
+    EXPECT_FALSE(FileExists(tmp_path_ + "/" + hash_empty.MakePath()));
+  }
+}
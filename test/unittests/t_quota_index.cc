@@ -0,0 +1,296 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "../common/testutil.h"
+#include "hash.h"
+#include "quota_index.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+#include "util/string.h"
+
+using namespace std;  // NOLINT
+
+class T_QuotaIndex : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_quota_index");
+    ASSERT_FALSE(tmp_path_.empty());
+    index_path_ = tmp_path_ + "/cacheidx";
+    index_ = QuotaIndex::Open(index_path_);
+    ASSERT_TRUE(index_ != NULL);
+
+    for (unsigned i = 0; i < 8; ++i) {
+      hashes_.push_back(shash::Any(shash::kSha1));
+      hashes_[i].digest[0] = i;
+    }
+  }
+
+  virtual void TearDown() {
+    delete index_;
+    RemoveTree(tmp_path_);
+  }
+
+  /**
+   * Simulates a crash: the checkpoint and the journal are reset to their
+   * state after the last commit, discarding the final checkpoint.
+   */
+  void Crash() {
+    const string journal = index_path_ + ".journal";
+    EXPECT_TRUE(index_->Commit());
+    EXPECT_TRUE(CopyPath2Path(index_path_, index_path_ + ".crash"));
+    EXPECT_TRUE(CopyPath2Path(journal, journal + ".crash"));
+    delete index_;
+    index_ = NULL;
+    EXPECT_EQ(0,
+              rename((index_path_ + ".crash").c_str(), index_path_.c_str()));
+    EXPECT_EQ(0, rename((journal + ".crash").c_str(), journal.c_str()));
+  }
+
+  void Insert(const unsigned i, const bool is_volatile = false) {
+    index_->Insert(hashes_[i], i + 1, seq_++, StringifyInt(i), false,
+                   is_volatile, false);
+  }
+
+  string PrintList(const QuotaIndex::ListType type) {
+    vector<string> lines = index_->List(type);
+    string result;
+    for (unsigned i = 0; i < lines.size(); ++i)
+      result += lines[i] + "\n";
+    return result;
+  }
+
+  shash::Any Lru() {
+    shash::Any hash;
+    uint64_t size;
+    EXPECT_TRUE(index_->GetLru(&hash, &size));
+    return hash;
+  }
+
+  string tmp_path_;
+  string index_path_;
+  QuotaIndex *index_;
+  vector<shash::Any> hashes_;
+  static uint64_t seq_;
+};
+
+uint64_t T_QuotaIndex::seq_ = 1;
+
+
+TEST_F(T_QuotaIndex, InsertTouchRemove) {
+  shash::Any hash;
+  uint64_t size;
+  bool is_pinned;
+  EXPECT_FALSE(index_->GetLru(&hash, &size));
+
+  Insert(0);
+  Insert(1);
+  Insert(2);
+  EXPECT_EQ(3U, index_->num_entries());
+  EXPECT_EQ(6U, index_->gauge());
+  EXPECT_TRUE(index_->Contains(hashes_[1]));
+  EXPECT_FALSE(index_->Contains(hashes_[3]));
+  EXPECT_TRUE(index_->Lookup(hashes_[1], &size, &is_pinned));
+  EXPECT_EQ(2U, size);
+  EXPECT_FALSE(is_pinned);
+
+  EXPECT_EQ(hashes_[0], Lru());
+  index_->Touch(hashes_[0], seq_++);
+  EXPECT_EQ(hashes_[1], Lru());
+  // Unknown entries are ignored
+  index_->Touch(hashes_[3], seq_++);
+  EXPECT_EQ(3U, index_->num_entries());
+
+  EXPECT_TRUE(index_->Remove(hashes_[1]));
+  EXPECT_FALSE(index_->Remove(hashes_[1]));
+  EXPECT_EQ(hashes_[2], Lru());
+  EXPECT_EQ(4U, index_->gauge());
+
+  // Replacing an entry updates the gauge
+  index_->Insert(hashes_[2], 10, seq_++, "2", false, false, false);
+  EXPECT_EQ(11U, index_->gauge());
+  EXPECT_EQ(2U, index_->num_entries());
+  EXPECT_EQ(hashes_[0], Lru());
+  EXPECT_EQ(seq_ - 1, index_->max_seq());
+}
+
+
+TEST_F(T_QuotaIndex, Volatile) {
+  Insert(0);
+  Insert(1, true);
+  Insert(2);
+  Insert(3, true);
+  EXPECT_EQ(hashes_[1], Lru());
+  // Touching keeps volatile entries volatile
+  index_->Touch(hashes_[1], seq_++);
+  EXPECT_EQ(hashes_[3], Lru());
+  EXPECT_EQ("3\n1\n", PrintList(QuotaIndex::kListVolatile));
+  index_->Remove(hashes_[3]);
+  index_->Remove(hashes_[1]);
+  EXPECT_EQ(hashes_[0], Lru());
+}
+
+
+TEST_F(T_QuotaIndex, Block) {
+  Insert(0);
+  Insert(1);
+  Insert(2, true);
+  index_->Block(hashes_[2]);
+  index_->Block(hashes_[0]);
+  EXPECT_EQ(hashes_[1], Lru());
+  EXPECT_EQ("0\n2\n", PrintList(QuotaIndex::kListPinned));
+
+  index_->UnblockAll();
+  EXPECT_EQ(hashes_[2], Lru());
+  index_->Remove(hashes_[2]);
+  EXPECT_EQ(hashes_[0], Lru());
+  // Blocked entries remain pinned
+  EXPECT_EQ("0\n", PrintList(QuotaIndex::kListPinned));
+  index_->Unpin(hashes_[0]);
+  EXPECT_EQ("", PrintList(QuotaIndex::kListPinned));
+}
+
+
+TEST_F(T_QuotaIndex, List) {
+  EXPECT_EQ("", PrintList(QuotaIndex::kListRegular));
+  index_->Insert(hashes_[0], 1, seq_++, "regular", false, false, false);
+  index_->Insert(hashes_[1], 1, seq_++, "volatile", false, true, false);
+  index_->Insert(hashes_[2], 1, seq_++, "pinned", false, false, true);
+  index_->Insert(hashes_[3], 1, seq_++, "catalog", true, false, true);
+  EXPECT_EQ("regular\nvolatile\npinned\n",
+            PrintList(QuotaIndex::kListRegular));
+  EXPECT_EQ("catalog\n", PrintList(QuotaIndex::kListCatalogs));
+  EXPECT_EQ("pinned\ncatalog\n", PrintList(QuotaIndex::kListPinned));
+  EXPECT_EQ("volatile\n", PrintList(QuotaIndex::kListVolatile));
+
+  // Listings are in the order of the last access
+  index_->Touch(hashes_[0], seq_++);
+  EXPECT_EQ("volatile\npinned\nregular\n",
+            PrintList(QuotaIndex::kListRegular));
+}
+
+
+TEST_F(T_QuotaIndex, Reopen) {
+  Insert(0);
+  Insert(1, true);
+  index_->Insert(hashes_[2], 3, seq_++, "2", true, false, true);
+  Insert(3);
+  index_->Touch(hashes_[0], seq_++);
+  index_->Remove(hashes_[3]);
+  delete index_;
+
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ(3U, index_->num_entries());
+  EXPECT_EQ(6U, index_->gauge());
+  EXPECT_EQ(seq_ - 1, index_->max_seq());
+  EXPECT_EQ(hashes_[1], Lru());
+  index_->Remove(hashes_[1]);
+  EXPECT_EQ(hashes_[2], Lru());
+  EXPECT_EQ("2\n", PrintList(QuotaIndex::kListCatalogs));
+  // Pinning is not persistent
+  EXPECT_EQ("", PrintList(QuotaIndex::kListPinned));
+}
+
+
+TEST_F(T_QuotaIndex, Recover) {
+  Insert(0);
+  Insert(1);
+  Insert(2);
+  EXPECT_TRUE(index_->Checkpoint());
+  index_->Touch(hashes_[0], seq_++);
+  index_->Remove(hashes_[1]);
+  Insert(3);
+  Crash();
+  EXPECT_GT(GetFileSize(index_path_ + ".journal"), 12);
+
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ(3U, index_->num_entries());
+  EXPECT_EQ("2\n0\n3\n", PrintList(QuotaIndex::kListRegular));
+  EXPECT_EQ(hashes_[2], Lru());
+
+  // Replaying a journal that is already part of the checkpoint is harmless
+  const string journal = index_path_ + ".journal";
+  index_->Touch(hashes_[2], seq_++);
+  index_->Remove(hashes_[3]);
+  EXPECT_TRUE(index_->Commit());
+  EXPECT_TRUE(CopyPath2Path(journal, journal + ".save"));
+  EXPECT_TRUE(index_->Checkpoint());
+  Crash();
+  EXPECT_EQ(0, rename((journal + ".save").c_str(), journal.c_str()));
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ("0\n2\n", PrintList(QuotaIndex::kListRegular));
+  EXPECT_EQ(hashes_[0], Lru());
+}
+
+
+TEST_F(T_QuotaIndex, TornJournal) {
+  Insert(0);
+  Insert(1);
+  Crash();
+  const string journal = index_path_ + ".journal";
+  const int64_t size = GetFileSize(journal);
+  EXPECT_EQ(0, truncate(journal.c_str(), size - 1));
+
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ(1U, index_->num_entries());
+  EXPECT_TRUE(index_->Contains(hashes_[0]));
+  // The journal starts over after recovery
+  Insert(2);
+  Crash();
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ("0\n2\n", PrintList(QuotaIndex::kListRegular));
+}
+
+
+TEST_F(T_QuotaIndex, Corrupted) {
+  Insert(0);
+  delete index_;
+  EXPECT_TRUE(SafeWriteToFile("not an index", index_path_, 0600));
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ(0U, index_->num_entries());
+
+  delete index_;
+  index_ = QuotaIndex::Open(tmp_path_ + "/noent/cacheidx");
+  EXPECT_EQ(NULL, index_);
+}
+
+
+TEST_F(T_QuotaIndex, Checkpoint) {
+  Insert(0);
+  Insert(1);
+  EXPECT_TRUE(index_->Commit());
+  const string journal = index_path_ + ".journal";
+  const int64_t journal_size = GetFileSize(journal);
+  const int64_t checkpoint_size = GetFileSize(index_path_);
+  EXPECT_GT(journal_size, checkpoint_size);
+
+  // The journal is condensed into a new checkpoint once it becomes long
+  for (unsigned i = 0; i < QuotaIndex::kMinCheckpointRecords - 3; ++i)
+    index_->Touch(hashes_[i % 2], seq_++);
+  EXPECT_TRUE(index_->Commit());
+  EXPECT_GT(GetFileSize(journal), journal_size);
+  index_->Touch(hashes_[1], seq_++);
+  index_->Touch(hashes_[0], seq_++);
+  EXPECT_TRUE(index_->Commit());
+  EXPECT_LT(GetFileSize(journal), journal_size);
+  EXPECT_GT(GetFileSize(index_path_), checkpoint_size);
+  Crash();
+
+  index_ = QuotaIndex::Open(index_path_);
+  ASSERT_TRUE(index_ != NULL);
+  EXPECT_EQ(2U, index_->num_entries());
+  EXPECT_EQ(hashes_[1], Lru());
+}
@@ -0,0 +1,111 @@
+/**
+ * This file is part of the CernVM File System.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "../common/testutil.h"
+#include "hash.h"
+#include "quota_trash.h"
+#include "util/pointer.h"
+#include "util/posix.h"
+
+using namespace std;  // NOLINT
+
+class T_QuotaTrash : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    tmp_path_ = CreateTempDir("./cvmfs_ut_quota_trash");
+    ASSERT_FALSE(tmp_path_.empty());
+    for (unsigned i = 0; i < 16; ++i) {
+      hashes_.push_back(shash::Any(shash::kSha1));
+      hashes_[i].digest[0] = i;
+      hashes_[i].digest[1] = i;
+      MkdirDeep(GetParentPath(Path(i)), 0700);
+      CreateFile(Path(i), 0600);
+    }
+  }
+
+  virtual void TearDown() {
+    RemoveTree(tmp_path_);
+  }
+
+  string Path(const unsigned i) {
+    return tmp_path_ + "/" + hashes_[i].MakePath();
+  }
+
+  unsigned NumTrashFiles() {
+    return FindFilesByPrefix(tmp_path_ + "/txn", QuotaTrash::kTrashPrefix)
+      .size();
+  }
+
+  string tmp_path_;
+  vector<shash::Any> hashes_;
+};
+
+
+TEST_F(T_QuotaTrash, Unlink) {
+  UniquePtr<QuotaTrash> trash(QuotaTrash::Create(tmp_path_, 4, 0));
+  ASSERT_TRUE(trash.IsValid());
+  for (unsigned i = 0; i < 8; ++i)
+    trash->Add(hashes_[i]);
+  trash->WaitForEmpty();
+  for (unsigned i = 0; i < 8; ++i)
+    EXPECT_FALSE(FileExists(Path(i)));
+  EXPECT_TRUE(FileExists(Path(8)));
+  EXPECT_EQ(8U, trash->num_unlinked());
+  EXPECT_EQ(0U, trash->num_pending());
+  EXPECT_EQ(0U, NumTrashFiles());
+
+  // Files that are already gone are harmless
+  trash->Add(hashes_[0]);
+  trash->WaitForEmpty();
+}
+
+
+TEST_F(T_QuotaTrash, NewCopy) {
+  // One file per second: the second file waits for its slot
+  UniquePtr<QuotaTrash> trash(QuotaTrash::Create(tmp_path_, 1, 1));
+  ASSERT_TRUE(trash.IsValid());
+  trash->Add(hashes_[0]);
+  trash->Add(hashes_[1]);
+  // The evicted file is out of the way immediately
+  EXPECT_FALSE(FileExists(Path(1)));
+  // A new copy committed before the unlink survives
+  CreateFile(Path(1), 0600);
+  trash->WaitForEmpty();
+  EXPECT_FALSE(FileExists(Path(0)));
+  EXPECT_TRUE(FileExists(Path(1)));
+  EXPECT_EQ(2U, trash->num_unlinked());
+  EXPECT_EQ(0U, NumTrashFiles());
+}
+
+
+TEST_F(T_QuotaTrash, ResumeAfterDestruction) {
+  QuotaTrash *trash = QuotaTrash::Create(tmp_path_, 2, 1);
+  ASSERT_TRUE(trash != NULL);
+  trash->Add(hashes_[0]);
+  trash->WaitForEmpty();
+  // The next batch waits for its slot
+  for (unsigned i = 1; i < 16; ++i)
+    trash->Add(hashes_[i]);
+  // Does not wait for the rate limit nor drain the queue
+  delete trash;
+  for (unsigned i = 0; i < 16; ++i)
+    EXPECT_FALSE(FileExists(Path(i)));
+  EXPECT_EQ(15U, NumTrashFiles());
+
+  trash = QuotaTrash::Create(tmp_path_, 2, 0);
+  ASSERT_TRUE(trash != NULL);
+  trash->WaitForEmpty();
+  EXPECT_EQ(0U, NumTrashFiles());
+  delete trash;
+}
+
+
+TEST_F(T_QuotaTrash, MissingDirectory) {
+  EXPECT_EQ(NULL, QuotaTrash::Create(tmp_path_ + "/noent", 1, 0));
+}
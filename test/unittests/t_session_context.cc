@@ -40,6 +40,38 @@ class SessionContextMocked : public upload::SessionContext {
   }
 };
 
+/**
+ * Uploads take a while, so that several of them overlap
+ */
+class SessionContextSlowMocked : public SessionContextMocked {
+ public:
+  SessionContextSlowMocked() {
+    atomic_init32(&num_uploads_);
+    atomic_init32(&num_in_flight_);
+    atomic_init32(&max_in_flight_);
+  }
+
+  atomic_int32 num_uploads_;
+  atomic_int32 num_in_flight_;
+  atomic_int32 max_in_flight_;
+
+ protected:
+  virtual bool DoUpload(const UploadJob* job) {
+    EXPECT_TRUE(job->curl_handle != NULL);
+    const int32_t in_flight = atomic_xadd32(&num_in_flight_, 1) + 1;
+    int32_t max_in_flight = atomic_read32(&max_in_flight_);
+    while ((in_flight > max_in_flight) &&
+           !atomic_cas32(&max_in_flight_, max_in_flight, in_flight))
+    {
+      max_in_flight = atomic_read32(&max_in_flight_);
+    }
+    SafeSleepMs(20);
+    atomic_dec32(&num_in_flight_);
+    atomic_inc32(&num_uploads_);
+    return true;
+  }
+};
+
 class T_SessionContext : public ::testing::Test {};
 
 TEST_F(T_SessionContext, BasicLifeCycle) {
@@ -218,6 +250,34 @@ TEST_F(T_SessionContext, EncounterFileWhichIsLargerThanExpected) {
   EXPECT_EQ(1, ctx.num_jobs_finished_);
 }
 
+TEST_F(T_SessionContext, ConcurrentUploads) {
+  SessionContextSlowMocked ctx;
+  EXPECT_TRUE(ctx.Initialize("http://my.repo.address:4929/api/v1",
+                             "/path/to/the/session_file", "some_key_id",
+                             "some_secret", 20000, 2, 4));
+
+  for (int i = 0; i < 10; ++i) {
+    ObjectPack::BucketHandle hd = ctx.NewBucket();
+
+    unsigned char buffer[4096];
+    memset(buffer, 0, 4096);
+    ObjectPack::AddToBucket(buffer, 4096, hd);
+
+    shash::Any hash(shash::kSha1);
+    EXPECT_TRUE(ctx.CommitBucket(ObjectPack::kCas, hash, hd, "", true));
+  }
+  ctx.WaitForUpload();
+  EXPECT_EQ(10, atomic_read32(&ctx.num_uploads_));
+  // Nothing new, must not block
+  ctx.WaitForUpload();
+  EXPECT_GT(atomic_read32(&ctx.max_in_flight_), 1);
+  EXPECT_LE(atomic_read32(&ctx.max_in_flight_), 4);
+
+  EXPECT_TRUE(ctx.Finalize(true, "fake/old_root_hash", "fake/new_root_hash",
+                           TestRepositoryTag()));
+  EXPECT_EQ(10, atomic_read32(&ctx.num_uploads_));
+}
+
 TEST_F(T_SessionContext, CurlUploadCallback) {
   ObjectPack pack(10000);
 
@@ -1134,3 +1134,52 @@ TEST(T_Shash, Sha256) {
     hash.c_str());
 #endif
 }
+
+
+TEST(T_Shash, UpdateMulti) {
+  // More streams than SIMD lanes with different lengths, some of them
+  // continue a partial block of a previous update
+  const unsigned kNumStreams = 19;
+  Prng prng;
+  prng.InitSeed(42);
+  string data[kNumStreams];
+  for (unsigned i = 0; i < kNumStreams; ++i) {
+    const unsigned size = (i == 0) ? 0 : prng.Next(3 * 16384);
+    for (unsigned j = 0; j < size; ++j)
+      data[i].push_back(static_cast<char>(prng.Next(256)));
+  }
+
+  const shash::CodePaths code_paths[] =
+    {shash::kCodePathAuto, shash::kCodePathSerial, shash::kCodePathLanes};
+  for (unsigned p = 0; p < 3; ++p) {
+    for (unsigned num_streams = 1; num_streams <= kNumStreams; ++num_streams) {
+      unsigned char context_buffers[kNumStreams][shash::kMaxContextSize];
+      shash::ContextPtr contexts[kNumStreams];
+      const unsigned char *buffers[kNumStreams];
+      unsigned buffer_sizes[kNumStreams];
+      for (unsigned i = 0; i < num_streams; ++i) {
+        const shash::Algorithms algorithm =
+          (i % 5 == 4) ? shash::kRmd160 : shash::kSha1;
+        contexts[i] = shash::ContextPtr(algorithm, context_buffers[i]);
+        shash::Init(contexts[i]);
+        const unsigned head = std::min(i % 3 * 17, unsigned(data[i].size()));
+        shash::Update(reinterpret_cast<const unsigned char *>(data[i].data()),
+                      head, contexts[i]);
+        buffers[i] =
+          reinterpret_cast<const unsigned char *>(data[i].data()) + head;
+        buffer_sizes[i] = data[i].size() - head;
+      }
+      shash::UpdateMulti(num_streams, buffers, buffer_sizes, contexts,
+                         code_paths[p]);
+
+      for (unsigned i = 0; i < num_streams; ++i) {
+        shash::Any result;
+        shash::Final(contexts[i], &result);
+        shash::Any expected(contexts[i].algorithm);
+        shash::HashString(data[i], &expected);
+        EXPECT_EQ(expected, result) << "code path " << code_paths[p]
+                                    << ", stream " << i << "/" << num_streams;
+      }
+    }
+  }
+}
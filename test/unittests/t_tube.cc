@@ -4,6 +4,10 @@
 
 #include "gtest/gtest.h"
 
+#include <pthread.h>
+
+#include <vector>
+
 #include "ingestion/tube.h"
 
 using namespace std;  // NOLINT
@@ -54,6 +58,23 @@ TEST_F(T_Tube, Fifo) {
 }
 
 
+TEST_F(T_Tube, TryPopFront) {
+  DummyItem a, b;
+  EXPECT_EQ(NULL, tube_.TryPopFront());
+  tube_.EnqueueBack(&a);
+  tube_.EnqueueBack(&b);
+  EXPECT_EQ(&a, tube_.TryPopFront());
+  EXPECT_EQ(&b, tube_.TryPopFront());
+  EXPECT_EQ(NULL, tube_.TryPopFront());
+
+  Tube<DummyItem> ring(4, kTubeRing);
+  EXPECT_EQ(NULL, ring.TryPopFront());
+  ring.EnqueueBack(&a);
+  EXPECT_EQ(&a, ring.TryPopFront());
+  EXPECT_EQ(NULL, ring.TryPopFront());
+}
+
+
 TEST_F(T_Tube, Group) {
   DummyItem a1, a2, b, c;
   a1.tag_ = a2.tag_ = 0;
@@ -89,3 +110,101 @@ TEST_F(T_Tube, Group) {
   x = t2->PopFront();  EXPECT_EQ(&c, x);
   x = t3->PopFront();  EXPECT_EQ(&b, x);
 }
+
+
+TEST_F(T_Tube, Ring) {
+  Tube<DummyItem> tube(3, kTubeRing);
+  DummyItem a, b, c, d;
+  EXPECT_TRUE(tube.IsEmpty());
+  EXPECT_EQ(NULL, tube.EnqueueBack(&a));
+  tube.EnqueueBack(&b);
+  tube.EnqueueBack(&c);
+  tube.EnqueueBack(&d);
+  EXPECT_EQ(4U, tube.size());
+  EXPECT_EQ(&a, tube.PopFront());
+  EXPECT_EQ(&b, tube.PopFront());
+  // Wraps around
+  tube.EnqueueBack(&a);
+  EXPECT_EQ(&c, tube.PopFront());
+  EXPECT_EQ(&d, tube.PopFront());
+  EXPECT_EQ(&a, tube.PopFront());
+  EXPECT_TRUE(tube.IsEmpty());
+  tube.Wait();
+}
+
+
+TEST_F(T_Tube, RingTry) {
+  TubeRing<DummyItem> ring(2);
+  DummyItem a, b, c;
+  EXPECT_EQ(2U, ring.capacity());
+  EXPECT_EQ(NULL, ring.TryDequeue());
+  EXPECT_TRUE(ring.TryEnqueue(&a));
+  EXPECT_TRUE(ring.TryEnqueue(&b));
+  EXPECT_FALSE(ring.TryEnqueue(&c));
+  EXPECT_EQ(&a, ring.TryDequeue());
+  EXPECT_TRUE(ring.TryEnqueue(&c));
+  EXPECT_EQ(&b, ring.TryDequeue());
+  EXPECT_EQ(&c, ring.TryDequeue());
+  EXPECT_EQ(NULL, ring.TryDequeue());
+}
+
+
+namespace {
+
+struct RingContext {
+  RingContext() : tube(16, kTubeRing), sum(0) { }
+  Tube<DummyItem> tube;
+  std::vector<DummyItem> items;
+  int64_t sum;
+};
+
+void *MainRingProducer(void *data) {
+  RingContext *ctx = reinterpret_cast<RingContext *>(data);
+  for (unsigned i = 0; i < ctx->items.size(); ++i)
+    ctx->tube.EnqueueBack(&ctx->items[i]);
+  return NULL;
+}
+
+void *MainRingConsumer(void *data) {
+  RingContext *ctx = reinterpret_cast<RingContext *>(data);
+  while (true) {
+    DummyItem *item = ctx->tube.PopFront();
+    if (item->tag_ < 0)
+      break;
+    __sync_fetch_and_add(&ctx->sum, item->tag_);
+  }
+  return NULL;
+}
+
+}  // anonymous namespace
+
+
+TEST_F(T_Tube, RingConcurrent) {
+  const unsigned kNumItems = 10000;
+  const unsigned kNumThreads = 4;
+  RingContext ctx;
+  ctx.items.resize(kNumItems);
+  int64_t expected = 0;
+  for (unsigned i = 0; i < kNumItems; ++i) {
+    ctx.items[i].tag_ = i;
+    expected += i;
+  }
+
+  pthread_t producers[kNumThreads];
+  pthread_t consumers[kNumThreads];
+  for (unsigned i = 0; i < kNumThreads; ++i) {
+    EXPECT_EQ(0, pthread_create(&consumers[i], NULL, MainRingConsumer, &ctx));
+    EXPECT_EQ(0, pthread_create(&producers[i], NULL, MainRingProducer, &ctx));
+  }
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(producers[i], NULL);
+  ctx.tube.Wait();
+
+  DummyItem quit_beacon;
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    ctx.tube.EnqueueBack(&quit_beacon);
+  for (unsigned i = 0; i < kNumThreads; ++i)
+    pthread_join(consumers[i], NULL);
+  EXPECT_TRUE(ctx.tube.IsEmpty());
+  EXPECT_EQ(kNumThreads * expected, ctx.sum);
+}
@@ -84,6 +84,7 @@ class T_Uploaders : public FileSandbox {
  public:
   static const unsigned kTotal429Replies;
   static const unsigned k429ThrottleSec;
+  static const unsigned kMultipartThreshold;
   static atomic_int64 gSeed;
   struct StreamHandle {
     StreamHandle() : handle(NULL), content_hash(shash::kMd5) {
@@ -371,8 +372,14 @@ class T_Uploaders : public FileSandbox {
     int *n429 = static_cast<int *>(data);
 
     HTTPResponse response;
-    // strip bucket name
+    // strip bucket name and query string
     std::string req_file = req.path.substr(req.path.find("/", 1) + 1);
+    std::string query;
+    const size_t pos_query = req_file.find('?');
+    if (pos_query != std::string::npos) {
+      query = req_file.substr(pos_query + 1);
+      req_file = req_file.substr(0, pos_query);
+    }
 
     if ((*n429 > 0) &&
         (req.path.size() >= 5) &&
@@ -381,6 +388,8 @@ class T_Uploaders : public FileSandbox {
       response.code = 429;
       response.reason = "Too Many Requests";
       response.AddHeader("Retry-After", "1");
+    } else if (!query.empty()) {
+      return S3MockupMultipartHandler(req, req_file, query);
     } else if (req.method == "PUT") {
       std::string path = T_Uploaders::dest_dir + "/" + req_file;
       FILE* file = fopen(path.c_str(), "w");
@@ -413,6 +422,94 @@ class T_Uploaders : public FileSandbox {
   }
 
 
+  /**
+   * Parts are stored next to the destination file as <file>.part<N> and
+   * concatenated when the upload is completed.
+   */
+  static HTTPResponse S3MockupMultipartHandler(const HTTPRequest &req,
+                                               const std::string &req_file,
+                                               const std::string &query)
+  {
+    HTTPResponse response;
+    const std::string path = T_Uploaders::dest_dir + "/" + req_file;
+    if ((req.method == "POST") && (query == "uploads")) {
+      response.body =
+        "<InitiateMultipartUploadResult><UploadId>mockup-upload-id"
+        "</UploadId></InitiateMultipartUploadResult>";
+    } else if (req.method == "PUT") {
+      // partNumber=<N>&uploadId=<id>
+      const std::string part_number =
+        SplitString(SplitString(query, '&')[0], '=')[1];
+      std::string copy_source;
+      std::string copy_range;
+      for (unsigned i = 0; i < req.headers.size(); ++i) {
+        if (req.headers[i].first == "x-amz-copy-source")
+          copy_source = req.headers[i].second;
+        if (req.headers[i].first == "x-amz-copy-source-range")
+          copy_range = req.headers[i].second;
+      }
+      if (copy_source.empty()) {
+        const bool retval = SafeWriteToFile(req.body.substr(
+          0, req.content_length), path + ".part" + part_number, 0600);
+        assert(retval);
+        response.AddHeader("ETag", "\"etag" + part_number + "\"");
+      } else {
+        // /<bucket>/<key>, bytes=<first>-<last>
+        copy_source = copy_source.substr(copy_source.find("/", 1) + 1);
+        const std::vector<std::string> range =
+          SplitString(SplitString(copy_range, '=')[1], '-');
+        const uint64_t first = String2Uint64(range[0]);
+        const uint64_t last = String2Uint64(range[1]);
+        int fd = open((T_Uploaders::dest_dir + "/" + copy_source).c_str(),
+                      O_RDONLY);
+        assert(fd >= 0);
+        std::string content;
+        bool retval = SafeReadToString(fd, &content);
+        assert(retval);
+        close(fd);
+        retval = SafeWriteToFile(content.substr(first, last - first + 1),
+                                 path + ".part" + part_number, 0600);
+        assert(retval);
+        response.body = "<CopyPartResult><ETag>\"etag" + part_number +
+                        "\"</ETag></CopyPartResult>";
+      }
+    } else if (req.method == "POST") {
+      FILE *file = fopen(path.c_str(), "w");
+      assert(file != NULL);
+      for (unsigned i = 1; ; ++i) {
+        const std::string part_path = path + ".part" + StringifyInt(i);
+        if (!FileExists(part_path))
+          break;
+        assert(req.body.find("<ETag>\"etag" + StringifyInt(i) + "\"</ETag>")
+               != std::string::npos);
+        int fd = open(part_path.c_str(), O_RDONLY);
+        assert(fd >= 0);
+        std::string content;
+        bool retval = SafeReadToString(fd, &content);
+        assert(retval);
+        close(fd);
+        retval = (fwrite(content.data(), 1, content.size(), file) ==
+                  content.size());
+        assert(retval);
+        unlink(part_path.c_str());
+      }
+      fclose(file);
+      response.body = "<CompleteMultipartUploadResult>"
+                      "</CompleteMultipartUploadResult>";
+    } else if (req.method == "DELETE") {
+      for (unsigned i = 1; ; ++i) {
+        const std::string part_path = path + ".part" + StringifyInt(i);
+        if (!FileExists(part_path))
+          break;
+        unlink(part_path.c_str());
+      }
+      response.code = 204;
+      response.reason = "No Content";
+    }
+    return response;
+  }
+
+
   void CreateTempS3ConfigFile(int accounts, int parallel_connections) {
     ASSERT_GE(accounts, 1);
     ASSERT_GE(parallel_connections, 1);
@@ -438,6 +535,11 @@ class T_Uploaders : public FileSandbox {
         StringifyInt(parallel_connections) + "\n"
         "CVMFS_S3_HOST=127.0.0.1\n"
         "CVMFS_S3_DNS_BUCKETS=false\n"
+        "CVMFS_S3_NUM_IO_THREADS=2\n"
+        "CVMFS_S3_MULTIPART_THRESHOLD=" + StringifyInt(kMultipartThreshold) +
+        "\n"
+        "CVMFS_S3_MULTIPART_PART_SIZE=" +
+        StringifyInt(s3fanout::S3FanoutManager::kMinMultipartPartSize) + "\n"
         "CVMFS_S3_PORT=" + StringifyInt(CVMFS_S3_TEST_MOCKUP_SERVER_PORT);
 
     fprintf(s3_conf, "%s\n", conf_str.c_str());
@@ -508,6 +610,10 @@ const unsigned T_Uploaders<UploadersT>::kTotal429Replies = 4;
 template <class UploadersT>
 const unsigned T_Uploaders<UploadersT>::k429ThrottleSec = 1;
 
+// Smaller than the huge file
+template <class UploadersT>
+const unsigned T_Uploaders<UploadersT>::kMultipartThreshold = 16 * 1024 * 1024;
+
 template <class UploadersT>
 const char T_Uploaders<UploadersT>::sandbox_path[] = "./cvmfs_ut_uploader";
 
@@ -733,6 +839,45 @@ TYPED_TEST(T_Uploaders, UploadHugeFileSlow) {
 //------------------------------------------------------------------------------
 
 
+TYPED_TEST(T_Uploaders, UploadMultipartSlow) {
+  if (!TestFixture::IsS3()) {
+    SUCCEED();  // Only the S3 uploader splits large objects
+    return;
+  }
+
+  const std::string huge_file_path = TestFixture::GetHugeFile();
+  const std::string dest_name     = "multipart_file";
+  const uint64_t num_parts =
+    (GetFileSize(huge_file_path) +
+     s3fanout::S3FanoutManager::kMinMultipartPartSize - 1) /
+    s3fanout::S3FanoutManager::kMinMultipartPartSize;
+  ASSERT_GT(num_parts, 1U);
+
+  upload::S3Uploader *s3uploader =
+    static_cast<upload::S3Uploader *>(this->uploader_);
+  this->uploader_->UploadFile(huge_file_path, dest_name,
+                              AbstractUploader::MakeClosure(
+                              &UploadCallbacks::SimpleUploadClosure,
+                              &this->delegate_,
+                              UploaderResults(0, huge_file_path)));
+  this->uploader_->WaitForUpload();
+
+  EXPECT_TRUE(TestFixture::CheckFile(dest_name));
+  EXPECT_EQ(1, atomic_read32(&(this->delegate_.simple_upload_invocations)));
+  TestFixture::CompareFileContents(huge_file_path,
+                                   TestFixture::AbsoluteDestinationPath(
+                                       dest_name));
+  EXPECT_FALSE(FileExists(
+    TestFixture::AbsoluteDestinationPath(dest_name) + ".part1"));
+  // Initiate, parts, complete
+  EXPECT_LE(num_parts + 2,
+            s3uploader->GetS3FanoutManager()->GetStatistics().num_requests);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 TYPED_TEST(T_Uploaders, UploadManyFilesSlow) {
   const int number_of_files = 500;
   typedef std::vector<std::pair<std::string, std::string> > Files;
@@ -846,6 +991,67 @@ TYPED_TEST(T_Uploaders, SingleStreamedUpload) {
 //------------------------------------------------------------------------------
 
 
+TYPED_TEST(T_Uploaders, StreamedMultipartUploadSlow) {
+  if (!TestFixture::IsS3()) {
+    SUCCEED();  // Only the S3 uploader stages large streamed objects
+    return;
+  }
+
+  const int number_of_buffers = 192;
+  typename TestFixture::Buffers buffers =
+      TestFixture::MakeRandomizedBuffers(number_of_buffers, 4711);
+  uint64_t size = 0;
+  for (unsigned i = 0; i < buffers.size(); ++i)
+    size += buffers[i]->length();
+  ASSERT_GT(size, TestFixture::kMultipartThreshold +
+                  s3fanout::S3FanoutManager::kMinMultipartPartSize);
+
+  UploadStreamHandle *handle = this->uploader_->InitStreamedUpload(
+      AbstractUploader::MakeClosure(&UploadCallbacks::StreamedUploadComplete,
+                                    &this->delegate_,
+                                    0));
+  ASSERT_NE(static_cast<UploadStreamHandle*>(NULL), handle);
+  for (unsigned i = 0; i < buffers.size(); ++i) {
+    this->uploader_->ScheduleUpload(
+      handle,
+      AbstractUploader::UploadBuffer(buffers[i]->length(),
+                                     const_cast<char *>(buffers[i]->data())),
+      AbstractUploader::MakeClosure(
+        &UploadCallbacks::BufferUploadComplete,
+        &this->delegate_,
+        UploaderResults(UploaderResults::kBufferUpload, 0)));
+  }
+  this->uploader_->WaitForUpload();
+
+  shash::Any content_hash(shash::kSha1, 'A');
+  content_hash.Randomize(42);
+  this->uploader_->ScheduleCommit(handle, content_hash);
+  this->uploader_->WaitForUpload();
+
+  EXPECT_EQ(number_of_buffers,
+    atomic_read32(&(this->delegate_.buffer_upload_complete_invocations)));
+  EXPECT_EQ(1,
+    atomic_read32(&(this->delegate_.streamed_upload_complete_invocations)));
+  EXPECT_EQ(0U, this->uploader_->GetNumberOfErrors());
+
+  const std::string dest = "data/" + content_hash.MakePath();
+  EXPECT_TRUE(TestFixture::CheckFile(dest));
+  TestFixture::CompareBuffersAndFileContents(
+      buffers,
+      TestFixture::AbsoluteDestinationPath(dest));
+
+  // The staging object is removed once it is copied
+  EXPECT_TRUE(FindFilesByPrefix(
+    TestFixture::AbsoluteDestinationPath("data/txn"),
+    StringifyInt(getpid()) + ".").empty());
+
+  TestFixture::FreeBuffers(&buffers);
+}
+
+
+//------------------------------------------------------------------------------
+
+
 TYPED_TEST(T_Uploaders, MultipleStreamedUploadSlow) {
   const int  number_of_files        = 100;
   const int  max_buffers_per_stream = 15;